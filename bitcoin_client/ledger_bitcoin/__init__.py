@@ -3,7 +3,13 @@
 
 from .client_base import Client, TransportClient, PartialSignature
 from .client import createClient
+from .capabilities import AppCapabilities, AppCapabilityFlag, AppLimit
+from .apdu_trace import ApduTrace, RecordingTransportClient, replay_trace
 from .common import Chain
+from .prepared_psbt import PreparedPsbt
+from .multi_device import MultiDeviceSignResult, sign_psbt_on_devices
+from .psbt_validation import PsbtIssue, validate_psbt
+from .response_cache import CachingClient, ResponseCache
 
 from .wallet import AddressType, WalletPolicy, MultisigWallet, WalletType
 
@@ -14,7 +20,20 @@ __all__ = [
     "TransportClient",
     "PartialSignature",
     "createClient",
+    "AppCapabilities",
+    "AppCapabilityFlag",
+    "AppLimit",
+    "ApduTrace",
+    "RecordingTransportClient",
+    "replay_trace",
     "Chain",
+    "PreparedPsbt",
+    "MultiDeviceSignResult",
+    "sign_psbt_on_devices",
+    "PsbtIssue",
+    "validate_psbt",
+    "CachingClient",
+    "ResponseCache",
     "AddressType",
     "WalletPolicy",
     "MultisigWallet",
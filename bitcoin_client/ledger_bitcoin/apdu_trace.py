@@ -0,0 +1,188 @@
+import time
+from dataclasses import dataclass, field
+from pathlib import Path
+from typing import List, Optional, Union
+
+from .client_base import ApduException, TransportClient
+from .common import ByteStreamParser, SW_OK, write_varint
+
+TRACE_MAGIC = b"APDUTRC\x01"
+
+
+@dataclass
+class TraceEvent:
+    """An APDU exchange: the APDU sent by the host, the response of the device, and when they happened, in
+    microseconds from the start of the recording."""
+
+    sent_at: int
+    received_at: int
+    cla: int
+    ins: int
+    p1: int
+    p2: int
+    data: bytes
+    sw: int
+    response: bytes
+
+    @property
+    def device_time(self) -> int:
+        """Microseconds between the APDU and the response, spent by the device and the transport."""
+        return self.received_at - self.sent_at
+
+
+@dataclass
+class ApduTrace:
+    """The APDU exchanges of a session, in order.
+
+    The trace is stored in a compact binary file: the magic `APDUTRC\\x01`, followed by an entry per exchange, where
+    the timestamps are varints relative to the previous timestamp, and the data and the response are prefixed by
+    their length as a varint.
+    """
+
+    events: List[TraceEvent] = field(default_factory=list)
+
+    def host_time(self, index: int) -> int:
+        """Microseconds between the response to the previous APDU and the APDU at `index`, spent by the host; for
+        example, to compute the answer to a client command."""
+        if index == 0:
+            return self.events[0].sent_at
+        return self.events[index].sent_at - self.events[index - 1].received_at
+
+    def serialize(self) -> bytes:
+        r = [TRACE_MAGIC]
+        last = 0
+        for e in self.events:
+            r.append(write_varint(e.sent_at - last) + write_varint(e.received_at - e.sent_at))
+            r.append(bytes([e.cla, e.ins, e.p1, e.p2]) + write_varint(len(e.data)) + e.data)
+            r.append(e.sw.to_bytes(2, byteorder="big") + write_varint(len(e.response)) + e.response)
+            last = e.received_at
+        return b"".join(r)
+
+    @classmethod
+    def deserialize(cls, serialized: bytes) -> 'ApduTrace':
+        if serialized[:len(TRACE_MAGIC)] != TRACE_MAGIC:
+            raise ValueError("Not an APDU trace")
+
+        parser = ByteStreamParser(serialized[len(TRACE_MAGIC):])
+        trace = cls()
+        last = 0
+        while parser.stream.tell() < len(serialized) - len(TRACE_MAGIC):
+            sent_at = last + parser.read_varint()
+            received_at = sent_at + parser.read_varint()
+            cla, ins, p1, p2 = parser.read_bytes(4)
+            data = parser.read_bytes(parser.read_varint())
+            sw = parser.read_uint(2)
+            response = parser.read_bytes(parser.read_varint())
+            trace.events.append(TraceEvent(sent_at, received_at, cla, ins, p1, p2, data, sw, response))
+            last = received_at
+        return trace
+
+    def save(self, path: Union[str, Path]) -> None:
+        Path(path).write_bytes(self.serialize())
+
+    @classmethod
+    def load(cls, path: Union[str, Path]) -> 'ApduTrace':
+        return cls.deserialize(Path(path).read_bytes())
+
+
+class RecordingTransportClient(TransportClient):
+    """Wraps a `TransportClient`, and records all the APDU exchanges with their timestamps in `trace`.
+
+    It can be passed to `createClient` in place of the wrapped transport client; since the client commands of the
+    device are answered with APDUs, the trace contains the complete session, including the responses computed
+    by the host."""
+
+    def __init__(self, transport_client: TransportClient):
+        self.transport_client = transport_client
+        self.trace = ApduTrace()
+        self.start = time.perf_counter_ns()
+
+    def _now(self) -> int:
+        return (time.perf_counter_ns() - self.start) // 1000
+
+    def apdu_exchange(self, cla: int, ins: int, data: bytes = b"", p1: int = 0, p2: int = 0) -> bytes:
+        sent_at = self._now()
+        try:
+            response = self.transport_client.apdu_exchange(cla, ins, data, p1, p2)
+        except ApduException as e:
+            self.trace.events.append(TraceEvent(sent_at, self._now(), cla, ins, p1, p2, data, e.sw, e.data))
+            raise
+        self.trace.events.append(TraceEvent(sent_at, self._now(), cla, ins, p1, p2, data, SW_OK, response))
+        return response
+
+    def stop(self) -> None:
+        self.transport_client.stop()
+
+
+@dataclass
+class ReplayEvent:
+    """An exchange of a replay: the recorded exchange, and the response of the device to the same APDU."""
+
+    recorded: TraceEvent
+    sw: int
+    response: bytes
+    device_time: int  # microseconds
+
+    @property
+    def matches(self) -> bool:
+        return self.sw == self.recorded.sw and self.response == self.recorded.response
+
+
+@dataclass
+class ReplayResult:
+    events: List[ReplayEvent] = field(default_factory=list)
+
+    @property
+    def first_mismatch(self) -> Optional[int]:
+        """The index of the first exchange where the device responded differently than in the recording."""
+        return next((i for i, e in enumerate(self.events) if not e.matches), None)
+
+
+def replay_trace(transport_client: TransportClient, trace: ApduTrace, paced: bool = False,
+                 stop_on_mismatch: bool = True) -> ReplayResult:
+    """Sends the APDUs of `trace` to the device, in order, and records its responses.
+
+    The APDUs answering the client commands are the ones that the host sent in the recording; they are only
+    meaningful as long as the device asks the same questions, therefore the replay stops at the first response
+    that differs from the recording, unless `stop_on_mismatch` is False.
+
+    Parameters
+    ----------
+    transport_client : TransportClient
+        The transport of the device, or of Speculos, to replay the trace on.
+
+    trace : ApduTrace
+        The recorded trace.
+
+    paced : bool
+        If True, waits before each APDU for the time the host took in the recording; otherwise, the APDUs are
+        sent as fast as possible, and the replay only measures the time of the device.
+
+    stop_on_mismatch : bool
+        Whether to stop the replay at the first response that differs from the recording.
+
+    Returns
+    -------
+    ReplayResult
+        The responses of the device, and the time it took for each of them.
+    """
+
+    result = ReplayResult()
+    for i, recorded in enumerate(trace.events):
+        if paced:
+            time.sleep(trace.host_time(i) / 1_000_000)
+
+        start = time.perf_counter_ns()
+        try:
+            sw, response = SW_OK, transport_client.apdu_exchange(recorded.cla, recorded.ins, recorded.data,
+                                                                 recorded.p1, recorded.p2)
+        except ApduException as e:
+            sw, response = e.sw, e.data
+        device_time = (time.perf_counter_ns() - start) // 1000
+
+        event = ReplayEvent(recorded, sw, response, device_time)
+        result.events.append(event)
+        if stop_on_mismatch and not event.matches:
+            break
+
+    return result
@@ -0,0 +1,83 @@
+from dataclasses import dataclass, field
+from io import BytesIO
+from typing import Dict, Optional
+import enum
+
+from .common import read_uint
+
+# format of the response of GET_APP_CAPABILITIES
+APP_CAPABILITIES_FORMAT = 1
+
+
+class AppCapabilityFlag(enum.IntFlag):
+    PERF_BUILD = 0x01
+    HIGH_LATENCY_TRANSPORT = 0x02
+
+
+class AppLimit(enum.IntEnum):
+    MAX_CONTINUE_LENGTH = 0x01
+    MAX_RESPONSE_LENGTH = 0x02
+    MAX_MERKLEIZED_MAP_VALUES_PER_REQUEST = 0x03
+    MAX_MULTI_REQUEST_SUBREQUESTS = 0x04
+    MAX_N_PSBTS_IN_BATCH = 0x05
+    MAX_WITHDRAW_BATCH_SIZE = 0x06
+    MAX_N_INPUTS_CAN_SIGN = 0x07
+    MAX_N_OUTPUTS_CAN_SIGN = 0x08
+    MAX_N_KEYS_IN_WALLET_POLICY = 0x09
+    WALLET_POLICY_CACHE_SIZE = 0x10
+    VALIDATED_PSBT_CACHE_SIZE = 0x11
+    XPUB_CACHE_SIZE = 0x12
+    MERKLE_NODE_CACHE_SIZE = 0x13
+    MERKLEIZED_MAP_CACHE_SIZE = 0x14
+    MAP_CONTENTS_CACHE_BYTES = 0x15
+    RAWTX_CACHE_SIZE = 0x16
+
+
+@dataclass
+class AppCapabilities:
+    """The protocol version and the client commands supported by the running app, and the limits of the device, as
+    returned by GET_APP_CAPABILITIES.
+
+    `limits` maps the identifier of each limit to its value; the identifiers that are not in `AppLimit` (returned by
+    newer apps) are kept as plain integers.
+    """
+
+    max_protocol_version: int
+    client_commands: int
+    flags: AppCapabilityFlag
+    limits: Dict[int, int] = field(default_factory=dict)
+
+    def supports_client_command(self, code: int) -> bool:
+        """Returns True if the app can send the client command with the given code (from 0x40)."""
+        return 0x40 <= code < 0x60 and (self.client_commands >> (code - 0x40)) & 1 == 1
+
+    def limit(self, limit_id: int, default: Optional[int] = None) -> Optional[int]:
+        return self.limits.get(limit_id, default)
+
+    @classmethod
+    def deserialize(cls, data: bytes) -> "AppCapabilities":
+        r = BytesIO(data)
+        try:
+            fmt = read_uint(r, 8)
+            if fmt != APP_CAPABILITIES_FORMAT:
+                raise ValueError(f"unsupported format {fmt}")
+
+            max_protocol_version = read_uint(r, 8)
+            client_commands = read_uint(r, 32, byteorder='big')
+            flags = AppCapabilityFlag(read_uint(r, 8))
+
+            limits: Dict[int, int] = {}
+            for _ in range(read_uint(r, 8)):
+                limit_id = read_uint(r, 8)
+                value = read_uint(r, 32, byteorder='big')
+                try:
+                    limits[AppLimit(limit_id)] = value
+                except ValueError:
+                    limits[limit_id] = value
+        except ValueError as e:
+            raise ValueError(f"Invalid capabilities: {e}") from e
+
+        if r.read() != b'':
+            raise ValueError("Invalid capabilities: unexpected trailing data")
+
+        return cls(max_protocol_version, client_commands, flags, limits)
@@ -1,44 +1,63 @@
+from functools import lru_cache
 from packaging.version import parse as parse_version
-from typing import Tuple, List, Mapping, Optional, Union
+from typing import Iterator, Tuple, List, Optional, Sequence, Union
 import base64
-import math
-from io import BytesIO, BufferedReader
+from io import BytesIO
 
 from .embit.base import EmbitError 
 from .embit.descriptor import Descriptor
+from .embit.descriptor.arguments import AllowedDerivation, KeyOrigin
 from .embit.networks import NETWORKS
 
-from .command_builder import BitcoinCommandBuilder, BitcoinInsType
-from .common import Chain, read_uint, read_varint, SW_OK, SW_INTERRUPTED_EXECUTION
+from .capabilities import AppCapabilities, AppLimit
+from .command_builder import BitcoinCommandBuilder, BitcoinInsType, MAX_APDU_DATA_LENGTH, MAX_EXTENDED_CONTINUE_LENGTH, MAX_WITHDRAW_BATCH_SIZE, \
+    SIGN_PSBT_MODE_SIGN, SIGN_PSBT_MODE_CHECKPOINT, SIGN_PSBT_MODE_RESUME, SIGN_PSBT_MODE_BATCH, SIGN_PSBT_FLAG_LOW_R, SIGN_PSBT_CHECKPOINT_LENGTH, \
+    SIGN_PSBT_BATCH_REVIEW_EACH, SIGN_PSBT_BATCH_REVIEW_COMBINED, MAX_N_INPUTS_CAN_SIGN, MAX_N_PSBTS_IN_BATCH, \
+    MAX_CHUNKS_PER_LEAF, CURRENT_PROTOCOL_VERSION, PROTOCOL_VERSION_EXTENDED_CONTINUE, PROTOCOL_VERSION_CHUNKS_PER_LEAF, \
+    message_leaves
+from .common import Chain, bip32_path_from_string, read_uint, read_varint, write_varint, sha256, SW_OK, SW_INTERRUPTED_EXECUTION, \
+    SW_RESPONSE_HAS_MORE, SW_INS_NOT_SUPPORTED
 from .client_command import ClientCommandInterpreter
 from .client_base import Client, TransportClient, PartialSignature
 from .client_legacy import LegacyClient
 from .exception import DeviceException
 from .errors import UnknownDeviceError
-from .merkle import get_merkleized_map_commitment
 from .wallet import WalletPolicy, WalletType
-from .psbt import PSBT, normalize_psbt
+from .prepared_psbt import PreparedPsbt
+from .psbt import PSBT
 from .withdraw import AcreWithdrawalData
 from . import segwit_addr
-from ._serialize import deser_string
 
 
-def parse_stream_to_map(f: BufferedReader) -> Mapping[bytes, bytes]:
-    result = {}
-    while True:
-        try:
-            key = deser_string(f)
-        except Exception:
-            break
+@lru_cache(maxsize=64)
+def _parse_descriptor_for_derivation(desc_str: str) -> Optional[Descriptor]:
+    """Parses a descriptor whose keys end with /<index>/*, and derives the /<index> step of each key once, so that
+    deriving each address only derives the last step. Returns None if embit does not support the descriptor.
+
+    The result is cached, and must not be modified."""
+
+    try:
+        desc = Descriptor.from_string(desc_str)
+    except EmbitError:
+        return None
 
-        # Check for separator
-        if len(key) == 0:
-            break
+    for key in desc.keys:
+        if key.allowed_derivation is None:
+            continue
 
-        value = deser_string(f)
+        indexes = key.allowed_derivation.indexes
+        if len(indexes) < 2 or indexes[-1] is not None or not all(isinstance(i, int) for i in indexes[:-1]):
+            continue
 
-        result[key] = value
-    return result
+        prefix = indexes[:-1]
+        if key.origin is not None:
+            key.origin = KeyOrigin(key.origin.fingerprint, key.origin.derivation + prefix)
+        else:
+            key.origin = KeyOrigin(key.key.my_fingerprint, prefix)
+        key.key = key.key.derive(prefix)
+        key.allowed_derivation = AllowedDerivation([None])
+
+    return desc
 
 
 def _make_partial_signature(pubkey_augm: bytes, signature: bytes) -> PartialSignature:
@@ -66,20 +85,53 @@ class NewClient(Client):
         super().__init__(comm_client, chain, debug)
         self.builder = BitcoinCommandBuilder()
 
+        # the parameters of the protocol; they are lowered by negotiate_capabilities() for older apps and smaller
+        # targets, and otherwise match the current version of the app
+        self.capabilities: Optional[AppCapabilities] = None
+        self.max_continue_length = MAX_EXTENDED_CONTINUE_LENGTH
+        self.chunks_per_leaf = MAX_CHUNKS_PER_LEAF
+        self.max_n_psbts_in_batch = MAX_N_PSBTS_IN_BATCH
+        self.max_withdraw_batch_size = MAX_WITHDRAW_BATCH_SIZE
+        self.max_n_inputs_can_sign = MAX_N_INPUTS_CAN_SIGN
+
+    # Modifies the behavior of the base method by reading all the chunks of the responses that do not fit in a single
+    # APDU (supported since version 6 of the protocol)
+    def _apdu_exchange(self, apdu: dict) -> Tuple[int, bytes]:
+        sw, response = super()._apdu_exchange(apdu)
+
+        while sw & 0xFF00 == SW_RESPONSE_HAS_MORE:
+            sw, next_chunk = super()._apdu_exchange(self.builder.get_response())
+            response += next_chunk
+
+        return sw, response
+
     # Modifies the behavior of the base method by taking care of SW_INTERRUPTED_EXECUTION responses
     def _make_request(
         self, apdu: dict, client_intepreter: ClientCommandInterpreter = None
     ) -> Tuple[int, bytes]:
         sw, response = self._apdu_exchange(apdu)
 
+        # the same CONTINUE APDU is reused for all the responses that fit in a single APDU
+        continue_apdu = self.builder.continue_interrupted(b"")
+
         while sw == SW_INTERRUPTED_EXECUTION:
             if not client_intepreter:
                 raise RuntimeError("Unexpected SW_INTERRUPTED_EXECUTION received.")
 
             command_response = client_intepreter.execute(response)
-            sw, response = self._apdu_exchange(
-                self.builder.continue_interrupted(command_response)
-            )
+
+            # responses that do not fit in a single APDU are split across multiple CONTINUE APDUs
+            while len(command_response) > MAX_APDU_DATA_LENGTH:
+                sw, response = self._apdu_exchange(
+                    self.builder.continue_interrupted(
+                        command_response[:MAX_APDU_DATA_LENGTH], has_more=True)
+                )
+                if sw != SW_OK:
+                    return sw, response
+                command_response = command_response[MAX_APDU_DATA_LENGTH:]
+
+            continue_apdu["data"] = command_response
+            sw, response = self._apdu_exchange(continue_apdu)
 
         return sw, response
 
@@ -91,11 +143,55 @@ class NewClient(Client):
 
         return response.decode()
 
+    def get_extended_pubkeys(self, paths: List[str]) -> List[str]:
+        # pack as many paths as fit in each APDU; each path takes 1 byte for its length and 4 bytes
+        # per derivation step, after the initial 'display' byte
+        batches: List[List[str]] = []
+        batch_len = MAX_APDU_DATA_LENGTH
+        for path in paths:
+            path_len = 1 + 4 * len(bip32_path_from_string(path))
+            if batch_len + path_len > MAX_APDU_DATA_LENGTH:
+                batches.append([])
+                batch_len = 1
+            batches[-1].append(path)
+            batch_len += path_len
+
+        results: List[str] = []
+        for batch in batches:
+            if len(batch) == 1:
+                # a single path is not a batch, and the xpub is returned directly
+                results.append(self.get_extended_pubkey(batch[0], False))
+                continue
+
+            client_intepreter = ClientCommandInterpreter(self.max_continue_length, self.builder.protocol_version)
+            sw, _ = self._make_request(self.builder.get_extended_pubkeys(batch), client_intepreter)
+
+            if sw != SW_OK:
+                raise DeviceException(error_code=sw, ins=BitcoinInsType.GET_EXTENDED_PUBKEY)
+
+            # each YIELD message contains one or more xpubs, each prefixed by its length
+            batch_results: List[str] = []
+            for yielded in client_intepreter.yielded:
+                yielded_buffer = BytesIO(yielded)
+                while yielded_buffer.tell() < len(yielded):
+                    xpub_len = read_uint(yielded_buffer, 8)
+                    xpub = yielded_buffer.read(xpub_len)
+                    if len(xpub) != xpub_len:
+                        raise RuntimeError("Invalid response")
+                    batch_results.append(xpub.decode())
+
+            if len(batch_results) != len(batch):
+                raise RuntimeError("Invalid response")
+
+            results.extend(batch_results)
+
+        return results
+
     def register_wallet(self, wallet: WalletPolicy) -> Tuple[bytes, bytes]:
         if wallet.version not in [WalletType.WALLET_POLICY_V1, WalletType.WALLET_POLICY_V2]:
             raise ValueError("invalid wallet policy version")
 
-        client_intepreter = ClientCommandInterpreter()
+        client_intepreter = ClientCommandInterpreter(self.max_continue_length, self.builder.protocol_version)
         client_intepreter.add_known_preimage(wallet.serialize())
         client_intepreter.add_known_list([k.encode() for k in wallet.keys_info])
 
@@ -138,7 +234,7 @@ class NewClient(Client):
         if change != 0 and change != 1:
             raise ValueError("Invalid change")
 
-        client_intepreter = ClientCommandInterpreter()
+        client_intepreter = ClientCommandInterpreter(self.max_continue_length, self.builder.protocol_version)
         client_intepreter.add_known_list([k.encode() for k in wallet.keys_info])
         client_intepreter.add_known_preimage(wallet.serialize())
 
@@ -164,88 +260,215 @@ class NewClient(Client):
 
         return result
 
-    def sign_psbt(self, psbt: Union[PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac: Optional[bytes]) -> List[Tuple[int, PartialSignature]]:
-
-        psbt = normalize_psbt(psbt)
-
-        if psbt.version != 2:
-            if self._no_clone_psbt:
-                psbt.convert_to_v2()
-                psbt_v2 = psbt
-            else:
-                psbt_v2 = PSBT()
-                psbt_v2.deserialize(psbt.serialize())  # clone psbt
-                psbt_v2.convert_to_v2()
-        else:
-            psbt_v2 = psbt
+    def get_wallet_addresses(
+        self,
+        wallet: WalletPolicy,
+        wallet_hmac: Optional[bytes],
+        change: int,
+        start_index: int,
+        count: int,
+    ) -> List[str]:
 
-        psbt_bytes = base64.b64decode(psbt_v2.serialize())
-        f = BytesIO(psbt_bytes)
+        if not isinstance(wallet, WalletPolicy) or wallet.version not in [WalletType.WALLET_POLICY_V1, WalletType.WALLET_POLICY_V2]:
+            raise ValueError("wallet type must be WalletPolicy, with version either WALLET_POLICY_V1 or WALLET_POLICY_V2")
 
-        # We parse the individual maps (global map, each input map, and each output map) from the psbt serialized as a
-        # sequence of bytes, in order to produce the serialized Merkleized map commitments. Moreover, we prepare the
-        # client interpreter to respond on queries on all the relevant Merkle trees and pre-images in the psbt.
+        if change != 0 and change != 1:
+            raise ValueError("Invalid change")
 
-        assert f.read(5) == b"psbt\xff"
+        if count < 1:
+            raise ValueError("Invalid count")
 
-        client_intepreter = ClientCommandInterpreter()
+        client_intepreter = ClientCommandInterpreter(self.max_continue_length, self.builder.protocol_version)
         client_intepreter.add_known_list([k.encode() for k in wallet.keys_info])
         client_intepreter.add_known_preimage(wallet.serialize())
 
         # necessary for version 1 of the protocol (introduced in version 2.1.0)
         client_intepreter.add_known_preimage(wallet.descriptor_template.encode())
 
-        global_map: Mapping[bytes, bytes] = parse_stream_to_map(f)
-        client_intepreter.add_known_mapping(global_map)
+        sw, _ = self._make_request(
+            self.builder.get_wallet_address(
+                wallet, wallet_hmac, start_index, change, False, count
+            ),
+            client_intepreter,
+        )
+
+        if sw != SW_OK:
+            raise DeviceException(error_code=sw, ins=BitcoinInsType.GET_WALLET_ADDRESS)
 
-        input_maps: List[Mapping[bytes, bytes]] = []
-        for _ in range(len(psbt_v2.inputs)):
-            input_maps.append(parse_stream_to_map(f))
-        for m in input_maps:
-            client_intepreter.add_known_mapping(m)
+        # each YIELD message contains one or more addresses, each prefixed by its length
+        results: List[str] = []
+        for batch in client_intepreter.yielded:
+            batch_buffer = BytesIO(batch)
+            while batch_buffer.tell() < len(batch):
+                address_len = read_uint(batch_buffer, 8)
+                address = batch_buffer.read(address_len)
+                if len(address) != address_len:
+                    raise RuntimeError("Invalid response")
+                results.append(address.decode())
+
+        if len(results) != count:
+            raise RuntimeError("Invalid response")
 
-        output_maps: List[Mapping[bytes, bytes]] = []
-        for _ in range(len(psbt_v2.outputs)):
-            output_maps.append(parse_stream_to_map(f))
-        for m in output_maps:
-            client_intepreter.add_known_mapping(m)
+        # sanity check: for miniscripts, derive the addresses independently with python-bip380
+        for i, result in enumerate(results):
+            if result != self._derive_address_for_policy(wallet, change, start_index + i):
+                raise RuntimeError("Invalid address. Please update your Bitcoin app. If the problem persists, report a bug at https://github.com/LedgerHQ/app-bitcoin-new")
 
-        # We also add the Merkle tree of the input (resp. output) map commitments as a known tree
-        input_commitments = [get_merkleized_map_commitment(m_in) for m_in in input_maps]
-        output_commitments = [get_merkleized_map_commitment(m_out) for m_out in output_maps]
+        return results
 
-        client_intepreter.add_known_list(input_commitments)
-        client_intepreter.add_known_list(output_commitments)
+    def prepare_psbt(self, psbt: Union[PSBT, bytes, str], wallet: WalletPolicy) -> PreparedPsbt:
+        return PreparedPsbt(psbt, wallet, clone=not self._no_clone_psbt)
 
-        sw, _ = self._make_request(
-            self.builder.sign_psbt(
-                global_map, input_maps, output_maps, wallet, wallet_hmac
-            ),
+    def _get_prepared_psbt(self, psbt: Union[PreparedPsbt, PSBT, bytes, str], wallet: WalletPolicy) -> PreparedPsbt:
+        if not isinstance(psbt, PreparedPsbt):
+            return self.prepare_psbt(psbt, wallet)
+
+        if psbt.wallet_id != wallet.id:
+            raise ValueError("The PSBT was prepared for a different wallet policy")
+        return psbt
+
+    def _sign_psbt_request(self, prepared: PreparedPsbt, wallet: WalletPolicy, wallet_hmac: Optional[bytes],
+                           mode_data: bytes = b"", extra_preimage: Optional[bytes] = None) -> Tuple[bytes, List[bytes]]:
+        """Sends a SIGN_PSBT request, and returns its response and the messages yielded by the device."""
+
+        client_intepreter = ClientCommandInterpreter(self.max_continue_length, self.builder.protocol_version)
+        client_intepreter.add_known_data(prepared.known_preimages, prepared.known_trees)
+
+        # the checkpoint and the input mask are requested by their hash
+        if extra_preimage is not None:
+            client_intepreter.add_known_preimage(extra_preimage)
+
+        sw, response = self._make_request(
+            self.builder.sign_psbt_with_commitment(prepared.psbt_commitment, wallet, wallet_hmac, mode_data),
             client_intepreter,
         )
 
         if sw != SW_OK:
             raise DeviceException(error_code=sw, ins=BitcoinInsType.SIGN_PSBT)
 
-        # parse results and return a structured version instead
-        results = client_intepreter.yielded
+        return response, client_intepreter.yielded
+
+    @staticmethod
+    def _split_sign_psbt_results(results: List[bytes]) -> Iterator[BytesIO]:
+        """Returns each result in the messages yielded by SIGN_PSBT."""
 
         if any(len(x) <= 1 for x in results):
             raise RuntimeError("Invalid response")
 
-        results_list: List[Tuple[int, PartialSignature]] = []
-        for res in results:
-            res_buffer = BytesIO(res)
-            input_index = read_varint(res_buffer)
+        for batch in results:
+            # each YIELD message contains one or more results, each prefixed by its length
+            batch_buffer = BytesIO(batch)
+            while batch_buffer.tell() < len(batch):
+                res_len = read_uint(batch_buffer, 8)
+                res = batch_buffer.read(res_len)
+                if len(res) != res_len:
+                    raise RuntimeError("Invalid response")
+
+                yield BytesIO(res)
+
+    @staticmethod
+    def _read_sign_psbt_result(res_buffer: BytesIO) -> Tuple[int, PartialSignature]:
+        input_index = read_varint(res_buffer)
+
+        pubkey_augm_len = read_uint(res_buffer, 8)
+        pubkey_augm = res_buffer.read(pubkey_augm_len)
+
+        signature = res_buffer.read()
+
+        return input_index, _make_partial_signature(pubkey_augm, signature)
+
+    @staticmethod
+    def _parse_sign_psbt_results(results: List[bytes]) -> List[Tuple[int, PartialSignature]]:
+        return [NewClient._read_sign_psbt_result(res) for res in NewClient._split_sign_psbt_results(results)]
+
+    @staticmethod
+    def _make_input_mask(inputs_to_sign: Sequence[int], begin: int, end: int) -> bytes:
+        """Returns the bitvector of the inputs between `begin` and `end` that the device should try to sign."""
+
+        mask = bytearray((end - begin + 7) // 8)
+        for i in inputs_to_sign:
+            if not begin <= i < end:
+                raise ValueError(f"Input index {i} out of range")
+            mask[(i - begin) // 8] |= 0x80 >> ((i - begin) % 8)
+        return bytes(mask)
+
+    @staticmethod
+    def _mode_byte(mode: int, low_r: bool) -> bytes:
+        return bytes([(mode | SIGN_PSBT_FLAG_LOW_R) if low_r else mode])
+
+    def sign_psbt(self, psbt: Union[PreparedPsbt, PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac: Optional[bytes],
+                  inputs_to_sign: Optional[Sequence[int]] = None, low_r: bool = False) -> List[Tuple[int, PartialSignature]]:
+        prepared = self._get_prepared_psbt(psbt, wallet)
+        if inputs_to_sign is None:
+            # without the mode byte, for compatibility with the versions of the app that do not know it
+            mode_data = self._mode_byte(SIGN_PSBT_MODE_SIGN, low_r) if low_r else b""
+            _, results = self._sign_psbt_request(prepared, wallet, wallet_hmac, mode_data)
+        else:
+            input_mask = self._make_input_mask(inputs_to_sign, 0, prepared.n_inputs)
+            mode_data = self._mode_byte(SIGN_PSBT_MODE_SIGN, low_r) + sha256(input_mask)
+            _, results = self._sign_psbt_request(prepared, wallet, wallet_hmac, mode_data, input_mask)
+        return self._parse_sign_psbt_results(results)
+
+    def sign_psbt_checkpoint(self, psbt: Union[PreparedPsbt, PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac: Optional[bytes]) -> bytes:
+        prepared = self._get_prepared_psbt(psbt, wallet)
+        checkpoint, _ = self._sign_psbt_request(prepared, wallet, wallet_hmac, bytes([SIGN_PSBT_MODE_CHECKPOINT]))
+
+        if len(checkpoint) != SIGN_PSBT_CHECKPOINT_LENGTH:
+            raise RuntimeError("Invalid response")
 
-            pubkey_augm_len = read_uint(res_buffer, 8)
-            pubkey_augm = res_buffer.read(pubkey_augm_len)
+        return checkpoint
 
-            signature = res_buffer.read()
+    def sign_psbt_resume(self, psbt: Union[PreparedPsbt, PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac: Optional[bytes],
+                         checkpoint: bytes, begin: int, end: int,
+                         inputs_to_sign: Optional[Sequence[int]] = None, low_r: bool = False) -> List[Tuple[int, PartialSignature]]:
+        if not 0 <= begin < end or end - begin > self.max_n_inputs_can_sign:
+            raise ValueError(f"Between 1 and {self.max_n_inputs_can_sign} inputs can be signed at once")
 
-            results_list.append((input_index, _make_partial_signature(pubkey_augm, signature)))
+        # the input mask, if any, is sent after the checkpoint
+        preimage = checkpoint
+        if inputs_to_sign is not None:
+            preimage += self._make_input_mask(inputs_to_sign, begin, end)
 
-        return results_list
+        mode_data = self._mode_byte(SIGN_PSBT_MODE_RESUME, low_r) + begin.to_bytes(4, byteorder="big") + \
+            end.to_bytes(4, byteorder="big") + sha256(preimage)
+        prepared = self._get_prepared_psbt(psbt, wallet)
+        _, results = self._sign_psbt_request(prepared, wallet, wallet_hmac, mode_data, preimage)
+        return self._parse_sign_psbt_results(results)
+
+    def sign_psbt_batch(self, psbts: Sequence[Union[PreparedPsbt, PSBT, bytes, str]], wallet: WalletPolicy,
+                        wallet_hmac: Optional[bytes], combined_review: bool = False,
+                        low_r: bool = False) -> List[List[Tuple[int, PartialSignature]]]:
+        if not 1 <= len(psbts) <= self.max_n_psbts_in_batch:
+            raise ValueError(f"Between 1 and {self.max_n_psbts_in_batch} PSBTs can be signed at once")
+
+        prepared = [self._get_prepared_psbt(psbt, wallet) for psbt in psbts]
+
+        client_intepreter = ClientCommandInterpreter(self.max_continue_length, self.builder.protocol_version)
+        for p in prepared:
+            client_intepreter.add_known_data(p.known_preimages, p.known_trees)
+        psbts_root = client_intepreter.add_known_list([p.psbt_commitment for p in prepared])
+
+        # the first PSBT is also in the request, as for a single PSBT
+        review = SIGN_PSBT_BATCH_REVIEW_COMBINED if combined_review else SIGN_PSBT_BATCH_REVIEW_EACH
+        mode_data = self._mode_byte(SIGN_PSBT_MODE_BATCH, low_r) + bytes([review]) + write_varint(len(prepared)) + psbts_root
+
+        sw, _ = self._make_request(
+            self.builder.sign_psbt_with_commitment(prepared[0].psbt_commitment, wallet, wallet_hmac, mode_data),
+            client_intepreter,
+        )
+
+        if sw != SW_OK:
+            raise DeviceException(error_code=sw, ins=BitcoinInsType.SIGN_PSBT)
+
+        # in a batch, each result starts with the index of its PSBT
+        results_lists: List[List[Tuple[int, PartialSignature]]] = [[] for _ in prepared]
+        for res in self._split_sign_psbt_results(client_intepreter.yielded):
+            psbt_index = read_varint(res)
+            if psbt_index >= len(prepared):
+                raise RuntimeError("Invalid response")
+            results_lists[psbt_index].append(self._read_sign_psbt_result(res))
+
+        return results_lists
 
     def get_master_fingerprint(self) -> bytes:
         sw, response = self._make_request(self.builder.get_master_fingerprint())
@@ -255,18 +478,64 @@ class NewClient(Client):
 
         return response
 
+    def get_app_capabilities(self) -> AppCapabilities:
+        capabilities = self._get_app_capabilities()
+
+        if capabilities is None:
+            raise DeviceException(error_code=SW_INS_NOT_SUPPORTED, ins=BitcoinInsType.GET_APP_CAPABILITIES)
+
+        return capabilities
+
+    # Returns None if the app does not implement GET_APP_CAPABILITIES
+    def _get_app_capabilities(self) -> Optional[AppCapabilities]:
+        sw, response = self._make_request(self.builder.get_app_capabilities())
+
+        if sw == SW_INS_NOT_SUPPORTED:
+            return None
+        if sw != SW_OK:
+            raise DeviceException(error_code=sw, ins=BitcoinInsType.GET_APP_CAPABILITIES)
+
+        return AppCapabilities.deserialize(response)
+
+    def negotiate_capabilities(self) -> Optional[AppCapabilities]:
+        """Queries the capabilities of the app, and adapts the protocol version and the limits used by the client.
+
+        Apps that do not implement GET_APP_CAPABILITIES are assumed to support the current protocol version, and
+        the default limits are kept; in that case, None is returned.
+        """
+
+        capabilities = self._get_app_capabilities()
+        if capabilities is None:
+            return None
+
+        self.capabilities = capabilities
+
+        version = min(CURRENT_PROTOCOL_VERSION, capabilities.max_protocol_version)
+        self.builder.protocol_version = version
+
+        if version < PROTOCOL_VERSION_EXTENDED_CONTINUE:
+            self.max_continue_length = MAX_APDU_DATA_LENGTH
+        else:
+            self.max_continue_length = capabilities.limit(AppLimit.MAX_CONTINUE_LENGTH, MAX_EXTENDED_CONTINUE_LENGTH)
+
+        self.chunks_per_leaf = MAX_CHUNKS_PER_LEAF if version >= PROTOCOL_VERSION_CHUNKS_PER_LEAF else 1
+
+        self.max_n_psbts_in_batch = capabilities.limit(AppLimit.MAX_N_PSBTS_IN_BATCH, MAX_N_PSBTS_IN_BATCH)
+        self.max_withdraw_batch_size = capabilities.limit(AppLimit.MAX_WITHDRAW_BATCH_SIZE, MAX_WITHDRAW_BATCH_SIZE)
+        self.max_n_inputs_can_sign = capabilities.limit(AppLimit.MAX_N_INPUTS_CAN_SIGN, MAX_N_INPUTS_CAN_SIGN)
+
+        return capabilities
+
     def sign_message(self, message: Union[str, bytes], bip32_path: str) -> str:
         if isinstance(message, str):
             message_bytes = message.encode("utf-8")
         else:
             message_bytes = message
 
-        chunks = [message_bytes[64 * i: 64 * i + 64] for i in range((len(message_bytes) + 63) // 64)]
+        client_intepreter = ClientCommandInterpreter(self.max_continue_length, self.builder.protocol_version)
+        client_intepreter.add_known_list(message_leaves(message_bytes, self.chunks_per_leaf))
 
-        client_intepreter = ClientCommandInterpreter()
-        client_intepreter.add_known_list(chunks)
-
-        sw, response = self._make_request(self.builder.sign_message(message_bytes, bip32_path), client_intepreter)
+        sw, response = self._make_request(self.builder.sign_message(message_bytes, bip32_path, self.chunks_per_leaf), client_intepreter)
 
         if sw != SW_OK:
             raise DeviceException(error_code=sw, ins=BitcoinInsType.SIGN_MESSAGE)
@@ -275,39 +544,45 @@ class NewClient(Client):
     
     def sign_withdraw(self, data: AcreWithdrawalData, bip32_path: str) -> str:
         data_bytes = data.to_bytes()
-        chunks = []
 
-        # Chunk 0: to[20] + gasToken[20] + refundReceiver[20]
-        chunks.append(data_bytes.to + data_bytes.gasToken + data_bytes.refundReceiver)
+        client_intepreter = ClientCommandInterpreter(self.max_continue_length, self.builder.protocol_version)
+        client_intepreter.add_known_list(data_bytes.to_leaves(self.chunks_per_leaf))
 
-        # Chunk 1: value[32] + safeTxGas[32]
-        chunks.append(data_bytes.value + data_bytes.safeTxGas)
+        sw, response = self._make_request(self.builder.sign_withdraw(data_bytes, bip32_path, self.chunks_per_leaf), client_intepreter)
 
-        # Chunk 2: baseGas[32] + gasPrice[32]
-        chunks.append(data_bytes.baseGas + data_bytes.gasPrice)
+        if sw != SW_OK:
+            raise DeviceException(error_code=sw, ins=BitcoinInsType.SIGN_WITHDRAW)
 
-        # Chunk 3: nonce[32] + operation[1]
-        chunks.append(data_bytes.nonce + data_bytes.operation)
+        return base64.b64encode(response).decode('utf-8')
+
+    def sign_withdrawals(self, data: List[AcreWithdrawalData], bip32_path: str) -> List[str]:
+        """Signs several withdrawals with the key at the same BIP32 path, in a single command.
+        Each withdrawal is reviewed on the device; the signatures are returned in the same order.
+        """
 
-        # Chunk 4: data_selector[4] (the first 4 bytes of data)
-        chunks.append(data_bytes.data[:4])
+        if not 1 <= len(data) <= self.max_withdraw_batch_size:
+            raise ValueError(f"Between 1 and {self.max_withdraw_batch_size} withdrawals can be signed at once")
 
-        # Calculate the number of 64-byte chunks needed for the remaining data
-        n_chunks_data = math.ceil((len(data_bytes.data) - 4) / 64)
+        if len(data) == 1:
+            return [self.sign_withdraw(data[0], bip32_path)]
 
-        # Chunk 5 to n: data[64]
-        for i in range(n_chunks_data):
-            chunks.append(data_bytes.data[4 + 64 * i: 4 + 64 * (i + 1)])
+        data_bytes_list = [d.to_bytes() for d in data]
 
-        client_intepreter = ClientCommandInterpreter()
-        client_intepreter.add_known_list(chunks)
+        client_intepreter = ClientCommandInterpreter(self.max_continue_length, self.builder.protocol_version)
+        for data_bytes in data_bytes_list:
+            client_intepreter.add_known_list(data_bytes.to_leaves(self.chunks_per_leaf))
 
-        sw, response = self._make_request(self.builder.sign_withdraw(data_bytes, bip32_path), client_intepreter)
+        sw, _ = self._make_request(self.builder.sign_withdrawals(data_bytes_list, bip32_path, self.chunks_per_leaf), client_intepreter)
 
         if sw != SW_OK:
             raise DeviceException(error_code=sw, ins=BitcoinInsType.SIGN_WITHDRAW)
 
-        return base64.b64encode(response).decode('utf-8')
+        # each YIELD message contains the 65-byte signature of one withdrawal
+        signatures = client_intepreter.yielded
+        if len(signatures) != len(data) or any(len(sig) != 65 for sig in signatures):
+            raise RuntimeError("Invalid response")
+
+        return [base64.b64encode(sig).decode('utf-8') for sig in signatures]
     
     def sign_erc4361_message(self, message: Union[str, bytes], bip32_path: str) -> str:
         if isinstance(message, str):
@@ -315,12 +590,10 @@ class NewClient(Client):
         else:
             message_bytes = message
 
-        chunks = [message_bytes[64 * i: 64 * i + 64] for i in range((len(message_bytes) + 63) // 64)]
-
-        client_intepreter = ClientCommandInterpreter()
-        client_intepreter.add_known_list(chunks)
+        client_intepreter = ClientCommandInterpreter(self.max_continue_length, self.builder.protocol_version)
+        client_intepreter.add_known_list(message_leaves(message_bytes, self.chunks_per_leaf))
 
-        sw, response = self._make_request(self.builder.sign_erc4361_message(message_bytes, bip32_path), client_intepreter)
+        sw, response = self._make_request(self.builder.sign_erc4361_message(message_bytes, bip32_path, self.chunks_per_leaf), client_intepreter)
 
         if sw != SW_OK:
             raise DeviceException(error_code=sw, ins=BitcoinInsType.SIGN_ERC4361_MESSAGE)
@@ -328,10 +601,11 @@ class NewClient(Client):
         return base64.b64encode(response).decode('utf-8')
 
     def _derive_address_for_policy(self, wallet: WalletPolicy, change: bool, address_index: int) -> Optional[str]:
-        desc_str = wallet.get_descriptor(change)
-        try:
-            desc = Descriptor.from_string(desc_str)
+        desc = _parse_descriptor_for_derivation(wallet.get_descriptor(change))
+        if desc is None:
+            return None
 
+        try:
             desc = desc.derive(address_index)
             net = NETWORKS['main'] if self.chain == Chain.MAIN else NETWORKS['test']
             return desc.script_pubkey().address(net)
@@ -339,8 +613,18 @@ class NewClient(Client):
             return None
 
 
-def createClient(comm_client: Optional[TransportClient] = None, chain: Chain = Chain.MAIN, debug: bool = False) -> Union[LegacyClient, NewClient]:
+def createClient(comm_client: Optional[TransportClient] = None, chain: Chain = Chain.MAIN, debug: bool = False,
+                 negotiate: bool = True) -> Union[LegacyClient, NewClient]:
+    """Creates a client for the app running on the device.
+
+    If `negotiate` is True, the client queries the capabilities of the app (see `NewClient.negotiate_capabilities`)
+    and uses the most recent protocol version and the largest batches that the app supports.
+    """
+
     if comm_client is None:
         comm_client = TransportClient("hid")
 
-    return NewClient(comm_client, chain, debug)
+    client = NewClient(comm_client, chain, debug)
+    if negotiate:
+        client.negotiate_capabilities()
+    return client
@@ -1,5 +1,5 @@
 from dataclasses import dataclass
-from typing import List, Tuple, Optional, Union, Literal
+from typing import List, Tuple, Optional, Sequence, Union, Literal
 from io import BytesIO
 
 from ledgercomm.interfaces.hid_device import HID
@@ -12,6 +12,7 @@ from .command_builder import DefaultInsType
 from .exception import DeviceException
 
 from .wallet import WalletPolicy
+from .prepared_psbt import PreparedPsbt
 from .psbt import PSBT
 from ._serialize import deser_string
 
@@ -33,7 +34,7 @@ class TransportClient:
     def apdu_exchange(
         self, cla: int, ins: int, data: bytes = b"", p1: int = 0, p2: int = 0
     ) -> bytes:
-        sw, data = self.transport.exchange(cla, ins, p1, p2, None, data)
+        sw, data = self.transport.exchange_apdu(cla, ins, p1, p2, data)
 
         if sw != SW_OK:
             raise ApduException(sw, data)
@@ -165,6 +166,23 @@ class Client:
 
         raise NotImplementedError
 
+    def get_extended_pubkeys(self, paths: List[str]) -> List[str]:
+        """Gets the serialized extended public keys for several BIP32 paths, without displaying them on the device.
+        All the paths must be standard.
+
+        Parameters
+        ----------
+        paths : List[str]
+            BIP32 paths of the public keys you want.
+
+        Returns
+        -------
+        List[str]
+            The requested serialized extended public keys, in the same order as `paths`.
+        """
+
+        raise NotImplementedError
+
     def register_wallet(self, wallet: WalletPolicy) -> Tuple[bytes, bytes]:
         """Registers a wallet policy with the user. After approval returns the wallet id and hmac to be stored on the client.
 
@@ -218,19 +236,81 @@ class Client:
 
         raise NotImplementedError
 
-    def sign_psbt(self, psbt: Union[PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac: Optional[bytes]) -> List[Tuple[int, PartialSignature]]:
+    def get_wallet_addresses(
+        self,
+        wallet: WalletPolicy,
+        wallet_hmac: Optional[bytes],
+        change: int,
+        start_index: int,
+        count: int,
+    ) -> List[str]:
+        """For a given wallet that was already registered on the device (or a standard wallet that does not need registration),
+        returns the addresses for the consecutive address indexes in the range [`start_index`, `start_index + count`), without
+        displaying them on the device.
+
+        Parameters
+        ----------
+        wallet : WalletPolicy
+            The registered wallet policy, or a standard wallet policy.
+
+        wallet_hmac: Optional[bytes]
+            For a registered wallet, the hmac obtained at wallet registration. `None` for a standard wallet policy.
+
+        change: int
+            0 for standard receive addresses, 1 for change addresses. Other values are invalid.
+
+        start_index: int
+            The address index of the first address.
+
+        count: int
+            The number of addresses to return; it must be at least 1.
+
+        Returns
+        -------
+        List[str]
+            The requested addresses, in order of address index.
+        """
+
+        raise NotImplementedError
+
+    def prepare_psbt(self, psbt: Union[PSBT, bytes, str], wallet: WalletPolicy) -> PreparedPsbt:
+        """Computes the commitments of a PSBT, and all the data the hardware wallet might request about it, once.
+
+        The result can be passed to `sign_psbt`, `sign_psbt_checkpoint` and `sign_psbt_resume` in place of the PSBT,
+        with the same wallet policy, so that retrying or resuming the signature does not recompute them. The PSBT
+        must not be modified afterwards.
+
+        Parameters
+        ----------
+        psbt : PSBT | bytes | str
+            The PSBT, as in `sign_psbt`.
+
+        wallet : WalletPolicy
+            The registered wallet policy, or a standard wallet policy, that will be used to sign the PSBT.
+
+        Returns
+        -------
+        PreparedPsbt
+            The prepared PSBT.
+        """
+
+        raise NotImplementedError
+
+    def sign_psbt(self, psbt: Union[PreparedPsbt, PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac: Optional[bytes],
+                  inputs_to_sign: Optional[Sequence[int]] = None, low_r: bool = False) -> List[Tuple[int, PartialSignature]]:
         """Signs a PSBT using a registered wallet (or a standard wallet that does not need registration).
 
         Signature requires explicit approval from the user.
 
         Parameters
         ----------
-        psbt : PSBT | bytes | str
+        psbt : PreparedPsbt | PSBT | bytes | str
             A PSBT of version 0 or 2, with all the necessary information to sign the inputs already filled in; what the
             required fields changes depending on the type of input.
             The non-witness UTXO must be present for both legacy and SegWit inputs, or the hardware wallet will reject
             signing (this will change for Taproot inputs).
-            The argument can be either a `PSBT` object, or `bytes`, or a base64-encoded `str`.
+            The argument can be either a `PSBT` object, or `bytes`, or a base64-encoded `str`, or the `PreparedPsbt`
+            returned by `prepare_psbt` for the same wallet policy.
 
         wallet : WalletPolicy
             The registered wallet policy, or a standard wallet policy.
@@ -238,6 +318,16 @@ class Client:
         wallet_hmac: Optional[bytes]
             For a registered wallet, the hmac obtained at wallet registration. `None` for a standard wallet policy.
 
+        inputs_to_sign : Optional[Sequence[int]]
+            If given, the indices of the only inputs that can be internal; the hardware wallet treats all the other
+            inputs as external, without checking if they match the wallet policy. At most 512 inputs are supported.
+
+        low_r : bool
+            If True, the hardware wallet grinds the nonce of each ECDSA signature until its R is low, as Bitcoin Core
+            does, so that the signatures are at most 71 bytes long (including the sighash byte) instead of 72 bytes
+            for about half of them. Each signature then takes on average twice as long to compute. Schnorr
+            signatures are not affected.
+
         Returns
         -------
         List[Tuple[int, PartialSignature]]
@@ -248,6 +338,106 @@ class Client:
 
         raise NotImplementedError
 
+    def sign_psbt_checkpoint(self, psbt: Union[PreparedPsbt, PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac: Optional[bytes]) -> bytes:
+        """Validates a PSBT with the user, as `sign_psbt` does, but returns a checkpoint instead of signing it.
+
+        The checkpoint allows signing the inputs of a PSBT with more inputs than can be signed at once, with
+        multiple calls to `sign_psbt_resume` that do not require the user's approval again.
+
+        Parameters
+        ----------
+        psbt : PreparedPsbt | PSBT | bytes | str
+            The PSBT, as in `sign_psbt`.
+
+        wallet : WalletPolicy
+            The registered wallet policy, or a standard wallet policy.
+
+        wallet_hmac: Optional[bytes]
+            For a registered wallet, the hmac obtained at wallet registration. `None` for a standard wallet policy.
+
+        Returns
+        -------
+        bytes
+            The checkpoint, authenticated by the hardware wallet. It is only valid for this PSBT and wallet policy.
+        """
+
+        raise NotImplementedError
+
+    def sign_psbt_resume(self, psbt: Union[PreparedPsbt, PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac: Optional[bytes],
+                         checkpoint: bytes, begin: int, end: int,
+                         inputs_to_sign: Optional[Sequence[int]] = None, low_r: bool = False) -> List[Tuple[int, PartialSignature]]:
+        """Signs the internal inputs of a PSBT with index between `begin` (included) and `end` (excluded), using a
+        checkpoint returned by `sign_psbt_checkpoint` for the same PSBT and wallet policy.
+
+        Parameters
+        ----------
+        psbt : PreparedPsbt | PSBT | bytes | str
+            The PSBT, exactly as passed to `sign_psbt_checkpoint`; preparing it once with `prepare_psbt` avoids
+            recomputing its commitments for each range of inputs.
+
+        wallet : WalletPolicy
+            The registered wallet policy, or a standard wallet policy.
+
+        wallet_hmac: Optional[bytes]
+            For a registered wallet, the hmac obtained at wallet registration. `None` for a standard wallet policy.
+
+        checkpoint : bytes
+            The checkpoint returned by `sign_psbt_checkpoint`.
+
+        begin : int
+            The index of the first input to sign.
+
+        end : int
+            The index after the last input to sign; at most 512 inputs can be signed at once.
+
+        inputs_to_sign : Optional[Sequence[int]]
+            If given, the indices of the only inputs in the range that can be internal, as in `sign_psbt`.
+
+        low_r : bool
+            Whether the ECDSA signatures are ground to have a low R, as in `sign_psbt`.
+
+        Returns
+        -------
+        List[Tuple[int, PartialSignature]]
+            The signatures of the internal inputs in the range, as in `sign_psbt`.
+        """
+
+        raise NotImplementedError
+
+    def sign_psbt_batch(self, psbts: Sequence[Union[PreparedPsbt, PSBT, bytes, str]], wallet: WalletPolicy,
+                        wallet_hmac: Optional[bytes], combined_review: bool = False,
+                        low_r: bool = False) -> List[List[Tuple[int, PartialSignature]]]:
+        """Signs several PSBTs with the same wallet policy in a single command.
+
+        The wallet policy is loaded and verified once for the whole batch, and the derived keys are shared by all the
+        PSBTs. Each PSBT is reviewed and approved separately, unless `combined_review` is True: then the external
+        outputs of all the PSBTs are shown one after the other, and the user approves the total fees of the batch once.
+
+        Parameters
+        ----------
+        psbts : Sequence[PreparedPsbt | PSBT | bytes | str]
+            Between 1 and 32 PSBTs, each as in `sign_psbt`.
+
+        wallet : WalletPolicy
+            The registered wallet policy, or a standard wallet policy.
+
+        wallet_hmac: Optional[bytes]
+            For a registered wallet, the hmac obtained at wallet registration. `None` for a standard wallet policy.
+
+        combined_review : bool
+            Whether the user approves all the PSBTs at once, rather than each of them.
+
+        low_r : bool
+            Whether the ECDSA signatures are ground to have a low R, as in `sign_psbt`.
+
+        Returns
+        -------
+        List[List[Tuple[int, PartialSignature]]]
+            For each PSBT, in the same order, its signatures as returned by `sign_psbt`.
+        """
+
+        raise NotImplementedError
+
     def get_master_fingerprint(self) -> bytes:
         """Gets the fingerprint of the master public key, as per BIP-32.
 
@@ -1,20 +1,71 @@
+from concurrent.futures import ThreadPoolExecutor
 from enum import IntEnum
-from typing import List, Mapping
+from typing import List, Mapping, Optional, Sequence, Tuple, Union
 from collections import deque
-from hashlib import sha256
+import hashlib
 
 from .common import ByteStreamParser, sha256, write_varint
-from .merkle import MerkleTree, element_hash
+from .merkle import MerkleTree
+from .command_builder import CURRENT_PROTOCOL_VERSION, PROTOCOL_VERSION_MERKLE_LEAF_ELEMENT, \
+    PROTOCOL_VERSION_MERKLE_LEAF_RANGE, PROTOCOL_VERSION_HINT_MERKLE_LEAVES, PROTOCOL_VERSION_MULTI_REQUEST, \
+    PROTOCOL_VERSION_MERKLEIZED_MAP_VALUES, PROTOCOL_VERSION_MERKLE_LEAF_HASHES
+
+
+# preimages from this length are hashed in parallel threads, as hashlib releases the GIL while hashing them
+PARALLEL_HASH_MIN_LEN = 4096
+# the minimum total length of such preimages for the threads to be worth it
+PARALLEL_HASH_MIN_TOTAL_LEN = 1 << 20
+
+
+def hash_preimages(preimages: Sequence[bytes], max_workers: Optional[int] = None) -> List[bytes]:
+    """Returns the sha256 of each preimage.
+
+    The short preimages are hashed in a single loop; if the long ones (from `PARALLEL_HASH_MIN_LEN`
+    bytes, like the non-witness UTXOs of a PSBT) add up to `PARALLEL_HASH_MIN_TOTAL_LEN` bytes, they are
+    hashed in parallel threads, at most `max_workers` as in `ThreadPoolExecutor`."""
+
+    h = hashlib.sha256
+    hashes: List[Optional[bytes]] = [h(p).digest() if len(p) < PARALLEL_HASH_MIN_LEN else None for p in preimages]
+
+    long_indices = [i for i, digest in enumerate(hashes) if digest is None]
+    if len(long_indices) > 1 and sum(len(preimages[i]) for i in long_indices) >= PARALLEL_HASH_MIN_TOTAL_LEN:
+        with ThreadPoolExecutor(max_workers=max_workers) as executor:
+            long_hashes = list(executor.map(lambda i: h(preimages[i]).digest(), long_indices))
+    else:
+        long_hashes = [h(preimages[i]).digest() for i in long_indices]
+
+    for i, digest in zip(long_indices, long_hashes):
+        hashes[i] = digest
+    return hashes  # type: ignore[return-value]
 
 
 class ClientCommandCode(IntEnum):
     YIELD = 0x10
+    DEFERRED_YIELD = 0x11  # not a command: the prefix of a YIELD message sent with the next command
     GET_PREIMAGE = 0x40
     GET_MERKLE_LEAF_PROOF = 0x41
     GET_MERKLE_LEAF_INDEX = 0x42
+    GET_MERKLE_LEAF_ELEMENT = 0x43
+    GET_MERKLE_LEAF_RANGE = 0x44
+    HINT_MERKLE_LEAVES = 0x45
+    GET_MERKLEIZED_MAP_VALUES = 0x46
+    MULTI_REQUEST = 0x47
+    GET_MERKLE_LEAF_HASHES = 0x48
     GET_MORE_ELEMENTS = 0xA0
 
 
+# the first protocol version that supports each client command; the app does not send a command to
+# a client of an older version
+MIN_PROTOCOL_VERSION = {
+    ClientCommandCode.GET_MERKLE_LEAF_ELEMENT: PROTOCOL_VERSION_MERKLE_LEAF_ELEMENT,
+    ClientCommandCode.GET_MERKLE_LEAF_RANGE: PROTOCOL_VERSION_MERKLE_LEAF_RANGE,
+    ClientCommandCode.HINT_MERKLE_LEAVES: PROTOCOL_VERSION_HINT_MERKLE_LEAVES,
+    ClientCommandCode.GET_MERKLEIZED_MAP_VALUES: PROTOCOL_VERSION_MERKLEIZED_MAP_VALUES,
+    ClientCommandCode.MULTI_REQUEST: PROTOCOL_VERSION_MULTI_REQUEST,
+    ClientCommandCode.GET_MERKLE_LEAF_HASHES: PROTOCOL_VERSION_MERKLE_LEAF_HASHES,
+}
+
+
 class ClientCommand:
     def execute(self, request: bytes) -> bytes:
         raise NotImplementedError("Subclasses should implement this method.")
@@ -37,8 +88,29 @@ class YieldCommand(ClientCommand):
         return b""
 
 
+class ByteRun:
+    """A sequence of bytes in the queue of GET_MORE_ELEMENTS, returned as elements of length 1.
+
+    The bytes that do not fit in a response are queued as a single run, rather than as one element per byte; each
+    GET_MORE_ELEMENTS response then contains slices of the run, in groups of at most 255 bytes."""
+
+    def __init__(self, data: bytes):
+        self.data = data
+        self.offset = 0
+
+    def __len__(self) -> int:
+        """Return the number of bytes not yet returned."""
+        return len(self.data) - self.offset
+
+    def take(self, n: int) -> bytes:
+        """Return the next `n` bytes at most, and remove them from the run."""
+        chunk = self.data[self.offset:self.offset + n]
+        self.offset += len(chunk)
+        return chunk
+
+
 class GetPreimageCommand(ClientCommand):
-    def __init__(self, known_preimages: Mapping[bytes, bytes], queue: "deque[bytes]"):
+    def __init__(self, known_preimages: Mapping[bytes, bytes], queue: "deque[Union[bytes, ByteRun]]"):
         self.queue = queue
         self.known_preimages = known_preimages
 
@@ -68,13 +140,8 @@ class GetPreimageCommand(ClientCommand):
             payload_size = min(max_payload_size, len(known_preimage))
 
             if payload_size < len(known_preimage):
-                # split into list of length-1 bytes elements
-                extra_elements = [
-                    known_preimage[i: i + 1]
-                    for i in range(payload_size, len(known_preimage))
-                ]
                 # add to the queue any remaining extra bytes
-                self.queue.extend(extra_elements)
+                self.queue.append(ByteRun(known_preimage[payload_size:]))
 
             return (
                 preimage_len_out
@@ -86,10 +153,51 @@ class GetPreimageCommand(ClientCommand):
         raise RuntimeError(f"Requested unknown preimage for: {req_hash.hex()}")
 
 
+def get_leaf_proof(mt: MerkleTree, root: bytes, leaf_index: int,
+                   prepared_proofs: Mapping[Tuple[bytes, int], List[bytes]]) -> List[bytes]:
+    """Returns the proof for a leaf, using the one prepared after a HINT_MERKLE_LEAVES command if any."""
+
+    proof = prepared_proofs.pop((root, leaf_index), None)
+    if proof is None:
+        proof = mt.prove_leaf(leaf_index)
+    return proof
+
+
+class HintMerkleLeavesCommand(ClientCommand):
+    def __init__(self, known_trees: Mapping[bytes, MerkleTree],
+                 prepared_proofs: Mapping[Tuple[bytes, int], List[bytes]]):
+        self.known_trees = known_trees
+        self.prepared_proofs = prepared_proofs
+
+    @property
+    def code(self) -> int:
+        return ClientCommandCode.HINT_MERKLE_LEAVES
+
+    def execute(self, request: bytes) -> bytes:
+        req = ByteStreamParser(request[1:])
+
+        root = req.read_bytes(32)
+        tree_size = req.read_varint()
+        begin = req.read_varint()
+        n_leaves = req.read_varint()
+        req.assert_empty()
+
+        # This is only a hint: unknown trees or invalid ranges are not an error, as the actual
+        # requests will be validated when they arrive.
+        mt = self.known_trees.get(root)
+        if mt is not None and len(mt) == tree_size and begin + n_leaves <= tree_size:
+            for leaf_index in range(begin, begin + n_leaves):
+                self.prepared_proofs[(root, leaf_index)] = mt.prove_leaf(leaf_index)
+
+        return b""
+
+
 class GetMerkleLeafProofCommand(ClientCommand):
-    def __init__(self, known_trees: Mapping[bytes, MerkleTree], queue: "deque[bytes]"):
+    def __init__(self, known_trees: Mapping[bytes, MerkleTree], queue: "deque[Union[bytes, ByteRun]]",
+                 prepared_proofs: Optional[Mapping[Tuple[bytes, int], List[bytes]]] = None):
         self.queue = queue
         self.known_trees = known_trees
+        self.prepared_proofs = prepared_proofs if prepared_proofs is not None else {}
 
     @property
     def code(self) -> int:
@@ -116,7 +224,7 @@ class GetMerkleLeafProofCommand(ClientCommand):
                 "This command should not execute when the queue is not empty."
             )
 
-        proof = mt.prove_leaf(leaf_index)
+        proof = get_leaf_proof(mt, root, leaf_index, self.prepared_proofs)
 
         # Compute how many elements we can fit in 255 - 32 - 1 - 1 = 221 bytes
         n_response_elements = min((255 - 32 - 1 - 1) // 32, len(proof))
@@ -164,9 +272,352 @@ class GetMerkleLeafIndexCommand(ClientCommand):
         return found.to_bytes(1, byteorder="big") + write_varint(leaf_index)
 
 
+class GetMerkleLeafElementCommand(ClientCommand):
+    def __init__(self, known_trees: Mapping[bytes, MerkleTree], known_preimages: Mapping[bytes, bytes],
+                 prepared_proofs: Optional[Mapping[Tuple[bytes, int], List[bytes]]] = None):
+        self.known_trees = known_trees
+        self.known_preimages = known_preimages
+        self.prepared_proofs = prepared_proofs if prepared_proofs is not None else {}
+
+    @property
+    def code(self) -> int:
+        return ClientCommandCode.GET_MERKLE_LEAF_ELEMENT
+
+    def execute(self, request: bytes) -> bytes:
+        req = ByteStreamParser(request[1:])
+
+        root = req.read_bytes(32)
+        tree_size = req.read_varint()
+        leaf_index = req.read_varint()
+        req.assert_empty()
+
+        if not root in self.known_trees:
+            raise ValueError(f"Unknown Merkle root: {root.hex()}.")
+
+        mt: MerkleTree = self.known_trees[root]
+
+        if leaf_index >= tree_size or len(mt) != tree_size:
+            raise ValueError(f"Invalid index or tree size.")
+
+        leaf_hash = mt.get(leaf_index)
+        if leaf_hash not in self.known_preimages:
+            raise RuntimeError(f"Requested unknown preimage for: {leaf_hash.hex()}")
+
+        element = self.known_preimages[leaf_hash][1:]  # skip the b'\0' prefix
+        proof = get_leaf_proof(mt, root, leaf_index, self.prepared_proofs)
+
+        response = b"".join(
+            [
+                b'\1',
+                len(proof).to_bytes(1, byteorder="big"),
+                *proof,
+                write_varint(len(element)),
+                element,
+            ]
+        )
+
+        if len(response) > 255:
+            # does not fit in a single response; the hardware wallet will fall back to
+            # GET_MERKLE_LEAF_PROOF and GET_PREIMAGE
+            return b'\0'
+
+        return response
+
+
+class GetMerkleLeafRangeCommand(ClientCommand):
+    def __init__(self, known_trees: Mapping[bytes, MerkleTree], known_preimages: Mapping[bytes, bytes], queue: "deque[Union[bytes, ByteRun]]"):
+        self.known_trees = known_trees
+        self.known_preimages = known_preimages
+        self.queue = queue
+
+    @property
+    def code(self) -> int:
+        return ClientCommandCode.GET_MERKLE_LEAF_RANGE
+
+    def execute(self, request: bytes) -> bytes:
+        req = ByteStreamParser(request[1:])
+
+        root = req.read_bytes(32)
+        tree_size = req.read_varint()
+        begin = req.read_varint()
+        n_leaves = req.read_varint()
+        req.assert_empty()
+
+        if not root in self.known_trees:
+            raise ValueError(f"Unknown Merkle root: {root.hex()}.")
+
+        mt: MerkleTree = self.known_trees[root]
+
+        end = begin + n_leaves
+        if not (0 <= begin < end <= tree_size) or len(mt) != tree_size:
+            raise ValueError(f"Invalid range or tree size.")
+
+        if len(self.queue) != 0:
+            raise RuntimeError(
+                "This command should not execute when the queue is not empty."
+            )
+
+        # The answer lists the proof hashes and the leaves in the order of a depth-first traversal
+        answer = bytearray()
+        leaf_index = begin
+        for proof_hash in mt.prove_range(begin, end):
+            if proof_hash is not None:
+                answer.extend(proof_hash)
+            else:
+                leaf_hash = mt.get(leaf_index)
+                if leaf_hash not in self.known_preimages:
+                    raise RuntimeError(f"Requested unknown preimage for: {leaf_hash.hex()}")
+
+                element = self.known_preimages[leaf_hash][1:]  # skip the b'\0' prefix
+                answer.extend(write_varint(len(element)))
+                answer.extend(element)
+                leaf_index += 1
+
+        answer_len_out = write_varint(len(answer))
+
+        # Same as for GET_PREIMAGE, the bytes that do not fit in the response are stored for
+        # GET_MORE_ELEMENTS
+        max_payload_size = 255 - len(answer_len_out) - 1
+
+        payload_size = min(max_payload_size, len(answer))
+
+        if payload_size < len(answer):
+            self.queue.append(ByteRun(bytes(answer[payload_size:])))
+
+        return (
+            answer_len_out
+            + payload_size.to_bytes(1, byteorder="big")
+            + bytes(answer[:payload_size])
+        )
+
+
+class GetMerkleizedMapValuesCommand(ClientCommand):
+    def __init__(self, known_trees: Mapping[bytes, MerkleTree], known_preimages: Mapping[bytes, bytes], queue: "deque[Union[bytes, ByteRun]]"):
+        self.known_trees = known_trees
+        self.known_preimages = known_preimages
+        self.queue = queue
+
+    @property
+    def code(self) -> int:
+        return ClientCommandCode.GET_MERKLEIZED_MAP_VALUES
+
+    def execute(self, request: bytes) -> bytes:
+        req = ByteStreamParser(request[1:])
+
+        keys_root = req.read_bytes(32)
+        values_root = req.read_bytes(32)
+        size = req.read_varint()
+        n_keys = req.read_uint(1)
+        key_hashes = [req.read_bytes(32) for _ in range(n_keys)]
+        req.assert_empty()
+
+        for root in [keys_root, values_root]:
+            if not root in self.known_trees:
+                raise ValueError(f"Unknown Merkle root: {root.hex()}.")
+
+        keys_mt: MerkleTree = self.known_trees[keys_root]
+        values_mt: MerkleTree = self.known_trees[values_root]
+
+        if len(keys_mt) != size or len(values_mt) != size:
+            raise ValueError(f"Invalid map size.")
+
+        if len(self.queue) != 0:
+            raise RuntimeError(
+                "This command should not execute when the queue is not empty."
+            )
+
+        # The answer starts with the index of each key, followed by the proofs of the found keys
+        # (without their leaves, that the hardware wallet knows) and of their values
+        answer = bytearray()
+        found_indices = set()
+        for key_hash in key_hashes:
+            try:
+                leaf_index = keys_mt.leaf_index(key_hash)
+                found_indices.add(leaf_index)
+                answer.extend(b'\1' + write_varint(leaf_index))
+            except ValueError:
+                answer.extend(b'\0' + write_varint(0))
+
+        if len(found_indices) > 0:
+            indices = sorted(found_indices)
+
+            for proof_hash in keys_mt.prove_leaves(indices):
+                if proof_hash is not None:
+                    answer.extend(proof_hash)
+
+            leaf_indices = iter(indices)
+            for proof_hash in values_mt.prove_leaves(indices):
+                if proof_hash is not None:
+                    answer.extend(proof_hash)
+                else:
+                    leaf_hash = values_mt.get(next(leaf_indices))
+                    if leaf_hash not in self.known_preimages:
+                        raise RuntimeError(f"Requested unknown preimage for: {leaf_hash.hex()}")
+
+                    element = self.known_preimages[leaf_hash][1:]  # skip the b'\0' prefix
+                    answer.extend(write_varint(len(element)))
+                    answer.extend(element)
+
+        answer_len_out = write_varint(len(answer))
+
+        # Same as for GET_MERKLE_LEAF_RANGE, the bytes that do not fit in the response are stored
+        # for GET_MORE_ELEMENTS
+        max_payload_size = 255 - len(answer_len_out) - 1
+
+        payload_size = min(max_payload_size, len(answer))
+
+        if payload_size < len(answer):
+            self.queue.append(ByteRun(bytes(answer[payload_size:])))
+
+        return (
+            answer_len_out
+            + payload_size.to_bytes(1, byteorder="big")
+            + bytes(answer[:payload_size])
+        )
+
+
+class MultiRequestCommand(ClientCommand):
+    def __init__(self, known_trees: Mapping[bytes, MerkleTree], known_preimages: Mapping[bytes, bytes],
+                 queue: "deque[Union[bytes, ByteRun]]",
+                 prepared_proofs: Optional[Mapping[Tuple[bytes, int], List[bytes]]] = None):
+        self.known_trees = known_trees
+        self.known_preimages = known_preimages
+        self.queue = queue
+        self.prepared_proofs = prepared_proofs if prepared_proofs is not None else {}
+
+    @property
+    def code(self) -> int:
+        return ClientCommandCode.MULTI_REQUEST
+
+    def get_tree(self, root: bytes) -> MerkleTree:
+        if not root in self.known_trees:
+            raise ValueError(f"Unknown Merkle root: {root.hex()}.")
+        return self.known_trees[root]
+
+    def execute(self, request: bytes) -> bytes:
+        req = ByteStreamParser(request[1:])
+
+        n_requests = req.read_uint(1)
+
+        if len(self.queue) != 0:
+            raise RuntimeError(
+                "This command should not execute when the queue is not empty."
+            )
+
+        # The answer is the concatenation of the complete responses to each of the requests
+        answer = bytearray()
+        for _ in range(n_requests):
+            code = req.read_uint(1)
+            if code == ClientCommandCode.GET_PREIMAGE:
+                if req.read_bytes(1) != b'\0':
+                    raise RuntimeError(f"Unsupported request: the first byte should be 0")
+                req_hash = req.read_bytes(32)
+                if req_hash not in self.known_preimages:
+                    raise RuntimeError(f"Requested unknown preimage for: {req_hash.hex()}")
+
+                preimage = self.known_preimages[req_hash]
+                answer.extend(write_varint(len(preimage)))
+                answer.extend(preimage)
+            elif code == ClientCommandCode.GET_MERKLE_LEAF_PROOF:
+                root = req.read_bytes(32)
+                tree_size = req.read_varint()
+                leaf_index = req.read_varint()
+
+                mt = self.get_tree(root)
+                if leaf_index >= tree_size or len(mt) != tree_size:
+                    raise ValueError(f"Invalid index or tree size.")
+
+                proof = get_leaf_proof(mt, root, leaf_index, self.prepared_proofs)
+                answer.extend(mt.get(leaf_index))
+                answer.extend(len(proof).to_bytes(1, byteorder="big"))
+                answer.extend(b"".join(proof))
+            elif code == ClientCommandCode.GET_MERKLE_LEAF_INDEX:
+                root = req.read_bytes(32)
+                leaf_hash = req.read_bytes(32)
+
+                try:
+                    leaf_index = self.get_tree(root).leaf_index(leaf_hash)
+                    found = 1
+                except ValueError:
+                    leaf_index = 0
+                    found = 0
+                answer.extend(found.to_bytes(1, byteorder="big"))
+                answer.extend(write_varint(leaf_index))
+            else:
+                raise RuntimeError(f"Unsupported request in MULTI_REQUEST: 0x{code:02X}")
+        req.assert_empty()
+
+        answer_len_out = write_varint(len(answer))
+
+        # Same as for GET_MERKLE_LEAF_RANGE, the bytes that do not fit in the response are stored
+        # for GET_MORE_ELEMENTS
+        max_payload_size = 255 - len(answer_len_out) - 1
+
+        payload_size = min(max_payload_size, len(answer))
+
+        if payload_size < len(answer):
+            self.queue.append(ByteRun(bytes(answer[payload_size:])))
+
+        return (
+            answer_len_out
+            + payload_size.to_bytes(1, byteorder="big")
+            + bytes(answer[:payload_size])
+        )
+
+
+class GetMerkleLeafHashesCommand(ClientCommand):
+    def __init__(self, known_trees: Mapping[bytes, MerkleTree], queue: "deque[Union[bytes, ByteRun]]"):
+        self.known_trees = known_trees
+        self.queue = queue
+
+    @property
+    def code(self) -> int:
+        return ClientCommandCode.GET_MERKLE_LEAF_HASHES
+
+    def execute(self, request: bytes) -> bytes:
+        req = ByteStreamParser(request[1:])
+
+        root = req.read_bytes(32)
+        tree_size = req.read_varint()
+        req.assert_empty()
+
+        if not root in self.known_trees:
+            raise ValueError(f"Unknown Merkle root: {root.hex()}.")
+
+        mt: MerkleTree = self.known_trees[root]
+
+        if len(mt) != tree_size:
+            raise ValueError(f"Invalid tree size.")
+
+        if len(self.queue) != 0:
+            raise RuntimeError(
+                "This command should not execute when the queue is not empty."
+            )
+
+        answer = b''.join(mt.get(i) for i in range(tree_size))
+
+        answer_len_out = write_varint(len(answer))
+
+        # Same as for GET_MERKLE_LEAF_RANGE, the bytes that do not fit in the response are stored
+        # for GET_MORE_ELEMENTS
+        max_payload_size = 255 - len(answer_len_out) - 1
+
+        payload_size = min(max_payload_size, len(answer))
+
+        if payload_size < len(answer):
+            self.queue.append(ByteRun(answer[payload_size:]))
+
+        return (
+            answer_len_out
+            + payload_size.to_bytes(1, byteorder="big")
+            + answer[:payload_size]
+        )
+
+
 class GetMoreElementsCommand(ClientCommand):
-    def __init__(self, queue: "deque[bytes]"):
+    def __init__(self, queue: "deque[Union[bytes, ByteRun]]", max_response_len: int = 255):
         self.queue = queue
+        self.max_response_len = max_response_len
 
     @property
     def code(self) -> int:
@@ -179,28 +630,59 @@ class GetMoreElementsCommand(ClientCommand):
         if len(self.queue) == 0:
             raise ValueError("No elements to get.")
 
+        if isinstance(self.queue[0], ByteRun):
+            return self.execute_byte_runs()
+
+        # Only the elements that are returned are checked: scanning the whole queue at each request
+        # would be quadratic in the length of long streams, like the range of a large message.
         element_len = len(self.queue[0])
-        if any(len(el) != element_len for el in self.queue):
-            raise ValueError(
-                "The queue contains elements of different byte length, which is not expected."
-            )
 
-        # pop from the queue, keeping the total response length at most 255
+        # pop from the queue, keeping the total response length at most max_response_len.
+        # Each group contains at most 255 elements; byte streams (elements of length 1) can be
+        # returned as a sequence of groups in the same response.
 
-        response_elements = bytearray()
+        response = bytearray()
 
-        n_added_elements = 0
-        while len(self.queue) > 0 and len(response_elements) + element_len <= 253:
-            response_elements.extend(self.queue.popleft())
-            n_added_elements += 1
+        while len(self.queue) > 0 and len(response) + 2 + element_len <= self.max_response_len:
+            response_elements = bytearray()
 
-        return b"".join(
-            [
-                n_added_elements.to_bytes(1, byteorder="big"),
-                element_len.to_bytes(1, byteorder="big"),
-                bytes(response_elements),
-            ]
-        )
+            n_added_elements = 0
+            while (len(self.queue) > 0 and n_added_elements < 255
+                   and len(response) + 2 + len(response_elements) + element_len <= self.max_response_len):
+                element = self.queue.popleft()
+                if len(element) != element_len:
+                    raise ValueError(
+                        "The queue contains elements of different byte length, which is not expected."
+                    )
+                response_elements.extend(element)
+                n_added_elements += 1
+
+            response.extend(n_added_elements.to_bytes(1, byteorder="big"))
+            response.extend(element_len.to_bytes(1, byteorder="big"))
+            response.extend(response_elements)
+
+            if element_len != 1:
+                break
+
+        return bytes(response)
+
+    def execute_byte_runs(self) -> bytes:
+        # As many groups of at most 255 bytes as fit in the response, taken from the runs at the
+        # front of the queue
+        response = bytearray()
+        while len(self.queue) > 0 and isinstance(self.queue[0], ByteRun):
+            run: ByteRun = self.queue[0]
+            while len(run) > 0 and len(response) + 2 + 1 <= self.max_response_len:
+                chunk = run.take(min(255, self.max_response_len - len(response) - 2))
+                response.append(len(chunk))
+                response.append(1)
+                response.extend(chunk)
+
+            if len(run) > 0:
+                break  # the response is full
+            self.queue.popleft()
+
+        return bytes(response)
 
 
 class ClientCommandInterpreter:
@@ -214,12 +696,19 @@ class ClientCommandInterpreter:
     - a queue of bytes that contains any bytes that could not fit in a response from the
       GET_PREIMAGE client command (when a preimage is too long to fit in a single message) or the
       GET_MERKLE_LEAF_PROOF command (which returns a Merkle proof, which might be too long to fit
-      in a single message). The data in the queue is returned in one (or more) successive
+      in a single message), or the GET_MERKLE_LEAF_RANGE, GET_MERKLEIZED_MAP_VALUES and MULTI_REQUEST commands (which return a sequence of
+      leaves, together with the proof hashes on the boundary of the range), or the GET_MERKLE_LEAF_HASHES command (which returns
+      the hashes of all the leaves of a tree). The data in the queue is returned in one (or more) successive
       GET_MORE_ELEMENTS commands from the hardware wallet.
 
     Finally, it keeps track of the yielded values (that is, the values sent from the hardware
     wallet with a YIELD client command).
 
+    Responses are at most `max_response_len` bytes long; values larger than 255 require the response
+    to be split across multiple CONTINUE APDUs, which is supported since version 2 of the protocol.
+
+    Only the client commands of `protocol_version` are handled: an unexpected command code is an error.
+
     Attributes
     ----------
     yielded: list[bytes]
@@ -227,7 +716,7 @@ class ClientCommandInterpreter:
         processing of an APDU.
     """
 
-    def __init__(self):
+    def __init__(self, max_response_len: int = 255, protocol_version: int = CURRENT_PROTOCOL_VERSION):
         self.known_preimages: Mapping[bytes, bytes] = {}
         self.known_trees: Mapping[bytes, MerkleTree] = {}
 
@@ -235,16 +724,29 @@ class ClientCommandInterpreter:
 
         queue = deque()
 
+        # proofs prepared in advance after a HINT_MERKLE_LEAVES command
+        prepared_proofs = {}
+
         commands = [
             YieldCommand(self.yielded),
             GetPreimageCommand(self.known_preimages, queue),
             GetMerkleLeafIndexCommand(self.known_trees),
-            GetMerkleLeafProofCommand(self.known_trees, queue),
-            GetMoreElementsCommand(queue),
+            GetMerkleLeafProofCommand(self.known_trees, queue, prepared_proofs),
+            GetMerkleLeafElementCommand(self.known_trees, self.known_preimages, prepared_proofs),
+            HintMerkleLeavesCommand(self.known_trees, prepared_proofs),
+            GetMerkleLeafRangeCommand(self.known_trees, self.known_preimages, queue),
+            GetMerkleizedMapValuesCommand(self.known_trees, self.known_preimages, queue),
+            MultiRequestCommand(self.known_trees, self.known_preimages, queue, prepared_proofs),
+            GetMerkleLeafHashesCommand(self.known_trees, queue),
+            GetMoreElementsCommand(queue, max_response_len),
         ]
+        commands = [cmd for cmd in commands if MIN_PROTOCOL_VERSION.get(cmd.code, 0) <= protocol_version]
 
         self.commands = {cmd.code: cmd for cmd in commands}
 
+        # the bound methods are resolved once, as the interpreter runs for each interruption
+        self.handlers = {cmd.code: cmd.execute for cmd in commands}
+
     def execute(self, hw_response: bytes) -> bytes:
         """Interprets the client command requested by the hardware wallet, returning the appropriate
         response and updating the client interpreter's internal state if needed.
@@ -266,13 +768,24 @@ class ClientCommandInterpreter:
                 "Unexpected empty SW_INTERRUPTED_EXECUTION response from hardware wallet."
             )
 
-        cmd_code = hw_response[0]
-        if cmd_code not in self.commands:
+        # Since version 10 of the protocol, the content of a YIELD message can be prefixed to the next client command,
+        # instead of being sent in its own round trip
+        if hw_response[0] == ClientCommandCode.DEFERRED_YIELD:
+            if len(hw_response) < 2 or len(hw_response) < 2 + hw_response[1]:
+                raise RuntimeError("Invalid deferred YIELD message.")
+            yield_len = hw_response[1]
+            self.yielded.append(hw_response[2:2 + yield_len])
+            hw_response = hw_response[2 + yield_len:]
+            if len(hw_response) == 0 or hw_response[0] == ClientCommandCode.DEFERRED_YIELD:
+                raise RuntimeError("Invalid client command after a deferred YIELD message.")
+
+        handler = self.handlers.get(hw_response[0])
+        if handler is None:
             raise RuntimeError(
-                "Unexpected command code: 0x{:02X}".format(cmd_code)
+                "Unexpected command code: 0x{:02X}".format(hw_response[0])
             )
 
-        return self.commands[cmd_code].execute(hw_response)
+        return handler(hw_response)
 
     def add_known_preimage(self, element: bytes) -> None:
         """Adds a preimage to the list of known preimages.
@@ -288,7 +801,7 @@ class ClientCommandInterpreter:
 
         self.known_preimages[sha256(element)] = element
 
-    def add_known_list(self, elements: List[bytes]) -> None:
+    def add_known_list(self, elements: List[bytes]) -> bytes:
         """Adds a known Merkleized list.
 
         Builds the Merkle tree of `elements`, and adds it to the Merkle trees known to the client
@@ -297,23 +810,34 @@ class ClientCommandInterpreter:
 
         If `el` is one of `elements`, the client must respond with b'\0' + `el` when a GET_PREIMAGE
         client command is sent with `sha256(b'\0' + el)`.
-        Moreover, the commands GET_MERKLE_LEAF_INDEX and GET_MERKLE_LEAF_PROOF must correctly answer
-        queries relative to the Merkle whose root is `mt_root`.
+        Moreover, the commands GET_MERKLE_LEAF_INDEX, GET_MERKLE_LEAF_PROOF, GET_MERKLE_LEAF_ELEMENT
+        and GET_MERKLE_LEAF_RANGE must correctly answer queries relative to the Merkle whose root is
+        `mt_root`.
 
         Parameters
         ----------
         elements : List[bytes]
             A list of `bytes` corresponding to the leafs of the Merkle tree.
+
+        Returns
+        -------
+        bytes
+            The Merkle root `mt_root`.
         """
 
-        for el in elements:
-            self.add_known_preimage(b"\x00" + el)
+        preimages = [b"\x00" + el for el in elements]
+        return self._add_known_tree(preimages, hash_preimages(preimages))
 
-        mt = MerkleTree(element_hash(el) for el in elements)
+    def _add_known_tree(self, preimages: List[bytes], leaves: List[bytes]) -> bytes:
+        # each leaf is the hash of its preimage, which is computed only once
+        self.known_preimages.update(zip(leaves, preimages))
+
+        mt = MerkleTree(leaves)
 
         self.known_trees[mt.root] = mt
+        return mt.root
 
-    def add_known_mapping(self, mapping: Mapping[bytes, bytes]) -> None:
+    def add_known_mapping(self, mapping: Mapping[bytes, bytes]) -> bytes:
         """Adds the Merkle trees of keys, and the Merkle tree of values (ordered by key)
         of a mapping of bytes to bytes.
 
@@ -324,11 +848,63 @@ class ClientCommandInterpreter:
         ----------
         mapping : Mapping[bytes, bytes]
             A mapping whose keys and values are `bytes`.
+
+        Returns
+        -------
+        bytes
+            The serialized Merkleized map commitment of `mapping`, as returned by
+            `get_merkleized_map_commitment`.
+        """
+
+        return self.add_known_mappings([mapping])[0]
+
+    def add_known_mappings(self, mappings: Sequence[Mapping[bytes, bytes]]) -> List[bytes]:
+        """Same as `add_known_mapping` for each of `mappings`, for example all the maps of a PSBT.
+
+        The leaves of all the trees are hashed in a single batch (see `hash_preimages`), which is faster
+        than hashing them map by map.
+
+        Parameters
+        ----------
+        mappings : Sequence[Mapping[bytes, bytes]]
+            The mappings whose keys and values are `bytes`.
+
+        Returns
+        -------
+        List[bytes]
+            The serialized Merkleized map commitment of each mapping.
         """
 
-        items_sorted = list(sorted(mapping.items()))
+        # the preimages of the keys, then of the values of each mapping
+        trees: List[List[bytes]] = []
+        for mapping in mappings:
+            items_sorted = sorted(mapping.items())
+            trees.append([b"\x00" + key for key, _ in items_sorted])
+            trees.append([b"\x00" + value for _, value in items_sorted])
+
+        leaves = hash_preimages([preimage for preimages in trees for preimage in preimages])
+
+        roots = []
+        start = 0
+        for preimages in trees:
+            roots.append(self._add_known_tree(preimages, leaves[start:start + len(preimages)]))
+            start += len(preimages)
+
+        return [write_varint(len(mapping)) + roots[2 * i] + roots[2 * i + 1] for i, mapping in enumerate(mappings)]
+
+    def add_known_data(self, known_preimages: Mapping[bytes, bytes],
+                       known_trees: Mapping[bytes, MerkleTree]) -> None:
+        """Adds preimages and Merkle trees that were already computed, for example by a `PreparedPsbt`.
+
+        The Merkle trees are shared, not copied; the client commands never modify them.
+
+        Parameters
+        ----------
+        known_preimages : Mapping[bytes, bytes]
+            A mapping from the sha256 hash of each preimage to the preimage.
+        known_trees : Mapping[bytes, MerkleTree]
+            A mapping from the Merkle root of each tree to the tree.
+        """
 
-        keys = [i[0] for i in items_sorted]
-        values = [i[1] for i in items_sorted]
-        self.add_known_list(keys)
-        self.add_known_list(values)
+        self.known_preimages.update(known_preimages)
+        self.known_trees.update(known_trees)
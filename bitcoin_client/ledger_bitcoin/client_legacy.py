@@ -13,7 +13,7 @@ import base64
 from .client_base import PartialSignature
 from .client import Client, TransportClient
 
-from typing import List, Tuple, Optional, Union
+from typing import List, Tuple, Optional, Sequence, Union
 
 from .common import AddressType, Chain, hash160
 from .key import ExtendedKey, parse_path
@@ -156,7 +156,14 @@ class LegacyClient(Client):
         assert isinstance(output["address"], str)
         return output['address'][12:-2]  # HACK: A bug in getWalletPublicKey results in the address being returned as the string "bytearray(b'<address>')". This extracts the actual address to work around this.
 
-    def sign_psbt(self, psbt: Union[PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac: Optional[bytes]) -> List[Tuple[int, PartialSignature]]:
+    def sign_psbt(self, psbt: Union[PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac: Optional[bytes],
+                  inputs_to_sign: Optional[Sequence[int]] = None, low_r: bool = False) -> List[Tuple[int, PartialSignature]]:
+        if inputs_to_sign is not None:
+            raise NotImplementedError("Selecting the inputs to sign is not supported in the legacy protocol")
+
+        if low_r:
+            raise NotImplementedError("Low R signatures are not supported in the legacy protocol")
+
         if wallet_hmac is not None or wallet.n_keys != 1:
             raise NotImplementedError("Policy wallets are only supported from version 2.0.0. Please update your Ledger hardware wallet")
 
@@ -1,14 +1,65 @@
 import enum
 from typing import List, Tuple, Mapping, Union, Iterator, Optional
-import math
 
 from .common import bip32_path_from_string, write_varint
 from .merkle import get_merkleized_map_commitment, MerkleTree, element_hash
 from .withdraw import AcreWithdrawalDataBytes
-from .wallet import WalletPolicy
+from .wallet import WalletPolicy, WalletType, MAX_N_KEYS_INLINE
 
 # p2 encodes the protocol version implemented
-CURRENT_PROTOCOL_VERSION = 1
+CURRENT_PROTOCOL_VERSION = 10
+
+# the first protocol versions with a different format for the requests of the client
+PROTOCOL_VERSION_EXTENDED_CONTINUE = 2
+PROTOCOL_VERSION_CHUNKS_PER_LEAF = 7
+PROTOCOL_VERSION_INLINE_WALLET_POLICY = 8
+
+# the first protocol versions where the client supports each of the newer client commands
+PROTOCOL_VERSION_MERKLE_LEAF_ELEMENT = 2
+PROTOCOL_VERSION_MERKLE_LEAF_RANGE = 2
+PROTOCOL_VERSION_HINT_MERKLE_LEAVES = 2
+PROTOCOL_VERSION_MULTI_REQUEST = 5
+PROTOCOL_VERSION_MERKLEIZED_MAP_VALUES = 5
+PROTOCOL_VERSION_MERKLE_LEAF_HASHES = 9
+
+# maximum length of the data of a single APDU
+MAX_APDU_DATA_LENGTH = 255
+
+# maximum total length of a response to a client command, when split across multiple CONTINUE APDUs
+# (supported since version 2 of the protocol)
+MAX_EXTENDED_CONTINUE_LENGTH = 1024
+
+# maximum number of withdrawals that can be signed with a single SIGN_WITHDRAW command
+MAX_WITHDRAW_BATCH_SIZE = 4
+
+# length of the chunks of a message or of a withdrawal
+MESSAGE_CHUNK_SIZE = 64
+
+# maximum number of chunks in each leaf of the Merkle tree of a message or of a withdrawal
+# (chosen by the client since version 7 of the protocol; each leaf is a single chunk before)
+MAX_CHUNKS_PER_LEAF = 3
+
+# optional modes of SIGN_PSBT, in the byte following the wallet hmac
+SIGN_PSBT_MODE_SIGN = 0x00
+SIGN_PSBT_MODE_CHECKPOINT = 0x01
+SIGN_PSBT_MODE_RESUME = 0x02
+SIGN_PSBT_MODE_BATCH = 0x03
+
+# flag of the mode byte: the ECDSA signatures are ground until they have a low R
+SIGN_PSBT_FLAG_LOW_R = 0x80
+
+# how the PSBTs of a batch are reviewed, in the byte following SIGN_PSBT_MODE_BATCH
+SIGN_PSBT_BATCH_REVIEW_EACH = 0x00
+SIGN_PSBT_BATCH_REVIEW_COMBINED = 0x01
+
+# maximum number of PSBTs signed by a single SIGN_PSBT command in batch mode
+MAX_N_PSBTS_IN_BATCH = 32
+
+# length of the checkpoint returned by SIGN_PSBT in checkpoint mode
+SIGN_PSBT_CHECKPOINT_LENGTH = 224
+
+# maximum number of inputs signed by a single SIGN_PSBT command
+MAX_N_INPUTS_CAN_SIGN = 512
 
 def chunkify(data: bytes, chunk_len: int) -> Iterator[Tuple[bool, bytes]]:
     size: int = len(data)
@@ -29,6 +80,13 @@ def chunkify(data: bytes, chunk_len: int) -> Iterator[Tuple[bool, bytes]]:
         yield True, data[offset:]
 
 
+def message_leaves(message: bytes, chunks_per_leaf: int) -> List[bytes]:
+    """Splits a message in the leaves of its Merkle tree, of chunks_per_leaf chunks each (the last one can be
+    shorter)."""
+    leaf_size = MESSAGE_CHUNK_SIZE * chunks_per_leaf
+    return [message[i: i + leaf_size] for i in range(0, len(message), leaf_size)]
+
+
 class DefaultInsType(enum.IntEnum):
     GET_VERSION = 0x01
 
@@ -38,11 +96,13 @@ class BitcoinInsType(enum.IntEnum):
     GET_WALLET_ADDRESS = 0x03
     SIGN_PSBT = 0x04
     GET_MASTER_FINGERPRINT = 0x05
+    GET_APP_CAPABILITIES = 0x06
     SIGN_MESSAGE = 0x10
     SIGN_WITHDRAW = 0x11
     SIGN_ERC4361_MESSAGE = 0x12
 class FrameworkInsType(enum.IntEnum):
     CONTINUE_INTERRUPTED = 0x01
+    GET_RESPONSE = 0x04
 
 
 class BitcoinCommandBuilder:
@@ -52,12 +112,16 @@ class BitcoinCommandBuilder:
     CLA_BITCOIN: int = 0xE1
     CLA_FRAMEWORK: int = 0xF8
 
+    def __init__(self, protocol_version: int = CURRENT_PROTOCOL_VERSION):
+        # the version sent in p2; lower than CURRENT_PROTOCOL_VERSION for older apps
+        self.protocol_version = protocol_version
+
     def serialize(
         self,
         cla: int,
         ins: Union[int, enum.IntEnum],
         p1: int = 0,
-        p2: int = CURRENT_PROTOCOL_VERSION,
+        p2: Optional[int] = None,
         cdata: bytes = b"",
     ) -> dict:
         """Serialize the whole APDU command (header + data).
@@ -70,8 +134,8 @@ class BitcoinCommandBuilder:
             Instruction code: INS (1 byte)
         p1 : int
             Instruction parameter 1: P1 (1 byte).
-        p2 : int
-            Instruction parameter 2: P2 (1 byte).
+        p2 : Optional[int]
+            Instruction parameter 2: P2 (1 byte). Defaults to the protocol version of the builder.
         cdata : bytes
             Bytes of command data.
 
@@ -82,8 +146,18 @@ class BitcoinCommandBuilder:
 
         """
 
+        if p2 is None:
+            p2 = self.protocol_version
         return {"cla": cla, "ins": ins, "p1": p1, "p2": p2, "data": cdata}
 
+    def _serialize_chunks_per_leaf(self, chunks_per_leaf: int) -> bytes:
+        # before the version 7 of the protocol, the leaves always contain a single chunk
+        if self.protocol_version >= PROTOCOL_VERSION_CHUNKS_PER_LEAF:
+            return chunks_per_leaf.to_bytes(1, byteorder="big")
+        if chunks_per_leaf != 1:
+            raise ValueError("Only one chunk per leaf is supported before version 7 of the protocol")
+        return b""
+
     def get_extended_pubkey(self, bip32_path: str, display: bool = False):
         bip32_path: List[bytes] = bip32_path_from_string(bip32_path)
 
@@ -99,8 +173,26 @@ class BitcoinCommandBuilder:
             cdata=cdata,
         )
 
-    def register_wallet(self, wallet: WalletPolicy):
+    def get_extended_pubkeys(self, bip32_paths: List[str]):
+        cdata: bytes = b'\0'  # never displayed
+        for path in bip32_paths:
+            bip32_path: List[bytes] = bip32_path_from_string(path)
+            cdata += len(bip32_path).to_bytes(1, byteorder="big") + b"".join(bip32_path)
+
+        return self.serialize(
+            cla=self.CLA_BITCOIN,
+            ins=BitcoinInsType.GET_EXTENDED_PUBKEY,
+            cdata=cdata,
+        )
+
+    def register_wallet(self, wallet: WalletPolicy, inline: bool = True):
         wallet_bytes = wallet.serialize()
+        # the inline serialization saves the requests for the descriptor template and the keys, if it fits
+        if inline and self.protocol_version >= PROTOCOL_VERSION_INLINE_WALLET_POLICY and \
+                wallet.version == WalletType.WALLET_POLICY_V2 and 1 <= wallet.n_keys <= MAX_N_KEYS_INLINE:
+            inline_bytes = wallet.serialize_inline()
+            if len(write_varint(len(inline_bytes)) + inline_bytes) <= MAX_APDU_DATA_LENGTH:
+                wallet_bytes = inline_bytes
 
         return self.serialize(
             cla=self.CLA_BITCOIN,
@@ -115,6 +207,7 @@ class BitcoinCommandBuilder:
         address_index: int,
         change: bool,
         display: bool,
+        count: Optional[int] = None,
     ):
         cdata: bytes = b"".join(
             [
@@ -126,6 +219,10 @@ class BitcoinCommandBuilder:
             ]
         )
 
+        # batch mode
+        if count is not None:
+            cdata += count.to_bytes(4, byteorder="big")                 # 4 bytes
+
         return self.serialize(
             cla=self.CLA_BITCOIN,
             ins=BitcoinInsType.GET_WALLET_ADDRESS,
@@ -139,30 +236,50 @@ class BitcoinCommandBuilder:
         output_mappings: List[Mapping[bytes, bytes]],
         wallet: WalletPolicy,
         wallet_hmac: Optional[bytes],
+        mode_data: bytes = b"",
     ):
 
-        cdata = bytearray()
-        cdata += get_merkleized_map_commitment(global_mapping)
+        psbt_commitment = bytearray()
+        psbt_commitment += get_merkleized_map_commitment(global_mapping)
 
-        cdata += write_varint(len(input_mappings))
-        cdata += MerkleTree(
+        psbt_commitment += write_varint(len(input_mappings))
+        psbt_commitment += MerkleTree(
             [
                 element_hash(get_merkleized_map_commitment(m_in))
                 for m_in in input_mappings
             ]
         ).root
 
-        cdata += write_varint(len(output_mappings))
-        cdata += MerkleTree(
+        psbt_commitment += write_varint(len(output_mappings))
+        psbt_commitment += MerkleTree(
             [
                 element_hash(get_merkleized_map_commitment(m_out))
                 for m_out in output_mappings
             ]
         ).root
 
+        return self.sign_psbt_with_commitment(bytes(psbt_commitment), wallet, wallet_hmac, mode_data)
+
+    def sign_psbt_with_commitment(
+        self,
+        psbt_commitment: bytes,
+        wallet: WalletPolicy,
+        wallet_hmac: Optional[bytes],
+        mode_data: bytes = b"",
+    ):
+        """Same as `sign_psbt`, for a PSBT whose commitment was already computed; `psbt_commitment` is the
+        commitment of the global map, followed by the number and the Merkle root of the commitments of the
+        input maps, and the same for the output maps."""
+
+        cdata = bytearray()
+        cdata += psbt_commitment
+
         cdata += wallet.id
         cdata += wallet_hmac if wallet_hmac is not None else b'\0' * 32
 
+        # optional mode, followed by its parameters
+        cdata += mode_data
+
         return self.serialize(
             cla=self.CLA_BITCOIN, ins=BitcoinInsType.SIGN_PSBT, cdata=bytes(cdata)
         )
@@ -173,21 +290,30 @@ class BitcoinCommandBuilder:
             ins=BitcoinInsType.GET_MASTER_FINGERPRINT
         )
 
-    def sign_message(self, message: bytes, bip32_path: str):
+    def get_app_capabilities(self):
+        # sent with the version 0, that any app accepts, as the supported versions are not known yet
+        return self.serialize(
+            cla=self.CLA_BITCOIN,
+            ins=BitcoinInsType.GET_APP_CAPABILITIES,
+            p2=0
+        )
+
+    def sign_message(self, message: bytes, bip32_path: str, chunks_per_leaf: int = MAX_CHUNKS_PER_LEAF):
         cdata = bytearray()
 
         bip32_path: List[bytes] = bip32_path_from_string(bip32_path)
 
-        # split message in 64-byte chunks (last chunk can be smaller)
-        n_chunks = (len(message) + 63) // 64
-        chunks = [message[64 * i: 64 * i + 64] for i in range(n_chunks)]
+        # split message in leaves of chunks_per_leaf 64-byte chunks (last leaf can be smaller)
+        leaves = message_leaves(message, chunks_per_leaf)
 
         cdata += len(bip32_path).to_bytes(1, byteorder="big")
         cdata += b''.join(bip32_path)
 
+        cdata += self._serialize_chunks_per_leaf(chunks_per_leaf)
+
         cdata += write_varint(len(message))
 
-        cdata += MerkleTree(element_hash(c) for c in chunks).root
+        cdata += MerkleTree(element_hash(c) for c in leaves).root
 
         return self.serialize(
             cla=self.CLA_BITCOIN,
@@ -195,41 +321,26 @@ class BitcoinCommandBuilder:
             cdata=bytes(cdata)
         )
     
-    def sign_withdraw(self, data_bytes: AcreWithdrawalDataBytes, bip32_path: str):
+    def sign_withdraw(self, data_bytes: AcreWithdrawalDataBytes, bip32_path: str,
+                      chunks_per_leaf: int = MAX_CHUNKS_PER_LEAF):
+        return self.sign_withdrawals([data_bytes], bip32_path, chunks_per_leaf)
+
+    def sign_withdrawals(self, data_bytes_list: List[AcreWithdrawalDataBytes], bip32_path: str,
+                         chunks_per_leaf: int = MAX_CHUNKS_PER_LEAF):
         cdata = bytearray()
 
         bip32_path: List[bytes] = bip32_path_from_string(bip32_path)
 
-        chunks = []
-
-        # Chunk 0: to[20] + gasToken[20] + refundReceiver[20]
-        chunks.append(data_bytes.to + data_bytes.gasToken + data_bytes.refundReceiver)
-
-        # Chunk 1: value[32] + safeTxGas[32]
-        chunks.append(data_bytes.value + data_bytes.safeTxGas)
-
-        # Chunk 2: baseGas[32] + gasPrice[32]
-        chunks.append(data_bytes.baseGas + data_bytes.gasPrice)
-
-        # Chunk 3: nonce[32] + operation[1]
-        chunks.append(data_bytes.nonce + data_bytes.operation)
-
-        # Chunk 4: data_selector[4] (the first 4 bytes of data)
-        chunks.append(data_bytes.data[:4])
-
-        # Calculate the number of 64-byte chunks needed for the remaining data
-        n_chunks_data = math.ceil((len(data_bytes.data) - 4) / 64)
-
-        # Chunk 5 to n: data[64]
-        for i in range(n_chunks_data):
-            chunks.append(data_bytes.data[4 + 64 * i: 4 + 64 * (i + 1)])
-
         cdata += len(bip32_path).to_bytes(1, byteorder="big")
         cdata += b''.join(bip32_path)
 
-        cdata += write_varint(n_chunks_data + 5)
+        cdata += self._serialize_chunks_per_leaf(chunks_per_leaf)
 
-        cdata += MerkleTree(element_hash(c) for c in chunks).root
+        # each payload is committed by the number of chunks and the Merkle root of its leaves
+        for data_bytes in data_bytes_list:
+            cdata += write_varint(len(data_bytes.to_chunks()))
+
+            cdata += MerkleTree(element_hash(c) for c in data_bytes.to_leaves(chunks_per_leaf)).root
 
         return self.serialize(
             cla=self.CLA_BITCOIN,
@@ -237,21 +348,22 @@ class BitcoinCommandBuilder:
             cdata=bytes(cdata)
         )
     
-    def sign_erc4361_message(self, message: bytes, bip32_path: str):
+    def sign_erc4361_message(self, message: bytes, bip32_path: str, chunks_per_leaf: int = MAX_CHUNKS_PER_LEAF):
         cdata = bytearray()
 
         bip32_path: List[bytes] = bip32_path_from_string(bip32_path)
 
-        # split message in 64-byte chunks (last chunk can be smaller)
-        n_chunks = (len(message) + 63) // 64
-        chunks = [message[64 * i: 64 * i + 64] for i in range(n_chunks)]
+        # split message in leaves of chunks_per_leaf 64-byte chunks (last leaf can be smaller)
+        leaves = message_leaves(message, chunks_per_leaf)
 
         cdata += len(bip32_path).to_bytes(1, byteorder="big")
         cdata += b''.join(bip32_path)
 
+        cdata += self._serialize_chunks_per_leaf(chunks_per_leaf)
+
         cdata += write_varint(len(message))
 
-        cdata += MerkleTree(element_hash(c) for c in chunks).root
+        cdata += MerkleTree(element_hash(c) for c in leaves).root
 
         return self.serialize(
             cla=self.CLA_BITCOIN,
@@ -259,9 +371,16 @@ class BitcoinCommandBuilder:
             cdata=bytes(cdata)
         )
 
-    def continue_interrupted(self, cdata: bytes):
+    def continue_interrupted(self, cdata: bytes, has_more: bool = False):
         """Command builder for CONTINUE.
 
+        Parameters
+        ----------
+        cdata : bytes
+            The response to the client command, or a part of it.
+        has_more : bool
+            True if more parts of the same response follow in subsequent CONTINUE APDUs.
+
         Returns
         -------
         bytes
@@ -271,5 +390,21 @@ class BitcoinCommandBuilder:
         return self.serialize(
             cla=self.CLA_FRAMEWORK,
             ins=FrameworkInsType.CONTINUE_INTERRUPTED,
+            p1=1 if has_more else 0,
             cdata=cdata,
         )
+
+    def get_response(self):
+        """Command builder for GET_RESPONSE.
+
+        Returns
+        -------
+        bytes
+            APDU command for GET_RESPONSE, that reads the next chunk of a response with status word
+            SW_RESPONSE_HAS_MORE.
+
+        """
+        return self.serialize(
+            cla=self.CLA_FRAMEWORK,
+            ins=FrameworkInsType.GET_RESPONSE,
+        )
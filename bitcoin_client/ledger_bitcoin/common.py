@@ -11,6 +11,9 @@ UINT16_MAX: int = 65535
 
 SW_OK = 0x9000
 SW_INTERRUPTED_EXECUTION = 0xE000
+# the high byte of the status word of a chunk of a response whose next chunk is read with GET_RESPONSE
+SW_RESPONSE_HAS_MORE = 0x6100
+SW_INS_NOT_SUPPORTED = 0x6D00
 
 # from bitcoin-core/HWI
 class Chain(Enum):
@@ -133,7 +136,7 @@ def ripemd160(x: bytes) -> bytes:
         return ripemd.ripemd160(x)
 
 def sha256(s: bytes) -> bytes:
-    return hashlib.new('sha256', s).digest()
+    return hashlib.sha256(s).digest()
 
 
 def hash160(s: bytes) -> bytes:
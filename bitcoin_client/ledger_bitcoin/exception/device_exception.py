@@ -7,6 +7,7 @@ from .errors import *
 class DeviceException(Exception):  # pylint: disable=too-few-public-methods
     exc: Dict[int, Any] = {
         0x5515: SecurityStatusNotSatisfiedError,  # returned by sdk in recent versions
+        0x6100: ResponseHasMore,  # not an error; only the high byte is fixed
         0x6985: DenyError,
         0x6982: SecurityStatusNotSatisfiedError,  # used in older app versions
         0x6A80: IncorrectDataError,
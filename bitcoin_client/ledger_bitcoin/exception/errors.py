@@ -53,3 +53,8 @@ class SignatureFailError(Exception):
 # Not really an error
 class InterruptedExecution(Exception):
     pass
+
+
+# Not really an error
+class ResponseHasMore(Exception):
+    pass
@@ -1,4 +1,6 @@
-from typing import List, Iterable, Mapping
+from bisect import bisect_left
+import hashlib
+from typing import Dict, List, Iterable, Mapping, Optional, Sequence
 
 from .common import write_varint, sha256
 
@@ -63,53 +65,6 @@ def combine_hashes(left: bytes, right: bytes) -> bytes:
     return sha256(b'\x01' + left + right)
 
 
-# root is the only node with parent == None
-# leaves have left == right == None
-class Node:
-    def __init__(self, left, right, parent, value: bytes):
-        self.left = left
-        self.right = right
-        self.parent = parent
-        self.value = value
-
-    def recompute_value(self):
-        assert self.left is not None
-        assert self.right is not None
-        self.value = combine_hashes(self.left.value, self.right.value)
-
-    def sibling(self):
-        if self.parent is None:
-            raise IndexError("The root does not have a sibling.")
-
-        if self.parent.left == self:
-            return self.parent.right
-        elif self.parent.right == self:
-            return self.parent.left
-        else:
-            raise IndexError("Invalid state: not a child of his parent.")
-
-
-def make_tree(leaves: List[Node], begin: int, size: int) -> Node:
-    """Given a list of nodes, builds the left-complete Merkle tree on top of it.
-    The nodes in `leaves` are modified by setting their `parent` field appropriately.
-    It returns the root of the newly built tree.
-    """
-
-    if size == 0:
-        return []
-    if size == 1:
-        return leaves[begin]
-
-    lchild_size = largest_power_of_2_less_than(size)
-
-    lchild = make_tree(leaves, begin, lchild_size)
-    rchild = make_tree(leaves, begin + lchild_size, size - lchild_size)
-    root = Node(lchild, rchild, None, None)
-    root.recompute_value()
-    lchild.parent = rchild.parent = root
-    return root
-
-
 class MerkleTree:
     """
     Maintains a dynamic vector of values and the Merkle tree built on top of it. The elements of the vector are stored
@@ -125,30 +80,51 @@ class MerkleTree:
     - There are always n - 1 internal nodes; all the internal nodes have exactly two children.
     - If a subtree has n > 1 leaves, then the left subchild is a complete subtree with p leaves, where p is the largest
       power of 2 smaller than n.
+
+    The tree is stored as a list of levels, from the leaves to the root: the node with index j of a level is the parent
+    of the nodes with indices 2j and 2j + 1 of the level below, or the same node as 2j, if it is the last node of its
+    level and has no sibling. A subtree with n leaves starting at leaf b is therefore the node with index
+    b >> ceil_lg(n) of the level ceil_lg(n).
+    The index of each leaf value and the proofs of the leaves are cached, as the device asks for them repeatedly.
     """
 
     def __init__(self, elements: Iterable[bytes] = []):
-        self.leaves = [Node(None, None, None, el) for el in elements]
-        n_elements = len(self.leaves)
-        if n_elements > 0:
-            self.root_node = make_tree(self.leaves, 0, n_elements)
-            self.depth = ceil_lg(n_elements)
-        else:
-            self.root_node = None
-            self.depth = None
+        self.levels: List[List[bytes]] = [list(elements)]
+
+        # the same as combine_hashes, inlined as the trees of large PSBTs have thousands of nodes
+        h = hashlib.sha256
+        if len(self.levels[0]) > 1 and any(len(leaf) != 32 for leaf in self.levels[0]):
+            raise ValueError("The elements must be 32-bytes sha256 outputs.")
+        while len(self.levels[-1]) > 1:
+            level = self.levels[-1]
+            parents = [h(b'\x01' + level[j] + level[j + 1]).digest() for j in range(0, len(level) - 1, 2)]
+            if len(level) % 2 == 1:
+                parents.append(level[-1])
+            self.levels.append(parents)
+
+        self.leaf_indices: Dict[bytes, int] = {}
+        for index, leaf in enumerate(self.levels[0]):
+            self.leaf_indices.setdefault(leaf, index)
+
+        self.proofs: Dict[int, List[bytes]] = {}
 
     def __len__(self) -> int:
         """Return the total number of leaves in the tree."""
-        return len(self.leaves)
+        return len(self.levels[0])
+
+    @property
+    def depth(self) -> Optional[int]:
+        """Return the depth of the tree, or None if the tree is empty."""
+        return None if len(self) == 0 else len(self.levels) - 1
 
     @property
     def root(self) -> bytes:
         """Return the Merkle root, or None if the tree is empty."""
-        return NIL if self.root_node is None else self.root_node.value
+        return NIL if len(self) == 0 else self.levels[-1][0]
 
     def copy(self):
         """Return an identical copy of this Merkle tree."""
-        return MerkleTree([leaf.value for leaf in self.leaves])
+        return MerkleTree(self.levels[0])
 
     def add(self, x: bytes) -> None:
         """Add an element as new leaf, and recompute the tree accordingly. Cost O(log n)."""
@@ -156,95 +132,137 @@ class MerkleTree:
         if len(x) != 32:
             raise ValueError("Inserted elements must be exactly 32 bytes long")
 
-        new_leaf = Node(None, None, None, x)
-        self.leaves.append(new_leaf)
-        if len(self.leaves) == 1:
-            self.root_node = new_leaf
-            self.depth = 0
-            return
-
-        # add a new leaf
-        if self.depth == 0:
-            ltree_size = 0
-        else:
-            # number of leaves of the left subtree of cur_root
-            ltree_size = 1 << (self.depth - 1)
-
-        cur_root = self.root_node
-        cur_root_size = len(self.leaves) - 1
-
-        while not is_power_of_2(cur_root_size):
-            cur_root = cur_root.right
-            cur_root_size -= ltree_size
-            ltree_size /= 2
-
-        # node value will be computed later
-        new_node = Node(cur_root, new_leaf, cur_root.parent, None)
-        if cur_root.parent is None:
-            # replacing the root
-            self.depth += 1
-            self.root_node = new_node
-        else:
-            assert cur_root.parent.right == cur_root
-            cur_root.parent.right = new_node
-        cur_root.parent = new_node
-        new_leaf.parent = new_node
-
-        self.fix_up(new_node)
+        self.levels[0].append(x)
+        self.leaf_indices.setdefault(x, len(self) - 1)
+        self.fix_up(len(self) - 1)
 
     def set(self, index: int, x: bytes) -> None:
         """
         Set the value of the leaf at position `index` to `x`, recomputing the tree accordingly.
         If `index` equals the current number of leaves, then it is equivalent to `add(x)`.
 
-        Cost: Worst case O(log n).
+        Cost: Worst case O(log n), or O(n) if the previous value of the leaf is also the value of a later leaf.
         """
-        assert 0 <= index <= len(self.leaves)
+        assert 0 <= index <= len(self)
 
-        if not (0 <= index <= len(self.leaves)):
+        if not (0 <= index <= len(self)):
             raise ValueError(
                 "The index must be at least 0, and at most the current number of leaves.")
 
         if len(x) != 32:
             raise ValueError("Inserted elements must be exactly 32 bytes long.")
 
-        if index == len(self.leaves):
+        if index == len(self):
             self.add(x)
-        else:
-            self.leaves[index].value = x
-            self.fix_up(self.leaves[index].parent)
+            return
+
+        old = self.levels[0][index]
+        self.levels[0][index] = x
+        if self.leaf_indices.get(old) == index:
+            del self.leaf_indices[old]
+            for i in range(index + 1, len(self)):
+                if self.levels[0][i] == old:
+                    self.leaf_indices[old] = i
+                    break
+        if self.leaf_indices.get(x, index) >= index:
+            self.leaf_indices[x] = index
 
-    def fix_up(self, node: Node):
-        while node is not None:
-            node.recompute_value()
-            node = node.parent
+        self.fix_up(index)
+
+    def fix_up(self, index: int) -> None:
+        """Recompute the ancestors of the leaf at position `index`, and discard the cached proofs."""
+
+        self.proofs.clear()
+
+        level, j = 0, index
+        while len(self.levels[level]) > 1:
+            nodes = self.levels[level]
+            left = j & ~1
+            value = combine_hashes(nodes[left], nodes[left + 1]) if left + 1 < len(nodes) else nodes[left]
+
+            if level + 1 == len(self.levels):
+                self.levels.append([])
+            parents = self.levels[level + 1]
+            if j // 2 == len(parents):
+                parents.append(value)
+            else:
+                parents[j // 2] = value
+
+            level, j = level + 1, j // 2
 
     def get(self, i: int) -> bytes:
         """Return the value of the leaf with index `i`, where 0 <= i < len(self)."""
-        return self.leaves[i].value
+        return self.levels[0][i]
 
     def leaf_index(self, x: bytes) -> int:
-        """Return the index of the leaf with hash `x`. Raises `ValueError` if not found."""
-        idx = 0
-        while idx < len(self):
-            if self.leaves[idx].value == x:
-                return idx
-            idx += 1
-        raise ValueError("Leaf not found")
+        """Return the index of the first leaf with hash `x`. Raises `ValueError` if not found."""
+        index = self.leaf_indices.get(x)
+        if index is None:
+            raise ValueError("Leaf not found")
+        return index
 
     def prove_leaf(self, index: int) -> List[bytes]:
         """Produce the Merkle proof of membership for the leaf with the given index where 0 <= index < len(self)."""
-        node = self.leaves[index]
-        proof = []
-        while node.parent is not None:
-            sibling = node.sibling()
-            assert sibling is not None
 
-            proof.append(sibling.value)
+        if not (0 <= index < len(self)):
+            raise IndexError("Invalid leaf index.")
+
+        proof = self.proofs.get(index)
+        if proof is None:
+            proof = []
+            j = index
+            for nodes in self.levels[:-1]:
+                # the last node of a level without a sibling is the same node in the next level
+                if j ^ 1 < len(nodes):
+                    proof.append(nodes[j ^ 1])
+                j //= 2
+            self.proofs[index] = proof
 
-            node = node.parent
+        # the caller might modify the returned list
+        return list(proof)
+
+    def prove_range(self, begin: int, end: int) -> List[Optional[bytes]]:
+        """
+        Produce the Merkle proof of membership for the consecutive leaves with indices in [begin, end), where
+        0 <= begin < end <= len(self).
+
+        The result lists the nodes in the order of a depth-first, left-to-right traversal of the tree: the root of
+        each maximal subtree that is disjoint from the range, and `None` in place of each leaf in the range.
+        """
+
+        if not (0 <= begin < end <= len(self)):
+            raise ValueError("Invalid range.")
+
+        return self.prove_leaves(range(begin, end))
+
+    def prove_leaves(self, indices: Sequence[int]) -> List[Optional[bytes]]:
+        """
+        Produce the Merkle proof of membership for the leaves with the given indices, that must be strictly
+        increasing, in the same format as `prove_range`: the root of each maximal subtree that contains none of
+        the leaves, and `None` in place of each of the leaves.
+        """
 
-        return proof
+        if len(indices) == 0 or indices[0] < 0 or indices[-1] >= len(self) or \
+                any(indices[i] >= indices[i + 1] for i in range(len(indices) - 1)):
+            raise ValueError("Invalid leaf indices.")
+
+        result = []
+
+        def visit(node_begin: int, node_size: int):
+            # whether any of the indices is in [node_begin, node_begin + node_size)
+            pos = bisect_left(indices, node_begin)
+            if pos == len(indices) or indices[pos] >= node_begin + node_size:
+                level = ceil_lg(node_size)
+                result.append(self.levels[level][node_begin >> level])
+            elif node_size == 1:
+                result.append(None)
+            else:
+                lchild_size = largest_power_of_2_less_than(node_size)
+                visit(node_begin, lchild_size)
+                visit(node_begin + lchild_size, node_size - lchild_size)
+
+        visit(0, len(self))
+        return result
 
 
 def get_merkleized_map_commitment(mapping: Mapping[bytes, bytes]) -> bytes:
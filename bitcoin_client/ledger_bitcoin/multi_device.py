@@ -0,0 +1,102 @@
+from concurrent.futures import ThreadPoolExecutor
+from dataclasses import dataclass, field
+from typing import Dict, List, Optional, Sequence, Tuple, Union
+
+from .client import NewClient
+from .client_base import Client, PartialSignature
+from .prepared_psbt import PreparedPsbt
+from .psbt import PSBT, normalize_psbt
+from .wallet import WalletPolicy
+
+
+@dataclass
+class MultiDeviceSignResult:
+    """The result of `sign_psbt_on_devices`.
+
+    Attributes
+    ----------
+    signatures : List[Tuple[int, PartialSignature]]
+        The signatures returned by all the devices, as returned by `sign_psbt`, without duplicates; they are
+        ordered by input index, and by the order of the devices for the same input.
+    signatures_by_device : Dict[int, List[Tuple[int, PartialSignature]]]
+        The signatures returned by each device that signed, mapped by the index of the device in `signers`.
+    errors : Dict[int, Exception]
+        The exception raised by each device that failed, for example because the user rejected the
+        transaction, mapped by the index of the device in `signers`.
+    """
+
+    signatures: List[Tuple[int, PartialSignature]] = field(default_factory=list)
+    signatures_by_device: Dict[int, List[Tuple[int, PartialSignature]]] = field(default_factory=dict)
+    errors: Dict[int, Exception] = field(default_factory=dict)
+
+
+def sign_psbt_on_devices(signers: Sequence[Tuple[Client, Optional[bytes]]], psbt: Union[PSBT, bytes, str],
+                         wallet: WalletPolicy, inputs_to_sign: Optional[Sequence[int]] = None) -> MultiDeviceSignResult:
+    """Signs the same PSBT with the same wallet policy on several devices at the same time.
+
+    Each device is driven by its own thread, as the transports are blocking; the total time is therefore the time
+    of the slowest device, rather than the sum of the times of all the devices. The PSBT is prepared only once,
+    and the `PreparedPsbt` is shared by all the `NewClient` instances; signing never modifies it, except for the
+    proofs cached in its Merkle trees, that are the same whichever thread computes them.
+
+    A failure of a device does not interrupt the other devices: its exception is returned in the result.
+
+    Parameters
+    ----------
+    signers : Sequence[Tuple[Client, Optional[bytes]]]
+        For each device, a client with its own transport, and the hmac of the wallet policy registered on that
+        device (`None` for a standard wallet policy).
+
+    psbt : PSBT | bytes | str
+        The PSBT, as in `Client.sign_psbt`.
+
+    wallet : WalletPolicy
+        The wallet policy, registered on each device.
+
+    inputs_to_sign : Optional[Sequence[int]]
+        If given, the indices of the only inputs that can be internal, as in `Client.sign_psbt`.
+
+    Returns
+    -------
+    MultiDeviceSignResult
+        The merged signatures, and the errors of the devices that failed.
+    """
+
+    psbt = normalize_psbt(psbt)
+    prepared: Optional[PreparedPsbt] = None
+    if any(isinstance(client, NewClient) for client, _ in signers):
+        prepared = PreparedPsbt(psbt, wallet)
+
+    # other clients get their own copy of the PSBT, deserialized from the same string
+    psbt_b64 = psbt.serialize()
+
+    def sign(client: Client, wallet_hmac: Optional[bytes]) -> List[Tuple[int, PartialSignature]]:
+        client_psbt = prepared if isinstance(client, NewClient) else psbt_b64
+        return client.sign_psbt(client_psbt, wallet, wallet_hmac, inputs_to_sign)
+
+    result = MultiDeviceSignResult()
+    if len(signers) == 0:
+        return result
+
+    with ThreadPoolExecutor(max_workers=len(signers)) as executor:
+        futures = [executor.submit(sign, client, wallet_hmac) for client, wallet_hmac in signers]
+
+        for i, future in enumerate(futures):
+            try:
+                result.signatures_by_device[i] = future.result()
+            except Exception as e:
+                result.errors[i] = e
+
+    # the same signature might be returned by more than one device, if they share a key
+    seen = set()
+    for i in sorted(result.signatures_by_device.keys()):
+        for input_index, sig in result.signatures_by_device[i]:
+            key = (input_index, sig.pubkey, sig.tapleaf_hash, sig.signature)
+            if key not in seen:
+                seen.add(key)
+                result.signatures.append((input_index, sig))
+
+    # sorted is stable, therefore the signatures of each input remain in the order of the devices
+    result.signatures.sort(key=lambda x: x[0])
+
+    return result
@@ -0,0 +1,205 @@
+from typing import Dict, List, Mapping, Optional, Tuple, Union
+import base64
+from io import BufferedReader
+
+from .client_command import ClientCommandInterpreter
+from .common import write_varint
+from .merkle import MerkleTree
+from .psbt import PSBT, normalize_psbt
+from .wallet import WalletPolicy
+from ._serialize import deser_string
+
+
+def parse_stream_to_map(f: BufferedReader) -> Mapping[bytes, bytes]:
+    result = {}
+    while True:
+        try:
+            key = deser_string(f)
+        except Exception:
+            break
+
+        # Check for separator
+        if len(key) == 0:
+            break
+
+        value = deser_string(f)
+
+        result[key] = value
+    return result
+
+
+RawMap = Dict[bytes, memoryview]
+
+
+def _read_compact_size(data: memoryview, pos: int) -> Tuple[int, int]:
+    """Reads the compact size at `pos`, returning it and the position that follows it."""
+
+    if pos >= len(data):
+        raise ValueError("Unexpected end of the PSBT")
+    first = data[pos]
+    if first < 0xfd:
+        return first, pos + 1
+    size = {0xfd: 2, 0xfe: 4, 0xff: 8}[first]
+    if pos + 1 + size > len(data):
+        raise ValueError("Unexpected end of the PSBT")
+    return int.from_bytes(data[pos + 1:pos + 1 + size], "little"), pos + 1 + size
+
+
+def _parse_raw_map(data: memoryview, pos: int) -> Tuple[RawMap, int]:
+    """Parses the map at `pos`, returning it and the position that follows its separator.
+
+    The values are slices of `data`, rather than copies; the keys, which are short, are copied in order to be hashable
+    and sortable."""
+
+    result: RawMap = {}
+    while True:
+        key_len, pos = _read_compact_size(data, pos)
+        if key_len == 0:
+            return result, pos
+        if pos + key_len > len(data):
+            raise ValueError("Unexpected end of the PSBT")
+        key = bytes(data[pos:pos + key_len])
+        value_len, pos = _read_compact_size(data, pos + key_len)
+        if pos + value_len > len(data):
+            raise ValueError("Unexpected end of the PSBT")
+        if key in result:
+            raise ValueError("Duplicate key in a map of the PSBT")
+        result[key] = data[pos:pos + value_len]
+        pos += value_len
+
+
+def parse_raw_psbt_v2(psbt: Union[bytes, str]) -> Optional[Tuple[RawMap, List[RawMap], List[RawMap]]]:
+    """Parses the global map, the input maps and the output maps of a serialized PSBT of version 2, without
+    deserializing their fields: the values are `memoryview` slices of the serialized PSBT.
+
+    Returns None if the PSBT is not of version 2; raises `ValueError` if it is not a sequence of well-formed maps.
+    Fields are not validated otherwise, as the hardware wallet validates the ones it uses."""
+
+    data = memoryview(base64.b64decode(psbt) if isinstance(psbt, str) else psbt)
+    if bytes(data[:5]) != b"psbt\xff":
+        raise ValueError("Invalid PSBT magic")
+
+    global_map, pos = _parse_raw_map(data, 5)
+
+    version = global_map.get(b"\xfb")
+    if version is None or len(version) != 4 or int.from_bytes(version, "little") != 2:
+        return None
+
+    counts = []
+    for key in [b"\x04", b"\x05"]:  # PSBT_GLOBAL_INPUT_COUNT, PSBT_GLOBAL_OUTPUT_COUNT
+        if key not in global_map:
+            raise ValueError("Missing input or output count in a PSBTv2")
+        count, count_len = _read_compact_size(global_map[key], 0)
+        if count_len != len(global_map[key]):
+            raise ValueError("Invalid input or output count in a PSBTv2")
+        counts.append(count)
+
+    input_maps = []
+    for _ in range(counts[0]):
+        m, pos = _parse_raw_map(data, pos)
+        input_maps.append(m)
+    output_maps = []
+    for _ in range(counts[1]):
+        m, pos = _parse_raw_map(data, pos)
+        output_maps.append(m)
+    if pos != len(data):
+        raise ValueError("Unexpected data after the maps of the PSBT")
+
+    return global_map, input_maps, output_maps
+
+
+class PreparedPsbt:
+    """A PSBT and a wallet policy, with all the data that the client needs in order to sign the PSBT with
+    the wallet policy already computed: the Merkleized map commitments of the PSBT, and the preimages and
+    Merkle trees that the hardware wallet might request.
+
+    Computing them requires hashing every key and value of the PSBT, which is slow for large PSBTs; a
+    `PreparedPsbt` can be passed to `sign_psbt`, `sign_psbt_checkpoint` and `sign_psbt_resume` in place of
+    the PSBT, so that retries and the multiple commands of the resumable signing pay this cost only once.
+
+    The PSBT must not be modified after it is prepared.
+
+    Attributes
+    ----------
+    n_inputs : int
+        The number of inputs of the PSBT.
+    n_outputs : int
+        The number of outputs of the PSBT.
+    wallet_id : bytes
+        The id of the wallet policy the PSBT was prepared for.
+    psbt_commitment : bytes
+        The commitment to the PSBT sent in the SIGN_PSBT request.
+    known_preimages : Mapping[bytes, bytes]
+        The preimages known to the client, mapped by their sha256 hash.
+    known_trees : Mapping[bytes, MerkleTree]
+        The Merkle trees known to the client, mapped by their root.
+    """
+
+    def __init__(self, psbt: Union[PSBT, bytes, str], wallet: WalletPolicy, clone: bool = True):
+        """Prepares `psbt`, either a `PSBT` object, or `bytes`, or a base64-encoded `str`, for `wallet`.
+
+        A PSBT of version 0 is converted to version 2; if `clone` is False, a `PSBT` object is converted
+        in place instead of being copied first. A serialized PSBT of version 2 is not deserialized: its maps
+        are committed to directly from their serialization (see `parse_raw_psbt_v2`), which is much faster
+        for large PSBTs.
+        """
+
+        # a serialized PSBTv2 is parsed directly into its maps, whose values are slices of the serialized PSBT: it is
+        # never deserialized to a `PSBT`, nor serialized again
+        raw_maps = parse_raw_psbt_v2(psbt) if isinstance(psbt, (bytes, str)) else None
+
+        if raw_maps is None:
+            psbt = normalize_psbt(psbt)
+
+            if psbt.version != 2:
+                if not clone:
+                    psbt.convert_to_v2()
+                    psbt_v2 = psbt
+                else:
+                    psbt_v2 = PSBT()
+                    psbt_v2.deserialize(psbt.serialize())  # clone psbt
+                    psbt_v2.convert_to_v2()
+            else:
+                psbt_v2 = psbt
+
+            raw_maps = parse_raw_psbt_v2(base64.b64decode(psbt_v2.serialize()))
+            assert raw_maps is not None
+
+        # From the individual maps (global map, each input map, and each output map), we produce the serialized
+        # Merkleized map commitments. Moreover, we collect all the relevant Merkle trees and pre-images in the psbt,
+        # that the client interpreter needs to respond to queries.
+        global_map, input_maps, output_maps = raw_maps
+
+        # the interpreter is only used to collect the known preimages and trees
+        client_intepreter = ClientCommandInterpreter()
+        client_intepreter.add_known_list([k.encode() for k in wallet.keys_info])
+        client_intepreter.add_known_preimage(wallet.serialize())
+
+        # necessary for version 1 of the protocol (introduced in version 2.1.0)
+        client_intepreter.add_known_preimage(wallet.descriptor_template.encode())
+
+        # all the maps are committed to at once, so that their keys and values are hashed in a single batch
+        commitments = client_intepreter.add_known_mappings([global_map] + input_maps + output_maps)
+        global_commitment = commitments[0]
+        input_commitments = commitments[1:1 + len(input_maps)]
+        output_commitments = commitments[1 + len(input_maps):]
+
+        # We also add the Merkle tree of the input (resp. output) map commitments as a known tree
+        inputs_root = client_intepreter.add_known_list(input_commitments)
+        outputs_root = client_intepreter.add_known_list(output_commitments)
+
+        # The serialized outputs of the transaction (preceded by their count), that the device might
+        # request as a preimage in order to compute the sighash of legacy inputs
+        serialized_outputs = write_varint(len(output_maps)) + b''.join(
+            part for m in output_maps for part in (m[b'\x03'], write_varint(len(m[b'\x04'])), m[b'\x04'])
+        )
+        client_intepreter.add_known_preimage(b'\x00' + serialized_outputs)
+
+        self.n_inputs: int = len(input_maps)
+        self.n_outputs: int = len(output_maps)
+        self.wallet_id: bytes = wallet.id
+        self.psbt_commitment: bytes = global_commitment + \
+            write_varint(len(input_maps)) + inputs_root + \
+            write_varint(len(output_maps)) + outputs_root
+        self.known_preimages: Mapping[bytes, bytes] = client_intepreter.known_preimages
+        self.known_trees: Mapping[bytes, MerkleTree] = client_intepreter.known_trees
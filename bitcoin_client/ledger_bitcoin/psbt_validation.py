@@ -0,0 +1,267 @@
+import copy
+import re
+from concurrent.futures import ThreadPoolExecutor
+from dataclasses import dataclass, field
+from typing import List, Optional, Sequence, Tuple, Union
+
+from .common import hash256
+from .key import KeyOriginInfo
+from .psbt import PSBT, PartiallySignedInput, normalize_psbt
+from .wallet import WalletPolicy, WalletType
+
+SIGHASH_DEFAULT = 0x00
+SIGHASH_ALL = 0x01
+SIGHASH_NONE = 0x02
+SIGHASH_SINGLE = 0x03
+SIGHASH_ANYONECANPAY = 0x80
+
+# the limits of the app
+MAX_BIP32_PATH_STEPS = 8
+
+
+@dataclass(frozen=True)
+class PsbtIssue:
+    """A reason why the device would reject a PSBT in `sign_psbt`.
+
+    Attributes
+    ----------
+    kind : str
+        "input", "output" or "global".
+    index : Optional[int]
+        The index of the input or of the output, or `None` for a global issue.
+    message : str
+        The description of the issue.
+    """
+
+    kind: str
+    index: Optional[int]
+    message: str
+
+    def __str__(self) -> str:
+        if self.index is None:
+            return self.message
+        return f"{self.kind} {self.index}: {self.message}"
+
+
+@dataclass
+class _Placeholder:
+    """A key placeholder of the wallet policy, whose key has an origin."""
+
+    origin: KeyOriginInfo
+    change_steps: Tuple[int, int]
+
+
+@dataclass
+class _InputCheck:
+    issues: List[PsbtIssue] = field(default_factory=list)
+    amount: Optional[int] = None
+    is_internal: bool = False
+
+
+def _get_policy_segwit_version(descriptor_template: str) -> int:
+    if descriptor_template.startswith("tr("):
+        return 1
+    if descriptor_template.startswith(("wpkh(", "wsh(", "sh(wpkh(", "sh(wsh(")):
+        return 0
+    return -1
+
+
+def _get_internal_placeholders(wallet: WalletPolicy, master_fingerprint: Optional[bytes]) -> List[_Placeholder]:
+    """Returns the placeholders whose derivations can make an input internal, in the order of the policy.
+
+    The device only uses the first placeholder of its own key: without the master fingerprint, all the keys with
+    an origin are candidates."""
+
+    if wallet.version == WalletType.WALLET_POLICY_V1:
+        # in V1, the /** is part of the key information
+        placeholders = [(int(i), 0, 1) for i in re.findall(r"@(\d+)", wallet.descriptor_template)]
+    else:
+        placeholders = []
+        for m in re.finditer(r"@(\d+)/(?:\*\*|<(\d+);(\d+)>/\*)", wallet.descriptor_template):
+            if m.group(2) is None:
+                placeholders.append((int(m.group(1)), 0, 1))
+            else:
+                placeholders.append((int(m.group(1)), int(m.group(2)), int(m.group(3))))
+
+    result: List[_Placeholder] = []
+    for key_index, num_first, num_second in placeholders:
+        if key_index >= wallet.n_keys:
+            continue
+        m = re.match(r"^\[([0-9a-fA-F]{8}(?:/\d+['h]?)*)\]", wallet.keys_info[key_index])
+        if m is None:
+            continue
+        origin = KeyOriginInfo.from_string(m.group(1))
+        if master_fingerprint is None:
+            result.append(_Placeholder(origin, (num_first, num_second)))
+        elif origin.fingerprint == master_fingerprint:
+            return [_Placeholder(origin, (num_first, num_second))]
+    return result
+
+
+def _matches_placeholder(origin: KeyOriginInfo, placeholders: Sequence[_Placeholder]) -> bool:
+    """Returns True if a derivation is at the change or at the receive path of one of the placeholders.
+
+    Like the device, only the fingerprint and the derivation path are compared; the pubkey is not derived."""
+
+    path = list(origin.path)
+    for placeholder in placeholders:
+        prefix = list(placeholder.origin.path)
+        if (origin.fingerprint == placeholder.origin.fingerprint and len(path) == len(prefix) + 2
+                and path[:len(prefix)] == prefix and path[-2] in placeholder.change_steps):
+            return True
+    return False
+
+
+def _check_input(psbt: PSBT, index: int, placeholders: Sequence[_Placeholder], segwit_version: int,
+                 can_be_internal: bool) -> _InputCheck:
+    inp: PartiallySignedInput = psbt.inputs[index]
+    check = _InputCheck()
+
+    def issue(message: str) -> None:
+        check.issues.append(PsbtIssue("input", index, message))
+
+    # the derivations are read in the order of their keys in the map, until one of them matches
+    if can_be_internal:
+        derivations = sorted([(PartiallySignedInput.PSBT_IN_BIP32_DERIVATION, pubkey, origin)
+                              for pubkey, origin in inp.hd_keypaths.items()]
+                             + [(PartiallySignedInput.PSBT_IN_TAP_BIP32_DERIVATION, xonly, origin)
+                                for xonly, (_, origin) in inp.tap_bip32_paths.items()],
+                             key=lambda d: (d[0], d[1]))
+        for key_type, pubkey, origin in derivations:
+            if key_type == PartiallySignedInput.PSBT_IN_BIP32_DERIVATION and len(pubkey) != 33:
+                issue("only compressed pubkeys are supported in the BIP32 derivations")
+                break
+            if not 2 <= len(origin.path) <= MAX_BIP32_PATH_STEPS:
+                issue(f"the BIP32 derivations must have between 2 and {MAX_BIP32_PATH_STEPS} steps")
+                break
+            if _matches_placeholder(origin, placeholders):
+                check.is_internal = True
+                break
+
+    if inp.non_witness_utxo is None and inp.witness_utxo is None:
+        issue("neither the witness utxo nor the non-witness utxo is present")
+        return check
+
+    if len(inp.prev_txid) != 32:
+        issue("the previous txid is missing")
+        return check
+
+    # for taproot policies, the device does not use the non-witness utxo if the witness utxo is present
+    use_non_witness_utxo = (inp.non_witness_utxo is not None
+                            and not (segwit_version >= 1 and inp.witness_utxo is not None))
+    if use_non_witness_utxo:
+        # hashlib releases the GIL while hashing large transactions: this is where the threads help
+        txid = hash256(inp.non_witness_utxo.serialize_without_witness())
+        if txid != inp.prev_txid:
+            issue("the txid of the non-witness utxo does not match the previous txid")
+            return check
+        if inp.prev_out is None or inp.prev_out >= len(inp.non_witness_utxo.vout):
+            issue("the output index is not an output of the non-witness utxo")
+            return check
+        prevout = inp.non_witness_utxo.vout[inp.prev_out]
+        check.amount = prevout.nValue
+        if inp.witness_utxo is not None and (inp.witness_utxo.nValue != prevout.nValue
+                                             or inp.witness_utxo.scriptPubKey != prevout.scriptPubKey):
+            issue("the amount or the script of the witness utxo do not match the non-witness utxo")
+            return check
+    else:
+        check.amount = inp.witness_utxo.nValue
+
+    if not check.is_internal:
+        return check
+
+    if segwit_version == -1 and (inp.non_witness_utxo is None or inp.witness_utxo is not None):
+        issue("legacy inputs must have the non-witness utxo, but no witness utxo")
+    if segwit_version >= 0 and inp.witness_utxo is None:
+        issue("the witness utxo is missing for a segwit input")
+
+    if inp.sighash is not None:
+        sighash = inp.sighash
+        if not ((segwit_version > 0 and sighash == SIGHASH_DEFAULT) or sighash == SIGHASH_ALL or (
+                segwit_version >= 0 and sighash in (SIGHASH_NONE, SIGHASH_SINGLE,
+                                                    SIGHASH_ANYONECANPAY | SIGHASH_ALL,
+                                                    SIGHASH_ANYONECANPAY | SIGHASH_NONE,
+                                                    SIGHASH_ANYONECANPAY | SIGHASH_SINGLE))):
+            issue(f"unsupported sighash type {sighash:#x}")
+        elif (sighash & SIGHASH_SINGLE) == SIGHASH_SINGLE and index >= len(psbt.outputs):
+            issue("SIGHASH_SINGLE is not allowed for an input without the output of the same index")
+
+    return check
+
+
+def validate_psbt(psbt: Union[PSBT, bytes, str], wallet: WalletPolicy, master_fingerprint: Optional[bytes] = None,
+                  inputs_to_sign: Optional[Sequence[int]] = None, max_workers: Optional[int] = None) -> List[PsbtIssue]:
+    """Checks, on the host, the fields of the PSBT that the device requires in order to sign it.
+
+    A PSBT with any issue would be rejected by `sign_psbt` after it was streamed to the device, often after tens or
+    hundreds of APDUs; checking it beforehand avoids the round trip. The inputs are checked in parallel, as the
+    txid of each non-witness utxo is computed from the whole previous transaction.
+
+    The checks are the ones of the device that do not need its keys: an input is assumed to be internal if one of
+    its BIP32 derivations has the fingerprint and the path of a key placeholder of the wallet policy. An empty
+    result therefore does not guarantee that the device signs the PSBT, but every issue is a certain rejection.
+
+    Parameters
+    ----------
+    psbt : PSBT | bytes | str
+        The PSBT, as in `Client.sign_psbt`; it is not modified.
+
+    wallet : WalletPolicy
+        The wallet policy that will be used to sign.
+
+    master_fingerprint : Optional[bytes]
+        The fingerprint of the device, as returned by `get_master_fingerprint`. If given, only the derivations of its
+        key can make an input internal, as on the device.
+
+    inputs_to_sign : Optional[Sequence[int]]
+        If given, the indices of the only inputs that can be internal, as in `Client.sign_psbt`.
+
+    max_workers : Optional[int]
+        The maximum number of threads, as in `ThreadPoolExecutor`.
+
+    Returns
+    -------
+    List[PsbtIssue]
+        The issues found, ordered by inputs, then outputs, then global issues; empty if none was found.
+    """
+
+    psbt = normalize_psbt(psbt)
+    if psbt.version != 2:
+        # a deep copy, rather than a serialization: deserializing would reject some of the issues with an exception
+        psbt_v2 = copy.deepcopy(psbt)
+        psbt_v2.convert_to_v2()
+        psbt = psbt_v2
+
+    segwit_version = _get_policy_segwit_version(wallet.descriptor_template)
+    placeholders = _get_internal_placeholders(wallet, master_fingerprint)
+    signable = set(range(len(psbt.inputs))) if inputs_to_sign is None else set(inputs_to_sign)
+
+    issues: List[PsbtIssue] = []
+    if len(placeholders) == 0:
+        issues.append(PsbtIssue("global", None, "no key of the wallet policy is internal"))
+        return issues
+
+    with ThreadPoolExecutor(max_workers=max_workers) as executor:
+        input_checks = list(executor.map(
+            lambda i: _check_input(psbt, i, placeholders, segwit_version, i in signable),
+            range(len(psbt.inputs))))
+
+    for check in input_checks:
+        issues.extend(check.issues)
+
+    outputs_total_amount = 0
+    for i, out in enumerate(psbt.outputs):
+        if out.amount is None:
+            issues.append(PsbtIssue("output", i, "the amount is missing"))
+            continue
+        if len(out.script) == 0:
+            issues.append(PsbtIssue("output", i, "the script is missing"))
+        outputs_total_amount += out.amount
+
+    if all(check.issues == [] for check in input_checks):
+        if not any(check.is_internal for check in input_checks):
+            issues.append(PsbtIssue("global", None, "no input has a BIP32 derivation of the wallet policy"))
+        elif sum(check.amount for check in input_checks) < outputs_total_amount:
+            issues.append(PsbtIssue("global", None, "the outputs spend more than the inputs"))
+
+    return issues
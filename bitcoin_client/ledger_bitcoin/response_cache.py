@@ -0,0 +1,146 @@
+from collections import OrderedDict
+from threading import Lock
+from typing import Any, Hashable, List, Optional, Tuple
+
+from .client_base import Client
+from .wallet import WalletPolicy
+
+
+class ResponseCache:
+    """The responses of the device queries whose result only depends on the seed of the device, keyed by the
+    master fingerprint of the device and the request.
+
+    It can be shared by several `CachingClient` instances, for example by the clients of a pool of devices, from
+    several threads. At most `max_entries` responses are kept; the least recently used are evicted first.
+    """
+
+    def __init__(self, max_entries: int = 4096):
+        if max_entries < 1:
+            raise ValueError("max_entries must be positive")
+        self.max_entries = max_entries
+        self._entries: 'OrderedDict[Tuple[bytes, Hashable], Any]' = OrderedDict()
+        self._lock = Lock()
+
+    def __len__(self) -> int:
+        with self._lock:
+            return len(self._entries)
+
+    def get(self, fingerprint: bytes, request: Hashable) -> Optional[Any]:
+        """Returns the cached response to the request for the device with the given master fingerprint, or None."""
+        with self._lock:
+            key = (fingerprint, request)
+            response = self._entries.get(key)
+            if response is not None:
+                self._entries.move_to_end(key)
+            return response
+
+    def put(self, fingerprint: bytes, request: Hashable, response: Any) -> None:
+        with self._lock:
+            key = (fingerprint, request)
+            self._entries[key] = response
+            self._entries.move_to_end(key)
+            while len(self._entries) > self.max_entries:
+                self._entries.popitem(last=False)
+
+    def invalidate(self, fingerprint: Optional[bytes] = None) -> None:
+        """Forgets the responses of the device with the given master fingerprint, or of all the devices."""
+        with self._lock:
+            if fingerprint is None:
+                self._entries.clear()
+            else:
+                for key in [key for key in self._entries if key[0] == fingerprint]:
+                    del self._entries[key]
+
+
+class CachingClient:
+    """Wraps a client, and answers the repeated queries whose result is deterministic for a given seed from a
+    `ResponseCache`, without interrupting the device:
+
+    - `get_master_fingerprint`, that is queried once and kept until `invalidate`;
+    - `get_extended_pubkey` and `get_extended_pubkeys`, without display;
+    - `get_wallet_address` and `get_wallet_addresses`, without display, for the same wallet policy and hmac.
+
+    The queries that show something on the screen, and all the other methods, are forwarded to the wrapped client.
+
+    The responses are keyed by the master fingerprint of the device: if the device of the transport may be replaced,
+    or its seed changed, `invalidate` must be called, otherwise the responses of the previous seed would be
+    returned.
+    """
+
+    def __init__(self, client: Client, cache: Optional[ResponseCache] = None):
+        self.client = client
+        self.cache = cache if cache is not None else ResponseCache()
+        self._fingerprint: Optional[bytes] = None
+
+    def __getattr__(self, name: str) -> Any:
+        return getattr(self.client, name)
+
+    def invalidate(self) -> None:
+        """Forgets the responses of the device, and its master fingerprint, that is queried again on next use."""
+        if self._fingerprint is not None:
+            self.cache.invalidate(self._fingerprint)
+        self._fingerprint = None
+
+    def get_master_fingerprint(self) -> bytes:
+        if self._fingerprint is None:
+            self._fingerprint = self.client.get_master_fingerprint()
+        return self._fingerprint
+
+    def get_extended_pubkey(self, path: str, display: bool = False) -> str:
+        if display:
+            return self.client.get_extended_pubkey(path, True)
+
+        fingerprint = self.get_master_fingerprint()
+        request = ("xpub", path)
+        xpub = self.cache.get(fingerprint, request)
+        if xpub is None:
+            xpub = self.client.get_extended_pubkey(path, False)
+            self.cache.put(fingerprint, request, xpub)
+        return xpub
+
+    def get_extended_pubkeys(self, paths: List[str]) -> List[str]:
+        fingerprint = self.get_master_fingerprint()
+        results = [self.cache.get(fingerprint, ("xpub", path)) for path in paths]
+
+        missing = [i for i, xpub in enumerate(results) if xpub is None]
+        if len(missing) > 0:
+            # a single batch for all the missing paths
+            xpubs = self.client.get_extended_pubkeys([paths[i] for i in missing])
+            for i, xpub in zip(missing, xpubs):
+                self.cache.put(fingerprint, ("xpub", paths[i]), xpub)
+                results[i] = xpub
+        return results
+
+    def get_wallet_address(self, wallet: WalletPolicy, wallet_hmac: Optional[bytes], change: int, address_index: int,
+                           display: bool) -> str:
+        if display:
+            return self.client.get_wallet_address(wallet, wallet_hmac, change, address_index, True)
+
+        fingerprint = self.get_master_fingerprint()
+        # the hmac is part of the request: an address is only returned for a wallet policy that the device accepted
+        request = ("address", wallet.id, wallet_hmac, change, address_index)
+        address = self.cache.get(fingerprint, request)
+        if address is None:
+            address = self.client.get_wallet_address(wallet, wallet_hmac, change, address_index, False)
+            self.cache.put(fingerprint, request, address)
+        return address
+
+    def get_wallet_addresses(self, wallet: WalletPolicy, wallet_hmac: Optional[bytes], change: int, start_index: int,
+                             count: int) -> List[str]:
+        if count < 1:
+            raise ValueError("Invalid count")
+
+        fingerprint = self.get_master_fingerprint()
+        requests = [("address", wallet.id, wallet_hmac, change, start_index + i) for i in range(count)]
+        results = [self.cache.get(fingerprint, request) for request in requests]
+
+        missing = [i for i, address in enumerate(results) if address is None]
+        if len(missing) > 0:
+            # a single request for the range from the first to the last missing address
+            first, last = missing[0], missing[-1]
+            addresses = self.client.get_wallet_addresses(wallet, wallet_hmac, change, start_index + first,
+                                                         last - first + 1)
+            for i, address in enumerate(addresses, first):
+                self.cache.put(fingerprint, requests[i], address)
+                results[i] = address
+        return results
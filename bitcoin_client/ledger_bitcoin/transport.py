@@ -10,6 +10,12 @@ from ledgercomm.interfaces.hid_device import HID
 from ledgercomm.log import LOG
 
 
+# header of an APDU without the option byte: CLA, INS, P1, P2, Lc
+APDU_HEADER = struct.Struct("BBBBB")
+
+MAX_APDU_DATA_LENGTH = 255
+
+
 class TransportType(enum.Enum):
     """Type of interface available."""
 
@@ -61,6 +67,9 @@ class Transport:
 
         self.inferface: TransportType
 
+        # reused by exchange_apdu for each APDU
+        self.apdu_buffer = bytearray(APDU_HEADER.size + MAX_APDU_DATA_LENGTH)
+
         try:
             self.interface = TransportType[interface.upper()]
         except KeyError as exc:
@@ -232,6 +241,40 @@ class Transport:
 
         return self.com.exchange(header + cdata)
 
+    def exchange_apdu(self, cla: int, ins: int, p1: int, p2: int, cdata: bytes) -> Tuple[int, bytes]:
+        """Same as `exchange` for an APDU without option byte, but faster: the APDU is assembled in
+        a buffer that is reused for each call, rather than by concatenating the header and the data.
+
+        Parameters
+        ----------
+        cla : int
+            Instruction class: CLA (1 byte)
+        ins : int
+            Instruction code: INS (1 byte)
+        p1 : int
+            Instruction parameter: P1 (1 byte).
+        p2 : int
+            Instruction parameter: P2 (1 byte).
+        cdata : bytes
+            Command data (at most 255 bytes).
+
+        Returns
+        -------
+        Tuple[int, bytes]
+            A pair (sw, rdata) for the status word (2 bytes represented
+            as int) and the reponse data (bytes of variable lenght).
+
+        """
+        lc = len(cdata)
+        if lc > MAX_APDU_DATA_LENGTH:
+            raise ValueError(f"The data of an APDU must be at most {MAX_APDU_DATA_LENGTH} bytes long.")
+
+        apdu_len = APDU_HEADER.size + lc
+        APDU_HEADER.pack_into(self.apdu_buffer, 0, cla, ins, p1, p2, lc)
+        self.apdu_buffer[APDU_HEADER.size:apdu_len] = cdata
+
+        return self.com.exchange(bytes(memoryview(self.apdu_buffer)[:apdu_len]))
+
     def exchange_raw(self, apdu: Union[str, bytes]) -> Tuple[int, bytes]:
         """Send raw bytes `apdu` and wait to receive datas from `self.com`.
 
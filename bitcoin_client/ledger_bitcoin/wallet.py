@@ -13,6 +13,13 @@ class WalletType(IntEnum):
     WALLET_POLICY_V2 = 2
 
 
+# set in the version byte of the inline serialization of a V2 wallet policy
+WALLET_POLICY_INLINE_FLAG = 0x80
+
+# maximum number of keys of a wallet policy in the inline serialization
+MAX_N_KEYS_INLINE = 10
+
+
 # should not be instantiated directly
 class WalletPolicyBase:
     def __init__(self, name: str, version: WalletType) -> None:
@@ -70,6 +77,24 @@ class WalletPolicy(WalletPolicyBase):
             MerkleTree(keys_info_hashes).root
         ])
 
+    def serialize_inline(self) -> bytes:
+        """Returns the inline serialization of a V2 wallet policy, with the descriptor template and the keys
+        information instead of their commitments. It has the same id as the one of `serialize`."""
+
+        if self.version != WalletType.WALLET_POLICY_V2:
+            raise ValueError("only V2 wallet policies can be serialized inline")
+        if not 1 <= len(self.keys_info) <= MAX_N_KEYS_INLINE:
+            raise ValueError(f"the inline serialization must have between 1 and {MAX_N_KEYS_INLINE} keys")
+
+        return b"".join([
+            (self.version.value | WALLET_POLICY_INLINE_FLAG).to_bytes(1, byteorder="big"),
+            serialize_str(self.name),
+            write_varint(len(self.descriptor_template.encode())),
+            self.descriptor_template.encode(),
+            write_varint(len(self.keys_info)),
+            *(write_varint(len(k.encode())) + k.encode() for k in self.keys_info)
+        ])
+
     def get_descriptor(self, change: bool) -> str:
         desc = self.descriptor_template
         for i in reversed(range(self.n_keys)):
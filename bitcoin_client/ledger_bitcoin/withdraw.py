@@ -1,4 +1,8 @@
 
+import math
+from typing import List
+
+
 class AcreWithdrawalDataBytes:
     def __init__(self, to: bytes, value: bytes, data: bytes, operation: bytes, safeTxGas: bytes, baseGas: bytes, gasPrice: bytes, gasToken: bytes, refundReceiver: bytes, nonce: bytes):
         self.to = to
@@ -12,6 +16,44 @@ class AcreWithdrawalDataBytes:
         self.refundReceiver = refundReceiver
         self.nonce = nonce
 
+    def to_chunks(self) -> List[bytes]:
+        """Returns the list of chunks of the withdrawal data, as committed by its Merkle root."""
+        chunks = []
+
+        # Chunk 0: to[20] + gasToken[20] + refundReceiver[20]
+        chunks.append(self.to + self.gasToken + self.refundReceiver)
+
+        # Chunk 1: value[32] + safeTxGas[32]
+        chunks.append(self.value + self.safeTxGas)
+
+        # Chunk 2: baseGas[32] + gasPrice[32]
+        chunks.append(self.baseGas + self.gasPrice)
+
+        # Chunk 3: nonce[32] + operation[1]
+        chunks.append(self.nonce + self.operation)
+
+        # Chunk 4: data_selector[4] (the first 4 bytes of data)
+        chunks.append(self.data[:4])
+
+        # Calculate the number of 64-byte chunks needed for the remaining data
+        n_chunks_data = math.ceil((len(self.data) - 4) / 64)
+
+        # Chunk 5 to n: data[64]
+        for i in range(n_chunks_data):
+            chunks.append(self.data[4 + 64 * i: 4 + 64 * (i + 1)])
+
+        return chunks
+
+    def to_leaves(self, chunks_per_leaf: int) -> List[bytes]:
+        """Returns the leaves of the Merkle tree of the withdrawal data, of chunks_per_leaf chunks each (fewer for the
+        last leaf). In each leaf, all the chunks but the last one are padded with zeros to 64 bytes."""
+        chunks = self.to_chunks()
+        leaves = []
+        for i in range(0, len(chunks), chunks_per_leaf):
+            group = chunks[i: i + chunks_per_leaf]
+            leaves.append(b''.join(c.ljust(64, b'\x00') for c in group[:-1]) + group[-1])
+        return leaves
+
 class AcreWithdrawalData:
     def __init__(self, to: str, value: str, data: str, operation: str, safeTxGas: str, baseGas: str, gasPrice: str, gasToken: str, refundReceiver: str, nonce: str):
         self.to = to
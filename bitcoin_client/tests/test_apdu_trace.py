@@ -0,0 +1,70 @@
+from bitcoin_client.ledger_bitcoin.apdu_trace import ApduTrace, RecordingTransportClient, replay_trace
+from bitcoin_client.ledger_bitcoin.client_base import ApduException, TransportClient
+
+
+class FakeTransportClient(TransportClient):
+    """A device that answers each APDU with its data reversed, and rejects the INS 0xFF."""
+
+    def __init__(self, suffix: bytes = b""):
+        self.suffix = suffix
+        self.received = []
+
+    def apdu_exchange(self, cla: int, ins: int, data: bytes = b"", p1: int = 0, p2: int = 0) -> bytes:
+        self.received.append((cla, ins, p1, p2, data))
+        if ins == 0xFF:
+            raise ApduException(0x6A80, b"\x01")
+        return data[::-1] + self.suffix
+
+    def stop(self) -> None:
+        pass
+
+
+APDUS = [(0xE1, 0x04, b"\x01\x02\x03", 0, 1), (0xF8, 0x01, b"\xaa" * 300, 0, 0), (0xE1, 0xFF, b"", 2, 3),
+         (0xF8, 0x01, b"", 0, 0)]
+
+
+def record() -> ApduTrace:
+    recorder = RecordingTransportClient(FakeTransportClient())
+    for cla, ins, data, p1, p2 in APDUS:
+        try:
+            recorder.apdu_exchange(cla, ins, data, p1, p2)
+        except ApduException:
+            pass
+    return recorder.trace
+
+
+def test_apdu_trace_serialization():
+    trace = record()
+
+    assert [(e.cla, e.ins, e.data, e.p1, e.p2) for e in trace.events] == APDUS
+    assert [e.sw for e in trace.events] == [0x9000, 0x9000, 0x6A80, 0x9000]
+    assert trace.events[1].response == b"\xaa" * 300
+    assert trace.events[2].response == b"\x01"
+    for i, e in enumerate(trace.events):
+        assert e.received_at >= e.sent_at
+        assert trace.host_time(i) >= 0
+
+    assert ApduTrace.deserialize(trace.serialize()) == trace
+
+    try:
+        ApduTrace.deserialize(b"not a trace")
+        assert False, "expected ValueError"
+    except ValueError:
+        pass
+
+
+def test_apdu_trace_replay():
+    trace = record()
+
+    device = FakeTransportClient()
+    result = replay_trace(device, trace, paced=True)
+    assert device.received == [(cla, ins, p1, p2, data) for cla, ins, data, p1, p2 in APDUS]
+    assert result.first_mismatch is None
+    assert all(e.device_time >= 0 for e in result.events)
+
+    # the replay stops at the first response that differs from the recording
+    result = replay_trace(FakeTransportClient(suffix=b"\x00"), trace)
+    assert len(result.events) == 1 and result.first_mismatch == 0
+
+    result = replay_trace(FakeTransportClient(suffix=b"\x00"), trace, stop_on_mismatch=False)
+    assert [e.matches for e in result.events] == [False, False, True, False]
@@ -0,0 +1,125 @@
+import pytest
+
+from bitcoin_client.ledger_bitcoin.capabilities import AppCapabilities, AppCapabilityFlag, AppLimit
+from bitcoin_client.ledger_bitcoin.client import NewClient, createClient
+from bitcoin_client.ledger_bitcoin.client_base import ApduException, TransportClient
+from bitcoin_client.ledger_bitcoin.command_builder import BitcoinCommandBuilder, BitcoinInsType, \
+    CURRENT_PROTOCOL_VERSION, MAX_CHUNKS_PER_LEAF, MAX_EXTENDED_CONTINUE_LENGTH, MAX_N_PSBTS_IN_BATCH
+from bitcoin_client.ledger_bitcoin.wallet import WalletPolicy
+
+
+def serialize_capabilities(max_protocol_version: int, limits: dict, client_commands: int = 0x000001FF,
+                           flags: int = 0) -> bytes:
+    res = bytes([1, max_protocol_version]) + client_commands.to_bytes(4, 'big') + bytes([flags, len(limits)])
+    for limit_id, value in limits.items():
+        res += bytes([limit_id]) + value.to_bytes(4, 'big')
+    return res
+
+
+class CapabilitiesTransportClient(TransportClient):
+    """A device that only answers GET_APP_CAPABILITIES, with a fixed response or status word."""
+
+    def __init__(self, response: bytes = b"", sw: int = 0x9000):
+        self.response = response
+        self.sw = sw
+        self.received = []
+
+    def apdu_exchange(self, cla: int, ins: int, data: bytes = b"", p1: int = 0, p2: int = 0) -> bytes:
+        self.received.append((cla, ins, p2))
+        if self.sw != 0x9000 or (cla, ins) != (BitcoinCommandBuilder.CLA_BITCOIN,
+                                               BitcoinInsType.GET_APP_CAPABILITIES):
+            raise ApduException(self.sw if self.sw != 0x9000 else 0x6D00, b"")
+        return self.response
+
+    def stop(self) -> None:
+        pass
+
+
+def test_deserialize_capabilities():
+    data = serialize_capabilities(9, {AppLimit.MAX_CONTINUE_LENGTH: 1024, 0x7F: 5},
+                                  flags=AppCapabilityFlag.PERF_BUILD)
+    capabilities = AppCapabilities.deserialize(data)
+
+    assert capabilities.max_protocol_version == 9
+    assert capabilities.flags == AppCapabilityFlag.PERF_BUILD
+    assert capabilities.supports_client_command(0x40)
+    assert capabilities.supports_client_command(0x48)
+    assert not capabilities.supports_client_command(0x49)
+    assert not capabilities.supports_client_command(0x10)
+    assert capabilities.limit(AppLimit.MAX_CONTINUE_LENGTH) == 1024
+    assert capabilities.limit(AppLimit.MAX_N_PSBTS_IN_BATCH, 32) == 32
+    # unknown limits are kept by their identifier
+    assert capabilities.limit(0x7F) == 5
+
+
+@pytest.mark.parametrize("data", [
+    b"",
+    bytes([2]) + serialize_capabilities(9, {})[1:],  # unknown format
+    serialize_capabilities(9, {AppLimit.MAX_CONTINUE_LENGTH: 1024})[:-1],  # truncated
+    serialize_capabilities(9, {}) + b"\x00",  # trailing data
+])
+def test_deserialize_capabilities_invalid(data: bytes):
+    with pytest.raises(ValueError):
+        AppCapabilities.deserialize(data)
+
+
+def test_negotiate_capabilities():
+    transport = CapabilitiesTransportClient(serialize_capabilities(CURRENT_PROTOCOL_VERSION, {
+        AppLimit.MAX_CONTINUE_LENGTH: 512,
+        AppLimit.MAX_N_PSBTS_IN_BATCH: 4,
+        AppLimit.MAX_WITHDRAW_BATCH_SIZE: 2,
+    }))
+    client = createClient(transport)
+
+    # the capabilities are queried with the version 0 of the protocol, that any app accepts
+    assert transport.received == [(BitcoinCommandBuilder.CLA_BITCOIN, BitcoinInsType.GET_APP_CAPABILITIES, 0)]
+    assert client.capabilities is not None
+    assert client.builder.protocol_version == CURRENT_PROTOCOL_VERSION
+    assert client.max_continue_length == 512
+    assert client.chunks_per_leaf == MAX_CHUNKS_PER_LEAF
+    assert client.max_n_psbts_in_batch == 4
+    assert client.max_withdraw_batch_size == 2
+
+    with pytest.raises(ValueError):
+        client.sign_psbt_batch([b""] * 5, None, None)
+
+
+def test_negotiate_capabilities_older_version():
+    client = createClient(CapabilitiesTransportClient(serialize_capabilities(6, {})))
+
+    assert client.builder.protocol_version == 6
+    assert client.max_continue_length == MAX_EXTENDED_CONTINUE_LENGTH
+    assert client.chunks_per_leaf == 1
+
+    # the requests are serialized in the format of the negotiated version
+    assert client.builder.get_master_fingerprint()["p2"] == 6
+    apdu = client.builder.sign_message(b"hello", "m/44'/1'/0'", client.chunks_per_leaf)
+    assert apdu["data"] == client.builder.sign_message(b"hello", "m/44'/1'/0'", 1)["data"]
+    assert len(apdu["data"]) == 1 + 4 * 3 + 1 + 32
+
+    wallet = WalletPolicy(
+        name="",
+        descriptor_template="wpkh(@0/**)",
+        keys_info=["[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"],
+    )
+    assert client.builder.register_wallet(wallet)["data"] == client.builder.register_wallet(wallet, inline=False)["data"]
+
+
+def test_negotiate_capabilities_unsupported():
+    # older apps reject the command: the client keeps the defaults
+    transport = CapabilitiesTransportClient(sw=0x6D00)
+    client = createClient(transport)
+
+    assert len(transport.received) == 1
+    assert client.capabilities is None
+    assert client.builder.protocol_version == CURRENT_PROTOCOL_VERSION
+    assert client.max_n_psbts_in_batch == MAX_N_PSBTS_IN_BATCH
+
+
+def test_create_client_without_negotiation():
+    transport = CapabilitiesTransportClient(serialize_capabilities(6, {}))
+    client = createClient(transport, negotiate=False)
+
+    assert isinstance(client, NewClient)
+    assert transport.received == []
+    assert client.builder.protocol_version == CURRENT_PROTOCOL_VERSION
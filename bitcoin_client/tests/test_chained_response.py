@@ -0,0 +1,60 @@
+from bitcoin_client.ledger_bitcoin.client import NewClient
+from bitcoin_client.ledger_bitcoin.client_base import ApduException, TransportClient
+from bitcoin_client.ledger_bitcoin.command_builder import BitcoinCommandBuilder, FrameworkInsType
+
+CHUNK_LENGTH = 258
+
+
+class ChainingTransportClient(TransportClient):
+    """A device that answers each command with a fixed response, split in chunks like the app does."""
+
+    def __init__(self, response: bytes, sw: int = 0x9000):
+        self.response = response
+        self.sw = sw
+        self.offset = 0
+        self.received = []
+
+    def apdu_exchange(self, cla: int, ins: int, data: bytes = b"", p1: int = 0, p2: int = 0) -> bytes:
+        self.received.append((cla, ins))
+        if (cla, ins) != (BitcoinCommandBuilder.CLA_FRAMEWORK, FrameworkInsType.GET_RESPONSE):
+            self.offset = 0
+
+        remaining = len(self.response) - self.offset
+        if remaining > CHUNK_LENGTH:
+            chunk = self.response[self.offset:self.offset + CHUNK_LENGTH]
+            self.offset += CHUNK_LENGTH
+            raise ApduException(0x6100 | min(remaining - CHUNK_LENGTH, 0xFF), chunk)
+
+        chunk = self.response[self.offset:]
+        if self.sw != 0x9000:
+            raise ApduException(self.sw, chunk)
+        return chunk
+
+    def stop(self) -> None:
+        pass
+
+
+def test_chained_response():
+    xpub = "x" * 600
+    transport = ChainingTransportClient(xpub.encode())
+    client = NewClient(transport)
+
+    assert client.get_extended_pubkey("m/44'/1'/0'") == xpub
+    assert [ins for _, ins in transport.received] == [0x00, FrameworkInsType.GET_RESPONSE,
+                                                      FrameworkInsType.GET_RESPONSE]
+
+    # a response that fits in a single APDU is not chained
+    transport.response = b"\xf5\xac\xc2\xfd"
+    transport.received = []
+    assert client.get_master_fingerprint() == b"\xf5\xac\xc2\xfd"
+    assert len(transport.received) == 1
+
+
+def test_chained_response_status_word():
+    # only the last chunk has the status word of the response
+    transport = ChainingTransportClient(b"\x01" * 300, sw=0x6A80)
+    client = NewClient(transport)
+
+    sw, response = client._make_request(client.builder.get_master_fingerprint())
+    assert sw == 0x6A80
+    assert response == b"\x01" * 300
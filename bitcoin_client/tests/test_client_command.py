@@ -0,0 +1,214 @@
+from collections import deque
+from hashlib import sha256
+
+import pytest
+
+from bitcoin_client.ledger_bitcoin.client_command import ByteRun, ClientCommandInterpreter, GetMoreElementsCommand, \
+    GetPreimageCommand, PARALLEL_HASH_MIN_LEN, PARALLEL_HASH_MIN_TOTAL_LEN, hash_preimages
+from bitcoin_client.ledger_bitcoin.common import ByteStreamParser, write_varint
+from bitcoin_client.ledger_bitcoin.merkle import MerkleTree, element_hash, get_merkleized_map_commitment
+
+from .test_merkle import root_from_leaves_proof
+
+
+def test_get_preimage_long():
+    # the bytes of a preimage that do not fit in the first response are queued as a single run,
+    # and returned by GET_MORE_ELEMENTS in groups of single-byte elements
+    preimage = b'\0' + bytes(i % 251 for i in range(100_000))
+    preimage_hash = sha256(preimage).digest()
+
+    for max_response_len in [255, 1000]:
+        queue = deque()
+        get_preimage = GetPreimageCommand({preimage_hash: preimage}, queue)
+        get_more_elements = GetMoreElementsCommand(queue, max_response_len)
+
+        res = ByteStreamParser(get_preimage.execute(b'\x40\x00' + preimage_hash))
+        assert res.read_varint() == len(preimage)
+        received = res.read_bytes(res.read_uint(1))
+        res.assert_empty()
+
+        assert len(queue) == 1 and isinstance(queue[0], ByteRun)
+
+        while len(queue) > 0:
+            response = get_more_elements.execute(b'\xa0')
+            assert len(response) <= max_response_len
+
+            pos = 0
+            while pos < len(response):
+                n_bytes, elements_len = response[pos], response[pos + 1]
+                assert elements_len == 1
+                received += response[pos + 2:pos + 2 + n_bytes]
+                pos += 2 + n_bytes
+            assert pos == len(response)
+
+        assert received == preimage
+
+
+def test_get_merkleized_map_values():
+    mapping = {bytes([2 * i]): bytes([i]) * (4 + 30 * i) for i in range(8)}
+    interpreter = ClientCommandInterpreter()
+    commitment = interpreter.add_known_mapping(mapping)
+    size = ByteStreamParser(commitment).read_varint()
+    keys_root, values_root = commitment[-64:-32], commitment[-32:]
+
+    sorted_keys = sorted(mapping.keys())
+    requested_keys = [b'\x0c', b'\x05', b'\x02', b'\x04']
+    request = b''.join([b'\x46', keys_root, values_root, write_varint(size), bytes([len(requested_keys)]),
+                        *(element_hash(key) for key in requested_keys)])
+
+    # the answer is longer than a response, and the rest is returned by GET_MORE_ELEMENTS
+    res = ByteStreamParser(interpreter.execute(request))
+    answer_len = res.read_varint()
+    answer = res.read_bytes(res.read_uint(1))
+    res.assert_empty()
+    while len(answer) < answer_len:
+        res = ByteStreamParser(interpreter.execute(b'\xa0'))
+        n_bytes, elements_len = res.read_uint(1), res.read_uint(1)
+        assert elements_len == 1
+        answer += res.read_bytes(n_bytes)
+        res.assert_empty()
+
+    ans = ByteStreamParser(answer)
+    found = {}
+    for key in requested_keys:
+        is_found, index = ans.read_uint(1), ans.read_varint()
+        assert is_found == (key in mapping)
+        if is_found:
+            assert sorted_keys[index] == key
+            found[index] = key
+    indices = sorted(found)
+
+    def read_proof(tree_size, with_elements):
+        proof, elements = [], []
+
+        def visit(begin, size):
+            if not any(begin <= i < begin + size for i in indices):
+                proof.append(ans.read_bytes(32))
+            elif size == 1:
+                proof.append(None)
+                if with_elements:
+                    elements.append(ans.read_bytes(ans.read_varint()))
+            else:
+                lchild_size = 1 << (size - 1).bit_length() - 1
+                visit(begin, lchild_size)
+                visit(begin + lchild_size, size - lchild_size)
+
+        visit(0, tree_size)
+        return proof, elements
+
+    keys_proof, _ = read_proof(size, False)
+    assert root_from_leaves_proof(size, indices, [element_hash(found[i]) for i in indices], keys_proof) == keys_root
+
+    values_proof, values = read_proof(size, True)
+    assert values == [mapping[found[i]] for i in indices]
+    assert root_from_leaves_proof(size, indices, [element_hash(v) for v in values], values_proof) == values_root
+    ans.assert_empty()
+
+
+def test_multi_request():
+    elements = [bytes([i]) * (10 + 20 * i) for i in range(7)]
+    interpreter = ClientCommandInterpreter()
+    root = interpreter.add_known_list(elements)
+    mt = MerkleTree(element_hash(el) for el in elements)
+    preimage = b'\0' + elements[6]
+    unknown_leaf = element_hash(b'unknown')
+
+    request = b''.join([b'\x47', bytes([5]),
+                        b'\x41', root, write_varint(len(elements)), write_varint(3),
+                        b'\x40\x00', sha256(preimage).digest(),
+                        b'\x42', root, element_hash(elements[5]),
+                        b'\x42', root, unknown_leaf,
+                        b'\x41', root, write_varint(len(elements)), write_varint(6)])
+
+    # the answer is longer than a response, and the rest is returned by GET_MORE_ELEMENTS
+    res = ByteStreamParser(interpreter.execute(request))
+    answer_len = res.read_varint()
+    answer = res.read_bytes(res.read_uint(1))
+    res.assert_empty()
+    assert len(answer) < answer_len
+    while len(answer) < answer_len:
+        res = ByteStreamParser(interpreter.execute(b'\xa0'))
+        n_bytes, elements_len = res.read_uint(1), res.read_uint(1)
+        assert elements_len == 1
+        answer += res.read_bytes(n_bytes)
+        res.assert_empty()
+
+    ans = ByteStreamParser(answer)
+
+    def read_proof(leaf_index):
+        assert ans.read_bytes(32) == mt.get(leaf_index)
+        assert [ans.read_bytes(32) for _ in range(ans.read_uint(1))] == mt.prove_leaf(leaf_index)
+
+    read_proof(3)
+    assert ans.read_bytes(ans.read_varint()) == preimage
+    assert (ans.read_uint(1), ans.read_varint()) == (1, 5)
+    assert (ans.read_uint(1), ans.read_varint()) == (0, 0)
+    read_proof(6)
+    ans.assert_empty()
+
+
+def test_get_merkle_leaf_hashes():
+    elements = [bytes([i]) * (1 + i) for i in range(10)]
+    interpreter = ClientCommandInterpreter()
+    root = interpreter.add_known_list(elements)
+
+    request = b''.join([b'\x48', root, write_varint(len(elements))])
+
+    # the 320 bytes of the answer do not fit in a response, and the rest is returned by GET_MORE_ELEMENTS
+    res = ByteStreamParser(interpreter.execute(request))
+    answer_len = res.read_varint()
+    answer = res.read_bytes(res.read_uint(1))
+    res.assert_empty()
+    assert answer_len == 32 * len(elements) and len(answer) < answer_len
+    while len(answer) < answer_len:
+        res = ByteStreamParser(interpreter.execute(b'\xa0'))
+        n_bytes, elements_len = res.read_uint(1), res.read_uint(1)
+        assert elements_len == 1
+        answer += res.read_bytes(n_bytes)
+        res.assert_empty()
+
+    assert answer == b''.join(element_hash(el) for el in elements)
+
+
+def test_hash_preimages():
+    # enough long preimages to be hashed in threads, mixed with short ones
+    n_long = PARALLEL_HASH_MIN_TOTAL_LEN // PARALLEL_HASH_MIN_LEN
+    preimages = [bytes([i % 256]) * (PARALLEL_HASH_MIN_LEN if i % 2 == 0 else i) for i in range(2 * n_long)]
+    assert hash_preimages(preimages, max_workers=4) == [sha256(p).digest() for p in preimages]
+    assert hash_preimages(preimages[:3]) == [sha256(p).digest() for p in preimages[:3]]
+    assert hash_preimages([]) == []
+
+
+def test_add_known_mappings():
+    mappings = [{}, {b"\x01": b"a"}, {bytes([i]): bytes([i]) * i for i in range(20, 0, -1)}]
+
+    batched = ClientCommandInterpreter()
+    commitments = batched.add_known_mappings(mappings)
+    assert commitments == [get_merkleized_map_commitment(m) for m in mappings]
+
+    # the same preimages and trees as committing to the mappings one by one
+    one_by_one = ClientCommandInterpreter()
+    assert [one_by_one.add_known_mapping(m) for m in mappings] == commitments
+    assert batched.known_preimages == one_by_one.known_preimages
+    assert batched.known_trees.keys() == one_by_one.known_trees.keys()
+
+
+def test_deferred_yield():
+    interpreter = ClientCommandInterpreter()
+    preimage = b'\0hello'
+    interpreter.add_known_preimage(preimage)
+    preimage_hash = sha256(preimage).digest()
+
+    # the deferred YIELD message is collected, and the client command that follows it is answered
+    results = b'\x02\x00\x01'
+    response = interpreter.execute(b'\x11' + bytes([len(results)]) + results + b'\x40\x00' + preimage_hash)
+    assert interpreter.yielded == [results]
+    assert response == write_varint(len(preimage)) + bytes([len(preimage)]) + preimage
+
+    # it can also be prefixed to a YIELD message, that is collected after it
+    assert interpreter.execute(b'\x11\x01\xaa\x10\xbb') == b''
+    assert interpreter.yielded == [results, b'\xaa', b'\xbb']
+
+    for invalid in [b'\x11', b'\x11\x05\x00', b'\x11\x01\xaa', b'\x11\x01\xaa\x11\x01\xbb\x10']:
+        with pytest.raises(RuntimeError):
+            interpreter.execute(invalid)
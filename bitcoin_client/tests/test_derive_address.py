@@ -0,0 +1,32 @@
+from bitcoin_client.ledger_bitcoin.client import _parse_descriptor_for_derivation
+from bitcoin_client.ledger_bitcoin.embit.descriptor import Descriptor
+from bitcoin_client.ledger_bitcoin.embit.networks import NETWORKS
+from bitcoin_client.ledger_bitcoin.wallet import WalletPolicy
+
+keys_info = [
+    "[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P",
+    "tpubDCwYjpDhUdPGP5rS3wgNg13mTrrjBuG8V9VpWbyptX6TRPbNoZVXsoVUSkCjmQ8jJycjuDKBb9eataSymXakTTaGifxR6kmVsfFehH1ZgJT",
+]
+
+
+def test_parse_descriptor_for_derivation():
+    # the descriptors with the keys derived in advance derive the same addresses and keys
+    for descriptor_template in [
+        "wpkh(@0/**)",
+        "tr(@0/**)",
+        "wsh(sortedmulti(2,@0/**,@1/<2;3>/*))",
+        "sh(wsh(and_v(v:pk(@0/**),pkh(@1/**))))",
+        "tr(@1/**,{pk(@0/<0;1>/*),pkh(@1/<2;3>/*)})",
+    ]:
+        wallet = WalletPolicy("", descriptor_template, keys_info)
+        for change in [False, True]:
+            desc_str = wallet.get_descriptor(change)
+            desc = _parse_descriptor_for_derivation(desc_str)
+            assert _parse_descriptor_for_derivation(desc_str) is desc
+
+            for address_index in [0, 1, 1000]:
+                expected = Descriptor.from_string(desc_str).derive(address_index)
+                derived = desc.derive(address_index)
+                assert str(derived) == str(expected)
+                assert derived.script_pubkey().address(NETWORKS['test']) == \
+                    expected.script_pubkey().address(NETWORKS['test'])
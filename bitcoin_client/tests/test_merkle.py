@@ -0,0 +1,124 @@
+from hashlib import sha256
+
+from bitcoin_client.ledger_bitcoin.merkle import MerkleTree, NIL, combine_hashes, largest_power_of_2_less_than
+
+
+def make_leaves(n: int):
+    return [sha256(i.to_bytes(4, byteorder="big")).digest() for i in range(n)]
+
+
+def reference_root(leaves):
+    """Root of the Merkle tree computed from its recursive definition."""
+    if len(leaves) == 1:
+        return leaves[0]
+    lchild_size = largest_power_of_2_less_than(len(leaves))
+    return combine_hashes(reference_root(leaves[:lchild_size]), reference_root(leaves[lchild_size:]))
+
+
+def root_from_proof(leaf: bytes, index: int, size: int, proof):
+    """Recomputes the root from a proof of membership, as the device does."""
+    if size == 1:
+        assert proof == []
+        return leaf
+    lchild_size = largest_power_of_2_less_than(size)
+    if index < lchild_size:
+        return combine_hashes(root_from_proof(leaf, index, lchild_size, proof[:-1]), proof[-1])
+    else:
+        return combine_hashes(proof[-1], root_from_proof(leaf, index - lchild_size, size - lchild_size, proof[:-1]))
+
+
+def test_merkle_tree():
+    assert MerkleTree().root == NIL
+
+    for n in list(range(1, 34)) + [255, 256, 257]:
+        leaves = make_leaves(n)
+        mt = MerkleTree(leaves)
+        assert len(mt) == n
+        assert mt.root == reference_root(leaves)
+
+        for i in range(n):
+            assert mt.get(i) == leaves[i]
+            assert mt.leaf_index(leaves[i]) == i
+            assert root_from_proof(leaves[i], i, n, mt.prove_leaf(i)) == mt.root
+
+
+def test_merkle_tree_add_set():
+    leaves = make_leaves(40)
+
+    mt = MerkleTree()
+    for n, leaf in enumerate(leaves, start=1):
+        mt.add(leaf)
+        assert mt.root == reference_root(leaves[:n])
+        assert root_from_proof(leaf, n - 1, n, mt.prove_leaf(n - 1)) == mt.root
+
+    # the cached proofs are updated after a change
+    proof = mt.prove_leaf(0)
+    new_leaf = sha256(b"new").digest()
+    mt.set(17, new_leaf)
+    leaves[17] = new_leaf
+    assert mt.root == reference_root(leaves)
+    assert mt.prove_leaf(0) != proof
+    assert root_from_proof(leaves[0], 0, len(leaves), mt.prove_leaf(0)) == mt.root
+
+
+def test_merkle_tree_leaf_index():
+    leaves = make_leaves(8)
+    leaves[5] = leaves[2]
+    mt = MerkleTree(leaves)
+
+    # the index of the first leaf with the value is returned
+    assert mt.leaf_index(leaves[2]) == 2
+
+    mt.set(2, leaves[0])
+    assert mt.leaf_index(leaves[5]) == 5
+    assert mt.leaf_index(leaves[0]) == 0
+
+    mt.set(0, leaves[1])
+    assert mt.leaf_index(leaves[0]) == 2
+
+    try:
+        mt.leaf_index(sha256(b"missing").digest())
+        assert False, "expected ValueError"
+    except ValueError:
+        pass
+
+
+def root_from_leaves_proof(size: int, indices, leaves, proof):
+    """Recomputes the root from the proof of the leaves with the given indices, as the device does."""
+    items = iter(proof)
+    leaves = iter(leaves)
+
+    def visit(begin: int, size: int):
+        if not any(begin <= i < begin + size for i in indices):
+            return next(items)
+        if size == 1:
+            assert next(items) is None
+            return next(leaves)
+        lchild_size = largest_power_of_2_less_than(size)
+        left = visit(begin, lchild_size)
+        return combine_hashes(left, visit(begin + lchild_size, size - lchild_size))
+
+    root = visit(0, size)
+    assert next(items, "end") == "end"
+    return root
+
+
+def test_merkle_tree_prove_leaves():
+    for n in [1, 2, 3, 7, 8, 13]:
+        leaves = make_leaves(n)
+        mt = MerkleTree(leaves)
+        for mask in range(1, 1 << n):
+            indices = [i for i in range(n) if mask & (1 << i)]
+            proof = mt.prove_leaves(indices)
+            assert proof.count(None) == len(indices)
+            assert root_from_leaves_proof(n, indices, [leaves[i] for i in indices], proof) == mt.root
+
+        assert mt.prove_range(0, n) == [None] * n
+
+    mt = MerkleTree(make_leaves(8))
+    for indices in [[], [3, 3], [4, 2], [8]]:
+        try:
+            mt.prove_leaves(indices)
+            assert False, "expected ValueError"
+        except ValueError:
+            pass
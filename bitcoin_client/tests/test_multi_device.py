@@ -0,0 +1,65 @@
+import time
+from pathlib import Path
+
+from bitcoin_client.ledger_bitcoin.client import NewClient
+from bitcoin_client.ledger_bitcoin.client_base import PartialSignature
+from bitcoin_client.ledger_bitcoin.multi_device import sign_psbt_on_devices
+from bitcoin_client.ledger_bitcoin.prepared_psbt import PreparedPsbt
+from bitcoin_client.ledger_bitcoin.wallet import WalletPolicy
+
+psbt_b64 = open(Path(__file__).parent.joinpath("psbt/singlesig/wpkh-2to2.psbt"), "r").read().strip()
+
+wallet = WalletPolicy(
+    "",
+    "wpkh(@0/**)",
+    [
+        "[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"
+    ],
+)
+
+DEVICE_DELAY = 0.3
+
+
+class FakeClient(NewClient):
+    """A client that signs each input with a fixed key after a delay, without a device."""
+
+    def __init__(self, pubkey: bytes, fail: bool = False):
+        self.pubkey = pubkey
+        self.fail = fail
+        self.received = []
+
+    def sign_psbt(self, psbt, wallet, wallet_hmac, inputs_to_sign=None):
+        self.received.append((psbt, wallet_hmac))
+        time.sleep(DEVICE_DELAY)
+        if self.fail:
+            raise RuntimeError("rejected")
+        return [(i, PartialSignature(pubkey=self.pubkey, signature=bytes([i]) + self.pubkey))
+                for i in range(psbt.n_inputs)]
+
+
+def test_sign_psbt_on_devices():
+    clients = [FakeClient(b'\x02' * 33), FakeClient(b'\x03' * 33, fail=True), FakeClient(b'\x04' * 33),
+               FakeClient(b'\x02' * 33)]
+    hmacs = [bytes([i]) * 32 for i in range(len(clients))]
+
+    start = time.monotonic()
+    result = sign_psbt_on_devices(list(zip(clients, hmacs)), psbt_b64, wallet)
+    elapsed = time.monotonic() - start
+
+    # the devices sign at the same time
+    assert elapsed < 2 * DEVICE_DELAY
+
+    # the same prepared PSBT is shared by all the devices, each with its own hmac
+    prepared = clients[0].received[0][0]
+    assert isinstance(prepared, PreparedPsbt)
+    for client, hmac in zip(clients, hmacs):
+        assert client.received == [(prepared, hmac)]
+
+    assert list(result.errors.keys()) == [1]
+    assert str(result.errors[1]) == "rejected"
+    assert sorted(result.signatures_by_device.keys()) == [0, 2, 3]
+
+    # the signatures of the last device are the same as the ones of the first device
+    assert [(i, sig.pubkey) for i, sig in result.signatures] == [
+        (0, b'\x02' * 33), (0, b'\x04' * 33), (1, b'\x02' * 33), (1, b'\x04' * 33)
+    ]
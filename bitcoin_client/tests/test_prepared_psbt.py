@@ -0,0 +1,102 @@
+import base64
+from io import BytesIO
+from pathlib import Path
+
+import pytest
+
+from bitcoin_client.ledger_bitcoin.command_builder import BitcoinCommandBuilder
+from bitcoin_client.ledger_bitcoin.merkle import get_merkleized_map_commitment
+from bitcoin_client.ledger_bitcoin.prepared_psbt import PreparedPsbt, parse_raw_psbt_v2, parse_stream_to_map
+from bitcoin_client.ledger_bitcoin.psbt import PSBT
+from bitcoin_client.ledger_bitcoin.wallet import WalletPolicy
+
+psbts_path = Path(__file__).parent.joinpath("psbt")
+
+wallet = WalletPolicy(
+    "",
+    "wpkh(@0/**)",
+    [
+        "[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"
+    ],
+)
+
+
+def test_prepared_psbt():
+    builder = BitcoinCommandBuilder()
+
+    for name in ["pkh-1to1", "wpkh-1to2", "wpkh-2to2", "tr-1to2"]:
+        psbt_b64 = open(psbts_path.joinpath(f"singlesig/{name}.psbt"), "r").read().strip()
+        prepared = PreparedPsbt(psbt_b64, wallet)
+
+        # the maps of the PSBT, as they were parsed before each request
+        psbt_v2 = PSBT()
+        psbt_v2.deserialize(psbt_b64)
+        psbt_v2.convert_to_v2()
+        f = BytesIO(base64.b64decode(psbt_v2.serialize()))
+        assert f.read(5) == b"psbt\xff"
+        global_map = parse_stream_to_map(f)
+        input_maps = [parse_stream_to_map(f) for _ in psbt_v2.inputs]
+        output_maps = [parse_stream_to_map(f) for _ in psbt_v2.outputs]
+
+        assert prepared.n_inputs == len(input_maps)
+        assert prepared.n_outputs == len(output_maps)
+        assert prepared.wallet_id == wallet.id
+
+        # the request is the same as the one computed from the maps
+        for mode_data in [b"", b"\x01"]:
+            assert builder.sign_psbt_with_commitment(prepared.psbt_commitment, wallet, None, mode_data) == \
+                builder.sign_psbt(global_map, input_maps, output_maps, wallet, None, mode_data)
+
+        # the trees of the keys and values of each map are known
+        for m in [global_map] + input_maps + output_maps:
+            commitment = get_merkleized_map_commitment(m)
+            assert commitment[-64:-32] in prepared.known_trees
+            assert commitment[-32:] in prepared.known_trees
+
+        assert wallet.serialize() in prepared.known_preimages.values()
+
+
+def test_prepared_psbt_does_not_modify_psbt():
+    psbt = PSBT()
+    psbt.deserialize(open(psbts_path.joinpath("singlesig/wpkh-1to2.psbt"), "r").read().strip())
+    serialized = psbt.serialize()
+
+    PreparedPsbt(psbt, wallet)
+    assert psbt.serialize() == serialized
+
+    # unless it is converted in place
+    PreparedPsbt(psbt, wallet, clone=False)
+    assert psbt.version == 2
+
+
+def test_prepared_psbt_raw_v2():
+    for name in ["pkh-1to1", "wpkh-1to2", "wpkh-2to2", "tr-1to2"]:
+        psbt_v2 = PSBT()
+        psbt_v2.deserialize(open(psbts_path.joinpath(f"singlesig/{name}.psbt"), "r").read().strip())
+        psbt_v2.convert_to_v2()
+        psbt_b64 = psbt_v2.serialize()
+        psbt_bytes = base64.b64decode(psbt_b64)
+
+        # a serialized PSBTv2 is not deserialized, but it is prepared in the same way as the PSBT object
+        prepared = PreparedPsbt(psbt_v2, wallet)
+        for raw in [psbt_b64, psbt_bytes]:
+            prepared_raw = PreparedPsbt(raw, wallet)
+            assert prepared_raw.n_inputs == prepared.n_inputs
+            assert prepared_raw.n_outputs == prepared.n_outputs
+            assert prepared_raw.psbt_commitment == prepared.psbt_commitment
+            assert prepared_raw.known_preimages == prepared.known_preimages
+            assert prepared_raw.known_trees.keys() == prepared.known_trees.keys()
+
+        global_map, input_maps, output_maps = parse_raw_psbt_v2(psbt_bytes)
+        assert len(input_maps) == len(psbt_v2.inputs)
+        assert len(output_maps) == len(psbt_v2.outputs)
+        assert all(isinstance(value, memoryview) for value in global_map.values())
+
+        with pytest.raises(ValueError):
+            parse_raw_psbt_v2(psbt_bytes[:-1])
+        with pytest.raises(ValueError):
+            parse_raw_psbt_v2(psbt_bytes + b"\x00")
+
+    # not a PSBTv2
+    psbt_b64 = open(psbts_path.joinpath("singlesig/wpkh-1to2.psbt"), "r").read().strip()
+    assert parse_raw_psbt_v2(psbt_b64) is None
@@ -0,0 +1,153 @@
+from pathlib import Path
+
+from bitcoin_client.ledger_bitcoin.psbt import PSBT
+from bitcoin_client.ledger_bitcoin.psbt_validation import PsbtIssue, validate_psbt
+from bitcoin_client.ledger_bitcoin.wallet import WalletPolicy
+
+psbts_path = Path(__file__).parent.joinpath("psbt")
+
+MASTER_FINGERPRINT = bytes.fromhex("f5acc2fd")
+
+wallets = {
+    "pkh-1to1": WalletPolicy(
+        "",
+        "pkh(@0/**)",
+        [
+            "[f5acc2fd/44'/1'/0']tpubDCwYjpDhUdPGP5rS3wgNg13mTrrjBuG8V9VpWbyptX6TRPbNoZVXsoVUSkCjmQ8jJycjuDKBb9eataSymXakTTaGifxR6kmVsfFehH1ZgJT"
+        ],
+    ),
+    "wpkh-2to2": WalletPolicy(
+        "",
+        "wpkh(@0/**)",
+        [
+            "[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"
+        ],
+    ),
+    "tr-1to2": WalletPolicy(
+        "",
+        "tr(@0/**)",
+        [
+            "[f5acc2fd/86'/1'/0']tpubDDKYE6BREvDsSWMazgHoyQWiJwYaDDYPbCFjYxN3HFXJP5fokeiK4hwK5tTLBNEDBwrDXn8cQ4v9b2xdW62Xr5yxoQdMu1v6c7UDXYVH27U"
+        ],
+    ),
+}
+
+
+def load_psbt(name: str) -> PSBT:
+    psbt = PSBT()
+    psbt.deserialize(open(psbts_path.joinpath(f"singlesig/{name}.psbt"), "r").read().strip())
+    return psbt
+
+
+def test_validate_psbt_valid():
+    for name, wallet in wallets.items():
+        psbt = load_psbt(name)
+        psbt_b64 = psbt.serialize()
+
+        assert validate_psbt(psbt, wallet) == []
+        assert validate_psbt(psbt_b64, wallet, MASTER_FINGERPRINT) == []
+        assert validate_psbt(psbt_b64, wallet, max_workers=1) == []
+
+        # the PSBT is not modified
+        assert psbt.serialize() == psbt_b64
+
+
+def test_validate_psbt_no_internal_inputs():
+    wallet = wallets["wpkh-2to2"]
+
+    assert validate_psbt(load_psbt("wpkh-2to2"), wallet, bytes.fromhex("01020304")) == [
+        PsbtIssue("global", None, "no key of the wallet policy is internal")
+    ]
+    assert validate_psbt(load_psbt("wpkh-2to2"), wallet, inputs_to_sign=[]) == [
+        PsbtIssue("global", None, "no input has a BIP32 derivation of the wallet policy")
+    ]
+    # a derivation of another account of the same device is external
+    assert validate_psbt(load_psbt("wpkh-2to2"), wallets["tr-1to2"]) == [
+        PsbtIssue("global", None, "no input has a BIP32 derivation of the wallet policy")
+    ]
+
+
+def test_validate_psbt_utxos():
+    wallet = wallets["wpkh-2to2"]
+
+    psbt = load_psbt("wpkh-2to2")
+    psbt.inputs[1].witness_utxo = None
+    psbt.inputs[1].non_witness_utxo = None
+    assert validate_psbt(psbt, wallet) == [
+        PsbtIssue("input", 1, "neither the witness utxo nor the non-witness utxo is present")
+    ]
+
+    psbt = load_psbt("wpkh-2to2")
+    psbt.inputs[0].witness_utxo = None
+    assert validate_psbt(psbt, wallet) == [PsbtIssue("input", 0, "the witness utxo is missing for a segwit input")]
+
+    psbt = load_psbt("wpkh-2to2")
+    psbt.inputs[0].witness_utxo.nValue += 1
+    assert validate_psbt(psbt, wallet) == [
+        PsbtIssue("input", 0, "the amount or the script of the witness utxo do not match the non-witness utxo")
+    ]
+
+    psbt = load_psbt("wpkh-2to2")
+    psbt.inputs[0].non_witness_utxo, psbt.inputs[1].non_witness_utxo = \
+        psbt.inputs[1].non_witness_utxo, psbt.inputs[0].non_witness_utxo
+    assert validate_psbt(psbt, wallet) == [
+        PsbtIssue("input", 0, "the txid of the non-witness utxo does not match the previous txid"),
+        PsbtIssue("input", 1, "the txid of the non-witness utxo does not match the previous txid"),
+    ]
+
+    # legacy inputs must not have the witness utxo
+    psbt = load_psbt("pkh-1to1")
+    psbt.inputs[0].witness_utxo = psbt.inputs[0].non_witness_utxo.vout[psbt.tx.vin[0].prevout.n]
+    assert validate_psbt(psbt, wallets["pkh-1to1"]) == [
+        PsbtIssue("input", 0, "legacy inputs must have the non-witness utxo, but no witness utxo")
+    ]
+
+
+def test_validate_psbt_sighash():
+    wallet = wallets["wpkh-2to2"]
+
+    psbt = load_psbt("wpkh-2to2")
+    psbt.inputs[0].sighash = 0x83
+    assert validate_psbt(psbt, wallet) == []
+
+    psbt.inputs[0].sighash = 0x04
+    assert validate_psbt(psbt, wallet) == [PsbtIssue("input", 0, "unsupported sighash type 0x4")]
+
+    # taproot only
+    psbt.inputs[0].sighash = 0x00
+    assert validate_psbt(psbt, wallet) == [PsbtIssue("input", 0, "unsupported sighash type 0x0")]
+
+    # only one output
+    psbt = load_psbt("pkh-1to1")
+    psbt.inputs[0].sighash = 0x02
+    assert validate_psbt(psbt, wallets["pkh-1to1"]) == [PsbtIssue("input", 0, "unsupported sighash type 0x2")]
+
+    psbt = load_psbt("wpkh-2to2")
+    psbt.inputs[1].sighash = 0x03
+    psbt.outputs = psbt.outputs[:1]
+    psbt.tx.vout = psbt.tx.vout[:1]
+    assert validate_psbt(psbt, wallet) == [
+        PsbtIssue("input", 1, "SIGHASH_SINGLE is not allowed for an input without the output of the same index")
+    ]
+
+
+def test_validate_psbt_derivations():
+    wallet = wallets["wpkh-2to2"]
+
+    psbt = load_psbt("wpkh-2to2")
+    pubkey, origin = next(iter(psbt.inputs[0].hd_keypaths.items()))
+    origin.path = list(origin.path) * 3
+    assert validate_psbt(psbt, wallet) == [
+        PsbtIssue("input", 0, "the BIP32 derivations must have between 2 and 8 steps")
+    ]
+
+    # not checked for the inputs that can not be internal
+    assert validate_psbt(psbt, wallet, inputs_to_sign=[1]) == []
+
+
+def test_validate_psbt_fees():
+    wallet = wallets["wpkh-2to2"]
+
+    psbt = load_psbt("wpkh-2to2")
+    psbt.tx.vout[0].nValue += sum(vin.witness_utxo.nValue for vin in psbt.inputs)
+    assert validate_psbt(psbt, wallet) == [PsbtIssue("global", None, "the outputs spend more than the inputs")]
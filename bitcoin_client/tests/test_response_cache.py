@@ -0,0 +1,105 @@
+from bitcoin_client.ledger_bitcoin.response_cache import CachingClient, ResponseCache
+from bitcoin_client.ledger_bitcoin.wallet import WalletPolicy
+
+wallet = WalletPolicy(
+    "",
+    "wpkh(@0/**)",
+    [
+        "[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"
+    ],
+)
+
+
+class FakeClient:
+    """A client that answers deterministically from its fingerprint, and records the queries sent to the device."""
+
+    def __init__(self, fingerprint: bytes):
+        self.fingerprint = fingerprint
+        self.calls = []
+
+    def get_master_fingerprint(self):
+        self.calls.append(("fpr",))
+        return self.fingerprint
+
+    def get_extended_pubkey(self, path, display=False):
+        self.calls.append(("xpub", path, display))
+        return f"{self.fingerprint.hex()}:{path}"
+
+    def get_extended_pubkeys(self, paths):
+        self.calls.append(("xpubs", tuple(paths)))
+        return [f"{self.fingerprint.hex()}:{path}" for path in paths]
+
+    def get_wallet_address(self, wallet, wallet_hmac, change, address_index, display):
+        self.calls.append(("address", change, address_index, display))
+        return f"{self.fingerprint.hex()}:{change}/{address_index}"
+
+    def get_wallet_addresses(self, wallet, wallet_hmac, change, start_index, count):
+        self.calls.append(("addresses", change, start_index, count))
+        return [f"{self.fingerprint.hex()}:{change}/{i}" for i in range(start_index, start_index + count)]
+
+    def sign_message(self, message, path):
+        self.calls.append(("sign", message))
+        return "sig"
+
+
+def test_repeated_queries_do_not_reach_the_device():
+    device = FakeClient(b"\xf5\xac\xc2\xfd")
+    client = CachingClient(device)
+
+    for _ in range(3):
+        assert client.get_master_fingerprint() == b"\xf5\xac\xc2\xfd"
+        assert client.get_extended_pubkey("m/84'/1'/0'") == "f5acc2fd:m/84'/1'/0'"
+        assert client.get_wallet_address(wallet, None, 0, 5, False) == "f5acc2fd:0/5"
+
+    assert device.calls == [("fpr",), ("xpub", "m/84'/1'/0'", False), ("address", 0, 5, False)]
+
+    # the queries with display, and the other methods, always reach the device
+    device.calls.clear()
+    client.get_extended_pubkey("m/84'/1'/0'", True)
+    client.get_wallet_address(wallet, None, 0, 5, True)
+    assert client.sign_message(b"hello", "m/44'/1'/0'/0/0") == "sig"
+    assert device.calls == [("xpub", "m/84'/1'/0'", True), ("address", 0, 5, True), ("sign", b"hello")]
+
+
+def test_batches_only_query_the_missing_responses():
+    device = FakeClient(b"\x01\x02\x03\x04")
+    client = CachingClient(device)
+
+    client.get_extended_pubkey("m/1'")
+    assert client.get_extended_pubkeys(["m/0'", "m/1'", "m/2'"]) == ["01020304:m/0'", "01020304:m/1'",
+                                                                      "01020304:m/2'"]
+
+    client.get_wallet_address(wallet, None, 1, 3, False)
+    assert client.get_wallet_addresses(wallet, None, 1, 2, 3) == ["01020304:1/2", "01020304:1/3", "01020304:1/4"]
+    assert client.get_wallet_addresses(wallet, None, 1, 3, 2) == ["01020304:1/3", "01020304:1/4"]
+
+    assert device.calls == [("fpr",), ("xpub", "m/1'", False), ("xpubs", ("m/0'", "m/2'")),
+                            ("address", 1, 3, False), ("addresses", 1, 2, 3)]
+
+
+def test_shared_cache_and_invalidation():
+    cache = ResponseCache(max_entries=3)
+    device1, device2 = FakeClient(b"\x01" * 4), FakeClient(b"\x02" * 4)
+    client1, client2 = CachingClient(device1, cache), CachingClient(device2, cache)
+
+    # the responses of each device are keyed by its fingerprint
+    assert client1.get_extended_pubkey("m/0'") == "01010101:m/0'"
+    assert client2.get_extended_pubkey("m/0'") == "02020202:m/0'"
+    assert len(cache) == 2
+
+    # another client of the same device reuses its responses
+    client1_bis = CachingClient(FakeClient(b"\x01" * 4), cache)
+    client1_bis.get_extended_pubkey("m/0'")
+    assert client1_bis.client.calls == [("fpr",)]
+
+    client1.invalidate()
+    assert len(cache) == 1
+    client1.get_extended_pubkey("m/0'")
+    assert device1.calls[-2:] == [("fpr",), ("xpub", "m/0'", False)]
+
+    # the least recently used responses are evicted
+    client2.get_extended_pubkey("m/1'")
+    client2.get_extended_pubkey("m/2'")
+    assert len(cache) == 3
+    assert cache.get(b"\x02" * 4, ("xpub", "m/0'")) is None
+    assert cache.get(b"\x01" * 4, ("xpub", "m/0'")) == "01010101:m/0'"
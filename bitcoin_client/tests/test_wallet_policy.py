@@ -0,0 +1,51 @@
+from hashlib import sha256
+
+from bitcoin_client.ledger_bitcoin.command_builder import BitcoinCommandBuilder
+from bitcoin_client.ledger_bitcoin.common import write_varint
+from bitcoin_client.ledger_bitcoin.merkle import MerkleTree, element_hash
+from bitcoin_client.ledger_bitcoin.wallet import WalletPolicy, WALLET_POLICY_INLINE_FLAG
+
+KEY_0 = "[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"
+KEY_1 = "[76223a6e/48'/1'/0'/2']tpubDE7NQymr4AFtewpAsWtnreyq9ghkzQBXpCZjWLFVRAvnbf7vya2eMTvT2fPapNqL8SuVvLQdbUbMfWLVDCZKnsEBqp6UK93QEzL8Ck23AwF"
+
+
+def parse_inline(data: bytes):
+    """Recomputes the canonical serialization from the inline one, as the device does."""
+    assert data[0] == 2 | WALLET_POLICY_INLINE_FLAG
+    name_len = data[1]
+    name = data[2:2 + name_len]
+    pos = 2 + name_len
+    template_len = data[pos]
+    template = data[pos + 1:pos + 1 + template_len]
+    pos += 1 + template_len
+    n_keys = data[pos]
+    pos += 1
+    keys = []
+    for _ in range(n_keys):
+        key_len = data[pos]
+        keys.append(data[pos + 1:pos + 1 + key_len])
+        pos += 1 + key_len
+    assert pos == len(data)
+    return b"".join([b"\x02", bytes([name_len]), name, write_varint(len(template)), sha256(template).digest(),
+                     write_varint(n_keys), MerkleTree(element_hash(k) for k in keys).root])
+
+
+def test_inline_serialization_has_the_same_commitments():
+    wallet = WalletPolicy("", "wpkh(@0/**)", [KEY_0])
+    assert parse_inline(wallet.serialize_inline()) == wallet.serialize()
+
+
+def test_register_wallet_is_inline_only_if_it_fits():
+    builder = BitcoinCommandBuilder()
+
+    small_wallet = WalletPolicy("Single", "tr(@0/**)", [KEY_0])
+    apdu = builder.register_wallet(small_wallet)
+    assert apdu["data"][1:] == small_wallet.serialize_inline()
+
+    apdu = builder.register_wallet(small_wallet, inline=False)
+    assert apdu["data"][1:] == small_wallet.serialize()
+
+    # two keys do not fit in a single APDU
+    large_wallet = WalletPolicy("Cosigners", "wsh(multi(1,@0/**,@1/**))", [KEY_0, KEY_1])
+    apdu = builder.register_wallet(large_wallet)
+    assert apdu["data"][1:] == large_wallet.serialize()
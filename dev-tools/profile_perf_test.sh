@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# Runs tests_perf cases in speculos under the sampling profiler of profile_speculos.py, and writes the folded
+# stacks to the given file. It must be run from the root of the repository, with an app built with
+# AUTOAPPROVE_FOR_PERF_TESTS=1.
+#
+# Usage: dev-tools/profile_perf_test.sh <output.folded> [profiler options --] <pytest arguments>
+# Example: dev-tools/profile_perf_test.sh psbt.folded --by-file -- test_perf_sign_psbt.py -k "wpkh and 10"
+
+set -e
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <output.folded> [profiler options --] <pytest arguments>" >&2
+    exit 1
+fi
+
+OUTPUT="$1"
+shift
+
+PROFILER_ARGS=()
+if [[ " $* " == *" -- "* ]]; then
+    while [ "$1" != "--" ]; do
+        PROFILER_ARGS+=("$1")
+        shift
+    done
+    shift
+fi
+
+python3 dev-tools/profile_speculos.py --elf "${BITCOIN_APP_BINARY:-bin/app.elf}" --output "$OUTPUT" \
+    "${PROFILER_ARGS[@]}" &
+PROFILER_PID=$!
+
+# speculos waits for the profiler to attach to its gdb port before running the app
+STATUS=0
+(cd tests_perf && SPECULOS_EXTRA_ARGS="-d" pytest --headless "$@") || STATUS=$?
+
+kill -INT $PROFILER_PID
+wait $PROFILER_PID || true
+
+exit $STATUS
@@ -0,0 +1,251 @@
+#!/usr/bin/env python3
+
+import argparse
+import bisect
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import time
+
+from collections import Counter
+from dataclasses import dataclass
+from typing import Dict, List, Optional, Tuple
+
+"""
+Sampling profiler for the app running in speculos.
+
+Speculos started with `-d` runs the app in qemu, waiting for a debugger on its gdb port (1234 by default). This
+script connects to the gdb stub of qemu, and repeatedly interrupts the app in order to sample its program counter,
+link register and stack; the samples are symbolized with the symbol table of the app ELF, and written as folded
+stacks, one line per stack with its number of samples, that can be rendered with flamegraph.pl or speedscope:
+
+```
+dev-tools/profile_speculos.py --elf bin/app.elf --output profile.folded
+flamegraph.pl profile.folded > profile.svg
+```
+
+The app is continued as soon as the profiler attaches; when speculos exits, the profiler waits for the next instance
+on the same port, so that a whole pytest session, that starts speculos for each test, is profiled in a single run.
+The profile is written when the profiler is interrupted (SIGINT or SIGTERM).
+
+Timings of speculos are not faithful to the devices, but the distribution of the samples across the functions and
+the source files of the app is a good proxy of where the instructions are spent. The stacks are unwound without
+debug information: the first frames are the program counter and the link register, and the outer frames are the
+return addresses found in the stack, that is the words pointing right after a BL or BLX instruction of the app. The
+outer frames are therefore approximate.
+
+It must be run from the root of the repository.
+"""
+
+ARM_SP, ARM_LR, ARM_PC = 13, 14, 15
+
+
+class GdbRemote:
+    """A minimal client of the gdb remote serial protocol, as implemented by the gdb stub of qemu."""
+
+    def __init__(self, host: str, port: int):
+        self.sock = socket.create_connection((host, port))
+        self.buffer = b""
+        self.ack = True
+        if self.command("QStartNoAckMode") == "OK":
+            self.ack = False
+
+    def close(self) -> None:
+        self.sock.close()
+
+    def _read(self) -> bytes:
+        data = self.sock.recv(4096)
+        if data == b"":
+            raise ConnectionError("gdb stub disconnected")
+        return data
+
+    def _send_packet(self, payload: str) -> None:
+        checksum = sum(payload.encode()) % 256
+        self.sock.sendall(f"${payload}#{checksum:02x}".encode())
+
+    def _read_packet(self) -> str:
+        while True:
+            start = self.buffer.find(b"$")
+            end = self.buffer.find(b"#", start)
+            if start >= 0 and end >= 0 and len(self.buffer) >= end + 3:
+                payload = self.buffer[start + 1:end]
+                self.buffer = self.buffer[end + 3:]
+                if self.ack:
+                    self.sock.sendall(b"+")
+                return payload.decode()
+            self.buffer += self._read()
+
+    def command(self, payload: str) -> str:
+        self._send_packet(payload)
+        return self._read_packet()
+
+    def cont(self) -> None:
+        self._send_packet("c")  # no reply until the target stops
+
+    def interrupt(self) -> str:
+        self.sock.sendall(b"\x03")
+        reply = self._read_packet()
+        if reply[:1] in ("W", "X"):
+            raise ConnectionError("the app exited")
+        return reply
+
+    def read_register(self, n: int) -> int:
+        return int.from_bytes(bytes.fromhex(self.command(f"p{n:x}")), byteorder="little")
+
+    def read_memory(self, addr: int, length: int) -> Optional[bytes]:
+        reply = self.command(f"m{addr:x},{length:x}")
+        if reply.startswith("E") or len(reply) != 2 * length:
+            return None
+        return bytes.fromhex(reply)
+
+
+@dataclass
+class Symbol:
+    address: int
+    name: str
+    file: str
+
+
+class Symbolizer:
+    """Maps addresses to the function symbols of the ELF, as listed by nm."""
+
+    def __init__(self, elf: str, nm: Optional[str], load_offset: int):
+        nm = nm or next((tool for tool in ["arm-none-eabi-nm", "llvm-nm", "nm"] if shutil.which(tool)), None)
+        if nm is None:
+            raise RuntimeError("nm not found, use --nm")
+
+        # -l adds the source file and line of each symbol, from the debug information when available
+        output = subprocess.run([nm, "-n", "-l", "--defined-only", elf], check=True, capture_output=True,
+                                text=True).stdout
+
+        self.symbols: List[Symbol] = []
+        for line in output.splitlines():
+            parts = line.split(maxsplit=3)
+            if len(parts) < 3 or parts[1] not in "tTwW":
+                continue
+            file = parts[3].rsplit("/", 1)[-1].split(":")[0] if len(parts) > 3 else "?"
+            self.symbols.append(Symbol((int(parts[0], 16) & ~1) + load_offset, parts[2], file))
+        self.addresses = [s.address for s in self.symbols]
+        self.text_start = self.addresses[0] if self.symbols else 0
+        self.text_end = self.addresses[-1] + 0x1000 if self.symbols else 0
+
+    def lookup(self, address: int) -> Optional[Symbol]:
+        address &= ~1  # thumb bit
+        if not self.text_start <= address < self.text_end:
+            return None
+        i = bisect.bisect_right(self.addresses, address) - 1
+        return self.symbols[i] if i >= 0 else None
+
+
+def is_call_return_address(gdb: GdbRemote, address: int, cache: Dict[int, bool]) -> bool:
+    """Whether `address` follows a BL or BLX (immediate or register) thumb instruction."""
+
+    if address not in cache:
+        code = gdb.read_memory((address & ~1) - 4, 4)
+        result = False
+        if code is not None:
+            hw1 = int.from_bytes(code[0:2], byteorder="little")
+            hw2 = int.from_bytes(code[2:4], byteorder="little")
+            # 32-bit BL/BLX: 11110xxxxxxxxxxx 11x1xxxxxxxxxxxx
+            result = (hw1 & 0xF800) == 0xF000 and (hw2 & 0xD000) in (0xD000, 0xC000)
+            # 16-bit BLX Rm: 010001111xxxx000
+            result = result or (hw2 & 0xFF87) == 0x4780
+        cache[address] = result
+    return cache[address]
+
+
+def sample_stack(gdb: GdbRemote, symbolizer: Symbolizer, scan_words: int, cache: Dict[int, bool]) -> List[int]:
+    """Returns the return addresses of the current stack, innermost first."""
+
+    pc = gdb.read_register(ARM_PC)
+    lr = gdb.read_register(ARM_LR)
+    sp = gdb.read_register(ARM_SP)
+
+    stack = [pc]
+    if symbolizer.lookup(lr) is not None:
+        stack.append(lr)
+
+    if scan_words > 0:
+        memory = gdb.read_memory(sp, 4 * scan_words) or b""
+        for i in range(0, len(memory) - 3, 4):
+            word = int.from_bytes(memory[i:i + 4], byteorder="little")
+            if (word & 1) and symbolizer.lookup(word) is not None and word != stack[-1] \
+                    and is_call_return_address(gdb, word, cache):
+                stack.append(word)
+    return stack
+
+
+def fold(stack: List[int], symbolizer: Symbolizer, by_file: bool) -> str:
+    frames = []
+    for address in reversed(stack):
+        symbol = symbolizer.lookup(address)
+        name = "?" if symbol is None else (symbol.file if by_file else symbol.name)
+        if len(frames) == 0 or frames[-1] != name:
+            frames.append(name)
+    return ";".join(frames)
+
+
+def profile_session(gdb: GdbRemote, symbolizer: Symbolizer, samples: Counter, interval: float, scan_words: int,
+                    by_file: bool) -> None:
+    cache: Dict[int, bool] = {}
+    gdb.cont()
+    while True:
+        time.sleep(interval)
+        gdb.interrupt()
+        samples[fold(sample_stack(gdb, symbolizer, scan_words, cache), symbolizer, by_file)] += 1
+        gdb.cont()
+
+
+def connect(host: str, port: int) -> GdbRemote:
+    while True:
+        try:
+            return GdbRemote(host, port)
+        except OSError:
+            time.sleep(0.05)
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description="Sampling profiler for the app running in speculos -d")
+    parser.add_argument("--elf", default="bin/app.elf", help="The app ELF run by speculos")
+    parser.add_argument("--output", default="profile.folded", help="Where to write the folded stacks")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=1234, help="The gdb port of speculos")
+    parser.add_argument("--interval", type=float, default=1.0, help="Milliseconds between two samples")
+    parser.add_argument("--scan-words", type=int, default=256,
+                        help="Words of the stack scanned for return addresses; 0 to only sample PC and LR")
+    parser.add_argument("--by-file", action="store_true", help="Aggregate the frames by source file")
+    parser.add_argument("--nm", help="The nm tool (default: arm-none-eabi-nm, llvm-nm or nm)")
+    parser.add_argument("--load-offset", type=lambda x: int(x, 0), default=0,
+                        help="Offset between the addresses of the ELF and the addresses in speculos")
+    parser.add_argument("--once", action="store_true", help="Stop when speculos exits, instead of waiting for it")
+    args = parser.parse_args()
+
+    symbolizer = Symbolizer(args.elf, args.nm, args.load_offset)
+    samples: Counter = Counter()
+
+    def write_profile(*_) -> None:
+        with open(args.output, "w") as f:
+            for stack, count in samples.most_common():
+                f.write(f"{stack} {count}\n")
+        print(f"{sum(samples.values())} samples written to {args.output}", file=sys.stderr)
+        sys.exit(0)
+
+    signal.signal(signal.SIGINT, write_profile)
+    signal.signal(signal.SIGTERM, write_profile)
+
+    while True:
+        gdb = connect(args.host, args.port)
+        try:
+            profile_session(gdb, symbolizer, samples, args.interval / 1000, args.scan_words, args.by_file)
+        except ConnectionError:
+            pass
+        finally:
+            gdb.close()
+        if args.once:
+            write_profile()
+
+
+if __name__ == "__main__":
+    main()
@@ -243,6 +243,15 @@ class GetMasterFingerprintCommandFormatter(BitcoinCommandFormatter):
         print("=> GET_MASTER_FINGERPRINT()")
 
 
+class GetAppCapabilitiesCommandFormatter(BitcoinCommandFormatter):
+    ins_type = BitcoinInsType.GET_APP_CAPABILITIES
+
+    @staticmethod
+    def format_request(apdu: APDU, stream: ByteStreamParser, context: CommandContext):
+        assert len(apdu.data) == 0
+        print("=> GET_APP_CAPABILITIES()")
+
+
 class SignMessageCommandFormatter(BitcoinCommandFormatter):
     ins_type = BitcoinInsType.SIGN_MESSAGE
 
@@ -261,7 +270,8 @@ class SignMessageCommandFormatter(BitcoinCommandFormatter):
 
 
 bitcoin_command_formatters: List[BitcoinCommandFormatter] = [GetExtendedPubkeyCommandFormatter, RegisterWalletCommandFormatter,
-                                                             GetWalletAddressCommandFormatter, SignPsbtCommandFormatter, GetMasterFingerprintCommandFormatter, SignMessageCommandFormatter]
+                                                             GetWalletAddressCommandFormatter, SignPsbtCommandFormatter, GetMasterFingerprintCommandFormatter,
+                                                             GetAppCapabilitiesCommandFormatter, SignMessageCommandFormatter]
 bitcoin_command_formatters_map: Mapping[BitcoinInsType, BitcoinCommandFormatter] = {
     f.ins_type: f for f in bitcoin_command_formatters
 }
@@ -427,6 +437,158 @@ class GetMerkleLeafIndexClientCommandFormatter(ClientCommandFormatter):
         print(f"=> ▶ <found:{found}><leaf_index:{leaf_index}>")
 
 
+class GetMerkleLeafElementClientCommandFormatter(ClientCommandFormatter):
+    code = ClientCommandCode.GET_MERKLE_LEAF_ELEMENT
+
+    @staticmethod
+    def format_cmd_request(response: bytes, stream: ByteStreamParser, context: CommandContext):
+        root = stream.read_bytes(32)
+        tree_size = stream.read_varint()
+        leaf_index = stream.read_varint()
+        stream.assert_empty()
+
+        context.get_merkle_leaf_proof__root = root
+        context.get_merkle_leaf_proof__leaf_index = leaf_index
+
+        print(
+            f"<= ⏸ GET_MERKLE_LEAF_ELEMENT(root={format_merkle_root(root, context)},tree_size={tree_size},leaf_index={leaf_index})")
+
+    @staticmethod
+    def format_cmd_response(apdu: APDU, stream: ByteStreamParser, context: CommandContext):
+        is_complete = stream.read_bytes(1)[0]
+        assert 0 <= is_complete <= 1
+
+        if is_complete == 0:
+            stream.assert_empty()
+            print(f"=> ▶ <is_complete:0>")
+        else:
+            proof_length = stream.read_bytes(1)[0]
+            proof = [stream.read_bytes(32) for _ in range(proof_length)]
+            element_len = stream.read_varint()
+            element = stream.read_bytes(element_len)
+            stream.assert_empty()
+
+            # If it's a leaf of the inputs_map_commitments_tree or the outputs_map_commitments_tree_root,
+            # the element is a map commitment; we name the keys and values Merkle trees for easier reference
+            if context.get_merkle_leaf_proof__root in context.merkle_root_names:
+                root_name = context.merkle_root_names[context.get_merkle_leaf_proof__root]
+                prefix = None
+                if root_name == 'inputs_map_commitments_tree_root':
+                    prefix = "input"
+                elif root_name == 'outputs_map_commitments_tree_root':
+                    prefix = "output"
+
+                if prefix is not None:
+                    element_stream = ByteStreamParser(element)
+                    element_stream.read_varint()  # map size
+                    keys_root = element_stream.read_bytes(32)
+                    values_root = element_stream.read_bytes(32)
+
+                    index = context.get_merkle_leaf_proof__leaf_index
+                    context.merkle_root_names[keys_root] = f"{prefix}_{index}_map_commitment_keys_root"
+                    context.merkle_root_names[values_root] = f"{prefix}_{index}_map_commitment_values_root"
+
+            proof_str = f"[{','.join(proof_el.hex() for proof_el in proof)}]"
+
+            print(
+                f"=> ▶ <is_complete:1><proof_length:{proof_length}><proof:{proof_str}><element_len:{element_len}><element:{element.hex()}>")
+
+        context.get_merkle_leaf_proof__root = None
+        context.get_merkle_leaf_proof__leaf_index = None
+
+
+class GetMerkleLeafRangeClientCommandFormatter(ClientCommandFormatter):
+    code = ClientCommandCode.GET_MERKLE_LEAF_RANGE
+
+    @staticmethod
+    def format_cmd_request(response: bytes, stream: ByteStreamParser, context: CommandContext):
+        root = stream.read_bytes(32)
+        tree_size = stream.read_varint()
+        begin = stream.read_varint()
+        n_leaves = stream.read_varint()
+        stream.assert_empty()
+
+        print(
+            f"<= ⏸ GET_MERKLE_LEAF_RANGE(root={format_merkle_root(root, context)},tree_size={tree_size},begin={begin},n_leaves={n_leaves})")
+
+    @staticmethod
+    def format_cmd_response(apdu: APDU, stream: ByteStreamParser, context: CommandContext):
+        answer_len = stream.read_varint()
+        payload_size = stream.read_bytes(1)[0]
+        payload = stream.read_bytes(payload_size)
+        stream.assert_empty()
+        print(
+            f"=> ▶ <answer_len:{answer_len}><payload_size: {payload_size}><payload:{payload.hex()}>)")
+
+
+class HintMerkleLeavesClientCommandFormatter(ClientCommandFormatter):
+    code = ClientCommandCode.HINT_MERKLE_LEAVES
+
+    @staticmethod
+    def format_cmd_request(response: bytes, stream: ByteStreamParser, context: CommandContext):
+        root = stream.read_bytes(32)
+        tree_size = stream.read_varint()
+        begin = stream.read_varint()
+        n_leaves = stream.read_varint()
+        stream.assert_empty()
+
+        print(
+            f"<= ⏸ HINT_MERKLE_LEAVES(root={format_merkle_root(root, context)},tree_size={tree_size},begin={begin},n_leaves={n_leaves})")
+
+    @staticmethod
+    def format_cmd_response(apdu: APDU, stream: ByteStreamParser, context: CommandContext):
+        stream.assert_empty()
+        print(f"=> ▶")
+
+
+class GetMerkleizedMapValuesClientCommandFormatter(ClientCommandFormatter):
+    code = ClientCommandCode.GET_MERKLEIZED_MAP_VALUES
+
+    @staticmethod
+    def format_cmd_request(response: bytes, stream: ByteStreamParser, context: CommandContext):
+        keys_root = stream.read_bytes(32)
+        values_root = stream.read_bytes(32)
+        size = stream.read_varint()
+        n_keys = stream.read_bytes(1)[0]
+        key_hashes = [stream.read_bytes(32) for _ in range(n_keys)]
+        stream.assert_empty()
+
+        key_hashes_str = f"[{','.join(key_hash.hex() for key_hash in key_hashes)}]"
+        print(
+            f"<= ⏸ GET_MERKLEIZED_MAP_VALUES(keys_root={format_merkle_root(keys_root, context)},values_root={format_merkle_root(values_root, context)},size={size},key_hashes={key_hashes_str})")
+
+    @staticmethod
+    def format_cmd_response(apdu: APDU, stream: ByteStreamParser, context: CommandContext):
+        answer_len = stream.read_varint()
+        payload_size = stream.read_bytes(1)[0]
+        payload = stream.read_bytes(payload_size)
+        stream.assert_empty()
+        print(
+            f"=> ▶ <answer_len:{answer_len}><payload_size: {payload_size}><payload:{payload.hex()}>)")
+
+
+class GetMerkleLeafHashesClientCommandFormatter(ClientCommandFormatter):
+    code = ClientCommandCode.GET_MERKLE_LEAF_HASHES
+
+    @staticmethod
+    def format_cmd_request(response: bytes, stream: ByteStreamParser, context: CommandContext):
+        root = stream.read_bytes(32)
+        tree_size = stream.read_varint()
+        stream.assert_empty()
+
+        print(
+            f"<= ⏸ GET_MERKLE_LEAF_HASHES(root={format_merkle_root(root, context)},tree_size={tree_size})")
+
+    @staticmethod
+    def format_cmd_response(apdu: APDU, stream: ByteStreamParser, context: CommandContext):
+        answer_len = stream.read_varint()
+        payload_size = stream.read_bytes(1)[0]
+        payload = stream.read_bytes(payload_size)
+        stream.assert_empty()
+        print(
+            f"=> ▶ <answer_len:{answer_len}><payload_size: {payload_size}><payload:{payload.hex()}>)")
+
+
 class GetMoreElementsClientCommandFormatter(ClientCommandFormatter):
     code = ClientCommandCode.GET_MORE_ELEMENTS
 
@@ -447,7 +609,11 @@ class GetMoreElementsClientCommandFormatter(ClientCommandFormatter):
 
 
 client_command_formatters: List[ClientCommandFormatter] = [YieldClientCommandFormatter, GetPreimageClientCommandFormatter,
-                                                           GetMerkleLeafProofClientCommandFormatter, GetMerkleLeafIndexClientCommandFormatter, GetMoreElementsClientCommandFormatter]
+                                                           GetMerkleLeafProofClientCommandFormatter, GetMerkleLeafIndexClientCommandFormatter, GetMerkleLeafElementClientCommandFormatter,
+                                                           GetMerkleLeafRangeClientCommandFormatter, HintMerkleLeavesClientCommandFormatter,
+                                                           GetMerkleizedMapValuesClientCommandFormatter,
+                                                           GetMerkleLeafHashesClientCommandFormatter,
+                                                           GetMoreElementsClientCommandFormatter]
 
 client_command_formatters_map: Mapping[ClientCommandCode, ClientCommandFormatter] = {
     f.code: f for f in client_command_formatters
@@ -536,6 +702,12 @@ def run():
                         "Unexpected INTERRUPTED_EXECUTION when no command was running")
 
                 assert len(response) > 0
+                # a deferred YIELD message can be prefixed to the client command
+                if response[0] == ClientCommandCode.DEFERRED_YIELD:
+                    yield_len = response[1]
+                    print(f"<= ⏸ YIELD({response[2:2 + yield_len].hex()}) (deferred)")
+                    response = response[2 + yield_len:]
+
                 stream = ByteStreamParser(response)
                 processing_client_command = stream.read_bytes(1)[0]
 
@@ -1,12 +1,14 @@
-from typing import Tuple, List, Optional, Union
+from typing import Tuple, List, Optional, Sequence, Union
 from pathlib import Path
 
 from bitcoin_client.ledger_bitcoin.common import SW_INTERRUPTED_EXECUTION
-from ledger_bitcoin.common import Chain
+from ledger_bitcoin.common import Chain, SW_OK
+from ledger_bitcoin.command_builder import MAX_APDU_DATA_LENGTH
 from ledger_bitcoin.client_command import ClientCommandInterpreter
 from ledger_bitcoin.client_base import TransportClient, PartialSignature
 from ledger_bitcoin.wallet import WalletPolicy
 from ledger_bitcoin.psbt import PSBT
+from ledger_bitcoin.prepared_psbt import PreparedPsbt
 from ledger_bitcoin.client import NewClient
 from ledger_bitcoin.client_base import print_response, print_apdu, ApduException
 from ledger_bitcoin.withdraw import AcreWithdrawalData
@@ -121,6 +123,17 @@ class RaggerClient(NewClient):
                     "Unexpected SW_INTERRUPTED_EXECUTION received.")
 
             command_response = client_intepreter.execute(response)
+
+            # responses that do not fit in a single APDU are split across multiple CONTINUE APDUs
+            while len(command_response) > MAX_APDU_DATA_LENGTH:
+                sw, response = self._apdu_exchange(
+                    self.builder.continue_interrupted(
+                        command_response[:MAX_APDU_DATA_LENGTH], has_more=True)
+                )
+                if sw != SW_OK:
+                    return sw, response
+                command_response = command_response[MAX_APDU_DATA_LENGTH:]
+
             apdu = self.builder.continue_interrupted(command_response)
 
             sw, response, index = self.ragger_navigate(
@@ -183,9 +196,43 @@ class RaggerClient(NewClient):
 
         return result
 
-    def sign_psbt(self, psbt: Union[PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac:
+    def sign_psbt(self, psbt: Union[PreparedPsbt, PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac:
                   Optional[bytes], navigator: Optional[Navigator] = None,
-                  testname: str = "", instructions: Instructions = None) -> List[Tuple[int, PartialSignature]]:
+                  testname: str = "", instructions: Instructions = None,
+                  inputs_to_sign: Optional[Sequence[int]] = None, low_r: bool = False) -> List[Tuple[int, PartialSignature]]:
+
+        if navigator:
+            self.navigate = True
+            self.navigator = navigator
+            self.testname = testname
+            self.instructions = instructions
+
+        result = NewClient.sign_psbt(self, psbt, wallet, wallet_hmac, inputs_to_sign, low_r)
+
+        self.navigate = False
+
+        return result
+
+    def sign_psbt_checkpoint(self, psbt: Union[PreparedPsbt, PSBT, bytes, str], wallet: WalletPolicy, wallet_hmac:
+                             Optional[bytes], navigator: Optional[Navigator] = None,
+                             testname: str = "", instructions: Instructions = None) -> bytes:
+
+        if navigator:
+            self.navigate = True
+            self.navigator = navigator
+            self.testname = testname
+            self.instructions = instructions
+
+        result = NewClient.sign_psbt_checkpoint(self, psbt, wallet, wallet_hmac)
+
+        self.navigate = False
+
+        return result
+
+    def sign_psbt_batch(self, psbts: Sequence[Union[PreparedPsbt, PSBT, bytes, str]], wallet: WalletPolicy,
+                        wallet_hmac: Optional[bytes], combined_review: bool = False,
+                        navigator: Optional[Navigator] = None, testname: str = "",
+                        instructions: Instructions = None, low_r: bool = False) -> List[List[Tuple[int, PartialSignature]]]:
 
         if navigator:
             self.navigate = True
@@ -193,7 +240,7 @@ class RaggerClient(NewClient):
             self.testname = testname
             self.instructions = instructions
 
-        result = NewClient.sign_psbt(self, psbt, wallet, wallet_hmac)
+        result = NewClient.sign_psbt_batch(self, psbts, wallet, wallet_hmac, combined_review, low_r)
 
         self.navigate = False
 
@@ -234,6 +281,24 @@ class RaggerClient(NewClient):
         self.navigate = False
 
         return response
+
+    def sign_withdrawals(self, data: List[AcreWithdrawalData], bip32_path: str, navigator:
+                         Optional[Navigator] = None,
+                         instructions: Instructions = None,
+                         testname: str = ""
+                         ) -> List[str]:
+
+        if navigator:
+            self.navigate = True
+            self.navigator = navigator
+            self.testname = testname
+            self.instructions = instructions
+
+        response = NewClient.sign_withdrawals(self, data, bip32_path)
+
+        self.navigate = False
+
+        return response
     
     def sign_erc4361_message(self, message: Union[str, bytes], bip32_path: str, navigator:
                      Optional[Navigator] = None,
@@ -9,3 +9,28 @@
  * Framework instruction to continue execution after an interruption.
  */
 #define INS_CONTINUE 0x01
+
+/**
+ * Framework instruction to read the performance counters of the last command. Only supported in
+ * perf builds (HAVE_PERF_STATS). With P1 = PERF_STATS_P1_CRYPTO, it returns the counts of the
+ * cryptographic operations instead; with P1 = PERF_STATS_P1_LATENCY, the latency histograms kept
+ * since the app was started, which need a chained response (PROTOCOL_VERSION_CHAINED_RESPONSE);
+ * with P1 = PERF_STATS_P1_CACHES, the counters of the caches.
+ */
+#define INS_GET_PERF_STATS 0x02
+
+#define PERF_STATS_P1_CRYPTO  0x01
+#define PERF_STATS_P1_LATENCY 0x02
+#define PERF_STATS_P1_CACHES  0x03
+
+/**
+ * Framework instruction to read the binary trace of the last command. Only supported in perf builds
+ * (HAVE_PERF_STATS).
+ */
+#define INS_GET_TRACE 0x03
+
+/**
+ * Framework instruction to read the next chunk of a chained response, after a response with the
+ * status word SW_RESPONSE_HAS_MORE. Only valid from PROTOCOL_VERSION_CHAINED_RESPONSE.
+ */
+#define INS_GET_RESPONSE 0x04
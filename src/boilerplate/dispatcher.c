@@ -17,15 +17,22 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "dispatcher.h"
 #include "constants.h"
 #include "globals.h"
 #include "io.h"
+#include "perf_stats.h"
 #include "sw.h"
+#include "trace.h"
 
 #include "common/buffer.h"
 
+#include "debug-helpers/log.h"
+
+#include "../handler/client_commands.h"
+
 extern dispatcher_context_t G_dispatcher_context;
 
 extern bool G_was_processing_screen_shown;
@@ -35,13 +42,35 @@ struct {
     void (*termination_cb)(void);
     uint16_t sw;
     bool had_ux_flow;  // set to true if there was any UX flow during the APDU processing
+    uint8_t protocol_version;
 } G_dispatcher_state;
 
+// Reassembled response to a client command, if sent in multiple CONTINUE APDUs
+static uint8_t G_extended_continue_buffer[MAX_EXTENDED_CONTINUE_LENGTH];
+
+// YIELD message waiting for the next client command, already framed with its
+// <CCMD_DEFERRED_YIELD> <len> prefix; len is 0 if there is none
+static struct {
+    uint8_t data[2 + MAX_DEFERRED_YIELD_LENGTH];
+    size_t len;
+} G_deferred_yield;
+
 static void add_to_response(const void *rdata, size_t rdata_len) {
     io_add_to_response(rdata, rdata_len);
 }
 
+static buffer_t get_response_writer(void) {
+    return io_get_response_writer();
+}
+
+static void commit_response(const buffer_t *writer) {
+    io_commit_response(writer);
+}
+
 static void finalize_response(uint16_t sw) {
+    if (sw != SW_OK && sw != SW_INTERRUPTED_EXECUTION) {
+        TRACE(TRACE_EV_ERROR, sw);
+    }
     G_dispatcher_state.sw = sw;
     io_finalize_response(sw);
 }
@@ -56,12 +85,18 @@ static void set_ui_dirty() {
 }
 
 // TODO: refactor code in common with the main apdu loop
-static int process_interruption(dispatcher_context_t *dc) {
-    command_t cmd;
+// Receives the next CONTINUE APDU in cmd, after sending the response in the output buffer.
+static int receive_continue(dispatcher_context_t *dc, command_t *cmd) {
     int input_len;
 
     // Reset structured APDU command
-    memset(&cmd, 0, sizeof(cmd));
+    memset(cmd, 0, sizeof(*cmd));
+
+    // a request that does not fit in a single APDU is read by the client with INS_GET_RESPONSE
+    if (io_flush_response_chunks() < 0) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return -1;
+    }
 
     io_start_interruption_timeout();
 
@@ -83,33 +118,139 @@ static int process_interruption(dispatcher_context_t *dc) {
     G_dispatcher_state.sw = 0;
 
     // Parse APDU command from G_io_apdu_buffer
-    if (!apdu_parser(&cmd, G_io_apdu_buffer, input_len)) {
+    if (!apdu_parser(cmd, G_io_apdu_buffer, input_len)) {
         SEND_SW(dc, SW_WRONG_DATA_LENGTH);
         return -1;
     }
 
-    PRINTF("=> CLA=%02X | INS=%02X | P1=%02X | P2=%02X | Lc=%02X | CData=",
-           cmd.cla,
-           cmd.ins,
-           cmd.p1,
-           cmd.p2,
-           cmd.lc);
-    for (int i = 0; i < cmd.lc; i++) {
-        PRINTF("%02X", cmd.data[i]);
-    }
-    PRINTF("\n");
+    // called for every CONTINUE; the data is only dumped at the debug log level
+    LOG_DEBUG("=> CLA=%02X | INS=%02X | P1=%02X | P2=%02X | Lc=%02X | CData=%.*H\n",
+              cmd->cla,
+              cmd->ins,
+              cmd->p1,
+              cmd->p2,
+              cmd->lc,
+              cmd->lc,
+              cmd->data);
 
     // INS_CONTINUE is the only valid apdu here
-    if (cmd.cla != CLA_FRAMEWORK || cmd.ins != INS_CONTINUE) {
+    if (cmd->cla != CLA_FRAMEWORK || cmd->ins != INS_CONTINUE) {
         SEND_SW(dc, SW_INCORRECT_DATA);
         return -1;
     }
 
-    dc->read_buffer = buffer_create(cmd.data, cmd.lc);
+    if (cmd->p1 != 0 && (cmd->p1 != P1_CONTINUE_HAS_MORE ||
+                         G_dispatcher_state.protocol_version < PROTOCOL_VERSION_EXTENDED_CONTINUE)) {
+        SEND_SW(dc, SW_WRONG_P1P2);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Prefixes the pending YIELD message, if any, to the client command in the response. If it does not
+// fit, it is kept for the next client command. Returns the length of the prefix.
+static size_t prepend_deferred_yield(void) {
+    size_t len = G_deferred_yield.len;
+    if (len == 0 || !io_prepend_to_response(G_deferred_yield.data, len)) {
+        return 0;
+    }
+    G_deferred_yield.len = 0;
+    return len;
+}
+
+static int process_interruption(dispatcher_context_t *dc) {
+    command_t cmd;
+
+    size_t prefix_len = prepend_deferred_yield();
+#ifdef HAVE_PERF_STATS
+    // the first byte of the response after the prefix is the client command code
+    uint8_t ccmd = G_output_len > prefix_len + 2 ? io_get_response()[prefix_len] : 0;
+    size_t bytes_out = G_output_len;
+    perf_stats_start_interruption();
+#else
+    (void) prefix_len;
+#endif
+
+    if (receive_continue(dc, &cmd) < 0) {
+        return -1;
+    }
+
+    if (cmd.p1 != P1_CONTINUE_HAS_MORE) {
+        // the whole response fits in a single APDU; no need to copy it
+        dc->read_buffer = buffer_create(cmd.data, cmd.lc);
+#ifdef HAVE_PERF_STATS
+        perf_stats_add_interruption(ccmd, 1, bytes_out, cmd.lc);
+        trace_event(TRACE_EV_INTERRUPTION, (uint32_t) ccmd << 16 | cmd.lc);
+#endif
+        return 0;
+    }
+
+    // The response is split across multiple APDUs; each non-final one is acknowledged with an empty
+    // SW_OK response, and the data is reassembled in a separate buffer.
+    size_t total_len = 0;
+#ifdef HAVE_PERF_STATS
+    size_t n_apdus = 1;
+#endif
+    while (true) {
+        if (total_len + cmd.lc > sizeof(G_extended_continue_buffer)) {
+            PRINTF("Response to client command is too long.\n");
+            SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+            return -1;
+        }
+        memcpy(G_extended_continue_buffer + total_len, cmd.data, cmd.lc);
+        total_len += cmd.lc;
+
+        if (cmd.p1 != P1_CONTINUE_HAS_MORE) {
+            break;
+        }
+
+        io_finalize_response(SW_OK);
+#ifdef HAVE_PERF_STATS
+        bytes_out += G_output_len;
+        ++n_apdus;
+#endif
+        if (receive_continue(dc, &cmd) < 0) {
+            return -1;
+        }
+    }
+
+    dc->read_buffer = buffer_create(G_extended_continue_buffer, total_len);
+#ifdef HAVE_PERF_STATS
+    perf_stats_add_interruption(ccmd, n_apdus, bytes_out, total_len);
+    trace_event(TRACE_EV_INTERRUPTION, (uint32_t) ccmd << 16 | total_len);
+#endif
 
     return 0;
 }
 
+static bool defer_yield(const void *data, size_t data_len) {
+    if (G_dispatcher_state.protocol_version < PROTOCOL_VERSION_DEFERRED_YIELD ||
+        G_deferred_yield.len != 0 || data_len == 0 || data_len > MAX_DEFERRED_YIELD_LENGTH) {
+        return false;
+    }
+    G_deferred_yield.data[0] = CCMD_DEFERRED_YIELD;
+    G_deferred_yield.data[1] = (uint8_t) data_len;
+    memcpy(G_deferred_yield.data + 2, data, data_len);
+    G_deferred_yield.len = 2 + data_len;
+    return true;
+}
+
+static int flush_deferred_yield(dispatcher_context_t *dc) {
+    if (G_deferred_yield.len == 0) {
+        return 0;
+    }
+
+    // sent as a plain YIELD message, as there is no other client command to prefix it to
+    uint8_t cmd = CCMD_YIELD;
+    dc->add_to_response(&cmd, 1);
+    dc->add_to_response(G_deferred_yield.data + 2, G_deferred_yield.len - 2);
+    G_deferred_yield.len = 0;
+    dc->finalize_response(SW_INTERRUPTED_EXECUTION);
+
+    return dc->process_interruption(dc);
+}
+
 void apdu_dispatcher(command_descriptor_t const cmd_descriptors[],
                      int n_descriptors,
                      void (*termination_cb)(void),
@@ -118,14 +259,25 @@ void apdu_dispatcher(command_descriptor_t const cmd_descriptors[],
 
     G_dispatcher_state.termination_cb = termination_cb;
     G_dispatcher_state.sw = 0;
+    G_dispatcher_state.protocol_version = cmd->p2;
+
+    // a YIELD message left pending by a failed command is discarded
+    G_deferred_yield.len = 0;
+
+    io_enable_chained_response(cmd->p2 >= PROTOCOL_VERSION_CHAINED_RESPONSE);
 
     G_dispatcher_context.add_to_response = add_to_response;
+    G_dispatcher_context.get_response_writer = get_response_writer;
+    G_dispatcher_context.commit_response = commit_response;
     G_dispatcher_context.finalize_response = finalize_response;
     G_dispatcher_context.send_response = send_response;
     G_dispatcher_context.set_ui_dirty = set_ui_dirty;
     G_dispatcher_context.process_interruption = process_interruption;
+    G_dispatcher_context.defer_yield = defer_yield;
+    G_dispatcher_context.flush_deferred_yield = flush_deferred_yield;
 
     G_dispatcher_context.read_buffer = buffer_create(cmd->data, cmd->lc);
+    G_dispatcher_context.protocol_version = cmd->p2;
 
     if (cmd->p2 > CURRENT_PROTOCOL_VERSION) {
         io_send_sw(SW_WRONG_P1P2);
@@ -136,7 +288,57 @@ void apdu_dispatcher(command_descriptor_t const cmd_descriptors[],
         PRINTF("Unexpected INS_CONTINUE.\n");
         io_send_sw(SW_BAD_STATE);  // received INS_CONTINUE, but no command was interrupted.
         return;
+    } else if (cmd->cla == CLA_FRAMEWORK && cmd->ins == INS_GET_RESPONSE) {
+        PRINTF("Unexpected INS_GET_RESPONSE.\n");
+        io_send_sw(SW_BAD_STATE);  // received INS_GET_RESPONSE, but no response was chained.
+        return;
+#ifdef HAVE_PERF_STATS
+    } else if (cmd->cla == CLA_FRAMEWORK && cmd->ins == INS_GET_PERF_STATS) {
+        // reports the counters of the previous command, so they must not be reset
+        if (cmd->p1 == PERF_STATS_P1_LATENCY) {
+            // too long for the stack: serialized directly in the (chained) response buffer
+            io_reset_response();
+            buffer_t writer = io_get_response_writer();
+            int latency_len = perf_stats_serialize_latency(writer.ptr, writer.size);
+            if (latency_len < 0) {
+                io_send_sw(SW_BAD_STATE);
+            } else {
+                writer.offset = latency_len;
+                io_commit_response(&writer);
+                io_finalize_response(SW_OK);
+                io_confirm_response();
+            }
+            return;
+        }
+        uint8_t stats[PERF_STATS_MAX_SERIALIZED_LENGTH];
+        int stats_len;
+        if (cmd->p1 == PERF_STATS_P1_CRYPTO) {
+            stats_len = perf_stats_serialize_crypto(stats, sizeof(stats));
+        } else if (cmd->p1 == PERF_STATS_P1_CACHES) {
+            stats_len = perf_stats_serialize_caches(stats, sizeof(stats));
+        } else {
+            stats_len = perf_stats_serialize(stats, sizeof(stats));
+        }
+        if (stats_len < 0) {
+            io_send_sw(SW_BAD_STATE);
+        } else {
+            io_send_response(stats, stats_len, SW_OK);
+        }
+        return;
+    } else if (cmd->cla == CLA_FRAMEWORK && cmd->ins == INS_GET_TRACE) {
+        // like the counters, the trace of the previous command is kept
+        uint8_t trace[TRACE_MAX_SERIALIZED_LENGTH];
+        int trace_len = trace_serialize(trace, sizeof(trace));
+        if (trace_len < 0) {
+            io_send_sw(SW_BAD_STATE);
+        } else {
+            io_send_response(trace, trace_len, SW_OK);
+        }
+        return;
+#endif
     } else {
+        // The descriptors are scanned linearly: there are only a few of them, and the lookup only
+        // happens once per command, as the CONTINUE APDUs are received in process_interruption.
         bool cla_found = false, ins_found = false;
         command_handler_t handler;
         for (int i = 0; i < n_descriptors; i++) {
@@ -158,7 +360,14 @@ void apdu_dispatcher(command_descriptor_t const cmd_descriptors[],
         }
 
         io_start_processing_timeout();
+#ifdef HAVE_PERF_STATS
+        trace_reset();
+        perf_stats_reset(cmd->cla, cmd->ins);
+#endif
         handler(&G_dispatcher_context, cmd->p2);
+#ifdef HAVE_PERF_STATS
+        perf_stats_end_command();
+#endif
     }
 
     // Here a response (either success or error) should have been send.
@@ -181,3 +390,7 @@ void apdu_dispatcher(command_descriptor_t const cmd_descriptors[],
 
     io_clear_processing_timeout();
 }
+
+uint16_t apdu_dispatcher_get_last_sw(void) {
+    return G_dispatcher_state.sw;
+}
@@ -6,10 +6,32 @@
 
 #include "common/buffer.h"
 
+/**
+ * Value of P1 in a CONTINUE APDU whose data is followed by more data for the same response, in
+ * another CONTINUE APDU. Only valid from PROTOCOL_VERSION_EXTENDED_CONTINUE.
+ */
+#define P1_CONTINUE_HAS_MORE 0x01
+
+/**
+ * Maximum total length of a response to a client command split across several CONTINUE APDUs.
+ */
+#define MAX_EXTENDED_CONTINUE_LENGTH 1024
+
+/**
+ * Maximum length of the data of a YIELD message passed to defer_yield.
+ */
+#define MAX_DEFERRED_YIELD_LENGTH 255
+
 // Forward declaration
 struct dispatcher_context_s;
 typedef struct dispatcher_context_s dispatcher_context_t;
 
+/**
+ * Handler of a command. The dispatcher validates P2, the protocol version, before calling it, so
+ * that the handlers receive a version that is at most CURRENT_PROTOCOL_VERSION. P1 is reserved for
+ * feature flags: it is not passed to the handlers, and it is not checked, for forward
+ * compatibility.
+ */
 typedef void (*command_handler_t)(dispatcher_context_t *, uint8_t p2);
 
 /**
@@ -18,11 +40,28 @@ typedef void (*command_handler_t)(dispatcher_context_t *, uint8_t p2);
 struct dispatcher_context_s {
     buffer_t read_buffer;
 
+    // The protocol version of the command (P2): the client commands are only sent to the clients
+    // that support them, see the PROTOCOL_VERSION_* constants.
+    uint8_t protocol_version;
+
     void (*set_ui_dirty)();
     void (*add_to_response)(const void *rdata, size_t rdata_len);
+    // Returns a buffer over the free space of the response, to serialize it in place instead of
+    // copying it with add_to_response; the bytes written are appended with commit_response.
+    buffer_t (*get_response_writer)(void);
+    void (*commit_response)(const buffer_t *writer);
     void (*finalize_response)(uint16_t sw);
     void (*send_response)(void);
     int (*process_interruption)(dispatcher_context_t *dispatcher_context);
+    // From PROTOCOL_VERSION_DEFERRED_YIELD, keeps the data of a YIELD message (without the
+    // CCMD_YIELD byte), and sends it prefixed to the next client command, saving its round trip.
+    // Returns false, keeping nothing, if the protocol version of the command is older or if another
+    // YIELD message is still pending: the caller must then send it as a client command, that the
+    // pending one is prefixed to.
+    bool (*defer_yield)(const void *data, size_t data_len);
+    // Sends the pending YIELD message, if any, as a client command. Must be called before the final
+    // response of a command that used defer_yield. Returns -1 on error, like process_interruption.
+    int (*flush_deferred_yield)(dispatcher_context_t *dispatcher_context);
 };
 
 static inline void SEND_SW(struct dispatcher_context_s *dc, uint16_t sw) {
@@ -81,6 +120,12 @@ void apdu_dispatcher(command_descriptor_t const cmd_descriptors[],
                      void (*termination_cb)(void),
                      const command_t *cmd);
 
+/**
+ * Returns the status word of the final response of the last command processed by apdu_dispatcher,
+ * or 0 if it was rejected before reaching a handler.
+ */
+uint16_t apdu_dispatcher_get_last_sw(void);
+
 // Debug utilities
 
 #if !defined(DEBUG) || DEBUG == 0
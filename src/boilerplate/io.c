@@ -26,6 +26,8 @@
 #endif  // HAVE_NBGL
 
 #include "io.h"
+#include "apdu_parser.h"
+#include "constants.h"
 #include "globals.h"
 #include "sw.h"
 #include "common/buffer.h"
@@ -36,6 +38,10 @@
 
 uint16_t G_output_len = 0;
 
+// Response serialized while chained responses are enabled, including the status word
+static uint8_t G_chained_response_buffer[MAX_CHAINED_RESPONSE_LENGTH + 2];
+static bool G_is_chained_response_enabled;
+
 // Counter incremented at every tick
 // The initial value does not matter, as only the difference between timeframes is used.
 uint16_t G_ticks;
@@ -52,6 +58,9 @@ bool G_was_processing_screen_shown;
 uint16_t G_interruption_timeout_start_tick;
 uint16_t G_processing_timeout_start_tick;
 
+// run once at the next tick event, if not NULL
+static void (*G_idle_task)(void);
+
 #ifdef HAVE_BAGL
 UX_STEP_NOCB(ux_processing_flow_1_step, pn, {&C_icon_processing, "Processing..."});
 UX_FLOW(ux_processing_flow, &ux_processing_flow_1_step);
@@ -85,6 +94,18 @@ void io_reset_timeouts() {
     G_was_processing_screen_shown = false;
 }
 
+void io_set_idle_task(void (*task)(void)) {
+    G_idle_task = task;
+}
+
+bool io_is_high_latency_transport(void) {
+#ifdef HAVE_BLE
+    return G_io_apdu_media == IO_APDU_MEDIA_BLE;
+#else
+    return false;
+#endif  // HAVE_BLE
+}
+
 void io_show_processing_screen() {
     if (!G_was_processing_screen_shown) {
         G_was_processing_screen_shown = true;
@@ -148,6 +169,12 @@ uint8_t io_event(uint8_t channel) {
                 THROW(EXCEPTION_IO_RESET);
             }
 
+            if (G_idle_task != NULL) {
+                void (*task)(void) = G_idle_task;
+                G_idle_task = NULL;
+                task();
+            }
+
             UX_TICKER_EVENT(G_io_seproxyhal_spi_buffer, {});
             break;
         default:
@@ -185,29 +212,75 @@ uint16_t io_exchange_al(uint8_t channel, uint16_t tx_len) {
     return 0;
 }
 
+// Returns the buffer where the response is serialized: G_io_apdu_buffer, unless chained responses
+// are enabled, in which case the response is only copied there one chunk at a time.
+static uint8_t *response_buffer(void) {
+    return G_is_chained_response_enabled ? G_chained_response_buffer : G_io_apdu_buffer;
+}
+
+// Returns the maximum length of the response, including the status word
+static size_t response_size(void) {
+    return G_is_chained_response_enabled ? sizeof(G_chained_response_buffer) : IO_APDU_BUFFER_SIZE;
+}
+
+void io_enable_chained_response(bool enabled) {
+    G_is_chained_response_enabled = enabled;
+}
+
 void io_add_to_response(const void *rdata, size_t rdata_len) {
-    if (G_output_len >= IO_APDU_BUFFER_SIZE - 2) {
-        G_output_len = IO_APDU_BUFFER_SIZE;
-        write_u16_be(G_io_apdu_buffer, IO_APDU_BUFFER_SIZE - 2, SW_WRONG_RESPONSE_LENGTH);
-    } else if (G_output_len + rdata_len > IO_APDU_BUFFER_SIZE - 2) {
-        io_add_to_response(rdata, IO_APDU_BUFFER_SIZE - 2 - rdata_len);
+    size_t size = response_size();
+    if (G_output_len >= size - 2) {
+        G_output_len = size;
+        write_u16_be(response_buffer(), size - 2, SW_WRONG_RESPONSE_LENGTH);
+    } else if (G_output_len + rdata_len > size - 2) {
+        io_add_to_response(rdata, size - 2 - G_output_len);
         io_finalize_response(SW_WRONG_RESPONSE_LENGTH);
     } else {
-        memmove(G_io_apdu_buffer + G_output_len, rdata, rdata_len);
+        memmove(response_buffer() + G_output_len, rdata, rdata_len);
         G_output_len += rdata_len;
     }
 }
 
 void io_finalize_response(uint16_t sw) {
-    if (G_output_len >= IO_APDU_BUFFER_SIZE - 2) {
-        G_output_len = IO_APDU_BUFFER_SIZE;
-        write_u16_be(G_io_apdu_buffer, IO_APDU_BUFFER_SIZE - 2, SW_WRONG_RESPONSE_LENGTH);
+    size_t size = response_size();
+    if (G_output_len >= size - 2) {
+        G_output_len = size;
+        write_u16_be(response_buffer(), size - 2, SW_WRONG_RESPONSE_LENGTH);
     } else {
-        write_u16_be(G_io_apdu_buffer, G_output_len, sw);
+        write_u16_be(response_buffer(), G_output_len, sw);
         G_output_len += 2;
     }
 }
 
+buffer_t io_get_response_writer(void) {
+    size_t size = response_size();
+    if (G_output_len >= size - 2) {
+        return buffer_create(response_buffer() + size - 2, 0);
+    }
+    return buffer_create(response_buffer() + G_output_len, size - 2 - G_output_len);
+}
+
+void io_commit_response(const buffer_t *writer) {
+    if (G_output_len < response_size() - 2) {
+        G_output_len += writer->offset;
+    }
+}
+
+const uint8_t *io_get_response(void) {
+    return response_buffer();
+}
+
+bool io_prepend_to_response(const void *rdata, size_t rdata_len) {
+    if (G_output_len + rdata_len > response_size()) {
+        return false;
+    }
+    uint8_t *buf = response_buffer();
+    memmove(buf + rdata_len, buf, G_output_len);
+    memcpy(buf, rdata, rdata_len);
+    G_output_len += rdata_len;
+    return true;
+}
+
 void io_reset_response() {
     G_output_len = 0;
 }
@@ -220,13 +293,56 @@ void io_set_response(const void *rdata, size_t rdata_len, uint16_t sw) {
     io_finalize_response(sw);
 }
 
+int io_flush_response_chunks(void) {
+    if (!G_is_chained_response_enabled) {
+        return 0;  // the response is already in G_io_apdu_buffer
+    }
+
+    size_t offset = 0;
+    // only the last chunk contains the status word of the response
+    while (G_output_len - offset > IO_APDU_BUFFER_SIZE) {
+        size_t remaining = G_output_len - 2 - offset - CHAINED_RESPONSE_CHUNK_LENGTH;
+        memcpy(G_io_apdu_buffer, G_chained_response_buffer + offset, CHAINED_RESPONSE_CHUNK_LENGTH);
+        write_u16_be(G_io_apdu_buffer,
+                     CHAINED_RESPONSE_CHUNK_LENGTH,
+                     SW_RESPONSE_HAS_MORE | (remaining < 0xFF ? remaining : 0xFF));
+        offset += CHAINED_RESPONSE_CHUNK_LENGTH;
+
+        io_start_interruption_timeout();
+        int input_len = io_exchange(CHANNEL_APDU, CHAINED_RESPONSE_CHUNK_LENGTH + 2);
+        io_clear_interruption_timeout();
+
+        // like a CONTINUE APDU, the GET_RESPONSE APDU is consumed here
+        G_io_app.apdu_length = 0;
+
+        command_t cmd;
+        if (input_len < 0 || !apdu_parser(&cmd, G_io_apdu_buffer, input_len) ||
+            cmd.cla != CLA_FRAMEWORK || cmd.ins != INS_GET_RESPONSE) {
+            PRINTF("Expected INS_GET_RESPONSE.\n");
+            G_output_len = 0;
+            return -1;
+        }
+    }
+
+    G_output_len -= offset;
+    memcpy(G_io_apdu_buffer, G_chained_response_buffer + offset, G_output_len);
+    return 0;
+}
+
 int io_confirm_response() {
     int ret;
+    bool is_chain_broken = io_flush_response_chunks() < 0;
+
+    if (is_chain_broken) {
+        // the host sent another APDU instead of reading the rest of the response; it is rejected
+        io_finalize_response(SW_INCORRECT_DATA);
+        io_flush_response_chunks();
+    }
 
     ret = io_exchange(CHANNEL_APDU | IO_RETURN_AFTER_TX, G_output_len);
     G_output_len = 0;
 
-    return ret;
+    return is_chain_broken ? -1 : ret;
 }
 
 int io_send_response(void *rdata, size_t rdata_len, uint16_t sw) {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "ux.h"
 #include "os_io_seproxyhal.h"
@@ -22,6 +23,16 @@ uint8_t io_event(uint8_t channel);
 
 uint16_t io_exchange_al(uint8_t channel, uint16_t tx_len);
 
+/**
+ * Maximum length of the data of a chained response, that is split across several APDUs.
+ */
+#define MAX_CHAINED_RESPONSE_LENGTH 1024
+
+/**
+ * Length of the data of each chunk of a chained response but the last one.
+ */
+#define CHAINED_RESPONSE_CHUNK_LENGTH (IO_APDU_BUFFER_SIZE - 2)
+
 #define INTERRUPTION_TIMEOUT_TICKS 50
 #define PROCESSING_TIMEOUT_TICKS   10
 
@@ -59,6 +70,29 @@ void io_reset_timeouts();
  */
 void io_show_processing_screen();
 
+/**
+ * Returns true if the current command was received over a transport where each APDU round trip is
+ * expensive (BLE), compared to USB. Requests that only save work on the client, at the cost of a
+ * round trip of their own, are not worth sending on such a transport.
+ */
+bool io_is_high_latency_transport(void);
+
+/**
+ * Instructs io_event to run the given task once, at the next tick event. Used to do work while the
+ * app is idle, waiting for the next command or for the user during a review: the task must be
+ * cleared (by passing NULL) as soon as the wait is over. A task can set itself again, in order to
+ * split longer work in bounded steps, one per tick.
+ */
+void io_set_idle_task(void (*task)(void));
+
+/**
+ * Enables or disables chained responses, for the next responses. Once enabled, a response can have
+ * up to MAX_CHAINED_RESPONSE_LENGTH bytes of data: if it does not fit in a single APDU, all its
+ * chunks but the last one are sent with the status word SW_RESPONSE_HAS_MORE, and the host reads
+ * each of the next ones with INS_GET_RESPONSE. Must only be called while the response is empty.
+ */
+void io_enable_chained_response(bool enabled);
+
 /**
  * TODO: docs
  */
@@ -74,9 +108,45 @@ void io_add_to_response(const void *rdata, size_t rdata_len);
  */
 void io_finalize_response(uint16_t sw);
 
+/**
+ * Returns a buffer over the free part of G_io_apdu_buffer, right after the data already added to
+ * the response, and leaving room for the status word. The response can be serialized in place with
+ * the buffer_write_* functions; the bytes written are only added to the response once
+ * io_commit_response is called.
+ */
+buffer_t io_get_response_writer(void);
+
+/**
+ * Adds to the response the bytes written to a buffer returned by io_get_response_writer, with no
+ * other call to the io_*_response functions in between.
+ */
+void io_commit_response(const buffer_t *writer);
+
+/**
+ * Inserts data at the beginning of a response that was already finalized with
+ * io_finalize_response. Returns false, leaving the response unchanged, if the result does not fit
+ * in the response buffer.
+ */
+bool io_prepend_to_response(const void *rdata, size_t rdata_len);
+
+/**
+ * Returns the start of the response being built.
+ */
+const uint8_t *io_get_response(void);
+
 /* TODO: docs */
 void io_set_response(const void *rdata, size_t rdata_len, uint16_t sw);
 
+/**
+ * If the response does not fit in a single APDU, sends all its chunks but the last one, waiting for
+ * an INS_GET_RESPONSE APDU after each of them. The last chunk is then left in G_io_apdu_buffer, and
+ * G_output_len is its length, so that it can be sent with io_exchange.
+ *
+ * Returns 0 on success, or -1 if another APDU was received instead of an INS_GET_RESPONSE; in that
+ * case, the response is reset, and a response to that APDU must still be sent.
+ */
+int io_flush_response_chunks(void);
+
 /* TODO: docs */
 int io_confirm_response(void);
 
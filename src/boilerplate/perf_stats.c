@@ -0,0 +1,385 @@
+#ifdef HAVE_PERF_STATS
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "perf_stats.h"
+#include "trace.h"
+
+#include "common/write.h"
+
+extern uint16_t G_ticks;
+
+// Lowest word of the stack, defined by the linker script of the SDK; the stack grows towards it
+extern uint32_t app_stack_canary;
+
+#define STACK_PAINT_PATTERN 0xA5A5A5A5U
+
+// Bytes below the frame of perf_stats_reset that are not painted, as they might be in use
+#define STACK_PAINT_MARGIN 64
+
+typedef struct {
+    uint8_t ccmd;
+    uint32_t n_interruptions;
+    uint32_t n_apdus;
+    uint32_t bytes_out;
+    uint32_t bytes_in;
+} perf_ccmd_stats_t;
+
+typedef struct {
+    uint32_t ticks;
+    uint32_t n_interruptions;
+} perf_phase_stats_t;
+
+static struct {
+    uint8_t cla;
+    uint8_t ins;
+
+    uint32_t n_interruptions;
+    uint32_t bytes_out;
+    uint32_t bytes_in;
+
+    uint8_t n_codes;
+    perf_ccmd_stats_t ccmd_stats[PERF_STATS_MAX_CCMD_CODES];
+
+    perf_phase_stats_t phase_stats[PERF_N_PHASES];
+    perf_phase_t current_phase;
+    uint16_t phase_start_tick;
+    uint32_t phase_start_n_interruptions;
+
+    uintptr_t stack_start;  // approximate stack pointer when the handler is called
+    uint32_t stack_used;
+    uint32_t stack_free;
+
+    uint32_t crypto_ops[PERF_N_CRYPTO_OPS];
+
+    uint32_t cache_events[PERF_N_CACHES][PERF_N_CACHE_EVENTS];
+
+    uint16_t command_start_tick;
+    uint16_t service_start_tick;
+    uint16_t wait_start_tick;
+    uint8_t last_ccmd;  // client command whose answer was received last, or 0
+    bool is_waiting;    // set while waiting for the answer to a client command
+} G_perf_stats;
+
+typedef struct {
+    uint8_t cla;
+    uint8_t ins;
+    uint32_t max_stack_used;
+    uint16_t ticks_histogram[PERF_LATENCY_N_BUCKETS];
+} perf_ins_stats_t;
+
+typedef struct {
+    uint8_t ccmd;
+    uint16_t service_histogram[PERF_LATENCY_N_BUCKETS];
+    uint16_t wait_histogram[PERF_LATENCY_N_BUCKETS];
+} perf_ccmd_latency_t;
+
+// Not reset between commands
+static struct {
+    uint8_t n_ins;
+    perf_ins_stats_t ins_stats[PERF_STATS_MAX_INS];
+} G_perf_ins_stats;
+
+// Not reset between commands either
+static struct {
+    uint8_t n_codes;
+    perf_ccmd_latency_t ccmd_latency[PERF_STATS_MAX_CCMD_CODES];
+} G_perf_ccmd_latency;
+
+// Set by the caches themselves, as their entries outlive the commands
+static struct {
+    uint32_t bytes_in_use;
+    uint32_t budget;
+} G_perf_cache_bytes[PERF_N_CACHES];
+
+static uint32_t *stack_bottom(void) {
+    // the canary itself must be preserved
+    return &app_stack_canary + 1;
+}
+
+static void __attribute__((noinline)) paint_stack(uintptr_t stack_start) {
+    volatile uint32_t *p = stack_bottom();
+    while ((uintptr_t) p < stack_start - STACK_PAINT_MARGIN) {
+        *(p++) = STACK_PAINT_PATTERN;
+    }
+}
+
+// Returns the lowest word of the stack that was written since paint_stack
+static uintptr_t __attribute__((noinline)) find_stack_high_watermark(uintptr_t stack_start) {
+    const volatile uint32_t *p = stack_bottom();
+    while ((uintptr_t) p < stack_start - STACK_PAINT_MARGIN && *p == STACK_PAINT_PATTERN) {
+        ++p;
+    }
+    return (uintptr_t) p;
+}
+
+static void add_to_histogram(uint16_t histogram[static PERF_LATENCY_N_BUCKETS], uint16_t ticks) {
+    size_t bucket = 0;
+    while (ticks != 0 && bucket < PERF_LATENCY_N_BUCKETS - 1) {
+        ticks >>= 1;
+        ++bucket;
+    }
+    if (histogram[bucket] != UINT16_MAX) {
+        ++histogram[bucket];
+    }
+}
+
+static perf_ccmd_latency_t *get_ccmd_latency(uint8_t ccmd) {
+    for (size_t i = 0; i < G_perf_ccmd_latency.n_codes; i++) {
+        if (G_perf_ccmd_latency.ccmd_latency[i].ccmd == ccmd) {
+            return &G_perf_ccmd_latency.ccmd_latency[i];
+        }
+    }
+    if (G_perf_ccmd_latency.n_codes == PERF_STATS_MAX_CCMD_CODES) {
+        return NULL;
+    }
+    perf_ccmd_latency_t *latency =
+        &G_perf_ccmd_latency.ccmd_latency[G_perf_ccmd_latency.n_codes++];
+    latency->ccmd = ccmd;
+    return latency;
+}
+
+// Accounts the service time since the last answer, or since the beginning of the command
+static void end_service(void) {
+    perf_ccmd_latency_t *latency = get_ccmd_latency(G_perf_stats.last_ccmd);
+    if (latency != NULL) {
+        add_to_histogram(latency->service_histogram,
+                         (uint16_t) (G_ticks - G_perf_stats.service_start_tick));
+    }
+}
+
+static void update_ins_stats(uint8_t cla, uint8_t ins, uint32_t stack_used, uint16_t ticks) {
+    perf_ins_stats_t *stats = NULL;
+    for (size_t i = 0; i < G_perf_ins_stats.n_ins; i++) {
+        if (G_perf_ins_stats.ins_stats[i].cla == cla && G_perf_ins_stats.ins_stats[i].ins == ins) {
+            stats = &G_perf_ins_stats.ins_stats[i];
+            break;
+        }
+    }
+    if (stats == NULL) {
+        if (G_perf_ins_stats.n_ins == PERF_STATS_MAX_INS) {
+            return;
+        }
+        stats = &G_perf_ins_stats.ins_stats[G_perf_ins_stats.n_ins++];
+        stats->cla = cla;
+        stats->ins = ins;
+    }
+    if (stack_used > stats->max_stack_used) {
+        stats->max_stack_used = stack_used;
+    }
+    add_to_histogram(stats->ticks_histogram, ticks);
+}
+
+void perf_stats_reset(uint8_t cla, uint8_t ins) {
+    memset(&G_perf_stats, 0, sizeof(G_perf_stats));
+    G_perf_stats.cla = cla;
+    G_perf_stats.ins = ins;
+    G_perf_stats.current_phase = PERF_PHASE_OTHER;
+    G_perf_stats.phase_start_tick = G_ticks;
+    G_perf_stats.command_start_tick = G_ticks;
+    G_perf_stats.service_start_tick = G_ticks;
+
+    G_perf_stats.stack_start = (uintptr_t) __builtin_frame_address(0);
+    paint_stack(G_perf_stats.stack_start);
+}
+
+void perf_stats_start_interruption(void) {
+    end_service();
+    G_perf_stats.is_waiting = true;
+    G_perf_stats.wait_start_tick = G_ticks;
+}
+
+void perf_stats_add_interruption(uint8_t ccmd, size_t n_apdus, size_t bytes_out, size_t bytes_in) {
+    perf_ccmd_latency_t *latency = get_ccmd_latency(ccmd);
+    if (latency != NULL) {
+        add_to_histogram(latency->wait_histogram,
+                         (uint16_t) (G_ticks - G_perf_stats.wait_start_tick));
+    }
+    G_perf_stats.is_waiting = false;
+    G_perf_stats.last_ccmd = ccmd;
+    G_perf_stats.service_start_tick = G_ticks;
+
+    ++G_perf_stats.n_interruptions;
+    G_perf_stats.bytes_out += bytes_out;
+    G_perf_stats.bytes_in += bytes_in;
+
+    perf_ccmd_stats_t *stats = NULL;
+    for (size_t i = 0; i < G_perf_stats.n_codes; i++) {
+        if (G_perf_stats.ccmd_stats[i].ccmd == ccmd) {
+            stats = &G_perf_stats.ccmd_stats[i];
+            break;
+        }
+    }
+    if (stats == NULL) {
+        if (G_perf_stats.n_codes == PERF_STATS_MAX_CCMD_CODES) {
+            return;  // only the totals are updated
+        }
+        stats = &G_perf_stats.ccmd_stats[G_perf_stats.n_codes++];
+        stats->ccmd = ccmd;
+    }
+
+    ++stats->n_interruptions;
+    stats->n_apdus += n_apdus;
+    stats->bytes_out += bytes_out;
+    stats->bytes_in += bytes_in;
+}
+
+void perf_stats_start_phase(perf_phase_t phase) {
+    trace_event(TRACE_EV_PHASE, phase);
+
+    perf_phase_stats_t *stats = &G_perf_stats.phase_stats[G_perf_stats.current_phase];
+    stats->ticks += (uint16_t) (G_ticks - G_perf_stats.phase_start_tick);
+    stats->n_interruptions += G_perf_stats.n_interruptions - G_perf_stats.phase_start_n_interruptions;
+
+    G_perf_stats.current_phase = phase;
+    G_perf_stats.phase_start_tick = G_ticks;
+    G_perf_stats.phase_start_n_interruptions = G_perf_stats.n_interruptions;
+}
+
+void perf_stats_count_crypto(perf_crypto_op_t op, uint32_t n) {
+    G_perf_stats.crypto_ops[op] += n;
+}
+
+void perf_stats_count_cache(perf_cache_t cache, perf_cache_event_t event) {
+    ++G_perf_stats.cache_events[cache][event];
+}
+
+void perf_stats_set_cache_bytes(perf_cache_t cache, uint32_t bytes_in_use, uint32_t budget) {
+    G_perf_cache_bytes[cache].bytes_in_use = bytes_in_use;
+    G_perf_cache_bytes[cache].budget = budget;
+}
+
+void perf_stats_end_command(void) {
+    perf_stats_start_phase(PERF_PHASE_OTHER);
+
+    uintptr_t high_watermark = find_stack_high_watermark(G_perf_stats.stack_start);
+    G_perf_stats.stack_used = (uint32_t) (G_perf_stats.stack_start - high_watermark);
+    G_perf_stats.stack_free = (uint32_t) (high_watermark - (uintptr_t) stack_bottom());
+
+    // if the command failed while waiting for an answer, there is no service time to account
+    if (!G_perf_stats.is_waiting) {
+        end_service();
+    }
+    update_ins_stats(G_perf_stats.cla,
+                     G_perf_stats.ins,
+                     G_perf_stats.stack_used,
+                     (uint16_t) (G_ticks - G_perf_stats.command_start_tick));
+}
+
+int perf_stats_serialize(uint8_t *out, size_t out_len) {
+    if (out_len < PERF_STATS_MAX_SERIALIZED_LENGTH) {
+        return -1;
+    }
+
+    size_t pos = 0;
+    out[pos++] = G_perf_stats.cla;
+    out[pos++] = G_perf_stats.ins;
+    write_u32_be(out, pos, G_perf_stats.n_interruptions);
+    write_u32_be(out, pos + 4, G_perf_stats.bytes_out);
+    write_u32_be(out, pos + 8, G_perf_stats.bytes_in);
+    pos += 12;
+
+    out[pos++] = G_perf_stats.n_codes;
+    for (size_t i = 0; i < G_perf_stats.n_codes; i++) {
+        const perf_ccmd_stats_t *stats = &G_perf_stats.ccmd_stats[i];
+        out[pos++] = stats->ccmd;
+        write_u32_be(out, pos, stats->n_interruptions);
+        write_u32_be(out, pos + 4, stats->n_apdus);
+        write_u32_be(out, pos + 8, stats->bytes_out);
+        write_u32_be(out, pos + 12, stats->bytes_in);
+        pos += 16;
+    }
+
+    out[pos++] = PERF_N_PHASES;
+    for (size_t i = 0; i < PERF_N_PHASES; i++) {
+        write_u32_be(out, pos, G_perf_stats.phase_stats[i].ticks);
+        write_u32_be(out, pos + 4, G_perf_stats.phase_stats[i].n_interruptions);
+        pos += 8;
+    }
+
+    write_u32_be(out, pos, G_perf_stats.stack_used);
+    write_u32_be(out, pos + 4, G_perf_stats.stack_free);
+    pos += 8;
+
+    out[pos++] = G_perf_ins_stats.n_ins;
+    for (size_t i = 0; i < G_perf_ins_stats.n_ins; i++) {
+        const perf_ins_stats_t *stats = &G_perf_ins_stats.ins_stats[i];
+        out[pos++] = stats->cla;
+        out[pos++] = stats->ins;
+        write_u32_be(out, pos, stats->max_stack_used);
+        pos += 4;
+    }
+
+    return (int) pos;
+}
+
+int perf_stats_serialize_crypto(uint8_t *out, size_t out_len) {
+    if (out_len < PERF_STATS_CRYPTO_SERIALIZED_LENGTH) {
+        return -1;
+    }
+
+    out[0] = PERF_N_CRYPTO_OPS;
+    for (size_t i = 0; i < PERF_N_CRYPTO_OPS; i++) {
+        write_u32_be(out, 1 + 4 * i, G_perf_stats.crypto_ops[i]);
+    }
+
+    return PERF_STATS_CRYPTO_SERIALIZED_LENGTH;
+}
+
+int perf_stats_serialize_caches(uint8_t *out, size_t out_len) {
+    if (out_len < PERF_STATS_CACHES_SERIALIZED_LENGTH) {
+        return -1;
+    }
+
+    size_t pos = 0;
+    out[pos++] = PERF_N_CACHES;
+    for (size_t i = 0; i < PERF_N_CACHES; i++) {
+        write_u32_be(out, pos, G_perf_stats.cache_events[i][PERF_CACHE_HIT]);
+        write_u32_be(out, pos + 4, G_perf_stats.cache_events[i][PERF_CACHE_MISS]);
+        write_u32_be(out, pos + 8, G_perf_stats.cache_events[i][PERF_CACHE_EVICTION]);
+        write_u32_be(out, pos + 12, G_perf_cache_bytes[i].bytes_in_use);
+        write_u32_be(out, pos + 16, G_perf_cache_bytes[i].budget);
+        pos += 20;
+    }
+
+    return (int) pos;
+}
+
+static size_t write_histogram(uint8_t *out,
+                              size_t pos,
+                              const uint16_t histogram[static PERF_LATENCY_N_BUCKETS]) {
+    for (size_t i = 0; i < PERF_LATENCY_N_BUCKETS; i++) {
+        write_u16_be(out, pos + 2 * i, histogram[i]);
+    }
+    return pos + 2 * PERF_LATENCY_N_BUCKETS;
+}
+
+int perf_stats_serialize_latency(uint8_t *out, size_t out_len) {
+    if (out_len < PERF_STATS_LATENCY_MAX_SERIALIZED_LENGTH) {
+        return -1;
+    }
+
+    size_t pos = 0;
+    out[pos++] = PERF_LATENCY_N_BUCKETS;
+
+    out[pos++] = G_perf_ins_stats.n_ins;
+    for (size_t i = 0; i < G_perf_ins_stats.n_ins; i++) {
+        const perf_ins_stats_t *stats = &G_perf_ins_stats.ins_stats[i];
+        out[pos++] = stats->cla;
+        out[pos++] = stats->ins;
+        pos = write_histogram(out, pos, stats->ticks_histogram);
+    }
+
+    out[pos++] = G_perf_ccmd_latency.n_codes;
+    for (size_t i = 0; i < G_perf_ccmd_latency.n_codes; i++) {
+        const perf_ccmd_latency_t *latency = &G_perf_ccmd_latency.ccmd_latency[i];
+        out[pos++] = latency->ccmd;
+        pos = write_histogram(out, pos, latency->service_histogram);
+        pos = write_histogram(out, pos, latency->wait_histogram);
+    }
+
+    return (int) pos;
+}
+
+#endif
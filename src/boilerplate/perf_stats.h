@@ -0,0 +1,306 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Performance counters of the last command, only available in perf builds (HAVE_PERF_STATS, enabled
+ * by AUTOAPPROVE_FOR_PERF_TESTS=1). They are reset at the beginning of each command, and read with
+ * the INS_GET_PERF_STATS framework APDU.
+ *
+ * For each client command code, they count the interruptions, the exchanged APDUs and the bytes sent
+ * and received. The command handlers can also mark the phases of their execution, so that the
+ * interruptions and the G_ticks elapsed in each phase are reported separately. Ticks are only
+ * delivered while waiting for the I/O, and they have a resolution of 100 ms; the interruption
+ * counts are deterministic.
+ *
+ * The free part of the stack is also painted with a known pattern before each command, and scanned
+ * once it returns: the deepest word that was overwritten gives the stack used by the command, and
+ * how much of the stack was never touched. The peak stack usage of each INS is kept across
+ * commands, until the app is restarted.
+ *
+ * Finally, the wrappers of crypto.c count the cryptographic operations of the command, so that the
+ * effect of caches and fast paths can be checked with exact counts rather than with timings.
+ *
+ * The caches count their lookups that found an entry (hits) or not (misses), and the entries that
+ * were in use when they were replaced (evictions); they also report the bytes of their entries in
+ * use, and their total size, that are kept across commands.
+ *
+ * Across commands, latency histograms are also kept until the app is restarted: the ticks of each
+ * command per INS, and for each client command code, the ticks spent waiting for the answer of the
+ * client, and the service time of the app from receiving the answer until sending the next request
+ * (or the final response). As ticks are only delivered during the I/O, the service time is a lower
+ * bound of the time computing on the device; the durations of the commands include both.
+ */
+
+/**
+ * Maximum number of distinct client command codes tracked during a command.
+ */
+#define PERF_STATS_MAX_CCMD_CODES 12
+
+/**
+ * Maximum number of distinct commands (CLA and INS) whose peak stack usage is tracked.
+ */
+#define PERF_STATS_MAX_INS 16
+
+/**
+ * Number of buckets of the latency histograms. Bucket 0 counts the durations of 0 ticks, bucket
+ * i > 0 the durations from 2^(i-1) to 2^i - 1 ticks, and the last bucket all the longer ones.
+ */
+#define PERF_LATENCY_N_BUCKETS 8
+
+/**
+ * Phases of a command. Everything happening before the first marked phase is accounted to
+ * PERF_PHASE_OTHER.
+ */
+typedef enum {
+    PERF_PHASE_OTHER = 0,
+    PERF_PHASE_INIT,     // parsing the inputs of the command
+    PERF_PHASE_INPUTS,   // processing the inputs of a transaction
+    PERF_PHASE_OUTPUTS,  // processing the outputs of a transaction
+    PERF_PHASE_CONFIRM,  // user confirmation
+    PERF_PHASE_SIGN,     // computing and yielding the signatures
+    PERF_N_PHASES
+} perf_phase_t;
+
+/**
+ * Cryptographic operations counted during a command.
+ */
+typedef enum {
+    PERF_CRYPTO_HASH_BLOCKS = 0,  // compressions of the hashes updated with crypto_hash_update and
+                                  // crypto_hash_digest, and of the one-shot SHA-256 of crypto.c
+    PERF_CRYPTO_HMAC_SHA256,      // HMAC-SHA256 computations (RFC6979 nonces)
+    PERF_CRYPTO_HMAC_SHA512,      // HMAC-SHA512 computations (BIP-32 child derivations)
+    PERF_CRYPTO_SCALAR_MULT,      // multiplications of the generator by a scalar
+    PERF_CRYPTO_POINT_ADD,        // additions of two points
+    PERF_CRYPTO_MOD_SQRT,         // modular square roots, to decompress or lift a point
+    PERF_CRYPTO_RIPEMD160,        // RIPEMD-160 computations
+    PERF_CRYPTO_OS_DERIVATION,    // derivations from the seed by the OS (BIP-32 and SLIP-21)
+    PERF_CRYPTO_SIGNATURE,        // ECDSA and Schnorr signatures, including the low-R attempts
+    PERF_N_CRYPTO_OPS
+} perf_crypto_op_t;
+
+/**
+ * Caches whose use is counted: the command and session caches of handler/lib/session.h, the NVM
+ * cache of extended pubkeys, and the cache of private nodes of crypto.c.
+ */
+typedef enum {
+    PERF_CACHE_MERKLE_NODE = 0,
+    PERF_CACHE_MERKLE_LEAF_TABLE,
+    PERF_CACHE_MERKLEIZED_MAP,
+    PERF_CACHE_MAP_CONTENTS,
+    PERF_CACHE_WALLET_KEY,
+    PERF_CACHE_RAWTX,
+    PERF_CACHE_TAPROOT_KEY,
+    PERF_CACHE_WALLET_POLICY,
+    PERF_CACHE_VALIDATED_PSBT,
+    PERF_CACHE_XPUB,
+    PERF_CACHE_PRIVATE_NODE,
+    PERF_N_CACHES
+} perf_cache_t;
+
+/**
+ * Events counted for each cache.
+ */
+typedef enum {
+    PERF_CACHE_HIT = 0,   // a lookup found the entry
+    PERF_CACHE_MISS,      // a lookup did not find the entry
+    PERF_CACHE_EVICTION,  // an entry in use was replaced by a new one
+    PERF_N_CACHE_EVENTS
+} perf_cache_event_t;
+
+/**
+ * Maximum length of the serialization of the counters.
+ */
+#define PERF_STATS_MAX_SERIALIZED_LENGTH                                  \
+    (2 + 12 + 1 + 17 * PERF_STATS_MAX_CCMD_CODES + 1 + 8 * PERF_N_PHASES + \
+     8 + 1 + 6 * PERF_STATS_MAX_INS)
+
+/**
+ * Length of the serialization of the crypto counters.
+ */
+#define PERF_STATS_CRYPTO_SERIALIZED_LENGTH (1 + 4 * PERF_N_CRYPTO_OPS)
+
+/**
+ * Length of the serialization of the cache counters.
+ */
+#define PERF_STATS_CACHES_SERIALIZED_LENGTH (1 + 5 * 4 * PERF_N_CACHES)
+
+// the dispatcher serializes all the counters except the latency histograms in the same buffer
+_Static_assert(PERF_STATS_CRYPTO_SERIALIZED_LENGTH <= PERF_STATS_MAX_SERIALIZED_LENGTH &&
+                   PERF_STATS_CACHES_SERIALIZED_LENGTH <= PERF_STATS_MAX_SERIALIZED_LENGTH,
+               "The counters must fit in the buffer of INS_GET_PERF_STATS");
+
+/**
+ * Maximum length of the serialization of the latency histograms.
+ */
+#define PERF_STATS_LATENCY_MAX_SERIALIZED_LENGTH                      \
+    (1 + 1 + (2 + 2 * PERF_LATENCY_N_BUCKETS) * PERF_STATS_MAX_INS + \
+     1 + (1 + 4 * PERF_LATENCY_N_BUCKETS) * PERF_STATS_MAX_CCMD_CODES)
+
+#ifdef HAVE_PERF_STATS
+
+/**
+ * Resets all the counters of the last command, and paints the free part of the stack. Called by
+ * the dispatcher before running the handler of a command.
+ *
+ * @param[in] cla
+ *   The CLA of the command.
+ * @param[in] ins
+ *   The INS of the command.
+ */
+void perf_stats_reset(uint8_t cla, uint8_t ins);
+
+/**
+ * Marks the moment when the running command sends a request to the client, ending the service
+ * time since the previous answer. Called by the dispatcher before waiting for the answer.
+ */
+void perf_stats_start_interruption(void);
+
+/**
+ * Accounts an interruption of the running command, once the whole answer of the client is received.
+ *
+ * @param[in] ccmd
+ *   The client command code, that is the first byte of the response sent to the client.
+ * @param[in] n_apdus
+ *   The number of CONTINUE APDUs received for this interruption.
+ * @param[in] bytes_out
+ *   The number of bytes sent to the client, including the status words.
+ * @param[in] bytes_in
+ *   The number of data bytes received from the client.
+ */
+void perf_stats_add_interruption(uint8_t ccmd, size_t n_apdus, size_t bytes_out, size_t bytes_in);
+
+/**
+ * Starts a new phase of the running command, ending the current one.
+ *
+ * @param[in] phase
+ *   The phase that starts.
+ */
+void perf_stats_start_phase(perf_phase_t phase);
+
+/**
+ * Counts cryptographic operations of the running command.
+ *
+ * @param[in] op
+ *   The operation.
+ * @param[in] n
+ *   The number of operations.
+ */
+void perf_stats_count_crypto(perf_crypto_op_t op, uint32_t n);
+
+/**
+ * Counts an event of a cache during the running command.
+ *
+ * @param[in] cache
+ *   The cache.
+ * @param[in] event
+ *   The event.
+ */
+void perf_stats_count_cache(perf_cache_t cache, perf_cache_event_t event);
+
+/**
+ * Sets the bytes of the entries of a cache that are in use, and its total size. Called by the
+ * caches when they are wiped, and when they add an entry.
+ *
+ * @param[in] cache
+ *   The cache.
+ * @param[in] bytes_in_use
+ *   The size of the entries in use, in bytes.
+ * @param[in] budget
+ *   The RAM (or NVM) taken by the cache, in bytes.
+ */
+void perf_stats_set_cache_bytes(perf_cache_t cache, uint32_t bytes_in_use, uint32_t budget);
+
+/**
+ * Ends the current phase, and measures the stack used by the command. Called by the dispatcher
+ * once the handler of a command returns.
+ */
+void perf_stats_end_command(void);
+
+/**
+ * Serializes the counters of the last command. All the integers are big-endian:
+ * <cla : 1> <ins : 1> <n_interruptions : 4> <bytes_out : 4> <bytes_in : 4>
+ * <n_codes : 1> n_codes times: <ccmd : 1> <n_interruptions : 4> <n_apdus : 4> <bytes_out : 4>
+ *                              <bytes_in : 4>
+ * <n_phases : 1> n_phases times: <ticks : 4> <n_interruptions : 4>
+ * <stack_used : 4> <stack_free : 4>
+ * <n_ins : 1> n_ins times: <cla : 1> <ins : 1> <max_stack_used : 4>
+ * The stack sizes are in bytes.
+ *
+ * @param[out] out
+ *   Pointer to the output buffer.
+ * @param[in] out_len
+ *   Length of the output buffer; it must be at least PERF_STATS_MAX_SERIALIZED_LENGTH.
+ *
+ * @return the length of the serialization, or -1 if the buffer is too short.
+ */
+int perf_stats_serialize(uint8_t *out, size_t out_len);
+
+/**
+ * Serializes the crypto counters of the last command; they are returned separately, as the
+ * response to INS_GET_PERF_STATS is close to the maximum length of an APDU. The integers are
+ * big-endian:
+ * <n_ops : 1> n_ops times: <count : 4>, in the order of perf_crypto_op_t
+ *
+ * @param[out] out
+ *   Pointer to the output buffer.
+ * @param[in] out_len
+ *   Length of the output buffer; it must be at least PERF_STATS_CRYPTO_SERIALIZED_LENGTH.
+ *
+ * @return the length of the serialization, or -1 if the buffer is too short.
+ */
+int perf_stats_serialize_crypto(uint8_t *out, size_t out_len);
+
+/**
+ * Serializes the counters of the caches: the events of the last command, and the bytes in use. The
+ * integers are big-endian:
+ * <n_caches : 1> n_caches times: <hits : 4> <misses : 4> <evictions : 4> <bytes_in_use : 4>
+ *                                <budget : 4>
+ * in the order of perf_cache_t.
+ *
+ * @param[out] out
+ *   Pointer to the output buffer.
+ * @param[in] out_len
+ *   Length of the output buffer; it must be at least PERF_STATS_CACHES_SERIALIZED_LENGTH.
+ *
+ * @return the length of the serialization, or -1 if the buffer is too short.
+ */
+int perf_stats_serialize_caches(uint8_t *out, size_t out_len);
+
+/**
+ * Serializes the latency histograms kept since the app was started. All the integers are
+ * big-endian:
+ * <n_buckets : 1>
+ * <n_ins : 1> n_ins times: <cla : 1> <ins : 1> n_buckets times: <n_commands : 2>
+ * <n_codes : 1> n_codes times: <ccmd : 1> n_buckets times: <n_service : 2>
+ *                              n_buckets times: <n_wait : 2>
+ * The service times accounted to ccmd are the ones following its answer; the ones before the first
+ * interruption of a command are accounted to ccmd 0. The counts saturate at 0xFFFF.
+ *
+ * @param[out] out
+ *   Pointer to the output buffer.
+ * @param[in] out_len
+ *   Length of the output buffer; it must be at least PERF_STATS_LATENCY_MAX_SERIALIZED_LENGTH.
+ *
+ * @return the length of the serialization, or -1 if the buffer is too short.
+ */
+int perf_stats_serialize_latency(uint8_t *out, size_t out_len);
+
+#define PERF_START_PHASE(phase)    perf_stats_start_phase(phase)
+#define PERF_COUNT_CRYPTO(op, n) perf_stats_count_crypto(op, n)
+#define PERF_COUNT_CACHE(cache, event) perf_stats_count_cache(cache, event)
+#define PERF_COUNT_CACHE_LOOKUP(cache, is_hit) \
+    perf_stats_count_cache(cache, (is_hit) ? PERF_CACHE_HIT : PERF_CACHE_MISS)
+#define PERF_SET_CACHE_BYTES(cache, bytes_in_use, budget) \
+    perf_stats_set_cache_bytes(cache, bytes_in_use, budget)
+
+#else
+
+#define PERF_START_PHASE(phase)
+#define PERF_COUNT_CRYPTO(op, n)
+#define PERF_COUNT_CACHE(cache, event)
+#define PERF_COUNT_CACHE_LOOKUP(cache, is_hit)
+#define PERF_SET_CACHE_BYTES(cache, bytes_in_use, budget)
+
+#endif
@@ -66,6 +66,13 @@
  */
 #define SW_SIGNATURE_FAIL 0xB008
 
+/**
+ * Status word of a chunk of a chained response, whose next chunk is read with INS_GET_RESPONSE. The
+ * low byte is the number of bytes of the response still to be read, or 0xFF if at least 255 bytes
+ * are left.
+ */
+#define SW_RESPONSE_HAS_MORE 0x6100
+
 /**
  * Status word for interrupted execution.
  */
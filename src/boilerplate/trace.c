@@ -0,0 +1,57 @@
+#ifdef HAVE_PERF_STATS
+
+#include <string.h>
+
+#include "trace.h"
+
+#include "common/write.h"
+
+extern uint16_t G_ticks;
+
+typedef struct {
+    uint8_t event;
+    uint16_t tick;
+    uint32_t arg;
+} trace_entry_t;
+
+static struct {
+    trace_entry_t entries[TRACE_MAX_EVENTS];
+    uint32_t n_events;  // total number of events recorded since the last reset
+} G_trace;
+
+void trace_reset(void) {
+    memset(&G_trace, 0, sizeof(G_trace));
+}
+
+void trace_event(trace_event_t event, uint32_t arg) {
+    trace_entry_t *entry = &G_trace.entries[G_trace.n_events % TRACE_MAX_EVENTS];
+    entry->event = (uint8_t) event;
+    entry->tick = G_ticks;
+    entry->arg = arg;
+    ++G_trace.n_events;
+}
+
+int trace_serialize(uint8_t *out, size_t out_len) {
+    if (out_len < TRACE_MAX_SERIALIZED_LENGTH) {
+        return -1;
+    }
+
+    uint32_t n_kept = G_trace.n_events < TRACE_MAX_EVENTS ? G_trace.n_events : TRACE_MAX_EVENTS;
+    uint32_t first = G_trace.n_events - n_kept;
+
+    size_t pos = 0;
+    write_u32_be(out, pos, first);
+    pos += 4;
+    out[pos++] = (uint8_t) n_kept;
+    for (uint32_t i = first; i < G_trace.n_events; i++) {
+        const trace_entry_t *entry = &G_trace.entries[i % TRACE_MAX_EVENTS];
+        out[pos++] = entry->event;
+        write_u16_be(out, pos, entry->tick);
+        write_u32_be(out, pos + 2, entry->arg);
+        pos += 6;
+    }
+
+    return (int) pos;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Binary trace of the last command, only available in perf builds (HAVE_PERF_STATS). Instead of
+ * formatting strings, the hot paths record compact events (an event id, the current G_ticks and one
+ * 32-bit argument) in a ring buffer in RAM, which costs a few instructions; the buffer is read
+ * afterwards with the INS_GET_TRACE framework APDU. Once the buffer is full, the oldest events are
+ * overwritten.
+ *
+ * The ring buffer is cleared at the beginning of each command, together with the perf counters.
+ */
+
+/**
+ * Number of events kept in the ring buffer.
+ */
+#define TRACE_MAX_EVENTS 32
+
+/**
+ * Ids of the traced events, and the meaning of their argument.
+ */
+typedef enum {
+    TRACE_EV_PHASE = 1,      // a phase of the command starts; arg: the perf_phase_t
+    TRACE_EV_INTERRUPTION,   // the app answered a client command; arg: ccmd << 16 | bytes received
+    TRACE_EV_INPUT,          // processing of an input of a transaction starts; arg: its index
+    TRACE_EV_OUTPUT,         // processing of an output of a transaction starts; arg: its index
+    TRACE_EV_SIGN_INPUT,     // signing of an input starts; arg: its index
+    TRACE_EV_ERROR,          // a command fails; arg: the status word
+} trace_event_t;
+
+/**
+ * Maximum length of the serialization of the ring buffer.
+ */
+#define TRACE_MAX_SERIALIZED_LENGTH (4 + 1 + 7 * TRACE_MAX_EVENTS)
+
+#ifdef HAVE_PERF_STATS
+
+/**
+ * Clears the ring buffer. Called by the dispatcher before running the handler of a command.
+ */
+void trace_reset(void);
+
+/**
+ * Records an event in the ring buffer.
+ *
+ * @param[in] event
+ *   The id of the event.
+ * @param[in] arg
+ *   The argument of the event.
+ */
+void trace_event(trace_event_t event, uint32_t arg);
+
+/**
+ * Serializes the events in the ring buffer, from the oldest to the most recent. All the integers
+ * are big-endian:
+ * <n_dropped : 4> <n_events : 1> n_events times: <event : 1> <tick : 2> <arg : 4>
+ * where n_dropped is the number of older events that were overwritten.
+ *
+ * @param[out] out
+ *   Pointer to the output buffer.
+ * @param[in] out_len
+ *   Length of the output buffer; it must be at least TRACE_MAX_SERIALIZED_LENGTH.
+ *
+ * @return the length of the serialization, or -1 if the buffer is too short.
+ */
+int trace_serialize(uint8_t *out, size_t out_len);
+
+#define TRACE(event, arg) trace_event(event, arg)
+
+#else
+
+#define TRACE(event, arg)
+
+#endif
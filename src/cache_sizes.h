@@ -0,0 +1,20 @@
+#pragma once
+
+/**
+ * Sizing of the caches for each target.
+ *
+ * Each cache header defines its number of entries as CACHE_SIZE_FOR_TARGET(base, large), next to
+ * the RAM taken by each entry. The Nano X has the least RAM available to the app, and uses the base
+ * sizes; the Nano S+, Stax and Flex have more, and use the large sizes, that take about 8 KB more
+ * in total.
+ *
+ * Each size can also be overridden at build time, for example with
+ *     DEFINES += RAWTX_CACHE_SIZE=4
+ * in the Makefile.
+ */
+
+#if defined(TARGET_NANOS2) || defined(TARGET_STAX) || defined(TARGET_FLEX)
+#define CACHE_SIZE_FOR_TARGET(base, large) (large)
+#else
+#define CACHE_SIZE_FOR_TARGET(base, large) (base)
+#endif
@@ -9,7 +9,9 @@ typedef enum {
     GET_WALLET_ADDRESS = 0x03,
     SIGN_PSBT = 0x04,
     GET_MASTER_FINGERPRINT = 0x05,
+    GET_APP_CAPABILITIES = 0x06,
     SIGN_MESSAGE = 0x10,
     WITHDRAW = 0x11,
     SIGN_ERC4361_MESSAGE = 0x12,
+    BENCHMARK_CRYPTO = 0xF0,  // only in perf builds (HAVE_PERF_STATS)
 } command_e;
@@ -16,7 +16,7 @@
 
 #include <stddef.h>   // size_t
 #include <stdint.h>   // uint*_t
-#include <string.h>   // memmove, memset
+#include <string.h>   // memset
 #include <stdbool.h>  // bool
 
 #include "base58.h"
@@ -42,78 +42,85 @@ char const BASE58_ALPHABET[] = {
     'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z'             //
 };
 
-int base58_decode(const char *in, size_t in_len, uint8_t *out, size_t out_len) {
-    uint8_t tmp[MAX_DEC_INPUT_SIZE] = {0};
-    uint8_t buffer[MAX_DEC_INPUT_SIZE] = {0};
+// 58^5 is the largest power of 58 that fits in 32 bits: the big numbers are stored as arrays of
+// 32-bit limbs, in little-endian order, and 5 base58 digits are processed at each step.
+#define BASE58_DIGITS_PER_LIMB 5
+#define BASE58_LIMB_BASE       656356768U  // 58^5
+
+#define MAX_DEC_LIMBS ((MAX_DEC_INPUT_SIZE + 3) / 4)
+#define MAX_ENC_LIMBS ((MAX_ENC_INPUT_SIZE + 3) / 4)
 
-    memset(tmp, 0, MAX_DEC_INPUT_SIZE);
-    memset(buffer, 0, MAX_DEC_INPUT_SIZE);
+// Returns the i-th least significant byte of the number represented by limbs.
+static inline uint8_t limbs_get_byte(const uint32_t *limbs, size_t i) {
+    return (uint8_t) (limbs[i / 4] >> (8 * (i % 4)));
+}
 
-    uint8_t j;
-    uint8_t start_at;
-    uint8_t zero_count = 0;
+int base58_decode(const char *in, size_t in_len, uint8_t *out, size_t out_len) {
+    uint32_t limbs[MAX_DEC_LIMBS] = {0};
+    size_t n_limbs = 0;
+    size_t zero_count = 0;
 
     if (in_len > MAX_DEC_INPUT_SIZE || in_len < 2) {
         return -1;
     }
 
-    memmove(tmp, in, in_len);
-
-    for (uint8_t i = 0; i < in_len; i++) {
-        if (in[i] >= sizeof(BASE58_TABLE)) {
-            return -1;
-        }
-
-        tmp[i] = BASE58_TABLE[(int) in[i]];
-
-        if (tmp[i] == 0xFF) {
+    for (size_t i = 0; i < in_len; i++) {
+        uint8_t c = (uint8_t) in[i];
+        if (c >= sizeof(BASE58_TABLE) || BASE58_TABLE[c] == 0xFF) {
             return -1;
         }
     }
 
-    while ((zero_count < in_len) && (tmp[zero_count] == 0)) {
+    while ((zero_count < in_len) && (in[zero_count] == BASE58_ALPHABET[0])) {
         ++zero_count;
     }
 
-    j = in_len;
-    start_at = zero_count;
-    while (start_at < in_len) {
-        uint16_t remainder = 0;
-        for (uint8_t div_loop = start_at; div_loop < in_len; div_loop++) {
-            uint16_t digit256 = (uint16_t) (tmp[div_loop] & 0xFF);
-            uint16_t tmp_div = remainder * 58 + digit256;
-            tmp[div_loop] = (uint8_t) (tmp_div / 256);
-            remainder = tmp_div % 256;
+    // multiply by 58^k and add the value of the next k digits, for k up to BASE58_DIGITS_PER_LIMB
+    size_t i = zero_count;
+    while (i < in_len) {
+        uint32_t multiplier = 1;
+        uint32_t group = 0;
+        for (size_t k = 0; k < BASE58_DIGITS_PER_LIMB && i < in_len; k++, i++) {
+            group = group * 58 + BASE58_TABLE[(uint8_t) in[i]];
+            multiplier *= 58;
         }
 
-        if (tmp[start_at] == 0) {
-            ++start_at;
+        uint64_t carry = group;
+        for (size_t k = 0; k < n_limbs; k++) {
+            carry += (uint64_t) limbs[k] * multiplier;
+            limbs[k] = (uint32_t) carry;
+            carry >>= 32;
+        }
+        if (carry != 0) {
+            limbs[n_limbs++] = (uint32_t) carry;
         }
-
-        buffer[--j] = (uint8_t) remainder;
     }
 
-    while ((j < in_len) && (buffer[j] == 0)) {
-        ++j;
+    size_t n_bytes = 4 * n_limbs;
+    while (n_bytes > 0 && limbs_get_byte(limbs, n_bytes - 1) == 0) {
+        --n_bytes;
     }
 
-    int length = in_len - (j - zero_count);
+    size_t length = zero_count + n_bytes;
 
-    if ((int) out_len < length) {
+    if (out_len < length) {
         return -1;
     }
 
-    memmove(out, buffer + j - zero_count, length);
+    memset(out, 0, zero_count);
+    for (size_t k = 0; k < n_bytes; k++) {
+        out[length - 1 - k] = limbs_get_byte(limbs, k);
+    }
 
-    return length;
+    return (int) length;
 }
 
 int base58_encode(const uint8_t *in, size_t in_len, char *out, size_t out_len) {
-    uint8_t buffer[MAX_ENC_INPUT_SIZE * 138 / 100 + 1] = {0};
-    size_t i, j;
-    size_t stop_at;
+    uint32_t limbs[MAX_ENC_LIMBS] = {0};
+    // base58 digits, least significant first
+    uint8_t digits[MAX_ENC_INPUT_SIZE * 138 / 100 + BASE58_DIGITS_PER_LIMB];
+    size_t n_digits = 0;
     size_t zero_count = 0;
-    size_t output_size;
 
     if (in_len > MAX_ENC_INPUT_SIZE) {
         return -1;
@@ -123,37 +130,45 @@ int base58_encode(const uint8_t *in, size_t in_len, char *out, size_t out_len) {
         ++zero_count;
     }
 
-    output_size = (in_len - zero_count) * 138 / 100 + 1;
-    stop_at = output_size - 1;
-    for (size_t start_at = zero_count; start_at < in_len; start_at++) {
-        unsigned int carry = in[start_at];
-        for (j = output_size - 1; (int) j >= 0; j--) {
-            carry += 256 * buffer[j];
-            buffer[j] = carry % 58;
-            carry /= 58;
-
-            if (j <= stop_at - 1 && carry == 0) {
-                break;
-            }
+    size_t n_bytes = in_len - zero_count;
+    for (size_t k = 0; k < n_bytes; k++) {
+        limbs[k / 4] |= (uint32_t) in[in_len - 1 - k] << (8 * (k % 4));
+    }
+    size_t n_limbs = (n_bytes + 3) / 4;
+
+    // divide by 58^5, and expand the remainder into BASE58_DIGITS_PER_LIMB digits
+    while (n_limbs > 0) {
+        uint64_t remainder = 0;
+        for (size_t k = n_limbs; k-- > 0;) {
+            remainder = (remainder << 32) | limbs[k];
+            limbs[k] = (uint32_t) (remainder / BASE58_LIMB_BASE);
+            remainder %= BASE58_LIMB_BASE;
+        }
+
+        while (n_limbs > 0 && limbs[n_limbs - 1] == 0) {
+            --n_limbs;
+        }
+
+        uint32_t group = (uint32_t) remainder;
+        for (size_t k = 0; k < BASE58_DIGITS_PER_LIMB; k++) {
+            digits[n_digits++] = group % 58;
+            group /= 58;
         }
-        stop_at = j;
     }
 
-    j = 0;
-    while (j < output_size && buffer[j] == 0) {
-        j += 1;
+    while (n_digits > 0 && digits[n_digits - 1] == 0) {
+        --n_digits;
     }
 
-    if (out_len < zero_count + output_size - j) {
+    if (out_len < zero_count + n_digits) {
         return -1;
     }
 
     memset(out, BASE58_ALPHABET[0], zero_count);
 
-    i = zero_count;
-    while (j < output_size) {
-        out[i++] = BASE58_ALPHABET[buffer[j++]];
+    for (size_t k = 0; k < n_digits; k++) {
+        out[zero_count + k] = BASE58_ALPHABET[digits[n_digits - 1 - k]];
     }
 
-    return i;
+    return (int) (zero_count + n_digits);
 }
@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 /**
  * Returns the size in bytes of a bitvector that can contain n bits.
@@ -40,4 +41,97 @@ static inline void bitvector_set(uint8_t *vec, unsigned int i, bool value) {
     } else {
         vec[byte_pos] &= ~mask;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Returns the 32 bits of the `w`-th word of a vector of `n` bits, that is the bits in positions from
+ * 32 * w to 32 * w + 31, with the first one in the most significant bit. The bits in positions `n`
+ * or higher are 0, and the bytes after the end of the vector are not read.
+ *
+ * @param vec pointer to the bitvector
+ * @param n number of bits in the bitvector
+ * @param w index of the word
+ * @return the `w`-th word of the bitvector
+ */
+static inline uint32_t bitvector_get_word(const uint8_t *vec, unsigned int n, unsigned int w) {
+    uint32_t word = 0;
+    for (unsigned int k = 0; k < 4; k++) {
+        unsigned int byte_pos = 4 * w + k;
+        word <<= 8;
+        if (byte_pos < BITVECTOR_REAL_SIZE(n)) {
+            word |= vec[byte_pos];
+        }
+    }
+    if (n - 32 * w < 32) {
+        word &= ~(0xFFFFFFFFu >> (n - 32 * w));  // only keep the bits before position n
+    }
+    return word;
+}
+
+/**
+ * Returns the number of bits equal to 1 in a vector of `n` bits.
+ *
+ * @param vec pointer to the bitvector
+ * @param n number of bits in the bitvector
+ * @return the number of bits equal to 1
+ */
+static inline unsigned int bitvector_count(const uint8_t *vec, unsigned int n) {
+    unsigned int count = 0;
+    for (unsigned int w = 0; 32 * w < n; w++) {
+        count += __builtin_popcount(bitvector_get_word(vec, n, w));
+    }
+    return count;
+}
+
+/**
+ * Returns the position of the first bit equal to 1 in a vector of `n` bits, starting from position
+ * `from`; words with no bit set are skipped at once. This allows iterating over the bits set:
+ *   for (i = bitvector_find_next_set(vec, n, 0); i < n; i = bitvector_find_next_set(vec, n, i + 1))
+ *
+ * @param vec pointer to the bitvector
+ * @param n number of bits in the bitvector
+ * @param from position of the first bit to consider
+ * @return the position of the first bit set in position `from` or higher, or `n` if there is none
+ */
+static inline unsigned int bitvector_find_next_set(const uint8_t *vec,
+                                                   unsigned int n,
+                                                   unsigned int from) {
+    for (unsigned int w = from / 32; 32 * w < n; w++) {
+        uint32_t word = bitvector_get_word(vec, n, w);
+        if (w == from / 32) {
+            word &= 0xFFFFFFFFu >> (from % 32);  // ignore the bits before position from
+        }
+        if (word != 0) {
+            return 32 * w + __builtin_clz(word);
+        }
+    }
+    return n;
+}
+
+/**
+ * Sets all the elements of the vector of bits in positions from `begin` to `end - 1` to `value`.
+ * There is no bounds checking, hence the caller is responsible for avoiding overflows.
+ *
+ * @param vec pointer to the bitvector
+ * @param begin position of the first bit to set
+ * @param end position after the last bit to set
+ * @param value
+ */
+static inline void bitvector_set_range(uint8_t *vec,
+                                       unsigned int begin,
+                                       unsigned int end,
+                                       bool value) {
+    // the bits before the first whole byte
+    while (begin < end && begin % 8 != 0) {
+        bitvector_set(vec, begin++, value);
+    }
+    // the whole bytes
+    if (end - begin >= 8) {
+        memset(&vec[begin / 8], value ? 0xFF : 0x00, (end - begin) / 8);
+        begin += 8 * ((end - begin) / 8);
+    }
+    // the bits after the last whole byte
+    while (begin < end) {
+        bitvector_set(vec, begin++, value);
+    }
+}
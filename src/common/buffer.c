@@ -237,6 +237,17 @@ bool buffer_write_bytes(buffer_t *buffer, const uint8_t *data, size_t n) {
     return true;
 }
 
+bool buffer_write_varint(buffer_t *buffer, uint64_t value) {
+    size_t length = varint_size(value);
+    if (!buffer_can_read(buffer, length)) {
+        return false;
+    }
+
+    varint_write(buffer->ptr, buffer->offset, value);
+    buffer_seek_cur(buffer, length);
+    return true;
+}
+
 void *buffer_alloc(buffer_t *buffer, size_t size, bool aligned) {
     size_t padding_size = 0;
 
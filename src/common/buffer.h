@@ -88,6 +88,28 @@ static inline uint8_t *buffer_get_cur(const buffer_t *buffer) {
     return buffer->ptr + buffer->offset;
 }
 
+/**
+ * Returns a pointer to the next `n` bytes of the buffer and advances past them, or NULL if fewer
+ * than `n` bytes are left, in which case the buffer is not advanced. As the bounds are only checked
+ * once, several fields can be read from the returned pointer without further checks, for example
+ * with the functions in read.h, that do not require aligned pointers.
+ *
+ * @param[in,out] buffer
+ *   Pointer to input buffer struct.
+ * @param[in] n
+ *   Number of bytes to read in buffer.
+ *
+ * @return a pointer to the bytes read, or NULL if the buffer does not contain `n` more bytes.
+ */
+static inline const uint8_t *buffer_reserve_read(buffer_t *buffer, size_t n) {
+    if (buffer->size - buffer->offset < n) {
+        return NULL;
+    }
+    const uint8_t *ptr = buffer->ptr + buffer->offset;
+    buffer->offset += n;
+    return ptr;
+}
+
 /**
  * Read 1 byte from buffer into uint8_t.
  *
@@ -295,6 +317,19 @@ bool buffer_write_u64(buffer_t *buffer, uint64_t value, endianness_t endianness)
  */
 bool buffer_write_bytes(buffer_t *buffer, const uint8_t *data, size_t n);
 
+/**
+ * Write a Bitcoin-like varint into the buffer.
+ *
+ * @param[in,out]  buffer
+ *   Pointer to output buffer struct.
+ * @param[in]      value
+ *   Value to be written.
+ *
+ * @return true if success, false if not enough space left in the buffer.
+ *
+ */
+bool buffer_write_varint(buffer_t *buffer, uint64_t value);
+
 /**
  * Creates a buffer pointing at ptr and with the given size; the initial offset is 0.
  *
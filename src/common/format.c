@@ -16,82 +16,107 @@
 
 #include <stddef.h>   // size_t
 #include <stdint.h>   // int*_t, uint*_t
-#include <string.h>   // strncpy, memmove
+#include <string.h>   // memcpy, strncpy, memmove
 #include <stdbool.h>  // bool
 
 #include "format.h"
 
-bool format_i64(char *dst, size_t dst_len, const int64_t value) {
-    char temp[] = "-9223372036854775808";
+// The decimal digits of each number between 0 and 99
+static const char DIGIT_PAIRS[200] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// High 64 bits of the 128-bit product a * b, computed with 32-bit multiplications only
+static uint64_t mul_high_u64(uint64_t a, uint64_t b) {
+    uint64_t a_lo = (uint32_t) a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t) b, b_hi = b >> 32;
+
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t hi_hi = a_hi * b_hi;
+
+    // can not overflow: the sum is at most 2^64 - 1
+    uint64_t cross = (lo_lo >> 32) + (uint32_t) hi_lo + lo_hi;
+    return hi_hi + (hi_lo >> 32) + (cross >> 32);
+}
 
-    char *ptr = temp;
-    int64_t num = value;
-    int sign = 1;
+// Each division by a constant below is a multiplication by its reciprocal, followed by a shift;
+// Cortex-M has no instruction for 64-bit divisions, and some cores none for 32-bit divisions.
 
-    if (value < 0) {
-        sign = -1;
-    }
+static uint64_t div_1e8(uint64_t n) {
+    return mul_high_u64(n, 0xABCC77118461CEFDULL) >> 26;
+}
 
-    while (num != 0) {
-        *ptr++ = '0' + (num % 10) * sign;
-        num /= 10;
-    }
+// Writes the 8 decimal digits of n < 10^8, with leading zeros
+static void write_8_digits(char *out, uint32_t n) {
+    uint32_t hi = (uint32_t) (((uint64_t) n * 0xD1B71759U) >> 45);  // n / 10000
+    uint32_t lo = n - hi * 10000;
 
-    if (value < 0) {
-        *ptr++ = '-';
-    } else if (value == 0) {
-        *ptr++ = '0';
-    }
+    uint32_t hi_hi = (hi * 5243U) >> 19;  // hi / 100, for hi < 10000
+    uint32_t lo_hi = (lo * 5243U) >> 19;  // lo / 100, for lo < 10000
 
-    int distance = (ptr - temp) + 1;
+    memcpy(out, &DIGIT_PAIRS[2 * hi_hi], 2);
+    memcpy(out + 2, &DIGIT_PAIRS[2 * (hi - hi_hi * 100)], 2);
+    memcpy(out + 4, &DIGIT_PAIRS[2 * lo_hi], 2);
+    memcpy(out + 6, &DIGIT_PAIRS[2 * (lo - lo_hi * 100)], 2);
+}
 
-    if ((int) dst_len < distance) {
-        return false;
+bool format_i64(char *dst, size_t dst_len, const int64_t value) {
+    if (value >= 0) {
+        return format_u64(dst, dst_len, (uint64_t) value);
     }
 
-    size_t index = 0;
-
-    while (--ptr >= temp) {
-        dst[index++] = *ptr;
+    if (dst_len < 2) {
+        return false;
     }
-
-    dst[index] = '\0';
-
-    return true;
+    dst[0] = '-';
+    // the magnitude is computed in unsigned arithmetic, as -INT64_MIN does not fit in an int64_t
+    return format_u64(dst + 1, dst_len - 1, (uint64_t) 0 - (uint64_t) value);
 }
 
 bool format_u64(char *out, size_t outLen, uint64_t in) {
-    uint8_t i = 0;
-
-    if (outLen == 0) {
-        return false;
-    }
-    outLen--;
-
-    while (in > 9) {
-        out[i] = in % 10 + '0';
-        in /= 10;
-        i++;
-        if (i + 1 > outLen) {
-            return false;
+    // UINT64_MAX has 20 digits: they are written in up to 3 groups of 8 digits, with leading zeros
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *start;
+
+    if (in < 100000000) {
+        start = end - 8;
+        write_8_digits(start, (uint32_t) in);
+    } else {
+        uint64_t q1 = div_1e8(in);
+        write_8_digits(end - 8, (uint32_t) (in - q1 * 100000000));
+        if (q1 < 100000000) {
+            start = end - 16;
+            write_8_digits(start, (uint32_t) q1);
+        } else {
+            uint64_t q2 = div_1e8(q1);  // q2 < 10^4
+            write_8_digits(end - 16, (uint32_t) (q1 - q2 * 100000000));
+            start = end - 24;
+            write_8_digits(start, (uint32_t) q2);
         }
     }
-    out[i] = in + '0';
-    out[i + 1] = '\0';
 
-    uint8_t j = 0;
-    char tmp;
-
-    // revert the string
-    while (j < i) {
-        // swap out[j] and out[i]
-        tmp = out[j];
-        out[j] = out[i];
-        out[i] = tmp;
+    // at least one digit is kept, for 0
+    while (start < end - 1 && *start == '0') {
+        start++;
+    }
 
-        i--;
-        j++;
+    size_t len = end - start;
+    if (outLen < len + 1) {
+        return false;
     }
+    memcpy(out, start, len);
+    out[len] = '\0';
     return true;
 }
 
@@ -134,24 +159,13 @@ int format_hex(const uint8_t *in, size_t in_len, char *out, size_t out_len) {
         return -1;
     }
 
-    const char hex[] = "0123456789abcdef";
-    size_t i = 0;
-    int written = 0;
+    static const char hex[] = "0123456789abcdef";
 
-    while (i < in_len && (i * 2 + (2 + 1)) <= out_len) {
-        uint8_t high_nibble = (in[i] & 0xF0) >> 4;
-        *out = hex[high_nibble];
-        out++;
-
-        uint8_t low_nibble = in[i] & 0x0F;
-        *out = hex[low_nibble];
-        out++;
-
-        i++;
-        written += 2;
+    for (size_t i = 0; i < in_len; i++) {
+        out[2 * i] = hex[in[i] >> 4];
+        out[2 * i + 1] = hex[in[i] & 0x0F];
     }
+    out[2 * in_len] = '\0';
 
-    *out = '\0';
-
-    return written + 1;
+    return (int) (2 * in_len + 1);
 }
@@ -49,35 +49,193 @@ void merkle_combine_hashes(const uint8_t left[static CX_SHA256_SIZE],
     cx_sha256_hash_iovec(iovec, 3, out);
 }
 
-// TODO: make this O(log n), or possibly O(1). Currently O(log^2 n).
-int merkle_get_ith_direction(size_t size, size_t index, size_t i) {
-    if (size <= 1 || index >= size) {
+int merkle_get_leaf_path(size_t size, size_t index, merkle_leaf_path_t *out) {
+    if (index >= size) {
         return -1;
     }
 
-    uint8_t n_directions = 0;
+    out->directions = 0;
+    out->depth = 0;
     while (size > 1) {
-        uint8_t depth = ceil_lg(size);
+        // number of leaves of the left subtree
+        size_t mask = (size_t) 1 << (ceil_lg(size) - 1);
 
-        // bitmask of the direction from the current node, where 0 = left, 1 = right;
-        // also the number of leaves of the left subtree
-        uint32_t mask = 1 << (depth - 1);
+        if (index >= mask) {
+            out->directions |= (uint32_t) 1 << out->depth;
+            size -= mask;
+            index -= mask;
+        } else {
+            size = mask;
+        }
+        ++out->depth;
+    }
+    return 0;
+}
 
-        uint8_t is_right_child = (index & mask) != 0 ? 1 : 0;
+int merkle_get_ith_direction(size_t size, size_t index, size_t i) {
+    merkle_leaf_path_t path;
+    if (size <= 1 || 0 > merkle_get_leaf_path(size, index, &path) || i >= path.depth) {
+        return -1;
+    }
+    return merkle_path_direction(&path, i);
+}
 
-        if (n_directions == i) {
-            return is_right_child;
-        }
+int merkle_get_leaf_depth(size_t size, size_t index) {
+    if (size == 0 || index >= size) {
+        return -1;
+    }
 
-        ++n_directions;
+    int depth = 0;
+    while (size > 1) {
+        size_t mask = (size_t) 1 << (ceil_lg(size) - 1);
+        if (index >= mask) {
+            size -= mask;
+            index -= mask;
+        } else {
+            size = mask;
+        }
+        ++depth;
+    }
+    return depth;
+}
 
-        if (is_right_child) {
+size_t merkle_get_subtree_start(size_t size, size_t index, size_t depth) {
+    size_t start = 0;
+    for (size_t d = 0; d < depth && size > 1; d++) {
+        size_t mask = (size_t) 1 << (ceil_lg(size) - 1);
+        if (index >= mask) {
+            start += mask;
             size -= mask;
             index -= mask;
         } else {
             size = mask;
         }
     }
+    return start;
+}
+
+// Computes the root of the subtree with the given size, where [begin, end) is the intersection of
+// the requested range with the leaves of the subtree (and begin >= end if they are disjoint).
+static int merkle_compute_subtree_range_root(size_t size,
+                                             size_t begin,
+                                             size_t end,
+                                             merkle_range_hash_source_t next_hash,
+                                             void *state,
+                                             uint8_t out[static CX_SHA256_SIZE]) {
+    if (begin >= end) {
+        // no leaf of this subtree is in the range, the client provides its root
+        return next_hash(state, false, out);
+    }
+
+    if (size == 1) {
+        return next_hash(state, true, out);
+    }
+
+    // number of leaves of the left subtree
+    size_t mask = (size_t) 1 << (ceil_lg(size) - 1);
+
+    if (0 > merkle_compute_subtree_range_root(mask,
+                                              begin,
+                                              MIN(end, mask),
+                                              next_hash,
+                                              state,
+                                              out)) {
+        return -1;
+    }
+
+    uint8_t right_hash[CX_SHA256_SIZE];
+    if (0 > merkle_compute_subtree_range_root(size - mask,
+                                              begin > mask ? begin - mask : 0,
+                                              end > mask ? end - mask : 0,
+                                              next_hash,
+                                              state,
+                                              right_hash)) {
+        return -1;
+    }
+
+    merkle_combine_hashes(out, right_hash, out);
+    return 0;
+}
+
+int merkle_compute_range_root(size_t size,
+                              size_t begin,
+                              size_t end,
+                              merkle_range_hash_source_t next_hash,
+                              void *state,
+                              uint8_t out[static CX_SHA256_SIZE]) {
+    if (begin >= end || end > size || ceil_lg(size) > MAX_MERKLE_TREE_DEPTH) {
+        return -1;
+    }
+
+    return merkle_compute_subtree_range_root(size, begin, end, next_hash, state, out);
+}
+
+// Computes the root of the subtree with the given size whose first leaf has index offset, where
+// indices are the requested leaves in the subtree.
+static int merkle_compute_subtree_leaves_root(size_t size,
+                                              size_t offset,
+                                              const uint32_t *indices,
+                                              size_t n_indices,
+                                              merkle_range_hash_source_t next_hash,
+                                              void *state,
+                                              uint8_t out[static CX_SHA256_SIZE]) {
+    if (n_indices == 0) {
+        // no requested leaf in this subtree, the client provides its root
+        return next_hash(state, false, out);
+    }
+
+    if (size == 1) {
+        return next_hash(state, true, out);
+    }
+
+    // number of leaves of the left subtree
+    size_t mask = (size_t) 1 << (ceil_lg(size) - 1);
+
+    size_t n_left = 0;
+    while (n_left < n_indices && indices[n_left] < offset + mask) {
+        ++n_left;
+    }
+
+    if (0 > merkle_compute_subtree_leaves_root(mask,
+                                               offset,
+                                               indices,
+                                               n_left,
+                                               next_hash,
+                                               state,
+                                               out)) {
+        return -1;
+    }
+
+    uint8_t right_hash[CX_SHA256_SIZE];
+    if (0 > merkle_compute_subtree_leaves_root(size - mask,
+                                               offset + mask,
+                                               indices + n_left,
+                                               n_indices - n_left,
+                                               next_hash,
+                                               state,
+                                               right_hash)) {
+        return -1;
+    }
+
+    merkle_combine_hashes(out, right_hash, out);
+    return 0;
+}
+
+int merkle_compute_leaves_root(size_t size,
+                               const uint32_t *indices,
+                               size_t n_indices,
+                               merkle_range_hash_source_t next_hash,
+                               void *state,
+                               uint8_t out[static CX_SHA256_SIZE]) {
+    if (n_indices == 0 || size == 0 || ceil_lg(size) > MAX_MERKLE_TREE_DEPTH) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < n_indices; i++) {
+        if (indices[i] >= size || (i > 0 && indices[i] <= indices[i - 1])) {
+            return -1;
+        }
+    }
 
-    return -1;
-}
\ No newline at end of file
+    return merkle_compute_subtree_leaves_root(size, 0, indices, n_indices, next_hash, state, out);
+}
@@ -2,6 +2,8 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 // TODO: RFC6962 defines the empty list hash as sha256(b''); while we're using 0 here. Should we
 // change?
@@ -59,19 +61,114 @@ void merkle_combine_hashes(const uint8_t left[static 32],
 
 // inlined to save on stack depth
 static inline uint8_t ceil_lg(uint32_t n) {
-    uint8_t r = 0;
-    uint32_t t = 1;
-    while (t < n) {
-        t = 2 * t;
-        ++r;
-    }
-    return r;
+    return n <= 1 ? 0 : (uint8_t) (32 - __builtin_clz(n - 1));
+}
+
+/**
+ * The path from the root of a Merkle tree to one of its leaves.
+ */
+typedef struct {
+    uint32_t directions;  // bit i is the direction of step i from the root: 0 = left, 1 = right
+    uint8_t depth;        // the number of steps, that is, the length of the Merkle proof
+} merkle_leaf_path_t;
+
+/**
+ * Computes the path to the leaf with the given index in a Merkle tree of the given size, in
+ * O(log n), so that the verification of a Merkle proof does not compute each direction separately.
+ *
+ * The proof hash at position k (starting from the leaf) is the sibling of the node reached after
+ * the step with index (depth - k - 1); it is on the left if that step is to the right.
+ *
+ * @return 0 on success, or -1 if index >= size.
+ */
+int merkle_get_leaf_path(size_t size, size_t index, merkle_leaf_path_t *out);
+
+// Returns the direction of the i-th step of a path, where 0 = left and 1 = right.
+static inline int merkle_path_direction(const merkle_leaf_path_t *path, size_t i) {
+    return (path->directions >> i) & 1;
+}
+
+// Returns the index of the first leaf of the subtree at depth i on a path, given the index of the
+// first leaf of the subtree at depth i + 1 (the index of the leaf, if i + 1 is the depth of the
+// path). Each step to the right skips a left subtree whose size is a smaller power of 2 than the
+// previous ones; hence, the size of the last one skipped is the lowest bit set in start.
+static inline size_t merkle_path_parent_start(const merkle_leaf_path_t *path,
+                                              size_t i,
+                                              size_t start) {
+    return merkle_path_direction(path, i) ? start & (start - 1) : start;
 }
 
 // Returns the ith member of the directions array for the leaf with the given index in a Merkle tree
 // of the given size. Returns -1 on error.
 int merkle_get_ith_direction(size_t size, size_t index, size_t i);
 
+// Returns the depth of the leaf with the given index in a Merkle tree of the given size, that is,
+// the length of its Merkle proof. Returns -1 on error.
+int merkle_get_leaf_depth(size_t size, size_t index);
+
+// Returns the index of the first leaf of the subtree at the given depth that contains the leaf with
+// the given index, in a Merkle tree of the given size. Together with the depth, it identifies the
+// node within the tree. The depth must not be larger than the depth of the leaf.
+size_t merkle_get_subtree_start(size_t size, size_t index, size_t depth);
+
+/**
+ * Callback used by merkle_compute_range_root to obtain the next hash in the traversal.
+ * If is_leaf is true, it must return the leaf hash of the next leaf in the range; otherwise, it must
+ * return the next hash of the range proof, that is, the root of the next subtree that is disjoint
+ * from the range.
+ *
+ * Returns 0 on success, or a negative number on failure.
+ */
+typedef int (*merkle_range_hash_source_t)(void *state, bool is_leaf, uint8_t out[static 32]);
+
+/**
+ * Computes the root of a Merkle tree of the given size from the hashes of the consecutive leaves
+ * with indices in [begin, end), and the roots of the maximal subtrees disjoint from that range.
+ *
+ * The hashes are requested to next_hash in the order they appear in a depth-first, left-to-right
+ * traversal of the tree: first the proof hashes of the subtrees to the left of the range, then the
+ * leaves in the range (in order), and finally the proof hashes of the subtrees to its right.
+ * A range containing all the leaves therefore requires no proof hash, and each internal node is
+ * only hashed once.
+ *
+ * @param[in] size
+ *   The number of leaves in the Merkle tree.
+ * @param[in] begin
+ *   The index of the first leaf in the range.
+ * @param[in] end
+ *   The index of the first leaf after the range; it must be that begin < end <= size.
+ * @param[in] next_hash
+ *   The callback used to obtain the leaf hashes and the proof hashes.
+ * @param[in] state
+ *   Arbitrary state passed to next_hash.
+ * @param[out] out
+ *   Pointer to a 32-bytes buffer to store the computed root.
+ *
+ * @return 0 on success, or a negative number on failure.
+ */
+int merkle_compute_range_root(size_t size,
+                              size_t begin,
+                              size_t end,
+                              merkle_range_hash_source_t next_hash,
+                              void *state,
+                              uint8_t out[static 32]);
+
+/**
+ * Like merkle_compute_range_root, but for the leaves with the given indices, that need not be
+ * consecutive. The indices must be strictly increasing.
+ *
+ * The hashes are requested to next_hash in the same depth-first, left-to-right order: the root of
+ * each maximal subtree that contains none of the leaves, and the leaf hash of each of the leaves.
+ *
+ * @return 0 on success, or a negative number on failure.
+ */
+int merkle_compute_leaves_root(size_t size,
+                               const uint32_t *indices,
+                               size_t n_indices,
+                               merkle_range_hash_source_t next_hash,
+                               void *state,
+                               uint8_t out[static 32]);
+
 /**
  * Represents the Merkleized version of a key-value map, holding the number of elements, the root of
  * the Merkle tree of the sorted list of keys, and the root of the Merkle tree of the values (sorted
@@ -59,6 +59,20 @@ bool dbuffer_read_u32(buffer_t *buffers[2], uint32_t *out, endianness_t endianne
  */
 bool dbuffer_read_varint(buffer_t *buffers[2], uint64_t *out);
 
+/**
+ * Like buffer_reserve_read, for the concatenation of two buffers: returns a pointer to the next `n`
+ * bytes and advances past them if they are all in the same buffer. Otherwise, returns NULL without
+ * advancing; the bytes might still be available, split across the two buffers, and can be copied
+ * with dbuffer_read_bytes.
+ */
+static inline const uint8_t *dbuffer_reserve_read(buffer_t *buffers[2], size_t n) {
+    // the first buffer is exhausted before reading from the second one
+    if (buffers[0]->offset < buffers[0]->size) {
+        return buffer_reserve_read(buffers[0], n);
+    }
+    return buffer_reserve_read(buffers[1], n);
+}
+
 /**
  * TODO: docs.
  */
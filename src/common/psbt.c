@@ -0,0 +1,101 @@
+/*****************************************************************************
+ *   (c) 2024 Ledger SAS.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *****************************************************************************/
+
+#include <stdint.h>  // uint*_t
+
+#include "psbt.h"
+
+// clang-format off
+
+// The hashes of the elements 0x00..0x18, that are the keys of a single byte in the maps: generated
+// with sha256(bytes([0, key_type])), as computed by merkle_compute_element_hash
+const uint8_t psbt_single_byte_key_hashes[PSBT_N_SINGLE_BYTE_KEYS][32] = {
+    {0x96, 0xa2, 0x96, 0xd2, 0x24, 0xf2, 0x85, 0xc6, 0x7b, 0xee, 0x93,
+     0xc3, 0x0f, 0x8a, 0x30, 0x91, 0x57, 0xf0, 0xda, 0xa3, 0x5d, 0xc5,
+     0xb8, 0x7e, 0x41, 0x0b, 0x78, 0x63, 0x0a, 0x09, 0xcf, 0xc7},  // 0x00
+    {0xb4, 0x13, 0xf4, 0x7d, 0x13, 0xee, 0x2f, 0xe6, 0xc8, 0x45, 0xb2,
+     0xee, 0x14, 0x1a, 0xf8, 0x1d, 0xe8, 0x58, 0xdf, 0x4e, 0xc5, 0x49,
+     0xa5, 0x8b, 0x79, 0x70, 0xbb, 0x96, 0x64, 0x5b, 0xc8, 0xd2},  // 0x01
+    {0xfc, 0xf0, 0xa6, 0xc7, 0x00, 0xdd, 0x13, 0xe2, 0x74, 0xb6, 0xfb,
+     0xa8, 0xde, 0xea, 0x8d, 0xd9, 0xb2, 0x6e, 0x4e, 0xed, 0xde, 0x34,
+     0x95, 0x71, 0x7c, 0xac, 0x84, 0x08, 0xc9, 0xc5, 0x17, 0x7f},  // 0x02
+    {0x58, 0x3c, 0x7d, 0xfb, 0x7b, 0x30, 0x55, 0xd9, 0x94, 0x65, 0x54,
+     0x40, 0x32, 0xa5, 0x71, 0xe1, 0x0a, 0x13, 0x4b, 0x1b, 0x6f, 0x76,
+     0x94, 0x22, 0xbb, 0xb7, 0x1f, 0xd7, 0xfa, 0x16, 0x7a, 0x5d},  // 0x03
+    {0x4f, 0x35, 0x21, 0x2d, 0x12, 0xf9, 0xad, 0x20, 0x36, 0x49, 0x2c,
+     0x95, 0xf1, 0xfe, 0x79, 0xba, 0xf4, 0xec, 0x7b, 0xd9, 0xbe, 0xf3,
+     0xdf, 0xfa, 0x75, 0x79, 0xf2, 0x29, 0x3f, 0xf5, 0x46, 0xa4},  // 0x04
+    {0x9f, 0x1a, 0xfa, 0x4d, 0xc1, 0x24, 0xcb, 0xa7, 0x31, 0x34, 0xe8,
+     0x2f, 0xf5, 0x0f, 0x17, 0xc8, 0xf7, 0x16, 0x42, 0x57, 0xc7, 0x9f,
+     0xed, 0x9a, 0x13, 0xf5, 0x94, 0x3a, 0x6a, 0xcb, 0x8e, 0x3d},  // 0x05
+    {0x40, 0xd8, 0x81, 0x27, 0xd4, 0xd3, 0x1a, 0x38, 0x91, 0xf4, 0x15,
+     0x98, 0xee, 0xed, 0x41, 0x17, 0x4e, 0x5b, 0xc8, 0x9b, 0x1e, 0xb9,
+     0xbb, 0xd6, 0x6a, 0x8c, 0xbf, 0xc0, 0x99, 0x56, 0xa3, 0xfd},  // 0x06
+    {0x2e, 0xcd, 0x8a, 0x6b, 0x7d, 0x28, 0x45, 0x54, 0x66, 0x59, 0xad,
+     0x4c, 0xf4, 0x43, 0x53, 0x3c, 0xf9, 0x21, 0xb1, 0x9d, 0xc8, 0x1f,
+     0xa8, 0x39, 0x34, 0xe8, 0x38, 0x21, 0xb4, 0xdf, 0xdc, 0xb7},  // 0x07
+    {0xb4, 0xc4, 0x3b, 0x50, 0xbf, 0x24, 0x5b, 0xd7, 0x27, 0x62, 0x3e,
+     0x3c, 0x77, 0x5a, 0x8f, 0xcf, 0xb8, 0xd8, 0x23, 0xd0, 0x0b, 0x57,
+     0xdd, 0x65, 0xf7, 0xf7, 0x9d, 0xd3, 0x3f, 0x12, 0x63, 0x15},  // 0x08
+    {0xc8, 0x74, 0x79, 0xcd, 0x65, 0x6e, 0x7e, 0x3a, 0xd6, 0xbd, 0x8d,
+     0xb4, 0x02, 0xe8, 0x02, 0x7d, 0xf4, 0x54, 0xb2, 0xb0, 0xc4, 0x2f,
+     0xf2, 0x9e, 0x09, 0x34, 0x58, 0xbe, 0xb9, 0x8a, 0x23, 0xd4},  // 0x09
+    {0x67, 0xeb, 0xbd, 0x37, 0x0d, 0xaa, 0x02, 0xba, 0x9a, 0xad, 0xd0,
+     0x5d, 0x8e, 0x09, 0x1e, 0x86, 0x2d, 0x0d, 0x8b, 0xca, 0xda, 0xfd,
+     0xf2, 0xa2, 0x23, 0x60, 0x24, 0x0a, 0x42, 0xfe, 0x92, 0x2e},  // 0x0a
+    {0xf0, 0x9a, 0x7a, 0x12, 0x95, 0x41, 0x69, 0xae, 0x59, 0x5d, 0x12,
+     0xd8, 0x70, 0xe6, 0x9a, 0x4c, 0x00, 0x92, 0x00, 0x31, 0x57, 0xd7,
+     0x25, 0x23, 0xd6, 0x26, 0xd2, 0xa3, 0x99, 0x02, 0x41, 0xe2},  // 0x0b
+    {0xfe, 0x25, 0x1e, 0x4d, 0xd0, 0x34, 0xdc, 0xf5, 0x89, 0xc8, 0x47,
+     0x94, 0x12, 0x0c, 0x85, 0xd6, 0x01, 0x5d, 0x65, 0xca, 0x7d, 0x9a,
+     0x2c, 0x2e, 0xc7, 0x3c, 0x9e, 0xcb, 0x5e, 0x33, 0xd8, 0x3b},  // 0x0c
+    {0xa1, 0xf3, 0x86, 0xa0, 0xec, 0xb0, 0x61, 0xb3, 0xc4, 0x6a, 0x03,
+     0x86, 0x16, 0x21, 0x27, 0x79, 0x85, 0x8b, 0xa7, 0x25, 0x8b, 0x2e,
+     0xcc, 0xb8, 0x18, 0xa6, 0x49, 0x86, 0xc9, 0x72, 0x82, 0xda},  // 0x0d
+    {0x9f, 0x49, 0x17, 0x38, 0x6c, 0x45, 0xe2, 0xc0, 0xda, 0x0d, 0x9b,
+     0x47, 0x5f, 0x1a, 0x19, 0xcf, 0x2d, 0xb1, 0xe9, 0x29, 0x19, 0x5c,
+     0x6a, 0x9f, 0x49, 0x66, 0xca, 0x0d, 0x21, 0x05, 0xb1, 0x96},  // 0x0e
+    {0x3b, 0x2b, 0x7c, 0x6e, 0xe2, 0x5e, 0x2f, 0x28, 0xa6, 0x23, 0x5e,
+     0x27, 0x3e, 0xaf, 0x13, 0xf5, 0x04, 0xbd, 0x44, 0x50, 0x24, 0x14,
+     0x7e, 0xba, 0xcb, 0x87, 0x82, 0x62, 0xaa, 0xe9, 0x05, 0x09},  // 0x0f
+    {0x02, 0x98, 0xd1, 0x22, 0x90, 0x6d, 0xcf, 0xc1, 0x08, 0x92, 0xcb,
+     0x53, 0xa7, 0x39, 0x92, 0xfc, 0x5b, 0x9f, 0x49, 0x3e, 0xa4, 0xc9,
+     0xba, 0xdb, 0x27, 0xb7, 0x91, 0xb4, 0x12, 0x7a, 0x7f, 0xe7},  // 0x10
+    {0x2e, 0xd3, 0x48, 0x34, 0x3a, 0xd2, 0xd9, 0x3b, 0xbb, 0xfc, 0x73,
+     0x16, 0xcd, 0xe4, 0x5c, 0x69, 0x3a, 0x36, 0xa3, 0xd4, 0xfd, 0xe8,
+     0xb3, 0x9b, 0x14, 0x49, 0x06, 0x7b, 0x16, 0x03, 0xb9, 0x0d},  // 0x11
+    {0xc4, 0x93, 0xf6, 0xf1, 0x46, 0x68, 0x5f, 0x76, 0xb4, 0x4f, 0x0c,
+     0x77, 0xca, 0x88, 0x12, 0x0c, 0xb8, 0xbc, 0x89, 0xf5, 0x34, 0xfe,
+     0x69, 0xb6, 0x82, 0x88, 0x27, 0xb9, 0x74, 0xe6, 0x88, 0x49},  // 0x12
+    {0xd8, 0x77, 0xa5, 0x67, 0x4d, 0x89, 0x3e, 0xfd, 0x84, 0x62, 0x08,
+     0xdb, 0xd8, 0x0d, 0xb1, 0x6f, 0xca, 0x06, 0x5c, 0x90, 0x74, 0x05,
+     0x98, 0x6f, 0x23, 0x3d, 0x76, 0xc3, 0xfd, 0xb9, 0x36, 0xa2},  // 0x13
+    {0xf4, 0x31, 0xa7, 0xf4, 0x78, 0x62, 0xc0, 0x5a, 0x44, 0xc4, 0x0e,
+     0xf1, 0xf4, 0x47, 0xd2, 0x07, 0xba, 0x15, 0xd3, 0x39, 0xce, 0xf1,
+     0xfb, 0x93, 0x57, 0x56, 0x49, 0x74, 0x13, 0x7c, 0x16, 0x73},  // 0x14
+    {0xcc, 0x08, 0xd3, 0x88, 0x27, 0x26, 0x10, 0x2f, 0xb4, 0xe6, 0x67,
+     0x05, 0x44, 0x2b, 0x98, 0x7e, 0xba, 0xec, 0xa2, 0xea, 0x8d, 0x9d,
+     0xea, 0x10, 0x12, 0x29, 0xcd, 0x1d, 0xff, 0x30, 0x2b, 0x06},  // 0x15
+    {0x06, 0xb6, 0xb4, 0x09, 0x5e, 0x02, 0x38, 0x05, 0xa3, 0xcd, 0x41,
+     0x87, 0x9f, 0x15, 0xba, 0x5a, 0xb2, 0xf2, 0xe3, 0x3a, 0x6f, 0x53,
+     0xd9, 0x16, 0x90, 0x44, 0x96, 0x06, 0x2f, 0x32, 0x49, 0x95},  // 0x16
+    {0x67, 0xa8, 0x8a, 0x2d, 0xc9, 0xa9, 0x74, 0x9e, 0xc6, 0x11, 0xee,
+     0xf8, 0xf4, 0x7e, 0xf5, 0xff, 0xcc, 0x33, 0x5f, 0x29, 0x50, 0xd1,
+     0xbf, 0xaa, 0xf3, 0x11, 0x69, 0xed, 0x01, 0x90, 0x40, 0x12},  // 0x17
+    {0xb5, 0x60, 0x93, 0x76, 0xc8, 0x7f, 0x00, 0xc6, 0x45, 0x43, 0x3e,
+     0x48, 0x64, 0x8c, 0xb0, 0x2e, 0x6a, 0x3f, 0x83, 0x46, 0x7f, 0x2c,
+     0x82, 0x71, 0x94, 0xde, 0x5d, 0x58, 0xf9, 0x71, 0xc8, 0xf0},  // 0x18
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 // clang-format off
 
 enum PsbtGlobalType {
@@ -54,4 +56,24 @@ enum PsbtOutputType {
 	PSBT_OUT_TAP_TREE             = 0x06,
 	PSBT_OUT_TAP_BIP32_DERIVATION = 0x07,
 	PSBT_OUT_PROPRIETARY          = 0xFC
-};
\ No newline at end of file
+};
+
+// clang-format on
+
+/**
+ * Number of entries of psbt_single_byte_key_hashes: all the key types up to PSBT_IN_TAP_MERKLE_ROOT.
+ */
+#define PSBT_N_SINGLE_BYTE_KEYS 0x19
+
+/**
+ * The Merkle leaf hashes of the keys that are a single key type byte without key data, as computed
+ * by merkle_compute_element_hash, precomputed so that the lookups of the fixed fields of the maps
+ * do not hash the key. Use it with PSBT_KEY_HASH.
+ */
+extern const uint8_t psbt_single_byte_key_hashes[PSBT_N_SINGLE_BYTE_KEYS][32];
+
+/**
+ * The Merkle leaf hash of the key made of the single byte key_type, that must be a constant lower
+ * than PSBT_N_SINGLE_BYTE_KEYS.
+ */
+#define PSBT_KEY_HASH(key_type) (psbt_single_byte_key_hashes[(key_type)])
@@ -3,11 +3,13 @@
 #include <string.h>
 #include <limits.h>
 
+#include "../common/base58.h"
 #include "../common/bip32.h"
 #include "../common/buffer.h"
 #include "../common/read.h"
 #include "../common/script.h"
 #include "../common/segwit_addr.h"
+#include "../common/write.h"
 
 #ifndef SKIP_FOR_CMOCKA
 #include "../crypto.h"
@@ -28,27 +30,40 @@ size_t get_push_script_size(uint32_t n) {
         return 6;  // 05 nnnnnnnnnn
 }
 
-int get_script_type(const uint8_t script[], size_t script_len) {
-    if (script_len == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 0x14 &&
-        script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) {
-        return SCRIPT_TYPE_P2PKH;
-    }
-
-    if (script_len == 23 && script[0] == OP_HASH160 && script[1] == 0x14 &&
-        script[22] == OP_EQUAL) {
-        return SCRIPT_TYPE_P2SH;
-    }
-
-    if (script_len == 22 && script[0] == 0x00 && script[1] == 0x14) {
-        return SCRIPT_TYPE_P2WPKH;
-    }
-
-    if (script_len == 34 && script[0] == OP_0 && script[1] == 0x20) {
-        return SCRIPT_TYPE_P2WSH;
-    }
-
-    if (script_len == 34 && script[0] == OP_1 && script[1] == 0x20) {
-        return SCRIPT_TYPE_P2TR;
+int get_script_info(const uint8_t script[], size_t script_len, script_info_t *info) {
+    // the standard templates have distinct lengths, therefore only one of them is checked
+    switch (script_len) {
+        case 25:
+            if (script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 0x14 &&
+                script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) {
+                *info = (script_info_t){SCRIPT_TYPE_P2PKH, 3, 20};
+                return SCRIPT_TYPE_P2PKH;
+            }
+            break;
+        case 23:
+            if (script[0] == OP_HASH160 && script[1] == 0x14 && script[22] == OP_EQUAL) {
+                *info = (script_info_t){SCRIPT_TYPE_P2SH, 2, 20};
+                return SCRIPT_TYPE_P2SH;
+            }
+            break;
+        case 22:
+            if (script[0] == OP_0 && script[1] == 0x14) {
+                *info = (script_info_t){SCRIPT_TYPE_P2WPKH, 2, 20};
+                return SCRIPT_TYPE_P2WPKH;
+            }
+            break;
+        case 34:
+            if (script[0] == OP_0 && script[1] == 0x20) {
+                *info = (script_info_t){SCRIPT_TYPE_P2WSH, 2, 32};
+                return SCRIPT_TYPE_P2WSH;
+            }
+            if (script[0] == OP_1 && script[1] == 0x20) {
+                *info = (script_info_t){SCRIPT_TYPE_P2TR, 2, 32};
+                return SCRIPT_TYPE_P2TR;
+            }
+            break;
+        default:
+            break;
     }
 
     // match if it is a potentially valid future segwit scriptPubKey as per BIP-0141
@@ -56,26 +71,40 @@ int get_script_type(const uint8_t script[], size_t script_len) {
         (script[0] == 0 || (script[0] >= OP_1 && script[0] <= OP_16))) {
         uint8_t push_len = script[1];
         if (script_len == 1 + 1 + push_len) {
+            *info = (script_info_t){SCRIPT_TYPE_UNKNOWN_SEGWIT, 2, push_len};
             return SCRIPT_TYPE_UNKNOWN_SEGWIT;
         }
     }
 
-    // unknown/invalid, or doesn't have an address
+    if (is_opreturn(script, script_len)) {
+        *info = (script_info_t){SCRIPT_TYPE_OPRETURN, 1, (uint8_t) (script_len - 1)};
+        return SCRIPT_TYPE_OPRETURN;
+    }
+
+    // unknown/invalid
     return -1;
 }
 
+int get_script_type(const uint8_t script[], size_t script_len) {
+    script_info_t info;
+    int script_type = get_script_info(script, script_len, &info);
+
+    // OP_RETURN scripts don't have an address
+    return script_type == SCRIPT_TYPE_OPRETURN ? -1 : script_type;
+}
+
 #ifndef SKIP_FOR_CMOCKA
 
-// TODO: add unit tests
-int get_script_address(const uint8_t script[], size_t script_len, char *out, size_t out_len) {
-    int script_type = get_script_type(script, script_len);
+int get_script_address_from_info(const uint8_t script[],
+                                 const script_info_t *info,
+                                 char *out,
+                                 size_t out_len) {
     int addr_len;
-    switch (script_type) {
+    switch (info->type) {
         case SCRIPT_TYPE_P2PKH:
         case SCRIPT_TYPE_P2SH: {
-            int offset = (script_type == SCRIPT_TYPE_P2PKH) ? 3 : 2;
-            int ver = (script_type == SCRIPT_TYPE_P2PKH) ? COIN_P2PKH_VERSION : COIN_P2SH_VERSION;
-            addr_len = base58_encode_address(script + offset, ver, out, out_len - 1);
+            int ver = (info->type == SCRIPT_TYPE_P2PKH) ? COIN_P2PKH_VERSION : COIN_P2SH_VERSION;
+            addr_len = base58_encode_address(script + info->payload_offset, ver, out, out_len - 1);
             if (addr_len < 0) {
                 return -1;
             }
@@ -85,8 +114,6 @@ int get_script_address(const uint8_t script[], size_t script_len, char *out, siz
         case SCRIPT_TYPE_P2WSH:
         case SCRIPT_TYPE_P2TR:
         case SCRIPT_TYPE_UNKNOWN_SEGWIT: {
-            uint8_t prog_len = script[1];  // length of the witness program
-
             // witness program version
             int version = (script[0] == 0 ? 0 : script[0] - 80);
 
@@ -95,8 +122,11 @@ int get_script_address(const uint8_t script[], size_t script_len, char *out, siz
                 return -1;
             }
 
-            int ret =
-                segwit_addr_encode(out, COIN_NATIVE_SEGWIT_PREFIX, version, script + 2, prog_len);
+            int ret = segwit_addr_encode(out,
+                                         COIN_NATIVE_SEGWIT_PREFIX,
+                                         version,
+                                         script + info->payload_offset,
+                                         info->payload_len);
 
             if (ret != 1) {
                 return -1;  // should never happen
@@ -114,6 +144,80 @@ int get_script_address(const uint8_t script[], size_t script_len, char *out, siz
     return addr_len;
 }
 
+int get_script_address(const uint8_t script[], size_t script_len, char *out, size_t out_len) {
+    script_info_t info;
+    if (get_script_info(script, script_len, &info) < 0) {
+        return -1;
+    }
+    return get_script_address_from_info(script, &info, out, out_len);
+}
+
+// Writes the version prefix of a base58check address as base58_encode_address does; returns its
+// length
+static size_t write_base58_version(uint32_t version, uint8_t out[static 4]) {
+    if (version < 256) {
+        out[0] = (uint8_t) version;
+        return 1;
+    } else if (version < 65536) {
+        write_u16_be(out, 0, (uint16_t) version);
+        return 2;
+    } else {
+        write_u32_be(out, 0, version);
+        return 4;
+    }
+}
+
+int get_address_script(const char *address, uint8_t out[static MAX_ADDRESS_SCRIPT_LEN]) {
+    int version;
+    uint8_t program[40];
+    size_t program_len;
+    if (segwit_addr_decode(&version, program, &program_len, COIN_NATIVE_SEGWIT_PREFIX, address)) {
+        out[0] = version == 0 ? OP_0 : (uint8_t) (OP_1 + version - 1);
+        out[1] = (uint8_t) program_len;
+        memcpy(out + 2, program, program_len);
+        return (int) (2 + program_len);
+    }
+
+    uint8_t decoded[4 + 20 + 4];  // version + hash + checksum
+    int decoded_len = base58_decode(address, strlen(address), decoded, sizeof(decoded));
+    if (decoded_len < 0) {
+        return -1;
+    }
+
+    const uint32_t versions[] = {COIN_P2PKH_VERSION, COIN_P2SH_VERSION};
+    for (size_t i = 0; i < sizeof(versions) / sizeof(versions[0]); i++) {
+        uint8_t prefix[4];
+        size_t prefix_len = write_base58_version(versions[i], prefix);
+        if ((size_t) decoded_len != prefix_len + 20 + 4 || memcmp(decoded, prefix, prefix_len)) {
+            continue;
+        }
+
+        uint8_t checksum[4];
+        crypto_get_checksum(decoded, prefix_len + 20, checksum);
+        if (memcmp(checksum, decoded + prefix_len + 20, 4) != 0) {
+            return -1;
+        }
+
+        const uint8_t *hash = decoded + prefix_len;
+        if (i == 0) {
+            out[0] = OP_DUP;
+            out[1] = OP_HASH160;
+            out[2] = 0x14;
+            memcpy(out + 3, hash, 20);
+            out[23] = OP_EQUALVERIFY;
+            out[24] = OP_CHECKSIG;
+            return 25;
+        } else {
+            out[0] = OP_HASH160;
+            out[1] = 0x14;
+            memcpy(out + 2, hash, 20);
+            out[22] = OP_EQUAL;
+            return 23;
+        }
+    }
+    return -1;
+}
+
 #endif
 
 int format_opscript_script(const uint8_t script[],
@@ -225,18 +329,16 @@ int format_opscript_script(const uint8_t script[],
 bool format_script(const uint8_t script[],
                    size_t script_len,
                    char out[static MAX_OUTPUT_SCRIPT_DESC_SIZE]) {
-    int address_len = get_script_address(script, script_len, out, MAX_OUTPUT_SCRIPT_DESC_SIZE);
-    if (address_len < 0) {
-        // script does not have an address; check if OP_RETURN
-        if (is_opreturn(script, script_len)) {
-            if (0 > format_opscript_script(script, script_len, out)) {
-                return false;
-            }
-        } else {
-            return false;
-        }
+    script_info_t info;
+    if (get_script_info(script, script_len, &info) < 0) {
+        return false;
+    }
+
+    if (info.type == SCRIPT_TYPE_OPRETURN) {
+        // the script does not have an address
+        return format_opscript_script(script, script_len, out) >= 0;
     }
-    return true;
+    return get_script_address_from_info(script, &info, out, MAX_OUTPUT_SCRIPT_DESC_SIZE) >= 0;
 }
 
 #endif
\ No newline at end of file
@@ -155,9 +155,20 @@ typedef enum {
     SCRIPT_TYPE_P2WPKH = 0x02,
     SCRIPT_TYPE_P2WSH = 0x03,
     SCRIPT_TYPE_P2TR = 0x04,
+    SCRIPT_TYPE_OPRETURN = 0xFE,       // only returned by get_script_info, as it has no address
     SCRIPT_TYPE_UNKNOWN_SEGWIT = 0xFF  // a valid but undefined segwit script
 } script_type_e;
 
+/**
+ * The type of a scriptPubKey, and the position of its payload: the hash for P2PKH and P2SH, the
+ * witness program for segwit scripts, and everything after the OP_RETURN opcode for OP_RETURN.
+ */
+typedef struct {
+    script_type_e type;
+    uint8_t payload_offset;
+    uint8_t payload_len;
+} script_info_t;
+
 static inline bool is_p2wpkh(const uint8_t script[], size_t script_len) {
     return script_len == 22 && script[0] == 0x00 && script[1] == 0x14;
 }
@@ -185,6 +196,19 @@ size_t get_push_script_size(uint32_t n);
  */
 int get_script_type(const uint8_t script[], size_t script_len);
 
+/**
+ * Classifies a scriptPubKey as get_script_type does, but also recognizes the OP_RETURN scripts of
+ * at most 83 bytes (without validating their content), and returns the position of the payload.
+ * It allows the callers that need both the type and the address of a script to parse it once.
+ *
+ * @param[in] script the script
+ * @param[in] script_len the length of the script
+ * @param[out] info the type and the payload of the script; only written if the return value is not
+ * negative.
+ * @return a `script_type_e` on success, -1 if the script is invalid or has an unknown type.
+ */
+int get_script_info(const uint8_t script[], size_t script_len, script_info_t *info);
+
 #ifndef SKIP_FOR_CMOCKA
 
 /**
@@ -201,6 +225,39 @@ int get_script_type(const uint8_t script[], size_t script_len);
  */
 int get_script_address(const uint8_t script[], size_t script_len, char *out, size_t out_len);
 
+/**
+ * Same as get_script_address, for a script already classified with get_script_info.
+ *
+ * @param script the scriptPubKey
+ * @param info the result of get_script_info for `script`
+ * @param out the output buffer
+ * @param out_len the length of the output buffer
+ * @return the length of the computed address on success; -1 if the script does not have an
+ * associated address (e.g. OP_RETURN), or the resulting address is too long to fit in out.
+ */
+int get_script_address_from_info(const uint8_t script[],
+                                 const script_info_t *info,
+                                 char *out,
+                                 size_t out_len);
+
+/**
+ * Maximum length of a scriptPubKey that has an address: a segwit script with a witness program of
+ * 40 bytes.
+ */
+#define MAX_ADDRESS_SCRIPT_LEN 42
+
+/**
+ * Computes the scriptPubKey of an address; it is the inverse of get_script_address. Both the
+ * base58check addresses (P2PKH and P2SH) and the segwit addresses of any version are supported,
+ * with the prefixes and the versions of the coin.
+ *
+ * @param address the null-terminated address
+ * @param out the output buffer
+ * @return the length of the scriptPubKey on success; -1 if the address is invalid, or is not an
+ * address of the coin.
+ */
+int get_address_script(const char *address, uint8_t out[static MAX_ADDRESS_SCRIPT_LEN]);
+
 #endif
 
 // the longest OP_RETURN description is upper bounded by:
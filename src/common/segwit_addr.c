@@ -27,14 +27,20 @@
 
 #include "segwit_addr.h"
 
+/* bech32_polymod_table[b] is the xor of the generators selected by the bits of b */
+static const uint32_t bech32_polymod_table[32] = {
+    0x00000000UL, 0x3b6a57b2UL, 0x26508e6dUL, 0x1d3ad9dfUL,
+    0x1ea119faUL, 0x25cb4e48UL, 0x38f19797UL, 0x039bc025UL,
+    0x3d4233ddUL, 0x0628646fUL, 0x1b12bdb0UL, 0x2078ea02UL,
+    0x23e32a27UL, 0x18897d95UL, 0x05b3a44aUL, 0x3ed9f3f8UL,
+    0x2a1462b3UL, 0x117e3501UL, 0x0c44ecdeUL, 0x372ebb6cUL,
+    0x34b57b49UL, 0x0fdf2cfbUL, 0x12e5f524UL, 0x298fa296UL,
+    0x1756516eUL, 0x2c3c06dcUL, 0x3106df03UL, 0x0a6c88b1UL,
+    0x09f74894UL, 0x329d1f26UL, 0x2fa7c6f9UL, 0x14cd914bUL,
+};
+
 static uint32_t bech32_polymod_step(uint32_t pre) {
-    uint8_t b = pre >> 25;
-    return ((pre & 0x1FFFFFF) << 5) ^
-        (-((b >> 0) & 1) & 0x3b6a57b2UL) ^
-        (-((b >> 1) & 1) & 0x26508e6dUL) ^
-        (-((b >> 2) & 1) & 0x1ea119faUL) ^
-        (-((b >> 3) & 1) & 0x3d4233ddUL) ^
-        (-((b >> 4) & 1) & 0x2a1462b3UL);
+    return ((pre & 0x1FFFFFF) << 5) ^ bech32_polymod_table[pre >> 25];
 }
 
 static uint32_t bech32_final_constant(bech32_encoding enc) {
@@ -57,7 +63,8 @@ static const int8_t charset_rev[128] = {
      1,  0,  3, 16, 11, 28, 12, 14,  6,  4,  2, -1, -1, -1, -1, -1
 };
 
-int bech32_encode(char *output, const char *hrp, const uint8_t *data, size_t data_len, bech32_encoding enc) {
+/* Validates the hrp, and computes its length and the checksum state after the hrp expansion */
+static int bech32_hrp_checksum(const char *hrp, size_t *hrp_len, uint32_t *chk_out) {
     uint32_t chk = 1;
     size_t i = 0;
     while (hrp[i] != 0) {
@@ -70,26 +77,41 @@ int bech32_encode(char *output, const char *hrp, const uint8_t *data, size_t dat
         chk = bech32_polymod_step(chk) ^ (ch >> 5);
         ++i;
     }
-    if (i + 7 + data_len > 90) return 0;
     chk = bech32_polymod_step(chk);
-    while (*hrp != 0) {
-        chk = bech32_polymod_step(chk) ^ (*hrp & 0x1f);
-        *(output++) = *(hrp++);
-    }
-    *(output++) = '1';
-    for (i = 0; i < data_len; ++i) {
-        if (*data >> 5) return 0;
-        chk = bech32_polymod_step(chk) ^ (*data);
-        *(output++) = charset[*(data++)];
+    for (size_t j = 0; j < i; ++j) {
+        chk = bech32_polymod_step(chk) ^ (hrp[j] & 0x1f);
     }
-    for (i = 0; i < 6; ++i) {
+    *hrp_len = i;
+    *chk_out = chk;
+    return 1;
+}
+
+/* Appends the 6 checksum characters and the terminating 0 */
+static void bech32_write_checksum(char *output, uint32_t chk, bech32_encoding enc) {
+    for (size_t i = 0; i < 6; ++i) {
         chk = bech32_polymod_step(chk);
     }
     chk ^= bech32_final_constant(enc);
-    for (i = 0; i < 6; ++i) {
+    for (size_t i = 0; i < 6; ++i) {
         *(output++) = charset[(chk >> ((5 - i) * 5)) & 0x1f];
     }
     *output = 0;
+}
+
+int bech32_encode(char *output, const char *hrp, const uint8_t *data, size_t data_len, bech32_encoding enc) {
+    uint32_t chk;
+    size_t hrp_len;
+    if (!bech32_hrp_checksum(hrp, &hrp_len, &chk)) return 0;
+    if (hrp_len + 7 + data_len > 90) return 0;
+    memcpy(output, hrp, hrp_len);
+    output += hrp_len;
+    *(output++) = '1';
+    for (size_t i = 0; i < data_len; ++i) {
+        if (*data >> 5) return 0;
+        chk = bech32_polymod_step(chk) ^ (*data);
+        *(output++) = charset[*(data++)];
+    }
+    bech32_write_checksum(output, chk, enc);
     return 1;
 }
 
@@ -178,18 +200,48 @@ static int convert_bits(uint8_t* out, size_t* outlen, int outbits, const uint8_t
     return 1;
 }
 
+/*
+ * Same as converting the witness program to 5-bit groups with convert_bits followed by
+ * bech32_encode, but the groups are encoded as soon as they are produced, without an intermediate
+ * buffer.
+ */
 int segwit_addr_encode(char *output, const char *hrp, int witver, const uint8_t *witprog, size_t witprog_len) {
-    uint8_t data[65];
-    size_t datalen = 0;
     bech32_encoding enc = BECH32_ENCODING_BECH32;
-    if (witver > 16) return 0;
+    uint32_t chk;
+    if (witver < 0 || witver > 16) return 0;
     if (witver == 0 && witprog_len != 20 && witprog_len != 32) return 0;
     if (witprog_len < 2 || witprog_len > 40) return 0;
     if (witver > 0) enc = BECH32_ENCODING_BECH32M;
-    data[0] = witver;
-    convert_bits(data + 1, &datalen, 5, witprog, witprog_len, 8, 1);
-    ++datalen;
-    return bech32_encode(output, hrp, data, datalen, enc);
+    size_t hrp_len;
+    if (!bech32_hrp_checksum(hrp, &hrp_len, &chk)) return 0;
+    size_t data_len = 1 + (witprog_len * 8 + 4) / 5;
+    if (hrp_len + 7 + data_len > 90) return 0;
+    memcpy(output, hrp, hrp_len);
+    output += hrp_len;
+    *(output++) = '1';
+
+    chk = bech32_polymod_step(chk) ^ witver;
+    *(output++) = charset[witver];
+
+    uint32_t val = 0;
+    int bits = 0;
+    for (size_t i = 0; i < witprog_len; ++i) {
+        val = (val << 8) | witprog[i];
+        bits += 8;
+        while (bits >= 5) {
+            bits -= 5;
+            uint8_t v = (val >> bits) & 0x1f;
+            chk = bech32_polymod_step(chk) ^ v;
+            *(output++) = charset[v];
+        }
+    }
+    if (bits) {
+        uint8_t v = (val << (5 - bits)) & 0x1f;
+        chk = bech32_polymod_step(chk) ^ v;
+        *(output++) = charset[v];
+    }
+    bech32_write_checksum(output, chk, enc);
+    return 1;
 }
 
 int segwit_addr_decode(int* witver, uint8_t* witdata, size_t* witdata_len, const char* hrp, const char* addr) {
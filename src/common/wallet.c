@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <limits.h>
 
@@ -21,45 +22,6 @@
 #define PIC(x) (x)
 #endif
 
-typedef struct {
-    PolicyNodeType type;
-    const char *name;
-} token_descriptor_t;
-
-static const token_descriptor_t KNOWN_TOKENS[] = {
-    {.type = TOKEN_SH, .name = "sh"},
-    {.type = TOKEN_WSH, .name = "wsh"},
-    {.type = TOKEN_PKH, .name = "pkh"},
-    {.type = TOKEN_WPKH, .name = "wpkh"},
-    {.type = TOKEN_MULTI, .name = "multi"},
-    {.type = TOKEN_MULTI_A, .name = "multi_a"},
-    {.type = TOKEN_SORTEDMULTI, .name = "sortedmulti"},
-    {.type = TOKEN_SORTEDMULTI_A, .name = "sortedmulti_a"},
-    {.type = TOKEN_TR, .name = "tr"},
-
-    // miniscript tokens (except wrappers)
-    {.type = TOKEN_0, .name = "0"},
-    {.type = TOKEN_1, .name = "1"},
-    {.type = TOKEN_PK, .name = "pk"},
-    {.type = TOKEN_PK_K, .name = "pk_k"},
-    {.type = TOKEN_PK_H, .name = "pk_h"},
-    {.type = TOKEN_OLDER, .name = "older"},
-    {.type = TOKEN_AFTER, .name = "after"},
-    {.type = TOKEN_SHA256, .name = "sha256"},
-    {.type = TOKEN_HASH256, .name = "hash256"},
-    {.type = TOKEN_RIPEMD160, .name = "ripemd160"},
-    {.type = TOKEN_HASH160, .name = "hash160"},
-    {.type = TOKEN_ANDOR, .name = "andor"},
-    {.type = TOKEN_AND_V, .name = "and_v"},
-    {.type = TOKEN_AND_B, .name = "and_b"},
-    {.type = TOKEN_AND_N, .name = "and_n"},
-    {.type = TOKEN_OR_B, .name = "or_b"},
-    {.type = TOKEN_OR_C, .name = "or_c"},
-    {.type = TOKEN_OR_D, .name = "or_d"},
-    {.type = TOKEN_OR_I, .name = "or_i"},
-    {.type = TOKEN_THRESH, .name = "thresh"},
-};
-
 // lookup table for characters that represent a valid miniscript wrapper fragment
 const bool is_valid_miniscript_wrapper[] = {
     1,  // "a"
@@ -214,22 +176,143 @@ static size_t read_token(buffer_t *buffer, char *out, size_t out_len) {
     return word_len;
 }
 
+// Selects the only token of the known tokens that can match, if any
+#define CANDIDATE(token_type, token_name) \
+    do {                                  \
+        type = (token_type);              \
+        name = (token_name);              \
+    } while (0)
+
+/**
+ * Returns the type of the token with the given name, or TOKEN_INVALID if it is not a known token.
+ * The tokens are bucketed by length, then told apart by one or two characters, so that only one
+ * comparison of the whole word is needed.
+ */
+static PolicyNodeType lookup_token(const char *word, size_t word_len) {
+    PolicyNodeType type = TOKEN_INVALID;
+    const char *name = NULL;
+
+    switch (word_len) {
+        case 1:
+            if (word[0] == '0') {
+                CANDIDATE(TOKEN_0, "0");
+            } else if (word[0] == '1') {
+                CANDIDATE(TOKEN_1, "1");
+            }
+            break;
+        case 2:
+            if (word[0] == 's') {
+                CANDIDATE(TOKEN_SH, "sh");
+            } else if (word[0] == 't') {
+                CANDIDATE(TOKEN_TR, "tr");
+            } else if (word[0] == 'p') {
+                CANDIDATE(TOKEN_PK, "pk");
+            }
+            break;
+        case 3:
+            if (word[0] == 'w') {
+                CANDIDATE(TOKEN_WSH, "wsh");
+            } else if (word[0] == 'p') {
+                CANDIDATE(TOKEN_PKH, "pkh");
+            }
+            break;
+        case 4:
+            if (word[0] == 'w') {
+                CANDIDATE(TOKEN_WPKH, "wpkh");
+            } else if (word[0] == 'p') {
+                if (word[3] == 'k') {
+                    CANDIDATE(TOKEN_PK_K, "pk_k");
+                } else if (word[3] == 'h') {
+                    CANDIDATE(TOKEN_PK_H, "pk_h");
+                }
+            } else if (word[0] == 'o') {
+                switch (word[3]) {
+                    case 'b':
+                        CANDIDATE(TOKEN_OR_B, "or_b");
+                        break;
+                    case 'c':
+                        CANDIDATE(TOKEN_OR_C, "or_c");
+                        break;
+                    case 'd':
+                        CANDIDATE(TOKEN_OR_D, "or_d");
+                        break;
+                    case 'i':
+                        CANDIDATE(TOKEN_OR_I, "or_i");
+                        break;
+                }
+            }
+            break;
+        case 5:
+            if (word[0] == 'm') {
+                CANDIDATE(TOKEN_MULTI, "multi");
+            } else if (word[0] == 'o') {
+                CANDIDATE(TOKEN_OLDER, "older");
+            } else if (word[0] == 'a') {
+                if (word[1] == 'f') {
+                    CANDIDATE(TOKEN_AFTER, "after");
+                } else if (word[3] == 'o') {
+                    CANDIDATE(TOKEN_ANDOR, "andor");
+                } else {
+                    switch (word[4]) {
+                        case 'v':
+                            CANDIDATE(TOKEN_AND_V, "and_v");
+                            break;
+                        case 'b':
+                            CANDIDATE(TOKEN_AND_B, "and_b");
+                            break;
+                        case 'n':
+                            CANDIDATE(TOKEN_AND_N, "and_n");
+                            break;
+                    }
+                }
+            }
+            break;
+        case 6:
+            if (word[0] == 's') {
+                CANDIDATE(TOKEN_SHA256, "sha256");
+            } else if (word[0] == 't') {
+                CANDIDATE(TOKEN_THRESH, "thresh");
+            }
+            break;
+        case 7:
+            if (word[0] == 'm') {
+                CANDIDATE(TOKEN_MULTI_A, "multi_a");
+            } else if (word[4] == '2') {
+                CANDIDATE(TOKEN_HASH256, "hash256");
+            } else {
+                CANDIDATE(TOKEN_HASH160, "hash160");
+            }
+            break;
+        case 9:
+            CANDIDATE(TOKEN_RIPEMD160, "ripemd160");
+            break;
+        case 11:
+            CANDIDATE(TOKEN_SORTEDMULTI, "sortedmulti");
+            break;
+        case 13:
+            CANDIDATE(TOKEN_SORTEDMULTI_A, "sortedmulti_a");
+            break;
+    }
+
+    if (name == NULL || memcmp(word, name, word_len) != 0) {
+        return TOKEN_INVALID;
+    }
+    return type;
+}
+
+#undef CANDIDATE
+
 /**
  * Read the next word from buffer (or up to MAX_TOKEN_LENGTH characters), and
- * returns the index of this word in KNOWN_TOKENS if found; TOKEN_INVALID otherwise.
+ * returns its token type if it is a known token; TOKEN_INVALID otherwise.
+ * Not inlined, so that the word is not part of the stack frame of the recursive parse_script.
  */
-static PolicyNodeType parse_token(buffer_t *buffer) {
-    char word[MAX_TOKEN_LENGTH + 1];
+static PolicyNodeType __attribute__((noinline)) parse_token(buffer_t *buffer) {
+    char word[MAX_TOKEN_LENGTH];
 
     size_t word_len = read_token(buffer, word, MAX_TOKEN_LENGTH);
-    word[word_len] = '\0';
 
-    for (unsigned int i = 0; i < sizeof(KNOWN_TOKENS) / sizeof(KNOWN_TOKENS[0]); i++) {
-        if (strncmp((const char *) PIC(KNOWN_TOKENS[i].name), word, MAX_TOKEN_LENGTH) == 0) {
-            return ((const token_descriptor_t *) PIC(&KNOWN_TOKENS[i]))->type;
-        }
-    }
-    return TOKEN_INVALID;
+    return lookup_token(word, word_len);
 }
 
 /**
@@ -534,141 +617,101 @@ static int parse_child_scripts(buffer_t *in_buf,
 static int parse_tree(buffer_t *in_buf, buffer_t *out_buf, int version, size_t depth);
 
 /**
- * Parses a SCRIPT expression from the in_buf buffer, allocating the nodes and variables in out_buf.
- * The initial pointer in out_buf will contain the root node of the SCRIPT.
+ * Parses the miniscript wrappers (like "sln:") at the current position of in_buf, if any,
+ * allocating the chain of wrapper nodes in out_buf. On return, *inner_wrapper points to the
+ * innermost wrapper, or is left NULL if there are no wrappers.
+ *
+ * @return the number of wrappers, or -1 on error.
  */
-static int parse_script(buffer_t *in_buf,
-                        buffer_t *out_buf,
-                        int version,
-                        size_t depth,
-                        unsigned int context_flags) {
+static int __attribute__((noinline)) parse_wrappers(buffer_t *in_buf,
+                                                    buffer_t *out_buf,
+                                                    policy_node_with_script_t **inner_wrapper) {
     int n_wrappers = 0;
 
-    policy_node_t *outermost_node = (policy_node_t *) buffer_get_cur(out_buf);
-    policy_node_with_script_t *inner_wrapper = NULL;  // pointer to the inner wrapper, if any
-
-    // miniscript-related parsing only within top-level WSH, or within tr
-    bool parse_as_miniscript =
-        ((context_flags & CONTEXT_WITHIN_WSH) != 0 && (context_flags & CONTEXT_WITHIN_SH) == 0) ||
-        (context_flags & CONTEXT_WITHIN_TR) != 0;
-
-    if (parse_as_miniscript) {
-        // look ahead to finds out if the buffer starts with alphanumeric digits that could be
-        // wrappers, followed by a colon
-        char c;
-        bool can_read;
-        while (true) {
-            can_read = buffer_peek_n(in_buf, n_wrappers, (uint8_t *) &c);
-            if (can_read && 'a' <= c && c <= 'z' && is_valid_miniscript_wrapper[c - 'a']) {
-                ++n_wrappers;
-            } else {
-                break;
-            }
-        }
-
-        if (can_read && c == ':') {
-            // parse wrappers
-            for (int i = 0; i < n_wrappers; i++) {
-                policy_node_with_script_t *node =
-                    (policy_node_with_script_t *) buffer_alloc(out_buf,
-                                                               sizeof(policy_node_with_script_t),
-                                                               true);
-                if (node == NULL) {
-                    return WITH_ERROR(-1, "Out of memory");
-                }
-                buffer_read_u8(in_buf, (uint8_t *) &c);
-                switch (c) {
-                    case 'a':
-                        node->base.type = TOKEN_A;
-                        break;
-                    case 's':
-                        node->base.type = TOKEN_S;
-                        break;
-                    case 'c':
-                        node->base.type = TOKEN_C;
-                        break;
-                    case 't':
-                        node->base.type = TOKEN_T;
-                        break;
-                    case 'd':
-                        node->base.type = TOKEN_D;
-                        break;
-                    case 'v':
-                        node->base.type = TOKEN_V;
-                        break;
-                    case 'j':
-                        node->base.type = TOKEN_J;
-                        break;
-                    case 'n':
-                        node->base.type = TOKEN_N;
-                        break;
-                    case 'l':
-                        node->base.type = TOKEN_L;
-                        break;
-                    case 'u':
-                        node->base.type = TOKEN_U;
-                        break;
-                    default:
-                        PRINTF("Unexpected wrapper: %c\n", c);
-                        return -1;
-                }
-
-                if (inner_wrapper != NULL) {
-                    i_policy_node(&inner_wrapper->script, node);
-                }
-                inner_wrapper = node;
-            }
-            buffer_seek_cur(in_buf, 1);  // skip ":"
+    // look ahead to finds out if the buffer starts with alphanumeric digits that could be
+    // wrappers, followed by a colon
+    char c;
+    bool can_read;
+    while (true) {
+        can_read = buffer_peek_n(in_buf, n_wrappers, (uint8_t *) &c);
+        if (can_read && 'a' <= c && c <= 'z' && is_valid_miniscript_wrapper[c - 'a']) {
+            ++n_wrappers;
         } else {
-            n_wrappers = 0;  // it was not a wrapper
+            break;
         }
     }
 
-    // We read the token, we'll do different parsing based on what token we find
-    PolicyNodeType token = parse_token(in_buf);
-    if (token == TOKEN_INVALID) {
-        PRINTF("Failed to parse token");
-        return -1;
-    }
-
-    if (context_flags & CONTEXT_WITHIN_SH) {
-        // whitelist of allowed tokens within sh; in particular, no miniscript
-        switch (token) {
-            case TOKEN_PK:
-            case TOKEN_PKH:
-            case TOKEN_MULTI:
-            case TOKEN_SORTEDMULTI:
-            case TOKEN_WPKH:
-            case TOKEN_WSH:
-                break;
-            default:
-                return WITH_ERROR(-1, "Token not allowed within sh");
-        }
-    }
+    if (can_read && c == ':') {
+        // parse wrappers
+        for (int i = 0; i < n_wrappers; i++) {
+            policy_node_with_script_t *node =
+                (policy_node_with_script_t *) buffer_alloc(out_buf,
+                                                           sizeof(policy_node_with_script_t),
+                                                           true);
+            if (node == NULL) {
+                return WITH_ERROR(-1, "Out of memory");
+            }
+            buffer_read_u8(in_buf, (uint8_t *) &c);
+            switch (c) {
+                case 'a':
+                    node->base.type = TOKEN_A;
+                    break;
+                case 's':
+                    node->base.type = TOKEN_S;
+                    break;
+                case 'c':
+                    node->base.type = TOKEN_C;
+                    break;
+                case 't':
+                    node->base.type = TOKEN_T;
+                    break;
+                case 'd':
+                    node->base.type = TOKEN_D;
+                    break;
+                case 'v':
+                    node->base.type = TOKEN_V;
+                    break;
+                case 'j':
+                    node->base.type = TOKEN_J;
+                    break;
+                case 'n':
+                    node->base.type = TOKEN_N;
+                    break;
+                case 'l':
+                    node->base.type = TOKEN_L;
+                    break;
+                case 'u':
+                    node->base.type = TOKEN_U;
+                    break;
+                default:
+                    PRINTF("Unexpected wrapper: %c\n", c);
+                    return -1;
+            }
 
-    if ((context_flags & CONTEXT_WITHIN_SH) != 0 && (context_flags & CONTEXT_WITHIN_WSH) != 0 &&
-        depth == 2) {
-        // whitelist of allowed tokens within sh(wsh()); only few simple wallet types are supported
-        switch (token) {
-            case TOKEN_PK:
-            case TOKEN_PKH:
-            case TOKEN_MULTI:
-            case TOKEN_SORTEDMULTI:
-                break;
-            default:
-                return WITH_ERROR(-1, "Token not allowed within sh(wsh())");
+            if (*inner_wrapper != NULL) {
+                i_policy_node(&(*inner_wrapper)->script, node);
+            }
+            *inner_wrapper = node;
         }
+        buffer_seek_cur(in_buf, 1);  // skip ":"
+    } else {
+        n_wrappers = 0;  // it was not a wrapper
     }
+    return n_wrappers;
+}
 
-    // all tokens but '0' and '1' have opening and closing parentheses
-    bool has_parentheses = token != TOKEN_0 && token != TOKEN_1;
-
-    if (has_parentheses) {
-        // Opening '('
-        if (!consume_character(in_buf, '(')) {
-            return WITH_ERROR(-1, "Expected '('");
-        }
-    }
+/**
+ * Parses a fragment that has no child scripts (constants, hashlocks, keys, timelocks and multisig),
+ * once its token and the opening parenthesis were consumed. It is kept out of parse_script, so that
+ * its locals are not part of the stack frame of each nesting level of the recursion.
+ */
+static int __attribute__((noinline)) parse_leaf_fragment(buffer_t *in_buf,
+                                                         buffer_t *out_buf,
+                                                         int version,
+                                                         size_t depth,
+                                                         unsigned int context_flags,
+                                                         PolicyNodeType token,
+                                                         policy_node_t **out_node) {
     policy_node_t *parsed_node;
 
     switch (token) {
@@ -705,46 +748,6 @@ static int parse_script(buffer_t *in_buf,
 
             break;
         }
-        case TOKEN_SH:
-        case TOKEN_WSH: {
-            if (token == TOKEN_SH) {
-                if (depth != 0) {
-                    return WITH_ERROR(-1, "sh can only be a top-level function");
-                }
-            } else if (token == TOKEN_WSH) {
-                if (depth != 0 && ((context_flags & CONTEXT_WITHIN_SH) == 0)) {
-                    return WITH_ERROR(-1, "wsh can only be top-level or inside sh");
-                }
-            }
-
-            policy_node_with_script_t *node =
-                (policy_node_with_script_t *) buffer_alloc(out_buf,
-                                                           sizeof(policy_node_with_script_t),
-                                                           true);
-            if (node == NULL) {
-                return WITH_ERROR(-1, "Out of memory");
-            }
-            parsed_node = (policy_node_t *) node;
-
-            node->base.type = token;
-
-            node->base.flags.is_miniscript = 0;
-
-            unsigned int inner_context_flags = context_flags;
-            inner_context_flags |= (token == TOKEN_SH) ? CONTEXT_WITHIN_SH : CONTEXT_WITHIN_WSH;
-
-            // the internal script is recursively parsed (if successful) in the current location
-            // of the output buffer
-            buffer_alloc(out_buf, 0, true);  // ensure alignment of current pointer
-            i_policy_node(&node->script, buffer_get_cur(out_buf));
-
-            if (0 > parse_script(in_buf, out_buf, version, depth + 1, inner_context_flags)) {
-                // failed while parsing internal script
-                return -1;
-            }
-
-            break;
-        }
         case TOKEN_SHA256:
         case TOKEN_HASH256: {
             policy_node_with_hash_256_t *node =
@@ -770,7 +773,6 @@ static int parse_script(buffer_t *in_buf,
             node->base.flags.miniscript_mod_u = 1;
             break;
         }
-
         case TOKEN_RIPEMD160:
         case TOKEN_HASH160: {
             policy_node_with_hash_160_t *node =
@@ -782,18 +784,542 @@ static int parse_script(buffer_t *in_buf,
             }
             parsed_node = (policy_node_t *) node;
 
-            if (0 > buffer_read_hex_hash(in_buf, node->h, 20)) {
-                return WITH_ERROR(-1, "Failed to parse 20-byte hash image");
+            if (0 > buffer_read_hex_hash(in_buf, node->h, 20)) {
+                return WITH_ERROR(-1, "Failed to parse 20-byte hash image");
+            }
+
+            node->base.type = token;
+            node->base.flags.is_miniscript = 1;
+            node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+            node->base.flags.miniscript_mod_z = 0;
+            node->base.flags.miniscript_mod_o = 1;
+            node->base.flags.miniscript_mod_n = 1;
+            node->base.flags.miniscript_mod_d = 1;
+            node->base.flags.miniscript_mod_u = 1;
+            break;
+        }
+        case TOKEN_PK:
+        case TOKEN_PKH:
+        case TOKEN_PK_K:
+        case TOKEN_PK_H:
+        case TOKEN_WPKH: {
+            policy_node_with_key_t *node =
+                (policy_node_with_key_t *) buffer_alloc(out_buf,
+                                                        sizeof(policy_node_with_key_t),
+                                                        true);
+            if (node == NULL) {
+                return WITH_ERROR(-1, "Out of memory");
+            }
+
+            policy_node_key_placeholder_t *key_placeholder =
+                buffer_alloc(out_buf, sizeof(policy_node_key_placeholder_t), true);
+
+            if (key_placeholder == NULL) {
+                return WITH_ERROR(-1, "Out of memory");
+            }
+            i_policy_node_key_placeholder(&node->key_placeholder, key_placeholder);
+
+            if (token == TOKEN_WPKH) {
+                if (depth > 0 && ((context_flags & CONTEXT_WITHIN_SH) == 0)) {
+                    return WITH_ERROR(-1, "wpkh can only be top-level or inside sh");
+                }
+            }
+
+            parsed_node = (policy_node_t *) node;
+
+            node->base.type = token;
+
+            if (0 > parse_placeholder(in_buf, version, key_placeholder)) {
+                return WITH_ERROR(-1, "Couldn't parse key placeholder");
+            }
+
+            if (token == TOKEN_WPKH) {
+                // not valid in miniscript
+                node->base.flags.is_miniscript = 0;
+            } else {
+                switch (token) {
+                    case TOKEN_PK:  // pk(key) == c:pk_k(key)
+                        node->base.flags.is_miniscript = 1;
+                        node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+                        node->base.flags.miniscript_mod_z = 0;
+                        node->base.flags.miniscript_mod_o = 1;
+                        node->base.flags.miniscript_mod_n = 1;
+                        node->base.flags.miniscript_mod_d = 1;
+                        node->base.flags.miniscript_mod_u = 1;
+                        break;
+                    case TOKEN_PKH:  // pkh(key) == c:pk_h(key)
+                        node->base.flags.is_miniscript = 1;
+                        node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+                        node->base.flags.miniscript_mod_z = 0;
+                        node->base.flags.miniscript_mod_o = 0;
+                        node->base.flags.miniscript_mod_n = 1;
+                        node->base.flags.miniscript_mod_d = 1;
+                        node->base.flags.miniscript_mod_u = 1;
+                        break;
+                    case TOKEN_PK_K:
+                        node->base.flags.is_miniscript = 1;
+                        node->base.flags.miniscript_type = MINISCRIPT_TYPE_K;
+                        node->base.flags.miniscript_mod_z = 0;
+                        node->base.flags.miniscript_mod_o = 1;
+                        node->base.flags.miniscript_mod_n = 1;
+                        node->base.flags.miniscript_mod_d = 1;
+                        node->base.flags.miniscript_mod_u = 1;
+                        break;
+                    case TOKEN_PK_H:
+                        node->base.flags.is_miniscript = 1;
+                        node->base.flags.miniscript_type = MINISCRIPT_TYPE_K;
+                        node->base.flags.miniscript_mod_z = 0;
+                        node->base.flags.miniscript_mod_o = 0;
+                        node->base.flags.miniscript_mod_n = 1;
+                        node->base.flags.miniscript_mod_d = 1;
+                        node->base.flags.miniscript_mod_u = 1;
+                        break;
+                    default:
+                        return WITH_ERROR(-1, "unreachable code reached");
+                }
+            }
+
+            break;
+        }
+        case TOKEN_OLDER:
+        case TOKEN_AFTER: {
+            policy_node_with_uint32_t *node =
+                (policy_node_with_uint32_t *) buffer_alloc(out_buf,
+                                                           sizeof(policy_node_with_uint32_t),
+                                                           true);
+            if (node == NULL) {
+                return WITH_ERROR(-1, "Out of memory");
+            }
+            parsed_node = (policy_node_t *) node;
+            node->base.type = token;
+
+            if (parse_unsigned_decimal(in_buf, &node->n) == -1) {
+                return WITH_ERROR(-1, "Error parsing number");
+            }
+
+            if (node->n < 1 || node->n >= (1u << 31)) {
+                return WITH_ERROR(-1, "n must satisfy 1 <= n < 2^31 in older/after");
+            }
+
+            node->base.flags.is_miniscript = 1;
+            node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+            node->base.flags.miniscript_mod_z = 1;
+            node->base.flags.miniscript_mod_o = 0;
+            node->base.flags.miniscript_mod_n = 0;
+            node->base.flags.miniscript_mod_d = 0;
+            node->base.flags.miniscript_mod_u = 0;
+
+            break;
+        }
+        case TOKEN_MULTI:
+        case TOKEN_MULTI_A:
+        case TOKEN_SORTEDMULTI:
+        case TOKEN_SORTEDMULTI_A: {
+            policy_node_multisig_t *node =
+                (policy_node_multisig_t *) buffer_alloc(out_buf,
+                                                        sizeof(policy_node_multisig_t),
+                                                        true);
+
+            if (node == NULL) {
+                return WITH_ERROR(-1, "Out of memory");
+            }
+
+            if ((context_flags & CONTEXT_WITHIN_TR) != 0) {
+                if (token != TOKEN_MULTI_A && token != TOKEN_SORTEDMULTI_A) {
+                    return WITH_ERROR(
+                        -1,
+                        "multi and sortedmulti can only be used in legacy or segwit scripts");
+                }
+            } else {  // legacy or segwit scripts
+                if (token != TOKEN_MULTI && token != TOKEN_SORTEDMULTI) {
+                    return WITH_ERROR(
+                        -1,
+                        "multi_a and sortedmulti_a can only be used in taproot scripts");
+                }
+            }
+
+            if (token == TOKEN_SORTEDMULTI) {
+                size_t n_sh_wrappers = 0;
+                if (context_flags & CONTEXT_WITHIN_SH) ++n_sh_wrappers;
+                if (context_flags & CONTEXT_WITHIN_WSH) ++n_sh_wrappers;
+
+                // sortedmulti can only be used bare, or directly under sh(), wsh()
+                if (depth != n_sh_wrappers) {
+                    return WITH_ERROR(-1,
+                                      "sortedmulti can only be bare, or directly under sh or wsh");
+                }
+            }
+
+            parsed_node = (policy_node_t *) node;
+            node->base.type = token;
+
+            uint32_t k;
+            if (parse_unsigned_decimal(in_buf, &k) == -1 || k > INT16_MAX) {
+                return WITH_ERROR(-1, "Error parsing threshold");
+            }
+            node->k = (int16_t) k;
+
+            // We allocate the array of key indices at the current position in the output buffer
+            // (on success)
+            buffer_alloc(out_buf, 0, true);  // ensure alignment of current pointer
+            i_policy_node_key_placeholder(&node->key_placeholders, buffer_get_cur(out_buf));
+
+            node->n = 0;
+            while (true) {
+                uint8_t c;
+                // If the next character is a ')', we exit and leave it in the buffer
+                if (buffer_peek(in_buf, &c) && c == ')') {
+                    break;
+                }
+
+                // otherwise, there must be a comma
+                if (!consume_character(in_buf, ',')) {
+                    return WITH_ERROR(-1, "Expected ','");
+                }
+
+                policy_node_key_placeholder_t *key_placeholder =
+                    (policy_node_key_placeholder_t *) buffer_alloc(
+                        out_buf,
+                        sizeof(policy_node_key_placeholder_t),
+                        true);  // we align this pointer, as there's padding in an array of
+                                // structures
+                if (key_placeholder == NULL) {
+                    return WITH_ERROR(-1, "Out of memory");
+                }
+
+                if (0 > parse_placeholder(in_buf, version, key_placeholder)) {
+                    return WITH_ERROR(-1, "Error parsing key placeholder");
+                }
+
+                ++node->n;
+            }
+
+            // check integrity of k and n
+            if (!(1 <= node->k && node->k <= node->n && node->n <= MAX_PUBKEYS_PER_MULTISIG)) {
+                return WITH_ERROR(-1, "Invalid k and/or n");
+            }
+
+            if (token == TOKEN_SORTEDMULTI || token == TOKEN_SORTEDMULTI_A) {
+                node->base.flags.is_miniscript = 0;
+            } else if (token == TOKEN_MULTI) {
+                node->base.flags.is_miniscript = 1;
+                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+                node->base.flags.miniscript_mod_z = 0;
+                node->base.flags.miniscript_mod_o = 0;
+                node->base.flags.miniscript_mod_n = 1;
+                node->base.flags.miniscript_mod_d = 1;
+                node->base.flags.miniscript_mod_u = 1;
+            } else if (token == TOKEN_MULTI_A) {
+                node->base.flags.is_miniscript = 1;
+                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+                node->base.flags.miniscript_mod_z = 0;
+                node->base.flags.miniscript_mod_o = 0;
+                node->base.flags.miniscript_mod_n = 0;
+                node->base.flags.miniscript_mod_d = 1;
+                node->base.flags.miniscript_mod_u = 1;
+            }
+
+            break;
+        }
+        default:
+            PRINTF("Unknown token: %d\n", token);
+            return -1;
+    }
+
+    *out_node = parsed_node;
+    return 0;
+}
+
+/**
+ * Validates the wrappers starting at outermost_node, and computes their flags (miniscript type and
+ * modifiers). The script of the innermost wrapper must already point to the wrapped node.
+ */
+static int __attribute__((noinline)) compute_wrappers_flags(policy_node_t *outermost_node,
+                                                            int n_wrappers,
+                                                            unsigned int context_flags) {
+    // Remark: This loop has quadratic complexity as we process a linked list in reverse order, but
+    // it does not matter as it is always a short list.
+
+    for (int i = n_wrappers - 1; i >= 0; i--) {
+        // find the actual node by traversing the list
+        policy_node_with_script_t *node = (policy_node_with_script_t *) outermost_node;
+        for (int j = 0; j < i; j++) {
+            node = (policy_node_with_script_t *) r_policy_node(&node->script);
+        }
+
+        if (!r_policy_node(&node->script)->flags.is_miniscript) {
+            return WITH_ERROR(-1, "wrappers can only be applied to miniscript");
+        }
+
+        const policy_node_t *X = r_policy_node(&node->script);
+
+        uint8_t X_type = X->flags.miniscript_type;
+
+        uint8_t X_z = X->flags.miniscript_mod_z;
+        uint8_t X_o = X->flags.miniscript_mod_o;
+        uint8_t X_n = X->flags.miniscript_mod_n;
+        uint8_t X_d = X->flags.miniscript_mod_d;
+        uint8_t X_u = X->flags.miniscript_mod_u;
+
+        switch (node->base.type) {
+            case TOKEN_A:
+                if (X_type != MINISCRIPT_TYPE_B) {
+                    return WITH_ERROR(-1, "'a' wrapper requires a B type child");
+                }
+
+                node->base.flags.is_miniscript = 1;
+                node->base.flags.miniscript_type = MINISCRIPT_TYPE_W;
+                node->base.flags.miniscript_mod_z = 0;
+                node->base.flags.miniscript_mod_o = 0;
+                node->base.flags.miniscript_mod_n = 0;
+                node->base.flags.miniscript_mod_d = X_d;
+                node->base.flags.miniscript_mod_u = X_u;
+                break;
+            case TOKEN_S:
+                if (X_type != MINISCRIPT_TYPE_B || !X_o) {
+                    return WITH_ERROR(-1, "'s' wrapper requires a Bu type child");
+                }
+
+                node->base.flags.is_miniscript = 1;
+                node->base.flags.miniscript_type = MINISCRIPT_TYPE_W;
+                node->base.flags.miniscript_mod_z = 0;
+                node->base.flags.miniscript_mod_o = 0;
+                node->base.flags.miniscript_mod_n = 0;
+                node->base.flags.miniscript_mod_d = X_d;
+                node->base.flags.miniscript_mod_u = X_u;
+                break;
+            case TOKEN_C:
+                if (X_type != MINISCRIPT_TYPE_K) {
+                    return WITH_ERROR(-1, "'c' wrapper requires a K type child");
+                }
+
+                node->base.flags.is_miniscript = 1;
+                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+                node->base.flags.miniscript_mod_z = 0;
+                node->base.flags.miniscript_mod_o = X_o;
+                node->base.flags.miniscript_mod_n = X_n;
+                node->base.flags.miniscript_mod_d = X_d;
+                node->base.flags.miniscript_mod_u = 1;
+                break;
+            case TOKEN_T:
+                // t:X == and_v(X,1)
+
+                if (X_type != MINISCRIPT_TYPE_V) {
+                    return WITH_ERROR(-1, "'t' wrapper requires a V type child");
+                }
+
+                node->base.flags.is_miniscript = 1;
+                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+                node->base.flags.miniscript_mod_z = X_z;
+                node->base.flags.miniscript_mod_o = X_o;
+                node->base.flags.miniscript_mod_n = X_n;
+                node->base.flags.miniscript_mod_d = 0;
+                node->base.flags.miniscript_mod_u = 1;
+                break;
+            case TOKEN_D:
+                if (X_type != MINISCRIPT_TYPE_V || !X_z) {
+                    return WITH_ERROR(-1, "'d' wrapper requires a Vz type child");
+                }
+
+                node->base.flags.is_miniscript = 1;
+                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+                node->base.flags.miniscript_mod_z = 0;
+                node->base.flags.miniscript_mod_o = 1;
+                node->base.flags.miniscript_mod_n = 1;
+                node->base.flags.miniscript_mod_d = 1;
+                node->base.flags.miniscript_mod_u = (context_flags & CONTEXT_WITHIN_TR) ? 1 : 0;
+                break;
+            case TOKEN_V:
+                if (X_type != MINISCRIPT_TYPE_B) {
+                    return WITH_ERROR(-1, "'v' wrapper requires a B type child");
+                }
+
+                node->base.flags.is_miniscript = 1;
+                node->base.flags.miniscript_type = MINISCRIPT_TYPE_V;
+                node->base.flags.miniscript_mod_z = X_z;
+                node->base.flags.miniscript_mod_o = X_o;
+                node->base.flags.miniscript_mod_n = X_n;
+                node->base.flags.miniscript_mod_d = 0;
+                node->base.flags.miniscript_mod_u = 0;
+                break;
+            case TOKEN_J:
+                if (X_type != MINISCRIPT_TYPE_B || !X_n) {
+                    return WITH_ERROR(-1, "'j' wrapper requires a Bn type child");
+                }
+
+                node->base.flags.is_miniscript = 1;
+                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+                node->base.flags.miniscript_mod_z = 0;
+                node->base.flags.miniscript_mod_o = X_o;
+                node->base.flags.miniscript_mod_n = 1;
+                node->base.flags.miniscript_mod_d = 1;
+                node->base.flags.miniscript_mod_u = X_u;
+                break;
+            case TOKEN_N:
+                if (X_type != MINISCRIPT_TYPE_B) {
+                    return WITH_ERROR(-1, "'n' wrapper requires a B type child");
+                }
+
+                node->base.flags.is_miniscript = 1;
+                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+                node->base.flags.miniscript_mod_z = X_z;
+                node->base.flags.miniscript_mod_o = X_o;
+                node->base.flags.miniscript_mod_n = X_n;
+                node->base.flags.miniscript_mod_d = X_d;
+                node->base.flags.miniscript_mod_u = 1;
+                break;
+            case TOKEN_L:
+                // l:X == or_i(0,X)
+
+                if (X_type != MINISCRIPT_TYPE_B) {
+                    return WITH_ERROR(-1, "'l' wrapper requires a B type child");
+                }
+
+                node->base.flags.is_miniscript = 1;
+                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+                node->base.flags.miniscript_mod_z = 0;
+                node->base.flags.miniscript_mod_o = X_z;
+                node->base.flags.miniscript_mod_n = 0;
+                node->base.flags.miniscript_mod_d = 1;
+                node->base.flags.miniscript_mod_u = X_u;
+                break;
+            case TOKEN_U:
+                // u:X == or_i(X,0)
+
+                if (X_type != MINISCRIPT_TYPE_B) {
+                    return WITH_ERROR(-1, "'u' wrapper requires a B type child");
+                }
+
+                node->base.flags.is_miniscript = 1;
+                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
+                node->base.flags.miniscript_mod_z = 0;
+                node->base.flags.miniscript_mod_o = X_z;
+                node->base.flags.miniscript_mod_n = 0;
+                node->base.flags.miniscript_mod_d = 1;
+                node->base.flags.miniscript_mod_u = X_u;
+                break;
+            default:
+                return WITH_ERROR(-1, "unreachable code reached");
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Parses a SCRIPT expression from the in_buf buffer, allocating the nodes and variables in out_buf.
+ * The initial pointer in out_buf will contain the root node of the SCRIPT.
+ * Only the fragments with child scripts are parsed in this function, as it is the only one that
+ * recurses; everything else is in separate noinline functions, to keep its stack frame small.
+ */
+static int parse_script(buffer_t *in_buf,
+                        buffer_t *out_buf,
+                        int version,
+                        size_t depth,
+                        unsigned int context_flags) {
+    int n_wrappers = 0;
+
+    policy_node_t *outermost_node = (policy_node_t *) buffer_get_cur(out_buf);
+    policy_node_with_script_t *inner_wrapper = NULL;  // pointer to the inner wrapper, if any
+
+    // miniscript-related parsing only within top-level WSH, or within tr
+    bool parse_as_miniscript =
+        ((context_flags & CONTEXT_WITHIN_WSH) != 0 && (context_flags & CONTEXT_WITHIN_SH) == 0) ||
+        (context_flags & CONTEXT_WITHIN_TR) != 0;
+
+    if (parse_as_miniscript) {
+        n_wrappers = parse_wrappers(in_buf, out_buf, &inner_wrapper);
+        if (n_wrappers < 0) {
+            return -1;
+        }
+    }
+
+    // We read the token, we'll do different parsing based on what token we find
+    PolicyNodeType token = parse_token(in_buf);
+    if (token == TOKEN_INVALID) {
+        PRINTF("Failed to parse token");
+        return -1;
+    }
+
+    if (context_flags & CONTEXT_WITHIN_SH) {
+        // whitelist of allowed tokens within sh; in particular, no miniscript
+        switch (token) {
+            case TOKEN_PK:
+            case TOKEN_PKH:
+            case TOKEN_MULTI:
+            case TOKEN_SORTEDMULTI:
+            case TOKEN_WPKH:
+            case TOKEN_WSH:
+                break;
+            default:
+                return WITH_ERROR(-1, "Token not allowed within sh");
+        }
+    }
+
+    if ((context_flags & CONTEXT_WITHIN_SH) != 0 && (context_flags & CONTEXT_WITHIN_WSH) != 0 &&
+        depth == 2) {
+        // whitelist of allowed tokens within sh(wsh()); only few simple wallet types are supported
+        switch (token) {
+            case TOKEN_PK:
+            case TOKEN_PKH:
+            case TOKEN_MULTI:
+            case TOKEN_SORTEDMULTI:
+                break;
+            default:
+                return WITH_ERROR(-1, "Token not allowed within sh(wsh())");
+        }
+    }
+
+    // all tokens but '0' and '1' have opening and closing parentheses
+    bool has_parentheses = token != TOKEN_0 && token != TOKEN_1;
+
+    if (has_parentheses) {
+        // Opening '('
+        if (!consume_character(in_buf, '(')) {
+            return WITH_ERROR(-1, "Expected '('");
+        }
+    }
+    policy_node_t *parsed_node;
+
+    switch (token) {
+        case TOKEN_SH:
+        case TOKEN_WSH: {
+            if (token == TOKEN_SH) {
+                if (depth != 0) {
+                    return WITH_ERROR(-1, "sh can only be a top-level function");
+                }
+            } else if (token == TOKEN_WSH) {
+                if (depth != 0 && ((context_flags & CONTEXT_WITHIN_SH) == 0)) {
+                    return WITH_ERROR(-1, "wsh can only be top-level or inside sh");
+                }
+            }
+
+            policy_node_with_script_t *node =
+                (policy_node_with_script_t *) buffer_alloc(out_buf,
+                                                           sizeof(policy_node_with_script_t),
+                                                           true);
+            if (node == NULL) {
+                return WITH_ERROR(-1, "Out of memory");
+            }
+            parsed_node = (policy_node_t *) node;
+
+            node->base.type = token;
+
+            node->base.flags.is_miniscript = 0;
+
+            unsigned int inner_context_flags = context_flags;
+            inner_context_flags |= (token == TOKEN_SH) ? CONTEXT_WITHIN_SH : CONTEXT_WITHIN_WSH;
+
+            // the internal script is recursively parsed (if successful) in the current location
+            // of the output buffer
+            buffer_alloc(out_buf, 0, true);  // ensure alignment of current pointer
+            i_policy_node(&node->script, buffer_get_cur(out_buf));
+
+            if (0 > parse_script(in_buf, out_buf, version, depth + 1, inner_context_flags)) {
+                // failed while parsing internal script
+                return -1;
             }
 
-            node->base.type = token;
-            node->base.flags.is_miniscript = 1;
-            node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-            node->base.flags.miniscript_mod_z = 0;
-            node->base.flags.miniscript_mod_o = 1;
-            node->base.flags.miniscript_mod_n = 1;
-            node->base.flags.miniscript_mod_d = 1;
-            node->base.flags.miniscript_mod_u = 1;
             break;
         }
 
@@ -1365,89 +1891,6 @@ static int parse_script(buffer_t *in_buf,
 
             break;
         }
-        case TOKEN_PK:
-        case TOKEN_PKH:
-        case TOKEN_PK_K:
-        case TOKEN_PK_H:
-        case TOKEN_WPKH: {
-            policy_node_with_key_t *node =
-                (policy_node_with_key_t *) buffer_alloc(out_buf,
-                                                        sizeof(policy_node_with_key_t),
-                                                        true);
-            if (node == NULL) {
-                return WITH_ERROR(-1, "Out of memory");
-            }
-
-            policy_node_key_placeholder_t *key_placeholder =
-                buffer_alloc(out_buf, sizeof(policy_node_key_placeholder_t), true);
-
-            if (key_placeholder == NULL) {
-                return WITH_ERROR(-1, "Out of memory");
-            }
-            i_policy_node_key_placeholder(&node->key_placeholder, key_placeholder);
-
-            if (token == TOKEN_WPKH) {
-                if (depth > 0 && ((context_flags & CONTEXT_WITHIN_SH) == 0)) {
-                    return WITH_ERROR(-1, "wpkh can only be top-level or inside sh");
-                }
-            }
-
-            parsed_node = (policy_node_t *) node;
-
-            node->base.type = token;
-
-            if (0 > parse_placeholder(in_buf, version, key_placeholder)) {
-                return WITH_ERROR(-1, "Couldn't parse key placeholder");
-            }
-
-            if (token == TOKEN_WPKH) {
-                // not valid in miniscript
-                node->base.flags.is_miniscript = 0;
-            } else {
-                switch (token) {
-                    case TOKEN_PK:  // pk(key) == c:pk_k(key)
-                        node->base.flags.is_miniscript = 1;
-                        node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-                        node->base.flags.miniscript_mod_z = 0;
-                        node->base.flags.miniscript_mod_o = 1;
-                        node->base.flags.miniscript_mod_n = 1;
-                        node->base.flags.miniscript_mod_d = 1;
-                        node->base.flags.miniscript_mod_u = 1;
-                        break;
-                    case TOKEN_PKH:  // pkh(key) == c:pk_h(key)
-                        node->base.flags.is_miniscript = 1;
-                        node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-                        node->base.flags.miniscript_mod_z = 0;
-                        node->base.flags.miniscript_mod_o = 0;
-                        node->base.flags.miniscript_mod_n = 1;
-                        node->base.flags.miniscript_mod_d = 1;
-                        node->base.flags.miniscript_mod_u = 1;
-                        break;
-                    case TOKEN_PK_K:
-                        node->base.flags.is_miniscript = 1;
-                        node->base.flags.miniscript_type = MINISCRIPT_TYPE_K;
-                        node->base.flags.miniscript_mod_z = 0;
-                        node->base.flags.miniscript_mod_o = 1;
-                        node->base.flags.miniscript_mod_n = 1;
-                        node->base.flags.miniscript_mod_d = 1;
-                        node->base.flags.miniscript_mod_u = 1;
-                        break;
-                    case TOKEN_PK_H:
-                        node->base.flags.is_miniscript = 1;
-                        node->base.flags.miniscript_type = MINISCRIPT_TYPE_K;
-                        node->base.flags.miniscript_mod_z = 0;
-                        node->base.flags.miniscript_mod_o = 0;
-                        node->base.flags.miniscript_mod_n = 1;
-                        node->base.flags.miniscript_mod_d = 1;
-                        node->base.flags.miniscript_mod_u = 1;
-                        break;
-                    default:
-                        return WITH_ERROR(-1, "unreachable code reached");
-                }
-            }
-
-            break;
-        }
         case TOKEN_TR: {  // supporting only xpubs
             if (depth > 1) {
                 return WITH_ERROR(-1, "tr can only be top-level");
@@ -1481,168 +1924,36 @@ static int parse_script(buffer_t *in_buf,
                 buffer_alloc(out_buf, 0, true);  // ensure alignment of current pointer
                 policy_node_tree_t *tree = (policy_node_tree_t *) buffer_get_cur(out_buf);
                 if (0 > parse_tree(in_buf, out_buf, version, depth + 1)) {
-                    return WITH_ERROR(-1, "Failed to parse TREE expression");
-                }
-                i_policy_node_tree(&node->tree, tree);
-            } else {
-                // no TREE, only tr(KP)
-                if (c != ')') {
-                    return WITH_ERROR(-1, "Failed to parse tr");
-                }
-                i_policy_node_tree(&node->tree, NULL);
-            }
-
-            parsed_node = (policy_node_t *) node;
-
-            node->base.type = token;
-
-            node->base.flags.is_miniscript = 0;
-
-            break;
-        }
-        case TOKEN_OLDER:
-        case TOKEN_AFTER: {
-            policy_node_with_uint32_t *node =
-                (policy_node_with_uint32_t *) buffer_alloc(out_buf,
-                                                           sizeof(policy_node_with_uint32_t),
-                                                           true);
-            if (node == NULL) {
-                return WITH_ERROR(-1, "Out of memory");
-            }
-            parsed_node = (policy_node_t *) node;
-            node->base.type = token;
-
-            if (parse_unsigned_decimal(in_buf, &node->n) == -1) {
-                return WITH_ERROR(-1, "Error parsing number");
-            }
-
-            if (node->n < 1 || node->n >= (1u << 31)) {
-                return WITH_ERROR(-1, "n must satisfy 1 <= n < 2^31 in older/after");
-            }
-
-            node->base.flags.is_miniscript = 1;
-            node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-            node->base.flags.miniscript_mod_z = 1;
-            node->base.flags.miniscript_mod_o = 0;
-            node->base.flags.miniscript_mod_n = 0;
-            node->base.flags.miniscript_mod_d = 0;
-            node->base.flags.miniscript_mod_u = 0;
-
-            break;
-        }
-        case TOKEN_MULTI:
-        case TOKEN_MULTI_A:
-        case TOKEN_SORTEDMULTI:
-        case TOKEN_SORTEDMULTI_A: {
-            policy_node_multisig_t *node =
-                (policy_node_multisig_t *) buffer_alloc(out_buf,
-                                                        sizeof(policy_node_multisig_t),
-                                                        true);
-
-            if (node == NULL) {
-                return WITH_ERROR(-1, "Out of memory");
-            }
-
-            if ((context_flags & CONTEXT_WITHIN_TR) != 0) {
-                if (token != TOKEN_MULTI_A && token != TOKEN_SORTEDMULTI_A) {
-                    return WITH_ERROR(
-                        -1,
-                        "multi and sortedmulti can only be used in legacy or segwit scripts");
-                }
-            } else {  // legacy or segwit scripts
-                if (token != TOKEN_MULTI && token != TOKEN_SORTEDMULTI) {
-                    return WITH_ERROR(
-                        -1,
-                        "multi_a and sortedmulti_a can only be used in taproot scripts");
-                }
-            }
-
-            if (token == TOKEN_SORTEDMULTI) {
-                size_t n_sh_wrappers = 0;
-                if (context_flags & CONTEXT_WITHIN_SH) ++n_sh_wrappers;
-                if (context_flags & CONTEXT_WITHIN_WSH) ++n_sh_wrappers;
-
-                // sortedmulti can only be used bare, or directly under sh(), wsh()
-                if (depth != n_sh_wrappers) {
-                    return WITH_ERROR(-1,
-                                      "sortedmulti can only be bare, or directly under sh or wsh");
-                }
-            }
-
-            parsed_node = (policy_node_t *) node;
-            node->base.type = token;
-
-            uint32_t k;
-            if (parse_unsigned_decimal(in_buf, &k) == -1 || k > INT16_MAX) {
-                return WITH_ERROR(-1, "Error parsing threshold");
-            }
-            node->k = (int16_t) k;
-
-            // We allocate the array of key indices at the current position in the output buffer
-            // (on success)
-            buffer_alloc(out_buf, 0, true);  // ensure alignment of current pointer
-            i_policy_node_key_placeholder(&node->key_placeholders, buffer_get_cur(out_buf));
-
-            node->n = 0;
-            while (true) {
-                uint8_t c;
-                // If the next character is a ')', we exit and leave it in the buffer
-                if (buffer_peek(in_buf, &c) && c == ')') {
-                    break;
-                }
-
-                // otherwise, there must be a comma
-                if (!consume_character(in_buf, ',')) {
-                    return WITH_ERROR(-1, "Expected ','");
-                }
-
-                policy_node_key_placeholder_t *key_placeholder =
-                    (policy_node_key_placeholder_t *) buffer_alloc(
-                        out_buf,
-                        sizeof(policy_node_key_placeholder_t),
-                        true);  // we align this pointer, as there's padding in an array of
-                                // structures
-                if (key_placeholder == NULL) {
-                    return WITH_ERROR(-1, "Out of memory");
-                }
-
-                if (0 > parse_placeholder(in_buf, version, key_placeholder)) {
-                    return WITH_ERROR(-1, "Error parsing key placeholder");
-                }
-
-                ++node->n;
-            }
-
-            // check integrity of k and n
-            if (!(1 <= node->k && node->k <= node->n && node->n <= MAX_PUBKEYS_PER_MULTISIG)) {
-                return WITH_ERROR(-1, "Invalid k and/or n");
-            }
-
-            if (token == TOKEN_SORTEDMULTI || token == TOKEN_SORTEDMULTI_A) {
-                node->base.flags.is_miniscript = 0;
-            } else if (token == TOKEN_MULTI) {
-                node->base.flags.is_miniscript = 1;
-                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-                node->base.flags.miniscript_mod_z = 0;
-                node->base.flags.miniscript_mod_o = 0;
-                node->base.flags.miniscript_mod_n = 1;
-                node->base.flags.miniscript_mod_d = 1;
-                node->base.flags.miniscript_mod_u = 1;
-            } else if (token == TOKEN_MULTI_A) {
-                node->base.flags.is_miniscript = 1;
-                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-                node->base.flags.miniscript_mod_z = 0;
-                node->base.flags.miniscript_mod_o = 0;
-                node->base.flags.miniscript_mod_n = 0;
-                node->base.flags.miniscript_mod_d = 1;
-                node->base.flags.miniscript_mod_u = 1;
+                    return WITH_ERROR(-1, "Failed to parse TREE expression");
+                }
+                i_policy_node_tree(&node->tree, tree);
+            } else {
+                // no TREE, only tr(KP)
+                if (c != ')') {
+                    return WITH_ERROR(-1, "Failed to parse tr");
+                }
+                i_policy_node_tree(&node->tree, NULL);
             }
 
+            parsed_node = (policy_node_t *) node;
+
+            node->base.type = token;
+
+            node->base.flags.is_miniscript = 0;
+
             break;
         }
         default:
-            PRINTF("Unknown token: %d\n", token);
-            return -1;
+            if (0 > parse_leaf_fragment(in_buf,
+                                        out_buf,
+                                        version,
+                                        depth,
+                                        context_flags,
+                                        token,
+                                        &parsed_node)) {
+                return -1;
+            }
+            break;
     }
 
     if (has_parentheses) {
@@ -1662,171 +1973,8 @@ static int parse_script(buffer_t *in_buf,
     }
 
     // Validate and compute the flags (miniscript type and modifiers) for all the wrapper, if any
-    // We start from the most internal wrapper.
-    // Remark: This loop has quadratic complexity as we process a linked list in reverse order, but
-    // it does not matter as it is always a short list.
-
-    for (int i = n_wrappers - 1; i >= 0; i--) {
-        // find the actual node by traversing the list
-        policy_node_with_script_t *node = (policy_node_with_script_t *) outermost_node;
-        for (int j = 0; j < i; j++) {
-            node = (policy_node_with_script_t *) r_policy_node(&node->script);
-        }
-
-        if (!r_policy_node(&node->script)->flags.is_miniscript) {
-            return WITH_ERROR(-1, "wrappers can only be applied to miniscript");
-        }
-
-        const policy_node_t *X = r_policy_node(&node->script);
-
-        uint8_t X_type = X->flags.miniscript_type;
-
-        uint8_t X_z = X->flags.miniscript_mod_z;
-        uint8_t X_o = X->flags.miniscript_mod_o;
-        uint8_t X_n = X->flags.miniscript_mod_n;
-        uint8_t X_d = X->flags.miniscript_mod_d;
-        uint8_t X_u = X->flags.miniscript_mod_u;
-
-        switch (node->base.type) {
-            case TOKEN_A:
-                if (X_type != MINISCRIPT_TYPE_B) {
-                    return WITH_ERROR(-1, "'a' wrapper requires a B type child");
-                }
-
-                node->base.flags.is_miniscript = 1;
-                node->base.flags.miniscript_type = MINISCRIPT_TYPE_W;
-                node->base.flags.miniscript_mod_z = 0;
-                node->base.flags.miniscript_mod_o = 0;
-                node->base.flags.miniscript_mod_n = 0;
-                node->base.flags.miniscript_mod_d = X_d;
-                node->base.flags.miniscript_mod_u = X_u;
-                break;
-            case TOKEN_S:
-                if (X_type != MINISCRIPT_TYPE_B || !X_o) {
-                    return WITH_ERROR(-1, "'s' wrapper requires a Bu type child");
-                }
-
-                node->base.flags.is_miniscript = 1;
-                node->base.flags.miniscript_type = MINISCRIPT_TYPE_W;
-                node->base.flags.miniscript_mod_z = 0;
-                node->base.flags.miniscript_mod_o = 0;
-                node->base.flags.miniscript_mod_n = 0;
-                node->base.flags.miniscript_mod_d = X_d;
-                node->base.flags.miniscript_mod_u = X_u;
-                break;
-            case TOKEN_C:
-                if (X_type != MINISCRIPT_TYPE_K) {
-                    return WITH_ERROR(-1, "'c' wrapper requires a K type child");
-                }
-
-                node->base.flags.is_miniscript = 1;
-                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-                node->base.flags.miniscript_mod_z = 0;
-                node->base.flags.miniscript_mod_o = X_o;
-                node->base.flags.miniscript_mod_n = X_n;
-                node->base.flags.miniscript_mod_d = X_d;
-                node->base.flags.miniscript_mod_u = 1;
-                break;
-            case TOKEN_T:
-                // t:X == and_v(X,1)
-
-                if (X_type != MINISCRIPT_TYPE_V) {
-                    return WITH_ERROR(-1, "'t' wrapper requires a V type child");
-                }
-
-                node->base.flags.is_miniscript = 1;
-                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-                node->base.flags.miniscript_mod_z = X_z;
-                node->base.flags.miniscript_mod_o = X_o;
-                node->base.flags.miniscript_mod_n = X_n;
-                node->base.flags.miniscript_mod_d = 0;
-                node->base.flags.miniscript_mod_u = 1;
-                break;
-            case TOKEN_D:
-                if (X_type != MINISCRIPT_TYPE_V || !X_z) {
-                    return WITH_ERROR(-1, "'d' wrapper requires a Vz type child");
-                }
-
-                node->base.flags.is_miniscript = 1;
-                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-                node->base.flags.miniscript_mod_z = 0;
-                node->base.flags.miniscript_mod_o = 1;
-                node->base.flags.miniscript_mod_n = 1;
-                node->base.flags.miniscript_mod_d = 1;
-                node->base.flags.miniscript_mod_u = (context_flags & CONTEXT_WITHIN_TR) ? 1 : 0;
-                break;
-            case TOKEN_V:
-                if (X_type != MINISCRIPT_TYPE_B) {
-                    return WITH_ERROR(-1, "'v' wrapper requires a B type child");
-                }
-
-                node->base.flags.is_miniscript = 1;
-                node->base.flags.miniscript_type = MINISCRIPT_TYPE_V;
-                node->base.flags.miniscript_mod_z = X_z;
-                node->base.flags.miniscript_mod_o = X_o;
-                node->base.flags.miniscript_mod_n = X_n;
-                node->base.flags.miniscript_mod_d = 0;
-                node->base.flags.miniscript_mod_u = 0;
-                break;
-            case TOKEN_J:
-                if (X_type != MINISCRIPT_TYPE_B || !X_n) {
-                    return WITH_ERROR(-1, "'j' wrapper requires a Bn type child");
-                }
-
-                node->base.flags.is_miniscript = 1;
-                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-                node->base.flags.miniscript_mod_z = 0;
-                node->base.flags.miniscript_mod_o = X_o;
-                node->base.flags.miniscript_mod_n = 1;
-                node->base.flags.miniscript_mod_d = 1;
-                node->base.flags.miniscript_mod_u = X_u;
-                break;
-            case TOKEN_N:
-                if (X_type != MINISCRIPT_TYPE_B) {
-                    return WITH_ERROR(-1, "'n' wrapper requires a B type child");
-                }
-
-                node->base.flags.is_miniscript = 1;
-                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-                node->base.flags.miniscript_mod_z = X_z;
-                node->base.flags.miniscript_mod_o = X_o;
-                node->base.flags.miniscript_mod_n = X_n;
-                node->base.flags.miniscript_mod_d = X_d;
-                node->base.flags.miniscript_mod_u = 1;
-                break;
-            case TOKEN_L:
-                // l:X == or_i(0,X)
-
-                if (X_type != MINISCRIPT_TYPE_B) {
-                    return WITH_ERROR(-1, "'l' wrapper requires a B type child");
-                }
-
-                node->base.flags.is_miniscript = 1;
-                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-                node->base.flags.miniscript_mod_z = 0;
-                node->base.flags.miniscript_mod_o = X_z;
-                node->base.flags.miniscript_mod_n = 0;
-                node->base.flags.miniscript_mod_d = 1;
-                node->base.flags.miniscript_mod_u = X_u;
-                break;
-            case TOKEN_U:
-                // u:X == or_i(X,0)
-
-                if (X_type != MINISCRIPT_TYPE_B) {
-                    return WITH_ERROR(-1, "'u' wrapper requires a B type child");
-                }
-
-                node->base.flags.is_miniscript = 1;
-                node->base.flags.miniscript_type = MINISCRIPT_TYPE_B;
-                node->base.flags.miniscript_mod_z = 0;
-                node->base.flags.miniscript_mod_o = X_z;
-                node->base.flags.miniscript_mod_n = 0;
-                node->base.flags.miniscript_mod_d = 1;
-                node->base.flags.miniscript_mod_u = X_u;
-                break;
-            default:
-                return WITH_ERROR(-1, "unreachable code reached");
-        }
+    if (0 > compute_wrappers_flags(outermost_node, n_wrappers, context_flags)) {
+        return -1;
     }
 
     return 0;
@@ -1921,6 +2069,132 @@ int parse_descriptor_template(buffer_t *in_buf, void *out, size_t out_len, int v
     return (int) out_buf.offset;
 }
 
+// The parsed descriptor templates of the default wallet policies, laid out like the output of
+// parse_descriptor_template: each node is followed by its children, at 4-byte aligned offsets.
+// None of them is within wsh or tr, so there is no miniscript ext info to precompute.
+
+// offset of the relative pointer at field `from` to the field `to` of a struct of the given type
+#define REL_OFFSET(type, from, to) ((uint16_t) (offsetof(type, to) - offsetof(type, from)))
+
+#define DEFAULT_KEY_PLACEHOLDER {.num_first = 0, .num_second = 1, .key_index = 0}
+
+// pkh(@0/**) and wpkh(@0/**)
+typedef struct {
+    policy_node_with_key_t node;
+    policy_node_key_placeholder_t key_placeholder;
+} parsed_with_key_t;
+
+// sh(wpkh(@0/**))
+typedef struct {
+    policy_node_with_script_t node;
+    parsed_with_key_t script;
+} parsed_sh_wpkh_t;
+
+// tr(@0/**)
+typedef struct {
+    policy_node_tr_t node;
+    policy_node_key_placeholder_t key_placeholder;
+} parsed_tr_t;
+
+static const parsed_with_key_t parsed_pkh = {
+    // pkh(key) == c:pk_h(key), with the same flags as in parse_script
+    .node = {.base = {.type = TOKEN_PKH,
+                      .flags = {.is_miniscript = 1,
+                                .miniscript_type = MINISCRIPT_TYPE_B,
+                                .miniscript_mod_n = 1,
+                                .miniscript_mod_d = 1,
+                                .miniscript_mod_u = 1}},
+             .key_placeholder = {REL_OFFSET(parsed_with_key_t,
+                                            node.key_placeholder,
+                                            key_placeholder)}},
+    .key_placeholder = DEFAULT_KEY_PLACEHOLDER};
+
+static const parsed_sh_wpkh_t parsed_sh_wpkh = {
+    .node = {.base = {.type = TOKEN_SH},
+             .script = {REL_OFFSET(parsed_sh_wpkh_t, node.script, script)}},
+    .script = {.node = {.base = {.type = TOKEN_WPKH},
+                        .key_placeholder = {REL_OFFSET(parsed_with_key_t,
+                                                       node.key_placeholder,
+                                                       key_placeholder)}},
+               .key_placeholder = DEFAULT_KEY_PLACEHOLDER}};
+
+static const parsed_with_key_t parsed_wpkh = {
+    .node = {.base = {.type = TOKEN_WPKH},
+             .key_placeholder = {REL_OFFSET(parsed_with_key_t,
+                                            node.key_placeholder,
+                                            key_placeholder)}},
+    .key_placeholder = DEFAULT_KEY_PLACEHOLDER};
+
+static const parsed_tr_t parsed_tr = {
+    .node = {.base = {.type = TOKEN_TR},
+             .key_placeholder = {REL_OFFSET(parsed_tr_t, node.key_placeholder, key_placeholder)},
+             .tree = {0}},
+    .key_placeholder = DEFAULT_KEY_PLACEHOLDER};
+
+static const struct {
+    const char *descriptor_template;
+    uint8_t descriptor_template_sha256[32];
+    const void *parsed;
+    size_t parsed_len;
+} default_descriptor_templates[] = {
+    {"pkh(@0/**)",
+     {0x36, 0x49, 0x95, 0xf0, 0x4a, 0x20, 0x0b, 0xdc, 0xf0, 0x89, 0x57, 0x2f,
+      0x9a, 0x98, 0x4c, 0x3b, 0xac, 0x20, 0xcf, 0x0e, 0x3a, 0x19, 0x15, 0x8d,
+      0x4d, 0x15, 0x53, 0x3a, 0xe1, 0x2e, 0x11, 0x0c},
+     &parsed_pkh,
+     sizeof(parsed_pkh)},
+    {"sh(wpkh(@0/**))",
+     {0x5a, 0xb1, 0xbe, 0xd3, 0x0e, 0xc2, 0x7c, 0x4f, 0xdc, 0x3b, 0xa1, 0x13,
+      0x6d, 0xd4, 0x8b, 0xd3, 0x38, 0xab, 0xbc, 0x9c, 0x8a, 0xcb, 0xe2, 0x9e,
+      0x35, 0x0d, 0x45, 0x13, 0x7f, 0x9a, 0x4c, 0x46},
+     &parsed_sh_wpkh,
+     sizeof(parsed_sh_wpkh)},
+    {"wpkh(@0/**)",
+     {0xc8, 0x97, 0x4a, 0x0d, 0x8b, 0xdd, 0x29, 0x02, 0x4b, 0x2d, 0xdb, 0x7a,
+      0x7f, 0xe8, 0xdf, 0x1d, 0x98, 0x01, 0xb2, 0x70, 0xf4, 0xe6, 0xc1, 0xe7,
+      0xe1, 0x01, 0x1a, 0xe3, 0x9e, 0x7c, 0x9b, 0x00},
+     &parsed_wpkh,
+     sizeof(parsed_wpkh)},
+    {"tr(@0/**)",
+     {0x7c, 0x54, 0xd8, 0xc8, 0xcd, 0x3b, 0xac, 0x81, 0xab, 0xf5, 0x64, 0x63,
+      0xd3, 0xd3, 0xed, 0x2e, 0xfa, 0x94, 0xaf, 0xd9, 0x67, 0x87, 0x07, 0xfc,
+      0xd6, 0x8a, 0x4c, 0x99, 0x0a, 0x71, 0xea, 0x6b},
+     &parsed_tr,
+     sizeof(parsed_tr)},
+};
+
+int get_default_descriptor_template(const uint8_t descriptor_template_sha256[static 32],
+                                    size_t descriptor_template_len,
+                                    uint8_t *descriptor_template,
+                                    size_t descriptor_template_out_len,
+                                    void *out,
+                                    size_t out_len) {
+    if ((unsigned long) out % 4 != 0) {
+        return WITH_ERROR(-1, "Unaligned pointer");
+    }
+
+    for (size_t i = 0;
+         i < sizeof(default_descriptor_templates) / sizeof(default_descriptor_templates[0]);
+         i++) {
+        const char *descriptor =
+            (const char *) PIC(default_descriptor_templates[i].descriptor_template);
+        size_t parsed_len = default_descriptor_templates[i].parsed_len;
+        if (memcmp(default_descriptor_templates[i].descriptor_template_sha256,
+                   descriptor_template_sha256,
+                   32) != 0 ||
+            strlen(descriptor) != descriptor_template_len) {
+            continue;
+        }
+        if (descriptor_template_len > descriptor_template_out_len || parsed_len > out_len) {
+            return -1;
+        }
+        memcpy(descriptor_template, descriptor, descriptor_template_len);
+        memcpy(out, PIC(default_descriptor_templates[i].parsed), parsed_len);
+        return (int) parsed_len;
+    }
+    return -1;
+}
+
 int get_policy_segwit_version(const policy_node_t *policy) {
     if (policy->type == TOKEN_TR) {
         return 1;
@@ -1969,76 +2243,96 @@ static int16_t maxcheck(int16_t a, int16_t b) {
 // Maximum supported value for n in a thresh miniscript operator (technical limitation)
 #define MAX_N_IN_THRESH 128
 
-static int compute_thresh_ops(const policy_node_thresh_t *node,
-                              miniscript_ops_t *out,
-                              MiniscriptContext ctx) {
-    uint16_t sats[MAX_N_IN_THRESH + 1 + 1] = {0};
-    uint16_t next_sats[MAX_N_IN_THRESH + 1 + 1] = {0};  // it temporarily uses an extra element
+/**
+ * Computes the extended info of a thresh node. Each child is analysed once: its flags, script size,
+ * ops count and stack size are all accumulated in the same pass, so that nesting thresh fragments
+ * does not analyse the same subtrees multiple times.
+ * The ops and stack size use the same dynamic programming: after i children, sats[j] is the best
+ * value to satisfy exactly j of them, and dissatisfy the others. The arrays are updated in place,
+ * from the last element down, so that sats[j - 1] is still the value for the previous children.
+ * out must be initialized as in compute_miniscript_policy_ext_info.
+ */
+static int __attribute__((noinline)) compute_thresh_ext_info(const policy_node_thresh_t *node,
+                                                             policy_node_ext_info_t *out,
+                                                             MiniscriptContext ctx) {
+    uint16_t ops_sats[MAX_N_IN_THRESH + 1] = {0};
+    uint16_t ss_sats[MAX_N_IN_THRESH + 1] = {0};
 
     if (node->n > MAX_N_IN_THRESH) return -1;
 
     policy_node_scriptlist_t *cur = r_policy_node_scriptlist(&node->scriptlist);
 
-    out->count = 0;
-
-    sats[0] = 0;
-    int sats_size = 1;
-
+    int count_s = 0;
+    int count_e = 0;
+    int count_m = 0;
+    size_t children_scriptsize = 0;
+    size_t n_children = 0;
     while (cur != NULL) {
-        policy_node_ext_info_t t;
-        if (0 > compute_miniscript_policy_ext_info(r_policy_node(&cur->script), &t, ctx)) return -1;
+        ++n_children;
 
-        out->count += t.ops.count + 1;
+        policy_node_ext_info_t t;
+        if (0 > compute_miniscript_policy_ext_info(r_policy_node(&cur->script), &t, ctx))
+            return -1;
 
-        next_sats[0] = sumcheck(sats[0], t.ops.dsat);
-        for (int j = 1; j < sats_size; j++) {
-            next_sats[j] =
-                maxcheck(sumcheck(sats[j], t.ops.dsat), sumcheck(sats[j - 1], t.ops.sat));
+        if (t.e) {
+            ++count_e;
+        }
+        if (t.s) {
+            ++count_s;
+        }
+        if (t.m) {
+            ++count_m;
         }
-        next_sats[sats_size] = sumcheck(sats[sats_size - 1], t.ops.sat);
 
-        ++sats_size;
-        memmove(sats, next_sats, sats_size * sizeof(sats[0]));
+        out->g |= t.g;
+        out->h |= t.h;
+        out->i |= t.i;
+        out->j |= t.j;
 
-        cur = r_policy_node_scriptlist(&cur->next);
-    }
+        out->k &= t.k;  // if any child doesn't have k, thresh doesn't have k
 
-    out->sat = sats[node->k];
-    out->dsat = sats[0];
-    return 0;
-}
+        // if any two children have mixed timelocks, thresh doesn't have k
+        if (node->k >= 2 &&
+            ((t.g & out->h) || (t.h & out->g) || (t.i & out->j) || (t.j & out->i))) {
+            out->k = 0;
+        }
 
-static int compute_thresh_stacksize(const policy_node_thresh_t *node,
-                                    miniscript_stacksize_t *out,
-                                    MiniscriptContext ctx) {
-    uint16_t sats[MAX_N_IN_THRESH + 1 + 1] = {0};
-    uint16_t next_sats[MAX_N_IN_THRESH + 1 + 1] = {0};  // it temporarily uses an extra element
+        children_scriptsize += t.script_size;
 
-    if (node->n > MAX_N_IN_THRESH) return -1;
+        out->ops.count += t.ops.count + 1;
 
-    policy_node_scriptlist_t *cur = r_policy_node_scriptlist(&node->scriptlist);
+        // n_children - 1 children were processed before this one
+        size_t last = n_children;
+        ops_sats[last] = sumcheck(ops_sats[last - 1], t.ops.sat);
+        ss_sats[last] = sumcheck(ss_sats[last - 1], t.ss.sat);
+        for (size_t j = last - 1; j >= 1; j--) {
+            ops_sats[j] = maxcheck(sumcheck(ops_sats[j], t.ops.dsat),
+                                   sumcheck(ops_sats[j - 1], t.ops.sat));
+            ss_sats[j] =
+                maxcheck(sumcheck(ss_sats[j], t.ss.dsat), sumcheck(ss_sats[j - 1], t.ss.sat));
+        }
+        ops_sats[0] = sumcheck(ops_sats[0], t.ops.dsat);
+        ss_sats[0] = sumcheck(ss_sats[0], t.ss.dsat);
 
-    sats[0] = 0;
-    int sats_size = 1;
+        cur = r_policy_node_scriptlist(&cur->next);
+    }
 
-    while (cur != NULL) {
-        policy_node_ext_info_t t;
-        if (0 > compute_miniscript_policy_ext_info(r_policy_node(&cur->script), &t, ctx)) return -1;
+    int count_not_s = node->n - count_s;
 
-        next_sats[0] = sumcheck(sats[0], t.ss.dsat);
-        for (int j = 1; j < sats_size; j++) {
-            next_sats[j] = maxcheck(sumcheck(sats[j], t.ss.dsat), sumcheck(sats[j - 1], t.ss.sat));
-        }
-        next_sats[sats_size] = sumcheck(sats[sats_size - 1], t.ss.sat);
+    out->s = count_not_s <= node->k - 1 ? 1 : 0;
+    out->e = count_s == node->n ? 1 : 0;
 
-        ++sats_size;
-        memmove(sats, next_sats, sats_size * sizeof(sats[0]));
+    out->m = (count_e == node->n && count_not_s <= node->k) ? 1 : 0;
 
-        cur = r_policy_node_scriptlist(&cur->next);
-    }
+    out->x = 0;
+
+    out->script_size = children_scriptsize + n_children + get_push_script_size(node->k);
+
+    out->ops.sat = ops_sats[node->k];
+    out->ops.dsat = ops_sats[0];
+    out->ss.sat = ss_sats[node->k];
+    out->ss.dsat = ss_sats[0];
 
-    out->sat = sats[node->k];
-    out->dsat = sats[0];
     return 0;
 }
 
@@ -2491,63 +2785,7 @@ int compute_miniscript_policy_ext_info(const policy_node_t *policy_node,
         }
         case TOKEN_THRESH: {
             const policy_node_thresh_t *node = (const policy_node_thresh_t *) policy_node;
-
-            policy_node_scriptlist_t *cur = r_policy_node_scriptlist(&node->scriptlist);
-
-            int count_s = 0;
-            int count_e = 0;
-            int count_m = 0;
-            size_t children_scriptsize = 0;
-            size_t n_children = 0;
-            while (cur != NULL) {
-                ++n_children;
-
-                policy_node_ext_info_t t;
-                if (0 > compute_miniscript_policy_ext_info(r_policy_node(&cur->script), &t, ctx))
-                    return -1;
-
-                if (t.e) {
-                    ++count_e;
-                }
-                if (t.s) {
-                    ++count_s;
-                }
-                if (t.m) {
-                    ++count_m;
-                }
-                cur = r_policy_node_scriptlist(&cur->next);
-
-                out->g |= t.g;
-                out->h |= t.h;
-                out->i |= t.i;
-                out->j |= t.j;
-
-                out->k &= t.k;  // if any child doesn't have k, thresh doesn't have k
-
-                // if any two children have mixed timelocks, thresh doesn't have k
-                if (node->k >= 2 &&
-                    ((t.g & out->h) || (t.h & out->g) || (t.i & out->j) || (t.j & out->i))) {
-                    out->k = 0;
-                }
-
-                children_scriptsize += t.script_size;
-            }
-
-            int count_not_s = node->n - count_s;
-
-            out->s = count_not_s <= node->k - 1 ? 1 : 0;
-            out->e = count_s == node->n ? 1 : 0;
-
-            out->m = (count_e == node->n && count_not_s <= node->k) ? 1 : 0;
-
-            out->x = 0;
-
-            out->script_size = children_scriptsize + n_children + get_push_script_size(node->k);
-
-            if (0 > compute_thresh_ops(node, &out->ops, ctx)) return -1;
-            if (0 > compute_thresh_stacksize(node, &out->ss, ctx)) return -1;
-
-            return 0;
+            return compute_thresh_ext_info(node, out, ctx);
         }
         case TOKEN_A: {
             const policy_node_with_script_t *node = (const policy_node_with_script_t *) policy_node;
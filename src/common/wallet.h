@@ -22,6 +22,10 @@
 #define WALLET_POLICY_VERSION_V1 1  // the legacy version of the first release
 #define WALLET_POLICY_VERSION_V2 2  // the current full version
 
+// Set in the version byte of a V2 wallet policy serialized with its descriptor template and its
+// keys information inline, instead of their commitments. It is never part of the wallet id.
+#define WALLET_POLICY_INLINE_FLAG 0x80
+
 // The string describing a pubkey can contain:
 // - (optional) the key origin info, which we limit to 46 bytes (2 + 8 + 3*12 = 46 bytes)
 // - the xpub itself (up to 113 characters)
@@ -71,6 +75,11 @@
 // keys_merkle_root (32 bytes)
 #define MAX_WALLET_POLICY_SERIALIZED_LENGTH_V2 (1 + 1 + MAX_WALLET_NAME_LENGTH + 9 + 32 + 9 + 32)
 
+// The inline form of V2 replaces the sha256 of the descriptor template with the template itself,
+// and the Merkle root of the keys information with the list of the keys information, each prefixed
+// with its length (varint). It is only accepted where the serialized wallet policy is part of the
+// data of the command (see read_and_parse_wallet_policy), so it is bounded by the APDU length.
+
 #define MAX_WALLET_POLICY_SERIALIZED_LENGTH \
     MAX(MAX_WALLET_POLICY_SERIALIZED_LENGTH_V1, MAX_WALLET_POLICY_SERIALIZED_LENGTH_V2)
 
@@ -450,6 +459,28 @@ int parse_policy_map_key_info(buffer_t *buffer, policy_map_key_info_t *out, int
  */
 int parse_descriptor_template(buffer_t *in_buf, void *out, size_t out_len, int version);
 
+/**
+ * Looks up the descriptor template with the given sha256 and length among the ones of the default
+ * wallet policies (pkh(@0/**), sh(wpkh(@0/**)), wpkh(@0/**) and tr(@0/**), in V2), that are stored
+ * in flash already parsed. If found, it is copied to descriptor_template, and its parsed form (the
+ * same as the output of parse_descriptor_template) is copied to out.
+ *
+ * @param descriptor_template_sha256 the sha256 of the descriptor template, as in the V2 header
+ * @param descriptor_template_len the length of the descriptor template, as in the header
+ * @param descriptor_template a buffer that receives the descriptor template
+ * @param descriptor_template_out_len the size of descriptor_template
+ * @param out a 4-byte aligned buffer that receives the parsed descriptor template
+ * @param out_len the size of out
+ * @return the memory size of the parsed descriptor template, or -1 if it is not a default one, or
+ * it does not fit in the buffers.
+ */
+int get_default_descriptor_template(const uint8_t descriptor_template_sha256[static 32],
+                                    size_t descriptor_template_len,
+                                    uint8_t *descriptor_template,
+                                    size_t descriptor_template_out_len,
+                                    void *out,
+                                    size_t out_len);
+
 /**
  * Given a valid policy that the bitcoin app is able to sign, returns the segwit version.
  * The result is undefined for a node that is not a valid root of a wallet policy that the bitcoin
@@ -8,7 +8,83 @@
 /**
  * Encodes the protocol version, which is passed in the p2 field of APDUs.
  */
-#define CURRENT_PROTOCOL_VERSION 1
+#define CURRENT_PROTOCOL_VERSION 10
+
+/**
+ * First protocol version where the response to a client command can be split across several
+ * CONTINUE APDUs.
+ */
+#define PROTOCOL_VERSION_EXTENDED_CONTINUE 2
+
+/**
+ * First protocol version where the client supports CCMD_GET_MERKLE_LEAF_ELEMENT; older clients
+ * are sent a CCMD_GET_MERKLE_LEAF_PROOF followed by a CCMD_GET_PREIMAGE instead.
+ */
+#define PROTOCOL_VERSION_MERKLE_LEAF_ELEMENT 2
+
+/**
+ * First protocol version where the client supports CCMD_GET_MERKLE_LEAF_RANGE; older clients are
+ * asked for each leaf of the range separately.
+ */
+#define PROTOCOL_VERSION_MERKLE_LEAF_RANGE 2
+
+/**
+ * First protocol version where the client supports CCMD_HINT_MERKLE_LEAVES; older clients are not
+ * sent any hint.
+ */
+#define PROTOCOL_VERSION_HINT_MERKLE_LEAVES 2
+
+/**
+ * First protocol version where a single YIELD message of SIGN_PSBT can contain multiple signatures.
+ */
+#define PROTOCOL_VERSION_BATCHED_YIELD 3
+
+/**
+ * First protocol version where SIGN_PSBT can request the serialized outputs of the transaction as
+ * a preimage, in order to compute the sighash of legacy inputs.
+ */
+#define PROTOCOL_VERSION_OUTPUTS_PREIMAGE 4
+
+/**
+ * First protocol version where the client supports the MULTI_REQUEST client command (0x47), that
+ * the app does not send.
+ */
+#define PROTOCOL_VERSION_MULTI_REQUEST 5
+
+/**
+ * First protocol version where the client supports CCMD_GET_MERKLEIZED_MAP_VALUES; older clients
+ * are asked for the index and the value of each key separately.
+ */
+#define PROTOCOL_VERSION_MERKLEIZED_MAP_VALUES 5
+
+/**
+ * First protocol version where a response that does not fit in a single APDU is split across
+ * several APDUs, that the client reads with INS_GET_RESPONSE.
+ */
+#define PROTOCOL_VERSION_CHAINED_RESPONSE 6
+
+/**
+ * First protocol version where the client chooses the number of chunks in each leaf of the Merkle
+ * tree of a message or of a withdrawal, with a byte following the BIP32 path of the command.
+ */
+#define PROTOCOL_VERSION_CHUNKS_PER_LEAF 7
+
+/**
+ * First protocol version where REGISTER_WALLET accepts a V2 wallet policy serialized with its
+ * descriptor template and its keys information inline (see WALLET_POLICY_INLINE_FLAG).
+ */
+#define PROTOCOL_VERSION_INLINE_WALLET_POLICY 8
+
+/**
+ * First protocol version where the client supports CCMD_GET_MERKLE_LEAF_HASHES.
+ */
+#define PROTOCOL_VERSION_MERKLE_LEAF_HASHES 9
+
+/**
+ * First protocol version where a YIELD message can be sent in the same response as the next client
+ * command, prefixed with CCMD_DEFERRED_YIELD.
+ */
+#define PROTOCOL_VERSION_DEFERRED_YIELD 10
 
 /**
  * Maximum length of a serialized address (in characters).
@@ -46,11 +122,33 @@
  */
 #define MAX_N_INPUTS_CAN_SIGN 512
 
+/**
+ * Maximum number of inputs of a transaction signed with a checkpoint, in several SIGN_PSBT commands
+ * that each sign at most MAX_N_INPUTS_CAN_SIGN of them.
+ */
+#define MAX_N_INPUTS_CAN_CHECKPOINT 4096
+
+/**
+ * Maximum number of PSBTs signed by a single SIGN_PSBT command in batch mode.
+ */
+#define MAX_N_PSBTS_IN_BATCH 32
+
+/**
+ * Maximum number of withdrawal payloads signed by a single SIGN_WITHDRAW command.
+ */
+#define MAX_WITHDRAW_BATCH_SIZE 4
+
 /**
  * Maximum number of outputs supported while signing a transaction.
  */
 #define MAX_N_OUTPUTS_CAN_SIGN 512
 
+/**
+ * Maximum number of 64-byte chunks in each leaf of the Merkle tree of a message or of a
+ * withdrawal, so that a leaf still fits in the response to a single CONTINUE APDU.
+ */
+#define MAX_CHUNKS_PER_LEAF 3
+
 // ERC4361 message constants
 #define MESSAGE_CHUNK_SIZE  64
 #define MAX_DOMAIN_LENGTH   64
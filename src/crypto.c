@@ -39,6 +39,13 @@
 
 #include "crypto.h"
 
+#ifdef HAVE_XPUB_CACHE
+#include "handler/lib/xpub_cache.h"
+#endif
+
+// Number of blocks compressed by a one-shot SHA-256 of len bytes, including the padding
+#define SHA256_N_BLOCKS(len) (((len) + 9 + 63) / 64)
+
 /**
  * Generator for secp256k1, value 'g' defined in "Standards for Efficient Cryptography"
  * (SEC2) 2.7.1.
@@ -77,39 +84,135 @@ static const uint8_t secp256k1_sqr_exponent[] = {
 static const uint8_t BIP0341_taptweak_tag[] = {'T', 'a', 'p', 'T', 'w', 'e', 'a', 'k'};
 static const uint8_t BIP0341_tapbranch_tag[] = {'T', 'a', 'p', 'B', 'r', 'a', 'n', 'c', 'h'};
 static const uint8_t BIP0341_tapleaf_tag[] = {'T', 'a', 'p', 'L', 'e', 'a', 'f'};
+static const uint8_t BIP0341_tapsighash_tag[] = {'T', 'a', 'p', 'S', 'i', 'g', 'h', 'a', 's', 'h'};
+
+// A tagged hash context that already absorbed the SHA256(tag) || SHA256(tag) prefix. As the prefix
+// is exactly one SHA256 block, it is computed at most once per tag while the app is running, and
+// then copied to initialize each new tagged hash.
+typedef struct {
+    const uint8_t *tag;
+    uint16_t tag_len;
+    bool is_initialized;
+    cx_sha256_t context;
+} tagged_hash_midstate_t;
+
+static tagged_hash_midstate_t G_taptweak_midstate = {.tag = BIP0341_taptweak_tag,
+                                                     .tag_len = sizeof(BIP0341_taptweak_tag)};
+static tagged_hash_midstate_t G_tapbranch_midstate = {.tag = BIP0341_tapbranch_tag,
+                                                      .tag_len = sizeof(BIP0341_tapbranch_tag)};
+static tagged_hash_midstate_t G_tapleaf_midstate = {.tag = BIP0341_tapleaf_tag,
+                                                    .tag_len = sizeof(BIP0341_tapleaf_tag)};
+static tagged_hash_midstate_t G_tapsighash_midstate = {.tag = BIP0341_tapsighash_tag,
+                                                       .tag_len = sizeof(BIP0341_tapsighash_tag)};
 
 /**
  * Gets the point on the SECP256K1 that corresponds to kG, where G is the curve's generator point.
  * Returns -1 if point is Infinity or any error occurs; 0 otherwise.
  */
 static int secp256k1_point(const uint8_t k[static 32], uint8_t out[static 65]) {
+    PERF_COUNT_CRYPTO(PERF_CRYPTO_SCALAR_MULT, 1);
     memcpy(out, secp256k1_generator, 65);
     if (CX_OK != cx_ecfp_scalar_mult_no_throw(CX_CURVE_SECP256K1, out, k, 32)) return -1;
     return 0;
 }
 
-int bip32_CKDpub(const serialized_extended_pubkey_t *parent,
-                 uint32_t index,
-                 serialized_extended_pubkey_t *child) {
+// The HMAC-SHA512 contexts keyed with a chain code: the SHA-512 contexts that absorbed the block of
+// the key xor'ed with the inner pad, and with the outer pad. Cloning them saves two of the four
+// SHA-512 compressions of each HMAC.
+typedef struct {
+    uint8_t chain_code[32];
+    bool is_valid;
+    cx_sha512_t inner;
+    cx_sha512_t outer;
+} ckdpub_hmac_state_t;
+
+static ckdpub_hmac_state_t G_ckdpub_hmac_states[CKDPUB_HMAC_CACHE_SIZE];
+static size_t G_ckdpub_hmac_next_state;
+
+#define HMAC_SHA512_BLOCK_SIZE 128
+#define HMAC_IPAD              0x36
+#define HMAC_OPAD              0x5c
+
+// Returns the keyed state for the chain code, computing it in place of the oldest one if it is not
+// cached, or NULL on failure.
+static const ckdpub_hmac_state_t *get_ckdpub_hmac_state(const uint8_t chain_code[static 32]) {
+    for (size_t i = 0; i < CKDPUB_HMAC_CACHE_SIZE; i++) {
+        const ckdpub_hmac_state_t *state = &G_ckdpub_hmac_states[i];
+        if (state->is_valid && memcmp(state->chain_code, chain_code, 32) == 0) {
+            return state;
+        }
+    }
+
+    ckdpub_hmac_state_t *state = &G_ckdpub_hmac_states[G_ckdpub_hmac_next_state];
+    G_ckdpub_hmac_next_state = (G_ckdpub_hmac_next_state + 1) % CKDPUB_HMAC_CACHE_SIZE;
+
+    uint8_t pad[HMAC_SHA512_BLOCK_SIZE];
+    memset(pad, HMAC_IPAD, sizeof(pad));
+    for (size_t i = 0; i < 32; i++) {
+        pad[i] ^= chain_code[i];
+    }
+    state->is_valid = CX_OK == cx_sha512_init_no_throw(&state->inner) &&
+                      CX_OK == crypto_hash_update(&state->inner.header, pad, sizeof(pad));
+
+    for (size_t i = 0; i < sizeof(pad); i++) {
+        pad[i] ^= HMAC_IPAD ^ HMAC_OPAD;
+    }
+    state->is_valid = state->is_valid && CX_OK == cx_sha512_init_no_throw(&state->outer) &&
+                      CX_OK == crypto_hash_update(&state->outer.header, pad, sizeof(pad));
+
+    if (!state->is_valid) {
+        return NULL;
+    }
+    memcpy(state->chain_code, chain_code, 32);
+    return state;
+}
+
+// HMAC-SHA512 keyed with the chain code, like cx_hmac_sha512(chain_code, 32, in, in_len, out, 64)
+static int ckdpub_hmac_sha512(const uint8_t chain_code[static 32],
+                              const uint8_t *in,
+                              size_t in_len,
+                              uint8_t out[static 64]) {
+    const ckdpub_hmac_state_t *state = get_ckdpub_hmac_state(chain_code);
+    if (state == NULL) {
+        return -1;
+    }
+
+    cx_sha512_t hash_context;
+    memcpy(&hash_context, &state->inner, sizeof(cx_sha512_t));
+    if (CX_OK != crypto_hash_update(&hash_context.header, in, in_len) ||
+        CX_OK != crypto_hash_digest(&hash_context.header, out, 64)) {
+        return -1;
+    }
+
+    memcpy(&hash_context, &state->outer, sizeof(cx_sha512_t));
+    if (CX_OK != crypto_hash_update(&hash_context.header, out, 64) ||
+        CX_OK != crypto_hash_digest(&hash_context.header, out, 64)) {
+        return -1;
+    }
+    return 0;
+}
+
+int bip32_CKDpub_uncompressed(const uint8_t parent_pubkey[static 65],
+                              const uint8_t parent_chain_code[static 32],
+                              uint32_t index,
+                              uint8_t child_pubkey[static 65],
+                              uint8_t child_chain_code[static 32]) {
     PRINT_STACK_POINTER();
 
     if (index >= BIP32_FIRST_HARDENED_CHILD) {
         return -1;  // can only derive unhardened children
     }
 
-    if (parent->depth == 255) {
-        return -1;  // maximum derivation depth reached
-    }
-
     uint8_t I[64];
 
     {  // make sure that heavy memory allocations are freed as soon as possible
 
         uint8_t tmp[33 + 4];
-        memcpy(tmp, parent->compressed_pubkey, 33);
+        if (0 > crypto_get_compressed_pubkey(parent_pubkey, tmp)) return -1;
         write_u32_be(tmp, 33, index);
 
-        cx_hmac_sha512(parent->chain_code, 32, tmp, sizeof(tmp), I, 64);
+        PERF_COUNT_CRYPTO(PERF_CRYPTO_HMAC_SHA512, 1);
+        if (0 > ckdpub_hmac_sha512(parent_chain_code, tmp, sizeof(tmp), I)) return -1;
     }
 
     uint8_t *I_L = &I[0];
@@ -121,40 +224,81 @@ int bip32_CKDpub(const serialized_extended_pubkey_t *parent,
         return -1;
     }
 
-    uint8_t child_uncompressed_pubkey[65];
-
     {  // make sure that heavy memory allocations are freed as soon as possible
         // compute point(I_L)
         uint8_t P[65];
         if (0 > secp256k1_point(I_L, P)) return -1;
 
-        uint8_t K_par[65];
-        crypto_get_uncompressed_pubkey(parent->compressed_pubkey, K_par);
-
-        // add K_par
-        if (CX_OK !=
-            cx_ecfp_add_point_no_throw(CX_CURVE_SECP256K1, child_uncompressed_pubkey, P, K_par)) {
+        // add K_par; P is reused for the result, as the child can overwrite the parent
+        PERF_COUNT_CRYPTO(PERF_CRYPTO_POINT_ADD, 1);
+        if (CX_OK != cx_ecfp_add_point_no_throw(CX_CURVE_SECP256K1, P, P, parent_pubkey)) {
             return -1;  // the point at infinity is not a valid child pubkey (should never happen in
                         // practice)
         }
+        memcpy(child_pubkey, P, 65);
     }
 
-    memmove(child->version, parent->version, 4);
-    child->depth = parent->depth + 1;
+    memcpy(child_chain_code, I_R, 32);
+
+    return 0;
+}
+
+int bip32_CKDpub(const serialized_extended_pubkey_t *parent,
+                 uint32_t index,
+                 serialized_extended_pubkey_t *child) {
+    PRINT_STACK_POINTER();
+
+    if (parent->depth == 255) {
+        return -1;  // maximum derivation depth reached
+    }
+
+    uint8_t K[65];
+    if (0 > crypto_get_uncompressed_pubkey(parent->compressed_pubkey, K)) return -1;
 
     uint32_t parent_fingerprint = crypto_get_key_fingerprint(parent->compressed_pubkey);
 
+    if (0 > bip32_CKDpub_uncompressed(K, parent->chain_code, index, K, child->chain_code)) {
+        return -1;
+    }
+
+    memmove(child->version, parent->version, 4);
+    child->depth = parent->depth + 1;
+
     write_u32_be(child->parent_fingerprint, 0, parent_fingerprint);
     write_u32_be(child->child_number, 0, index);
 
-    memcpy(child->chain_code, I_R, 32);
-
-    crypto_get_compressed_pubkey(child_uncompressed_pubkey, child->compressed_pubkey);
+    crypto_get_compressed_pubkey(K, child->compressed_pubkey);
 
     return 0;
 }
 
+bool crypto_hash_tee_add(crypto_hash_tee_t *tee, cx_hash_t *hash_context) {
+    if (tee->n_sinks >= CRYPTO_HASH_TEE_MAX_SINKS) {
+        return false;
+    }
+    tee->sinks[tee->n_sinks++] = hash_context;
+    return true;
+}
+
+int crypto_hash_tee_update(const crypto_hash_tee_t *tee, const void *in, size_t in_len) {
+    int res = 0;
+    for (size_t i = 0; i < tee->n_sinks; i++) {
+        int sink_res = crypto_hash_update(tee->sinks[i], in, in_len);
+        if (res == 0) {
+            res = sink_res;
+        }
+    }
+    return res;
+}
+
+void crypto_hash_tee_update_buffer(buffer_t *data, void *tee) {
+    crypto_hash_tee_update((const crypto_hash_tee_t *) tee,
+                           data->ptr + data->offset,
+                           data->size - data->offset);
+}
+
 void crypto_ripemd160(const uint8_t *in, uint16_t inlen, uint8_t out[static 20]) {
+    PERF_COUNT_CRYPTO(PERF_CRYPTO_RIPEMD160, 1);
     int res = cx_ripemd160_hash(in, inlen, out);
     LEDGER_ASSERT(res == CX_OK, "Unexpected error in ripemd160 computation. Returned: %d", res);
 }
@@ -163,6 +307,7 @@ void crypto_hash160(const uint8_t *in, uint16_t inlen, uint8_t out[static 20]) {
     PRINT_STACK_POINTER();
 
     uint8_t buffer[32];
+    PERF_COUNT_CRYPTO(PERF_CRYPTO_HASH_BLOCKS, SHA256_N_BLOCKS(inlen));
     int res = cx_hash_sha256(in, inlen, buffer, 32);
     LEDGER_ASSERT(res == CX_SHA256_SIZE,
                   "Unexpected error in sha256 computation. Returned: %d",
@@ -204,6 +349,7 @@ int crypto_get_uncompressed_pubkey(const uint8_t compressed_key[static 33],
     scalar[31] = 7;
     if (CX_OK != cx_math_addm_no_throw(y, y, scalar, secp256k1_p, 32))
         return -1;  // tmp = x^3 + 7 (mod p)
+    PERF_COUNT_CRYPTO(PERF_CRYPTO_MOD_SQRT, 1);
     if (CX_OK != cx_math_powm_no_throw(y, y, secp256k1_sqr_exponent, 32, secp256k1_p, 32))
         return -1;  // tmp = sqrt(x^3 + 7) (mod p)
 
@@ -220,6 +366,7 @@ int crypto_get_uncompressed_pubkey(const uint8_t compressed_key[static 33],
 void crypto_get_checksum(const uint8_t *in, uint16_t in_len, uint8_t out[static 4]) {
     uint8_t buffer[32];
     size_t res;
+    PERF_COUNT_CRYPTO(PERF_CRYPTO_HASH_BLOCKS, SHA256_N_BLOCKS(in_len) + SHA256_N_BLOCKS(32));
     res = cx_hash_sha256(in, in_len, buffer, 32);
     LEDGER_ASSERT(res == CX_SHA256_SIZE,
                   "Unexpected error in sha256 computation. Returned: %d",
@@ -231,18 +378,29 @@ void crypto_get_checksum(const uint8_t *in, uint16_t in_len, uint8_t out[static
     memmove(out, buffer, 4);
 }
 
+bool crypto_get_uncompressed_pubkey_at_path(const uint32_t bip32_path[],
+                                            uint8_t bip32_path_len,
+                                            uint8_t pubkey[static 65],
+                                            uint8_t chain_code[]) {
+    PERF_COUNT_CRYPTO(PERF_CRYPTO_OS_DERIVATION, 1);
+    return bip32_derive_get_pubkey_256(CX_CURVE_256K1,
+                                       bip32_path,
+                                       bip32_path_len,
+                                       pubkey,
+                                       chain_code,
+                                       CX_SHA512) == CX_OK;
+}
+
 bool crypto_get_compressed_pubkey_at_path(const uint32_t bip32_path[],
                                           uint8_t bip32_path_len,
                                           uint8_t pubkey[static 33],
                                           uint8_t chain_code[]) {
     uint8_t raw_public_key[65];
 
-    if (bip32_derive_get_pubkey_256(CX_CURVE_256K1,
-                                    bip32_path,
-                                    bip32_path_len,
-                                    raw_public_key,
-                                    chain_code,
-                                    CX_SHA512) != CX_OK) {
+    if (!crypto_get_uncompressed_pubkey_at_path(bip32_path,
+                                                bip32_path_len,
+                                                raw_public_key,
+                                                chain_code)) {
         return false;
     }
 
@@ -253,18 +411,229 @@ bool crypto_get_compressed_pubkey_at_path(const uint32_t bip32_path[],
     return true;
 }
 
+// The fingerprint of the last key. The parent fingerprint of an extended pubkey is the fingerprint
+// of its parent, that is the same for all the sibling keys: for example, for the accounts of the
+// same purpose and coin type, or for consecutive CKDpub from the same parent.
+static struct {
+    uint8_t pubkey[33];
+    uint32_t value;
+    bool is_valid;
+} G_last_key_fingerprint;
+
 uint32_t crypto_get_key_fingerprint(const uint8_t pub_key[static 33]) {
+    if (G_last_key_fingerprint.is_valid &&
+        memcmp(G_last_key_fingerprint.pubkey, pub_key, 33) == 0) {
+        return G_last_key_fingerprint.value;
+    }
+
     uint8_t key_rip[20];
     crypto_hash160(pub_key, 33, key_rip);
 
-    return read_u32_be(key_rip, 0);
+    memcpy(G_last_key_fingerprint.pubkey, pub_key, 33);
+    G_last_key_fingerprint.value = read_u32_be(key_rip, 0);
+    G_last_key_fingerprint.is_valid = true;
+    return G_last_key_fingerprint.value;
+}
+
+// The fingerprint of the master key never changes while the app is running, but computing it
+// requires a full derivation from the seed.
+static struct {
+    uint32_t value;
+    bool is_valid;
+} G_master_key_fingerprint;
+
+// Signing with multiple keys of the same account only requires the unhardened steps from the
+// account-level node: the private node at the hardened prefix of the last path that was signed for
+// is kept, if that prefix is at least at the account level (purpose' / coin_type' / account').
+// The shallower nodes, and in particular the master node, are never kept in RAM.
+#define PRIVATE_NODE_CACHE_MIN_DEPTH 3
+
+static struct {
+    uint32_t path[MAX_BIP32_PATH_STEPS];
+    uint8_t path_len;
+    bool is_used;
+    uint8_t private_key[32];
+    uint8_t chain_code[32];
+} G_private_node_cache;
+
+static void private_node_cache_report_bytes_in_use(void) {
+    PERF_SET_CACHE_BYTES(PERF_CACHE_PRIVATE_NODE,
+                         G_private_node_cache.is_used ? sizeof(G_private_node_cache) : 0,
+                         sizeof(G_private_node_cache));
+}
+
+void crypto_session_cache_reset(void) {
+    explicit_bzero(&G_last_key_fingerprint, sizeof(G_last_key_fingerprint));
+    explicit_bzero(&G_master_key_fingerprint, sizeof(G_master_key_fingerprint));
+    explicit_bzero(&G_private_node_cache, sizeof(G_private_node_cache));
+    private_node_cache_report_bytes_in_use();
+}
+
+bool crypto_try_get_master_key_fingerprint(uint32_t *out) {
+    if (!G_master_key_fingerprint.is_valid) {
+        uint8_t master_pub_key[33];
+        // only cache the result if the derivation succeeded
+        if (!crypto_get_compressed_pubkey_at_path(NULL, 0, master_pub_key, NULL)) {
+            return false;
+        }
+        G_master_key_fingerprint.value = crypto_get_key_fingerprint(master_pub_key);
+        G_master_key_fingerprint.is_valid = true;
+    }
+    *out = G_master_key_fingerprint.value;
+    return true;
 }
 
 uint32_t crypto_get_master_key_fingerprint() {
-    uint8_t master_pub_key[33];
-    uint32_t bip32_path[] = {};
-    crypto_get_compressed_pubkey_at_path(bip32_path, 0, master_pub_key, NULL);
-    return crypto_get_key_fingerprint(master_pub_key);
+    uint32_t master_key_fingerprint = 0;
+    crypto_try_get_master_key_fingerprint(&master_key_fingerprint);
+    return master_key_fingerprint;
+}
+
+/**
+ * Replaces the cached private node, that has a single entry, with the node at the given path;
+ * replacing the node of another account counts as an eviction.
+ */
+static void private_node_cache_set(const uint32_t path[],
+                                   uint8_t path_len,
+                                   const uint8_t k[static 32],
+                                   const uint8_t c[static 32]) {
+    if (G_private_node_cache.is_used) {
+        PERF_COUNT_CACHE(PERF_CACHE_PRIVATE_NODE, PERF_CACHE_EVICTION);
+    }
+    memcpy(G_private_node_cache.path, path, path_len * sizeof(uint32_t));
+    G_private_node_cache.path_len = path_len;
+    memcpy(G_private_node_cache.private_key, k, 32);
+    memcpy(G_private_node_cache.chain_code, c, 32);
+    G_private_node_cache.is_used = true;
+    private_node_cache_report_bytes_in_use();
+}
+
+/**
+ * Derives the child of index `index` of the private node (k_par, c_par), as per the CKDpriv
+ * function of BIP-32; k_par and c_par are overwritten with the child node. Returns 0 on success, -1
+ * on error.
+ */
+static int bip32_CKDpriv(uint8_t k_par[static 32], uint8_t c_par[static 32], uint32_t index) {
+    uint8_t I[64];
+    uint8_t tmp[33 + 4];
+    int ret = -1;
+    do {  // loop to break out in case of error
+        if (index >= BIP32_FIRST_HARDENED_CHILD) {
+            tmp[0] = 0x00;
+            memcpy(tmp + 1, k_par, 32);
+        } else {
+            uint8_t P[65];
+            if (0 > secp256k1_point(k_par, P)) break;
+            if (0 > crypto_get_compressed_pubkey(P, tmp)) break;
+        }
+        write_u32_be(tmp, 33, index);
+
+        PERF_COUNT_CRYPTO(PERF_CRYPTO_HMAC_SHA512, 1);
+        cx_hmac_sha512(c_par, 32, tmp, sizeof(tmp), I, 64);
+
+        // fail if I_L is not smaller than the group order n, but the probability is < 1/2^128
+        int diff;
+        if (CX_OK != cx_math_cmp_no_throw(I, secp256k1_n, 32, &diff) || diff >= 0) break;
+
+        if (CX_OK != cx_math_addm_no_throw(k_par, k_par, I, secp256k1_n, 32)) break;
+
+        // fail if the child key is zero, but the probability is < 1/2^128
+        bool is_zero;
+        if (CX_OK != cx_math_is_zero_no_throw(k_par, 32, &is_zero) || is_zero) break;
+
+        memcpy(c_par, &I[32], 32);
+
+        ret = 0;
+    } while (0);
+
+    explicit_bzero(I, sizeof(I));
+    explicit_bzero(tmp, sizeof(tmp));
+
+    return ret;
+}
+
+/**
+ * Derives the private key k and the chain code c at the given BIP-32 path. The hardened prefix of
+ * the path is derived by the OS, unless it is the cached account-level node; the unhardened steps
+ * are then derived with CKDpriv. If the hardened prefix is shallower than the account level, the
+ * whole path is derived by the OS, and nothing is cached.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int derive_private_node(const uint32_t bip32_path[],
+                               uint8_t bip32_path_len,
+                               uint8_t k[static 32],
+                               uint8_t c[static 32]) {
+    if (bip32_path_len > MAX_BIP32_PATH_STEPS) {
+        return -1;
+    }
+
+    // the prefix of the path up to its last hardened step
+    uint8_t prefix_len = bip32_path_len;
+    while (prefix_len > 0 && bip32_path[prefix_len - 1] < BIP32_FIRST_HARDENED_CHILD) {
+        --prefix_len;
+    }
+    bool is_cacheable = prefix_len >= PRIVATE_NODE_CACHE_MIN_DEPTH;
+
+    bool is_hit = is_cacheable && G_private_node_cache.is_used &&
+                  G_private_node_cache.path_len == prefix_len &&
+                  memcmp(G_private_node_cache.path, bip32_path, prefix_len * sizeof(uint32_t)) == 0;
+    if (is_cacheable) {
+        PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_PRIVATE_NODE, is_hit);
+    }
+
+    uint8_t start;
+    if (is_hit) {
+        start = prefix_len;
+        memcpy(k, G_private_node_cache.private_key, 32);
+        memcpy(c, G_private_node_cache.chain_code, 32);
+    } else {
+        start = is_cacheable ? prefix_len : bip32_path_len;
+
+        cx_ecfp_private_key_t private_key = {0};
+        PERF_COUNT_CRYPTO(PERF_CRYPTO_OS_DERIVATION, 1);
+        bool error = bip32_derive_init_privkey_256(CX_CURVE_256K1,
+                                                   bip32_path,
+                                                   start,
+                                                   &private_key,
+                                                   c) != CX_OK;
+        memcpy(k, private_key.d, 32);
+        explicit_bzero(&private_key, sizeof(private_key));
+        if (error) {
+            return -1;
+        }
+
+        if (is_cacheable) {
+            private_node_cache_set(bip32_path, start, k, c);
+        }
+    }
+
+    for (uint8_t i = start; i < bip32_path_len; i++) {
+        if (0 > bip32_CKDpriv(k, c, bip32_path[i])) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int crypto_derive_private_key(const uint32_t bip32_path[],
+                              uint8_t bip32_path_len,
+                              cx_ecfp_private_key_t *private_key) {
+    uint8_t k[32];
+    uint8_t c[32];
+
+    int ret = derive_private_node(bip32_path, bip32_path_len, k, c);
+
+    if (ret == 0 &&
+        CX_OK != cx_ecfp_init_private_key_no_throw(CX_CURVE_256K1, k, 32, private_key)) {
+        ret = -1;
+    }
+
+    explicit_bzero(k, sizeof(k));
+    explicit_bzero(c, sizeof(c));
+
+    return ret;
 }
 
 bool crypto_derive_symmetric_key(const char *label, size_t label_len, uint8_t key[static 32]) {
@@ -276,6 +645,7 @@ bool crypto_derive_symmetric_key(const char *label, size_t label_len, uint8_t ke
 
     memcpy(label_copy, label, label_len);
 
+    PERF_COUNT_CRYPTO(PERF_CRYPTO_OS_DERIVATION, 1);
     if (os_derive_bip32_with_seed_no_throw(HDW_SLIP21,
                                            CX_CURVE_SECP256K1,
                                            (uint32_t *) label_copy,
@@ -290,42 +660,108 @@ bool crypto_derive_symmetric_key(const char *label, size_t label_len, uint8_t ke
     return true;
 }
 
-int get_extended_pubkey_at_path(const uint32_t bip32_path[],
-                                uint8_t bip32_path_len,
-                                uint32_t bip32_pubkey_version,
-                                serialized_extended_pubkey_t *out_pubkey) {
-    // find parent key's fingerprint and child number
-    uint32_t parent_fingerprint = 0;
-    uint32_t child_number = 0;
-    if (bip32_path_len > 0) {
-        // here we reuse the storage for the parent keys that we will later use
-        // for the response, in order to save memory
-
-        uint8_t parent_pubkey[33];
-        if (!crypto_get_compressed_pubkey_at_path(bip32_path,
-                                                  bip32_path_len - 1,
-                                                  parent_pubkey,
-                                                  NULL)) {
-            return -1;
+// If store_in_xpub_cache is true, the account-level extended pubkeys that are not in the cache in
+// NVM are added to it
+static int get_extended_pubkey_at_path_internal(const uint32_t bip32_path[],
+                                                uint8_t bip32_path_len,
+                                                uint32_t bip32_pubkey_version,
+                                                serialized_extended_pubkey_t *out_pubkey,
+                                                bool store_in_xpub_cache) {
+#ifdef HAVE_XPUB_CACHE
+    // the master key fingerprint is only computed for the paths that can be in the cache
+    uint32_t master_key_fingerprint = 0;
+    bool use_xpub_cache = xpub_cache_is_cacheable_path(bip32_path, bip32_path_len) &&
+                          crypto_try_get_master_key_fingerprint(&master_key_fingerprint);
+    if (use_xpub_cache &&
+        xpub_cache_get(bip32_path, bip32_path_len, master_key_fingerprint, out_pubkey)) {
+        write_u32_be(out_pubkey->version, 0, bip32_pubkey_version);
+        return 0;
+    }
+#endif
+
+    // Only public derivations are used: the private nodes are only derived, and cached, to sign
+    // (see crypto_derive_private_key). The parent pubkey is needed anyway for its fingerprint; if
+    // the last step is unhardened, the key is then derived from it with CKDpub, rather than by the
+    // OS from the seed.
+    uint8_t K[65];
+    int ret = -1;
+    do {  // loop to break out in case of error
+        uint32_t parent_fingerprint = 0;
+        uint32_t child_number = 0;
+        if (bip32_path_len == 0) {
+            if (!crypto_get_uncompressed_pubkey_at_path(bip32_path, 0, K, out_pubkey->chain_code)) {
+                break;
+            }
+        } else {
+            uint8_t parent_chain_code[32];
+            if (!crypto_get_uncompressed_pubkey_at_path(bip32_path,
+                                                        bip32_path_len - 1,
+                                                        K,
+                                                        parent_chain_code)) {
+                break;
+            }
+            // the compressed parent pubkey is overwritten with the one of the child below
+            if (0 > crypto_get_compressed_pubkey(K, out_pubkey->compressed_pubkey)) break;
+            parent_fingerprint = crypto_get_key_fingerprint(out_pubkey->compressed_pubkey);
+            child_number = bip32_path[bip32_path_len - 1];
+
+            if (child_number < BIP32_FIRST_HARDENED_CHILD) {
+                if (0 > bip32_CKDpub_uncompressed(K,
+                                                  parent_chain_code,
+                                                  child_number,
+                                                  K,
+                                                  out_pubkey->chain_code)) {
+                    break;
+                }
+            } else if (!crypto_get_uncompressed_pubkey_at_path(bip32_path,
+                                                               bip32_path_len,
+                                                               K,
+                                                               out_pubkey->chain_code)) {
+                break;
+            }
         }
 
-        parent_fingerprint = crypto_get_key_fingerprint(parent_pubkey);
-        child_number = bip32_path[bip32_path_len - 1];
-    }
+        if (0 > crypto_get_compressed_pubkey(K, out_pubkey->compressed_pubkey)) break;
 
-    write_u32_be(out_pubkey->version, 0, bip32_pubkey_version);
-    out_pubkey->depth = bip32_path_len;
-    write_u32_be(out_pubkey->parent_fingerprint, 0, parent_fingerprint);
-    write_u32_be(out_pubkey->child_number, 0, child_number);
+        write_u32_be(out_pubkey->version, 0, bip32_pubkey_version);
+        out_pubkey->depth = bip32_path_len;
+        write_u32_be(out_pubkey->parent_fingerprint, 0, parent_fingerprint);
+        write_u32_be(out_pubkey->child_number, 0, child_number);
 
-    if (!crypto_get_compressed_pubkey_at_path(bip32_path,
-                                              bip32_path_len,
-                                              out_pubkey->compressed_pubkey,
-                                              out_pubkey->chain_code)) {
-        return -1;
+        ret = 0;
+    } while (0);
+
+#ifdef HAVE_XPUB_CACHE
+    if (ret == 0 && use_xpub_cache && store_in_xpub_cache) {
+        xpub_cache_add(bip32_path, bip32_path_len, master_key_fingerprint, out_pubkey);
     }
+#else
+    (void) store_in_xpub_cache;
+#endif
 
-    return 0;
+    return ret;
+}
+
+int get_extended_pubkey_at_path(const uint32_t bip32_path[],
+                                uint8_t bip32_path_len,
+                                uint32_t bip32_pubkey_version,
+                                serialized_extended_pubkey_t *out_pubkey) {
+    return get_extended_pubkey_at_path_internal(bip32_path,
+                                                bip32_path_len,
+                                                bip32_pubkey_version,
+                                                out_pubkey,
+                                                false);
+}
+
+int get_wallet_extended_pubkey_at_path(const uint32_t bip32_path[],
+                                       uint8_t bip32_path_len,
+                                       uint32_t bip32_pubkey_version,
+                                       serialized_extended_pubkey_t *out_pubkey) {
+    return get_extended_pubkey_at_path_internal(bip32_path,
+                                                bip32_path_len,
+                                                bip32_pubkey_version,
+                                                out_pubkey,
+                                                true);
 }
 
 int base58_encode_address(const uint8_t in[20], uint32_t version, char *out, size_t out_len) {
@@ -348,45 +784,234 @@ int base58_encode_address(const uint8_t in[20], uint32_t version, char *out, siz
     return base58_encode(tmp, version_len + 20 + 4, out, out_len);
 }
 
+int crypto_ecdsa_sign_sha256_hash_with_private_key(const cx_ecfp_private_key_t *private_key,
+                                                   const uint8_t hash[static 32],
+                                                   uint8_t out[static MAX_DER_SIG_LEN],
+                                                   uint32_t *info) {
+    size_t sig_len = MAX_DER_SIG_LEN;
+    uint32_t info_internal = 0;
+
+    PERF_COUNT_CRYPTO(PERF_CRYPTO_SIGNATURE, 1);
+    if (cx_ecdsa_sign_no_throw(private_key,
+                               CX_RND_RFC6979,
+                               CX_SHA256,
+                               hash,
+                               32,
+                               out,
+                               &sig_len,
+                               &info_internal) != CX_OK) {
+        return -1;
+    }
+
+    if (info != NULL) {
+        *info = info_internal;
+    }
+
+    return sig_len;
+}
+
+/**
+ * (n - 1)/2 for secp256k1, the largest s of a signature with low S
+ */
+static const uint8_t secp256k1_n_half[] = {
+    0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x5d, 0x57, 0x6e, 0x73, 0x57, 0xa4, 0x50, 0x1d, 0xdf, 0xe9, 0x2f, 0x46, 0x68, 0x1b, 0x20, 0xa0};
+
+// Computes the deterministic nonce of RFC6979 with the 32 bytes of additional data of section 3.6,
+// exactly as the nonce_function_rfc6979 of libsecp256k1 does when it is given extra entropy.
+static int rfc6979_nonce_with_extra_data(const uint8_t seckey[static 32],
+                                         const uint8_t hash[static 32],
+                                         const uint8_t extra_data[static 32],
+                                         uint8_t k[static 32]) {
+    // V || 0x00 or 0x01 || seckey || bits2octets(hash) || extra_data
+    uint8_t data[32 + 1 + 3 * 32];
+    uint8_t K[32], V[32], tmp[32];
+
+    memset(K, 0x00, sizeof(K));
+    memset(V, 0x01, sizeof(V));
+    memcpy(data + 33, seckey, 32);
+    memcpy(data + 65, hash, 32);
+    memcpy(data + 97, extra_data, 32);
+
+    int ret = -1;
+    do {  // loop to break out in case of error
+        if (CX_OK != cx_math_modm_no_throw(data + 65, 32, secp256k1_n, 32)) break;
+
+        PERF_COUNT_CRYPTO(PERF_CRYPTO_HMAC_SHA256, 4);
+        for (uint8_t sep = 0x00; sep <= 0x01; sep++) {
+            memcpy(data, V, 32);
+            data[32] = sep;
+            cx_hmac_sha256(K, 32, data, sizeof(data), tmp, 32);
+            memcpy(K, tmp, 32);
+            cx_hmac_sha256(K, 32, V, 32, tmp, 32);
+            memcpy(V, tmp, 32);
+        }
+
+        while (true) {
+            PERF_COUNT_CRYPTO(PERF_CRYPTO_HMAC_SHA256, 1);
+            cx_hmac_sha256(K, 32, V, 32, tmp, 32);
+            memcpy(V, tmp, 32);
+
+            int diff;
+            bool is_zero;
+            if (CX_OK != cx_math_cmp_no_throw(V, secp256k1_n, 32, &diff) ||
+                CX_OK != cx_math_is_zero_no_throw(V, 32, &is_zero)) {
+                break;
+            }
+            if (diff < 0 && !is_zero) {
+                memcpy(k, V, 32);
+                ret = 0;
+                break;
+            }
+
+            // not a valid scalar, try again as in section 3.2, step h.3
+            memcpy(data, V, 32);
+            data[32] = 0x00;
+            PERF_COUNT_CRYPTO(PERF_CRYPTO_HMAC_SHA256, 2);
+            cx_hmac_sha256(K, 32, data, 33, tmp, 32);
+            memcpy(K, tmp, 32);
+            cx_hmac_sha256(K, 32, V, 32, tmp, 32);
+            memcpy(V, tmp, 32);
+        }
+    } while (0);
+
+    explicit_bzero(data, sizeof(data));
+    explicit_bzero(K, sizeof(K));
+    explicit_bzero(V, sizeof(V));
+    explicit_bzero(tmp, sizeof(tmp));
+
+    return ret;
+}
+
+// Signs the hash with the ECDSA using the nonce of RFC6979 with the given additional data, with low
+// S as the BOLOS signatures; info gets the same flags as returned by cx_ecdsa_sign_no_throw.
+// Returns the length of the DER-encoded signature, or -1 on error.
+static int ecdsa_sign_with_extra_data(const cx_ecfp_private_key_t *private_key,
+                                      const uint8_t hash[static 32],
+                                      const uint8_t extra_data[static 32],
+                                      uint8_t out[static MAX_DER_SIG_LEN],
+                                      uint32_t *info) {
+    uint8_t k[32], R[65], r[32], s[32], z[32];
+
+    int ret = -1;
+    do {  // loop to break out in case of error
+        PERF_COUNT_CRYPTO(PERF_CRYPTO_SIGNATURE, 1);
+        if (0 > rfc6979_nonce_with_extra_data(private_key->d, hash, extra_data, k)) break;
+
+        if (0 > secp256k1_point(k, R)) break;
+
+        *info = (R[64] & 1) ? CX_ECCINFO_PARITY_ODD : 0;
+
+        // r = x(R) mod n
+        int diff;
+        memcpy(r, R + 1, 32);
+        if (CX_OK != cx_math_cmp_no_throw(r, secp256k1_n, 32, &diff)) break;
+        if (diff >= 0) {
+            *info |= CX_ECCINFO_xGTn;
+            if (CX_OK != cx_math_modm_no_throw(r, 32, secp256k1_n, 32)) break;
+        }
+
+        // s = k^-1 * (z + r * d) mod n
+        memcpy(z, hash, 32);
+        if (CX_OK != cx_math_modm_no_throw(z, 32, secp256k1_n, 32) ||
+            CX_OK != cx_math_multm_no_throw(s, r, private_key->d, secp256k1_n, 32) ||
+            CX_OK != cx_math_addm_no_throw(s, s, z, secp256k1_n, 32) ||
+            CX_OK != cx_math_invprimem_no_throw(k, k, secp256k1_n, 32) ||
+            CX_OK != cx_math_multm_no_throw(s, s, k, secp256k1_n, 32)) {
+            break;
+        }
+
+        bool r_is_zero, s_is_zero;
+        if (CX_OK != cx_math_is_zero_no_throw(r, 32, &r_is_zero) ||
+            CX_OK != cx_math_is_zero_no_throw(s, 32, &s_is_zero) || r_is_zero || s_is_zero) {
+            break;
+        }
+
+        if (CX_OK != cx_math_cmp_no_throw(s, secp256k1_n_half, 32, &diff)) break;
+        if (diff > 0) {
+            // high S, use -s, that is the signature for -k
+            if (CX_OK != cx_math_sub_no_throw(s, secp256k1_n, s, 32)) break;
+            *info ^= CX_ECCINFO_PARITY_ODD;
+        }
+
+        size_t sig_len = cx_ecfp_encode_sig_der(out, MAX_DER_SIG_LEN, r, 32, s, 32);
+        if (sig_len == 0) break;
+
+        ret = (int) sig_len;
+    } while (0);
+
+    explicit_bzero(k, sizeof(k));
+
+    return ret;
+}
+
+// Whether the DER-encoded signature has a low R, that is, if its R is encoded in at most 32 bytes
+static bool ecdsa_sig_has_low_r(const uint8_t sig[static MAX_DER_SIG_LEN]) {
+    // 0x30 <len> 0x02 <len_r> <r> 0x02 <len_s> <s>
+    return sig[3] <= 32;
+}
+
 int crypto_ecdsa_sign_sha256_hash_with_key(const uint32_t bip32_path[],
                                            uint8_t bip32_path_len,
                                            const uint8_t hash[static 32],
                                            uint8_t *pubkey,
                                            uint8_t out[static MAX_DER_SIG_LEN],
-                                           uint32_t *info) {
+                                           uint32_t *info,
+                                           bool grind_low_r) {
     cx_ecfp_private_key_t private_key = {0};
     cx_ecfp_public_key_t public_key;
     uint32_t info_internal = 0;
 
-    size_t sig_len = MAX_DER_SIG_LEN;
+    int sig_len = -1;
     bool error = true;
 
-    if (bip32_derive_init_privkey_256(CX_CURVE_256K1,
-                                      bip32_path,
-                                      bip32_path_len,
-                                      &private_key,
-                                      NULL) != CX_OK) {
+    if (crypto_derive_private_key(bip32_path, bip32_path_len, &private_key) < 0) {
         goto end;
     }
 
-    if (cx_ecdsa_sign_no_throw(&private_key,
-                               CX_RND_RFC6979,
-                               CX_SHA256,
-                               hash,
-                               32,
-                               out,
-                               &sig_len,
-                               &info_internal) != CX_OK) {
+    sig_len =
+        crypto_ecdsa_sign_sha256_hash_with_private_key(&private_key, hash, out, &info_internal);
+    if (sig_len < 0) {
         goto end;
     }
 
-    if (pubkey != NULL) {
+    // whether the signature was computed by ecdsa_sign_with_extra_data, instead of the OS
+    bool is_ground = false;
+    if (grind_low_r) {
+        // As Bitcoin Core, retry with the attempt counter as extra data, 32 bytes little-endian
+        uint8_t extra_data[32] = {0};
+        for (uint32_t counter = 1; !ecdsa_sig_has_low_r(out) && counter < MAX_LOW_R_ATTEMPTS;
+             counter++) {
+            write_u32_le(extra_data, 0, counter);
+            sig_len =
+                ecdsa_sign_with_extra_data(&private_key, hash, extra_data, out, &info_internal);
+            if (sig_len < 0) {
+                goto end;
+            }
+            is_ground = true;
+        }
+    }
+
+    if (pubkey != NULL || is_ground) {
         // Generate associated pubkey
+        PERF_COUNT_CRYPTO(PERF_CRYPTO_SCALAR_MULT, 1);
         if (cx_ecfp_generate_pair_no_throw(CX_CURVE_256K1, &public_key, &private_key, true) !=
             CX_OK) {
             goto end;
         }
+    }
 
+    // The OS API has no way to pass the additional data of RFC6979, so the ground signatures are
+    // computed by the app itself; as a fault or a bug there could leak the key, they are checked
+    // with the OS before being returned.
+    if (is_ground) {
+        if (!cx_ecdsa_verify_no_throw(&public_key, hash, 32, out, (size_t) sig_len)) {
+            explicit_bzero(out, MAX_DER_SIG_LEN);
+            goto end;
+        }
+    }
+
+    if (pubkey != NULL) {
         // compute compressed public key
         if (crypto_get_compressed_pubkey(public_key.W, pubkey) < 0) {
             goto end;
@@ -428,8 +1053,21 @@ void crypto_tr_tagged_hash_init(cx_sha256_t *hash_context, const uint8_t *tag, u
     LEDGER_ASSERT(res == CX_OK, "Unexpected error in sha256 computation. Returned: %d", res);
 }
 
+static void crypto_tr_tagged_hash_init_from_midstate(cx_sha256_t *hash_context,
+                                                     tagged_hash_midstate_t *midstate) {
+    if (!midstate->is_initialized) {
+        crypto_tr_tagged_hash_init(&midstate->context, midstate->tag, midstate->tag_len);
+        midstate->is_initialized = true;
+    }
+    memcpy(hash_context, &midstate->context, sizeof(cx_sha256_t));
+}
+
 void crypto_tr_tapleaf_hash_init(cx_sha256_t *hash_context) {
-    crypto_tr_tagged_hash_init(hash_context, BIP0341_tapleaf_tag, sizeof(BIP0341_tapleaf_tag));
+    crypto_tr_tagged_hash_init_from_midstate(hash_context, &G_tapleaf_midstate);
+}
+
+void crypto_tr_tapsighash_init(cx_sha256_t *hash_context) {
+    crypto_tr_tagged_hash_init_from_midstate(hash_context, &G_tapsighash_midstate);
 }
 
 static int crypto_tr_lift_x(const uint8_t x[static 32], uint8_t out[static 65]) {
@@ -445,6 +1083,7 @@ static int crypto_tr_lift_x(const uint8_t x[static 32], uint8_t out[static 65])
     if (CX_OK != cx_math_addm_no_throw(c, c, scalar, secp256k1_p, 32))
         return -1;  // c = x^3 + 7 (mod p)
 
+    PERF_COUNT_CRYPTO(PERF_CRYPTO_MOD_SQRT, 1);
     if (CX_OK != cx_math_powm_no_throw(y, c, secp256k1_sqr_exponent, 32, secp256k1_p, 32))
         return -1;  // y = sqrt(x^3 + 7) (mod p)
 
@@ -471,64 +1110,45 @@ static int crypto_tr_lift_x(const uint8_t x[static 32], uint8_t out[static 65])
 
 // Computes a tagged hash according to BIP-340.
 // If data2_len > 0, then data2 must be non-NULL and the `data` and `data2` arrays are concatenated.
-static void crypto_tr_tagged_hash(const uint8_t *tag,
-                                  uint16_t tag_len,
+static void crypto_tr_tagged_hash(tagged_hash_midstate_t *midstate,
                                   const uint8_t *data,
                                   uint16_t data_len,
                                   const uint8_t *data2,
                                   uint16_t data2_len,
                                   uint8_t out[static CX_SHA256_SIZE]) {
-    // First compute hashtag, reuse out buffer for that
-    cx_sha256_hash(tag, tag_len, out);
+    int res;
+    cx_sha256_t hash_context;
+    crypto_tr_tagged_hash_init_from_midstate(&hash_context, midstate);
 
-    cx_iovec_t iovec[4] = {{.iov_base = out, .iov_len = CX_SHA256_SIZE},
-                           {.iov_base = out, .iov_len = CX_SHA256_SIZE},
-                           {.iov_base = data, .iov_len = data_len},
-                           {.iov_base = data2, .iov_len = data2_len}};
+    res = crypto_hash_update(&hash_context.header, data, data_len);
+    LEDGER_ASSERT(res == CX_OK, "Unexpected error in sha256 computation. Returned: %d", res);
     if (data2_len > 0) {
-        cx_sha256_hash_iovec(iovec, 4, out);
-    } else {
-        cx_sha256_hash_iovec(iovec, 3, out);
+        res = crypto_hash_update(&hash_context.header, data2, data2_len);
+        LEDGER_ASSERT(res == CX_OK, "Unexpected error in sha256 computation. Returned: %d", res);
     }
+    res = crypto_hash_digest(&hash_context.header, out, CX_SHA256_SIZE);
+    LEDGER_ASSERT(res == CX_OK, "Unexpected error in sha256 computation. Returned: %d", res);
 }
 
 void crypto_tr_combine_taptree_hashes(const uint8_t left_h[static 32],
                                       const uint8_t right_h[static 32],
                                       uint8_t out[static 32]) {
     if (memcmp(left_h, right_h, 32) < 0) {
-        crypto_tr_tagged_hash(BIP0341_tapbranch_tag,
-                              sizeof(BIP0341_tapbranch_tag),
-                              left_h,
-                              32,
-                              right_h,
-                              32,
-                              out);
+        crypto_tr_tagged_hash(&G_tapbranch_midstate, left_h, 32, right_h, 32, out);
     } else {
-        crypto_tr_tagged_hash(BIP0341_tapbranch_tag,
-                              sizeof(BIP0341_tapbranch_tag),
-                              right_h,
-                              32,
-                              left_h,
-                              32,
-                              out);
+        crypto_tr_tagged_hash(&G_tapbranch_midstate, right_h, 32, left_h, 32, out);
     }
 }
 
-// Like taproot_tweak_pubkey of BIP0341
-int crypto_tr_tweak_pubkey(const uint8_t pubkey[static 32],
-                           const uint8_t *h,
-                           size_t h_len,
-                           uint8_t *y_parity,
-                           uint8_t out[static 32]) {
+// Like taproot_tweak_pubkey of BIP0341, for the point with even y whose x is the BIP340 pubkey
+static int tr_tweak_lifted_pubkey(const uint8_t lifted_pubkey[static 65],
+                                  const uint8_t *h,
+                                  size_t h_len,
+                                  uint8_t *y_parity,
+                                  uint8_t out[static 32]) {
     uint8_t t[32];
 
-    crypto_tr_tagged_hash(BIP0341_taptweak_tag,
-                          sizeof(BIP0341_taptweak_tag),
-                          pubkey,
-                          32,
-                          h,
-                          h_len,
-                          t);
+    crypto_tr_tagged_hash(&G_taptweak_midstate, lifted_pubkey + 1, 32, h, h_len, t);
 
     // fail if t is not smaller than the curve order
     int diff;
@@ -538,16 +1158,12 @@ int crypto_tr_tweak_pubkey(const uint8_t pubkey[static 32],
 
     uint8_t Q[65];
 
-    uint8_t lifted_pubkey[65];
-    if (crypto_tr_lift_x(pubkey, lifted_pubkey) < 0) {
-        return -1;
-    }
-
     if (0 > secp256k1_point(t, Q)) {
         // point at infinity, or error
         return -1;
     }
 
+    PERF_COUNT_CRYPTO(PERF_CRYPTO_POINT_ADD, 1);
     if (CX_OK != cx_ecfp_add_point_no_throw(CX_CURVE_SECP256K1, Q, Q, lifted_pubkey)) {
         return -1;  // error, or point at Infinity
     }
@@ -557,6 +1173,37 @@ int crypto_tr_tweak_pubkey(const uint8_t pubkey[static 32],
     return 0;
 }
 
+// Like taproot_tweak_pubkey of BIP0341
+int crypto_tr_tweak_pubkey(const uint8_t pubkey[static 32],
+                           const uint8_t *h,
+                           size_t h_len,
+                           uint8_t *y_parity,
+                           uint8_t out[static 32]) {
+    uint8_t lifted_pubkey[65];
+    if (crypto_tr_lift_x(pubkey, lifted_pubkey) < 0) {
+        return -1;
+    }
+
+    return tr_tweak_lifted_pubkey(lifted_pubkey, h, h_len, y_parity, out);
+}
+
+int crypto_tr_tweak_uncompressed_pubkey(const uint8_t pubkey[static 65],
+                                        const uint8_t *h,
+                                        size_t h_len,
+                                        uint8_t *y_parity,
+                                        uint8_t out[static 32]) {
+    // the point with the same x and even y is either the pubkey or its negation; no square root
+    // is needed, unlike lifting the x-only pubkey
+    uint8_t lifted_pubkey[65];
+    memcpy(lifted_pubkey, pubkey, 65);
+    if (pubkey[64] & 1) {
+        if (CX_OK != cx_math_sub_no_throw(lifted_pubkey + 1 + 32, secp256k1_p, pubkey + 1 + 32, 32))
+            return -1;
+    }
+
+    return tr_tweak_lifted_pubkey(lifted_pubkey, h, h_len, y_parity, out);
+}
+
 // Like taproot_tweak_seckey of BIP0341
 int crypto_tr_tweak_seckey(const uint8_t seckey[static 32],
                            const uint8_t *h,
@@ -576,8 +1223,7 @@ int crypto_tr_tweak_seckey(const uint8_t seckey[static 32],
         }
 
         uint8_t t[32];
-        crypto_tr_tagged_hash(BIP0341_taptweak_tag,
-                              sizeof(BIP0341_taptweak_tag),
+        crypto_tr_tagged_hash(&G_taptweak_midstate,
                               &P[1],  // P[1:33] is x(P)
                               32,
                               h,
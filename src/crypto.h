@@ -7,8 +7,11 @@
 #include "os.h"
 #include "cx.h"
 #include "constants.h"
+#include "./cache_sizes.h"
 
+#include "./boilerplate/perf_stats.h"
 #include "./common/bip32.h"
+#include "./common/buffer.h"
 #include "./common/varint.h"
 #include "./common/write.h"
 
@@ -49,6 +52,44 @@ int bip32_CKDpub(const serialized_extended_pubkey_t *parent,
                  uint32_t index,
                  serialized_extended_pubkey_t *child);
 
+/**
+ * Number of parent chain codes for which bip32_CKDpub_uncompressed keeps the pre-keyed states of
+ * the HMAC-SHA512. Each entry takes about 450 bytes of RAM.
+ */
+#ifndef CKDPUB_HMAC_CACHE_SIZE
+#define CKDPUB_HMAC_CACHE_SIZE CACHE_SIZE_FOR_TARGET(2, 4)
+#endif
+
+/**
+ * Variant of bip32_CKDpub that takes and returns the public keys as uncompressed points, and only
+ * computes the child pubkey and chain code. In a chain of derivations, this avoids decompressing
+ * each intermediate key, which requires a modular square root.
+ *
+ * The states of the HMAC-SHA512 keyed with the chain code of the parent are kept for the last
+ * CKDPUB_HMAC_CACHE_SIZE parents, so that deriving several children of the same parent, like the
+ * addresses of a branch of a wallet, only hashes the key once.
+ *
+ * @param[in]  parent_pubkey
+ *   Pointer to the 65-byte uncompressed pubkey of the parent.
+ * @param[in]  parent_chain_code
+ *   Pointer to the 32-byte chain code of the parent.
+ * @param[in] index
+ *   Index of the child to derive. It MUST be not hardened, that is, strictly less than 0x80000000.
+ * @param[out] child_pubkey
+ *   Pointer to the 65-byte output buffer for the child's uncompressed pubkey. It can equal
+ * parent_pubkey.
+ * @param[out] child_chain_code
+ *   Pointer to the 32-byte output buffer for the child's chain code. It can equal
+ * parent_chain_code.
+ *
+ * @return 0 if success, a negative number on failure.
+ */
+int bip32_CKDpub_uncompressed(const uint8_t parent_pubkey[static 65],
+                              const uint8_t parent_chain_code[static 32],
+                              uint32_t index,
+                              uint8_t child_pubkey[static 65],
+                              uint8_t child_chain_code[static 32]);
+
 /**
  * Convenience wrapper for cx_hash_no_throw to add some data to an initialized hash context.
  *
@@ -62,7 +103,15 @@ int bip32_CKDpub(const serialized_extended_pubkey_t *parent,
  * @return the return value of cx_hash_no_throw.
  */
 static inline int crypto_hash_update(cx_hash_t *hash_context, const void *in, size_t in_len) {
+#ifdef HAVE_PERF_STATS
+    // the counter of the context is the number of blocks already compressed
+    unsigned int n_blocks = hash_context->counter;
+    int res = cx_hash_no_throw(hash_context, 0, in, in_len, NULL, 0);
+    PERF_COUNT_CRYPTO(PERF_CRYPTO_HASH_BLOCKS, hash_context->counter - n_blocks);
+    return res;
+#else
     return cx_hash_no_throw(hash_context, 0, in, in_len, NULL, 0);
+#endif
 }
 
 /**
@@ -79,6 +128,8 @@ static inline int crypto_hash_update(cx_hash_t *hash_context, const void *in, si
  * @return the return value of cx_hash_no_throw.
  */
 static inline int crypto_hash_digest(cx_hash_t *hash_context, uint8_t *out, size_t out_len) {
+    // the padding is counted as a single block, even when it takes two
+    PERF_COUNT_CRYPTO(PERF_CRYPTO_HASH_BLOCKS, 1);
     return cx_hash_no_throw(hash_context, CX_LAST, NULL, 0, out, out_len);
 }
 
@@ -147,6 +198,68 @@ static inline int crypto_hash_update_u32(cx_hash_t *hash_context, uint32_t data)
     return crypto_hash_update(hash_context, &buf, sizeof(buf));
 }
 
+/**
+ * Maximum number of hash contexts updated by a crypto_hash_tee_t.
+ */
+#define CRYPTO_HASH_TEE_MAX_SINKS 4
+
+/**
+ * A set of hash contexts that are all updated with the same data, so that a stream of bytes is
+ * added to several digests at once. The contexts are not owned by the tee: they must be initialized
+ * by the caller, and each of them can still be updated on its own.
+ */
+typedef struct {
+    cx_hash_t *sinks[CRYPTO_HASH_TEE_MAX_SINKS];
+    size_t n_sinks;
+} crypto_hash_tee_t;
+
+/**
+ * Initializes a tee without any hash context.
+ *
+ * @param[out] tee
+ *   The tee to initialize.
+ */
+static inline void crypto_hash_tee_init(crypto_hash_tee_t *tee) {
+    tee->n_sinks = 0;
+}
+
+/**
+ * Adds a hash context to the ones updated by the tee.
+ *
+ * @param[in,out] tee
+ *   The tee, which must already be initialized.
+ * @param[in] hash_context
+ *   The context of the hash, which must already be initialized.
+ *
+ * @return true on success, false if the tee already has CRYPTO_HASH_TEE_MAX_SINKS contexts.
+ */
+bool crypto_hash_tee_add(crypto_hash_tee_t *tee, cx_hash_t *hash_context);
+
+/**
+ * Adds some data to all the hash contexts of the tee, in the order they were added.
+ *
+ * @param[in] tee
+ *   The tee.
+ * @param[in] in
+ *   Pointer to the data to be added to the hash computations.
+ * @param[in] in_len
+ *   Size of the passed data.
+ *
+ * @return 0 on success, or the first error returned by cx_hash_no_throw.
+ */
+int crypto_hash_tee_update(const crypto_hash_tee_t *tee, const void *in, size_t in_len);
+
+/**
+ * Adds the bytes of a buffer from its current offset to all the hash contexts of the tee; it has
+ * the signature of the callbacks of call_stream_preimage, with the tee as the callback state.
+ *
+ * @param[in] data
+ *   The buffer; its offset is not changed.
+ * @param[in] tee
+ *   Pointer to the crypto_hash_tee_t.
+ */
+void crypto_hash_tee_update_buffer(buffer_t *data, void *tee);
+
 /**
  * Computes RIPEMD160(in).
  *
@@ -214,6 +327,25 @@ int crypto_get_uncompressed_pubkey(const uint8_t compressed_key[static 33], uint
  */
 void crypto_get_checksum(const uint8_t *in, uint16_t in_len, uint8_t out[static 4]);
 
+/**
+ * Gets the uncompressed pubkey and (optionally) the chain code at the given derivation path.
+ *
+ * @param[in]  bip32_path
+ *   Pointer to 32-bit integer input buffer.
+ * @param[in]  bip32_path_len
+ *   Number of derivation steps.
+ * @param[out]  pubkey
+ *   A pointer to a 65-bytes buffer that will receive the uncompressed public key.
+ * @param[out]  chaincode
+ *   Either NULL, or a pointer to a 32-bytes buffer that will receive the chain code.
+ *
+ * @return true on success, false in case of error.
+ */
+bool crypto_get_uncompressed_pubkey_at_path(const uint32_t bip32_path[],
+                                            uint8_t bip32_path_len,
+                                            uint8_t pubkey[static 65],
+                                            uint8_t chain_code[]);
+
 /**
  * Gets the compressed pubkey and (optionally) the chain code at the given derivation path.
  *
@@ -240,6 +372,9 @@ bool crypto_get_compressed_pubkey_at_path(const uint32_t bip32_path[],
  * @param[in]  pub_key
  *   Pointer to 32-bit integer input buffer.
  *
+ * The fingerprint of the last key is cached, as the same parent fingerprint is often computed for
+ * several keys in a row.
+ *
  * @return the fingerprint of pub_key.
  */
 uint32_t crypto_get_key_fingerprint(const uint8_t pub_key[static 33]);
@@ -252,7 +387,50 @@ uint32_t crypto_get_key_fingerprint(const uint8_t pub_key[static 33]);
 uint32_t crypto_get_master_key_fingerprint();
 
 /**
- * Computes extended pubkey at a given path, serialized as per BIP32.
+ * Computes the fingerprint of the master key as per BIP32, like crypto_get_master_key_fingerprint,
+ * but reports if the derivation failed. The result is cached until crypto_session_cache_reset.
+ *
+ * @param[out] out
+ *   Pointer to the fingerprint of the master key.
+ *
+ * @return true on success, false in case of error.
+ */
+bool crypto_try_get_master_key_fingerprint(uint32_t *out);
+
+/**
+ * Derives the private key at the given BIP-32 path.
+ *
+ * The private node at the prefix of the path up to its last hardened step, derived by the OS, is
+ * cached if it is at least at the account level, so that deriving multiple keys under the same
+ * account (differing only in the unhardened steps) does not require a derivation from the seed
+ * each time. Only the node of the last account is kept, and shallower nodes (like the master node)
+ * are never cached. As the cached node is secret, this must only be called to sign.
+ *
+ * @param[in]  bip32_path
+ *   Pointer to 32-bit array of BIP-32 derivation steps.
+ * @param[in]  bip32_path_len
+ *   Number of steps in the BIP32 derivation; it must be at most MAX_BIP32_PATH_STEPS.
+ * @param[out]  private_key
+ *   Pointer to the private key to initialize. It is the caller's responsibility to wipe it.
+ *
+ * @return 0 on success, -1 in case of error.
+ */
+int crypto_derive_private_key(const uint32_t bip32_path[],
+                              uint8_t bip32_path_len,
+                              cx_ecfp_private_key_t *private_key);
+
+/**
+ * Wipes the cached key fingerprints and the cached private node of crypto_derive_private_key.
+ * Called when the session ends (see handler/lib/session.h).
+ */
+void crypto_session_cache_reset(void);
+
+/**
+ * Computes extended pubkey at a given path, serialized as per BIP32. Only public derivations are
+ * used: if the last step is unhardened, the key is derived with CKDpub from the parent pubkey
+ * derived by the OS, that is also needed for the fingerprint. If the app is built with
+ * HAVE_XPUB_CACHE, the account-level extended pubkeys are also looked up in the cache in NVM of
+ * handler/lib/xpub_cache.h; they are only added to it by get_wallet_extended_pubkey_at_path.
  *
  * @param[in]  bip32_path
  *   Pointer to 32-bit array of BIP-32 derivation steps.
@@ -270,6 +448,17 @@ int get_extended_pubkey_at_path(const uint32_t bip32_path[],
                                 uint32_t bip32_pubkey_version,
                                 serialized_extended_pubkey_t *out_pubkey);
 
+/**
+ * Same as get_extended_pubkey_at_path, for the keys of the wallets that the device signs for or
+ * registers: if the app is built with HAVE_XPUB_CACHE, the account-level extended pubkeys that are
+ * not in the cache in NVM are also added to it. The other commands, like GET_EXTENDED_PUBKEY, can
+ * ask for any path, and must not use it, as each new entry is a write to the flash.
+ */
+int get_wallet_extended_pubkey_at_path(const uint32_t bip32_path[],
+                                       uint8_t bip32_path_len,
+                                       uint32_t bip32_pubkey_version,
+                                       serialized_extended_pubkey_t *out_pubkey);
+
 /**
  * Derives the level-1 symmetric key at the given label using SLIP-0021.
  *
@@ -302,11 +491,46 @@ bool crypto_derive_symmetric_key(const char *label, size_t label_len, uint8_t ke
  */
 int base58_encode_address(const uint8_t in[20], uint32_t version, char *out, size_t out_len);
 
+/**
+ * Signs a SHA-256 hash using the ECDSA with deterministic nonce according to RFC6979 with the given
+ * private key. The signature is returned in the conventional DER encoding.
+ *
+ * @param[in]  private_key
+ *   Pointer to the signing private key, for example as returned by crypto_derive_private_key.
+ * @param[in]  hash
+ *   Pointer to a 32-byte SHA-256 hash digest.
+ * @param[out]  out
+ *   The pointer to the output array to contain the signature, that must be of length
+ * `MAX_DER_SIG_LEN`.
+ * @param[out]  info
+ *   Pointer to contain the `info` variable returned by `cx_ecdsa_sign`, or `NULL` if not needed.
+ *
+ * @return the length of the signature on success, or -1 in case of error.
+ */
+int crypto_ecdsa_sign_sha256_hash_with_private_key(const cx_ecfp_private_key_t *private_key,
+                                                   const uint8_t hash[static 32],
+                                                   uint8_t out[static MAX_DER_SIG_LEN],
+                                                   uint32_t *info);
+
+/**
+ * Maximum number of signatures computed by crypto_ecdsa_sign_sha256_hash_with_key in order to find
+ * one with a low R; about half of the signatures have a high R, therefore more than one is needed
+ * with probability 1/2, and all of them fail with probability 2^-MAX_LOW_R_ATTEMPTS.
+ */
+#define MAX_LOW_R_ATTEMPTS 32
+
 /**
  * Signs a SHA-256 hash using the ECDSA with deterministic nonce accordin to RFC6979; the signing
  * private key is the one derived at the given BIP-32 path. The signature is returned in the
  * conventional DER encoding.
  *
+ * If grind_low_r is true and the signature has a high R, that is, if it is 72 bytes long, the
+ * signature is computed again with the attempt counter as the additional data of RFC6979, as
+ * Bitcoin Core does, until R is low; the signature is then at most 71 bytes long, and the same
+ * that Bitcoin Core would produce with the same key. As the OS cannot compute these signatures,
+ * they are computed by the app, and verified with the public key before being returned; if the
+ * verification fails, nothing is returned.
+ *
  * @param[in]  bip32_path
  *   Pointer to 32-bit array of BIP-32 derivation steps.
  * @param[in]  bip32_path_len
@@ -321,6 +545,8 @@ int base58_encode_address(const uint8_t in[20], uint32_t version, char *out, siz
  * `MAX_DER_SIG_LEN`.
  * @param[out]  info
  *   Pointer to contain the `info` variable returned by `cx_ecdsa_sign`, or `NULL` if not needed.
+ * @param[in]  grind_low_r
+ *   Whether to grind the nonce until the signature has a low R.
  *
  * @return the length of the signature on success, or -1 in case of error.
  */
@@ -329,7 +555,8 @@ int crypto_ecdsa_sign_sha256_hash_with_key(const uint32_t bip32_path[],
                                            const uint8_t hash[static 32],
                                            uint8_t *pubkey,
                                            uint8_t out[static MAX_DER_SIG_LEN],
-                                           uint32_t *info);
+                                           uint32_t *info,
+                                           bool grind_low_r);
 
 /**
  * Initializes the "tagged" SHA256 hash with the given tag, as defined by BIP-0340.
@@ -351,6 +578,14 @@ void crypto_tr_tagged_hash_init(cx_sha256_t *hash_context, const uint8_t *tag, u
  */
 void crypto_tr_tapleaf_hash_init(cx_sha256_t *hash_context);
 
+/**
+ * Initializes the "tagged" SHA256 hash with tag "TapSighash", used for the BIP-0341 sighash.
+ *
+ * @param[out]  hash_context
+ *   Pointer to a sha256 hash context.
+ */
+void crypto_tr_tapsighash_init(cx_sha256_t *hash_context);
+
 /**
  * Computes the tagged hash with tagged hash of a tapbranch, given the hashes for the children.
  *
@@ -389,6 +624,30 @@ int crypto_tr_tweak_pubkey(const uint8_t pubkey[static 32],
                            uint8_t *y_parity,
                            uint8_t out[static 32]);
 
+/**
+ * Like crypto_tr_tweak_pubkey, for the BIP340 public key whose x is the x of the given uncompressed
+ * public key. As the full point is known, it is faster than crypto_tr_tweak_pubkey.
+ *
+ * @param[in]  pubkey
+ *   Pointer to a 65-byte uncompressed public key.
+ * @param[in]  h
+ *   Pointer to the tweaking data.
+ * @param[in]  h_len
+ *   Length of `h`.
+ * @param[out]  y_parity
+ *   Pointer to a variable that will be set to 0/1 according to the parity of th y-coordinate of the
+ * final tweaked pubkey.
+ * @param[out]  out
+ *  Pointer to the a 32-byte array that will contain the x coordinate of the tweaked key.
+ *
+ * @return 0 on success, or -1 in case of error.
+ */
+int crypto_tr_tweak_uncompressed_pubkey(const uint8_t pubkey[static 65],
+                                        const uint8_t *h,
+                                        size_t h_len,
+                                        uint8_t *y_parity,
+                                        uint8_t out[static 32]);
+
 /**
  * Computes the tweaked secret key from a BIP340 secret key.
  * Implementation of taproot_tweak_seckey of BIP341 with `h` set to the empty byte string.
@@ -0,0 +1,59 @@
+#pragma once
+
+/**
+ * Levelled logging over PRINTF. Messages above LOG_LEVEL are removed by the preprocessor, together
+ * with the evaluation of their arguments; release builds (no HAVE_PRINTF) default to LOG_LEVEL_NONE,
+ * so that nothing is left of them.
+ *
+ * Debug logs in loops that run once per input, output or APDU make semihosted builds much slower
+ * than the release build; only use LOG_DEBUG there. When LOG_LEVEL is not set explicitly (for
+ * example, with -DLOG_LEVEL=LOG_LEVEL_DEBUG), builds with PRINTF default to LOG_LEVEL_INFO.
+ */
+
+#include "os.h"
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#ifdef HAVE_PRINTF
+#define LOG_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_LEVEL LOG_LEVEL_NONE
+#endif
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) PRINTF(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) \
+    do {               \
+    } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) PRINTF(__VA_ARGS__)
+#else
+#define LOG_WARN(...) \
+    do {              \
+    } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) PRINTF(__VA_ARGS__)
+#else
+#define LOG_INFO(...) \
+    do {              \
+    } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) PRINTF(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) \
+    do {               \
+    } while (0)
+#endif
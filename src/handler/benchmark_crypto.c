@@ -0,0 +1,204 @@
+/*****************************************************************************
+ *   Ledger App Acre.
+ *   (c) 2024 Ledger SAS.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *****************************************************************************/
+
+#ifdef HAVE_PERF_STATS
+
+#include <stdint.h>
+#include <string.h>
+
+#include "boilerplate/dispatcher.h"
+#include "boilerplate/sw.h"
+#include "common/bip32.h"
+#include "common/write.h"
+#include "../commands.h"
+#include "../crypto.h"
+
+#include "benchmark_crypto.h"
+#include "handlers.h"
+
+extern uint16_t G_ticks;
+
+// Arbitrary inputs; the cost of the primitives does not depend on the value of the data
+static const uint8_t G_benchmark_data[64] = {
+    0x37, 0x9a, 0x1e, 0x5c, 0xd2, 0x84, 0x0b, 0x6e, 0xf1, 0x23, 0x98, 0x4d, 0xa7, 0x60, 0x15, 0xbc,
+    0x2f, 0x73, 0xc8, 0x09, 0x5e, 0xe4, 0x31, 0x8a, 0x66, 0xbd, 0x02, 0x97, 0x4a, 0xf8, 0x1c, 0x55,
+    0x88, 0x3e, 0xd9, 0x14, 0x6b, 0xa0, 0x47, 0xf2, 0x0d, 0x92, 0x5b, 0xe6, 0x39, 0x7c, 0xc1, 0x26,
+    0x9f, 0x40, 0xb5, 0x6a, 0x13, 0xde, 0x81, 0x2c, 0x77, 0xfa, 0x08, 0xc3, 0x5d, 0x94, 0x3b, 0xe0};
+
+static int run_primitive(benchmark_primitive_e primitive,
+                         const serialized_extended_pubkey_t *xpub,
+                         const uint8_t pubkey[static 65],
+                         cx_ecfp_private_key_t *private_key) {
+    uint8_t out[MAX_DER_SIG_LEN];
+    size_t out_len = sizeof(out);
+
+    switch (primitive) {
+        case BENCHMARK_SHA256:
+            cx_hash_sha256(G_benchmark_data, sizeof(G_benchmark_data), out, 32);
+            return 0;
+        case BENCHMARK_RIPEMD160:
+            crypto_ripemd160(G_benchmark_data, sizeof(G_benchmark_data), out);
+            return 0;
+        case BENCHMARK_HASH160:
+            crypto_hash160(G_benchmark_data, 33, out);
+            return 0;
+        case BENCHMARK_HMAC_SHA512:
+            cx_hmac_sha512(G_benchmark_data, 32, G_benchmark_data + 32, 32, out, 64);
+            return 0;
+        case BENCHMARK_KECCAK256: {
+            cx_sha3_t hash_context;
+            if (CX_OK != cx_keccak_init_no_throw(&hash_context, 256) ||
+                CX_OK != cx_hash_no_throw(&hash_context.header,
+                                          CX_LAST,
+                                          G_benchmark_data,
+                                          sizeof(G_benchmark_data),
+                                          out,
+                                          32)) {
+                return -1;
+            }
+            return 0;
+        }
+        case BENCHMARK_SCALAR_MULT: {
+            cx_ecfp_public_key_t public_key;
+            if (CX_OK != cx_ecfp_generate_pair_no_throw(CX_CURVE_256K1,
+                                                        &public_key,
+                                                        private_key,
+                                                        1)) {
+                return -1;
+            }
+            return 0;
+        }
+        case BENCHMARK_DECOMPRESS_PUBKEY: {
+            uint8_t uncompressed_pubkey[65];
+            return crypto_get_uncompressed_pubkey(xpub->compressed_pubkey, uncompressed_pubkey);
+        }
+        case BENCHMARK_CKDPUB: {
+            // without the cache, this includes the computation of the parent fingerprint
+            crypto_session_cache_reset();
+
+            serialized_extended_pubkey_t child;
+            return bip32_CKDpub(xpub, 0, &child);
+        }
+        case BENCHMARK_CKDPUB_UNCOMPRESSED: {
+            uint8_t child_pubkey[65];
+            uint8_t child_chain_code[32];
+            return bip32_CKDpub_uncompressed(pubkey,
+                                             xpub->chain_code,
+                                             0,
+                                             child_pubkey,
+                                             child_chain_code);
+        }
+        case BENCHMARK_DERIVE_PRIVATE_KEY: {
+            // without the cache, this measures the full derivation from the seed
+            crypto_session_cache_reset();
+
+            const uint32_t path[] = {BIP32_FIRST_HARDENED_CHILD + 84,
+                                     BIP32_FIRST_HARDENED_CHILD + BIP44_COIN_TYPE,
+                                     BIP32_FIRST_HARDENED_CHILD,
+                                     0,
+                                     0};
+            cx_ecfp_private_key_t key;
+            int ret = crypto_derive_private_key(path, sizeof(path) / sizeof(path[0]), &key);
+            explicit_bzero(&key, sizeof(key));
+            return ret;
+        }
+        case BENCHMARK_ECDSA_SIGN:
+            return crypto_ecdsa_sign_sha256_hash_with_private_key(private_key,
+                                                                  G_benchmark_data,
+                                                                  out,
+                                                                  NULL) < 0
+                       ? -1
+                       : 0;
+        case BENCHMARK_SCHNORR_SIGN:
+            if (CX_OK != cx_ecschnorr_sign_no_throw(private_key,
+                                                    CX_ECSCHNORR_BIP0340 | CX_RND_TRNG,
+                                                    CX_SHA256,
+                                                    G_benchmark_data,
+                                                    32,
+                                                    out,
+                                                    &out_len)) {
+                return -1;
+            }
+            return 0;
+        case BENCHMARK_TR_TWEAK_PUBKEY: {
+            uint8_t y_parity;
+            return crypto_tr_tweak_pubkey(xpub->compressed_pubkey + 1, NULL, 0, &y_parity, out);
+        }
+        default:
+            return -1;
+    }
+}
+
+void handler_benchmark_crypto(dispatcher_context_t *dc, uint8_t protocol_version) {
+    (void) protocol_version;
+
+    uint8_t primitive;
+    uint32_t n_iterations;
+    if (!buffer_read_u8(&dc->read_buffer, &primitive) ||
+        !buffer_read_u32(&dc->read_buffer, &n_iterations, BE)) {
+        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+        return;
+    }
+
+    if (primitive >= BENCHMARK_N_PRIMITIVES) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return;
+    }
+
+    // The inputs are prepared outside of the measured loop
+    const uint32_t account_path[] = {BIP32_FIRST_HARDENED_CHILD + 84,
+                                     BIP32_FIRST_HARDENED_CHILD + BIP44_COIN_TYPE,
+                                     BIP32_FIRST_HARDENED_CHILD};
+    serialized_extended_pubkey_t xpub;
+    uint8_t pubkey[65];
+    cx_ecfp_private_key_t private_key;
+    if (0 > get_extended_pubkey_at_path(account_path,
+                                        sizeof(account_path) / sizeof(account_path[0]),
+                                        BIP32_PUBKEY_VERSION,
+                                        &xpub) ||
+        0 > crypto_get_uncompressed_pubkey(xpub.compressed_pubkey, pubkey) ||
+        0 > crypto_derive_private_key(account_path,
+                                      sizeof(account_path) / sizeof(account_path[0]),
+                                      &private_key)) {
+        explicit_bzero(&private_key, sizeof(private_key));
+        SEND_SW(dc, SW_BAD_STATE);
+        return;
+    }
+
+    uint16_t start_tick = G_ticks;
+    int ret = 0;
+    for (uint32_t i = 0; i < n_iterations && ret == 0; i++) {
+        ret = run_primitive(primitive, &xpub, pubkey, &private_key);
+    }
+    uint16_t elapsed_ticks = G_ticks - start_tick;
+
+    explicit_bzero(&private_key, sizeof(private_key));
+    crypto_session_cache_reset();
+
+    if (ret != 0) {
+        SEND_SW(dc, SW_BAD_STATE);
+        return;
+    }
+
+    uint8_t response[1 + 4 + 2];
+    response[0] = primitive;
+    write_u32_be(response, 1, n_iterations);
+    write_u16_be(response, 5, elapsed_ticks);
+    SEND_RESPONSE(dc, response, sizeof(response), SW_OK);
+}
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+/**
+ * Primitives timed by the BENCHMARK_CRYPTO command, only available in perf builds
+ * (HAVE_PERF_STATS).
+ *
+ * Request : <primitive : 1> <n_iterations : 4>
+ * Response: <primitive : 1> <n_iterations : 4> <elapsed_ticks : 2>
+ *
+ * The integers are big-endian. The keys and the data are prepared before running the iterations,
+ * so that the command only measures the primitive. Ticks are not delivered while the device is
+ * computing, therefore elapsed_ticks is usually 0: the cost of a primitive is measured by the
+ * client, as the difference between the time of the command with N and with 0 iterations.
+ */
+typedef enum {
+    BENCHMARK_SHA256 = 0,           // cx_hash_sha256 of 64 bytes
+    BENCHMARK_RIPEMD160,            // crypto_ripemd160 of 64 bytes
+    BENCHMARK_HASH160,              // crypto_hash160 of a 33-byte pubkey
+    BENCHMARK_HMAC_SHA512,          // cx_hmac_sha512 with the sizes used in bip32_CKDpub
+    BENCHMARK_KECCAK256,            // Keccak-256 of 64 bytes, as in the withdrawal hashes
+    BENCHMARK_SCALAR_MULT,          // pubkey computation from a private key
+    BENCHMARK_DECOMPRESS_PUBKEY,    // crypto_get_uncompressed_pubkey
+    BENCHMARK_CKDPUB,               // bip32_CKDpub of a compressed xpub, without cache
+    BENCHMARK_CKDPUB_UNCOMPRESSED,  // bip32_CKDpub_uncompressed
+    BENCHMARK_DERIVE_PRIVATE_KEY,   // crypto_derive_private_key of a 5-step path, without cache
+    BENCHMARK_ECDSA_SIGN,           // crypto_ecdsa_sign_sha256_hash_with_private_key
+    BENCHMARK_SCHNORR_SIGN,         // BIP-340 signature, as in sign_psbt
+    BENCHMARK_TR_TWEAK_PUBKEY,      // crypto_tr_tweak_pubkey with an empty tweak
+    BENCHMARK_N_PRIMITIVES
+} benchmark_primitive_e;
@@ -8,6 +8,13 @@
 // Response: empty
 #define CCMD_YIELD 0x10
 
+// Prefix of a client command, carrying the content of a YIELD message that was deferred to save
+// its round trip (see dispatcher_context_t.defer_yield); only sent from
+// PROTOCOL_VERSION_DEFERRED_YIELD. It is not a client command by itself.
+// Request : <CCMD_DEFERRED_YIELD : 1> <len : 1> <yield data : len> <client command request>
+// Response: the response to the client command that follows the prefix
+#define CCMD_DEFERRED_YIELD 0x11
+
 /* MERKLE PROOFS */
 
 // Request : <GET_PREIMAGE : 1> <hash_type : 1> <hash : 32>
@@ -25,6 +32,53 @@
 // Response: <is_found(0 or 1) : 1> <leaf_index : 4>
 #define CCMD_GET_MERKLE_LEAF_INDEX 0x42
 
+// Request : <CCMD_GET_MERKLE_LEAF_ELEMENT : 1> <merkle_root : 32> <tree_size: 4> <leaf_index: 4>
+// Response: <is_complete(0 or 1) : 1>
+//           If is_complete == 1, it continues with:
+//           <proof_size: 1> <proof_hash 1: 32> ... <proof_hash proof_size: 32>
+//           <element_len : varint> <element : element_len>
+//           If is_complete == 0, nothing else follows, and the leaf must be requested with
+//           CCMD_GET_MERKLE_LEAF_PROOF and CCMD_GET_PREIMAGE instead.
+#define CCMD_GET_MERKLE_LEAF_ELEMENT 0x43
+
+// Request : <CCMD_GET_MERKLE_LEAF_RANGE : 1> <merkle_root : 32> <tree_size: 4> <begin: 4>
+//           <n_leaves: 4>
+// Response: <len = answer length : varint> <partial_len : 1> <answer : partial_len>
+//           The answer is a sequence of items in the order of a depth-first, left-to-right
+//           traversal of the tree: the root hash (32 bytes) of each maximal subtree disjoint from
+//           the range, and <element_len : varint> <element : element_len> for each leaf in the
+//           range. If partial_len < len, the remaining bytes will be given as responses of
+//           CCMD_GET_MORE_ELEMENTS, as 1-byte elements.
+#define CCMD_GET_MERKLE_LEAF_RANGE 0x44
+
+// Request : <CCMD_HINT_MERKLE_LEAVES : 1> <merkle_root : 32> <tree_size: 4> <begin: 4>
+//           <n_leaves: 4>
+// Response: empty
+//           Informs the client that the leaves with indices in [begin, begin + n_leaves) are about
+//           to be requested, so that it can prepare the responses in advance.
+#define CCMD_HINT_MERKLE_LEAVES 0x45
+
+// Request : <CCMD_GET_MERKLEIZED_MAP_VALUES : 1> <keys_root : 32> <values_root : 32> <size : 4>
+//           <n_keys : 1> <key_hash 1 : 32> ... <key_hash n_keys : 32>
+// Response: <len = answer length : varint> <partial_len : 1> <answer : partial_len>
+//           The answer starts with <is_found(0 or 1) : 1> <leaf_index : varint> for each key, in
+//           the order of the request. It continues with the proof of the found keys in the keys
+//           tree, and then with the proof of their values in the values tree, both in the format
+//           of CCMD_GET_MERKLE_LEAF_RANGE for the found indices, in increasing order; the leaves
+//           of the keys tree are omitted, as they are known. The remaining bytes are given as
+//           responses of CCMD_GET_MORE_ELEMENTS, as for CCMD_GET_MERKLE_LEAF_RANGE.
+#define CCMD_GET_MERKLEIZED_MAP_VALUES 0x46
+
+// 0x47 is CCMD_MULTI_REQUEST, that the clients of PROTOCOL_VERSION_MULTI_REQUEST and later
+// implement, but that the app does not send.
+
+// Request : <CCMD_GET_MERKLE_LEAF_HASHES : 1> <merkle_root : 32> <tree_size : varint>
+// Response: <len = answer length : varint> <partial_len : 1> <answer : partial_len>
+//           The answer is the concatenation of the hashes of all the leaves of the tree, in order
+//           (32 * tree_size bytes). The remaining bytes are given as responses of
+//           CCMD_GET_MORE_ELEMENTS, as for CCMD_GET_MERKLE_LEAF_RANGE.
+#define CCMD_GET_MERKLE_LEAF_HASHES 0x48
+
 /* GENERIC/MULTIPURPOSE */
 
 // Used to get additional elements from the host when the required response from an interruption did
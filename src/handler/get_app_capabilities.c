@@ -0,0 +1,102 @@
+/*****************************************************************************
+ *   Ledger App Acre.
+ *   (c) 2024 Ledger SAS.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *****************************************************************************/
+
+#include <stdint.h>
+
+#include "boilerplate/dispatcher.h"
+#include "boilerplate/io.h"
+#include "boilerplate/sw.h"
+#include "common/wallet.h"
+#include "common/write.h"
+#include "../commands.h"
+#include "../constants.h"
+
+#include "client_commands.h"
+#include "get_app_capabilities.h"
+#include "handlers.h"
+#include "lib/get_merkleized_map_value.h"
+#include "lib/map_contents_cache.h"
+#include "lib/merkle_node_cache.h"
+#include "lib/merkleized_map_cache.h"
+#include "lib/rawtx_cache.h"
+#include "lib/validated_psbt_cache.h"
+#include "lib/wallet_policy_cache.h"
+#include "lib/xpub_cache.h"
+
+#ifndef HAVE_XPUB_CACHE
+#define XPUB_CACHE_SIZE 0
+#endif
+
+#define CCMD_BIT(ccmd) (1ul << ((ccmd) - CCMD_GET_PREIMAGE))
+
+// The client commands sent by the app, besides CCMD_YIELD and CCMD_GET_MORE_ELEMENTS
+static const uint32_t SUPPORTED_CLIENT_COMMANDS =
+    CCMD_BIT(CCMD_GET_PREIMAGE) | CCMD_BIT(CCMD_GET_MERKLE_LEAF_PROOF) |
+    CCMD_BIT(CCMD_GET_MERKLE_LEAF_INDEX) | CCMD_BIT(CCMD_GET_MERKLE_LEAF_ELEMENT) |
+    CCMD_BIT(CCMD_GET_MERKLE_LEAF_RANGE) | CCMD_BIT(CCMD_HINT_MERKLE_LEAVES) |
+    CCMD_BIT(CCMD_GET_MERKLEIZED_MAP_VALUES) | CCMD_BIT(CCMD_GET_MERKLE_LEAF_HASHES);
+
+typedef struct {
+    uint8_t id;
+    uint32_t value;
+} app_limit_t;
+
+static const app_limit_t APP_LIMITS[] = {
+    {APP_LIMIT_MAX_CONTINUE_LENGTH, MAX_EXTENDED_CONTINUE_LENGTH},
+    {APP_LIMIT_MAX_RESPONSE_LENGTH, MAX_CHAINED_RESPONSE_LENGTH},
+    {APP_LIMIT_MAX_MERKLEIZED_MAP_VALUES_PER_REQUEST, MAX_MERKLEIZED_MAP_VALUES_PER_REQUEST},
+    {APP_LIMIT_MAX_N_PSBTS_IN_BATCH, MAX_N_PSBTS_IN_BATCH},
+    {APP_LIMIT_MAX_WITHDRAW_BATCH_SIZE, MAX_WITHDRAW_BATCH_SIZE},
+    {APP_LIMIT_MAX_N_INPUTS_CAN_SIGN, MAX_N_INPUTS_CAN_SIGN},
+    {APP_LIMIT_MAX_N_OUTPUTS_CAN_SIGN, MAX_N_OUTPUTS_CAN_SIGN},
+    {APP_LIMIT_MAX_N_KEYS_IN_WALLET_POLICY, MAX_N_KEYS_IN_WALLET_POLICY},
+    {APP_LIMIT_WALLET_POLICY_CACHE_SIZE, WALLET_POLICY_CACHE_SIZE},
+    {APP_LIMIT_VALIDATED_PSBT_CACHE_SIZE, VALIDATED_PSBT_CACHE_SIZE},
+    {APP_LIMIT_XPUB_CACHE_SIZE, XPUB_CACHE_SIZE},
+    {APP_LIMIT_MERKLE_NODE_CACHE_SIZE, MERKLE_NODE_CACHE_SIZE},
+    {APP_LIMIT_MERKLEIZED_MAP_CACHE_SIZE, MERKLEIZED_MAP_CACHE_SIZE},
+    {APP_LIMIT_MAP_CONTENTS_CACHE_BYTES, MAP_CONTENTS_CACHE_BYTES},
+    {APP_LIMIT_RAWTX_CACHE_SIZE, RAWTX_CACHE_SIZE},
+};
+
+#define N_APP_LIMITS (sizeof(APP_LIMITS) / sizeof(APP_LIMITS[0]))
+
+void handler_get_app_capabilities(dispatcher_context_t *dc, uint8_t protocol_version) {
+    // answered for any protocol version, so that the client can find out the one to use
+    (void) protocol_version;
+
+    uint8_t flags = 0;
+#ifdef HAVE_PERF_STATS
+    flags |= APP_CAPABILITY_FLAG_PERF_BUILD;
+#endif
+    if (io_is_high_latency_transport()) {
+        flags |= APP_CAPABILITY_FLAG_HIGH_LATENCY_TRANSPORT;
+    }
+
+    uint8_t response[1 + 1 + 4 + 1 + 1 + 5 * N_APP_LIMITS];
+    response[0] = APP_CAPABILITIES_FORMAT;
+    response[1] = CURRENT_PROTOCOL_VERSION;
+    write_u32_be(response, 2, SUPPORTED_CLIENT_COMMANDS);
+    response[6] = flags;
+    response[7] = (uint8_t) N_APP_LIMITS;
+    for (size_t i = 0; i < N_APP_LIMITS; i++) {
+        response[8 + 5 * i] = APP_LIMITS[i].id;
+        write_u32_be(response, 8 + 5 * i + 1, APP_LIMITS[i].value);
+    }
+
+    SEND_RESPONSE(dc, response, sizeof(response), SW_OK);
+}
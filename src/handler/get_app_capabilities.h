@@ -0,0 +1,42 @@
+#pragma once
+
+/**
+ * Format of the response of the GET_APP_CAPABILITIES command, that tells the client which protocol
+ * version and which client commands the running app supports, and the limits of the target.
+ *
+ * Response: <format : 1> <max_protocol_version : 1> <client_commands : 4> <flags : 1>
+ *           <n_limits : 1> <limit_id : 1> <limit_value : 4> ... (n_limits times)
+ *
+ * The integers are big-endian. Bit i of client_commands is set if the app can send the client
+ * command with code 0x40 + i, at the maximum protocol version; CCMD_YIELD and
+ * CCMD_GET_MORE_ELEMENTS are always supported. The limits are identified by the values of
+ * app_limit_e, and clients must ignore the identifiers that they do not know.
+ */
+#define APP_CAPABILITIES_FORMAT 1
+
+typedef enum {
+    APP_CAPABILITY_FLAG_PERF_BUILD = 0x01,              // built with HAVE_PERF_STATS
+    APP_CAPABILITY_FLAG_HIGH_LATENCY_TRANSPORT = 0x02,  // this command was received via BLE
+} app_capability_flag_e;
+
+typedef enum {
+    // sizes of the messages, in bytes
+    APP_LIMIT_MAX_CONTINUE_LENGTH = 0x01,  // MAX_EXTENDED_CONTINUE_LENGTH
+    APP_LIMIT_MAX_RESPONSE_LENGTH = 0x02,  // MAX_CHAINED_RESPONSE_LENGTH
+    // sizes of the batches
+    APP_LIMIT_MAX_MERKLEIZED_MAP_VALUES_PER_REQUEST = 0x03,
+    // 0x04 was the maximum number of sub-requests of CCMD_MULTI_REQUEST, that is not sent
+    APP_LIMIT_MAX_N_PSBTS_IN_BATCH = 0x05,
+    APP_LIMIT_MAX_WITHDRAW_BATCH_SIZE = 0x06,
+    APP_LIMIT_MAX_N_INPUTS_CAN_SIGN = 0x07,
+    APP_LIMIT_MAX_N_OUTPUTS_CAN_SIGN = 0x08,
+    APP_LIMIT_MAX_N_KEYS_IN_WALLET_POLICY = 0x09,
+    // number of entries of the caches, that depend on the target (see cache_sizes.h)
+    APP_LIMIT_WALLET_POLICY_CACHE_SIZE = 0x10,
+    APP_LIMIT_VALIDATED_PSBT_CACHE_SIZE = 0x11,
+    APP_LIMIT_XPUB_CACHE_SIZE = 0x12,
+    APP_LIMIT_MERKLE_NODE_CACHE_SIZE = 0x13,
+    APP_LIMIT_MERKLEIZED_MAP_CACHE_SIZE = 0x14,
+    APP_LIMIT_MAP_CONTENTS_CACHE_BYTES = 0x15,  // in bytes
+    APP_LIMIT_RAWTX_CACHE_SIZE = 0x16,
+} app_limit_e;
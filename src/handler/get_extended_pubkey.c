@@ -28,6 +28,8 @@
 #include "../ui/display.h"
 #include "../ui/menu.h"
 
+#include "client_commands.h"
+
 #define H 0x80000000ul
 
 static bool is_path_safe_for_pubkey_export(const uint32_t bip32_path[], size_t bip32_path_len) {
@@ -105,6 +107,123 @@ static bool is_path_safe_for_pubkey_export(const uint32_t bip32_path[], size_t b
     return true;
 }
 
+// Maximum length of the xpubs sent in a single YIELD message in batch mode, excluding the command
+// code
+#define MAX_XPUB_BATCH_LEN 254
+
+// Reads a BIP-32 path, serialized as its number of steps followed by the steps, from the data of
+// the APDU. On failure, it sends the appropriate status word and returns false.
+static bool read_bip32_path(dispatcher_context_t *dc,
+                            uint32_t bip32_path[static MAX_BIP32_PATH_STEPS],
+                            uint8_t *bip32_path_len) {
+    if (!buffer_read_u8(&dc->read_buffer, bip32_path_len)) {
+        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+        return false;
+    }
+
+    if (*bip32_path_len > MAX_BIP32_PATH_STEPS) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return false;
+    }
+
+    if (!buffer_read_bip32_path(&dc->read_buffer, bip32_path, *bip32_path_len)) {
+        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+        return false;
+    }
+    return true;
+}
+
+// Computes the base58 encoding of the serialized extended pubkey at the given path, and writes it
+// as a null-terminated string to out. Returns the length of the encoding, or -1 on error.
+static int get_xpub_string_at_path(const uint32_t bip32_path[],
+                                   uint8_t bip32_path_len,
+                                   char out[static MAX_SERIALIZED_PUBKEY_LENGTH + 1]) {
+    serialized_extended_pubkey_check_t pubkey_check;
+    if (0 > get_extended_pubkey_at_path(bip32_path,
+                                        bip32_path_len,
+                                        BIP32_PUBKEY_VERSION,
+                                        &pubkey_check.serialized_extended_pubkey)) {
+        PRINTF("Failed getting bip32 pubkey\n");
+        return -1;
+    }
+
+    crypto_get_checksum((uint8_t *) &pubkey_check.serialized_extended_pubkey,
+                        sizeof(pubkey_check.serialized_extended_pubkey),
+                        pubkey_check.checksum);
+
+    int pubkey_str_len = base58_encode((uint8_t *) &pubkey_check,
+                                       sizeof(pubkey_check),
+                                       out,
+                                       MAX_SERIALIZED_PUBKEY_LENGTH + 1);
+    if (pubkey_str_len != 111 && pubkey_str_len != 112) {
+        PRINTF("Failed encoding base58 pubkey\n");
+        return -1;
+    }
+    out[pubkey_str_len] = 0;
+    return pubkey_str_len;
+}
+
+// Sends a batch of xpubs to the client with a YIELD client command
+static bool yield_xpub_batch(dispatcher_context_t *dc, const uint8_t *batch, size_t batch_len) {
+    uint8_t cmd = CCMD_YIELD;
+    dc->add_to_response(&cmd, 1);
+    dc->add_to_response(batch, batch_len);
+    dc->finalize_response(SW_INTERRUPTED_EXECUTION);
+
+    if (dc->process_interruption(dc) < 0) {
+        SEND_SW(dc, SW_BAD_STATE);
+        return false;
+    }
+    return true;
+}
+
+// Batch mode: the data of the APDU contains several BIP-32 paths, and the corresponding xpubs are
+// returned with YIELD client commands, without being displayed. All the paths are validated before
+// any xpub is returned.
+static void get_extended_pubkeys_batch(dispatcher_context_t *dc) {
+    uint32_t bip32_path[MAX_BIP32_PATH_STEPS];
+    uint8_t bip32_path_len;
+
+    buffer_snapshot_t paths_start = buffer_snapshot(&dc->read_buffer);
+    while (buffer_can_read(&dc->read_buffer, 1)) {
+        if (!read_bip32_path(dc, bip32_path, &bip32_path_len)) return;
+
+        if (!is_path_safe_for_pubkey_export(bip32_path, bip32_path_len)) {
+            SEND_SW(dc, SW_NOT_SUPPORTED);
+            return;
+        }
+    }
+    buffer_restore(&dc->read_buffer, paths_start);
+
+    // each xpub is prefixed by its length, and the YIELD messages contain as many as fit
+    uint8_t batch[MAX_XPUB_BATCH_LEN];
+    size_t batch_len = 0;
+
+    while (buffer_can_read(&dc->read_buffer, 1)) {
+        if (!read_bip32_path(dc, bip32_path, &bip32_path_len)) return;
+
+        char pubkey_str[MAX_SERIALIZED_PUBKEY_LENGTH + 1];
+        int pubkey_str_len = get_xpub_string_at_path(bip32_path, bip32_path_len, pubkey_str);
+        if (pubkey_str_len < 0) {
+            SEND_SW(dc, SW_BAD_STATE);
+            return;
+        }
+
+        if (batch_len + 1 + pubkey_str_len > sizeof(batch)) {
+            if (!yield_xpub_batch(dc, batch, batch_len)) return;
+            batch_len = 0;
+        }
+
+        batch[batch_len++] = (uint8_t) pubkey_str_len;
+        memcpy(batch + batch_len, pubkey_str, pubkey_str_len);
+        batch_len += pubkey_str_len;
+    }
+
+    if (!yield_xpub_batch(dc, batch, batch_len)) return;
+
+    SEND_SW(dc, SW_OK);
+}
+
 void handler_get_extended_pubkey(dispatcher_context_t *dc, uint8_t protocol_version) {
     (void) protocol_version;
 
@@ -112,20 +231,28 @@ void handler_get_extended_pubkey(dispatcher_context_t *dc, uint8_t protocol_vers
 
     uint8_t display;
     uint8_t bip32_path_len;
-    if (!buffer_read_u8(&dc->read_buffer, &display) ||
-        !buffer_read_u8(&dc->read_buffer, &bip32_path_len)) {
+    if (!buffer_read_u8(&dc->read_buffer, &display)) {
         SEND_SW(dc, SW_WRONG_DATA_LENGTH);
         return;
     }
 
-    if (display > 1 || bip32_path_len > MAX_BIP32_PATH_STEPS) {
+    if (display > 1) {
         SEND_SW(dc, SW_INCORRECT_DATA);
         return;
     }
 
     uint32_t bip32_path[MAX_BIP32_PATH_STEPS];
-    if (!buffer_read_bip32_path(&dc->read_buffer, bip32_path, bip32_path_len)) {
-        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+    buffer_snapshot_t path_start = buffer_snapshot(&dc->read_buffer);
+    if (!read_bip32_path(dc, bip32_path, &bip32_path_len)) return;
+
+    // if there are more paths after the first one, the command is in batch mode
+    if (buffer_can_read(&dc->read_buffer, 1)) {
+        if (display) {
+            SEND_SW(dc, SW_INCORRECT_DATA);  // xpubs are never shown in batch mode
+            return;
+        }
+        buffer_restore(&dc->read_buffer, path_start);
+        get_extended_pubkeys_batch(dc);
         return;
     }
 
@@ -136,31 +263,12 @@ void handler_get_extended_pubkey(dispatcher_context_t *dc, uint8_t protocol_vers
         return;
     }
 
-    serialized_extended_pubkey_check_t pubkey_check;
-    if (0 > get_extended_pubkey_at_path(bip32_path,
-                                        bip32_path_len,
-                                        BIP32_PUBKEY_VERSION,
-                                        &pubkey_check.serialized_extended_pubkey)) {
-        PRINTF("Failed getting bip32 pubkey\n");
-        SEND_SW(dc, SW_BAD_STATE);
-        return;
-    }
-
-    crypto_get_checksum((uint8_t *) &pubkey_check.serialized_extended_pubkey,
-                        sizeof(pubkey_check.serialized_extended_pubkey),
-                        pubkey_check.checksum);
-
     char pubkey_str[MAX_SERIALIZED_PUBKEY_LENGTH + 1];
-    int pubkey_str_len = base58_encode((uint8_t *) &pubkey_check,
-                                       sizeof(pubkey_check),
-                                       pubkey_str,
-                                       sizeof(pubkey_str));
-    if (pubkey_str_len != 111 && pubkey_str_len != 112) {
-        PRINTF("Failed encoding base58 pubkey\n");
+    int pubkey_str_len = get_xpub_string_at_path(bip32_path, bip32_path_len, pubkey_str);
+    if (pubkey_str_len < 0) {
         SEND_SW(dc, SW_BAD_STATE);
         return;
     }
-    pubkey_str[pubkey_str_len] = 0;
 
     char path_str[MAX_SERIALIZED_BIP32_PATH_LENGTH + 1] = "(Master key)";
     if (bip32_path_len > 0) {
@@ -27,14 +27,15 @@
 void handler_get_master_fingerprint(dispatcher_context_t *dc, uint8_t protocol_version) {
     (void) protocol_version;
 
-    uint8_t master_pubkey[33];
-    if (!crypto_get_compressed_pubkey_at_path((uint32_t[]){}, 0, master_pubkey, NULL)) {
+    // usually already computed while the app was idle (see session_warm_up)
+    uint32_t master_key_fingerprint;
+    if (!crypto_try_get_master_key_fingerprint(&master_key_fingerprint)) {
         SEND_SW(dc, SW_BAD_STATE);  // should never happen
         return;
     }
 
     uint8_t master_fingerprint_be[4];
-    write_u32_be(master_fingerprint_be, 0, crypto_get_key_fingerprint(master_pubkey));
+    write_u32_be(master_fingerprint_be, 0, master_key_fingerprint);
 
     SEND_RESPONSE(dc, master_fingerprint_be, sizeof(master_fingerprint_be), SW_OK);
 }
@@ -37,12 +37,63 @@
 #include "../swap/handle_swap_sign_transaction.h"
 
 #include "lib/policy.h"
-#include "lib/get_preimage.h"
 #include "lib/get_merkle_leaf_element.h"
+#include "lib/wallet_policy_cache.h"
 
 #include "handlers.h"
 #include "client_commands.h"
 
+// Maximum length of the addresses sent in a single YIELD message in batch mode, excluding the
+// command code
+#define MAX_ADDRESS_BATCH_LEN 254
+
+// Computes the address of the wallet policy at the given change/address_index, and writes it as a
+// null-terminated string to out. Returns the length of the address, or -1 on error.
+static int __attribute__((noinline)) get_wallet_address_at(
+    dispatcher_context_t *dc,
+    const policy_map_wallet_header_t *header,
+    const policy_node_t *policy,
+    bool is_change,
+    uint32_t address_index,
+    char out[static MAX_ADDRESS_LENGTH_STR + 1]) {
+    uint8_t script[MAX_PREVOUT_SCRIPTPUBKEY_LEN];
+
+    int script_len = get_wallet_script(
+        dc,
+        policy,
+        &(wallet_derivation_info_t){.wallet_version = header->version,
+                                    .keys_merkle_root = header->keys_info_merkle_root,
+                                    .n_keys = header->n_keys,
+                                    .change = is_change,
+                                    .address_index = address_index},
+        script);
+    if (script_len < 0) {
+        PRINTF("Couldn't produce wallet script\n");
+        return -1;
+    }
+
+    int address_len = get_script_address(script, script_len, out, MAX_ADDRESS_LENGTH_STR + 1);
+    if (address_len < 0) {
+        PRINTF("Could not produce address\n");
+        return -1;
+    }
+    return address_len;
+}
+
+// Sends a batch of addresses to the client with a YIELD client command
+static bool yield_address_batch(dispatcher_context_t *dc, const uint8_t *batch, size_t batch_len) {
+    uint8_t cmd = CCMD_YIELD;
+    dc->add_to_response(&cmd, 1);
+    dc->add_to_response(batch, batch_len);
+    dc->finalize_response(SW_INTERRUPTED_EXECUTION);
+
+    if (dc->process_interruption(dc) < 0) {
+        SEND_SW(dc, SW_BAD_STATE);
+        return false;
+    }
+    return true;
+}
+
 void handler_get_wallet_address(dispatcher_context_t *dc, uint8_t protocol_version) {
     (void) protocol_version;
 
@@ -53,6 +104,9 @@ void handler_get_wallet_address(dispatcher_context_t *dc, uint8_t protocol_versi
     uint32_t address_index;
     uint8_t is_change;
 
+    // in batch mode, the number of consecutive addresses to return, starting from address_index
+    uint32_t count = 0;
+
     uint8_t wallet_id[32];
     uint8_t wallet_hmac[32];
 
@@ -92,33 +146,31 @@ void handler_get_wallet_address(dispatcher_context_t *dc, uint8_t protocol_versi
         return;
     }
 
-    {
-        uint8_t serialized_wallet_policy[MAX_WALLET_POLICY_SERIALIZED_LENGTH];
-
-        // Fetch the serialized wallet policy from the client
-        int serialized_wallet_policy_len = call_get_preimage(dc,
-                                                             wallet_id,
-                                                             serialized_wallet_policy,
-                                                             sizeof(serialized_wallet_policy));
-        if (serialized_wallet_policy_len < 0) {
-            SEND_SW(dc, SW_INCORRECT_DATA);
+    // count (optional); if present, the addresses are returned in batch mode
+    bool is_batch = buffer_can_read(&dc->read_buffer, 1);
+    if (is_batch) {
+        if (!buffer_read_u32(&dc->read_buffer, &count, BE)) {
+            SEND_SW(dc, SW_WRONG_DATA_LENGTH);
             return;
         }
-
-        buffer_t serialized_wallet_policy_buf =
-            buffer_create(serialized_wallet_policy, serialized_wallet_policy_len);
-
-        uint8_t policy_map_descriptor[MAX_DESCRIPTOR_TEMPLATE_LENGTH];
-        if (0 > read_and_parse_wallet_policy(dc,
-                                             &serialized_wallet_policy_buf,
-                                             &wallet_header,
-                                             policy_map_descriptor,
-                                             wallet_policy_map.bytes,
-                                             sizeof(wallet_policy_map.bytes))) {
+        // addresses are never shown in batch mode, and they must all be unhardened
+        if (display_address != 0 || count == 0 ||
+            count > BIP32_FIRST_HARDENED_CHILD - address_index) {
             SEND_SW(dc, SW_INCORRECT_DATA);
             return;
         }
     }
+    uint32_t last_address_index = is_batch ? address_index + count - 1 : address_index;
+
+    // Fetch the serialized wallet policy from the client, unless it is cached
+    if (0 > fetch_and_parse_wallet_policy(dc,
+                                          wallet_id,
+                                          &wallet_header,
+                                          wallet_policy_map.bytes,
+                                          sizeof(wallet_policy_map.bytes))) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return;
+    }
 
     // the binary OR of all the hmac bytes (so == 0 iff the hmac is identically 0)
     uint8_t hmac_or = 0;
@@ -126,10 +178,16 @@ void handler_get_wallet_address(dispatcher_context_t *dc, uint8_t protocol_versi
         hmac_or = hmac_or | wallet_hmac[i];
     }
 
-    if (hmac_or == 0) {
+    // a wallet policy in the on-device registry does not need an hmac
+    bool is_registered = is_wallet_policy_registered(wallet_id);
+
+    if (hmac_or == 0 && !is_registered) {
         // No hmac, verify that the policy is indeed a default one
 
-        if (!is_wallet_policy_standard(dc, &wallet_header, &wallet_policy_map.parsed)) {
+        if (!is_wallet_policy_standard_cached(dc,
+                                              wallet_id,
+                                              &wallet_header,
+                                              &wallet_policy_map.parsed)) {
             SEND_SW(dc, SW_INCORRECT_DATA);
             return;
         }
@@ -140,7 +198,7 @@ void handler_get_wallet_address(dispatcher_context_t *dc, uint8_t protocol_versi
             return;
         }
 
-        if (address_index > MAX_BIP44_ADDRESS_INDEX_RECOMMENDED) {
+        if (last_address_index > MAX_BIP44_ADDRESS_INDEX_RECOMMENDED) {
             PRINTF("Address index is too large\n");
             SEND_SW(dc, SW_INCORRECT_DATA);
             return;
@@ -150,10 +208,13 @@ void handler_get_wallet_address(dispatcher_context_t *dc, uint8_t protocol_versi
     } else {
         // Verify hmac
 
-        if (!check_wallet_hmac(wallet_id, wallet_hmac)) {
-            PRINTF("Incorrect hmac\n");
-            SEND_SW(dc, SW_SIGNATURE_FAIL);
-            return;
+        if (!is_registered && !wallet_policy_cache_is_hmac_verified(wallet_id, wallet_hmac)) {
+            if (!check_wallet_hmac(wallet_id, wallet_hmac)) {
+                PRINTF("Incorrect hmac\n");
+                SEND_SW(dc, SW_SIGNATURE_FAIL);
+                return;
+            }
+            wallet_policy_cache_set_hmac_verified(wallet_id, wallet_hmac);
         }
 
         is_wallet_default = false;
@@ -178,31 +239,60 @@ void handler_get_wallet_address(dispatcher_context_t *dc, uint8_t protocol_versi
         }
     }
 
-    {
-        uint8_t script[MAX_PREVOUT_SCRIPTPUBKEY_LEN];
-
-        int script_len = get_wallet_script(
-            dc,
-            &wallet_policy_map.parsed,
-            &(wallet_derivation_info_t){.wallet_version = wallet_header.version,
-                                        .keys_merkle_root = wallet_header.keys_info_merkle_root,
-                                        .n_keys = wallet_header.n_keys,
-                                        .change = is_change,
-                                        .address_index = address_index},
-            script);
-        if (script_len < 0) {
-            PRINTF("Couldn't produce wallet script\n");
-            SEND_SW(dc, SW_BAD_STATE);  // unexpected
-            return;
+    // fetch the information of all the keys at once, rather than during each derivation
+    if (0 > prefetch_policy_keys_info(dc,
+                                      wallet_header.version,
+                                      wallet_header.keys_info_merkle_root,
+                                      wallet_header.n_keys)) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return;
+    }
+
+    if (is_batch) {
+        // Each address is prefixed by its length, and they are sent in YIELD messages containing as
+        // many addresses as fit. The parsed wallet policy and the wallet key cache are shared by
+        // all the addresses, so only the /<address_index> derivation step is repeated.
+        uint8_t batch[MAX_ADDRESS_BATCH_LEN];
+        size_t batch_len = 0;
+
+        for (uint32_t i = 0; i < count; i++) {
+            char address[MAX_ADDRESS_LENGTH_STR + 1];  // null-terminated string
+            int address_len = get_wallet_address_at(dc,
+                                                    &wallet_header,
+                                                    &wallet_policy_map.parsed,
+                                                    is_change,
+                                                    address_index + i,
+                                                    address);
+            if (address_len < 0) {
+                SEND_SW(dc, SW_BAD_STATE);  // unexpected
+                return;
+            }
+
+            if (batch_len + 1 + address_len > sizeof(batch)) {
+                if (!yield_address_batch(dc, batch, batch_len)) return;
+                batch_len = 0;
+            }
+
+            batch[batch_len++] = (uint8_t) address_len;
+            memcpy(batch + batch_len, address, address_len);
+            batch_len += address_len;
         }
 
-        int address_len;
-        char address[MAX_ADDRESS_LENGTH_STR + 1];  // null-terminated string
+        if (!yield_address_batch(dc, batch, batch_len)) return;
 
-        address_len = get_script_address(script, script_len, address, sizeof(address));
+        SEND_SW(dc, SW_OK);
+        return;
+    }
 
+    {
+        char address[MAX_ADDRESS_LENGTH_STR + 1];  // null-terminated string
+        int address_len = get_wallet_address_at(dc,
+                                                &wallet_header,
+                                                &wallet_policy_map.parsed,
+                                                is_change,
+                                                address_index,
+                                                address);
         if (address_len < 0) {
-            PRINTF("Could not produce address\n");
             SEND_SW(dc, SW_BAD_STATE);  // unexpected
             return;
         }
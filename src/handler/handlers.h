@@ -4,9 +4,14 @@
 
 void handler_get_extended_pubkey(dispatcher_context_t *dispatcher_context, uint8_t p2);
 void handler_get_master_fingerprint(dispatcher_context_t *dispatcher_context, uint8_t p2);
+void handler_get_app_capabilities(dispatcher_context_t *dispatcher_context, uint8_t p2);
 void handler_get_wallet_address(dispatcher_context_t *dispatcher_context, uint8_t p2);
 void handler_register_wallet(dispatcher_context_t *dispatcher_context, uint8_t p2);
 void handler_sign_message(dispatcher_context_t *dispatcher_context, uint8_t p2);
 void handler_sign_psbt(dispatcher_context_t *dispatcher_context, uint8_t p2);
 void handler_withdraw(dispatcher_context_t *dispatcher_context, uint8_t p2);
-void handler_sign_erc4361_message(dispatcher_context_t *dispatcher_context, uint8_t p2);
\ No newline at end of file
+void handler_sign_erc4361_message(dispatcher_context_t *dispatcher_context, uint8_t p2);
+
+#ifdef HAVE_PERF_STATS
+void handler_benchmark_crypto(dispatcher_context_t *dispatcher_context, uint8_t p2);
+#endif
@@ -0,0 +1,14 @@
+#include "cache_slots.h"
+
+uint8_t cache_slots_take(cache_slots_t *slots, uint8_t n_entries, perf_cache_t cache) {
+    (void) cache;  // only used in perf builds
+
+    uint8_t index = slots->next;
+    if (slots->n_used < n_entries) {
+        ++slots->n_used;
+    } else {
+        PERF_COUNT_CACHE(cache, PERF_CACHE_EVICTION);
+    }
+    slots->next = (uint8_t) ((index + 1) % n_entries);
+    return index;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "../../boilerplate/perf_stats.h"
+
+/**
+ * The replacement policy shared by the caches with a fixed number of entries, whose RAM is their
+ * fixed budget: the entries are filled in order and, once all of them are used, the oldest one is
+ * replaced (first in, first out). It needs no bookkeeping on lookups, which are much more frequent
+ * than additions, and the entries of a command are mostly needed in the order they are added.
+ *
+ * Each cache keeps a cache_slots_t next to its entries, that is zeroed with them when the cache is
+ * wiped.
+ */
+typedef struct {
+    uint8_t next;    // index of the next entry to fill
+    uint8_t n_used;  // number of entries filled since the cache was wiped, up to its size
+} cache_slots_t;
+
+/**
+ * Returns the index of the entry to fill in a cache with n_entries entries, and moves to the next
+ * one. Once all the entries are used, the returned entry is the oldest one, and its replacement is
+ * counted as an eviction of the given cache (see perf_stats.h).
+ */
+uint8_t cache_slots_take(cache_slots_t *slots, uint8_t n_entries, perf_cache_t cache);
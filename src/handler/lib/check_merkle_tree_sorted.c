@@ -2,6 +2,7 @@
 
 #include "check_merkle_tree_sorted.h"
 #include "get_merkle_leaf_element.h"
+#include "get_merkle_leaf_range.h"
 
 #include "../../common/merkle.h"
 
@@ -10,6 +11,44 @@ static int compare_byte_arrays(const uint8_t array1[],
                                const uint8_t array2[],
                                size_t array2_len);
 
+typedef struct {
+    int prev_el_len;
+    uint8_t prev_el[MAX_CHECK_MERKLE_TREE_SORTED_PREIMAGE_SIZE];
+    bool is_sorted;
+
+    // the first n_buffered elements, each prefixed by its length (1 byte, as the elements that fit
+    // in the buffer are shorter than 256 bytes)
+    uint8_t buffered[MAX_CHECK_MERKLE_TREE_SORTED_BUFFER_SIZE];
+    size_t buffered_len;
+    size_t n_buffered;
+} sorted_range_state_t;
+
+// Called for each leaf streamed by call_get_merkle_leaf_range, before the range is verified
+static void sorted_range_callback(void *state_ptr,
+                                  uint32_t leaf_index,
+                                  const uint8_t *element,
+                                  size_t element_len) {
+    sorted_range_state_t *state = (sorted_range_state_t *) state_ptr;
+
+    if (leaf_index > 0 &&
+        compare_byte_arrays(state->prev_el, state->prev_el_len, element, element_len) >= 0) {
+        state->is_sorted = false;
+    }
+
+    memcpy(state->prev_el, element, element_len);
+    state->prev_el_len = element_len;
+
+    // once an element does not fit, the following ones are not buffered either, so that the
+    // buffered elements are always a prefix of the tree
+    if (state->n_buffered == leaf_index &&
+        state->buffered_len + 1 + element_len <= sizeof(state->buffered)) {
+        state->buffered[state->buffered_len] = (uint8_t) element_len;
+        memcpy(state->buffered + state->buffered_len + 1, element, element_len);
+        state->buffered_len += 1 + element_len;
+        ++state->n_buffered;
+    }
+}
+
 int call_check_merkle_tree_sorted_with_callback(dispatcher_context_t *dispatcher_context,
                                                 void *callback_state,
                                                 const uint8_t root[static 32],
@@ -18,36 +57,62 @@ int call_check_merkle_tree_sorted_with_callback(dispatcher_context_t *dispatcher
                                                 const merkleized_map_commitment_t *map_commitment) {
     // LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
-    int prev_el_len = 0;
-    uint8_t prev_el[MAX_CHECK_MERKLE_TREE_SORTED_PREIMAGE_SIZE];
+    if (size == 0) {
+        return 0;
+    }
+
+    _Static_assert(MAX_CHECK_MERKLE_TREE_SORTED_BUFFER_SIZE <= 256,
+                   "The length of the buffered elements must fit in 1 byte");
 
-    for (size_t cur_el_idx = 0; cur_el_idx < size; cur_el_idx++) {
-        uint8_t cur_el[MAX_CHECK_MERKLE_TREE_SORTED_PREIMAGE_SIZE];
+    // All the elements are streamed with a single request, and verified against the root with O(n)
+    // hashes, without a proof for each of them
+    sorted_range_state_t state = {.is_sorted = true};
+    uint8_t element_buf[MAX_CHECK_MERKLE_TREE_SORTED_PREIMAGE_SIZE];
+    if (0 > call_get_merkle_leaf_range(dispatcher_context,
+                                       root,
+                                       size,
+                                       0,
+                                       size,
+                                       element_buf,
+                                       sizeof(element_buf),
+                                       sorted_range_callback,
+                                       &state)) {
+        return -1;
+    }
+
+    if (!state.is_sorted) {
+        // elements are not in (strict) lexicographical order
+        PRINTF("Keys not in order\n");
+        return -1;
+    }
+
+    if (callback == NULL) {
+        return 0;
+    }
+
+    // The callback is only called once the elements are verified, as it might query the client
+    size_t offset = 0;
+    for (size_t cur_el_idx = 0; cur_el_idx < state.n_buffered; cur_el_idx++) {
+        size_t cur_el_len = state.buffered[offset];
+        buffer_t buf = buffer_create(state.buffered + offset + 1, cur_el_len);
+        callback(dispatcher_context, callback_state, map_commitment, cur_el_idx, &buf);
+        offset += 1 + cur_el_len;
+    }
+
+    // the elements that did not fit in the buffer are requested again, one by one
+    for (size_t cur_el_idx = state.n_buffered; cur_el_idx < size; cur_el_idx++) {
         int cur_el_len = call_get_merkle_leaf_element(dispatcher_context,
                                                       root,
                                                       size,
                                                       cur_el_idx,
-                                                      cur_el,
-                                                      sizeof(cur_el));
-
+                                                      element_buf,
+                                                      sizeof(element_buf));
         if (cur_el_len < 0) {
             return -1;
         }
 
-        if (cur_el_idx > 0 && compare_byte_arrays(prev_el, prev_el_len, cur_el, cur_el_len) >= 0) {
-            // elements are not in (strict) lexicographical order
-            PRINTF("Keys not in order\n");
-            return -1;
-        }
-
-        memcpy(prev_el, cur_el, cur_el_len);
-        prev_el_len = cur_el_len;
-
-        if (callback != NULL) {
-            // call callback with data
-            buffer_t buf = buffer_create(cur_el, cur_el_len);
-            callback(dispatcher_context, callback_state, map_commitment, cur_el_idx, &buf);
-        }
+        buffer_t buf = buffer_create(element_buf, cur_el_len);
+        callback(dispatcher_context, callback_state, map_commitment, cur_el_idx, &buf);
     }
     return 0;
 }
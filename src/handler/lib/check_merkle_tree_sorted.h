@@ -10,6 +10,11 @@
 // supported depth
 #define MAX_CHECK_MERKLE_TREE_SORTED_PREIMAGE_SIZE (34 + 32 * (MAX_TAPTREE_POLICY_DEPTH - 1))
 
+// size of the buffer for the elements that are passed to the callback after the verification; the
+// elements after the first one that does not fit are requested again one by one. The keys of a
+// typical PSBT map fit in it: most of them are 1 byte long, and the BIP32 derivations 34 bytes.
+#define MAX_CHECK_MERKLE_TREE_SORTED_BUFFER_SIZE 256
+
 typedef void (*merkle_tree_elements_callback_t)(struct dispatcher_context_s *,
                                                 void *,
                                                 const merkleized_map_commitment_t *,
@@ -18,9 +23,10 @@ typedef void (*merkle_tree_elements_callback_t)(struct dispatcher_context_s *,
 
 /**
  * Given a Merkle tree root and the size of the tree, it requests all the elements to the client
- * (verifying Merkle proofs) and verifies that the leaf preimages are in lexicographical order. If a
- * callback to a non-NULL function is given, it is called once for each of the elements of the
- * Merkle tree, in lexicographical order.
+ * with a single CCMD_GET_MERKLE_LEAF_RANGE request (rebuilding the Merkle root from them) and
+ * verifies that the leaf preimages are in lexicographical order. If a callback to a non-NULL
+ * function is given, it is called once for each of the elements of the Merkle tree, in
+ * lexicographical order, after all the elements are verified.
  *
  * Returns 0 on success, or a negative number on failure.
  */
@@ -1,8 +1,138 @@
+#include <string.h>
+
 #include "get_merkle_leaf_element.h"
 
 #include "get_merkle_leaf_hash.h"
 #include "get_merkle_preimage.h"
 
+#include "../../common/buffer.h"
+#include "../../common/merkle.h"
+#include "../../common/varint.h"
+#include "../../boilerplate/sw.h"
+#include "../../constants.h"
+#include "../client_commands.h"
+#include "merkle_leaf_table.h"
+#include "merkle_node_cache.h"
+
+#include "debug-helpers/debug.h"
+
+// Returned if the client signals that the answer does not fit in a single response
+#define ERR_LEAF_ELEMENT_DOES_NOT_FIT (-2)
+
+// Sends the GET_MERKLE_LEAF_ELEMENT request, and verifies the response.
+// Returns the length of the element on success, ERR_LEAF_ELEMENT_DOES_NOT_FIT if the client could
+// not fit the answer in a single response, or -1 on any other error.
+static int get_merkle_leaf_element_single_response(dispatcher_context_t *dc,
+                                                   const uint8_t merkle_root[static 32],
+                                                   uint32_t tree_size,
+                                                   uint32_t leaf_index,
+                                                   uint8_t *out_ptr,
+                                                   size_t out_ptr_len) {
+    PRINT_STACK_POINTER();
+
+    {  // the request is serialized directly in the response buffer
+        buffer_t request = dc->get_response_writer();
+        if (!buffer_write_u8(&request, CCMD_GET_MERKLE_LEAF_ELEMENT) ||
+            !buffer_write_bytes(&request, merkle_root, 32) ||
+            !buffer_write_varint(&request, tree_size) ||
+            !buffer_write_varint(&request, leaf_index)) {
+            return -1;
+        }
+        dc->commit_response(&request);
+        dc->finalize_response(SW_INTERRUPTED_EXECUTION);
+    }
+
+    if (dc->process_interruption(dc) < 0) {
+        return -1;
+    }
+
+    uint8_t is_complete;
+    if (!buffer_read_u8(&dc->read_buffer, &is_complete)) {
+        return -1;
+    }
+
+    if (is_complete == 0) {
+        // the client could not fit the answer in a single response
+        if (buffer_can_read(&dc->read_buffer, 1)) {
+            return -1;
+        }
+        return ERR_LEAF_ELEMENT_DOES_NOT_FIT;
+    } else if (is_complete != 1) {
+        return -1;
+    }
+
+    uint8_t proof_size;
+    if (!buffer_read_u8(&dc->read_buffer, &proof_size) ||
+        !buffer_can_read(&dc->read_buffer, 32 * (size_t) proof_size)) {
+        return -1;
+    }
+
+    merkle_leaf_path_t path;
+    if (0 > merkle_get_leaf_path(tree_size, leaf_index, &path) || proof_size != path.depth) {
+        PRINTF("Wrong length of the Merkle proof.\n");
+        return -1;
+    }
+
+    // we use the memory in the buffer directly, to avoid copying the proof unnecessarily
+    const uint8_t *proof = dc->read_buffer.ptr + dc->read_buffer.offset;
+    buffer_seek_cur(&dc->read_buffer, 32 * (size_t) proof_size);
+
+    uint64_t element_len;
+    if (!buffer_read_varint(&dc->read_buffer, &element_len) ||
+        !buffer_can_read(&dc->read_buffer, (size_t) element_len)) {
+        return -1;
+    }
+
+    if (element_len > out_ptr_len) {
+        PRINTF("Output buffer too short\n");
+        return -1;
+    }
+
+    const uint8_t *element = dc->read_buffer.ptr + dc->read_buffer.offset;
+
+    uint8_t cur_hash[32];
+    merkle_compute_element_hash(element, (size_t) element_len, cur_hash);
+
+    // Stop at the first node already verified during this command, if any
+    int cache_status =
+        merkle_node_cache_check(merkle_root, tree_size, proof_size, leaf_index, cur_hash);
+    if (cache_status == 0) {
+        merkle_node_cache_add_pending(merkle_root, tree_size, proof_size, leaf_index, cur_hash);
+    }
+
+    size_t start = leaf_index;  // index of the first leaf of the subtree of cur_hash
+    for (int cur_step = 0; cache_status == 0 && cur_step < proof_size; cur_step++) {
+        const uint8_t *sibling_hash = proof + 32 * cur_step;
+
+        int i = proof_size - cur_step - 1;
+        if (merkle_path_direction(&path, i) == 0) {
+            merkle_combine_hashes(cur_hash, sibling_hash, cur_hash);
+        } else {
+            merkle_combine_hashes(sibling_hash, cur_hash, cur_hash);
+        }
+        start = merkle_path_parent_start(&path, i, start);
+
+        if (i > 0) {
+            cache_status = merkle_node_cache_check(merkle_root, tree_size, i, start, cur_hash);
+            if (cache_status == 0) {
+                merkle_node_cache_add_pending(merkle_root, tree_size, i, start, cur_hash);
+            }
+        }
+    }
+
+    if (cache_status < 0 || (cache_status == 0 && memcmp(merkle_root, cur_hash, 32) != 0)) {
+        PRINTF("Merkle root mismatch");
+        merkle_node_cache_discard_pending();
+        return -1;
+    }
+
+    merkle_node_cache_commit_pending();
+
+    memcpy(out_ptr, element, (size_t) element_len);
+
+    return (int) element_len;
+}
+
 int call_get_merkle_leaf_element(dispatcher_context_t *dispatcher_context,
                                  const uint8_t merkle_root[static 32],
                                  uint32_t tree_size,
@@ -11,13 +141,41 @@ int call_get_merkle_leaf_element(dispatcher_context_t *dispatcher_context,
                                  size_t out_ptr_len) {
     // LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
+    // the root of a tree with a single leaf is the hash of the leaf, that only needs its preimage;
+    // common for the keys information of single-signature wallet policies, and for short messages
+    if (tree_size == 1) {
+        if (leaf_index != 0) {
+            return -1;
+        }
+        return call_get_merkle_preimage(dispatcher_context, merkle_root, out_ptr, out_ptr_len);
+    }
+
+    // likewise if the hash of the leaf is in the merkle_leaf_table
     uint8_t leaf_hash[32];
+    if (merkle_leaf_table_get(merkle_root, tree_size, leaf_index, leaf_hash)) {
+        return call_get_merkle_preimage(dispatcher_context, leaf_hash, out_ptr, out_ptr_len);
+    }
+
+    if (dispatcher_context->protocol_version >= PROTOCOL_VERSION_MERKLE_LEAF_ELEMENT) {
+        int res = get_merkle_leaf_element_single_response(dispatcher_context,
+                                                          merkle_root,
+                                                          tree_size,
+                                                          leaf_index,
+                                                          out_ptr,
+                                                          out_ptr_len);
+        if (res != ERR_LEAF_ELEMENT_DOES_NOT_FIT) {
+            return res;
+        }
+    }
 
-    int res = call_get_merkle_leaf_hash(dispatcher_context,
-                                        merkle_root,
-                                        tree_size,
-                                        leaf_index,
-                                        leaf_hash);
+    // The client does not support GET_MERKLE_LEAF_ELEMENT, or the answer did not fit in a single
+    // response; fall back to requesting the proof and the preimage separately.
+    int res;
+    res = call_get_merkle_leaf_hash(dispatcher_context,
+                                    merkle_root,
+                                    tree_size,
+                                    leaf_index,
+                                    leaf_hash);
     if (res < 0) {
         return res;
     }
@@ -3,7 +3,14 @@
 #include "../../boilerplate/dispatcher.h"
 
 /**
- * TODO: docs
+ * Requests the element at index leaf_index of the Merkle tree with the given root, and verifies it
+ * against the Merkle root. Uses a single CCMD_GET_MERKLE_LEAF_ELEMENT round trip when the client can
+ * fit the element and its proof in one response; otherwise, or if the client does not support it
+ * (see PROTOCOL_VERSION_MERKLE_LEAF_ELEMENT), it falls back to a CCMD_GET_MERKLE_LEAF_PROOF
+ * followed by a CCMD_GET_PREIMAGE. If the leaf hash is already known, because the tree has a
+ * single leaf or is in the merkle_leaf_table, only its CCMD_GET_PREIMAGE is sent.
+ *
+ * Returns the length of the element on success, or a negative number on failure.
  */
 int call_get_merkle_leaf_element(dispatcher_context_t *dispatcher_context,
                                  const uint8_t merkle_root[static 32],
@@ -8,6 +8,9 @@
 #include "../../common/varint.h"
 #include "../../boilerplate/sw.h"
 #include "../client_commands.h"
+#include "get_merkle_leaf_hashes.h"
+#include "merkle_leaf_table.h"
+#include "merkle_node_cache.h"
 
 #include "debug-helpers/debug.h"
 
@@ -21,19 +24,37 @@ int call_get_merkle_leaf_hash(dispatcher_context_t *dc,
 
     PRINT_STACK_POINTER();
 
-    {  // make sure memory is deallocated as soon as possible
-        uint8_t tmp[9];
-        tmp[0] = CCMD_GET_MERKLE_LEAF_PROOF;
-        dc->add_to_response(tmp, 1);
-
-        dc->add_to_response(merkle_root, 32);
+    if (leaf_index >= tree_size) {
+        return -1;
+    }
 
-        int tree_size_len = varint_write(tmp, 0, tree_size);
-        dc->add_to_response(tmp, tree_size_len);
+    // the root of a tree with a single leaf is the hash of the leaf: there is no proof to ask for
+    if (tree_size == 1) {
+        memcpy(out, merkle_root, 32);
+        return 0;
+    }
 
-        int leaf_index_len = varint_write(tmp, 0, leaf_index);
-        dc->add_to_response(tmp, leaf_index_len);
+    // the leaves of the small trees accessed more than once are served from their table
+    if (merkle_leaf_table_get(merkle_root, tree_size, leaf_index, out)) {
+        return 0;
+    }
+    if (merkle_leaf_table_should_download(merkle_root, tree_size)) {
+        if (0 > call_get_merkle_leaf_hashes(dc, merkle_root, tree_size) ||
+            !merkle_leaf_table_get(merkle_root, tree_size, leaf_index, out)) {
+            return -1;
+        }
+        return 0;
+    }
 
+    {  // the request is serialized directly in the response buffer
+        buffer_t request = dc->get_response_writer();
+        if (!buffer_write_u8(&request, CCMD_GET_MERKLE_LEAF_PROOF) ||
+            !buffer_write_bytes(&request, merkle_root, 32) ||
+            !buffer_write_varint(&request, tree_size) ||
+            !buffer_write_varint(&request, leaf_index)) {
+            return -1;
+        }
+        dc->commit_response(&request);
         dc->finalize_response(SW_INTERRUPTED_EXECUTION);
     }
 
@@ -44,13 +65,13 @@ int call_get_merkle_leaf_hash(dispatcher_context_t *dc,
     {
         int cur_step;          // counter for the proof steps
         uint8_t cur_hash[32];  // temporary buffer for intermediate hashes
-        uint8_t proof_size;
-        uint8_t n_proof_elements;
-        if (!buffer_read_bytes(&dc->read_buffer, cur_hash, 32) ||
-            !buffer_read_u8(&dc->read_buffer, &proof_size) ||
-            !buffer_read_u8(&dc->read_buffer, &n_proof_elements)) {
+        const uint8_t *header = buffer_reserve_read(&dc->read_buffer, 32 + 1 + 1);
+        if (header == NULL) {
             return -1;
         }
+        memcpy(cur_hash, header, 32);
+        uint8_t proof_size = header[32];
+        uint8_t n_proof_elements = header[33];
 
         if (n_proof_elements > proof_size) {
             PRINTF("Received more proof data than expected.\n");
@@ -59,34 +80,65 @@ int call_get_merkle_leaf_hash(dispatcher_context_t *dc,
             return -1;
         }
 
-        if (!buffer_can_read(&dc->read_buffer, 32 * (size_t) n_proof_elements)) {
+        merkle_leaf_path_t path;
+        if (0 > merkle_get_leaf_path(tree_size, leaf_index, &path) || proof_size != path.depth) {
+            PRINTF("Wrong length of the Merkle proof.\n");
+            return -1;
+        }
+
+        // the sibling hashes are read directly from the buffer, to avoid copying them
+        const uint8_t *sibling_hashes =
+            buffer_reserve_read(&dc->read_buffer, 32 * (size_t) n_proof_elements);
+        if (sibling_hashes == NULL) {
             return -1;
         }
 
         // Copy leaf hash to output (although it is not verified yet)
         memcpy(out, cur_hash, 32);
 
+        // If an ancestor of the leaf (or the leaf itself) was already verified during this
+        // command, there is no need to hash the rest of the path up to the root; the remaining
+        // proof elements are still consumed.
+        int cache_status =
+            merkle_node_cache_check(merkle_root, tree_size, proof_size, leaf_index, cur_hash);
+        if (cache_status < 0) {
+            return -1;
+        } else if (cache_status == 0) {
+            merkle_node_cache_add_pending(merkle_root, tree_size, proof_size, leaf_index, cur_hash);
+        }
+
         // Initialize proof verification
         cur_step = 0;
+        size_t start = leaf_index;  // index of the first leaf of the subtree of cur_hash
 
         while (true) {
             int end_step = cur_step + n_proof_elements;
-            for (; cur_step < end_step; cur_step++) {
-                // we use the memory in the buffer directly, to avoid copying the hash unnecessarily
-                const uint8_t *sibling_hash = dc->read_buffer.ptr + dc->read_buffer.offset;
+            for (; cur_step < end_step; cur_step++, sibling_hashes += 32) {
+                if (cache_status != 0) {
+                    continue;  // the remaining sibling hashes are only consumed
+                }
 
-                int i = proof_size - cur_step - 1;
-                int direction = merkle_get_ith_direction(tree_size, leaf_index, i);
+                const uint8_t *sibling_hash = sibling_hashes;
 
-                if (direction == 0) {
+                int i = proof_size - cur_step - 1;
+                if (merkle_path_direction(&path, i) == 0) {
                     merkle_combine_hashes(cur_hash, sibling_hash, cur_hash);
-                } else if (direction == 1) {
-                    merkle_combine_hashes(sibling_hash, cur_hash, cur_hash);
                 } else {
-                    return -1;  // unexpected, proof too long?
+                    merkle_combine_hashes(sibling_hash, cur_hash, cur_hash);
+                }
+                start = merkle_path_parent_start(&path, i, start);
+
+                if (i > 0) {
+                    cache_status =
+                        merkle_node_cache_check(merkle_root, tree_size, i, start, cur_hash);
+                    if (cache_status < 0) {
+                        PRINTF("Merkle proof mismatch");
+                        merkle_node_cache_discard_pending();
+                        return -1;
+                    } else if (cache_status == 0) {
+                        merkle_node_cache_add_pending(merkle_root, tree_size, i, start, cur_hash);
+                    }
                 }
-
-                buffer_seek_cur(&dc->read_buffer, 32);  // consume the bytes of the sibling hash
             }
 
             if (cur_step == proof_size) {
@@ -96,31 +148,38 @@ int call_get_merkle_leaf_hash(dispatcher_context_t *dc,
             uint8_t req_more[] = {CCMD_GET_MORE_ELEMENTS};
             SET_RESPONSE(dc, req_more, sizeof(req_more), SW_INTERRUPTED_EXECUTION);
             if (dc->process_interruption(dc) < 0) {
+                merkle_node_cache_discard_pending();
                 return -1;
             }
 
             // Parse response to CCMD_GET_MORE_ELEMENTS
-            uint8_t elements_len;
-            if (!buffer_read_u8(&dc->read_buffer, &n_proof_elements) ||
-                !buffer_read_u8(&dc->read_buffer, &elements_len) ||
-                !buffer_can_read(&dc->read_buffer, (size_t) n_proof_elements * elements_len)) {
+            const uint8_t *more_header = buffer_reserve_read(&dc->read_buffer, 2);
+            if (more_header == NULL || more_header[1] != 32) {
+                merkle_node_cache_discard_pending();
                 return -1;
             }
+            n_proof_elements = more_header[0];
 
-            if (elements_len != 32) {
+            sibling_hashes = buffer_reserve_read(&dc->read_buffer, 32 * (size_t) n_proof_elements);
+            if (sibling_hashes == NULL) {
+                merkle_node_cache_discard_pending();
                 return -1;
             }
 
             if (cur_step + n_proof_elements > proof_size) {
                 // Receiving more data then expected
+                merkle_node_cache_discard_pending();
                 return -1;
             }
         }
 
-        if (memcmp(merkle_root, cur_hash, 32) != 0) {
+        if (cache_status == 0 && memcmp(merkle_root, cur_hash, 32) != 0) {
             PRINTF("Merkle root mismatch");
+            merkle_node_cache_discard_pending();
             return -1;
         }
+
+        merkle_node_cache_commit_pending();
     }
 
     return 0;
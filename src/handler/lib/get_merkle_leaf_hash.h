@@ -3,7 +3,13 @@
 #include "../../boilerplate/dispatcher.h"
 
 /**
- * TODO: docs
+ * Requests the hash of the leaf at index leaf_index of the Merkle tree with the given root with a
+ * CCMD_GET_MERKLE_LEAF_PROOF, and verifies it against the Merkle root. For a tree with a single
+ * leaf, the root is the leaf hash, and no request is sent. For the small trees that are accessed
+ * more than once, the hashes of all the leaves are downloaded instead, and kept in the
+ * merkle_leaf_table for the next accesses (see merkle_leaf_table.h).
+ *
+ * Returns 0 on success, or a negative number on failure.
  */
 int call_get_merkle_leaf_hash(dispatcher_context_t *dispatcher_context,
                               const uint8_t merkle_root[static 32],
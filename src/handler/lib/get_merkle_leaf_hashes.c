@@ -0,0 +1,81 @@
+#include <string.h>
+
+#include "get_merkle_leaf_hashes.h"
+
+#include "get_merkle_leaf_range.h"
+#include "merkle_leaf_table.h"
+
+#include "../../boilerplate/sw.h"
+#include "../../common/buffer.h"
+#include "../../common/merkle.h"
+#include "../client_commands.h"
+
+#include "debug-helpers/debug.h"
+
+typedef struct {
+    merkle_answer_stream_t stream;
+    uint8_t (*leaf_hashes)[32];
+    uint32_t next_leaf_index;
+} leaf_hashes_stream_state_t;
+
+// All the hashes of a range that covers the whole tree are leaves, that are also kept in the table
+static int leaf_hashes_source(void *state_ptr, bool is_leaf, uint8_t out[static 32]) {
+    leaf_hashes_stream_state_t *state = (leaf_hashes_stream_state_t *) state_ptr;
+
+    if (!is_leaf || 0 > merkle_answer_stream_read(&state->stream, out, 32)) {
+        return -1;
+    }
+    memcpy(state->leaf_hashes[state->next_leaf_index++], out, 32);
+    return 0;
+}
+
+int call_get_merkle_leaf_hashes(dispatcher_context_t *dc,
+                                const uint8_t merkle_root[static 32],
+                                uint32_t tree_size) {
+    // LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    PRINT_STACK_POINTER();
+
+    uint8_t(*leaf_hashes)[32] = merkle_leaf_table_reserve(merkle_root, tree_size);
+    if (leaf_hashes == NULL) {
+        return -1;
+    }
+
+    {  // the request is serialized directly in the response buffer
+        buffer_t request = dc->get_response_writer();
+        if (!buffer_write_u8(&request, CCMD_GET_MERKLE_LEAF_HASHES) ||
+            !buffer_write_bytes(&request, merkle_root, 32) ||
+            !buffer_write_varint(&request, tree_size)) {
+            return -1;
+        }
+        dc->commit_response(&request);
+        dc->finalize_response(SW_INTERRUPTED_EXECUTION);
+    }
+
+    if (dc->process_interruption(dc) < 0) {
+        return -1;
+    }
+
+    leaf_hashes_stream_state_t state = {.leaf_hashes = leaf_hashes};
+    if (0 > merkle_answer_stream_init(&state.stream, dc)) {
+        return -1;
+    }
+
+    uint8_t root[32];
+    if (0 > merkle_compute_range_root(tree_size, 0, tree_size, leaf_hashes_source, &state, root)) {
+        return -1;
+    }
+
+    if (!merkle_answer_stream_is_done(&state.stream)) {
+        PRINTF("Received more data than expected.\n");
+        return -1;
+    }
+
+    if (memcmp(merkle_root, root, 32) != 0) {
+        PRINTF("Merkle root mismatch");
+        return -1;
+    }
+
+    merkle_leaf_table_commit();
+    return 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "../../boilerplate/dispatcher.h"
+
+/**
+ * Requests the hashes of all the leaves of the Merkle tree with the given root using a single
+ * CCMD_GET_MERKLE_LEAF_HASHES request, verifies them by recomputing the root with tree_size - 1
+ * combinations, and adds them to the merkle_leaf_table. The tree must have at most
+ * MERKLE_LEAF_TABLE_MAX_LEAVES leaves.
+ *
+ * The client only supports it from PROTOCOL_VERSION_MERKLE_LEAF_HASHES.
+ *
+ * Returns 0 on success, or a negative number on failure.
+ */
+int call_get_merkle_leaf_hashes(dispatcher_context_t *dispatcher_context,
+                                const uint8_t merkle_root[static 32],
+                                uint32_t tree_size);
@@ -2,6 +2,7 @@
 
 #include "../../boilerplate/sw.h"
 #include "get_merkle_leaf_hash.h"
+#include "merkle_leaf_table.h"
 
 #include "../client_commands.h"
 
@@ -11,6 +12,19 @@ int call_get_merkle_leaf_index(dispatcher_context_t *dispatcher_context,
                                const uint8_t leaf_hash[static 32]) {
     // LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
+    // the only leaf of a tree with a single leaf is the root
+    if (size == 1) {
+        return memcmp(leaf_hash, root, 32) == 0 ? 0 : -3;
+    }
+
+    // all the leaves of a tree in the merkle_leaf_table are known
+    if (size <= MERKLE_LEAF_TABLE_MAX_LEAVES) {
+        int index = merkle_leaf_table_find(root, size, leaf_hash);
+        if (index != -2) {
+            return index >= 0 ? index : -3;
+        }
+    }
+
     {  // free memory as soon as possible
         uint8_t request[1 + 32 + 32];
         request[0] = CCMD_GET_MERKLE_LEAF_INDEX;
@@ -0,0 +1,239 @@
+#include <string.h>
+
+#include "get_merkle_leaf_range.h"
+
+#include "../../boilerplate/sw.h"
+#include "../../common/buffer.h"
+#include "../../common/merkle.h"
+#include "../../common/varint.h"
+#include "../../constants.h"
+#include "../client_commands.h"
+#include "get_merkle_leaf_element.h"
+
+#include "debug-helpers/debug.h"
+
+int merkle_answer_stream_init(merkle_answer_stream_t *stream, dispatcher_context_t *dc) {
+    uint64_t total_len;
+    uint8_t partial_data_len;
+    if (!buffer_read_varint(&dc->read_buffer, &total_len) ||
+        !buffer_read_u8(&dc->read_buffer, &partial_data_len) ||
+        !buffer_can_read(&dc->read_buffer, partial_data_len)) {
+        return -1;
+    }
+
+    if (partial_data_len > total_len) {
+        return -1;
+    }
+
+    stream->dc = dc;
+    stream->chunk_remaining = partial_data_len;
+    stream->bytes_remaining = (size_t) total_len - partial_data_len;
+    return 0;
+}
+
+int merkle_answer_stream_read(merkle_answer_stream_t *stream, uint8_t *out, size_t len) {
+    dispatcher_context_t *dc = stream->dc;
+
+    while (len > 0) {
+        if (stream->chunk_remaining == 0) {
+            if (stream->bytes_remaining == 0) {
+                PRINTF("Unexpected end of the answer\n");
+                return -1;
+            }
+
+            // A single response can contain more than one group of elements
+            if (!buffer_can_read(&dc->read_buffer, 1)) {
+                uint8_t req_more[] = {CCMD_GET_MORE_ELEMENTS};
+                SET_RESPONSE(dc, req_more, sizeof(req_more), SW_INTERRUPTED_EXECUTION);
+                if (dc->process_interruption(dc) < 0) {
+                    return -1;
+                }
+            }
+
+            // Parse response to CCMD_GET_MORE_ELEMENTS
+            uint8_t n_bytes, elements_len;
+            if (!buffer_read_u8(&dc->read_buffer, &n_bytes) ||
+                !buffer_read_u8(&dc->read_buffer, &elements_len) ||
+                !buffer_can_read(&dc->read_buffer, (size_t) n_bytes * elements_len)) {
+                return -1;
+            }
+
+            if (elements_len != 1) {
+                PRINTF("Elements should be single bytes\n");
+                return -1;
+            }
+
+            if (n_bytes == 0 || n_bytes > stream->bytes_remaining) {
+                PRINTF("Received an unexpected number of bytes.\n");
+                return -1;
+            }
+
+            stream->chunk_remaining = n_bytes;
+            stream->bytes_remaining -= n_bytes;
+        }
+
+        size_t n = MIN(len, stream->chunk_remaining);
+        if (!buffer_read_bytes(&dc->read_buffer, out, n)) {
+            return -1;
+        }
+        out += n;
+        len -= n;
+        stream->chunk_remaining -= n;
+    }
+    return 0;
+}
+
+int merkle_answer_stream_read_varint(merkle_answer_stream_t *stream, uint64_t *out) {
+    uint8_t varint_bytes[9];
+    if (0 > merkle_answer_stream_read(stream, varint_bytes, 1)) {
+        return -1;
+    }
+
+    size_t varint_len = 1;
+    if (varint_bytes[0] == 0xFD) {
+        varint_len = 3;
+    } else if (varint_bytes[0] == 0xFE) {
+        varint_len = 5;
+    } else if (varint_bytes[0] == 0xFF) {
+        varint_len = 9;
+    }
+
+    if (0 > merkle_answer_stream_read(stream, varint_bytes + 1, varint_len - 1) ||
+        0 > varint_read(varint_bytes, varint_len, out)) {
+        return -1;
+    }
+    return 0;
+}
+
+int merkle_answer_stream_read_element(merkle_answer_stream_t *stream,
+                                      uint8_t *out,
+                                      size_t out_len) {
+    uint64_t element_len;
+    if (0 > merkle_answer_stream_read_varint(stream, &element_len)) {
+        return -1;
+    }
+
+    if (element_len > out_len) {
+        PRINTF("Output buffer too short\n");
+        return -1;
+    }
+
+    if (0 > merkle_answer_stream_read(stream, out, (size_t) element_len)) {
+        return -1;
+    }
+    return (int) element_len;
+}
+
+typedef struct {
+    merkle_answer_stream_t stream;
+
+    uint32_t next_leaf_index;
+    uint8_t *element_buf;
+    size_t element_buf_len;
+
+    merkle_leaf_range_callback_t callback;
+    void *callback_state;
+} leaf_range_stream_state_t;
+
+static int range_hash_source(void *state_ptr, bool is_leaf, uint8_t out[static 32]) {
+    leaf_range_stream_state_t *state = (leaf_range_stream_state_t *) state_ptr;
+
+    if (!is_leaf) {
+        return merkle_answer_stream_read(&state->stream, out, 32);
+    }
+
+    int element_len = merkle_answer_stream_read_element(&state->stream,
+                                                        state->element_buf,
+                                                        state->element_buf_len);
+    if (element_len < 0) {
+        return -1;
+    }
+
+    merkle_compute_element_hash(state->element_buf, (size_t) element_len, out);
+
+    state->callback(state->callback_state,
+                    state->next_leaf_index,
+                    state->element_buf,
+                    (size_t) element_len);
+    ++state->next_leaf_index;
+
+    return 0;
+}
+
+int call_get_merkle_leaf_range(dispatcher_context_t *dc,
+                               const uint8_t merkle_root[static 32],
+                               uint32_t tree_size,
+                               uint32_t begin,
+                               uint32_t end,
+                               uint8_t *element_buf,
+                               size_t element_buf_len,
+                               merkle_leaf_range_callback_t callback,
+                               void *callback_state) {
+    // LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    PRINT_STACK_POINTER();
+
+    if (begin >= end || end > tree_size) {
+        return -1;
+    }
+
+    if (dc->protocol_version < PROTOCOL_VERSION_MERKLE_LEAF_RANGE) {
+        // each leaf is requested and verified on its own
+        for (uint32_t i = begin; i < end; i++) {
+            int element_len = call_get_merkle_leaf_element(dc,
+                                                           merkle_root,
+                                                           tree_size,
+                                                           i,
+                                                           element_buf,
+                                                           element_buf_len);
+            if (element_len < 0) {
+                return -1;
+            }
+            callback(callback_state, i, element_buf, (size_t) element_len);
+        }
+        return 0;
+    }
+
+    {  // the request is serialized directly in the response buffer
+        buffer_t request = dc->get_response_writer();
+        if (!buffer_write_u8(&request, CCMD_GET_MERKLE_LEAF_RANGE) ||
+            !buffer_write_bytes(&request, merkle_root, 32) ||
+            !buffer_write_varint(&request, tree_size) ||
+            !buffer_write_varint(&request, begin) ||
+            !buffer_write_varint(&request, end - begin)) {
+            return -1;
+        }
+        dc->commit_response(&request);
+        dc->finalize_response(SW_INTERRUPTED_EXECUTION);
+    }
+
+    if (dc->process_interruption(dc) < 0) {
+        return -1;
+    }
+
+    leaf_range_stream_state_t state = {.next_leaf_index = begin,
+                                       .element_buf = element_buf,
+                                       .element_buf_len = element_buf_len,
+                                       .callback = callback,
+                                       .callback_state = callback_state};
+    if (0 > merkle_answer_stream_init(&state.stream, dc)) {
+        return -1;
+    }
+
+    uint8_t root[32];
+    if (0 > merkle_compute_range_root(tree_size, begin, end, range_hash_source, &state, root)) {
+        return -1;
+    }
+
+    if (!merkle_answer_stream_is_done(&state.stream)) {
+        PRINTF("Received more data than expected.\n");
+        return -1;
+    }
+
+    if (memcmp(merkle_root, root, 32) != 0) {
+        PRINTF("Merkle root mismatch");
+        return -1;
+    }
+
+    return 0;
+}
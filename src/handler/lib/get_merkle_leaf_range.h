@@ -0,0 +1,81 @@
+#pragma once
+
+#include "../../boilerplate/dispatcher.h"
+
+/**
+ * Reader of an answer in the format of the response to CCMD_GET_MERKLE_LEAF_RANGE: the bytes that
+ * do not fit in the first response are requested with CCMD_GET_MORE_ELEMENTS as they are read.
+ */
+typedef struct {
+    dispatcher_context_t *dc;
+    size_t chunk_remaining;  // bytes of the last response from the client not yet consumed
+    size_t bytes_remaining;  // bytes of the answer not yet received from the client
+} merkle_answer_stream_t;
+
+/**
+ * Parses the header of the answer, at the beginning of the response of the client.
+ *
+ * Returns 0 on success, or a negative number on failure.
+ */
+int merkle_answer_stream_init(merkle_answer_stream_t *stream, dispatcher_context_t *dc);
+
+/**
+ * Reads the next len bytes of the answer.
+ *
+ * Returns 0 on success, or a negative number on failure.
+ */
+int merkle_answer_stream_read(merkle_answer_stream_t *stream, uint8_t *out, size_t len);
+
+/**
+ * Reads the next varint of the answer.
+ *
+ * Returns 0 on success, or a negative number on failure.
+ */
+int merkle_answer_stream_read_varint(merkle_answer_stream_t *stream, uint64_t *out);
+
+/**
+ * Reads the next element of the answer, serialized as <element_len : varint> <element>.
+ *
+ * Returns the length of the element, or a negative number on failure, or if the element is longer
+ * than out_len.
+ */
+int merkle_answer_stream_read_element(merkle_answer_stream_t *stream, uint8_t *out, size_t out_len);
+
+/**
+ * Returns true if all the bytes of the answer were read.
+ */
+static inline bool merkle_answer_stream_is_done(const merkle_answer_stream_t *stream) {
+    return stream->chunk_remaining == 0 && stream->bytes_remaining == 0;
+}
+
+/**
+ * Callback called by call_get_merkle_leaf_range for each leaf in the requested range, in order.
+ * The element is not authenticated yet when the callback is called: the callback must not take
+ * any irreversible action before call_get_merkle_leaf_range returns successfully.
+ */
+typedef void (*merkle_leaf_range_callback_t)(void *state,
+                                             uint32_t leaf_index,
+                                             const uint8_t *element,
+                                             size_t element_len);
+
+/**
+ * Requests the consecutive leaves with indices in [begin, end) of the Merkle tree with the given
+ * root using a single CCMD_GET_MERKLE_LEAF_RANGE request, and verifies them against the root.
+ * Only the proof hashes on the boundary of the range are sent by the client; each internal node of
+ * the tree is hashed at most once. If the client does not support it (see
+ * PROTOCOL_VERSION_MERKLE_LEAF_RANGE), each leaf is requested with call_get_merkle_leaf_element.
+ *
+ * Each element is copied in element_buf (which must be large enough to contain any of the
+ * elements), and then passed to the callback.
+ *
+ * Returns 0 on success, or a negative number on failure.
+ */
+int call_get_merkle_leaf_range(dispatcher_context_t *dispatcher_context,
+                               const uint8_t merkle_root[static 32],
+                               uint32_t tree_size,
+                               uint32_t begin,
+                               uint32_t end,
+                               uint8_t *element_buf,
+                               size_t element_buf_len,
+                               merkle_leaf_range_callback_t callback,
+                               void *callback_state);
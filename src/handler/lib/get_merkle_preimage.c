@@ -19,13 +19,13 @@ int call_get_merkle_preimage(dispatcher_context_t *dispatcher_context,
 
     PRINT_STACK_POINTER();
 
-    uint8_t cmd = CCMD_GET_PREIMAGE;
-    dispatcher_context->add_to_response(&cmd, 1);
-
-    uint8_t zero = 0;
-    dispatcher_context->add_to_response(&zero, 1);
-
-    dispatcher_context->add_to_response(hash, 32);
+    // the request is serialized directly in the response buffer
+    buffer_t request = dispatcher_context->get_response_writer();
+    if (!buffer_write_u8(&request, CCMD_GET_PREIMAGE) || !buffer_write_u8(&request, 0) ||
+        !buffer_write_bytes(&request, hash, 32)) {
+        return -1;
+    }
+    dispatcher_context->commit_response(&request);
     dispatcher_context->finalize_response(SW_INTERRUPTED_EXECUTION);
 
     if (dispatcher_context->process_interruption(dispatcher_context) < 0) {
@@ -63,7 +63,7 @@ int call_get_merkle_preimage(dispatcher_context_t *dispatcher_context,
     cx_sha256_init(&hash_context);
 
     // update hash
-    int ret = cx_hash_no_throw(&hash_context.header, 0, data_ptr, partial_data_len, NULL, 0);
+    int ret = crypto_hash_update(&hash_context.header, data_ptr, partial_data_len);
     if (ret != 0) {
         PRINTF("Error updating hash\n");
         return -11;
@@ -73,14 +73,19 @@ int call_get_merkle_preimage(dispatcher_context_t *dispatcher_context,
 
     // write bytes to output
     buffer_write_bytes(&out_buffer, data_ptr + 1, partial_data_len - 1);  // we skip the first byte
+    buffer_seek_cur(&dispatcher_context->read_buffer, partial_data_len);
 
     size_t bytes_remaining = (size_t) preimage_len - partial_data_len;
 
     while (bytes_remaining > 0) {
-        uint8_t get_more_elements_req[] = {CCMD_GET_MORE_ELEMENTS};
-        SET_RESPONSE(dispatcher_context, get_more_elements_req, 1, SW_INTERRUPTED_EXECUTION);
-        if (dispatcher_context->process_interruption(dispatcher_context) < 0) {
-            return -6;
+        // A single response can contain more than one group of elements; we only ask for more once
+        // the current response is exhausted.
+        if (!buffer_can_read(&dispatcher_context->read_buffer, 1)) {
+            uint8_t get_more_elements_req[] = {CCMD_GET_MORE_ELEMENTS};
+            SET_RESPONSE(dispatcher_context, get_more_elements_req, 1, SW_INTERRUPTED_EXECUTION);
+            if (dispatcher_context->process_interruption(dispatcher_context) < 0) {
+                return -6;
+            }
         }
 
         // Parse response to CCMD_GET_MORE_ELEMENTS
@@ -101,14 +106,10 @@ int call_get_merkle_preimage(dispatcher_context_t *dispatcher_context,
             return -9;
         }
 
+        data_ptr = dispatcher_context->read_buffer.ptr + dispatcher_context->read_buffer.offset;
+
         // update hash
-        ret = cx_hash_no_throw(
-            &hash_context.header,
-            0,
-            dispatcher_context->read_buffer.ptr + dispatcher_context->read_buffer.offset,
-            n_bytes,
-            NULL,
-            0);
+        ret = crypto_hash_update(&hash_context.header, data_ptr, n_bytes);
         if (ret != 0) {
             PRINTF("Error updating hash\n");
             return -12;
@@ -116,6 +117,7 @@ int call_get_merkle_preimage(dispatcher_context_t *dispatcher_context,
 
         // write bytes to output
         buffer_write_bytes(&out_buffer, data_ptr, n_bytes);
+        buffer_seek_cur(&dispatcher_context->read_buffer, n_bytes);
 
         bytes_remaining -= n_bytes;
     }
@@ -3,10 +3,88 @@
 #include "get_merkleized_map.h"
 
 #include "get_merkle_leaf_element.h"
+#include "get_merkle_leaf_hash.h"
+#include "get_merkle_leaf_index.h"
+#include "get_merkle_leaf_range.h"
 #include "check_merkle_tree_sorted.h"
+#include "map_contents_cache.h"
+#include "merkleized_map_cache.h"
 
 #include "../../common/buffer.h"
 
+typedef struct {
+    merkle_tree_elements_callback_t callback;
+    void *callback_state;
+} record_keys_state_t;
+
+// Records the tag of each key in the map cache, then forwards the key to the caller's callback
+static void record_keys_callback(dispatcher_context_t *dc,
+                                 void *state,
+                                 const merkleized_map_commitment_t *map_commitment,
+                                 int i,
+                                 buffer_t *data) {
+    record_keys_state_t *record_state = (record_keys_state_t *) state;
+
+    uint8_t key_hash[32];
+    merkle_compute_element_hash(data->ptr, data->size, key_hash);
+    merkleized_map_cache_record_key(i, key_hash);
+    map_contents_cache_record_key(i, key_hash, data->ptr, data->size);
+
+    if (record_state->callback != NULL) {
+        record_state->callback(dc, record_state->callback_state, map_commitment, i, data);
+    }
+}
+
+// Verifies that the keys of the map are sorted, calling the callback (if not NULL) for each key
+static int check_map_keys(dispatcher_context_t *dispatcher_context,
+                          void *callback_state,
+                          merkle_tree_elements_callback_t callback,
+                          merkleized_map_commitment_t *map) {
+    // If there is no callback, fetching the keys is only needed to verify that they are sorted;
+    // we can skip it if this was already done for the same keys during this command.
+    if (callback == NULL && merkleized_map_cache_is_verified(map->keys_root, map->size)) {
+        return 0;
+    }
+
+    // The keys of a map whose contents are cached are already verified, and known
+    if (map_contents_cache_has(map)) {
+        for (int i = 0; i < (int) map->size && callback != NULL; i++) {
+            const uint8_t *key;
+            int key_len = map_contents_cache_get_key(map, i, &key);
+            buffer_t data = buffer_create((void *) key, key_len);
+            callback(dispatcher_context, callback_state, map, i, &data);
+        }
+        return 0;
+    }
+
+    record_keys_state_t record_state = {.callback = callback, .callback_state = callback_state};
+    merkleized_map_cache_begin_keys(map->size);
+    map_contents_cache_begin_keys(map->size);
+
+    int res = call_check_merkle_tree_sorted_with_callback(dispatcher_context,
+                                                          &record_state,
+                                                          map->keys_root,
+                                                          map->size,
+                                                          record_keys_callback,
+                                                          map);
+    if (res < 0) {
+        return res;
+    }
+
+    merkleized_map_cache_add(map->keys_root, map->size);
+    map_contents_cache_end_keys(map);
+    return res;
+}
+
+// Parses a serialized map commitment: <size : varint> <keys_root : 32> <values_root : 32>
+static bool parse_map_commitment(const uint8_t *element,
+                                 size_t element_len,
+                                 merkleized_map_commitment_t *out) {
+    buffer_t buf = buffer_create((void *) element, element_len);
+    return buffer_read_varint(&buf, &out->size) && buffer_read_bytes(&buf, out->keys_root, 32) &&
+           buffer_read_bytes(&buf, out->values_root, 32);
+}
+
 int call_get_merkleized_map_with_callback(dispatcher_context_t *dispatcher_context,
                                           void *callback_state,
                                           const uint8_t root[static 32],
@@ -29,17 +107,87 @@ int call_get_merkleized_map_with_callback(dispatcher_context_t *dispatcher_conte
         return -1;
     }
 
-    buffer_t buf = buffer_create(raw_output, el_len);
-    if (!buffer_read_varint(&buf, &out_ptr->size) ||
-        !buffer_read_bytes(&buf, out_ptr->keys_root, 32) ||
-        !buffer_read_bytes(&buf, out_ptr->values_root, 32)) {
+    if (!parse_map_commitment(raw_output, el_len, out_ptr)) {
+        return -1;
+    }
+
+    return check_map_keys(dispatcher_context, callback_state, callback, out_ptr);
+}
+
+typedef struct {
+    merkleized_map_commitment_t *out;
+    int begin;
+    bool has_error;
+} map_range_state_t;
+
+// Callback for call_get_merkle_leaf_range; the commitments are only used once the whole range is
+// verified.
+static void store_map_commitment(void *state,
+                                 uint32_t leaf_index,
+                                 const uint8_t *element,
+                                 size_t element_len) {
+    map_range_state_t *range_state = (map_range_state_t *) state;
+    if (!parse_map_commitment(element,
+                              element_len,
+                              &range_state->out[(int) leaf_index - range_state->begin])) {
+        range_state->has_error = true;
+    }
+}
+
+int call_get_merkleized_maps(dispatcher_context_t *dispatcher_context,
+                             const uint8_t root[static 32],
+                             int size,
+                             int begin,
+                             int end,
+                             merkleized_map_commitment_t *out) {
+    if (begin < 0 || begin >= end || end > size) {
         return -1;
     }
 
-    return call_check_merkle_tree_sorted_with_callback(dispatcher_context,
-                                                       callback_state,
-                                                       out_ptr->keys_root,
-                                                       out_ptr->size,
-                                                       callback,
-                                                       out_ptr);
-}
\ No newline at end of file
+    uint8_t raw_output[9 + 2 * 32];
+    map_range_state_t state = {.out = out, .begin = begin, .has_error = false};
+    if (0 > call_get_merkle_leaf_range(dispatcher_context,
+                                       root,
+                                       size,
+                                       begin,
+                                       end,
+                                       raw_output,
+                                       sizeof(raw_output),
+                                       store_map_commitment,
+                                       &state) ||
+        state.has_error) {
+        return -1;
+    }
+
+    for (int i = 0; i < end - begin; i++) {
+        if (0 > check_map_keys(dispatcher_context, NULL, NULL, &out[i])) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int call_get_merkleized_map_key_index(dispatcher_context_t *dispatcher_context,
+                                      const merkleized_map_commitment_t *map,
+                                      const uint8_t key_hash[static 32]) {
+    int index = map_contents_cache_find_key_index(map, key_hash);
+    if (index != -2) {
+        return index;  // the map is cached, and all its keys are known
+    }
+
+    index = merkleized_map_cache_find_key_index(map->keys_root, map->size, key_hash);
+    if (index >= 0) {
+        // The tag is only a hint; check that the key at that index is the right one
+        uint8_t returned_key_hash[32];
+        if (call_get_merkle_leaf_hash(dispatcher_context,
+                                      map->keys_root,
+                                      map->size,
+                                      index,
+                                      returned_key_hash) >= 0 &&
+            memcmp(key_hash, returned_key_hash, 32) == 0) {
+            return index;
+        }
+    }
+
+    return call_get_merkle_leaf_index(dispatcher_context, map->size, map->keys_root, key_hash);
+}
@@ -6,7 +6,13 @@
 #include "check_merkle_tree_sorted.h"
 
 /**
- * TODO: docs
+ * Fetches the commitment of the merkleized map at position `index` of the Merkle tree with the given
+ * `root` and `size`, and verifies that its keys are sorted. If `callback` is not NULL, it is called
+ * for each key, in order. Without a callback, the keys are not fetched again if the same keys tree
+ * was already verified during the current command; neither are they with a callback, if the
+ * contents of the map are in the map_contents_cache (see call_load_merkleized_map_values).
+ *
+ * Returns 0 on success, or a negative number on failure.
  */
 int call_get_merkleized_map_with_callback(dispatcher_context_t *dispatcher_context,
                                           void *callback_state,
@@ -32,3 +38,31 @@ static inline int call_get_merkleized_map(dispatcher_context_t *dispatcher_conte
                                                  NULL,
                                                  out_ptr);
 }
+
+/**
+ * Fetches the commitments of the merkleized maps at positions [begin, end) of the Merkle tree with
+ * the given root and size using a single CCMD_GET_MERKLE_LEAF_RANGE request, so that all of them
+ * are verified against the root together, and verifies that the keys of each map are sorted, like
+ * call_get_merkleized_map. The commitments are stored in out, that must have room for end - begin
+ * of them.
+ *
+ * Returns 0 on success, or a negative number on failure.
+ */
+int call_get_merkleized_maps(dispatcher_context_t *dispatcher_context,
+                             const uint8_t root[static 32],
+                             int size,
+                             int begin,
+                             int end,
+                             merkleized_map_commitment_t *out);
+
+/**
+ * Finds the index of the key with the given Merkle leaf hash in a merkleized map, and verifies it
+ * against the keys root. If the keys of the map were recorded in the cache when the map was fetched,
+ * the index is found without asking the host; if the contents of the map are cached, no round trip
+ * is needed at all.
+ *
+ * Returns the index of the key, or a negative number if the key is not found or on failure.
+ */
+int call_get_merkleized_map_key_index(dispatcher_context_t *dispatcher_context,
+                                      const merkleized_map_commitment_t *map,
+                                      const uint8_t key_hash[static 32]);
@@ -2,8 +2,19 @@
 
 #include "get_merkleized_map_value.h"
 
-#include "get_merkle_leaf_index.h"
+#include "get_merkleized_map.h"
 #include "get_merkle_leaf_element.h"
+#include "get_merkle_leaf_range.h"
+#include "map_contents_cache.h"
+
+#include "../../boilerplate/sw.h"
+#include "../../common/buffer.h"
+#include "../../constants.h"
+#include "../client_commands.h"
+
+#include "../../crypto.h"
+
+#include "debug-helpers/debug.h"
 
 int call_get_merkleized_map_value(dispatcher_context_t *dispatcher_context,
                                   const merkleized_map_commitment_t *map,
@@ -16,18 +27,361 @@ int call_get_merkleized_map_value(dispatcher_context_t *dispatcher_context,
     uint8_t key_merkle_hash[32];
     merkle_compute_element_hash(key, key_len, key_merkle_hash);
 
-    int index =
-        call_get_merkle_leaf_index(dispatcher_context, map->size, map->keys_root, key_merkle_hash);
+    return call_get_merkleized_map_value_by_hash(dispatcher_context,
+                                                 map,
+                                                 key_merkle_hash,
+                                                 out,
+                                                 out_len);
+}
+
+int call_get_merkleized_map_value_by_hash(dispatcher_context_t *dispatcher_context,
+                                          const merkleized_map_commitment_t *map,
+                                          const uint8_t key_hash[static 32],
+                                          uint8_t *out,
+                                          int out_len) {
+    int index = call_get_merkleized_map_key_index(dispatcher_context, map, key_hash);
 
     if (index < 0) {
         PRINTF("Key not found, or incorrect data.\n");
         return -1;
     }
 
+    const uint8_t *value;
+    int value_len = map_contents_cache_get_value(map, (uint32_t) index, &value);
+    if (value_len >= 0) {
+        if (value_len > out_len) {
+            PRINTF("Output buffer too short\n");
+            return -1;
+        }
+        memcpy(out, value, value_len);
+        return value_len;
+    }
+
     return call_get_merkle_leaf_element(dispatcher_context,
                                         map->values_root,
                                         map->size,
                                         index,
                                         out,
                                         out_len);
-}
\ No newline at end of file
+}
+
+typedef struct {
+    merkle_answer_stream_t stream;
+
+    merkleized_map_value_request_t *requests;
+    const uint8_t (*key_hashes)[32];
+    const int *order;  // the positions in requests of the found keys, sorted by their index
+    int next_leaf;     // the position in order of the next leaf
+} map_values_stream_state_t;
+
+// The leaves of the keys tree are the hashes of the requested keys, that the client does not send
+static int keys_hash_source(void *state_ptr, bool is_leaf, uint8_t out[static 32]) {
+    map_values_stream_state_t *state = (map_values_stream_state_t *) state_ptr;
+
+    if (!is_leaf) {
+        return merkle_answer_stream_read(&state->stream, out, 32);
+    }
+
+    memcpy(out, state->key_hashes[state->order[state->next_leaf++]], 32);
+    return 0;
+}
+
+// The leaves of the values tree are streamed directly into the output buffer of each request
+static int values_hash_source(void *state_ptr, bool is_leaf, uint8_t out[static 32]) {
+    map_values_stream_state_t *state = (map_values_stream_state_t *) state_ptr;
+
+    if (!is_leaf) {
+        return merkle_answer_stream_read(&state->stream, out, 32);
+    }
+
+    merkleized_map_value_request_t *request = &state->requests[state->order[state->next_leaf++]];
+    int value_len =
+        merkle_answer_stream_read_element(&state->stream, request->out, request->out_len);
+    if (value_len < 0) {
+        return -1;
+    }
+    request->value_len = value_len;
+
+    merkle_compute_element_hash(request->out, value_len, out);
+    return 0;
+}
+
+// Fetches the values of at most MAX_MERKLEIZED_MAP_VALUES_PER_REQUEST keys
+static int get_merkleized_map_values_batch(dispatcher_context_t *dc,
+                                           const merkleized_map_commitment_t *map,
+                                           merkleized_map_value_request_t *requests,
+                                           int n_requests) {
+    uint8_t key_hashes[MAX_MERKLEIZED_MAP_VALUES_PER_REQUEST][32];
+
+    {  // the request is serialized directly in the response buffer
+        buffer_t request = dc->get_response_writer();
+        if (!buffer_write_u8(&request, CCMD_GET_MERKLEIZED_MAP_VALUES) ||
+            !buffer_write_bytes(&request, map->keys_root, 32) ||
+            !buffer_write_bytes(&request, map->values_root, 32) ||
+            !buffer_write_varint(&request, map->size) ||
+            !buffer_write_u8(&request, (uint8_t) n_requests)) {
+            return -1;
+        }
+        for (int i = 0; i < n_requests; i++) {
+            requests[i].value_len = -1;
+            if (requests[i].key_hash != NULL) {
+                memcpy(key_hashes[i], requests[i].key_hash, 32);
+            } else {
+                merkle_compute_element_hash(requests[i].key, requests[i].key_len, key_hashes[i]);
+            }
+            if (!buffer_write_bytes(&request, key_hashes[i], 32)) {
+                return -1;
+            }
+        }
+        dc->commit_response(&request);
+        dc->finalize_response(SW_INTERRUPTED_EXECUTION);
+    }
+
+    if (dc->process_interruption(dc) < 0) {
+        return -1;
+    }
+
+    map_values_stream_state_t state = {.requests = requests,
+                                       .key_hashes = (const uint8_t(*)[32]) key_hashes};
+    if (0 > merkle_answer_stream_init(&state.stream, dc)) {
+        return -1;
+    }
+
+    // the indices of the found keys, sorted with the positions of the corresponding requests
+    uint32_t indices[MAX_MERKLEIZED_MAP_VALUES_PER_REQUEST];
+    int order[MAX_MERKLEIZED_MAP_VALUES_PER_REQUEST];
+    int n_found = 0;
+    for (int i = 0; i < n_requests; i++) {
+        uint8_t is_found;
+        uint64_t index;
+        if (0 > merkle_answer_stream_read(&state.stream, &is_found, 1) ||
+            0 > merkle_answer_stream_read_varint(&state.stream, &index) || is_found > 1) {
+            return -1;
+        }
+        if (!is_found) {
+            continue;
+        }
+        if (index >= map->size) {
+            return -1;
+        }
+
+        int j = n_found++;
+        for (; j > 0 && indices[j - 1] > index; j--) {
+            indices[j] = indices[j - 1];
+            order[j] = order[j - 1];
+        }
+        indices[j] = (uint32_t) index;
+        order[j] = i;
+    }
+    state.order = order;
+
+    // the unsorted indices (or duplicates) are rejected by merkle_compute_leaves_root
+    if (n_found > 0) {
+        uint8_t root[32];
+
+        if (0 > merkle_compute_leaves_root((size_t) map->size,
+                                           indices,
+                                           n_found,
+                                           keys_hash_source,
+                                           &state,
+                                           root) ||
+            memcmp(map->keys_root, root, 32) != 0) {
+            PRINTF("Merkle root mismatch for the keys");
+            return -1;
+        }
+
+        state.next_leaf = 0;
+        if (0 > merkle_compute_leaves_root((size_t) map->size,
+                                           indices,
+                                           n_found,
+                                           values_hash_source,
+                                           &state,
+                                           root) ||
+            memcmp(map->values_root, root, 32) != 0) {
+            PRINTF("Merkle root mismatch for the values");
+            return -1;
+        }
+    }
+
+    if (!merkle_answer_stream_is_done(&state.stream)) {
+        PRINTF("Received more data than expected.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Answers each request on its own: for a map whose contents are cached, where only the values
+// before first_value are fetched, with their index already known, and for the clients that do not
+// support CCMD_GET_MERKLEIZED_MAP_VALUES, where a key whose index is not found is missing, as for
+// call_get_merkleized_map_value
+static int get_map_values_one_by_one(dispatcher_context_t *dc,
+                                     const merkleized_map_commitment_t *map,
+                                     merkleized_map_value_request_t *requests,
+                                     int n_requests) {
+    for (int i = 0; i < n_requests; i++) {
+        merkleized_map_value_request_t *request = &requests[i];
+
+        uint8_t key_hash[32];
+        if (request->key_hash != NULL) {
+            memcpy(key_hash, request->key_hash, 32);
+        } else {
+            merkle_compute_element_hash(request->key, request->key_len, key_hash);
+        }
+
+        int index = call_get_merkleized_map_key_index(dc, map, key_hash);
+        if (index < 0) {
+            request->value_len = -1;
+            continue;
+        }
+
+        const uint8_t *value;
+        int value_len = map_contents_cache_get_value(map, (uint32_t) index, &value);
+        if (value_len >= 0) {
+            if (value_len > request->out_len) {
+                PRINTF("Output buffer too short\n");
+                return -1;
+            }
+            memcpy(request->out, value, value_len);
+        } else {
+            value_len = call_get_merkle_leaf_element(dc,
+                                                     map->values_root,
+                                                     map->size,
+                                                     index,
+                                                     request->out,
+                                                     request->out_len);
+            if (value_len < 0) {
+                return -1;
+            }
+        }
+        request->value_len = value_len;
+    }
+    return 0;
+}
+
+int call_get_merkleized_map_values(dispatcher_context_t *dispatcher_context,
+                                   const merkleized_map_commitment_t *map,
+                                   merkleized_map_value_request_t *requests,
+                                   int n_requests) {
+    // LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    if (map_contents_cache_has(map) ||
+        dispatcher_context->protocol_version < PROTOCOL_VERSION_MERKLEIZED_MAP_VALUES) {
+        return get_map_values_one_by_one(dispatcher_context, map, requests, n_requests);
+    }
+
+    for (int i = 0; i < n_requests; i += MAX_MERKLEIZED_MAP_VALUES_PER_REQUEST) {
+        int n_batch = MIN(n_requests - i, MAX_MERKLEIZED_MAP_VALUES_PER_REQUEST);
+        if (0 > get_merkleized_map_values_batch(dispatcher_context, map, requests + i, n_batch)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    merkle_answer_stream_t stream;
+    uint32_t next_leaf_index;
+} load_values_stream_state_t;
+
+// The values are streamed directly into the cache; a value that does not fit is only hashed, and
+// the map is then not cached, but the whole answer is still read and verified
+static int load_values_hash_source(void *state_ptr, bool is_leaf, uint8_t out[static 32]) {
+    load_values_stream_state_t *state = (load_values_stream_state_t *) state_ptr;
+
+    if (!is_leaf) {
+        return merkle_answer_stream_read(&state->stream, out, 32);
+    }
+
+    uint64_t value_len;
+    if (0 > merkle_answer_stream_read_varint(&state->stream, &value_len)) {
+        return -1;
+    }
+
+    uint8_t *value = value_len <= MAP_CONTENTS_CACHE_BYTES
+                         ? map_contents_cache_reserve_value(state->next_leaf_index, value_len)
+                         : NULL;
+    ++state->next_leaf_index;
+
+    if (value != NULL) {
+        if (0 > merkle_answer_stream_read(&state->stream, value, (size_t) value_len)) {
+            return -1;
+        }
+        merkle_compute_element_hash(value, (size_t) value_len, out);
+        return 0;
+    }
+
+    cx_sha256_t hash_context;
+    cx_sha256_init(&hash_context);
+    crypto_hash_update_u8(&hash_context.header, 0x00);
+    while (value_len > 0) {
+        uint8_t chunk[64];
+        size_t n = (size_t) MIN(value_len, sizeof(chunk));
+        if (0 > merkle_answer_stream_read(&state->stream, chunk, n)) {
+            return -1;
+        }
+        crypto_hash_update(&hash_context.header, chunk, n);
+        value_len -= n;
+    }
+    crypto_hash_digest(&hash_context.header, out, 32);
+    return 0;
+}
+
+int call_load_merkleized_map_values(dispatcher_context_t *dc,
+                                    const merkleized_map_commitment_t *map,
+                                    uint32_t first_value) {
+    // LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    // the values are only an optimization of the later lookups, that work without them
+    if (dc->protocol_version < PROTOCOL_VERSION_MERKLE_LEAF_RANGE || map_contents_cache_has(map) ||
+        !map_contents_cache_begin_values(map, first_value)) {
+        return 0;
+    }
+
+    if (first_value < map->size) {
+        {  // the request is serialized directly in the response buffer
+            buffer_t request = dc->get_response_writer();
+            if (!buffer_write_u8(&request, CCMD_GET_MERKLE_LEAF_RANGE) ||
+                !buffer_write_bytes(&request, map->values_root, 32) ||
+                !buffer_write_varint(&request, map->size) ||
+                !buffer_write_varint(&request, first_value) ||
+                !buffer_write_varint(&request, map->size - first_value)) {
+                return -1;
+            }
+            dc->commit_response(&request);
+            dc->finalize_response(SW_INTERRUPTED_EXECUTION);
+        }
+
+        if (dc->process_interruption(dc) < 0) {
+            return -1;
+        }
+
+        load_values_stream_state_t state = {.next_leaf_index = first_value};
+        if (0 > merkle_answer_stream_init(&state.stream, dc)) {
+            return -1;
+        }
+
+        uint8_t root[32];
+        if (0 > merkle_compute_range_root((size_t) map->size,
+                                          first_value,
+                                          (size_t) map->size,
+                                          load_values_hash_source,
+                                          &state,
+                                          root)) {
+            return -1;
+        }
+
+        if (!merkle_answer_stream_is_done(&state.stream)) {
+            PRINTF("Received more data than expected.\n");
+            return -1;
+        }
+
+        if (memcmp(map->values_root, root, 32) != 0) {
+            PRINTF("Merkle root mismatch for the values");
+            return -1;
+        }
+    }
+
+    map_contents_cache_add();
+    return 0;
+}
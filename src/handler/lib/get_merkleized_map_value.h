@@ -23,6 +23,72 @@ int call_get_merkleized_map_value(dispatcher_context_t *dispatcher_context,
                                   uint8_t *out,
                                   int out_len);
 
+/**
+ * Like call_get_merkleized_map_value, but for a key whose Merkle leaf hash is already known, like
+ * the precomputed hashes of the single-byte keys of psbt.h; the key itself is not needed.
+ */
+int call_get_merkleized_map_value_by_hash(dispatcher_context_t *dispatcher_context,
+                                          const merkleized_map_commitment_t *map,
+                                          const uint8_t key_hash[static 32],
+                                          uint8_t *out,
+                                          int out_len);
+
+/**
+ * Maximum number of keys in a single CCMD_GET_MERKLEIZED_MAP_VALUES request.
+ */
+#define MAX_MERKLEIZED_MAP_VALUES_PER_REQUEST 5
+
+/**
+ * A key to look up with call_get_merkleized_map_values, and the buffer for its value.
+ */
+typedef struct {
+    const uint8_t *key;
+    int key_len;
+    const uint8_t *key_hash;  // if not NULL, the Merkle leaf hash of the key, used instead of key
+    uint8_t *out;
+    int out_len;
+    int value_len;  // set to the length of the value, or to -1 if the key is not in the map
+} merkleized_map_value_request_t;
+
+/**
+ * Like call_get_merkleized_map_value, but for several keys of the same map, that are fetched and
+ * verified with a single CCMD_GET_MERKLEIZED_MAP_VALUES request for every
+ * MAX_MERKLEIZED_MAP_VALUES_PER_REQUEST keys. The internal nodes shared by the proofs are only
+ * hashed once. If the client does not support it (see PROTOCOL_VERSION_MERKLEIZED_MAP_VALUES), each
+ * key is looked up as by call_get_merkleized_map_value.
+ *
+ * A key that is not in the map is not an error: its value_len is set to -1.
+ *
+ * Returns 0 on success, or a negative number if a value is too long for its output buffer, or if
+ * any of the proofs failed.
+ *
+ * NOTE: this does _not_ check that the keys are lexicographically sorted; the sanity check needs to
+ * be done before.
+ */
+int call_get_merkleized_map_values(dispatcher_context_t *dispatcher_context,
+                                   const merkleized_map_commitment_t *map,
+                                   merkleized_map_value_request_t *requests,
+                                   int n_requests);
+
+/**
+ * Fetches the values at positions [first_value, size) of a map with a single
+ * CCMD_GET_MERKLE_LEAF_RANGE request, verifies them against the values root, and keeps them in the
+ * map_contents_cache together with the keys of the map, that must be the last ones streamed by
+ * call_get_merkleized_map_with_callback. The following lookups in the map, and reopening it, then
+ * take no round trip, except for the values before first_value, that are fetched as usual.
+ *
+ * Does nothing if the map is already cached, or if its keys were not recorded (for example, because
+ * the map has more than MAP_CONTENTS_CACHE_MAX_KEYS keys, or because the cache is full), or if the
+ * client does not support CCMD_GET_MERKLE_LEAF_RANGE (see PROTOCOL_VERSION_MERKLE_LEAF_RANGE).
+ * The map is not cached either if its values do not fit in the cache; nonetheless, they are all
+ * verified.
+ *
+ * Returns 0 on success, or a negative number if the values do not match the values root.
+ */
+int call_load_merkleized_map_values(dispatcher_context_t *dispatcher_context,
+                                    const merkleized_map_commitment_t *map,
+                                    uint32_t first_value);
+
 /**
  * Convenience shortcut to read a little-endian unsigned 32-bit int.
  * TODO: more docs
@@ -42,4 +108,25 @@ static inline int call_get_merkleized_map_value_u32_le(dispatcher_context_t *dis
     *out = read_u32_le(result_raw, 0);
 
     return 4;
-}
\ No newline at end of file
+}
+
+/**
+ * Like call_get_merkleized_map_value_u32_le, but for a key whose Merkle leaf hash is already known.
+ */
+static inline int call_get_merkleized_map_value_u32_le_by_hash(
+    dispatcher_context_t *dispatcher_context,
+    const merkleized_map_commitment_t *map,
+    const uint8_t key_hash[static 32],
+    uint32_t *out) {
+    uint8_t result_raw[4];
+
+    int res =
+        call_get_merkleized_map_value_by_hash(dispatcher_context, map, key_hash, result_raw, 4);
+    if (res != 4) {
+        return -1;
+    }
+
+    *out = read_u32_le(result_raw, 0);
+
+    return 4;
+}
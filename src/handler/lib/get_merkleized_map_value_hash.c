@@ -3,7 +3,8 @@
 #include "get_merkleized_map_value_hash.h"
 
 #include "get_merkle_leaf_hash.h"
-#include "get_merkle_leaf_index.h"
+#include "get_merkleized_map.h"
+#include "map_contents_cache.h"
 
 int call_get_merkleized_map_value_hash(dispatcher_context_t *dispatcher_context,
                                        const merkleized_map_commitment_t *map,
@@ -15,12 +16,18 @@ int call_get_merkleized_map_value_hash(dispatcher_context_t *dispatcher_context,
     uint8_t key_merkle_hash[32];
     merkle_compute_element_hash(key, key_len, key_merkle_hash);
 
-    int index =
-        call_get_merkle_leaf_index(dispatcher_context, map->size, map->keys_root, key_merkle_hash);
+    int index = call_get_merkleized_map_key_index(dispatcher_context, map, key_merkle_hash);
     if (index < 0) {
         PRINTF("Key not found, or incorrect data.\n");
         return -1;
     }
 
+    const uint8_t *value;
+    int value_len = map_contents_cache_get_value(map, (uint32_t) index, &value);
+    if (value_len >= 0) {
+        merkle_compute_element_hash(value, value_len, out);
+        return 0;
+    }
+
     return call_get_merkle_leaf_hash(dispatcher_context, map->values_root, map->size, index, out);
 }
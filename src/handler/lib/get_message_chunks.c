@@ -0,0 +1,84 @@
+#include <string.h>
+
+#include "get_message_chunks.h"
+#include "get_merkle_leaf_range.h"
+
+#include "../../constants.h"
+
+typedef struct {
+    const message_chunks_t *message;
+    bool has_error;
+} message_chunks_state_t;
+
+// Returns true if the leaf has the length of a leaf with n_chunks chunks, starting at first_chunk
+static bool is_leaf_length_valid(const message_chunks_t *message,
+                                 size_t first_chunk,
+                                 size_t n_chunks,
+                                 size_t leaf_len) {
+    if (message->message_length != 0) {
+        size_t offset = first_chunk * MESSAGE_CHUNK_SIZE;
+        return leaf_len == MIN(n_chunks * MESSAGE_CHUNK_SIZE, message->message_length - offset);
+    }
+    // only the last chunk can be shorter
+    return leaf_len <= n_chunks * MESSAGE_CHUNK_SIZE &&
+           (n_chunks == 1 || leaf_len > (n_chunks - 1) * MESSAGE_CHUNK_SIZE);
+}
+
+// Callback for call_get_merkle_leaf_range, that splits each leaf in its chunks
+static void process_message_leaf(void *state,
+                                  uint32_t leaf_index,
+                                  const uint8_t *element,
+                                  size_t element_len) {
+    message_chunks_state_t *chunks_state = (message_chunks_state_t *) state;
+    const message_chunks_t *message = chunks_state->message;
+    if (chunks_state->has_error) {
+        return;
+    }
+
+    size_t first_chunk = leaf_index * message->chunks_per_leaf;
+    size_t n_chunks_in_leaf = MIN(message->chunks_per_leaf, message->n_chunks - first_chunk);
+    if (!is_leaf_length_valid(message, first_chunk, n_chunks_in_leaf, element_len)) {
+        chunks_state->has_error = true;
+        return;
+    }
+
+    for (size_t i = 0; i < n_chunks_in_leaf; i++) {
+        size_t offset = i * MESSAGE_CHUNK_SIZE;
+        size_t chunk_len = MIN(element_len - offset, MESSAGE_CHUNK_SIZE);
+        if (message->digests != NULL) {
+            crypto_hash_tee_update(message->digests, element + offset, chunk_len);
+        }
+        if (message->callback != NULL) {
+            message->callback(message->callback_state,
+                              first_chunk + i,
+                              element + offset,
+                              chunk_len);
+        }
+    }
+}
+
+int call_get_message_chunks(dispatcher_context_t *dispatcher_context,
+                            const message_chunks_t *message) {
+    if (message->chunks_per_leaf == 0 || message->chunks_per_leaf > MAX_CHUNKS_PER_LEAF) {
+        return MESSAGE_CHUNKS_ERROR_CHUNKING;
+    }
+    if (message->n_chunks == 0) {
+        return 0;
+    }
+
+    size_t n_leaves = (message->n_chunks + message->chunks_per_leaf - 1) / message->chunks_per_leaf;
+    uint8_t leaf[MAX_CHUNKS_PER_LEAF * MESSAGE_CHUNK_SIZE];
+    message_chunks_state_t state = {.message = message, .has_error = false};
+    if (0 > call_get_merkle_leaf_range(dispatcher_context,
+                                       message->merkle_root,
+                                       n_leaves,
+                                       0,
+                                       n_leaves,
+                                       leaf,
+                                       message->chunks_per_leaf * MESSAGE_CHUNK_SIZE,
+                                       process_message_leaf,
+                                       &state)) {
+        return MESSAGE_CHUNKS_ERROR_REQUEST;
+    }
+    return state.has_error ? MESSAGE_CHUNKS_ERROR_CHUNKING : 0;
+}
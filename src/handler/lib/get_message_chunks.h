@@ -0,0 +1,56 @@
+#pragma once
+
+#include "../../boilerplate/dispatcher.h"
+#include "../../crypto.h"
+
+/**
+ * Callback called by call_get_message_chunks for each chunk of the message, in order. Like for
+ * call_get_merkle_leaf_range, the chunk is not authenticated yet when the callback is called: the
+ * callback must not take any irreversible action before call_get_message_chunks returns
+ * successfully.
+ */
+typedef void (*message_chunk_callback_t)(void *state,
+                                         size_t chunk_index,
+                                         const uint8_t *chunk,
+                                         size_t chunk_len);
+
+/**
+ * A message, or any other data, split in chunks of MESSAGE_CHUNK_SIZE bytes; the leaves of its
+ * Merkle tree are the concatenations of chunks_per_leaf consecutive chunks (fewer for the last
+ * leaf).
+ *
+ * If message_length is not 0, the message has exactly that length, and all the chunks but the last
+ * one have MESSAGE_CHUNK_SIZE bytes. Otherwise, the last chunk of each leaf can be shorter, and its
+ * missing bytes are deemed to be padding.
+ */
+typedef struct {
+    const uint8_t *merkle_root;
+    size_t n_chunks;
+    size_t chunks_per_leaf;  // between 1 and MAX_CHUNKS_PER_LEAF
+    size_t message_length;
+    crypto_hash_tee_t *digests;         // if not NULL, updated with each chunk
+    message_chunk_callback_t callback;  // if not NULL, called for each chunk
+    void *callback_state;
+} message_chunks_t;
+
+/**
+ * Returned by call_get_message_chunks if the client failed to send the leaves of the Merkle tree,
+ * or if they do not match its root.
+ */
+#define MESSAGE_CHUNKS_ERROR_REQUEST (-1)
+
+/**
+ * Returned by call_get_message_chunks if the leaves match the Merkle root, but not the chunking of
+ * the message.
+ */
+#define MESSAGE_CHUNKS_ERROR_CHUNKING (-2)
+
+/**
+ * Fetches all the chunks of the message with a single CCMD_GET_MERKLE_LEAF_RANGE request, and
+ * checks the length of each leaf. Each chunk is added to the digests and passed to the callback as
+ * soon as it is received, so that the message is never stored as a whole.
+ *
+ * Returns 0 on success, MESSAGE_CHUNKS_ERROR_REQUEST or MESSAGE_CHUNKS_ERROR_CHUNKING on failure.
+ */
+int call_get_message_chunks(dispatcher_context_t *dispatcher_context,
+                            const message_chunks_t *message);
@@ -12,11 +12,13 @@ int call_get_preimage(dispatcher_context_t *dispatcher_context,
                       size_t out_len) {
     // LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
-    uint8_t cmd = CCMD_GET_PREIMAGE;
-    dispatcher_context->add_to_response(&cmd, 1);
-    uint8_t zero = 0;
-    dispatcher_context->add_to_response(&zero, 1);
-    dispatcher_context->add_to_response(hash, 32);
+    // the request is serialized directly in the response buffer
+    buffer_t request = dispatcher_context->get_response_writer();
+    if (!buffer_write_u8(&request, CCMD_GET_PREIMAGE) || !buffer_write_u8(&request, 0) ||
+        !buffer_write_bytes(&request, hash, 32)) {
+        return -1;
+    }
+    dispatcher_context->commit_response(&request);
     dispatcher_context->finalize_response(SW_INTERRUPTED_EXECUTION);
 
     if (dispatcher_context->process_interruption(dispatcher_context) < 0) {
@@ -55,17 +57,22 @@ int call_get_preimage(dispatcher_context_t *dispatcher_context,
 
     // write to output buffer
     buffer_write_bytes(&buffer_out, data_ptr, partial_data_len);
+    buffer_seek_cur(&dispatcher_context->read_buffer, partial_data_len);
 
     size_t bytes_remaining = (size_t) preimage_len - partial_data_len;
 
     while (bytes_remaining > 0) {
-        uint8_t get_more_elements_req[] = {CCMD_GET_MORE_ELEMENTS};
-        SET_RESPONSE(dispatcher_context,
-                     get_more_elements_req,
-                     sizeof(get_more_elements_req),
-                     SW_INTERRUPTED_EXECUTION);
-        if (dispatcher_context->process_interruption(dispatcher_context) < 0) {
-            return -5;
+        // A single response can contain more than one group of elements; we only ask for more once
+        // the current response is exhausted.
+        if (!buffer_can_read(&dispatcher_context->read_buffer, 1)) {
+            uint8_t get_more_elements_req[] = {CCMD_GET_MORE_ELEMENTS};
+            SET_RESPONSE(dispatcher_context,
+                         get_more_elements_req,
+                         sizeof(get_more_elements_req),
+                         SW_INTERRUPTED_EXECUTION);
+            if (dispatcher_context->process_interruption(dispatcher_context) < 0) {
+                return -5;
+            }
         }
 
         // Parse response to CCMD_GET_MORE_ELEMENTS
@@ -92,6 +99,7 @@ int call_get_preimage(dispatcher_context_t *dispatcher_context,
         crypto_hash_update(&hash_context.header, data_ptr, n_bytes);
 
         buffer_write_bytes(&buffer_out, data_ptr, n_bytes);
+        buffer_seek_cur(&dispatcher_context->read_buffer, n_bytes);
 
         bytes_remaining -= n_bytes;
     }
@@ -0,0 +1,52 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "hash_pool.h"
+
+static struct {
+    cx_sha256_t sha256[HASH_POOL_N_SHA256];
+    cx_sha3_t sha3[HASH_POOL_N_SHA3];
+    bool sha256_in_use[HASH_POOL_N_SHA256];
+    bool sha3_in_use[HASH_POOL_N_SHA3];
+} G_hash_pool;
+
+void hash_pool_reset(void) {
+    explicit_bzero(&G_hash_pool, sizeof(G_hash_pool));
+}
+
+cx_sha256_t *hash_pool_acquire_sha256(void) {
+    for (size_t i = 0; i < HASH_POOL_N_SHA256; i++) {
+        if (!G_hash_pool.sha256_in_use[i]) {
+            G_hash_pool.sha256_in_use[i] = true;
+            return &G_hash_pool.sha256[i];
+        }
+    }
+    return NULL;
+}
+
+cx_sha3_t *hash_pool_acquire_sha3(void) {
+    for (size_t i = 0; i < HASH_POOL_N_SHA3; i++) {
+        if (!G_hash_pool.sha3_in_use[i]) {
+            G_hash_pool.sha3_in_use[i] = true;
+            return &G_hash_pool.sha3[i];
+        }
+    }
+    return NULL;
+}
+
+void hash_pool_release(const void *context) {
+    for (size_t i = 0; i < HASH_POOL_N_SHA256; i++) {
+        if (context == &G_hash_pool.sha256[i]) {
+            explicit_bzero(&G_hash_pool.sha256[i], sizeof(cx_sha256_t));
+            G_hash_pool.sha256_in_use[i] = false;
+            return;
+        }
+    }
+    for (size_t i = 0; i < HASH_POOL_N_SHA3; i++) {
+        if (context == &G_hash_pool.sha3[i]) {
+            explicit_bzero(&G_hash_pool.sha3[i], sizeof(cx_sha3_t));
+            G_hash_pool.sha3_in_use[i] = false;
+            return;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "os.h"
+#include "cx.h"
+
+/**
+ * Number of SHA-256 contexts in the pool: the most that are in use at the same time, while the
+ * inputs of SIGN_PSBT are hashed for BIP-143 and BIP-341. Each context takes about 108 bytes of
+ * RAM.
+ */
+#define HASH_POOL_N_SHA256 4
+
+/**
+ * Number of SHA-3 contexts in the pool, used by WITHDRAW. Each context takes about 420 bytes of
+ * RAM.
+ */
+#define HASH_POOL_N_SHA3 1
+
+/**
+ * Statically allocated hash contexts, for the hashes that are kept across long sequences of calls
+ * to the client (the BIP-143 and BIP-341 hashes of the inputs, the sighashes, the hash of a
+ * withdrawal). Keeping them out of the stack makes the peak stack usage of the handlers flat.
+ *
+ * The contexts are acquired and released explicitly; the ones that are not released, for example
+ * when a command fails, are released and wiped at the end of the command (see session.h).
+ */
+
+/**
+ * Releases and wipes all the contexts. Called at the beginning and at the end of each command.
+ */
+void hash_pool_reset(void);
+
+/**
+ * Acquires a SHA-256 context, that is not initialized.
+ *
+ * Returns NULL if all the SHA-256 contexts are in use.
+ */
+cx_sha256_t *hash_pool_acquire_sha256(void);
+
+/**
+ * Acquires a SHA-3 context, that is not initialized.
+ *
+ * Returns NULL if all the SHA-3 contexts are in use.
+ */
+cx_sha3_t *hash_pool_acquire_sha3(void);
+
+/**
+ * Wipes and releases a context acquired from the pool. Does nothing if context is NULL.
+ */
+void hash_pool_release(const void *context);
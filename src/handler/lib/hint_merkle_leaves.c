@@ -0,0 +1,52 @@
+#include "hint_merkle_leaves.h"
+
+#include "../../boilerplate/io.h"
+#include "../../boilerplate/sw.h"
+#include "../../common/buffer.h"
+#include "../../constants.h"
+#include "../client_commands.h"
+
+int call_hint_merkle_leaves(dispatcher_context_t *dc,
+                            const uint8_t merkle_root[static 32],
+                            uint32_t tree_size,
+                            uint32_t begin,
+                            uint32_t end) {
+    // LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    if (begin >= end || end > tree_size) {
+        return -1;
+    }
+
+    if (dc->protocol_version < PROTOCOL_VERSION_HINT_MERKLE_LEAVES) {
+        return 0;
+    }
+
+    // the hint only moves work of the client earlier, and costs a round trip of its own
+    if (io_is_high_latency_transport()) {
+        return 0;
+    }
+
+    {  // the request is serialized directly in the response buffer
+        buffer_t request = dc->get_response_writer();
+        if (!buffer_write_u8(&request, CCMD_HINT_MERKLE_LEAVES) ||
+            !buffer_write_bytes(&request, merkle_root, 32) ||
+            !buffer_write_varint(&request, tree_size) ||
+            !buffer_write_varint(&request, begin) ||
+            !buffer_write_varint(&request, end - begin)) {
+            return -1;
+        }
+        dc->commit_response(&request);
+        dc->finalize_response(SW_INTERRUPTED_EXECUTION);
+    }
+
+    if (dc->process_interruption(dc) < 0) {
+        return -1;
+    }
+
+    // the response is empty
+    if (buffer_can_read(&dc->read_buffer, 1)) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "../../boilerplate/dispatcher.h"
+
+/**
+ * Tells the client that the leaves with indices in [begin, end) of the Merkle tree with the given
+ * root are about to be requested, using a CCMD_HINT_MERKLE_LEAVES request. The client can use it to
+ * prepare the responses in advance; the hint does not change what is requested afterwards, nor how
+ * the responses are verified.
+ *
+ * Nothing is sent to the clients that do not support the command (see
+ * PROTOCOL_VERSION_HINT_MERKLE_LEAVES), nor on a high latency transport (see
+ * io_is_high_latency_transport), where the round trip of the hint costs more than the work it lets
+ * the client do in advance.
+ *
+ * Returns 0 on success, or a negative number on failure.
+ */
+int call_hint_merkle_leaves(dispatcher_context_t *dispatcher_context,
+                            const uint8_t merkle_root[static 32],
+                            uint32_t tree_size,
+                            uint32_t begin,
+                            uint32_t end);
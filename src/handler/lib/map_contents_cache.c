@@ -0,0 +1,243 @@
+#include <string.h>
+
+#include "map_contents_cache.h"
+
+#include "../../boilerplate/perf_stats.h"
+#include "../../common/read.h"
+#include "../../common/write.h"
+
+// The contents of a map are stored in the data array, starting at offset: first, for each key,
+// <tag : 4> <key_len : 2> <key>, where the tag is the beginning of the Merkle leaf hash of the key;
+// then, for each value from first_value on, <value_len : 2> <value>.
+#define KEY_HEADER_LEN   6
+#define VALUE_HEADER_LEN 2
+
+typedef struct {
+    uint8_t keys_root[32];
+    uint8_t values_root[32];
+    uint16_t offset;
+    uint8_t size;
+    uint8_t first_value;
+} map_contents_cache_entry_t;
+
+typedef enum {
+    PENDING_NONE,
+    PENDING_KEYS,       // recording the keys
+    PENDING_KEYS_DONE,  // all the keys of pending_map were recorded
+    PENDING_VALUES,     // recording the values of pending_map
+} pending_state_e;
+
+static struct {
+    map_contents_cache_entry_t entries[MAP_CONTENTS_CACHE_SIZE];
+    uint8_t data[MAP_CONTENTS_CACHE_BYTES];
+    uint16_t n_bytes;          // number of bytes used by the entries; the pending map follows
+    uint16_t n_pending_bytes;  // bytes recorded for the pending map
+    uint8_t n_entries;
+    map_contents_cache_entry_t pending_map;
+    uint8_t n_pending;  // number of keys or values recorded for the pending map
+    pending_state_e pending_state;
+} G_map_contents_cache;
+
+// The data of the maps is packed, therefore the cache is filled until it is full, without evictions
+static void report_bytes_in_use(void) {
+    PERF_SET_CACHE_BYTES(PERF_CACHE_MAP_CONTENTS,
+                         G_map_contents_cache.n_entries * sizeof(map_contents_cache_entry_t) +
+                             G_map_contents_cache.n_bytes,
+                         sizeof(G_map_contents_cache));
+}
+
+void map_contents_cache_reset(void) {
+    explicit_bzero(&G_map_contents_cache, sizeof(G_map_contents_cache));
+    report_bytes_in_use();
+}
+
+static const map_contents_cache_entry_t *find_entry(const merkleized_map_commitment_t *map) {
+    for (int i = 0; i < G_map_contents_cache.n_entries; i++) {
+        const map_contents_cache_entry_t *entry = &G_map_contents_cache.entries[i];
+        if (entry->size == map->size && memcmp(entry->keys_root, map->keys_root, 32) == 0 &&
+            memcmp(entry->values_root, map->values_root, 32) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Reserves len bytes for the pending map, or stops recording it if they do not fit
+static uint8_t *reserve_pending_bytes(size_t len) {
+    size_t pos = (size_t) G_map_contents_cache.n_bytes + G_map_contents_cache.n_pending_bytes;
+    if (len > MAP_CONTENTS_CACHE_BYTES - pos) {
+        G_map_contents_cache.pending_state = PENDING_NONE;
+        return NULL;
+    }
+    G_map_contents_cache.n_pending_bytes += (uint16_t) len;
+    return &G_map_contents_cache.data[pos];
+}
+
+void map_contents_cache_begin_keys(uint64_t size) {
+    G_map_contents_cache.n_pending_bytes = 0;
+    G_map_contents_cache.n_pending = 0;
+    G_map_contents_cache.pending_state =
+        (G_map_contents_cache.n_entries < MAP_CONTENTS_CACHE_SIZE && size > 0 &&
+         size <= MAP_CONTENTS_CACHE_MAX_KEYS)
+            ? PENDING_KEYS
+            : PENDING_NONE;
+}
+
+void map_contents_cache_record_key(uint64_t index,
+                                   const uint8_t key_hash[static 32],
+                                   const uint8_t *key,
+                                   size_t key_len) {
+    if (G_map_contents_cache.pending_state != PENDING_KEYS) {
+        return;
+    }
+
+    if (index != G_map_contents_cache.n_pending) {
+        G_map_contents_cache.pending_state = PENDING_NONE;
+        return;
+    }
+
+    uint8_t *record = reserve_pending_bytes(KEY_HEADER_LEN + key_len);
+    if (record == NULL) {
+        return;
+    }
+    memcpy(record, key_hash, 4);
+    write_u16_le(record, 4, (uint16_t) key_len);
+    memcpy(record + KEY_HEADER_LEN, key, key_len);
+    ++G_map_contents_cache.n_pending;
+}
+
+void map_contents_cache_end_keys(const merkleized_map_commitment_t *map) {
+    if (G_map_contents_cache.pending_state != PENDING_KEYS ||
+        G_map_contents_cache.n_pending != map->size) {
+        G_map_contents_cache.pending_state = PENDING_NONE;
+        return;
+    }
+
+    map_contents_cache_entry_t *pending = &G_map_contents_cache.pending_map;
+    memcpy(pending->keys_root, map->keys_root, 32);
+    memcpy(pending->values_root, map->values_root, 32);
+    pending->size = (uint8_t) map->size;
+    G_map_contents_cache.pending_state = PENDING_KEYS_DONE;
+}
+
+bool map_contents_cache_begin_values(const merkleized_map_commitment_t *map, uint32_t first_value) {
+    map_contents_cache_entry_t *pending = &G_map_contents_cache.pending_map;
+    if (G_map_contents_cache.pending_state != PENDING_KEYS_DONE || pending->size != map->size ||
+        memcmp(pending->keys_root, map->keys_root, 32) != 0 ||
+        memcmp(pending->values_root, map->values_root, 32) != 0 || first_value > map->size ||
+        G_map_contents_cache.n_entries >= MAP_CONTENTS_CACHE_SIZE) {
+        G_map_contents_cache.pending_state = PENDING_NONE;
+        return false;
+    }
+
+    pending->first_value = (uint8_t) first_value;
+    G_map_contents_cache.n_pending = (uint8_t) first_value;
+    G_map_contents_cache.pending_state = PENDING_VALUES;
+    return true;
+}
+
+uint8_t *map_contents_cache_reserve_value(uint64_t index, size_t value_len) {
+    if (G_map_contents_cache.pending_state != PENDING_VALUES) {
+        return NULL;
+    }
+
+    if (index != G_map_contents_cache.n_pending) {
+        G_map_contents_cache.pending_state = PENDING_NONE;
+        return NULL;
+    }
+
+    uint8_t *record = reserve_pending_bytes(VALUE_HEADER_LEN + value_len);
+    if (record == NULL) {
+        return NULL;
+    }
+    write_u16_le(record, 0, (uint16_t) value_len);
+    ++G_map_contents_cache.n_pending;
+    return record + VALUE_HEADER_LEN;
+}
+
+void map_contents_cache_add(void) {
+    map_contents_cache_entry_t *pending = &G_map_contents_cache.pending_map;
+    bool is_complete = G_map_contents_cache.pending_state == PENDING_VALUES &&
+                       G_map_contents_cache.n_pending == pending->size;
+    G_map_contents_cache.pending_state = PENDING_NONE;
+
+    if (!is_complete || G_map_contents_cache.n_entries >= MAP_CONTENTS_CACHE_SIZE) {
+        return;
+    }
+
+    pending->offset = G_map_contents_cache.n_bytes;
+    G_map_contents_cache.entries[G_map_contents_cache.n_entries++] = *pending;
+    G_map_contents_cache.n_bytes += G_map_contents_cache.n_pending_bytes;
+    G_map_contents_cache.n_pending_bytes = 0;
+    report_bytes_in_use();
+}
+
+bool map_contents_cache_has(const merkleized_map_commitment_t *map) {
+    return find_entry(map) != NULL;
+}
+
+int map_contents_cache_find_key_index(const merkleized_map_commitment_t *map,
+                                      const uint8_t key_hash[static 32]) {
+    const map_contents_cache_entry_t *entry = find_entry(map);
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_MAP_CONTENTS, entry != NULL);
+    if (entry == NULL) {
+        return -2;
+    }
+
+    const uint8_t *record = &G_map_contents_cache.data[entry->offset];
+    for (int i = 0; i < entry->size; i++) {
+        uint16_t key_len = read_u16_le(record, 4);
+        // the tag is only a hint, but the key itself was verified when it was recorded
+        if (memcmp(record, key_hash, 4) == 0) {
+            uint8_t hash[32];
+            merkle_compute_element_hash(record + KEY_HEADER_LEN, key_len, hash);
+            if (memcmp(hash, key_hash, 32) == 0) {
+                return i;
+            }
+        }
+        record += KEY_HEADER_LEN + key_len;
+    }
+    return -1;
+}
+
+// Returns the record of the key at position index, or of the first value if index is the size
+static const uint8_t *get_key_record(const map_contents_cache_entry_t *entry, uint32_t index) {
+    const uint8_t *record = &G_map_contents_cache.data[entry->offset];
+    for (uint32_t i = 0; i < index; i++) {
+        record += KEY_HEADER_LEN + read_u16_le(record, 4);
+    }
+    return record;
+}
+
+int map_contents_cache_get_key(const merkleized_map_commitment_t *map,
+                               uint32_t index,
+                               const uint8_t **out) {
+    const map_contents_cache_entry_t *entry = find_entry(map);
+    bool is_hit = entry != NULL && index < entry->size;
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_MAP_CONTENTS, is_hit);
+    if (!is_hit) {
+        return -1;
+    }
+
+    const uint8_t *record = get_key_record(entry, index);
+    *out = record + KEY_HEADER_LEN;
+    return read_u16_le(record, 4);
+}
+
+int map_contents_cache_get_value(const merkleized_map_commitment_t *map,
+                                 uint32_t index,
+                                 const uint8_t **out) {
+    const map_contents_cache_entry_t *entry = find_entry(map);
+    bool is_hit = entry != NULL && index >= entry->first_value && index < entry->size;
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_MAP_CONTENTS, is_hit);
+    if (!is_hit) {
+        return -1;
+    }
+
+    const uint8_t *record = get_key_record(entry, entry->size);
+    for (uint32_t i = entry->first_value; i < index; i++) {
+        record += VALUE_HEADER_LEN + read_u16_le(record, 0);
+    }
+    *out = record + VALUE_HEADER_LEN;
+    return read_u16_le(record, 0);
+}
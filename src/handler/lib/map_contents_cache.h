@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../../common/merkle.h"
+
+#include "../../cache_sizes.h"
+
+/**
+ * Maximum number of keys of the maps whose contents can be cached.
+ */
+#define MAP_CONTENTS_CACHE_MAX_KEYS 16
+
+/**
+ * Number of maps whose contents can be cached. Each entry takes 68 bytes of RAM.
+ */
+#ifndef MAP_CONTENTS_CACHE_SIZE
+#define MAP_CONTENTS_CACHE_SIZE CACHE_SIZE_FOR_TARGET(8, 16)
+#endif
+
+/**
+ * Total size in bytes of the keys and values of all the cached maps. Each key takes 6 bytes more
+ * than its length, and each value 2 bytes more.
+ */
+#ifndef MAP_CONTENTS_CACHE_BYTES
+#define MAP_CONTENTS_CACHE_BYTES CACHE_SIZE_FOR_TARGET(1536, 3072)
+#endif
+
+/**
+ * Cache of the whole contents of small merkleized maps, verified against both the keys root and the
+ * values root of the map during the current command. For each cached map, it holds all the keys,
+ * and the values of the keys from position first_value on; this allows to skip the large values
+ * at the beginning of a map, like the non-witness UTXO of a PSBT input. A map is identified by its
+ * full commitment.
+ *
+ * The keys of a map are recorded while they are streamed to verify that they are sorted; the values
+ * are then added with map_contents_cache_begin_values. Reopening a cached map, finding a key or
+ * reading one of the cached values then requires no round trip with the client.
+ *
+ * Once the cache is full, new maps are not added, so that maps that are accessed in sequence
+ * (like the inputs of a PSBT) keep hitting the cache for the first maps.
+ */
+
+/**
+ * Empties the cache. Must be called at the beginning of each command.
+ */
+void map_contents_cache_reset(void);
+
+/**
+ * Starts recording the keys of a map with `size` keys, before they are streamed. Any keys recorded
+ * since the last call to map_contents_cache_add are discarded.
+ */
+void map_contents_cache_begin_keys(uint64_t size);
+
+/**
+ * Records the key at position `index`, given the key and its Merkle leaf hash. Keys must be
+ * recorded in order; otherwise, or if they do not fit in the cache, the map is not cached.
+ */
+void map_contents_cache_record_key(uint64_t index,
+                                   const uint8_t key_hash[static 32],
+                                   const uint8_t *key,
+                                   size_t key_len);
+
+/**
+ * Records that the keys recorded since the last call to map_contents_cache_begin_keys are the keys
+ * of the given map, verified against its keys root.
+ */
+void map_contents_cache_end_keys(const merkleized_map_commitment_t *map);
+
+/**
+ * Starts recording the values from position first_value on of the map whose keys were the last
+ * ones recorded.
+ *
+ * Returns false if the keys of the map were not all recorded, or if the cache is full.
+ */
+bool map_contents_cache_begin_values(const merkleized_map_commitment_t *map, uint32_t first_value);
+
+/**
+ * Returns the buffer where the value at position `index` must be written, or NULL if it does not
+ * fit in the cache, or if the values are not recorded in order; in that case, the map is not
+ * cached.
+ */
+uint8_t *map_contents_cache_reserve_value(uint64_t index, size_t value_len);
+
+/**
+ * Adds the map whose values are being recorded to the cache, if all its values from first_value on
+ * were recorded. The values must have been verified against the values root of the map.
+ */
+void map_contents_cache_add(void);
+
+/**
+ * Returns true if the contents of the map are in the cache.
+ */
+bool map_contents_cache_has(const merkleized_map_commitment_t *map);
+
+/**
+ * Looks up the position of a key in a cached map, given its Merkle leaf hash. As all the keys of a
+ * cached map are known, a key that is not found is certainly not in the map.
+ *
+ * Returns the index of the key, -1 if the map is cached but does not contain the key, or -2 if the
+ * map is not cached.
+ */
+int map_contents_cache_find_key_index(const merkleized_map_commitment_t *map,
+                                      const uint8_t key_hash[static 32]);
+
+/**
+ * Looks up the key at position `index` of a cached map.
+ *
+ * Returns the length of the key and sets *out to point to it, or -1 if the map is not cached.
+ */
+int map_contents_cache_get_key(const merkleized_map_commitment_t *map,
+                               uint32_t index,
+                               const uint8_t **out);
+
+/**
+ * Looks up the value at position `index` of a cached map.
+ *
+ * Returns the length of the value and sets *out to point to it, or -1 if the map is not cached, or
+ * if the value is not (as it comes before first_value).
+ */
+int map_contents_cache_get_value(const merkleized_map_commitment_t *map,
+                                 uint32_t index,
+                                 const uint8_t **out);
@@ -0,0 +1,130 @@
+#include <string.h>
+
+#include "cache_slots.h"
+#include "merkle_leaf_table.h"
+
+typedef struct {
+    uint8_t root[32];
+    uint8_t leaf_hashes[MERKLE_LEAF_TABLE_MAX_LEAVES][32];
+    uint8_t size;
+    bool is_used;
+} merkle_leaf_table_entry_t;
+
+typedef struct {
+    uint8_t root[32];
+    uint8_t size;
+    bool is_used;
+} seen_tree_t;
+
+static struct {
+    merkle_leaf_table_entry_t entries[MERKLE_LEAF_TABLE_SIZE];
+    cache_slots_t slots;
+    int8_t reserved;  // index of the entry returned by merkle_leaf_table_reserve, or -1
+    seen_tree_t seen[MERKLE_LEAF_TABLE_SEEN_TREES];
+    uint8_t next_seen;  // index of the next seen tree to be replaced
+    bool is_download_enabled;
+} G_merkle_leaf_table;
+
+static void report_bytes_in_use(void) {
+    PERF_SET_CACHE_BYTES(PERF_CACHE_MERKLE_LEAF_TABLE,
+                         G_merkle_leaf_table.slots.n_used * sizeof(merkle_leaf_table_entry_t),
+                         sizeof(G_merkle_leaf_table));
+}
+
+void merkle_leaf_table_reset(void) {
+    explicit_bzero(&G_merkle_leaf_table, sizeof(G_merkle_leaf_table));
+    G_merkle_leaf_table.reserved = -1;
+    report_bytes_in_use();
+}
+
+void merkle_leaf_table_enable_downloads(void) {
+    G_merkle_leaf_table.is_download_enabled = true;
+}
+
+static const merkle_leaf_table_entry_t *find_entry(const uint8_t root[static 32], uint32_t size) {
+    for (int i = 0; i < MERKLE_LEAF_TABLE_SIZE; i++) {
+        const merkle_leaf_table_entry_t *entry = &G_merkle_leaf_table.entries[i];
+        if (entry->is_used && entry->size == size && memcmp(entry->root, root, 32) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool merkle_leaf_table_should_download(const uint8_t root[static 32], uint32_t size) {
+    if (!G_merkle_leaf_table.is_download_enabled || size < 2 ||
+        size > MERKLE_LEAF_TABLE_MAX_LEAVES) {
+        return false;
+    }
+
+    for (int i = 0; i < MERKLE_LEAF_TABLE_SEEN_TREES; i++) {
+        seen_tree_t *seen = &G_merkle_leaf_table.seen[i];
+        if (seen->is_used && seen->size == size && memcmp(seen->root, root, 32) == 0) {
+            seen->is_used = false;  // downloaded now, or never if the download fails
+            return true;
+        }
+    }
+
+    seen_tree_t *seen = &G_merkle_leaf_table.seen[G_merkle_leaf_table.next_seen];
+    memcpy(seen->root, root, 32);
+    seen->size = (uint8_t) size;
+    seen->is_used = true;
+    G_merkle_leaf_table.next_seen =
+        (G_merkle_leaf_table.next_seen + 1) % MERKLE_LEAF_TABLE_SEEN_TREES;
+    return false;
+}
+
+uint8_t (*merkle_leaf_table_reserve(const uint8_t root[static 32], uint32_t size))[32] {
+    if (size == 0 || size > MERKLE_LEAF_TABLE_MAX_LEAVES) {
+        return NULL;
+    }
+
+    int index = cache_slots_take(&G_merkle_leaf_table.slots,
+                                 MERKLE_LEAF_TABLE_SIZE,
+                                 PERF_CACHE_MERKLE_LEAF_TABLE);
+    merkle_leaf_table_entry_t *entry = &G_merkle_leaf_table.entries[index];
+    entry->is_used = false;
+    memcpy(entry->root, root, 32);
+    entry->size = (uint8_t) size;
+
+    G_merkle_leaf_table.reserved = (int8_t) index;
+    report_bytes_in_use();
+    return entry->leaf_hashes;
+}
+
+void merkle_leaf_table_commit(void) {
+    if (G_merkle_leaf_table.reserved < 0) {
+        return;
+    }
+    G_merkle_leaf_table.entries[G_merkle_leaf_table.reserved].is_used = true;
+    G_merkle_leaf_table.reserved = -1;
+}
+
+bool merkle_leaf_table_get(const uint8_t root[static 32],
+                           uint32_t size,
+                           uint32_t leaf_index,
+                           uint8_t out[static 32]) {
+    const merkle_leaf_table_entry_t *entry = find_entry(root, size);
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_MERKLE_LEAF_TABLE, entry != NULL);
+    if (entry == NULL || leaf_index >= size) {
+        return false;
+    }
+    memcpy(out, entry->leaf_hashes[leaf_index], 32);
+    return true;
+}
+
+int merkle_leaf_table_find(const uint8_t root[static 32],
+                           uint32_t size,
+                           const uint8_t leaf_hash[static 32]) {
+    const merkle_leaf_table_entry_t *entry = find_entry(root, size);
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_MERKLE_LEAF_TABLE, entry != NULL);
+    if (entry == NULL) {
+        return -2;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        if (memcmp(entry->leaf_hashes[i], leaf_hash, 32) == 0) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../../cache_sizes.h"
+
+/**
+ * Maximum number of leaves of the trees whose leaf hashes can be cached; that covers the keys
+ * information of any wallet policy, and the keys and values of most PSBT maps.
+ */
+#define MERKLE_LEAF_TABLE_MAX_LEAVES 16
+
+/**
+ * Number of trees whose leaf hashes can be cached. Each entry takes about 550 bytes of RAM.
+ */
+#ifndef MERKLE_LEAF_TABLE_SIZE
+#define MERKLE_LEAF_TABLE_SIZE CACHE_SIZE_FOR_TARGET(2, 4)
+#endif
+
+/**
+ * Number of trees whose first access is remembered, in order to download the leaf hashes of the
+ * trees that are accessed again. Each entry takes about 36 bytes of RAM.
+ */
+#define MERKLE_LEAF_TABLE_SEEN_TREES 4
+
+/**
+ * Cache of the hashes of all the leaves of small Merkle trees, that were downloaded with a
+ * CCMD_GET_MERKLE_LEAF_HASHES and verified against their root during the current command. A tree
+ * is identified by its root and its size. The hash of any leaf of a cached tree, or the index of a
+ * leaf given its hash, is then known without asking the client, and an element only costs the
+ * CCMD_GET_PREIMAGE of its hash.
+ *
+ * Downloading a table costs as many round trips as one Merkle proof for the trees that fit in a
+ * single response, and a few more for the largest ones; therefore, a tree is only downloaded the
+ * second time one of its leaf hashes is requested. Downloads must be enabled by the handler, for
+ * the clients that support the command (see PROTOCOL_VERSION_MERKLE_LEAF_HASHES).
+ */
+
+/**
+ * Empties the cache and disables the downloads. Must be called at the beginning of each command.
+ */
+void merkle_leaf_table_reset(void);
+
+/**
+ * Allows merkle_leaf_table_should_download to return true until the end of the command.
+ */
+void merkle_leaf_table_enable_downloads(void);
+
+/**
+ * Returns true if the leaf hashes of the tree with the given root and size should be downloaded
+ * now, that is, if downloads are enabled, the tree has between 2 and MERKLE_LEAF_TABLE_MAX_LEAVES
+ * leaves, and it was already accessed during this command. Otherwise, it records the access.
+ */
+bool merkle_leaf_table_should_download(const uint8_t root[static 32], uint32_t size);
+
+/**
+ * Evicts the oldest entry if the cache is full, and returns the buffer where the size leaf hashes
+ * of the tree must be written; the tree is only cached once merkle_leaf_table_commit is called,
+ * after they were verified against the root. Returns NULL if size is 0 or larger than
+ * MERKLE_LEAF_TABLE_MAX_LEAVES.
+ */
+uint8_t (*merkle_leaf_table_reserve(const uint8_t root[static 32], uint32_t size))[32];
+
+/**
+ * Adds the tree of the last call to merkle_leaf_table_reserve to the cache.
+ */
+void merkle_leaf_table_commit(void);
+
+/**
+ * Looks up the hash of a leaf in the cache.
+ *
+ * Returns true and copies the hash to out if the tree is cached, false otherwise.
+ */
+bool merkle_leaf_table_get(const uint8_t root[static 32],
+                           uint32_t size,
+                           uint32_t leaf_index,
+                           uint8_t out[static 32]);
+
+/**
+ * Looks up the index of a leaf in the cache, given its hash. As all the leaves of a cached tree are
+ * known, a leaf that is not found is certainly not in the tree.
+ *
+ * Returns the index of the first leaf with that hash, -1 if the tree is cached but does not contain
+ * the leaf, or -2 if the tree is not cached.
+ */
+int merkle_leaf_table_find(const uint8_t root[static 32],
+                           uint32_t size,
+                           const uint8_t leaf_hash[static 32]);
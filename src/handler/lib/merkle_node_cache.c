@@ -0,0 +1,96 @@
+#include <string.h>
+
+#include "cache_slots.h"
+#include "merkle_node_cache.h"
+
+typedef struct {
+    uint8_t root[32];
+    uint8_t hash[32];
+    uint32_t tree_size;
+    uint32_t start;
+    uint8_t depth;
+    bool is_used;
+    bool is_pending;
+} merkle_node_cache_entry_t;
+
+static struct {
+    merkle_node_cache_entry_t entries[MERKLE_NODE_CACHE_SIZE];
+    cache_slots_t slots;
+} G_merkle_node_cache;
+
+static void report_bytes_in_use(void) {
+    PERF_SET_CACHE_BYTES(PERF_CACHE_MERKLE_NODE,
+                         G_merkle_node_cache.slots.n_used * sizeof(merkle_node_cache_entry_t),
+                         sizeof(G_merkle_node_cache));
+}
+
+void merkle_node_cache_reset(void) {
+    explicit_bzero(&G_merkle_node_cache, sizeof(G_merkle_node_cache));
+    report_bytes_in_use();
+}
+
+static merkle_node_cache_entry_t *find_entry(const uint8_t root[static 32],
+                                             uint32_t tree_size,
+                                             uint8_t depth,
+                                             uint32_t start) {
+    for (int i = 0; i < MERKLE_NODE_CACHE_SIZE; i++) {
+        merkle_node_cache_entry_t *entry = &G_merkle_node_cache.entries[i];
+        if (entry->is_used && entry->depth == depth && entry->start == start &&
+            entry->tree_size == tree_size && memcmp(entry->root, root, 32) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int merkle_node_cache_check(const uint8_t root[static 32],
+                            uint32_t tree_size,
+                            uint8_t depth,
+                            uint32_t start,
+                            const uint8_t hash[static 32]) {
+    const merkle_node_cache_entry_t *entry = find_entry(root, tree_size, depth, start);
+    bool is_hit = entry != NULL && !entry->is_pending;
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_MERKLE_NODE, is_hit);
+    if (!is_hit) {
+        return 0;
+    }
+    return memcmp(entry->hash, hash, 32) == 0 ? 1 : -1;
+}
+
+void merkle_node_cache_add_pending(const uint8_t root[static 32],
+                                   uint32_t tree_size,
+                                   uint8_t depth,
+                                   uint32_t start,
+                                   const uint8_t hash[static 32]) {
+    if (find_entry(root, tree_size, depth, start) != NULL) {
+        return;
+    }
+
+    merkle_node_cache_entry_t *entry = &G_merkle_node_cache.entries[cache_slots_take(
+        &G_merkle_node_cache.slots, MERKLE_NODE_CACHE_SIZE, PERF_CACHE_MERKLE_NODE)];
+    memcpy(entry->root, root, 32);
+    memcpy(entry->hash, hash, 32);
+    entry->tree_size = tree_size;
+    entry->start = start;
+    entry->depth = depth;
+    entry->is_used = true;
+    entry->is_pending = true;
+
+    report_bytes_in_use();
+}
+
+void merkle_node_cache_commit_pending(void) {
+    for (int i = 0; i < MERKLE_NODE_CACHE_SIZE; i++) {
+        G_merkle_node_cache.entries[i].is_pending = false;
+    }
+}
+
+void merkle_node_cache_discard_pending(void) {
+    for (int i = 0; i < MERKLE_NODE_CACHE_SIZE; i++) {
+        merkle_node_cache_entry_t *entry = &G_merkle_node_cache.entries[i];
+        if (entry->is_pending) {
+            entry->is_used = false;
+            entry->is_pending = false;
+        }
+    }
+}
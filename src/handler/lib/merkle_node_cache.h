@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../../cache_sizes.h"
+
+/**
+ * Number of Merkle tree nodes that can be cached. Each entry takes about 76 bytes of RAM.
+ */
+#ifndef MERKLE_NODE_CACHE_SIZE
+#define MERKLE_NODE_CACHE_SIZE CACHE_SIZE_FOR_TARGET(16, 32)
+#endif
+
+/**
+ * Cache of nodes of Merkle trees that were already verified against their root during the current
+ * command. A node is identified by the root and the size of its tree, its depth (0 for the root),
+ * and the index of the first leaf of the subtree rooted in the node. The size is part of the key:
+ * with the same root, the same depth and start are a leaf in a tree and an internal node in a
+ * larger one, for example leaf 2 of a tree of 4 leaves and the parent of leaves 2-3 of a tree of 6.
+ *
+ * Nodes are first added as pending while a Merkle proof is being checked; they are only considered
+ * verified once merkle_node_cache_commit_pending is called, after the proof was fully verified.
+ */
+
+/**
+ * Empties the cache. Must be called at the beginning of each command.
+ */
+void merkle_node_cache_reset(void);
+
+/**
+ * Checks a computed node hash against the verified nodes in the cache.
+ *
+ * Returns 1 if the node is cached with the same hash (therefore, the node is verified), 0 if the
+ * node is not in the cache, or -1 if the node is in the cache with a different hash (therefore, the
+ * computed hash is wrong).
+ */
+int merkle_node_cache_check(const uint8_t root[static 32],
+                            uint32_t tree_size,
+                            uint8_t depth,
+                            uint32_t start,
+                            const uint8_t hash[static 32]);
+
+/**
+ * Adds a node as pending, evicting the oldest entry if the cache is full. Does nothing if the node
+ * is already in the cache.
+ */
+void merkle_node_cache_add_pending(const uint8_t root[static 32],
+                                   uint32_t tree_size,
+                                   uint8_t depth,
+                                   uint32_t start,
+                                   const uint8_t hash[static 32]);
+
+/**
+ * Marks all the pending nodes as verified.
+ */
+void merkle_node_cache_commit_pending(void);
+
+/**
+ * Removes all the pending nodes from the cache.
+ */
+void merkle_node_cache_discard_pending(void);
@@ -0,0 +1,116 @@
+#include <string.h>
+
+#include "merkleized_map_cache.h"
+
+#include "../../boilerplate/perf_stats.h"
+#include "../../common/read.h"
+
+typedef struct {
+    uint8_t keys_root[32];
+    uint64_t size;
+    uint16_t tags_offset;  // index of the tag of the first key in the tags array
+    bool has_tags;
+} merkleized_map_cache_entry_t;
+
+static struct {
+    merkleized_map_cache_entry_t entries[MERKLEIZED_MAP_CACHE_SIZE];
+    uint32_t tags[MERKLEIZED_MAP_CACHE_KEY_TAGS];
+    uint16_t n_tags;  // number of tags used by the entries; the pending tags follow
+    uint16_t n_pending_tags;
+    uint8_t n_entries;
+    bool is_recording;  // true if the pending tags are a prefix of the keys of the next map
+} G_merkleized_map_cache;
+
+// The tags of the keys are packed, therefore the cache is filled until it is full, without
+// evictions
+static void report_bytes_in_use(void) {
+    PERF_SET_CACHE_BYTES(PERF_CACHE_MERKLEIZED_MAP,
+                         G_merkleized_map_cache.n_entries * sizeof(merkleized_map_cache_entry_t) +
+                             G_merkleized_map_cache.n_tags * sizeof(uint32_t),
+                         sizeof(G_merkleized_map_cache));
+}
+
+void merkleized_map_cache_reset(void) {
+    explicit_bzero(&G_merkleized_map_cache, sizeof(G_merkleized_map_cache));
+    report_bytes_in_use();
+}
+
+static merkleized_map_cache_entry_t *find_entry(const uint8_t keys_root[static 32], uint64_t size) {
+    for (int i = 0; i < G_merkleized_map_cache.n_entries; i++) {
+        merkleized_map_cache_entry_t *entry = &G_merkleized_map_cache.entries[i];
+        if (entry->size == size && memcmp(entry->keys_root, keys_root, 32) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool merkleized_map_cache_is_verified(const uint8_t keys_root[static 32], uint64_t size) {
+    bool is_verified = find_entry(keys_root, size) != NULL;
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_MERKLEIZED_MAP, is_verified);
+    return is_verified;
+}
+
+void merkleized_map_cache_begin_keys(uint64_t size) {
+    G_merkleized_map_cache.n_pending_tags = 0;
+    G_merkleized_map_cache.is_recording =
+        G_merkleized_map_cache.n_entries < MERKLEIZED_MAP_CACHE_SIZE &&
+        size <= (uint64_t) (MERKLEIZED_MAP_CACHE_KEY_TAGS - G_merkleized_map_cache.n_tags);
+}
+
+void merkleized_map_cache_record_key(uint64_t index, const uint8_t key_hash[static 32]) {
+    if (!G_merkleized_map_cache.is_recording) {
+        return;
+    }
+
+    uint16_t pos = G_merkleized_map_cache.n_tags + G_merkleized_map_cache.n_pending_tags;
+    if (index != G_merkleized_map_cache.n_pending_tags || pos >= MERKLEIZED_MAP_CACHE_KEY_TAGS) {
+        G_merkleized_map_cache.is_recording = false;
+        return;
+    }
+
+    G_merkleized_map_cache.tags[pos] = read_u32_be(key_hash, 0);
+    ++G_merkleized_map_cache.n_pending_tags;
+}
+
+void merkleized_map_cache_add(const uint8_t keys_root[static 32], uint64_t size) {
+    bool has_tags = G_merkleized_map_cache.is_recording &&
+                    G_merkleized_map_cache.n_pending_tags == size;
+    G_merkleized_map_cache.is_recording = false;
+
+    if (G_merkleized_map_cache.n_entries >= MERKLEIZED_MAP_CACHE_SIZE ||
+        find_entry(keys_root, size) != NULL) {
+        return;
+    }
+
+    merkleized_map_cache_entry_t *entry =
+        &G_merkleized_map_cache.entries[G_merkleized_map_cache.n_entries];
+    memcpy(entry->keys_root, keys_root, 32);
+    entry->size = size;
+    entry->has_tags = has_tags;
+    entry->tags_offset = G_merkleized_map_cache.n_tags;
+    if (has_tags) {
+        G_merkleized_map_cache.n_tags += G_merkleized_map_cache.n_pending_tags;
+    }
+    ++G_merkleized_map_cache.n_entries;
+    report_bytes_in_use();
+}
+
+int merkleized_map_cache_find_key_index(const uint8_t keys_root[static 32],
+                                        uint64_t size,
+                                        const uint8_t key_hash[static 32]) {
+    const merkleized_map_cache_entry_t *entry = find_entry(keys_root, size);
+    bool is_hit = entry != NULL && entry->has_tags;
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_MERKLEIZED_MAP, is_hit);
+    if (!is_hit) {
+        return -1;
+    }
+
+    uint32_t tag = read_u32_be(key_hash, 0);
+    for (int i = 0; i < (int) entry->size; i++) {
+        if (G_merkleized_map_cache.tags[entry->tags_offset + i] == tag) {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../../cache_sizes.h"
+
+/**
+ * Maximum number of merkleized maps that can be remembered as verified. Each entry takes 44 bytes
+ * of RAM.
+ */
+#ifndef MERKLEIZED_MAP_CACHE_SIZE
+#define MERKLEIZED_MAP_CACHE_SIZE CACHE_SIZE_FOR_TARGET(32, 64)
+#endif
+
+/**
+ * Total number of keys, across all the cached maps, whose position can be remembered. Each key
+ * takes 4 bytes of RAM.
+ */
+#ifndef MERKLEIZED_MAP_CACHE_KEY_TAGS
+#define MERKLEIZED_MAP_CACHE_KEY_TAGS CACHE_SIZE_FOR_TARGET(256, 512)
+#endif
+
+/**
+ * Cache of the merkleized maps whose keys were already verified to be sorted during the current
+ * command. A map is identified by the root of its keys Merkle tree and by its number of keys; as the
+ * property only depends on the keys tree, the entries are valid for any map with the same keys.
+ *
+ * For each map, the cache can also store a short tag of the hash of each key, in order; this allows
+ * to find the index of a key without asking the host. As tags are truncated hashes, the index found
+ * this way is only a hint: the caller must verify that the key at that index is the expected one.
+ *
+ * Once the cache is full, new maps are not added, so that maps that are accessed in sequence
+ * (like the inputs of a PSBT) keep hitting the cache for the first MERKLEIZED_MAP_CACHE_SIZE maps.
+ */
+
+/**
+ * Empties the cache. Must be called at the beginning of each command.
+ */
+void merkleized_map_cache_reset(void);
+
+/**
+ * Returns true if the keys tree with the given root and size was already verified to be sorted.
+ */
+bool merkleized_map_cache_is_verified(const uint8_t keys_root[static 32], uint64_t size);
+
+/**
+ * Starts recording the key tags of a map with `size` keys, before its keys are streamed. Any tags
+ * recorded since the last call to merkleized_map_cache_add are discarded.
+ */
+void merkleized_map_cache_begin_keys(uint64_t size);
+
+/**
+ * Records the tag of the key at position `index`, given its Merkle leaf hash. Keys must be recorded
+ * in order; otherwise, no tag is stored for the map.
+ */
+void merkleized_map_cache_record_key(uint64_t index, const uint8_t key_hash[static 32]);
+
+/**
+ * Records that the keys tree with the given root and size was verified to be sorted, together with
+ * the tags recorded since the last call to merkleized_map_cache_begin_keys, if all the keys were
+ * recorded. Does nothing if the cache is full.
+ */
+void merkleized_map_cache_add(const uint8_t keys_root[static 32], uint64_t size);
+
+/**
+ * Looks up the position of a key in a cached map, given its Merkle leaf hash.
+ *
+ * Returns the candidate index, or -1 if the map or its tags are not in the cache, or if no key has a
+ * matching tag.
+ */
+int merkleized_map_cache_find_key_index(const uint8_t keys_root[static 32],
+                                        uint64_t size,
+                                        const uint8_t key_hash[static 32]);
@@ -3,10 +3,14 @@
 #include "policy.h"
 
 #include "../lib/get_merkle_leaf_element.h"
+#include "../lib/get_merkle_leaf_range.h"
 #include "../lib/get_preimage.h"
+#include "../lib/wallet_key_cache.h"
+#include "../lib/wallet_policy_cache.h"
+#include "../lib/wallet_registry.h"
 #include "../../crypto.h"
 #include "../../common/base58.h"
-#include "../../common/bitvector.h"
+#include "../../common/merkle.h"
 #include "../../common/read.h"
 #include "../../common/script.h"
 #include "../../common/segwit_addr.h"
@@ -48,7 +52,8 @@ typedef struct {
     int node_stack_eos;  // index of node being processed within nodes; will be set -1 at the end of
                          // processing
 
-    cx_hash_t *hash_context;
+    cx_hash_t *const *hash_contexts;  // updated with the bytes of the script
+    size_t n_hash_contexts;
     uint8_t hash[32];  // when a node is popped, the hash is computed here
 } policy_parser_state_t;
 
@@ -67,15 +72,12 @@ static int cmp_arrays(const void *a, const void *b, size_t length) {
 
 typedef int (*policy_parser_processor_t)(policy_parser_state_t *state, const void *arg);
 
+// The fragments that have children are encoded as tables of generic_processor_command_t, that are
+// interpreted by process_generic_node; the leaf fragments have their own emitters instead, that
+// output the whole script of the fragment at once.
 typedef enum {
-    CMD_CODE_OP,       // data is a byte to emit (usually an opcode)
-    CMD_CODE_OP_V,     // data is an opcode, but transform according to 'v' if necessary
-    CMD_CODE_PUSH_PK,  // push the compressed pubkey indicated by the current policy_node_with_key_t
-    CMD_CODE_PUSH_PKH,         // push the hash160 of the compressed pubkey indicated by the current
-                               // policy_node_with_key_t
-    CMD_CODE_PUSH_UINT32,      // push the integer in the current policy_node_with_uint32_t
-    CMD_CODE_PUSH_HASH20,      // push a 20 bytes hash in the current policy_node_with_hash_160_t
-    CMD_CODE_PUSH_HASH32,      // push a 32 bytes hash in the current policy_node_with_hash_256_t
+    CMD_CODE_OP,               // data is a byte to emit (usually an opcode)
+    CMD_CODE_OP_V,             // data is an opcode, but transform according to 'v' if necessary
     CMD_CODE_PROCESS_CHILD,    // process the i-th script of a policy_node_with_scripts_t,
                                // where i is indicated by the command data
     CMD_CODE_PROCESS_CHILD_V,  // like the previous, but it propagates the v flag to the child
@@ -165,61 +167,6 @@ static const uint8_t fragment_whitelist_tapscript[] = {
     TOKEN_L,
     TOKEN_U};
 
-static const generic_processor_command_t commands_0[] = {{CMD_CODE_OP_V, OP_0}, {CMD_CODE_END, 0}};
-static const generic_processor_command_t commands_1[] = {{CMD_CODE_OP_V, OP_1}, {CMD_CODE_END, 0}};
-static const generic_processor_command_t commands_pk_k[] = {{CMD_CODE_PUSH_PK, 0},
-                                                            {CMD_CODE_END, 0}};
-static const generic_processor_command_t commands_pk_h[] = {{CMD_CODE_OP, OP_DUP},
-                                                            {CMD_CODE_OP, OP_HASH160},
-                                                            {CMD_CODE_PUSH_PKH, 0},
-                                                            {CMD_CODE_OP, OP_EQUALVERIFY},
-                                                            {CMD_CODE_END, 0}};
-static const generic_processor_command_t commands_pk[] = {{CMD_CODE_PUSH_PK, 0},
-                                                          {CMD_CODE_OP_V, OP_CHECKSIG},
-                                                          {CMD_CODE_END, 0}};
-static const generic_processor_command_t commands_older[] = {{CMD_CODE_PUSH_UINT32, 0},
-                                                             {CMD_CODE_OP_V, OP_CSV},
-                                                             {CMD_CODE_END, 0}};
-static const generic_processor_command_t commands_after[] = {{CMD_CODE_PUSH_UINT32, 0},
-                                                             {CMD_CODE_OP_V, OP_CLTV},
-                                                             {CMD_CODE_END, 0}};
-
-static const generic_processor_command_t commands_sha256[] = {{CMD_CODE_OP, OP_SIZE},
-                                                              {CMD_CODE_OP, 1},   // 1-byte push
-                                                              {CMD_CODE_OP, 32},  // pushed value
-                                                              {CMD_CODE_OP, OP_EQUALVERIFY},
-                                                              {CMD_CODE_OP, OP_SHA256},
-                                                              {CMD_CODE_PUSH_HASH32, 0},
-                                                              {CMD_CODE_OP_V, OP_EQUAL},
-                                                              {CMD_CODE_END, 0}};
-
-static const generic_processor_command_t commands_hash256[] = {{CMD_CODE_OP, OP_SIZE},
-                                                               {CMD_CODE_OP, 1},   // 1-byte push
-                                                               {CMD_CODE_OP, 32},  // pushed value
-                                                               {CMD_CODE_OP, OP_EQUALVERIFY},
-                                                               {CMD_CODE_OP, OP_HASH256},
-                                                               {CMD_CODE_PUSH_HASH32, 0},
-                                                               {CMD_CODE_OP_V, OP_EQUAL},
-                                                               {CMD_CODE_END, 0}};
-
-static const generic_processor_command_t commands_ripemd160[] = {{CMD_CODE_OP, OP_SIZE},
-                                                                 {CMD_CODE_OP, 1},   // 1-byte push
-                                                                 {CMD_CODE_OP, 32},  // pushed value
-                                                                 {CMD_CODE_OP, OP_EQUALVERIFY},
-                                                                 {CMD_CODE_OP, OP_RIPEMD160},
-                                                                 {CMD_CODE_PUSH_HASH20, 0},
-                                                                 {CMD_CODE_OP_V, OP_EQUAL},
-                                                                 {CMD_CODE_END, 0}};
-
-static const generic_processor_command_t commands_hash160[] = {{CMD_CODE_OP, OP_SIZE},
-                                                               {CMD_CODE_OP, 1},   // 1-byte push
-                                                               {CMD_CODE_OP, 32},  // pushed value
-                                                               {CMD_CODE_OP, OP_EQUALVERIFY},
-                                                               {CMD_CODE_OP, OP_HASH160},
-                                                               {CMD_CODE_PUSH_HASH20, 0},
-                                                               {CMD_CODE_OP_V, OP_EQUAL},
-                                                               {CMD_CODE_END, 0}};
-
 // andor(X,Y,X) ==> [X] NOTIF [Z] ELSE [Y] ENDIF
 static const generic_processor_command_t commands_andor[] = {{CMD_CODE_PROCESS_CHILD, 0},
                                                              {CMD_CODE_OP, OP_NOTIF},
@@ -322,14 +269,93 @@ static const generic_processor_command_t commands_u[] = {{CMD_CODE_OP, OP_IF},
                                                          {CMD_CODE_OP_V, OP_ENDIF},
                                                          {CMD_CODE_END, 0}};
 
+typedef struct {
+    const char (*keys_info)[MAX_POLICY_KEY_INFO_LEN + 1];
+    size_t next_key;
+} inline_keys_hash_state_t;
+
+// Callback for merkle_compute_range_root; as the range is the whole tree, only the leaf hashes are
+// requested.
+static int next_inline_key_hash(void *state, bool is_leaf, uint8_t out[static 32]) {
+    inline_keys_hash_state_t *hash_state = (inline_keys_hash_state_t *) state;
+    if (!is_leaf) {
+        return -1;
+    }
+    const char *key_info = hash_state->keys_info[hash_state->next_key++];
+    merkle_compute_element_hash((const uint8_t *) key_info, strlen(key_info), out);
+    return 0;
+}
+
+// Reads a V2 wallet policy serialized in the inline form, and computes the sha256 of its
+// descriptor template and the Merkle root of its keys information, so that the header is the same
+// as the one of the canonical serialization.
+static int read_inline_wallet_policy(
+    buffer_t *buf,
+    policy_map_wallet_header_t *wallet_header,
+    uint8_t descriptor_template[static MAX_DESCRIPTOR_TEMPLATE_LENGTH],
+    char (*keys_info)[MAX_POLICY_KEY_INFO_LEN + 1]) {
+    uint8_t version;
+    uint64_t descriptor_template_len;
+    uint64_t n_keys;
+    if (!buffer_read_u8(buf, &version) ||
+        version != (WALLET_POLICY_VERSION_V2 | WALLET_POLICY_INLINE_FLAG) ||
+        !buffer_read_u8(buf, &wallet_header->name_len) ||
+        wallet_header->name_len > MAX_WALLET_NAME_LENGTH ||
+        !buffer_read_bytes(buf, (uint8_t *) wallet_header->name, wallet_header->name_len) ||
+        !buffer_read_varint(buf, &descriptor_template_len) ||
+        descriptor_template_len > MAX_DESCRIPTOR_TEMPLATE_LENGTH_V2 ||
+        !buffer_read_bytes(buf, descriptor_template, (size_t) descriptor_template_len) ||
+        !buffer_read_varint(buf, &n_keys) || n_keys == 0 || n_keys > MAX_N_KEYS_IN_WALLET_POLICY) {
+        return WITH_ERROR(-1, "Invalid inline wallet policy");
+    }
+    wallet_header->version = WALLET_POLICY_VERSION_V2;
+    wallet_header->name[wallet_header->name_len] = '\0';
+    wallet_header->descriptor_template_len = (uint16_t) descriptor_template_len;
+    wallet_header->n_keys = (size_t) n_keys;
+
+    for (size_t i = 0; i < wallet_header->n_keys; i++) {
+        uint64_t key_info_len;
+        if (!buffer_read_varint(buf, &key_info_len) || key_info_len > MAX_POLICY_KEY_INFO_LEN ||
+            !buffer_read_bytes(buf, (uint8_t *) keys_info[i], (size_t) key_info_len) ||
+            memchr(keys_info[i], 0, (size_t) key_info_len) != NULL) {
+            return WITH_ERROR(-1, "Invalid key information in inline wallet policy");
+        }
+        keys_info[i][key_info_len] = '\0';
+    }
+
+    cx_hash_sha256(descriptor_template,
+                   wallet_header->descriptor_template_len,
+                   wallet_header->descriptor_template_sha256,
+                   32);
+
+    inline_keys_hash_state_t state = {.keys_info = keys_info, .next_key = 0};
+    if (0 > merkle_compute_range_root(wallet_header->n_keys,
+                                      0,
+                                      wallet_header->n_keys,
+                                      next_inline_key_hash,
+                                      &state,
+                                      wallet_header->keys_info_merkle_root)) {
+        return WITH_ERROR(-1, "Failed computing the Merkle root of the keys information");
+    }
+    return 0;
+}
+
 int read_and_parse_wallet_policy(
     dispatcher_context_t *dispatcher_context,
     buffer_t *buf,
     policy_map_wallet_header_t *wallet_header,
     uint8_t policy_map_descriptor_template[static MAX_DESCRIPTOR_TEMPLATE_LENGTH],
     uint8_t *policy_map_bytes,
-    size_t policy_map_bytes_len) {
-    if ((read_wallet_policy_header(buf, wallet_header)) < 0) {
+    size_t policy_map_bytes_len,
+    char (*inline_keys_info)[MAX_POLICY_KEY_INFO_LEN + 1]) {
+    if (inline_keys_info != NULL) {
+        if (0 > read_inline_wallet_policy(buf,
+                                          wallet_header,
+                                          policy_map_descriptor_template,
+                                          inline_keys_info)) {
+            return -1;
+        }
+    } else if ((read_wallet_policy_header(buf, wallet_header)) < 0) {
         return WITH_ERROR(-1, "Failed reading wallet policy header");
     }
 
@@ -338,13 +364,29 @@ int read_and_parse_wallet_policy(
                wallet_header->descriptor_template,
                wallet_header->descriptor_template_len);
     } else {
-        // if V2, stream and parse descriptor template from client first
-        int descriptor_template_len = call_get_preimage(dispatcher_context,
-                                                        wallet_header->descriptor_template_sha256,
-                                                        policy_map_descriptor_template,
-                                                        MAX_DESCRIPTOR_TEMPLATE_LENGTH);
-        if (descriptor_template_len < 0) {
-            return WITH_ERROR(-1, "Failed getting wallet policy descriptor template");
+        // the descriptor templates of the default wallet policies are stored already parsed, so
+        // they are neither fetched from the client nor parsed
+        int desc_temp_len =
+            get_default_descriptor_template(wallet_header->descriptor_template_sha256,
+                                            wallet_header->descriptor_template_len,
+                                            policy_map_descriptor_template,
+                                            MAX_DESCRIPTOR_TEMPLATE_LENGTH,
+                                            policy_map_bytes,
+                                            policy_map_bytes_len);
+        if (desc_temp_len >= 0) {
+            return desc_temp_len;
+        }
+
+        // if V2, stream and parse descriptor template from client first, unless it was inline
+        if (inline_keys_info == NULL) {
+            int descriptor_template_len =
+                call_get_preimage(dispatcher_context,
+                                  wallet_header->descriptor_template_sha256,
+                                  policy_map_descriptor_template,
+                                  MAX_DESCRIPTOR_TEMPLATE_LENGTH);
+            if (descriptor_template_len < 0) {
+                return WITH_ERROR(-1, "Failed getting wallet policy descriptor template");
+            }
         }
     }
 
@@ -361,6 +403,57 @@ int read_and_parse_wallet_policy(
     return desc_temp_len;
 }
 
+int fetch_and_parse_wallet_policy(dispatcher_context_t *dispatcher_context,
+                                  const uint8_t wallet_id[static 32],
+                                  policy_map_wallet_header_t *wallet_header,
+                                  uint8_t *policy_map_bytes,
+                                  size_t policy_map_bytes_len) {
+    int desc_temp_len =
+        wallet_policy_cache_get(wallet_id, wallet_header, policy_map_bytes, policy_map_bytes_len);
+    if (desc_temp_len >= 0) {
+        return desc_temp_len;
+    }
+
+#ifdef HAVE_WALLET_REGISTRY
+    desc_temp_len = wallet_registry_get(wallet_id,
+                                        crypto_get_master_key_fingerprint(),
+                                        wallet_header,
+                                        policy_map_bytes,
+                                        policy_map_bytes_len);
+    if (desc_temp_len >= 0) {
+        wallet_policy_cache_add(wallet_id, wallet_header, policy_map_bytes, desc_temp_len);
+        return desc_temp_len;
+    }
+#endif
+
+    uint8_t serialized_wallet_policy[MAX_WALLET_POLICY_SERIALIZED_LENGTH];
+    int serialized_wallet_policy_len = call_get_preimage(dispatcher_context,
+                                                         wallet_id,
+                                                         serialized_wallet_policy,
+                                                         sizeof(serialized_wallet_policy));
+    if (serialized_wallet_policy_len < 0) {
+        return WITH_ERROR(-1, "Failed getting the serialized wallet policy");
+    }
+
+    buffer_t serialized_wallet_policy_buf =
+        buffer_create(serialized_wallet_policy, serialized_wallet_policy_len);
+
+    uint8_t policy_map_descriptor[MAX_DESCRIPTOR_TEMPLATE_LENGTH];
+    desc_temp_len = read_and_parse_wallet_policy(dispatcher_context,
+                                                 &serialized_wallet_policy_buf,
+                                                 wallet_header,
+                                                 policy_map_descriptor,
+                                                 policy_map_bytes,
+                                                 policy_map_bytes_len,
+                                                 NULL);
+    if (desc_temp_len < 0) {
+        return desc_temp_len;
+    }
+
+    wallet_policy_cache_add(wallet_id, wallet_header, policy_map_bytes, desc_temp_len);
+    return desc_temp_len;
+}
+
 /**
  * Pushes a node onto the stack. Returns 0 on success, -1 if the stack is exhausted.
  */
@@ -417,6 +510,107 @@ execute_processor(policy_parser_state_t *state, policy_parser_processor_t proc,
 // p2sh (also nested segwit) ==> legacy script  (start with 3 on mainnet, 2 on testnet)
 // p2wpkh or p2wsh           ==> bech32         (sart with bc1 on mainnet, tb1 on testnet)
 
+int get_policy_key_info(dispatcher_context_t *dispatcher_context,
+                        int wallet_version,
+                        const uint8_t keys_merkle_root[static 32],
+                        uint32_t n_keys,
+                        uint32_t key_index,
+                        policy_map_key_info_t *out) {
+    if (wallet_key_cache_get_key_info(keys_merkle_root, wallet_version, key_index, out)) {
+        return 0;
+    }
+
+    char key_info_str[MAX_POLICY_KEY_INFO_LEN];
+
+    int key_info_len = call_get_merkle_leaf_element(dispatcher_context,
+                                                    keys_merkle_root,
+                                                    n_keys,
+                                                    key_index,
+                                                    (uint8_t *) key_info_str,
+                                                    sizeof(key_info_str));
+    if (key_info_len == -1) {
+        return -1;
+    }
+
+    // Make a sub-buffer for the pubkey info
+    buffer_t key_info_buffer = buffer_create(key_info_str, key_info_len);
+
+    if (parse_policy_map_key_info(&key_info_buffer, out, wallet_version) == -1) {
+        return -1;
+    }
+
+    wallet_key_cache_add_key_info(keys_merkle_root, wallet_version, key_index, out);
+    return 0;
+}
+
+typedef struct {
+    const uint8_t *keys_merkle_root;
+    int wallet_version;
+    bool has_error;
+} keys_info_prefetch_state_t;
+
+// Callback for call_get_merkle_leaf_range; the key information is added to the key cache before it
+// is authenticated, therefore the cache is emptied if the range is not verified in the end.
+static void add_prefetched_key_info(void *state,
+                                    uint32_t leaf_index,
+                                    const uint8_t *element,
+                                    size_t element_len) {
+    keys_info_prefetch_state_t *prefetch_state = (keys_info_prefetch_state_t *) state;
+    if (prefetch_state->has_error) {
+        return;
+    }
+
+    buffer_t key_info_buffer = buffer_create((void *) element, element_len);
+    policy_map_key_info_t key_info;
+    if (parse_policy_map_key_info(&key_info_buffer, &key_info, prefetch_state->wallet_version) ==
+        -1) {
+        prefetch_state->has_error = true;
+        return;
+    }
+    wallet_key_cache_add_key_info(prefetch_state->keys_merkle_root,
+                                  prefetch_state->wallet_version,
+                                  leaf_index,
+                                  &key_info);
+}
+
+int prefetch_policy_keys_info(dispatcher_context_t *dispatcher_context,
+                              int wallet_version,
+                              const uint8_t keys_merkle_root[static 32],
+                              uint32_t n_keys) {
+    if (n_keys < 2 || n_keys > MAX_N_KEYS_IN_WALLET_POLICY) {
+        return 0;  // nothing to batch, or the keys would not fit in the cache
+    }
+
+    // nothing to do if they are all cached already, for example for a repeated command
+    bool all_cached = true;
+    for (uint32_t i = 0; i < n_keys && all_cached; i++) {
+        policy_map_key_info_t key_info;
+        all_cached = wallet_key_cache_get_key_info(keys_merkle_root, wallet_version, i, &key_info);
+    }
+    if (all_cached) {
+        return 0;
+    }
+
+    keys_info_prefetch_state_t state = {.keys_merkle_root = keys_merkle_root,
+                                        .wallet_version = wallet_version,
+                                        .has_error = false};
+    uint8_t key_info_str[MAX_POLICY_KEY_INFO_LEN];
+    if (0 > call_get_merkle_leaf_range(dispatcher_context,
+                                       keys_merkle_root,
+                                       n_keys,
+                                       0,
+                                       n_keys,
+                                       key_info_str,
+                                       sizeof(key_info_str),
+                                       add_prefetched_key_info,
+                                       &state) ||
+        state.has_error) {
+        wallet_key_cache_reset();
+        return WITH_ERROR(-1, "Failed to fetch the keys information");
+    }
+    return 0;
+}
+
 // convenience function, split from get_derived_pubkey only to improve stack usage
 // returns -1 on error, 0 if the returned key info has no wildcard (**), 1 if it has the wildcard
 __attribute__((noinline, warn_unused_result)) static int get_extended_pubkey(
@@ -428,25 +622,13 @@ __attribute__((noinline, warn_unused_result)) static int get_extended_pubkey(
 
     policy_map_key_info_t key_info;
 
-    {
-        char key_info_str[MAX_POLICY_KEY_INFO_LEN];
-
-        int key_info_len = call_get_merkle_leaf_element(dispatcher_context,
-                                                        wdi->keys_merkle_root,
-                                                        wdi->n_keys,
-                                                        key_index,
-                                                        (uint8_t *) key_info_str,
-                                                        sizeof(key_info_str));
-        if (key_info_len == -1) {
-            return -1;
-        }
-
-        // Make a sub-buffer for the pubkey info
-        buffer_t key_info_buffer = buffer_create(key_info_str, key_info_len);
-
-        if (parse_policy_map_key_info(&key_info_buffer, &key_info, wdi->wallet_version) == -1) {
-            return -1;
-        }
+    if (0 > get_policy_key_info(dispatcher_context,
+                                wdi->wallet_version,
+                                wdi->keys_merkle_root,
+                                wdi->n_keys,
+                                key_index,
+                                &key_info)) {
+        return -1;
     }
     *out = key_info.ext_pubkey;
 
@@ -460,21 +642,68 @@ __attribute__((warn_unused_result)) static int get_derived_pubkey(
     uint8_t out[static 33]) {
     PRINT_STACK_POINTER();
 
-    serialized_extended_pubkey_t ext_pubkey;
+    uint32_t change_step = wdi->change ? key_placeholder->num_second : key_placeholder->num_first;
 
-    int ret = get_extended_pubkey(dispatcher_context, wdi, key_placeholder->key_index, &ext_pubkey);
-    if (ret < 0) {
+    if (wallet_key_cache_get_derived_pubkey(wdi->keys_merkle_root,
+                                            key_placeholder->key_index,
+                                            change_step,
+                                            wdi->address_index,
+                                            out)) {
+        return 0;
+    }
+
+    // The derivation steps are computed on the uncompressed pubkey, so that only the first key in
+    // the chain needs to be decompressed. Only the pubkey and the chain code are computed, as the
+    // other fields of the intermediate extended pubkeys are never used.
+    uint8_t pubkey[65];
+    uint8_t chain_code[32];
+
+    // the /<change> child is shared by all the addresses in the same branch; its compressed pubkey
+    // is temporarily stored in out
+    if (!wallet_key_cache_get_change_pubkey(wdi->keys_merkle_root,
+                                            key_placeholder->key_index,
+                                            change_step,
+                                            out,
+                                            chain_code)) {
+        serialized_extended_pubkey_t ext_pubkey;
+        int ret =
+            get_extended_pubkey(dispatcher_context, wdi, key_placeholder->key_index, &ext_pubkey);
+        if (ret < 0) {
+            return -1;
+        }
+
+        if (0 > crypto_get_uncompressed_pubkey(ext_pubkey.compressed_pubkey, pubkey) ||
+            0 > bip32_CKDpub_uncompressed(pubkey,
+                                          ext_pubkey.chain_code,
+                                          change_step,
+                                          pubkey,
+                                          chain_code)) {
+            return -1;
+        }
+        crypto_get_compressed_pubkey(pubkey, out);
+
+        wallet_key_cache_add_change_pubkey(wdi->keys_merkle_root,
+                                           key_placeholder->key_index,
+                                           wdi->change,
+                                           change_step,
+                                           out,
+                                           chain_code);
+    } else if (0 > crypto_get_uncompressed_pubkey(out, pubkey)) {
         return -1;
     }
 
-    // we derive the /<change>/<address_index> child of this pubkey
-    // we reuse the same memory of ext_pubkey
-    bip32_CKDpub(&ext_pubkey,
-                 wdi->change ? key_placeholder->num_second : key_placeholder->num_first,
-                 &ext_pubkey);
-    bip32_CKDpub(&ext_pubkey, wdi->address_index, &ext_pubkey);
+    // we derive the /<address_index> child of the /<change> pubkey
+    if (0 > bip32_CKDpub_uncompressed(pubkey, chain_code, wdi->address_index, pubkey, chain_code)) {
+        return -1;
+    }
+
+    crypto_get_compressed_pubkey(pubkey, out);
 
-    memcpy(out, ext_pubkey.compressed_pubkey, 33);
+    wallet_key_cache_add_derived_pubkey(wdi->keys_merkle_root,
+                                        key_placeholder->key_index,
+                                        change_step,
+                                        wdi->address_index,
+                                        out);
 
     return 0;
 }
@@ -482,8 +711,8 @@ __attribute__((warn_unused_result)) static int get_derived_pubkey(
 static void update_output(policy_parser_state_t *state, const uint8_t *data, size_t data_len) {
     policy_parser_node_state_t *node = &state->nodes[state->node_stack_eos];
     node->length += data_len;
-    if (state->hash_context != NULL) {
-        crypto_hash_update(state->hash_context, data, data_len);
+    for (size_t i = 0; i < state->n_hash_contexts; i++) {
+        crypto_hash_update(state->hash_contexts[i], data, data_len);
     }
 }
 
@@ -539,23 +768,180 @@ static void update_output_op_v(policy_parser_state_t *state, uint8_t op) {
     }
 }
 
+// Outputs the push of the derived pubkey of the key placeholder of a policy_node_with_key_t;
+// if hash is true, the push of its hash160 instead.
+// Returns 0 on success, -1 on error.
+__attribute__((warn_unused_result)) static int update_output_push_key(
+    policy_parser_state_t *state,
+    const policy_node_with_key_t *policy,
+    bool hash) {
+    uint8_t compressed_pubkey[33];
+    if (-1 == get_derived_pubkey(state->dispatcher_context,
+                                 state->wdi,
+                                 r_policy_node_key_placeholder(&policy->key_placeholder),
+                                 compressed_pubkey)) {
+        return -1;
+    }
+
+    // x-only pubkey if within taproot
+    const uint8_t *key = state->is_taproot ? compressed_pubkey + 1 : compressed_pubkey;
+    uint8_t key_len = state->is_taproot ? 32 : 33;
+
+    if (hash) {
+        crypto_hash160(key, key_len, compressed_pubkey);  // reuse memory
+        update_output_u8(state, 20);                      // PUSH 20 bytes
+        update_output(state, compressed_pubkey, 20);
+    } else {
+        update_output_u8(state, key_len);  // PUSH 32 or 33 bytes
+        update_output(state, key, key_len);
+    }
+    return 0;
+}
+
+// 0 ==> 0
+// 1 ==> 1
+__attribute__((warn_unused_result)) static int process_0_1_node(policy_parser_state_t *state,
+                                                                const void *arg) {
+    UNUSED(arg);
+
+    const policy_parser_node_state_t *node = &state->nodes[state->node_stack_eos];
+
+    if (node->step != 0) {
+        return -1;
+    }
+
+    update_output_op_v(state, node->policy_node->type == TOKEN_0 ? OP_0 : OP_1);
+    return 1;
+}
+
+// pk_k(key) ==> <key>
+// pk_h(key) ==> DUP HASH160 <HASH160(key)> EQUALVERIFY
+// pk(key)   ==> <key> CHECKSIG
+__attribute__((warn_unused_result)) static int process_pk_k_pk_h_pk_node(
+    policy_parser_state_t *state,
+    const void *arg) {
+    UNUSED(arg);
+
+    const policy_parser_node_state_t *node = &state->nodes[state->node_stack_eos];
+
+    if (node->step != 0) {
+        return -1;
+    }
+
+    const policy_node_with_key_t *policy = (const policy_node_with_key_t *) node->policy_node;
+
+    if (policy->base.type == TOKEN_PK_H) {
+        update_output_u8(state, OP_DUP);
+        update_output_u8(state, OP_HASH160);
+        if (0 > update_output_push_key(state, policy, true)) {
+            return -1;
+        }
+        update_output_u8(state, OP_EQUALVERIFY);
+        return 1;
+    }
+
+    if (0 > update_output_push_key(state, policy, false)) {
+        return -1;
+    }
+    if (policy->base.type == TOKEN_PK) {
+        update_output_op_v(state, OP_CHECKSIG);
+    }
+    return 1;
+}
+
+// older(n) ==> <n> CHECKSEQUENCEVERIFY
+// after(n) ==> <n> CHECKLOCKTIMEVERIFY
+__attribute__((warn_unused_result)) static int process_older_after_node(
+    policy_parser_state_t *state,
+    const void *arg) {
+    UNUSED(arg);
+
+    const policy_parser_node_state_t *node = &state->nodes[state->node_stack_eos];
+
+    if (node->step != 0) {
+        return -1;
+    }
+
+    const policy_node_with_uint32_t *policy = (const policy_node_with_uint32_t *) node->policy_node;
+
+    update_output_push_u32(state, policy->n);
+    update_output_op_v(state, policy->base.type == TOKEN_OLDER ? OP_CSV : OP_CLTV);
+    return 1;
+}
+
+// sha256(h)    ==> SIZE <32> EQUALVERIFY SHA256 <h> EQUAL
+// hash256(h)   ==> SIZE <32> EQUALVERIFY HASH256 <h> EQUAL
+// ripemd160(h) ==> SIZE <32> EQUALVERIFY RIPEMD160 <h> EQUAL
+// hash160(h)   ==> SIZE <32> EQUALVERIFY HASH160 <h> EQUAL
+__attribute__((warn_unused_result)) static int process_hashlock_node(policy_parser_state_t *state,
+                                                                     const void *arg) {
+    UNUSED(arg);
+
+    const policy_parser_node_state_t *node = &state->nodes[state->node_stack_eos];
+
+    if (node->step != 0) {
+        return -1;
+    }
+
+    uint8_t op;
+    const uint8_t *h;
+    uint8_t h_len;
+    switch (node->policy_node->type) {
+        case TOKEN_SHA256:
+            op = OP_SHA256;
+            h = ((const policy_node_with_hash_256_t *) node->policy_node)->h;
+            h_len = 32;
+            break;
+        case TOKEN_HASH256:
+            op = OP_HASH256;
+            h = ((const policy_node_with_hash_256_t *) node->policy_node)->h;
+            h_len = 32;
+            break;
+        case TOKEN_RIPEMD160:
+            op = OP_RIPEMD160;
+            h = ((const policy_node_with_hash_160_t *) node->policy_node)->h;
+            h_len = 20;
+            break;
+        case TOKEN_HASH160:
+            op = OP_HASH160;
+            h = ((const policy_node_with_hash_160_t *) node->policy_node)->h;
+            h_len = 20;
+            break;
+        default:
+            return -1;
+    }
+
+    update_output_u8(state, OP_SIZE);
+    update_output_u8(state, 1);   // 1-byte push
+    update_output_u8(state, 32);  // pushed value
+    update_output_u8(state, OP_EQUALVERIFY);
+    update_output_u8(state, op);
+    update_output_u8(state, h_len);
+    update_output(state, h, h_len);
+    update_output_op_v(state, OP_EQUAL);
+    return 1;
+}
+
+// Interprets the commands of a fragment with children. All the commands up to the next child are
+// executed in a single call; the call returns after pushing the child on the stack, and the next
+// call resumes after it.
 __attribute__((warn_unused_result)) static int process_generic_node(policy_parser_state_t *state,
                                                                     const void *arg) {
     policy_parser_node_state_t *node = &state->nodes[state->node_stack_eos];
 
     const generic_processor_command_t *commands = (const generic_processor_command_t *) arg;
 
-    size_t n_commands = 0;
-    while (commands[n_commands].code != CMD_CODE_END) ++n_commands;
-
-    if (node->step > n_commands) {
-        return WITH_ERROR(-1, "Inconsistent state");
-    } else if (node->step == n_commands) {
-        return 1;
-    } else {
+    while (true) {
         uint8_t cmd_code = commands[node->step].code;
         uint8_t cmd_data = commands[node->step].data;
 
+        if (cmd_code == CMD_CODE_END) {
+            return 1;
+        }
+
+        // advanced before pushing a child, so that the next call resumes after it
+        ++node->step;
+
         switch (cmd_code) {
             case CMD_CODE_OP: {
                 update_output_u8(state, cmd_data);
@@ -565,104 +951,26 @@ __attribute__((warn_unused_result)) static int process_generic_node(policy_parse
                 update_output_op_v(state, cmd_data);
                 break;
             }
-            case CMD_CODE_PUSH_PK: {
-                const policy_node_with_key_t *policy =
-                    (const policy_node_with_key_t *) node->policy_node;
-                uint8_t compressed_pubkey[33];
-                if (-1 ==
-                    get_derived_pubkey(state->dispatcher_context,
-                                       state->wdi,
-                                       r_policy_node_key_placeholder(&policy->key_placeholder),
-                                       compressed_pubkey)) {
-                    return -1;
-                }
-
-                if (!state->is_taproot) {
-                    update_output_u8(state, 33);  // PUSH 33 bytes
-                    update_output(state, compressed_pubkey, 33);
-                } else {
-                    // x-only pubkey if within taproot
-                    update_output_u8(state, 32);  // PUSH 32 bytes
-                    update_output(state, compressed_pubkey + 1, 32);
-                }
-                break;
-            }
-            case CMD_CODE_PUSH_PKH: {
-                const policy_node_with_key_t *policy =
-                    (const policy_node_with_key_t *) node->policy_node;
-                uint8_t compressed_pubkey[33];
-                if (-1 ==
-                    get_derived_pubkey(state->dispatcher_context,
-                                       state->wdi,
-                                       r_policy_node_key_placeholder(&policy->key_placeholder),
-                                       compressed_pubkey)) {
-                    return -1;
-                }
-                if (!state->is_taproot) {
-                    crypto_hash160(compressed_pubkey, 33, compressed_pubkey);  // reuse memory
-                } else {
-                    // x-only pubkey if within taproot
-                    crypto_hash160(compressed_pubkey + 1, 32, compressed_pubkey);  // reuse memory
-                }
-
-                update_output_u8(state, 20);  // PUSH 20 bytes
-                update_output(state, compressed_pubkey, 20);
-                break;
-            }
-            case CMD_CODE_PUSH_UINT32: {
-                const policy_node_with_uint32_t *policy =
-                    (const policy_node_with_uint32_t *) node->policy_node;
-                update_output_push_u32(state, policy->n);
-                break;
-            }
-            case CMD_CODE_PUSH_HASH20: {
-                const policy_node_with_hash_160_t *policy =
-                    (const policy_node_with_hash_160_t *) node->policy_node;
-                update_output_u8(state, 20);
-                update_output(state, policy->h, 20);
-                break;
-            }
-            case CMD_CODE_PUSH_HASH32: {
-                const policy_node_with_hash_256_t *policy =
-                    (const policy_node_with_hash_256_t *) node->policy_node;
-                update_output_u8(state, 32);
-                update_output(state, policy->h, 32);
-                break;
-            }
-            case CMD_CODE_PROCESS_CHILD: {
-                const policy_node_with_scripts_t *policy =
-                    (const policy_node_with_scripts_t *) node->policy_node;
-                if (0 > state_stack_push(state, r_policy_node(&policy->scripts[cmd_data]), 0)) {
-                    return -1;
-                }
-                break;
-            }
-            case CMD_CODE_PROCESS_CHILD_V: {
-                const policy_node_with_scripts_t *policy =
-                    (const policy_node_with_scripts_t *) node->policy_node;
-                if (0 > state_stack_push(state,
-                                         r_policy_node(&policy->scripts[cmd_data]),
-                                         node->flags)) {
-                    return -1;
-                }
-                break;
-            }
+            case CMD_CODE_PROCESS_CHILD:
+            case CMD_CODE_PROCESS_CHILD_V:
             case CMD_CODE_PROCESS_CHILD_VV: {
                 const policy_node_with_scripts_t *policy =
                     (const policy_node_with_scripts_t *) node->policy_node;
-                if (0 > state_stack_push(state,
-                                         r_policy_node(&policy->scripts[cmd_data]),
-                                         node->flags | PROCESSOR_FLAG_V)) {
+                uint8_t flags = 0;
+                if (cmd_code == CMD_CODE_PROCESS_CHILD_V) {
+                    flags = node->flags;
+                } else if (cmd_code == CMD_CODE_PROCESS_CHILD_VV) {
+                    flags = node->flags | PROCESSOR_FLAG_V;
+                }
+                if (0 > state_stack_push(state, r_policy_node(&policy->scripts[cmd_data]), flags)) {
                     return -1;
                 }
-                break;
+                return 0;
             }
             default:
                 PRINTF("Unexpected command code: %d\n", cmd_code);
                 return -1;
         }
-        ++node->step;
-        return 0;
     }
 }
 
@@ -785,6 +1093,41 @@ __attribute__((warn_unused_result)) static int process_thresh_node(policy_parser
     }
 }
 
+// Derives the n pubkeys of a multisig node; for sortedmulti and sortedmulti_a, they are sorted
+// lexicographically, ignoring the first byte of the compressed pubkeys if x_only is true. Each key
+// is derived only once, and sorted in memory with an insertion sort (n is at most 16).
+__attribute__((warn_unused_result, noinline)) static int get_multisig_pubkeys(
+    policy_parser_state_t *state,
+    const policy_node_multisig_t *policy,
+    bool x_only,
+    uint8_t out[static MAX_PUBKEYS_PER_MULTISIG][33]) {
+    LEDGER_ASSERT(policy->n <= MAX_PUBKEYS_PER_MULTISIG, "Too many keys in multisig");
+
+    bool sorted =
+        policy->base.type == TOKEN_SORTEDMULTI || policy->base.type == TOKEN_SORTEDMULTI_A;
+    size_t offset = x_only ? 1 : 0;
+
+    for (int i = 0; i < policy->n; i++) {
+        uint8_t pubkey[33];
+        if (-1 == get_derived_pubkey(state->dispatcher_context,
+                                     state->wdi,
+                                     &r_policy_node_key_placeholder(&policy->key_placeholders)[i],
+                                     pubkey)) {
+            return -1;
+        }
+
+        int pos = i;
+        if (sorted) {
+            while (pos > 0 && cmp_arrays(out[pos - 1] + offset, pubkey + offset, 33 - offset) > 0) {
+                memcpy(out[pos], out[pos - 1], 33);
+                --pos;
+            }
+        }
+        memcpy(out[pos], pubkey, 33);
+    }
+    return 0;
+}
+
 __attribute__((warn_unused_result)) static int process_multi_sortedmulti_node(
     policy_parser_state_t *state,
     const void *arg) {
@@ -801,62 +1144,19 @@ __attribute__((warn_unused_result)) static int process_multi_sortedmulti_node(
 
     // k {pubkey_1} ... {pubkey_n} n OP_CHECKMULTISIG
 
-    update_output_u8(state, 0x50 + policy->k);  // OP_k
+    // All the keys are kept in memory (33*MAX_PUBKEYS_PER_MULTISIG bytes), so that each of them is
+    // only derived once, even if they have to be sorted.
+    uint8_t pubkeys[MAX_PUBKEYS_PER_MULTISIG][33];
+    if (-1 == get_multisig_pubkeys(state, policy, false, pubkeys)) {
+        return -1;
+    }
 
-    // bitvector of used keys (only relevant for sorting keys in SORTEDMULTI)
-    uint8_t used[BITVECTOR_REAL_SIZE(MAX_PUBKEYS_PER_MULTISIG)];
-    memset(used, 0, sizeof(used));
+    update_output_u8(state, 0x50 + policy->k);  // OP_k
 
     for (int i = 0; i < policy->n; i++) {
-        uint8_t compressed_pubkey[33];
-
-        if (policy->base.type == TOKEN_MULTI) {
-            if (-1 ==
-                get_derived_pubkey(state->dispatcher_context,
-                                   state->wdi,
-                                   &r_policy_node_key_placeholder(&policy->key_placeholders)[i],
-                                   compressed_pubkey)) {
-                return -1;
-            }
-        } else {
-            // sortedmulti is problematic, especially for very large wallets: we don't have enough
-            // memory on Nano S to keep all the keys in memory. Therefore, we use a slow method: at
-            // each iteration, find the lexicographically smallest key that was not already used
-            // (basically, like in insertion sort). This means quadratic communication with the
-            // client, and a quadratic number of pubkey derivations as well, which are quite slow.
-            // Performance might become an issue for very large multisig wallets, but this allows us
-            // to remove any limitation on the supported number of pubkeys, and to keep the code
-            // simple.
-            // Should speed be reported as an issue in practice, sorting could be done in-memory for
-            // non-Nano S devices, instead (requiring 33*MAX_PUBKEYS_PER_MULTISIG > 500 bytes more
-            // memory).
-
-            int smallest_pubkey_index = -1;
-            memset(compressed_pubkey, 0xFF, sizeof(compressed_pubkey));  // init to largest value
-
-            for (int j = 0; j < policy->n; j++) {
-                if (!bitvector_get(used, j)) {
-                    uint8_t cur_pubkey[33];
-                    if (-1 == get_derived_pubkey(
-                                  state->dispatcher_context,
-                                  state->wdi,
-                                  &r_policy_node_key_placeholder(&policy->key_placeholders)[j],
-                                  cur_pubkey)) {
-                        return -1;
-                    }
-
-                    if (cmp_arrays(compressed_pubkey, cur_pubkey, 33) > 0) {
-                        memcpy(compressed_pubkey, cur_pubkey, 33);
-                        smallest_pubkey_index = j;
-                    }
-                }
-            }
-            bitvector_set(used, smallest_pubkey_index, true);  // mark the key as used
-        }
-
         // push <i-th pubkey> (33 = 0x21 bytes)
         update_output_u8(state, 0x21);
-        update_output(state, compressed_pubkey, 33);
+        update_output(state, pubkeys[i], 33);
     }
 
     update_output_u8(state, 0x50 + policy->n);    // OP_n
@@ -881,51 +1181,16 @@ __attribute__((warn_unused_result)) static int process_multi_a_sortedmulti_a_nod
 
     // <pk_1> OP_CHECKSIG <pk_2> OP_CHECKSIGADD ... <pk_n> OP_CHECKSIGADD <k> OP_NUMEQUAL
 
-    // bitvector of used keys (only relevant for sorting keys in SORTEDMULTI)
-    uint8_t used[BITVECTOR_REAL_SIZE(MAX_PUBKEYS_PER_MULTISIG)];
-    memset(used, 0, sizeof(memset));
+    // x-only pubkeys must be sorted ignoring the first byte; see process_multi_sortedmulti_node
+    uint8_t pubkeys[MAX_PUBKEYS_PER_MULTISIG][33];
+    if (-1 == get_multisig_pubkeys(state, policy, true, pubkeys)) {
+        return -1;
+    }
 
     for (int i = 0; i < policy->n; i++) {
-        uint8_t compressed_pubkey[33];
-
-        if (policy->base.type == TOKEN_MULTI_A) {
-            if (-1 ==
-                get_derived_pubkey(state->dispatcher_context,
-                                   state->wdi,
-                                   &r_policy_node_key_placeholder(&policy->key_placeholders)[i],
-                                   compressed_pubkey)) {
-                return -1;
-            }
-        } else {
-            // Inefficient O(n^2) sorting; check process_multi_sortedmulti_node for the motivation.
-
-            int smallest_pubkey_index = -1;
-            memset(compressed_pubkey, 0xFF, sizeof(compressed_pubkey));  // init to largest value
-
-            for (int j = 0; j < policy->n; j++) {
-                if (!bitvector_get(used, j)) {
-                    uint8_t cur_pubkey[33];
-                    if (-1 == get_derived_pubkey(
-                                  state->dispatcher_context,
-                                  state->wdi,
-                                  &r_policy_node_key_placeholder(&policy->key_placeholders)[j],
-                                  cur_pubkey)) {
-                        return -1;
-                    }
-
-                    // x-only pubkeys must be compared ignoring the first byte
-                    if (cmp_arrays(compressed_pubkey + 1, cur_pubkey + 1, 32) > 0) {
-                        memcpy(compressed_pubkey, cur_pubkey, 33);
-                        smallest_pubkey_index = j;
-                    }
-                }
-            }
-            bitvector_set(used, smallest_pubkey_index, true);  // mark the key as used
-        }
-
         // push <i-th pubkey> as x-only key (32 = 0x20 bytes)
         update_output_u8(state, 0x20);
-        update_output(state, compressed_pubkey + 1, 32);
+        update_output(state, pubkeys[i] + 1, 32);
 
         if (i == 0) {
             update_output_u8(state, OP_CHECKSIG);
@@ -975,29 +1240,132 @@ __attribute__((warn_unused_result, noinline)) static int compute_tapleaf_hash(
     return 0;
 }
 
-// Separated from compute_taptree_hash to optimize its stack usage
+// The hash of a tapleaf without key placeholders (for example, a hashlock) is the same for every
+// address, so it is cached only once, as if it was the one of the first receive address. Returns
+// true in that case, and sets the derivation that identifies the tapleaf hash in the cache.
+static bool get_tapleaf_cache_derivation(const wallet_derivation_info_t *wdi,
+                                         const policy_node_t *script_policy,
+                                         bool *is_change,
+                                         uint32_t *address_index) {
+    if (get_key_placeholder_by_index(script_policy, 0, NULL, NULL) == 0) {
+        *is_change = false;
+        *address_index = 0;
+        return true;
+    }
+    *is_change = wdi->change;
+    *address_index = wdi->address_index;
+    return false;
+}
+
+__attribute__((warn_unused_result, noinline)) static int compute_taptree_hash_rec(
+    dispatcher_context_t *dc,
+    const wallet_derivation_info_t *wdi,
+    const policy_node_tree_t *tree,
+    uint8_t out[static 32]);
+
+// Separated from compute_taptree_hash_rec to optimize its stack usage
 __attribute__((warn_unused_result, noinline)) static int compute_and_combine_taptree_child_hashes(
     dispatcher_context_t *dc,
     const wallet_derivation_info_t *wdi,
     const policy_node_tree_t *tree,
     uint8_t out[static 32]) {
     uint8_t left_h[32], right_h[32];
-    if (0 > compute_taptree_hash(dc, wdi, r_policy_node_tree(&tree->left_tree), left_h)) return -1;
-    if (0 > compute_taptree_hash(dc, wdi, r_policy_node_tree(&tree->right_tree), right_h))
+    if (0 > compute_taptree_hash_rec(dc, wdi, r_policy_node_tree(&tree->left_tree), left_h))
+        return -1;
+    if (0 > compute_taptree_hash_rec(dc, wdi, r_policy_node_tree(&tree->right_tree), right_h))
         return -1;
     crypto_tr_combine_taptree_hashes(left_h, right_h, out);
     return 0;
 }
 
 // See taproot_tree_helper in BIP-0341
-__attribute__((noinline)) int compute_taptree_hash(dispatcher_context_t *dc,
-                                                   const wallet_derivation_info_t *wdi,
-                                                   const policy_node_tree_t *tree,
-                                                   uint8_t out[static 32]) {
-    if (tree->is_leaf)
-        return compute_tapleaf_hash(dc, wdi, r_policy_node(&tree->script), out);
-    else
+__attribute__((warn_unused_result, noinline)) static int compute_taptree_hash_rec(
+    dispatcher_context_t *dc,
+    const wallet_derivation_info_t *wdi,
+    const policy_node_tree_t *tree,
+    uint8_t out[static 32]) {
+    if (tree->is_leaf) {
+        const policy_node_t *script_policy = r_policy_node(&tree->script);
+        bool is_change;
+        uint32_t address_index;
+        bool is_key_free =
+            get_tapleaf_cache_derivation(wdi, script_policy, &is_change, &address_index);
+        // use the tapleaf hash if it was cached by get_tapleaf_hash, but do not add all the leaves
+        // to the cache, as they would evict the more useful entries; only the leaves without keys
+        // are added, as they are reused for every address
+        if (wallet_key_cache_get_taptree_hash(wdi->keys_merkle_root,
+                                              script_policy,
+                                              is_change,
+                                              address_index,
+                                              out)) {
+            return 0;
+        }
+        if (0 > compute_tapleaf_hash(dc, wdi, script_policy, out)) {
+            return -1;
+        }
+        if (is_key_free) {
+            wallet_key_cache_add_taptree_hash(wdi->keys_merkle_root,
+                                              script_policy,
+                                              is_change,
+                                              address_index,
+                                              out);
+        }
+        return 0;
+    } else {
         return compute_and_combine_taptree_child_hashes(dc, wdi, tree, out);
+    }
+}
+
+int compute_taptree_hash(dispatcher_context_t *dc,
+                         const wallet_derivation_info_t *wdi,
+                         const policy_node_tree_t *tree,
+                         uint8_t out[static 32]) {
+    if (wallet_key_cache_get_taptree_hash(wdi->keys_merkle_root,
+                                          tree,
+                                          wdi->change,
+                                          wdi->address_index,
+                                          out)) {
+        return 0;
+    }
+
+    if (0 > compute_taptree_hash_rec(dc, wdi, tree, out)) {
+        return -1;
+    }
+
+    wallet_key_cache_add_taptree_hash(wdi->keys_merkle_root,
+                                      tree,
+                                      wdi->change,
+                                      wdi->address_index,
+                                      out);
+    return 0;
+}
+
+int get_tapleaf_hash(dispatcher_context_t *dc,
+                     const wallet_derivation_info_t *wdi,
+                     const policy_node_t *script_policy,
+                     uint8_t out[static 32]) {
+    bool is_change;
+    uint32_t address_index;
+    get_tapleaf_cache_derivation(wdi, script_policy, &is_change, &address_index);
+
+    if (wallet_key_cache_get_taptree_hash(wdi->keys_merkle_root,
+                                          script_policy,
+                                          is_change,
+                                          address_index,
+                                          out)) {
+        return 0;
+    }
+
+    if (0 > compute_tapleaf_hash(dc, wdi, script_policy, out)) {
+        return -1;
+    }
+
+    wallet_key_cache_add_taptree_hash(wdi->keys_merkle_root,
+                                      script_policy,
+                                      is_change,
+                                      address_index,
+                                      out);
+    return 0;
 }
 
 #pragma GCC diagnostic push
@@ -1148,12 +1516,26 @@ int get_wallet_script(dispatcher_context_t *dispatcher_context,
     return -1;
 }
 
-__attribute__((noinline)) int get_wallet_internal_script_hash(
+int get_wallet_internal_script_hash(dispatcher_context_t *dispatcher_context,
+                                    const policy_node_t *policy,
+                                    const wallet_derivation_info_t *wdi,
+                                    internal_script_type_e script_type,
+                                    cx_hash_t *hash_context) {
+    return get_wallet_internal_script_hashes(dispatcher_context,
+                                             policy,
+                                             wdi,
+                                             script_type,
+                                             &hash_context,
+                                             hash_context != NULL ? 1 : 0);
+}
+
+__attribute__((noinline)) int get_wallet_internal_script_hashes(
     dispatcher_context_t *dispatcher_context,
     const policy_node_t *policy,
     const wallet_derivation_info_t *wdi,
     internal_script_type_e script_type,
-    cx_hash_t *hash_context) {
+    cx_hash_t *const hash_contexts[],
+    size_t n_hash_contexts) {
     const uint8_t *whitelist;
     size_t whitelist_len;
     switch (script_type) {
@@ -1178,11 +1560,20 @@ __attribute__((noinline)) int get_wallet_internal_script_hash(
             return -1;
     }
 
+    // The whitelist is checked again each time the processing of a node resumes after one of its
+    // children, so it is turned into a bitmask once, rather than scanned at every step
+    _Static_assert(TOKEN_U < 64, "The whitelist bitmask must have a bit for each token");
+    uint64_t whitelist_mask = 0;
+    for (size_t i = 0; i < whitelist_len; i++) {
+        whitelist_mask |= 1ULL << whitelist[i];
+    }
+
     policy_parser_state_t state = {.dispatcher_context = dispatcher_context,
                                    .wdi = wdi,
                                    .is_taproot = (script_type == WRAPPED_SCRIPT_TYPE_TAPSCRIPT),
                                    .node_stack_eos = 0,
-                                   .hash_context = hash_context};
+                                   .hash_contexts = hash_contexts,
+                                   .n_hash_contexts = n_hash_contexts};
 
     state.nodes[0] =
         (policy_parser_node_state_t){.length = 0, .flags = 0, .step = 0, .policy_node = policy};
@@ -1196,15 +1587,8 @@ __attribute__((noinline)) int get_wallet_internal_script_hash(
             return -1;
         }
 
-        bool is_whitelisted = false;
-        for (size_t i = 0; i < whitelist_len; i++) {
-            if (node->policy_node->type == whitelist[i]) {
-                is_whitelisted = true;
-                break;
-            }
-        }
-
-        if (!is_whitelisted) {
+        PolicyNodeType type = node->policy_node->type;
+        if (type < 0 || type >= 64 || (whitelist_mask & (1ULL << type)) == 0) {
             PRINTF("Fragment %d not allowed in script type %d\n",
                    node->policy_node->type,
                    script_type);
@@ -1213,42 +1597,42 @@ __attribute__((noinline)) int get_wallet_internal_script_hash(
 
         switch (node->policy_node->type) {
             case TOKEN_0:
-                ret = execute_processor(&state, process_generic_node, commands_0);
+                ret = execute_processor(&state, process_0_1_node, NULL);
                 break;
             case TOKEN_1:
-                ret = execute_processor(&state, process_generic_node, commands_1);
+                ret = execute_processor(&state, process_0_1_node, NULL);
                 break;
             case TOKEN_PK_K:
-                ret = execute_processor(&state, process_generic_node, commands_pk_k);
+                ret = execute_processor(&state, process_pk_k_pk_h_pk_node, NULL);
                 break;
             case TOKEN_PK_H:
-                ret = execute_processor(&state, process_generic_node, commands_pk_h);
+                ret = execute_processor(&state, process_pk_k_pk_h_pk_node, NULL);
                 break;
             case TOKEN_PK:
-                ret = execute_processor(&state, process_generic_node, commands_pk);
+                ret = execute_processor(&state, process_pk_k_pk_h_pk_node, NULL);
                 break;
             case TOKEN_PKH:
             case TOKEN_WPKH:
                 ret = execute_processor(&state, process_pkh_wpkh_node, NULL);
                 break;
             case TOKEN_OLDER:
-                ret = execute_processor(&state, process_generic_node, commands_older);
+                ret = execute_processor(&state, process_older_after_node, NULL);
                 break;
             case TOKEN_AFTER:
-                ret = execute_processor(&state, process_generic_node, commands_after);
+                ret = execute_processor(&state, process_older_after_node, NULL);
                 break;
 
             case TOKEN_SHA256:
-                ret = execute_processor(&state, process_generic_node, commands_sha256);
+                ret = execute_processor(&state, process_hashlock_node, NULL);
                 break;
             case TOKEN_HASH256:
-                ret = execute_processor(&state, process_generic_node, commands_hash256);
+                ret = execute_processor(&state, process_hashlock_node, NULL);
                 break;
             case TOKEN_RIPEMD160:
-                ret = execute_processor(&state, process_generic_node, commands_ripemd160);
+                ret = execute_processor(&state, process_hashlock_node, NULL);
                 break;
             case TOKEN_HASH160:
-                ret = execute_processor(&state, process_generic_node, commands_hash160);
+                ret = execute_processor(&state, process_hashlock_node, NULL);
                 break;
 
             case TOKEN_ANDOR:
@@ -1335,12 +1719,67 @@ __attribute__((noinline)) int get_wallet_internal_script_hash(
     if (ret < 0) {
         return WITH_ERROR(ret, "Processor failed");
     }
-
+
+    return ret;
+}
+
+#pragma GCC diagnostic pop
+
+int get_wallet_witness_script_hashes(dispatcher_context_t *dispatcher_context,
+                                     const policy_node_t *policy,
+                                     const wallet_derivation_info_t *wdi,
+                                     cx_hash_t *hash_unprefixed,
+                                     cx_hash_t *hash_prefixed) {
+    internal_script_type_e script_type = WRAPPED_SCRIPT_TYPE_WSH;
+    const policy_node_t *child = NULL;
+    if (policy->type == TOKEN_WSH) {
+        child = r_policy_node(&((const policy_node_with_script_t *) policy)->script);
+    } else if (policy->type == TOKEN_SH) {
+        script_type = WRAPPED_SCRIPT_TYPE_SH_WSH;
+        const policy_node_t *wsh_policy =
+            r_policy_node(&((const policy_node_with_script_t *) policy)->script);
+        if (wsh_policy->type == TOKEN_WSH) {
+            child = r_policy_node(&((const policy_node_with_script_t *) wsh_policy)->script);
+        }
+    }
+    if (child == NULL) {
+        PRINTF("Not a P2WSH policy\n");
+        return -1;
+    }
+
+    int script_len = -1;
+    if (hash_prefixed != NULL) {
+        // the length prefix comes before the script: as for the tapleaf hashes, the script is
+        // computed once without any output just for its length, rather than kept in memory
+        script_len =
+            get_wallet_internal_script_hash(dispatcher_context, child, wdi, script_type, NULL);
+        if (script_len < 0) {
+            return -1;
+        }
+        crypto_hash_update_varint(hash_prefixed, script_len);
+    }
+
+    cx_hash_t *hash_contexts[2];
+    size_t n_hash_contexts = 0;
+    if (hash_unprefixed != NULL) {
+        hash_contexts[n_hash_contexts++] = hash_unprefixed;
+    }
+    if (hash_prefixed != NULL) {
+        hash_contexts[n_hash_contexts++] = hash_prefixed;
+    }
+
+    int ret = get_wallet_internal_script_hashes(dispatcher_context,
+                                                child,
+                                                wdi,
+                                                script_type,
+                                                hash_contexts,
+                                                n_hash_contexts);
+    if (ret < 0 || (hash_prefixed != NULL && ret != script_len)) {
+        return WITH_ERROR(-1, "Failed to compute the witness script");
+    }
     return ret;
 }
 
-#pragma GCC diagnostic pop
-
 // For a standard descriptor template, return the corresponding BIP44 purpose
 // Otherwise, returns -1.
 static int get_bip44_purpose(const policy_node_t *descriptor_template) {
@@ -1409,22 +1848,13 @@ bool is_wallet_policy_standard(dispatcher_context_t *dispatcher_context,
     // we check if the key is indeed internal
     uint32_t master_key_fingerprint = crypto_get_master_key_fingerprint();
 
-    uint8_t key_info_str[MAX_POLICY_KEY_INFO_LEN];
-    int key_info_len = call_get_merkle_leaf_element(dispatcher_context,
-                                                    wallet_policy_header->keys_info_merkle_root,
-                                                    wallet_policy_header->n_keys,
-                                                    0,  // only one key
-                                                    key_info_str,
-                                                    sizeof(key_info_str));
-    if (key_info_len < 0) {
-        return false;
-    }
-
-    // Make a sub-buffer for the pubkey info
-    buffer_t key_info_buffer = buffer_create(key_info_str, key_info_len);
-
     policy_map_key_info_t key_info;
-    if (0 > parse_policy_map_key_info(&key_info_buffer, &key_info, wallet_policy_header->version)) {
+    if (0 > get_policy_key_info(dispatcher_context,
+                                wallet_policy_header->version,
+                                wallet_policy_header->keys_info_merkle_root,
+                                wallet_policy_header->n_keys,
+                                0,  // only one key
+                                &key_info)) {
         return false;
     }
 
@@ -1438,10 +1868,10 @@ bool is_wallet_policy_standard(dispatcher_context_t *dispatcher_context,
 
     // generate pubkey and check if it matches
     serialized_extended_pubkey_t derived_pubkey;
-    if (0 > get_extended_pubkey_at_path(key_info.master_key_derivation,
-                                        key_info.master_key_derivation_len,
-                                        BIP32_PUBKEY_VERSION,
-                                        &derived_pubkey)) {
+    if (0 > get_wallet_extended_pubkey_at_path(key_info.master_key_derivation,
+                                               key_info.master_key_derivation_len,
+                                               BIP32_PUBKEY_VERSION,
+                                               &derived_pubkey)) {
         PRINTF("Failed to derive pubkey\n");
         return false;
     }
@@ -1467,43 +1897,95 @@ bool is_wallet_policy_standard(dispatcher_context_t *dispatcher_context,
     return true;
 }
 
-bool compute_wallet_hmac(const uint8_t wallet_id[static 32], uint8_t wallet_hmac[static 32]) {
-    uint8_t key[32];
+bool is_wallet_policy_standard_cached(dispatcher_context_t *dispatcher_context,
+                                      const uint8_t wallet_id[static 32],
+                                      const policy_map_wallet_header_t *wallet_policy_header,
+                                      const policy_node_t *descriptor_template) {
+    policy_map_key_info_t key_info;
+    if (wallet_policy_cache_get_standard_key_info(wallet_id, &key_info)) {
+        // the key information was checked against the internal key when the verdict was cached
+        wallet_key_cache_add_key_info(wallet_policy_header->keys_info_merkle_root,
+                                      wallet_policy_header->version,
+                                      0,
+                                      &key_info);
+        return true;
+    }
 
-    bool result = false;
+    if (!is_wallet_policy_standard(dispatcher_context, wallet_policy_header, descriptor_template)) {
+        return false;
+    }
 
-    if (!crypto_derive_symmetric_key(WALLET_SLIP0021_LABEL, WALLET_SLIP0021_LABEL_LEN, key)) {
-        goto end;
+    // it was just fetched by is_wallet_policy_standard, so it comes from the key cache
+    if (0 > get_policy_key_info(dispatcher_context,
+                                wallet_policy_header->version,
+                                wallet_policy_header->keys_info_merkle_root,
+                                wallet_policy_header->n_keys,
+                                0,
+                                &key_info)) {
+        return false;
     }
+    wallet_policy_cache_set_standard(wallet_id, &key_info);
+    return true;
+}
+
+// The SLIP-21 key for the wallet policy hmacs; it is derived on first use, and kept until the app
+// exits or the IO is reset
+static struct {
+    uint8_t key[32];
+    bool is_valid;
+} G_wallet_hmac_key;
 
-    cx_hmac_sha256(key, sizeof(key), wallet_id, 32, wallet_hmac, 32);
+void wallet_hmac_key_reset(void) {
+    explicit_bzero(&G_wallet_hmac_key, sizeof(G_wallet_hmac_key));
+}
 
-    result = true;
+// Returns a pointer to the 32-byte key for the wallet policy hmacs, or NULL on error
+static const uint8_t *get_wallet_hmac_key(void) {
+    if (!G_wallet_hmac_key.is_valid) {
+        if (!crypto_derive_symmetric_key(WALLET_SLIP0021_LABEL,
+                                         WALLET_SLIP0021_LABEL_LEN,
+                                         G_wallet_hmac_key.key)) {
+            wallet_hmac_key_reset();
+            return NULL;
+        }
+        G_wallet_hmac_key.is_valid = true;
+    }
+    return G_wallet_hmac_key.key;
+}
 
-end:
-    explicit_bzero(key, sizeof(key));
+bool compute_wallet_hmac(const uint8_t wallet_id[static 32], uint8_t wallet_hmac[static 32]) {
+    const uint8_t *key = get_wallet_hmac_key();
+    if (key == NULL) {
+        return false;
+    }
 
-    return result;
+    cx_hmac_sha256(key, 32, wallet_id, 32, wallet_hmac, 32);
+    return true;
+}
+
+bool is_wallet_policy_registered(const uint8_t wallet_id[static 32]) {
+#ifdef HAVE_WALLET_REGISTRY
+    return wallet_registry_contains(wallet_id, crypto_get_master_key_fingerprint());
+#else
+    (void) wallet_id;
+    return false;
+#endif
 }
 
 bool check_wallet_hmac(const uint8_t wallet_id[static 32], const uint8_t wallet_hmac[static 32]) {
-    uint8_t key[32];
     uint8_t correct_hmac[32];
 
-    bool result = false;
-
-    if (!crypto_derive_symmetric_key(WALLET_SLIP0021_LABEL, WALLET_SLIP0021_LABEL_LEN, key)) {
-        goto end;
+    const uint8_t *key = get_wallet_hmac_key();
+    if (key == NULL) {
+        return false;
     }
 
-    cx_hmac_sha256(key, sizeof(key), wallet_id, 32, correct_hmac, 32);
+    cx_hmac_sha256(key, 32, wallet_id, 32, correct_hmac, 32);
 
     // It is important to use a constant-time function to compare the hmac,
     // to avoid timing-attack that could be exploited to extract it.
-    result = os_secure_memcmp((void *) wallet_hmac, (void *) correct_hmac, 32) == 0;
+    bool result = os_secure_memcmp((void *) wallet_hmac, (void *) correct_hmac, 32) == 0;
 
-end:
-    explicit_bzero(key, sizeof(key));
     explicit_bzero(correct_hmac, sizeof(correct_hmac));
 
     return result;
@@ -1722,22 +2204,209 @@ int get_key_placeholder_by_index(const policy_node_t *policy,
     return -1;
 }
 
-int count_distinct_keys_info(const policy_node_t *policy) {
-    int ret = -1;
-
-    int n_placeholders = get_key_placeholder_by_index(policy, 0, NULL, NULL);
-    if (n_placeholders < 0) {
-        return -1;
+typedef struct {
+    policy_key_placeholder_ref_t *out;  // if NULL, the placeholders are only counted
+    size_t out_len;
+    size_t count;
+    int max_key_index;  // largest key index of the collected placeholders, or -1 if none
+} key_placeholders_collector_t;
+
+static int add_key_placeholder(key_placeholders_collector_t *collector,
+                               const policy_node_key_placeholder_t *placeholder,
+                               const policy_node_t *tapleaf_ptr) {
+    if (collector->out != NULL) {
+        if (collector->count >= collector->out_len) {
+            return WITH_ERROR(-1, "Too many key placeholders");
+        }
+        collector->out[collector->count].placeholder = placeholder;
+        collector->out[collector->count].tapleaf_ptr = tapleaf_ptr;
     }
+    ++collector->count;
+    collector->max_key_index = MAX(collector->max_key_index, placeholder->key_index);
+    return 0;
+}
 
-    for (int cur = 0; cur < n_placeholders; ++cur) {
-        policy_node_key_placeholder_t placeholder;
-        if (0 > get_key_placeholder_by_index(policy, cur, NULL, &placeholder)) {
+static int collect_key_placeholders(const policy_node_t *policy,
+                                    const policy_node_t *tapleaf_ptr,
+                                    key_placeholders_collector_t *collector);
+
+static int collect_key_placeholders_in_tree(const policy_node_tree_t *tree,
+                                            key_placeholders_collector_t *collector) {
+    if (tree->is_leaf) {
+        const policy_node_t *script = r_policy_node(&tree->script);
+        return collect_key_placeholders(script, script, collector);
+    } else {
+        if (0 > collect_key_placeholders_in_tree(r_policy_node_tree(&tree->left_tree), collector)) {
             return -1;
         }
-        ret = MAX(ret, placeholder.key_index + 1);
+        return collect_key_placeholders_in_tree(r_policy_node_tree(&tree->right_tree), collector);
     }
-    return ret;
+}
+
+// Appends the placeholders of the given policy to the collector, in the same order as they are
+// indexed by get_key_placeholder_by_index. tapleaf_ptr is the tapleaf containing the policy, or
+// NULL.
+static int collect_key_placeholders(const policy_node_t *policy,
+                                    const policy_node_t *tapleaf_ptr,
+                                    key_placeholders_collector_t *collector) {
+    switch (policy->type) {
+        // terminal nodes with absolutely no keys
+        case TOKEN_0:
+        case TOKEN_1:
+        case TOKEN_OLDER:
+        case TOKEN_AFTER:
+        case TOKEN_SHA256:
+        case TOKEN_HASH256:
+        case TOKEN_RIPEMD160:
+        case TOKEN_HASH160:
+            return 0;
+
+        // terminal nodes with exactly 1 key
+        case TOKEN_PK_K:
+        case TOKEN_PK_H:
+        case TOKEN_PK:
+        case TOKEN_PKH:
+        case TOKEN_WPKH: {
+            const policy_node_with_key_t *node = (const policy_node_with_key_t *) policy;
+            return add_key_placeholder(collector,
+                                       r_policy_node_key_placeholder(&node->key_placeholder),
+                                       tapleaf_ptr);
+        }
+        case TOKEN_TR: {
+            const policy_node_tr_t *tr = (const policy_node_tr_t *) policy;
+            if (0 > add_key_placeholder(collector,
+                                        r_policy_node_key_placeholder(&tr->key_placeholder),
+                                        NULL)) {
+                return -1;
+            }
+            if (!isnull_policy_node_tree(&tr->tree)) {
+                return collect_key_placeholders_in_tree(r_policy_node_tree(&tr->tree), collector);
+            }
+            return 0;
+        }
+
+        // terminal nodes with multiple keys
+        case TOKEN_MULTI:
+        case TOKEN_MULTI_A:
+        case TOKEN_SORTEDMULTI:
+        case TOKEN_SORTEDMULTI_A: {
+            const policy_node_multisig_t *node = (const policy_node_multisig_t *) policy;
+            const policy_node_key_placeholder_t *placeholders =
+                r_policy_node_key_placeholder(&node->key_placeholders);
+            for (int i = 0; i < node->n; i++) {
+                if (0 > add_key_placeholder(collector, &placeholders[i], tapleaf_ptr)) {
+                    return -1;
+                }
+            }
+            return 0;
+        }
+
+        // nodes with a single child script (including miniscript wrappers)
+        case TOKEN_SH:
+        case TOKEN_WSH:
+        case TOKEN_A:
+        case TOKEN_S:
+        case TOKEN_C:
+        case TOKEN_T:
+        case TOKEN_D:
+        case TOKEN_V:
+        case TOKEN_J:
+        case TOKEN_N:
+        case TOKEN_L:
+        case TOKEN_U: {
+            return collect_key_placeholders(
+                r_policy_node(&((const policy_node_with_script_t *) policy)->script),
+                tapleaf_ptr,
+                collector);
+        }
+
+        // nodes with exactly two child scripts
+        case TOKEN_AND_V:
+        case TOKEN_AND_B:
+        case TOKEN_AND_N:
+        case TOKEN_OR_B:
+        case TOKEN_OR_C:
+        case TOKEN_OR_D:
+        case TOKEN_OR_I: {
+            const policy_node_with_script2_t *node = (const policy_node_with_script2_t *) policy;
+            for (int i = 0; i < 2; i++) {
+                if (0 > collect_key_placeholders(r_policy_node(&node->scripts[i]),
+                                                 tapleaf_ptr,
+                                                 collector)) {
+                    return -1;
+                }
+            }
+            return 0;
+        }
+
+        // nodes with exactly three child scripts
+        case TOKEN_ANDOR: {
+            const policy_node_with_script3_t *node = (const policy_node_with_script3_t *) policy;
+            for (int i = 0; i < 3; i++) {
+                if (0 > collect_key_placeholders(r_policy_node(&node->scripts[i]),
+                                                 tapleaf_ptr,
+                                                 collector)) {
+                    return -1;
+                }
+            }
+            return 0;
+        }
+
+        // nodes with multiple child scripts
+        case TOKEN_THRESH: {
+            const policy_node_thresh_t *node = (const policy_node_thresh_t *) policy;
+            policy_node_scriptlist_t *cur_child = r_policy_node_scriptlist(&node->scriptlist);
+            for (int script_idx = 0; script_idx < node->n; script_idx++) {
+                LEDGER_ASSERT(cur_child != NULL,
+                              "The script should always have exactly n child scripts");
+
+                if (0 > collect_key_placeholders(r_policy_node(&cur_child->script),
+                                                 tapleaf_ptr,
+                                                 collector)) {
+                    return -1;
+                }
+                cur_child = r_policy_node_scriptlist(&cur_child->next);
+            }
+            return 0;
+        }
+
+        case TOKEN_INVALID:
+        default:
+            PRINTF("Unknown token type: %d\n", policy->type);
+            return -1;
+    }
+
+    // unreachable
+    assert(0);
+    return -1;
+}
+
+int get_key_placeholders(const policy_node_t *policy,
+                         policy_key_placeholder_ref_t out[],
+                         size_t out_len) {
+    key_placeholders_collector_t collector = {.out = out,
+                                              .out_len = out_len,
+                                              .count = 0,
+                                              .max_key_index = -1};
+    if (0 > collect_key_placeholders(policy, NULL, &collector)) {
+        return -1;
+    }
+    return (int) collector.count;
+}
+
+int count_distinct_keys_info(const policy_node_t *policy) {
+    // a single traversal, only keeping track of the largest key index
+    key_placeholders_collector_t collector = {.out = NULL,
+                                              .out_len = 0,
+                                              .count = 0,
+                                              .max_key_index = -1};
+    if (0 > collect_key_placeholders(policy, NULL, &collector)) {
+        return -1;
+    }
+    if (collector.count == 0) {
+        return -1;
+    }
+    return collector.max_key_index + 1;
 }
 
 // Utility function to extract and decode the i-th xpub from the keys information vector
@@ -1747,23 +2416,14 @@ static int get_pubkey_from_merkle_tree(dispatcher_context_t *dispatcher_context,
                                        uint32_t n_keys,
                                        uint32_t index,
                                        serialized_extended_pubkey_t *out) {
-    char key_info_str[MAX_POLICY_KEY_INFO_LEN];
-    int key_info_len = call_get_merkle_leaf_element(dispatcher_context,
-                                                    keys_merkle_root,
-                                                    n_keys,
-                                                    index,
-                                                    (uint8_t *) key_info_str,
-                                                    sizeof(key_info_str));
-    if (key_info_len == -1) {
-        return WITH_ERROR(-1, "Failed to retrieve key info");
-    }
-
-    // Make a sub-buffer for the pubkey info
-    buffer_t key_info_buffer = buffer_create(key_info_str, key_info_len);
-
     policy_map_key_info_t key_info;
-    if (parse_policy_map_key_info(&key_info_buffer, &key_info, wallet_version) == -1) {
-        return WITH_ERROR(-1, "Failed to parse key information");
+    if (0 > get_policy_key_info(dispatcher_context,
+                                wallet_version,
+                                keys_merkle_root,
+                                n_keys,
+                                index,
+                                &key_info)) {
+        return WITH_ERROR(-1, "Failed to retrieve key information");
     }
     *out = key_info.ext_pubkey;
     return 0;
@@ -1852,6 +2512,77 @@ static int is_taptree_miniscript_sane(const policy_node_tree_t *taptree) {
     return 0;
 }
 
+// Checks that the key placeholders for the same key have disjoint derivations.
+// The placeholders are collected with a single traversal of the policy; the array of references
+// is only on the stack for the duration of this function, rather than in the frame of the caller.
+static int __attribute__((noinline)) check_placeholders_derivations(const policy_node_t *policy) {
+    policy_key_placeholder_ref_t placeholders[MAX_N_KEY_PLACEHOLDERS_IN_WALLET_POLICY];
+
+    int n_placeholders =
+        get_key_placeholders(policy, placeholders, MAX_N_KEY_PLACEHOLDERS_IN_WALLET_POLICY);
+    if (n_placeholders < 0) {
+        return WITH_ERROR(-1, "Unexpected error retrieving placeholders from the policy");
+    }
+
+    // quadratic in the number of placeholders, but each comparison is cheap
+    for (int i = 0; i < n_placeholders - 1;
+         i++) {  // no point in running this for the last placeholder
+        const policy_node_key_placeholder_t *kp_i = placeholders[i].placeholder;
+        for (int j = i + 1; j < n_placeholders; j++) {
+            const policy_node_key_placeholder_t *kp_j = placeholders[j].placeholder;
+
+            // placeholders for the same key must have disjoint derivation options
+            if (kp_i->key_index == kp_j->key_index) {
+                if (kp_i->num_first == kp_j->num_first || kp_i->num_first == kp_j->num_second ||
+                    kp_i->num_second == kp_j->num_first || kp_i->num_second == kp_j->num_second) {
+                    return WITH_ERROR(-1,
+                                      "Key placeholders with repeated derivations in miniscript");
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// Checks that all the keys of the wallet policy have different pubkeys. Each key is retrieved only
+// once; the pairs of compressed pubkeys are then compared in memory.
+static int __attribute__((noinline))
+check_distinct_pubkeys(dispatcher_context_t *dispatcher_context,
+                       int wallet_version,
+                       const uint8_t keys_merkle_root[static 32],
+                       uint32_t n_keys) {
+    if (n_keys > MAX_N_KEYS_IN_WALLET_POLICY) {
+        return WITH_ERROR(-1, "Too many keys in the wallet policy");
+    }
+
+    uint8_t pubkeys[MAX_N_KEYS_IN_WALLET_POLICY][33];
+    for (unsigned int i = 0; i < n_keys; i++) {
+        serialized_extended_pubkey_t pubkey;
+        if (0 > get_pubkey_from_merkle_tree(dispatcher_context,
+                                            wallet_version,
+                                            keys_merkle_root,
+                                            n_keys,
+                                            i,
+                                            &pubkey)) {
+            return -1;
+        }
+        memcpy(pubkeys[i], pubkey.compressed_pubkey, sizeof(pubkeys[i]));
+    }
+
+    for (unsigned int i = 0; i + 1 < n_keys; i++) {  // no point in running this for the last key
+        for (unsigned int j = i + 1; j < n_keys; j++) {
+            // We reject if any two xpubs have the same pubkey
+            // Conservatively, we only compare the compressed pubkey, rather than the whole xpub:
+            // there is no good reason for allowing two different xpubs with the same pubkey.
+            if (memcmp(pubkeys[i], pubkeys[j], sizeof(pubkeys[i])) == 0) {
+                // duplicated pubkey
+                return WITH_ERROR(-1, "Repeated pubkey in wallet policy");
+            }
+        }
+    }
+    return 0;
+}
+
 int is_policy_sane(dispatcher_context_t *dispatcher_context,
                    const policy_node_t *policy,
                    int wallet_version,
@@ -1875,74 +2606,13 @@ int is_policy_sane(dispatcher_context_t *dispatcher_context,
     }
 
     // check that all the xpubs are different
-    for (unsigned int i = 0; i < n_keys - 1; i++) {  // no point in running this for the last key
-        serialized_extended_pubkey_t pubkey_i;
-        if (0 > get_pubkey_from_merkle_tree(dispatcher_context,
-                                            wallet_version,
-                                            keys_merkle_root,
-                                            n_keys,
-                                            i,
-                                            &pubkey_i)) {
-            return -1;
-        }
-
-        for (unsigned int j = i + 1; j < n_keys; j++) {
-            serialized_extended_pubkey_t pubkey_j;
-            if (0 > get_pubkey_from_merkle_tree(dispatcher_context,
-                                                wallet_version,
-                                                keys_merkle_root,
-                                                n_keys,
-                                                j,
-                                                &pubkey_j)) {
-                return -1;
-            }
-
-            // We reject if any two xpubs have the same pubkey
-            // Conservatively, we only compare the compressed pubkey, rather than the whole xpub:
-            // there is no good reason for allowing two different xpubs with the same pubkey.
-            if (memcmp(pubkey_i.compressed_pubkey,
-                       pubkey_j.compressed_pubkey,
-                       sizeof(pubkey_i.compressed_pubkey)) == 0) {
-                // duplicated pubkey
-                return WITH_ERROR(-1, "Repeated pubkey in wallet policy");
-            }
-        }
+    if (0 > check_distinct_pubkeys(dispatcher_context, wallet_version, keys_merkle_root, n_keys)) {
+        return -1;
     }
 
     // check that all the key placeholders for the same xpub do indeed have different
     // derivations
-    int n_placeholders = get_key_placeholder_by_index(policy, 0, NULL, NULL);
-    if (n_placeholders < 0) {
-        return WITH_ERROR(-1, "Unexpected error while counting placeholders");
-    }
-
-    // The following loop computationally very inefficient (quadratic in the number of
-    // placeholders), but more efficient solutions likely require a substantial amount of RAM
-    // (proportional to the number of key placeholders). Instead, this only requires stack depth
-    // proportional to the depth of the wallet policy's abstract syntax tree.
-    for (int i = 0; i < n_placeholders - 1;
-         i++) {  // no point in running this for the last placeholder
-        policy_node_key_placeholder_t kp_i;
-        if (0 > get_key_placeholder_by_index(policy, i, NULL, &kp_i)) {
-            return WITH_ERROR(-1, "Unexpected error retrieving placeholders from the policy");
-        }
-        for (int j = i + 1; j < n_placeholders; j++) {
-            policy_node_key_placeholder_t kp_j;
-            if (0 > get_key_placeholder_by_index(policy, j, NULL, &kp_j)) {
-                return WITH_ERROR(-1, "Unexpected error retrieving placeholders from the policy");
-            }
-
-            // placeholders for the same key must have disjoint derivation options
-            if (kp_i.key_index == kp_j.key_index) {
-                if (kp_i.num_first == kp_j.num_first || kp_i.num_first == kp_j.num_second ||
-                    kp_i.num_second == kp_j.num_first || kp_i.num_second == kp_j.num_second) {
-                    return WITH_ERROR(-1,
-                                      "Key placeholders with repeated derivations in miniscript");
-                }
-            }
-        }
-    }
-    return 0;
+    return check_placeholders_derivations(policy);
 }
 
 #pragma GCC diagnostic pop
@@ -19,6 +19,10 @@
  * @param policy_map_bytes Pointer to an array of bytes that will be used for the parsed abstract
  * syntax tree
  * @param policy_map_bytes_len Length of policy_map_bytes in bytes.
+ * @param inline_keys_info If not NULL, the wallet policy must be a V2 one serialized in the inline
+ * form (see WALLET_POLICY_INLINE_FLAG); its keys information are copied there as 0-terminated
+ * strings, and the commitments of the header are computed from the inline data, so that nothing is
+ * requested to the client. If NULL, the inline form is rejected.
  * @return The memory size of the parsed descriotor template on success, a negative number in case
  * of error.
  */
@@ -29,6 +33,29 @@ __attribute__((warn_unused_result)) int read_and_parse_wallet_policy(
     policy_map_wallet_header_t *wallet_header,
     uint8_t policy_map_descriptor[static MAX_DESCRIPTOR_TEMPLATE_LENGTH],
     uint8_t *policy_map_bytes,
+    size_t policy_map_bytes_len,
+    char (*inline_keys_info)[MAX_POLICY_KEY_INFO_LEN + 1]);
+
+/**
+ * Fetches from the client the serialized wallet policy with the given wallet id, and parses it
+ * with read_and_parse_wallet_policy. The parsed wallet policies are cached across commands (see
+ * wallet_policy_cache.h), in which case nothing is requested to the client.
+ *
+ * @param dispatcher_context Pointer to the dispatcher content
+ * @param wallet_id The id of the wallet policy, that is, the sha256 hash of its serialization
+ * @param wallet_header Pointer to policy_map_wallet_header_t that will receive the policy map
+ * header
+ * @param policy_map_bytes Pointer to an array of bytes that will be used for the parsed abstract
+ * syntax tree
+ * @param policy_map_bytes_len Length of policy_map_bytes in bytes.
+ * @return The memory size of the parsed descriptor template on success, a negative number in case
+ * of error.
+ */
+__attribute__((warn_unused_result)) int fetch_and_parse_wallet_policy(
+    dispatcher_context_t *dispatcher_context,
+    const uint8_t wallet_id[static 32],
+    policy_map_wallet_header_t *wallet_header,
+    uint8_t *policy_map_bytes,
     size_t policy_map_bytes_len);
 
 typedef enum {
@@ -54,6 +81,7 @@ typedef struct {
  * Computes the hash of a taptree, to be used as tweak for the internal key per BIP-0341;
  * The returned hash is the second value in the tuple returned by taproot_tree_helper in
  * BIP-0341, assuming leaf_version 0xC0.
+ * The result is cached for the duration of the command.
  *
  * @param[in] dispatcher_context
  *   Pointer to the dispatcher context
@@ -72,6 +100,26 @@ __attribute__((warn_unused_result)) int compute_taptree_hash(
     const policy_node_tree_t *tree,
     uint8_t out[static 32]);
 
+/**
+ * Computes the tapleaf hash of a tapscript of the wallet policy per BIP-0341, assuming leaf_version
+ * 0xC0. The result is cached for the duration of the command.
+ *
+ * @param[in] dispatcher_context
+ *   Pointer to the dispatcher context
+ * @param[in] wdi
+ *   Pointer to a wallet_derivation_info_t structure containing multiple other parameters
+ * @param[in] script_policy
+ *   Pointer to the script of the tapleaf
+ * @param[out] out
+ *   A buffer of 32 bytes to receive the output
+ *
+ * @return 0 on success, a negative number on failure.
+ */
+__attribute__((warn_unused_result)) int get_tapleaf_hash(dispatcher_context_t *dispatcher_context,
+                                                         const wallet_derivation_info_t *wdi,
+                                                         const policy_node_t *script_policy,
+                                                         uint8_t out[static 32]);
+
 /**
  * Computes the script corresponding to a wallet policy, for a certain change and address index.
  *
@@ -116,6 +164,49 @@ __attribute__((warn_unused_result)) int get_wallet_internal_script_hash(
     internal_script_type_e script_type,
     cx_hash_t *hash_context);
 
+/**
+ * Like get_wallet_internal_script_hash, but the bytes of the script are sent to each of the
+ * n_hash_contexts hash contexts, so that several hashes of the same script are computed without
+ * keeping it in memory, nor computing it more than once.
+ *
+ * @return the length of the script on success; a negative number in case of error.
+ */
+__attribute__((warn_unused_result)) int get_wallet_internal_script_hashes(
+    dispatcher_context_t *dispatcher_context,
+    const policy_node_t *policy,
+    const wallet_derivation_info_t *wdi,
+    internal_script_type_e script_type,
+    cx_hash_t *const hash_contexts[],
+    size_t n_hash_contexts);
+
+/**
+ * Computes the witness script of a wsh or sh(wsh) wallet policy, for a certain change and address
+ * index, streaming it into the given hash contexts rather than into a buffer, as it can be up to
+ * MAX_STANDARD_P2WSH_SCRIPT_SIZE bytes long. This is the same interface as
+ * update_hashes_with_map_value, for a witness script that is computed rather than fetched.
+ *
+ * @param[in] dispatcher_context
+ *   Pointer to the dispatcher context
+ * @param[in] policy
+ *   Pointer to the root node of the policy, that must be wsh or sh(wsh)
+ * @param[in] wdi
+ *   Pointer to a wallet_derivation_info_t structure containing multiple other parameters
+ * @param[out] hash_unprefixed
+ *   If not NULL, an already initialized hash context updated with the bytes of the witness script,
+ * for example to compute the witness program
+ * @param[out] hash_prefixed
+ *   If not NULL, an already initialized hash context updated with the length of the witness script
+ * as a varint, followed by its bytes, as in the scriptCode of BIP-143
+ *
+ * @return the length of the witness script on success; a negative number in case of error.
+ */
+__attribute__((warn_unused_result)) int get_wallet_witness_script_hashes(
+    dispatcher_context_t *dispatcher_context,
+    const policy_node_t *policy,
+    const wallet_derivation_info_t *wdi,
+    cx_hash_t *hash_unprefixed,
+    cx_hash_t *hash_prefixed);
+
 /**
  * Returns the address type constant corresponding to a standard policy type.
  *
@@ -151,6 +242,37 @@ __attribute__((warn_unused_result)) bool is_wallet_policy_standard(
     const policy_map_wallet_header_t *wallet_policy_header,
     const policy_node_t *descriptor_template);
 
+/**
+ * Same as is_wallet_policy_standard, but the verdict is remembered in the wallet policy cache,
+ * together with the information of the only key of the policy. For a wallet policy that was
+ * already verified in a previous command, the cached key information is added to the key cache of
+ * the current command, so that deriving its addresses does not fetch it again from the client.
+ * On success, the xpub of the only key is known to be the one derived from the seed at its key
+ * origin, so the callers do not need to derive it again.
+ *
+ * @param[in] dispatcher_context
+ *   Pointer to the dispatcher context
+ * @param[in] wallet_id
+ *   The id of the wallet policy; it must be in the wallet policy cache for the verdict to be kept
+ * @param[in] wallet_policy_header
+ *   Pointer the wallet policy header
+ * @param[in] descriptor_template
+ *   Pointer to the root node of the policy
+ *
+ * @return true if the descriptor_template is standard; false if not, or in case of error.
+ */
+__attribute__((warn_unused_result)) bool is_wallet_policy_standard_cached(
+    dispatcher_context_t *dispatcher_context,
+    const uint8_t wallet_id[static 32],
+    const policy_map_wallet_header_t *wallet_policy_header,
+    const policy_node_t *descriptor_template);
+
+/**
+ * Wipes the symmetric key used for the wallet policy hmacs, that is otherwise derived only once and
+ * kept in memory. Called when the session ends (see session.h).
+ */
+void wallet_hmac_key_reset(void);
+
 /**
  * Computes and returns the wallet_hmac, using the symmetric key derived
  * with the WALLET_SLIP0021_LABEL label according to SLIP-0021.
@@ -175,6 +297,17 @@ bool compute_wallet_hmac(const uint8_t wallet_id[static 32], uint8_t wallet_hmac
  */
 bool check_wallet_hmac(const uint8_t wallet_id[static 32], const uint8_t wallet_hmac[static 32]);
 
+/**
+ * Returns true if the wallet policy with the given wallet_id is stored in the on-device registry of
+ * registered wallet policies for the current master key, in which case it does not need an hmac.
+ * Always returns false if the app is built without HAVE_WALLET_REGISTRY.
+ *
+ * @param[in] wallet_id
+ *   Pointer to the a 32-bytes array containing the 32-byte wallet policy id.
+ * @return true if the wallet policy is in the registry, false otherwise.
+ */
+bool is_wallet_policy_registered(const uint8_t wallet_id[static 32]);
+
 /**
  * Copies the i-th placeholder (indexing from 0) of the given policy into `out_placeholder` (if not
  * null).
@@ -196,6 +329,39 @@ __attribute__((warn_unused_result)) int get_key_placeholder_by_index(
     const policy_node_t **out_tapleaf_ptr,
     policy_node_key_placeholder_t *out_placeholder);
 
+/**
+ * Upper bound on the number of key placeholders in a parsed wallet policy, as each placeholder
+ * takes at least sizeof(policy_node_key_placeholder_t) bytes of the parsed policy.
+ */
+#define MAX_N_KEY_PLACEHOLDERS_IN_WALLET_POLICY \
+    (MAX_WALLET_POLICY_BYTES / sizeof(policy_node_key_placeholder_t))
+
+/**
+ * Reference to a key placeholder of a parsed wallet policy.
+ */
+typedef struct {
+    const policy_node_key_placeholder_t *placeholder;  // pointer to the placeholder in the policy
+    const policy_node_t *tapleaf_ptr;  // the tapleaf's script containing it, or NULL if none
+} policy_key_placeholder_ref_t;
+
+/**
+ * Lists all the placeholders of the given policy with a single traversal, in the same order as they
+ * are indexed by get_key_placeholder_by_index. The returned pointers point inside the policy, and
+ * are only valid as long as the policy is.
+ *
+ * @param[in] policy
+ *   Pointer to the root node of the policy
+ * @param[out] out
+ *   Pointer to an array that will receive the references to the placeholders of the policy
+ * @param[in] out_len
+ *   The length of the out array
+ * @return the number of placeholders in the policy on success; -1 in case of error, or if out_len
+ * is too small.
+ */
+__attribute__((warn_unused_result)) int get_key_placeholders(const policy_node_t *policy,
+                                                             policy_key_placeholder_ref_t out[],
+                                                             size_t out_len);
+
 /**
  * Determines the expected number of unique keys in the provided policy's key information.
  * The function calculates this by finding the maximum key index from placeholders and increments it
@@ -208,6 +374,56 @@ __attribute__((warn_unused_result)) int get_key_placeholder_by_index(
  */
 __attribute__((warn_unused_result)) int count_distinct_keys_info(const policy_node_t *policy);
 
+/**
+ * Fetches the information of all the keys of a wallet policy with a single
+ * CCMD_GET_MERKLE_LEAF_RANGE request, and adds it to the key cache of the command. Later calls to
+ * get_policy_key_info, including the ones for key derivations, then do not make a round trip for
+ * each key. Nothing is fetched if the wallet policy has a single key, more keys than the cache can
+ * hold, or if all of them are cached already.
+ *
+ * @param[in] dispatcher_context
+ *   Pointer to the dispatcher context
+ * @param[in] wallet_version
+ *   The version of the wallet policy (since it affects the format of keys in the vector of keys)
+ * @param[in] keys_merkle_root
+ *   The root of the Merkle tree of the vector of keys information in the wallet policy
+ * @param[in] n_keys
+ *   The number of keys in the vector of keys
+ * @return 0 on success; -1 in case of error.
+ */
+__attribute__((warn_unused_result)) int prefetch_policy_keys_info(
+    dispatcher_context_t *dispatcher_context,
+    int wallet_version,
+    const uint8_t keys_merkle_root[static 32],
+    uint32_t n_keys);
+
+/**
+ * Retrieves and parses the information of the key with the given index in the vector of keys of a
+ * wallet policy. The parsed key information is cached for the duration of the command, so that
+ * later calls for the same key do not need to fetch it again from the client.
+ *
+ * @param[in] dispatcher_context
+ *   Pointer to the dispatcher context
+ * @param[in] wallet_version
+ *   The version of the wallet policy (since it affects the format of keys in the vector of keys)
+ * @param[in] keys_merkle_root
+ *   The root of the Merkle tree of the vector of keys information in the wallet policy
+ * @param[in] n_keys
+ *   The number of keys in the vector of keys
+ * @param[in] key_index
+ *   The index of the key in the vector of keys
+ * @param[out] out
+ *   Pointer to the structure that will contain the parsed key information
+ * @return 0 on success; -1 in case of error.
+ */
+__attribute__((warn_unused_result)) int get_policy_key_info(
+    dispatcher_context_t *dispatcher_context,
+    int wallet_version,
+    const uint8_t keys_merkle_root[static 32],
+    uint32_t n_keys,
+    uint32_t key_index,
+    policy_map_key_info_t *out);
+
 /**
  * Checks if a wallet policy is sane, verifying that pubkeys are never repeated and (if miniscript)
  * that the miniscript is "sane".
@@ -6,6 +6,7 @@
 #include "psbt_parse_rawtx.h"
 
 #include "get_merkleized_map_value_hash.h"
+#include "rawtx_cache.h"
 #include "stream_preimage.h"
 
 #include "../../boilerplate/dispatcher.h"
@@ -62,9 +63,10 @@ typedef struct parse_rawtx_state_s {
         };
     };
 
-    int output_index;  // index of queried output, or -1
+    const unsigned int *output_indices;  // indices of the queried outputs
+    int n_output_indices;
 
-    txid_parser_outputs_t *parser_outputs;
+    txid_parser_outputs_t *parser_outputs;  // one for each queried output
 
 } parse_rawtx_state_t;
 
@@ -77,27 +79,57 @@ typedef struct psbt_parse_rawtx_state_s {
     bool parser_error;  // set to true if there was an error during parsing
 } psbt_parse_rawtx_state_t;
 
+// Reads the next `n` bytes (at most 32) and adds them to the hash of the transaction. Returns a
+// pointer to the bytes, that points inside the buffers unless the bytes are split across them, in
+// which case they are copied to `tmp`; returns NULL if fewer than `n` bytes are available.
+static const uint8_t *read_and_hash(parse_rawtx_state_t *state,
+                                    buffer_t *buffers[2],
+                                    size_t n,
+                                    uint8_t tmp[static 32]) {
+    const uint8_t *ptr = dbuffer_reserve_read(buffers, n);
+    if (ptr == NULL) {
+        if (!dbuffer_read_bytes(buffers, tmp, n)) {
+            return NULL;
+        }
+        ptr = tmp;
+    }
+    crypto_hash_update(&state->hash_context->header, ptr, n);
+    return ptr;
+}
+
+// Consumes the bytes of a field of `size` bytes that are not only parsed as a whole, like scripts
+// and witness elements; `*counter` is the number of bytes of the field that were already consumed,
+// and is updated. All the available bytes of the field are consumed at once, in one block per
+// buffer, and added to the hash of the transaction if `hash` is true. Returns 1 once all the bytes
+// of the field are consumed, or 0 if more data is needed.
+static int skip_bytes(parse_rawtx_state_t *state,
+                      buffer_t *buffers[2],
+                      unsigned int size,
+                      unsigned int *counter,
+                      bool hash) {
+    for (int i = 0; i < 2 && *counter < size; i++) {
+        size_t n = MIN(size - *counter, buffers[i]->size - buffers[i]->offset);
+        if (hash) {
+            crypto_hash_update(&state->hash_context->header, buffer_get_cur(buffers[i]), n);
+        }
+        buffer_seek_cur(buffers[i], n);
+        *counter += n;
+    }
+    return *counter == size;
+}
+
 /*   PARSER FOR A RAWTX INPUT */
 
 // parses the 32-bytes txid of an input in a rawtx
 static int parse_rawtxinput_txid(parse_rawtxinput_state_t *state, buffer_t *buffers[2]) {
-    uint8_t txid[32];
-    bool result = dbuffer_read_bytes(buffers, txid, 32);
-    if (result) {
-        crypto_hash_update(&state->parent_state->hash_context->header, txid, 32);
-    }
-    return result;
+    uint8_t tmp[32];
+    return read_and_hash(state->parent_state, buffers, 32, tmp) != NULL;
 }
 
 // parses the 4-bytes vout of an input in a rawtx
-// TODO: shares logic with the previous method; try to factor out the shared code
 static int parse_rawtxinput_vout(parse_rawtxinput_state_t *state, buffer_t *buffers[2]) {
-    uint8_t vout_bytes[4];
-    bool result = dbuffer_read_bytes(buffers, vout_bytes, 4);
-    if (result) {
-        crypto_hash_update(&state->parent_state->hash_context->header, vout_bytes, 4);
-    }
-    return result;
+    uint8_t tmp[32];
+    return read_and_hash(state->parent_state, buffers, 4, tmp) != NULL;
 }
 
 static int parse_rawtxinput_scriptsig_size(parse_rawtxinput_state_t *state, buffer_t *buffers[2]) {
@@ -121,39 +153,18 @@ static int parse_rawtxinput_scriptsig_init(parse_rawtxinput_state_t *state, buff
     return 1;
 }
 
+// The scriptSig is only hashed
 static int parse_rawtxinput_scriptsig(parse_rawtxinput_state_t *state, buffer_t *buffers[2]) {
-    uint8_t data[32];
-
-    while (true) {
-        int remaining_len = state->scriptsig_size - state->scriptsig_counter;
-
-        // We read in chunks of at most 32 bytes, so that we can always interrupt with less than 32
-        // unparsed bytes
-        int data_len = MIN(32, remaining_len);
-
-        bool read_result = dbuffer_read_bytes(buffers, data, data_len);
-        if (!read_result) {
-            return 0;  // could not read enough data
-        }
-
-        crypto_hash_update(&state->parent_state->hash_context->header, data, data_len);
-
-        state->scriptsig_counter += data_len;
-
-        if (state->scriptsig_counter == state->scriptsig_size) {
-            return 1;  // done
-        }
-    }
+    return skip_bytes(state->parent_state,
+                      buffers,
+                      state->scriptsig_size,
+                      &state->scriptsig_counter,
+                      true);
 }
 
 static int parse_rawtxinput_sequence(parse_rawtxinput_state_t *state, buffer_t *buffers[2]) {
-    uint8_t sequence_bytes[4];
-
-    bool result = dbuffer_read_bytes(buffers, sequence_bytes, 4);
-    if (result) {
-        crypto_hash_update(&state->parent_state->hash_context->header, sequence_bytes, 4);
-    }
-    return result;
+    uint8_t tmp[32];
+    return read_and_hash(state->parent_state, buffers, 4, tmp) != NULL;
 }
 
 static const parsing_step_t parse_rawtxinput_steps[] = {
@@ -170,22 +181,30 @@ const int n_parse_rawtxinput_steps =
 
 /*   PARSER FOR A RAWTX OUTPUT */
 
-static int parse_rawtxoutput_value(parse_rawtxoutput_state_t *state, buffer_t *buffers[2]) {
-    uint8_t value_bytes[8];
-    bool result = dbuffer_read_bytes(buffers, value_bytes, 8);
-    if (result) {
-        uint64_t value = read_u64_le(value_bytes, 0);
+// Returns the position of the next queried output after position `start` that is the output
+// currently being parsed, or -1 if there is none.
+static int find_queried_output(const parse_rawtx_state_t *state, int start) {
+    for (int i = start; i < state->n_output_indices; i++) {
+        if (state->output_indices[i] == state->out_counter) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-        crypto_hash_update(&state->parent_state->hash_context->header, value_bytes, 8);
+static int parse_rawtxoutput_value(parse_rawtxoutput_state_t *state, buffer_t *buffers[2]) {
+    uint8_t tmp[32];
+    const uint8_t *value_bytes = read_and_hash(state->parent_state, buffers, 8, tmp);
+    if (value_bytes == NULL) {
+        return 0;
+    }
 
-        if (state->parent_state->output_index != -1) {
-            unsigned int relevant_output_index = (unsigned int) state->parent_state->output_index;
-            if (state->parent_state->out_counter == relevant_output_index) {
-                state->parent_state->parser_outputs->vout_value = value;
-            }
-        }
+    uint64_t value = read_u64_le(value_bytes, 0);
+    for (int i = find_queried_output(state->parent_state, 0); i != -1;
+         i = find_queried_output(state->parent_state, i + 1)) {
+        state->parent_state->parser_outputs[i].vout_value = value;
     }
-    return result;
+    return 1;
 }
 
 static int parse_rawtxoutput_scriptpubkey_size(parse_rawtxoutput_state_t *state,
@@ -197,12 +216,10 @@ static int parse_rawtxoutput_scriptpubkey_size(parse_rawtxoutput_state_t *state,
 
         crypto_hash_update_varint(&state->parent_state->hash_context->header, scriptpubkey_size);
 
-        if (state->parent_state->output_index != -1) {
-            unsigned int relevant_output_index = (unsigned int) state->parent_state->output_index;
-            if (state->parent_state->out_counter == relevant_output_index) {
-                state->parent_state->parser_outputs->vout_scriptpubkey_len =
-                    (unsigned int) scriptpubkey_size;
-            }
+        for (int i = find_queried_output(state->parent_state, 0); i != -1;
+             i = find_queried_output(state->parent_state, i + 1)) {
+            state->parent_state->parser_outputs[i].vout_scriptpubkey_len =
+                (unsigned int) scriptpubkey_size;
         }
     }
     return result;
@@ -218,7 +235,7 @@ static int parse_rawtxoutput_scriptpubkey_init(parse_rawtxoutput_state_t *state,
 }
 
 static int parse_rawtxoutput_scriptpubkey(parse_rawtxoutput_state_t *state, buffer_t *buffers[2]) {
-    uint8_t data[32];
+    uint8_t tmp[32];
 
     while (true) {
         int remaining_len = state->scriptpubkey_size - state->scriptpubkey_counter;
@@ -227,28 +244,20 @@ static int parse_rawtxoutput_scriptpubkey(parse_rawtxoutput_state_t *state, buff
         // unparsed bytes
         int data_len = MIN(32, remaining_len);
 
-        bool read_result = dbuffer_read_bytes(buffers, data, data_len);
-        if (!read_result) {
+        const uint8_t *data = read_and_hash(state->parent_state, buffers, data_len, tmp);
+        if (data == NULL) {
             return 0;  // could not read enough data
         }
 
-        crypto_hash_update(&state->parent_state->hash_context->header, data, data_len);
-
-        if (state->parent_state->output_index != -1) {
-            unsigned int relevant_output_index = (unsigned int) state->parent_state->output_index;
-            if (state->parent_state->out_counter == relevant_output_index) {
-                unsigned int scriptpubkey_len =
-                    state->parent_state->parser_outputs->vout_scriptpubkey_len;
-                if (scriptpubkey_len > MAX_PREVOUT_SCRIPTPUBKEY_LEN) {
-                    return -1;  // not expecting any scriptPubkey larger than
-                                // MAX_PREVOUT_SCRIPTPUBKEY_LEN
-                }
-
-                memcpy(state->parent_state->parser_outputs->vout_scriptpubkey +
-                           state->scriptpubkey_counter,
-                       data,
-                       data_len);
+        for (int i = find_queried_output(state->parent_state, 0); i != -1;
+             i = find_queried_output(state->parent_state, i + 1)) {
+            txid_parser_outputs_t *output = &state->parent_state->parser_outputs[i];
+            if (output->vout_scriptpubkey_len > MAX_PREVOUT_SCRIPTPUBKEY_LEN) {
+                return -1;  // not expecting any scriptPubkey larger than
+                            // MAX_PREVOUT_SCRIPTPUBKEY_LEN
             }
+
+            memcpy(output->vout_scriptpubkey + state->scriptpubkey_counter, data, data_len);
         }
 
         state->scriptpubkey_counter += data_len;
@@ -272,13 +281,8 @@ const int n_parse_rawtxoutput_steps =
 /*   PARSER FOR A FULL RAWTX */
 
 static int parse_rawtx_version(parse_rawtx_state_t *state, buffer_t *buffers[2]) {
-    uint8_t version_bytes[4];
-
-    bool result = dbuffer_read_bytes(buffers, version_bytes, 4);
-    if (result) {
-        crypto_hash_update(&state->hash_context->header, version_bytes, 4);
-    }
-    return result;
+    uint8_t tmp[32];
+    return read_and_hash(state, buffers, 4, tmp) != NULL;
 }
 
 // Checks if this transaction is serialized according to bip144 (segwit), that is, it has a 0x00
@@ -447,18 +451,13 @@ static int parse_rawtx_witnesses(parse_rawtx_state_t *state, buffer_t *buffers[2
                 state->cur_wit_el_bytes_read = 0;
             }
 
-            while (state->cur_wit_el_bytes_read < state->cur_wit_elem_len) {
-                uint8_t data[32];
-                int remaining_len = state->cur_wit_elem_len - state->cur_wit_el_bytes_read;
-
-                // We read in chunks of at most 32 bytes, so that we can always interrupt with less
-                // than 32 unparsed bytes
-                int data_len = MIN(32, remaining_len);
-                if (!dbuffer_read_bytes(buffers, data, data_len)) {
-                    return 0;
-                }
-
-                state->cur_wit_el_bytes_read += data_len;
+            // the witnesses are not part of the txid, so their bytes are skipped without hashing
+            if (!skip_bytes(state,
+                            buffers,
+                            state->cur_wit_elem_len,
+                            &state->cur_wit_el_bytes_read,
+                            false)) {
+                return 0;  // incomplete, read more data
             }
 
             ++state->wit_stack_el_counter;
@@ -473,12 +472,8 @@ static int parse_rawtx_witnesses(parse_rawtx_state_t *state, buffer_t *buffers[2
 }
 
 static int parse_rawtx_locktime(parse_rawtx_state_t *state, buffer_t *buffers[2]) {
-    uint8_t locktime_bytes[4];
-    bool result = dbuffer_read_bytes(buffers, locktime_bytes, 4);
-    if (result) {
-        crypto_hash_update(&state->hash_context->header, locktime_bytes, 4);
-    }
-    return result;
+    uint8_t tmp[32];
+    return read_and_hash(state, buffers, 4, tmp) != NULL;
 }
 
 static const parsing_step_t parse_rawtx_steps[] = {(parsing_step_t) parse_rawtx_version,
@@ -521,10 +516,15 @@ int call_psbt_parse_rawtx(dispatcher_context_t *dispatcher_context,
                           const merkleized_map_commitment_t *map,
                           const uint8_t *key,
                           int key_len,
-                          int output_index,
+                          const unsigned int *output_indices,
+                          int n_output_indices,
                           txid_parser_outputs_t *outputs) {
     LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
+    if (n_output_indices < 1 || n_output_indices > PSBT_PARSE_RAWTX_MAX_OUTPUTS) {
+        return -1;
+    }
+
     cx_sha256_t hash_context;
     cx_sha256_init(&hash_context);
 
@@ -536,7 +536,8 @@ int call_psbt_parse_rawtx(dispatcher_context_t *dispatcher_context,
     flow_state.parser_error = false;
     parser_init_context(&flow_state.parser_context, &flow_state.parser_state);
 
-    flow_state.parser_state.output_index = output_index;
+    flow_state.parser_state.output_indices = output_indices;
+    flow_state.parser_state.n_output_indices = n_output_indices;
 
     uint8_t value_hash[32];
     int res = call_get_merkleized_map_value_hash(dispatcher_context, map, key, key_len, value_hash);
@@ -544,6 +545,16 @@ int call_psbt_parse_rawtx(dispatcher_context_t *dispatcher_context,
         return -1;
     }
 
+    // the same transaction was already parsed during this command, for all the queried outputs
+    int n_cached = 0;
+    while (n_cached < n_output_indices &&
+           rawtx_cache_get(value_hash, output_indices[n_cached], &outputs[n_cached])) {
+        ++n_cached;
+    }
+    if (n_cached == n_output_indices) {
+        return 0;
+    }
+
     // init the state of the parser (global)
     flow_state.parser_state.hash_context = &hash_context;
 
@@ -554,7 +565,19 @@ int call_psbt_parse_rawtx(dispatcher_context_t *dispatcher_context,
         return -1;
     }
 
-    crypto_hash_digest(&hash_context.header, outputs->txid, 32);
-    cx_hash_sha256(outputs->txid, 32, outputs->txid, 32);
+    for (int i = 0; i < n_output_indices; i++) {
+        if (output_indices[i] >= flow_state.parser_state.n_outputs) {
+            PRINTF("Queried output not found in the transaction\n");
+            return -1;
+        }
+    }
+
+    crypto_hash_digest(&hash_context.header, outputs[0].txid, 32);
+    cx_hash_sha256(outputs[0].txid, 32, outputs[0].txid, 32);
+
+    for (int i = 0; i < n_output_indices; i++) {
+        memcpy(outputs[i].txid, outputs[0].txid, 32);
+        rawtx_cache_add(value_hash, output_indices[i], &outputs[i]);
+    }
     return 0;
 }
@@ -11,14 +11,26 @@ typedef struct {
     uint8_t txid[32];                                         // will contain the computed txid
 } txid_parser_outputs_t;
 
+/**
+ * Maximum number of outputs whose amount and scriptPubKey can be extracted in a single pass.
+ */
+#define PSBT_PARSE_RAWTX_MAX_OUTPUTS 3
+
 /**
  * Given a commitment to a merkleized map and a key, this flow parses it as a serialized bitcoin
- * transaction, computes the transaction id and optionally keeps track of the vout amunt and
- * scriptPubkey of one of the outputs.
+ * transaction, computes the transaction id and keeps track of the vout amount and scriptPubkey of
+ * each of the outputs with the given indices, in a single pass over the transaction.
+ *
+ * For each index in output_indices, the corresponding element of the outputs array is filled,
+ * including the txid. It must be 1 <= n_output_indices <= PSBT_PARSE_RAWTX_MAX_OUTPUTS.
+ *
+ * Returns a negative number on error, including if any of the requested outputs does not exist.
+ * Returns 0 on success.
  */
 int call_psbt_parse_rawtx(dispatcher_context_t *dispatcher_context,
                           const merkleized_map_commitment_t *map,
                           const uint8_t *key,
                           int key_len,
-                          int output_index,
+                          const unsigned int *output_indices,
+                          int n_output_indices,
                           txid_parser_outputs_t *outputs);
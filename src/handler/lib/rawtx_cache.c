@@ -0,0 +1,69 @@
+#include <string.h>
+
+#include "cache_slots.h"
+#include "rawtx_cache.h"
+
+typedef struct {
+    uint8_t value_hash[32];
+    unsigned int output_index;
+    txid_parser_outputs_t outputs;
+    bool is_used;
+} rawtx_cache_entry_t;
+
+static struct {
+    rawtx_cache_entry_t entries[RAWTX_CACHE_SIZE];
+    cache_slots_t slots;
+} G_rawtx_cache;
+
+static void report_bytes_in_use(void) {
+    PERF_SET_CACHE_BYTES(PERF_CACHE_RAWTX,
+                         G_rawtx_cache.slots.n_used * sizeof(rawtx_cache_entry_t),
+                         sizeof(G_rawtx_cache));
+}
+
+void rawtx_cache_reset(void) {
+    explicit_bzero(&G_rawtx_cache, sizeof(G_rawtx_cache));
+    report_bytes_in_use();
+}
+
+static const rawtx_cache_entry_t *find_entry(const uint8_t value_hash[static 32],
+                                             unsigned int output_index) {
+    for (int i = 0; i < RAWTX_CACHE_SIZE; i++) {
+        const rawtx_cache_entry_t *entry = &G_rawtx_cache.entries[i];
+        if (entry->is_used && entry->output_index == output_index &&
+            memcmp(entry->value_hash, value_hash, 32) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool rawtx_cache_get(const uint8_t value_hash[static 32],
+                     unsigned int output_index,
+                     txid_parser_outputs_t *out) {
+    const rawtx_cache_entry_t *entry = find_entry(value_hash, output_index);
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_RAWTX, entry != NULL);
+    if (entry == NULL) {
+        return false;
+    }
+    memcpy(out, &entry->outputs, sizeof(txid_parser_outputs_t));
+    return true;
+}
+
+void rawtx_cache_add(const uint8_t value_hash[static 32],
+                     unsigned int output_index,
+                     const txid_parser_outputs_t *outputs) {
+    if (find_entry(value_hash, output_index) != NULL) {
+        return;
+    }
+
+    rawtx_cache_entry_t *entry = &G_rawtx_cache.entries[cache_slots_take(&G_rawtx_cache.slots,
+                                                                         RAWTX_CACHE_SIZE,
+                                                                         PERF_CACHE_RAWTX)];
+    memcpy(entry->value_hash, value_hash, 32);
+    entry->output_index = output_index;
+    memcpy(&entry->outputs, outputs, sizeof(txid_parser_outputs_t));
+    entry->is_used = true;
+
+    report_bytes_in_use();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "psbt_parse_rawtx.h"
+
+#include "../../cache_sizes.h"
+
+/**
+ * Number of parsed outputs of previous transactions that can be cached. Each entry takes about 128
+ * bytes of RAM.
+ */
+#ifndef RAWTX_CACHE_SIZE
+#define RAWTX_CACHE_SIZE CACHE_SIZE_FOR_TARGET(8, 16)
+#endif
+
+/**
+ * Cache of the results of parsing the non-witness-utxo of the inputs during the current command.
+ * A transaction is identified by the hash of its serialization as a Merkle tree leaf, which is the
+ * value hash the client commits to in the PSBT map; an entry holds the txid computed from it,
+ * together with the amount and scriptPubKey of one of its outputs.
+ *
+ * This allows inputs spending the same previous transaction, or the same input when it is signed
+ * after being processed, to skip streaming and hashing the whole transaction again.
+ * Once the cache is full, the oldest entry is replaced.
+ */
+
+/**
+ * Empties the cache. Must be called at the beginning of each command.
+ */
+void rawtx_cache_reset(void);
+
+/**
+ * Looks up the parsed transaction with the given value hash, for the output with the given index.
+ *
+ * Returns true and fills `out` if found, false otherwise.
+ */
+bool rawtx_cache_get(const uint8_t value_hash[static 32],
+                     unsigned int output_index,
+                     txid_parser_outputs_t *out);
+
+/**
+ * Adds the result of parsing the transaction with the given value hash, for the output with the
+ * given index.
+ */
+void rawtx_cache_add(const uint8_t value_hash[static 32],
+                     unsigned int output_index,
+                     const txid_parser_outputs_t *outputs);
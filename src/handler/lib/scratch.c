@@ -0,0 +1,27 @@
+#include <string.h>
+
+#include "os.h"
+
+#include "scratch.h"
+
+static struct {
+    __attribute__((aligned(4))) uint8_t bytes[SCRATCH_ARENA_SIZE];
+    size_t used;
+} G_scratch;
+
+void scratch_reset(void) {
+    explicit_bzero(G_scratch.bytes, G_scratch.used);
+    G_scratch.used = 0;
+}
+
+void *scratch_alloc(size_t size) {
+    size_t aligned_size = (size + 3) & ~(size_t) 3;
+    if (aligned_size < size || aligned_size > SCRATCH_ARENA_SIZE - G_scratch.used) {
+        return NULL;
+    }
+
+    // the bytes after `used` are always zero, as they are wiped on reset
+    void *ptr = G_scratch.bytes + G_scratch.used;
+    G_scratch.used += aligned_size;
+    return ptr;
+}
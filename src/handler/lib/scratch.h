@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Size of the scratch arena, that fits the largest working memory of a handler: the state of
+ * SIGN_PSBT, with the records of the internal inputs kept for the signing phase.
+ */
+#define SCRATCH_ARENA_SIZE 4096
+
+/**
+ * Statically reserved memory for the large transient buffers of the command handlers, allocated
+ * by bump allocation and released all at once when the command ends (see session.h). Keeping them
+ * out of the stack makes the peak stack usage of the handlers predictable.
+ *
+ * Only the top-level handlers allocate from it, so that its use can be checked statically against
+ * SCRATCH_ARENA_SIZE.
+ */
+
+/**
+ * Releases and wipes all the allocations.
+ */
+void scratch_reset(void);
+
+/**
+ * Allocates size bytes, aligned to 4 bytes, and zeroed.
+ *
+ * Returns NULL if there is not enough space left.
+ */
+void *scratch_alloc(size_t size);
@@ -0,0 +1,60 @@
+#include "session.h"
+
+#include "hash_pool.h"
+#include "map_contents_cache.h"
+#include "merkle_leaf_table.h"
+#include "merkle_node_cache.h"
+#include "merkleized_map_cache.h"
+#include "policy.h"
+#include "rawtx_cache.h"
+#include "scratch.h"
+#include "taproot_key_cache.h"
+#include "validated_psbt_cache.h"
+#include "wallet_key_cache.h"
+#include "wallet_policy_cache.h"
+
+#include "../../boilerplate/sw.h"
+#include "../../crypto.h"
+
+static void command_caches_reset(void) {
+    merkle_node_cache_reset();
+    merkle_leaf_table_reset();
+    merkleized_map_cache_reset();
+    map_contents_cache_reset();
+    wallet_key_cache_reset();
+    rawtx_cache_reset();
+    taproot_key_cache_reset();
+}
+
+void session_begin_command(void) {
+    // Command caches are only valid for the duration of a single command
+    command_caches_reset();
+    scratch_reset();
+    hash_pool_reset();
+}
+
+void session_end_command(uint16_t sw) {
+    // the cached signing keys and the working memory must not outlive the command
+    taproot_key_cache_reset();
+    scratch_reset();
+    hash_pool_reset();
+
+    if (sw == SW_DENY) {
+        session_reset();
+    }
+}
+
+void session_warm_up(void) {
+    uint32_t master_key_fingerprint;
+    (void) crypto_try_get_master_key_fingerprint(&master_key_fingerprint);
+}
+
+void session_reset(void) {
+    command_caches_reset();
+    scratch_reset();
+    hash_pool_reset();
+    wallet_policy_cache_reset();
+    validated_psbt_cache_reset();
+    wallet_hmac_key_reset();
+    crypto_session_cache_reset();
+}
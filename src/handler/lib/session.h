@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * The state that the app keeps across the commands of a session, and the lifetime of all the
+ * caches.
+ *
+ * A session is implicit: it starts with the first command after the app is opened, and it ends
+ * when the app exits, when the IO is reset (which also happens if the client stops responding
+ * during a command), or when the user rejects a command. When a session ends, all the caches are
+ * wiped, so that consecutive commands only share the state of operations that the user accepted
+ * on the same connection.
+ *
+ * The caches have two lifetimes:
+ * - the command caches (merkle_node_cache, merkle_leaf_table, merkleized_map_cache,
+ *   map_contents_cache, wallet_key_cache, rawtx_cache, taproot_key_cache) only hold data about the
+ *   inputs of the current command, and are wiped at the beginning of each command; the
+ *   taproot_key_cache, that holds secret keys, is also wiped at its end;
+ * - the session caches (wallet_policy_cache, validated_psbt_cache, the wallet hmac key and the
+ *   crypto caches) hold data that only depends on the seed, on a verified wallet policy or on a
+ *   validated transaction, and are kept for all the commands of the session.
+ *
+ * All the caches are statically allocated by their own modules, with the sizes in their headers;
+ * their total is the RAM budget of the session. The working memory of the handlers (see scratch.h)
+ * and the contexts of the hash pool (see hash_pool.h) are released at the beginning and at the end
+ * of each command.
+ */
+
+/**
+ * Must be called before dispatching each command.
+ */
+void session_begin_command(void);
+
+/**
+ * Must be called after each command, with the status word of its final response. The session
+ * ends if the user rejected the command.
+ */
+void session_end_command(uint16_t sw);
+
+/**
+ * Ends the session, wiping all the caches.
+ */
+void session_reset(void);
+
+/**
+ * Fills the session caches that most commands need, and that only depend on the seed: currently,
+ * the fingerprint of the master key. Run while the app is idle, waiting for a command (see
+ * io_set_idle_task), so that the first command of a session does not pay for it. Secrets, like the
+ * wallet hmac key, are still only derived when a command needs them.
+ */
+void session_warm_up(void);
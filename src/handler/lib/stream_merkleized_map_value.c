@@ -1,5 +1,7 @@
 #include "stream_merkleized_map_value.h"
 #include "get_merkle_leaf_index.h"
+#include "get_merkleized_map.h"
+#include "map_contents_cache.h"
 #include "stream_merkle_leaf_element.h"
 
 int call_stream_merkleized_map_value(dispatcher_context_t *dispatcher_context,
@@ -14,14 +16,24 @@ int call_stream_merkleized_map_value(dispatcher_context_t *dispatcher_context,
     uint8_t key_merkle_hash[32];
     merkle_compute_element_hash(key, key_len, key_merkle_hash);
 
-    int index =
-        call_get_merkle_leaf_index(dispatcher_context, map->size, map->keys_root, key_merkle_hash);
+    int index = call_get_merkleized_map_key_index(dispatcher_context, map, key_merkle_hash);
 
     if (index < 0) {
         PRINTF("Key not found, or incorrect data.\n");
         return -1;
     }
 
+    const uint8_t *value;
+    int value_len = map_contents_cache_get_value(map, (uint32_t) index, &value);
+    if (value_len >= 0) {
+        if (len_callback != NULL) {
+            len_callback(value_len, callback_state);
+        }
+        buffer_t data = buffer_create((void *) value, value_len);
+        callback(&data, callback_state);
+        return value_len;
+    }
+
     return call_stream_merkle_leaf_element(dispatcher_context,
                                            map->values_root,
                                            map->size,
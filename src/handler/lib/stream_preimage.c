@@ -13,11 +13,13 @@ int call_stream_preimage(dispatcher_context_t *dispatcher_context,
                          void *callback_state) {
     LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
-    uint8_t cmd = CCMD_GET_PREIMAGE;
-    dispatcher_context->add_to_response(&cmd, 1);
-    uint8_t zero = 0;
-    dispatcher_context->add_to_response(&zero, 1);
-    dispatcher_context->add_to_response(hash, 32);
+    // the request is serialized directly in the response buffer
+    buffer_t request = dispatcher_context->get_response_writer();
+    if (!buffer_write_u8(&request, CCMD_GET_PREIMAGE) || !buffer_write_u8(&request, 0) ||
+        !buffer_write_bytes(&request, hash, 32)) {
+        return -1;
+    }
+    dispatcher_context->commit_response(&request);
     dispatcher_context->finalize_response(SW_INTERRUPTED_EXECUTION);
 
     if (dispatcher_context->process_interruption(dispatcher_context) < 0) {
@@ -27,10 +29,12 @@ int call_stream_preimage(dispatcher_context_t *dispatcher_context,
     uint64_t preimage_len_u64;  // preimage len (including the 0x00 prefix of Merkle tree leaves)
 
     uint8_t partial_data_len;
+    const uint8_t *data_ptr;
 
     if (!buffer_read_varint(&dispatcher_context->read_buffer, &preimage_len_u64) ||
         !buffer_read_u8(&dispatcher_context->read_buffer, &partial_data_len) ||
-        !buffer_can_read(&dispatcher_context->read_buffer, partial_data_len)) {
+        (data_ptr = buffer_reserve_read(&dispatcher_context->read_buffer, partial_data_len)) ==
+            NULL) {
         return -2;
     }
     uint32_t preimage_len = (uint32_t) preimage_len_u64;
@@ -48,37 +52,39 @@ int call_stream_preimage(dispatcher_context_t *dispatcher_context,
         len_callback(preimage_len - 1, callback_state);
     }
 
-    uint8_t *data_ptr =
-        dispatcher_context->read_buffer.ptr + dispatcher_context->read_buffer.offset;
-
     cx_sha256_t hash_context;
     cx_sha256_init(&hash_context);
     // update hash
     crypto_hash_update(&hash_context.header, data_ptr, partial_data_len);
 
     // call callback with data
-    buffer_t initial_buf = buffer_create(data_ptr + 1, partial_data_len - 1);  // skip 0x00 prefix
+    buffer_t initial_buf =
+        buffer_create((uint8_t *) data_ptr + 1, partial_data_len - 1);  // skip 0x00 prefix
     callback(&initial_buf, callback_state);
 
     size_t bytes_remaining = (size_t) preimage_len - partial_data_len;
 
     while (bytes_remaining > 0) {
-        uint8_t get_more_elements_req[] = {CCMD_GET_MORE_ELEMENTS};
-        SET_RESPONSE(dispatcher_context,
-                     get_more_elements_req,
-                     sizeof(get_more_elements_req),
-                     SW_INTERRUPTED_EXECUTION);
-        if (dispatcher_context->process_interruption(dispatcher_context) < 0) {
-            return -5;
+        // A single response can contain more than one group of elements; we only ask for more once
+        // the current response is exhausted.
+        if (!buffer_can_read(&dispatcher_context->read_buffer, 1)) {
+            uint8_t get_more_elements_req[] = {CCMD_GET_MORE_ELEMENTS};
+            SET_RESPONSE(dispatcher_context,
+                         get_more_elements_req,
+                         sizeof(get_more_elements_req),
+                         SW_INTERRUPTED_EXECUTION);
+            if (dispatcher_context->process_interruption(dispatcher_context) < 0) {
+                return -5;
+            }
         }
 
         // Parse response to CCMD_GET_MORE_ELEMENTS
-        uint8_t n_bytes, elements_len;
-        if (!buffer_read_u8(&dispatcher_context->read_buffer, &n_bytes) ||
-            !buffer_read_u8(&dispatcher_context->read_buffer, &elements_len) ||
-            !buffer_can_read(&dispatcher_context->read_buffer, (size_t) n_bytes * elements_len)) {
+        const uint8_t *header = buffer_reserve_read(&dispatcher_context->read_buffer, 2);
+        if (header == NULL) {
             return -6;
         }
+        uint8_t n_bytes = header[0];
+        uint8_t elements_len = header[1];
 
         if (elements_len != 1) {
             PRINTF("Elements should be single bytes\n");
@@ -90,13 +96,16 @@ int call_stream_preimage(dispatcher_context_t *dispatcher_context,
             return -8;
         }
 
-        data_ptr = dispatcher_context->read_buffer.ptr + dispatcher_context->read_buffer.offset;
+        data_ptr = buffer_reserve_read(&dispatcher_context->read_buffer, n_bytes);
+        if (data_ptr == NULL) {
+            return -6;
+        }
 
         // update hash
         crypto_hash_update(&hash_context.header, data_ptr, n_bytes);
 
         // call callback with data
-        buffer_t buf = buffer_create(data_ptr, n_bytes);
+        buffer_t buf = buffer_create((uint8_t *) data_ptr, n_bytes);
         callback(&buf, callback_state);
 
         bytes_remaining -= n_bytes;
@@ -0,0 +1,102 @@
+#include <string.h>
+
+#include "cache_slots.h"
+#include "taproot_key_cache.h"
+
+typedef struct {
+    uint32_t bip32_path[MAX_BIP32_PATH_STEPS];
+    uint8_t bip32_path_len;
+    bool is_tweaked;
+    uint8_t tweak_len;
+    bool is_used;
+    uint8_t tweak[32];
+    uint8_t seckey[32];
+    uint8_t xonly_pubkey[32];
+} taproot_key_cache_entry_t;
+
+static struct {
+    taproot_key_cache_entry_t entries[TAPROOT_KEY_CACHE_SIZE];
+    cache_slots_t slots;
+} G_taproot_key_cache;
+
+static void report_bytes_in_use(void) {
+    PERF_SET_CACHE_BYTES(PERF_CACHE_TAPROOT_KEY,
+                         G_taproot_key_cache.slots.n_used * sizeof(taproot_key_cache_entry_t),
+                         sizeof(G_taproot_key_cache));
+}
+
+void taproot_key_cache_reset(void) {
+    explicit_bzero(&G_taproot_key_cache, sizeof(G_taproot_key_cache));
+    report_bytes_in_use();
+}
+
+static taproot_key_cache_entry_t *find_entry(const uint32_t bip32_path[],
+                                             uint8_t bip32_path_len,
+                                             bool is_tweaked,
+                                             const uint8_t *tweak,
+                                             uint8_t tweak_len) {
+    if (!is_tweaked) {
+        tweak_len = 0;
+    }
+
+    for (int i = 0; i < TAPROOT_KEY_CACHE_SIZE; i++) {
+        taproot_key_cache_entry_t *entry = &G_taproot_key_cache.entries[i];
+        if (entry->is_used && entry->bip32_path_len == bip32_path_len &&
+            entry->is_tweaked == is_tweaked && entry->tweak_len == tweak_len &&
+            memcmp(entry->bip32_path, bip32_path, bip32_path_len * sizeof(uint32_t)) == 0 &&
+            memcmp(entry->tweak, tweak, tweak_len) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool taproot_key_cache_get(const uint32_t bip32_path[],
+                           uint8_t bip32_path_len,
+                           bool is_tweaked,
+                           const uint8_t *tweak,
+                           uint8_t tweak_len,
+                           uint8_t seckey[static 32],
+                           uint8_t xonly_pubkey[static 32]) {
+    const taproot_key_cache_entry_t *entry =
+        find_entry(bip32_path, bip32_path_len, is_tweaked, tweak, tweak_len);
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_TAPROOT_KEY, entry != NULL);
+    if (entry == NULL) {
+        return false;
+    }
+    memcpy(seckey, entry->seckey, 32);
+    memcpy(xonly_pubkey, entry->xonly_pubkey, 32);
+    return true;
+}
+
+void taproot_key_cache_add(const uint32_t bip32_path[],
+                           uint8_t bip32_path_len,
+                           bool is_tweaked,
+                           const uint8_t *tweak,
+                           uint8_t tweak_len,
+                           const uint8_t seckey[static 32],
+                           const uint8_t xonly_pubkey[static 32]) {
+    if (bip32_path_len > MAX_BIP32_PATH_STEPS || (is_tweaked && tweak_len > 32)) {
+        return;  // not cacheable
+    }
+
+    if (find_entry(bip32_path, bip32_path_len, is_tweaked, tweak, tweak_len) != NULL) {
+        return;
+    }
+
+    taproot_key_cache_entry_t *entry = &G_taproot_key_cache.entries[cache_slots_take(
+        &G_taproot_key_cache.slots, TAPROOT_KEY_CACHE_SIZE, PERF_CACHE_TAPROOT_KEY)];
+    explicit_bzero(entry, sizeof(taproot_key_cache_entry_t));
+    memcpy(entry->bip32_path, bip32_path, bip32_path_len * sizeof(uint32_t));
+    entry->bip32_path_len = bip32_path_len;
+    entry->is_tweaked = is_tweaked;
+    if (is_tweaked) {
+        memcpy(entry->tweak, tweak, tweak_len);
+        entry->tweak_len = tweak_len;
+    }
+    memcpy(entry->seckey, seckey, 32);
+    memcpy(entry->xonly_pubkey, xonly_pubkey, 32);
+    entry->is_used = true;
+
+    report_bytes_in_use();
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../../common/bip32.h"
+
+#include "../../cache_sizes.h"
+
+/**
+ * Number of taproot signing keys that can be cached. Each entry takes about 140 bytes of RAM.
+ */
+#ifndef TAPROOT_KEY_CACHE_SIZE
+#define TAPROOT_KEY_CACHE_SIZE CACHE_SIZE_FOR_TARGET(4, 8)
+#endif
+
+/**
+ * Cache of the secret keys used for Schnorr signatures during the current command, after the
+ * BIP-341 tweak (if any) is applied, together with the corresponding x-only public key.
+ * An entry is identified by the BIP-32 path of the key and by the tweak: inputs spending from the
+ * same address with the same taptree therefore sign with the same key, which is only derived and
+ * tweaked once.
+ * Once the cache is full, the oldest entry is replaced.
+ *
+ * As this cache holds secret keys, it must be wiped both at the beginning and at the end of each
+ * command.
+ */
+
+/**
+ * Wipes the cache.
+ */
+void taproot_key_cache_reset(void);
+
+/**
+ * Looks up the key derived at the given path, tweaked with the given tweak. If `is_tweaked` is
+ * false, the key is not tweaked and `tweak` is ignored; otherwise, `tweak` is the data committed in
+ * the BIP-341 tweak, which is either empty or a 32-byte taptree hash.
+ *
+ * Returns true and fills `seckey` and `xonly_pubkey` if found, false otherwise.
+ */
+bool taproot_key_cache_get(const uint32_t bip32_path[],
+                           uint8_t bip32_path_len,
+                           bool is_tweaked,
+                           const uint8_t *tweak,
+                           uint8_t tweak_len,
+                           uint8_t seckey[static 32],
+                           uint8_t xonly_pubkey[static 32]);
+
+/**
+ * Adds a key to the cache; the parameters are as in taproot_key_cache_get.
+ */
+void taproot_key_cache_add(const uint32_t bip32_path[],
+                           uint8_t bip32_path_len,
+                           bool is_tweaked,
+                           const uint8_t *tweak,
+                           uint8_t tweak_len,
+                           const uint8_t seckey[static 32],
+                           const uint8_t xonly_pubkey[static 32]);
@@ -0,0 +1,71 @@
+#include <string.h>
+
+#include "cache_slots.h"
+#include "validated_psbt_cache.h"
+
+typedef struct {
+    uint8_t key[32];
+    uint8_t state[VALIDATED_PSBT_MAX_LEN];
+    uint16_t state_len;
+    bool is_used;
+} validated_psbt_cache_entry_t;
+
+static struct {
+    validated_psbt_cache_entry_t entries[VALIDATED_PSBT_CACHE_SIZE];
+    cache_slots_t slots;
+} G_validated_psbt_cache;
+
+static void report_bytes_in_use(void) {
+    PERF_SET_CACHE_BYTES(PERF_CACHE_VALIDATED_PSBT,
+                         G_validated_psbt_cache.slots.n_used * sizeof(validated_psbt_cache_entry_t),
+                         sizeof(G_validated_psbt_cache));
+}
+
+void validated_psbt_cache_reset(void) {
+    explicit_bzero(&G_validated_psbt_cache, sizeof(G_validated_psbt_cache));
+    report_bytes_in_use();
+}
+
+static validated_psbt_cache_entry_t *find_entry(const uint8_t key[static 32]) {
+    for (int i = 0; i < VALIDATED_PSBT_CACHE_SIZE; i++) {
+        validated_psbt_cache_entry_t *entry = &G_validated_psbt_cache.entries[i];
+        if (entry->is_used && memcmp(entry->key, key, 32) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool validated_psbt_cache_get(const uint8_t key[static 32], void *out, size_t out_len) {
+    const validated_psbt_cache_entry_t *entry = find_entry(key);
+    bool is_hit = entry != NULL && entry->state_len == out_len;
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_VALIDATED_PSBT, is_hit);
+    if (!is_hit) {
+        return false;
+    }
+
+    memcpy(out, entry->state, out_len);
+    return true;
+}
+
+void validated_psbt_cache_add(const uint8_t key[static 32], const void *state, size_t state_len) {
+    if (state_len > VALIDATED_PSBT_MAX_LEN) {
+        return;
+    }
+
+    // an entry for the same transaction is updated in place
+    validated_psbt_cache_entry_t *entry = find_entry(key);
+    if (entry == NULL) {
+        entry = &G_validated_psbt_cache.entries[cache_slots_take(&G_validated_psbt_cache.slots,
+                                                                 VALIDATED_PSBT_CACHE_SIZE,
+                                                                 PERF_CACHE_VALIDATED_PSBT)];
+    }
+
+    explicit_bzero(entry, sizeof(validated_psbt_cache_entry_t));
+    memcpy(entry->key, key, 32);
+    memcpy(entry->state, state, state_len);
+    entry->state_len = (uint16_t) state_len;
+    entry->is_used = true;
+
+    report_bytes_in_use();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../../cache_sizes.h"
+
+/**
+ * Number of validated transactions that can be cached. Each entry takes VALIDATED_PSBT_MAX_LEN
+ * bytes of RAM, plus the 32-byte key.
+ */
+#ifndef VALIDATED_PSBT_CACHE_SIZE
+#define VALIDATED_PSBT_CACHE_SIZE CACHE_SIZE_FOR_TARGET(1, 2)
+#endif
+
+/**
+ * Maximum length of the state kept for each validated transaction.
+ */
+#define VALIDATED_PSBT_MAX_LEN 640
+
+/**
+ * Cache of the state that SIGN_PSBT computes while validating the inputs and the outputs of a
+ * transaction, before asking for the approval of the user. Like the wallet_policy_cache, it is kept
+ * for the whole session (see session.h), so that signing the same PSBT again, for example when the
+ * client retries after losing the response, skips fetching and checking all the inputs and the
+ * outputs; the transaction is still shown to the user.
+ *
+ * The state is opaque; its layout is private to the handler. An entry is identified by a hash that
+ * commits to all the Merkle roots of the PSBT in the request, the wallet policy, its hmac and the
+ * protocol version: the state only depends on them and on the seed, that can not change during a
+ * session.
+ *
+ * Once the cache is full, the oldest entry is replaced.
+ */
+
+/**
+ * Empties the cache. Called when the session ends (see session.h).
+ */
+void validated_psbt_cache_reset(void);
+
+/**
+ * Looks up the state of the transaction with the given key, copying it to out.
+ *
+ * Returns true if found, false otherwise, or if the state is not exactly out_len bytes long.
+ */
+bool validated_psbt_cache_get(const uint8_t key[static 32], void *out, size_t out_len);
+
+/**
+ * Adds the state of a validated transaction to the cache. It does nothing if state_len is larger
+ * than VALIDATED_PSBT_MAX_LEN.
+ */
+void validated_psbt_cache_add(const uint8_t key[static 32], const void *state, size_t state_len);
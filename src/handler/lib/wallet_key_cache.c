@@ -0,0 +1,377 @@
+#include <string.h>
+
+#include "cache_slots.h"
+#include "wallet_key_cache.h"
+
+typedef struct {
+    uint32_t change_step;
+    uint32_t address_index;
+    uint8_t pubkey[33];
+    uint8_t key_index;
+    bool is_used;
+} derived_pubkey_entry_t;
+
+typedef struct {
+    uint32_t change_step;
+    uint8_t pubkey[33];
+    uint8_t chain_code[32];
+    bool is_used;
+} change_pubkey_entry_t;
+
+typedef struct {
+    policy_map_key_info_t key_info;
+    int wallet_version;
+    bool is_used;
+} key_info_entry_t;
+
+typedef struct {
+    const void *node;
+    uint32_t address_index;
+    uint8_t hash[32];
+    bool is_change;
+    bool is_used;
+} taptree_hash_entry_t;
+
+typedef struct {
+    const void *policy;
+    uint32_t address_index;
+    uint8_t script[MAX_PREVOUT_SCRIPTPUBKEY_LEN];
+    uint8_t script_len;
+    bool is_change;
+    bool is_used;
+} script_entry_t;
+
+static struct {
+    uint8_t keys_root[32];
+    bool has_root;
+    derived_pubkey_entry_t derived[WALLET_KEY_CACHE_DERIVED_PUBKEYS];
+    cache_slots_t derived_slots;
+    change_pubkey_entry_t change_pubkeys[MAX_N_KEYS_IN_WALLET_POLICY]
+                                        [WALLET_KEY_CACHE_CHANGE_XPUBS_PER_KEY];
+    key_info_entry_t key_infos[MAX_N_KEYS_IN_WALLET_POLICY];
+    taptree_hash_entry_t taptree_hashes[WALLET_KEY_CACHE_TAPTREE_HASHES];
+    cache_slots_t taptree_hash_slots;
+    script_entry_t scripts[WALLET_KEY_CACHE_SCRIPTS];
+    cache_slots_t script_slots;
+} G_wallet_key_cache;
+
+// The key infos and the change pubkeys have a slot per key of the wallet policy, and are never
+// evicted while the cache holds the same wallet policy
+static void report_bytes_in_use(void) {
+#ifdef HAVE_PERF_STATS
+    size_t bytes_in_use =
+        G_wallet_key_cache.derived_slots.n_used * sizeof(derived_pubkey_entry_t) +
+        G_wallet_key_cache.taptree_hash_slots.n_used * sizeof(taptree_hash_entry_t) +
+        G_wallet_key_cache.script_slots.n_used * sizeof(script_entry_t);
+    for (int i = 0; i < MAX_N_KEYS_IN_WALLET_POLICY; i++) {
+        if (G_wallet_key_cache.key_infos[i].is_used) {
+            bytes_in_use += sizeof(key_info_entry_t);
+        }
+        for (int j = 0; j < WALLET_KEY_CACHE_CHANGE_XPUBS_PER_KEY; j++) {
+            if (G_wallet_key_cache.change_pubkeys[i][j].is_used) {
+                bytes_in_use += sizeof(change_pubkey_entry_t);
+            }
+        }
+    }
+    PERF_SET_CACHE_BYTES(PERF_CACHE_WALLET_KEY, bytes_in_use, sizeof(G_wallet_key_cache));
+#endif
+}
+
+void wallet_key_cache_reset(void) {
+    explicit_bzero(&G_wallet_key_cache, sizeof(G_wallet_key_cache));
+    report_bytes_in_use();
+}
+
+// Returns true if the cache holds the keys of the wallet policy with the given keys root
+static bool is_current_wallet(const uint8_t keys_root[static 32]) {
+    return G_wallet_key_cache.has_root && memcmp(G_wallet_key_cache.keys_root, keys_root, 32) == 0;
+}
+
+// Makes the cache hold the keys of the wallet policy with the given keys root, emptying it if it
+// contained keys of a different wallet policy
+static void select_wallet(const uint8_t keys_root[static 32]) {
+    if (!is_current_wallet(keys_root)) {
+        wallet_key_cache_reset();
+        memcpy(G_wallet_key_cache.keys_root, keys_root, 32);
+        G_wallet_key_cache.has_root = true;
+    }
+}
+
+static derived_pubkey_entry_t *find_derived_pubkey(uint32_t key_index,
+                                                   uint32_t change_step,
+                                                   uint32_t address_index) {
+    for (int i = 0; i < WALLET_KEY_CACHE_DERIVED_PUBKEYS; i++) {
+        derived_pubkey_entry_t *entry = &G_wallet_key_cache.derived[i];
+        if (entry->is_used && entry->key_index == key_index &&
+            entry->change_step == change_step && entry->address_index == address_index) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool wallet_key_cache_get_derived_pubkey(const uint8_t keys_root[static 32],
+                                         uint32_t key_index,
+                                         uint32_t change_step,
+                                         uint32_t address_index,
+                                         uint8_t out[static 33]) {
+    if (!is_current_wallet(keys_root)) {
+        return false;
+    }
+
+    const derived_pubkey_entry_t *entry =
+        find_derived_pubkey(key_index, change_step, address_index);
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_WALLET_KEY, entry != NULL);
+    if (entry == NULL) {
+        return false;
+    }
+    memcpy(out, entry->pubkey, 33);
+    return true;
+}
+
+void wallet_key_cache_add_derived_pubkey(const uint8_t keys_root[static 32],
+                                         uint32_t key_index,
+                                         uint32_t change_step,
+                                         uint32_t address_index,
+                                         const uint8_t pubkey[static 33]) {
+    if (key_index >= MAX_N_KEYS_IN_WALLET_POLICY) {
+        return;
+    }
+
+    select_wallet(keys_root);
+
+    if (find_derived_pubkey(key_index, change_step, address_index) != NULL) {
+        return;
+    }
+
+    derived_pubkey_entry_t *entry =
+        &G_wallet_key_cache.derived[cache_slots_take(&G_wallet_key_cache.derived_slots,
+                                                     WALLET_KEY_CACHE_DERIVED_PUBKEYS,
+                                                     PERF_CACHE_WALLET_KEY)];
+    entry->change_step = change_step;
+    entry->address_index = address_index;
+    memcpy(entry->pubkey, pubkey, 33);
+    entry->key_index = key_index;
+    entry->is_used = true;
+
+    report_bytes_in_use();
+}
+
+static change_pubkey_entry_t *find_change_pubkey(uint32_t key_index, uint32_t change_step) {
+    if (key_index >= MAX_N_KEYS_IN_WALLET_POLICY) {
+        return NULL;
+    }
+    for (int i = 0; i < WALLET_KEY_CACHE_CHANGE_XPUBS_PER_KEY; i++) {
+        change_pubkey_entry_t *entry = &G_wallet_key_cache.change_pubkeys[key_index][i];
+        if (entry->is_used && entry->change_step == change_step) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool wallet_key_cache_get_change_pubkey(const uint8_t keys_root[static 32],
+                                        uint32_t key_index,
+                                        uint32_t change_step,
+                                        uint8_t pubkey[static 33],
+                                        uint8_t chain_code[static 32]) {
+    if (!is_current_wallet(keys_root)) {
+        return false;
+    }
+
+    const change_pubkey_entry_t *entry = find_change_pubkey(key_index, change_step);
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_WALLET_KEY, entry != NULL);
+    if (entry == NULL) {
+        return false;
+    }
+    memcpy(pubkey, entry->pubkey, 33);
+    memcpy(chain_code, entry->chain_code, 32);
+    return true;
+}
+
+void wallet_key_cache_add_change_pubkey(const uint8_t keys_root[static 32],
+                                        uint32_t key_index,
+                                        bool is_change,
+                                        uint32_t change_step,
+                                        const uint8_t pubkey[static 33],
+                                        const uint8_t chain_code[static 32]) {
+    if (key_index >= MAX_N_KEYS_IN_WALLET_POLICY) {
+        return;
+    }
+
+    select_wallet(keys_root);
+
+    if (find_change_pubkey(key_index, change_step) != NULL) {
+        return;
+    }
+
+    // use a free slot if there is one, otherwise replace the one of the same branch
+    change_pubkey_entry_t *slots = G_wallet_key_cache.change_pubkeys[key_index];
+    change_pubkey_entry_t *entry = &slots[is_change ? 1 : 0];
+    for (int i = 0; i < WALLET_KEY_CACHE_CHANGE_XPUBS_PER_KEY; i++) {
+        if (!slots[i].is_used) {
+            entry = &slots[i];
+            break;
+        }
+    }
+    if (entry->is_used) {
+        PERF_COUNT_CACHE(PERF_CACHE_WALLET_KEY, PERF_CACHE_EVICTION);
+    }
+
+    memcpy(entry->pubkey, pubkey, 33);
+    memcpy(entry->chain_code, chain_code, 32);
+    entry->change_step = change_step;
+    entry->is_used = true;
+
+    report_bytes_in_use();
+}
+
+bool wallet_key_cache_get_key_info(const uint8_t keys_root[static 32],
+                                   int wallet_version,
+                                   uint32_t key_index,
+                                   policy_map_key_info_t *out) {
+    if (key_index >= MAX_N_KEYS_IN_WALLET_POLICY || !is_current_wallet(keys_root)) {
+        return false;
+    }
+
+    const key_info_entry_t *entry = &G_wallet_key_cache.key_infos[key_index];
+    bool is_hit = entry->is_used && entry->wallet_version == wallet_version;
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_WALLET_KEY, is_hit);
+    if (!is_hit) {
+        return false;
+    }
+    *out = entry->key_info;
+    return true;
+}
+
+void wallet_key_cache_add_key_info(const uint8_t keys_root[static 32],
+                                   int wallet_version,
+                                   uint32_t key_index,
+                                   const policy_map_key_info_t *key_info) {
+    if (key_index >= MAX_N_KEYS_IN_WALLET_POLICY) {
+        return;
+    }
+
+    select_wallet(keys_root);
+
+    key_info_entry_t *entry = &G_wallet_key_cache.key_infos[key_index];
+    entry->key_info = *key_info;
+    entry->wallet_version = wallet_version;
+    entry->is_used = true;
+
+    report_bytes_in_use();
+}
+
+static taptree_hash_entry_t *find_taptree_hash(const void *node,
+                                               bool is_change,
+                                               uint32_t address_index) {
+    for (int i = 0; i < WALLET_KEY_CACHE_TAPTREE_HASHES; i++) {
+        taptree_hash_entry_t *entry = &G_wallet_key_cache.taptree_hashes[i];
+        if (entry->is_used && entry->node == node && entry->is_change == is_change &&
+            entry->address_index == address_index) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool wallet_key_cache_get_taptree_hash(const uint8_t keys_root[static 32],
+                                       const void *node,
+                                       bool is_change,
+                                       uint32_t address_index,
+                                       uint8_t out[static 32]) {
+    if (!is_current_wallet(keys_root)) {
+        return false;
+    }
+
+    const taptree_hash_entry_t *entry = find_taptree_hash(node, is_change, address_index);
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_WALLET_KEY, entry != NULL);
+    if (entry == NULL) {
+        return false;
+    }
+    memcpy(out, entry->hash, 32);
+    return true;
+}
+
+void wallet_key_cache_add_taptree_hash(const uint8_t keys_root[static 32],
+                                       const void *node,
+                                       bool is_change,
+                                       uint32_t address_index,
+                                       const uint8_t hash[static 32]) {
+    select_wallet(keys_root);
+
+    if (find_taptree_hash(node, is_change, address_index) != NULL) {
+        return;
+    }
+
+    taptree_hash_entry_t *entry =
+        &G_wallet_key_cache.taptree_hashes[cache_slots_take(&G_wallet_key_cache.taptree_hash_slots,
+                                                            WALLET_KEY_CACHE_TAPTREE_HASHES,
+                                                            PERF_CACHE_WALLET_KEY)];
+    entry->node = node;
+    entry->address_index = address_index;
+    memcpy(entry->hash, hash, 32);
+    entry->is_change = is_change;
+    entry->is_used = true;
+
+    report_bytes_in_use();
+}
+
+static script_entry_t *find_script(const void *policy, bool is_change, uint32_t address_index) {
+    for (int i = 0; i < WALLET_KEY_CACHE_SCRIPTS; i++) {
+        script_entry_t *entry = &G_wallet_key_cache.scripts[i];
+        if (entry->is_used && entry->policy == policy && entry->is_change == is_change &&
+            entry->address_index == address_index) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int wallet_key_cache_get_script(const uint8_t keys_root[static 32],
+                                const void *policy,
+                                bool is_change,
+                                uint32_t address_index,
+                                uint8_t out[static MAX_PREVOUT_SCRIPTPUBKEY_LEN]) {
+    if (!is_current_wallet(keys_root)) {
+        return -1;
+    }
+
+    const script_entry_t *entry = find_script(policy, is_change, address_index);
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_WALLET_KEY, entry != NULL);
+    if (entry == NULL) {
+        return -1;
+    }
+    memcpy(out, entry->script, entry->script_len);
+    return entry->script_len;
+}
+
+void wallet_key_cache_add_script(const uint8_t keys_root[static 32],
+                                 const void *policy,
+                                 bool is_change,
+                                 uint32_t address_index,
+                                 const uint8_t *script,
+                                 size_t script_len) {
+    if (script_len > MAX_PREVOUT_SCRIPTPUBKEY_LEN) {
+        return;
+    }
+
+    select_wallet(keys_root);
+
+    if (find_script(policy, is_change, address_index) != NULL) {
+        return;
+    }
+
+    script_entry_t *entry =
+        &G_wallet_key_cache.scripts[cache_slots_take(&G_wallet_key_cache.script_slots,
+                                                     WALLET_KEY_CACHE_SCRIPTS,
+                                                     PERF_CACHE_WALLET_KEY)];
+    entry->policy = policy;
+    entry->address_index = address_index;
+    memcpy(entry->script, script, script_len);
+    entry->script_len = (uint8_t) script_len;
+    entry->is_change = is_change;
+    entry->is_used = true;
+
+    report_bytes_in_use();
+}
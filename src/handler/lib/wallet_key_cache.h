@@ -0,0 +1,173 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../../crypto.h"
+#include "../../common/wallet.h"
+
+#include "../../cache_sizes.h"
+
+/**
+ * Number of derived pubkeys that can be cached. Each entry takes about 44 bytes of RAM.
+ */
+#ifndef WALLET_KEY_CACHE_DERIVED_PUBKEYS
+#define WALLET_KEY_CACHE_DERIVED_PUBKEYS CACHE_SIZE_FOR_TARGET(16, 32)
+#endif
+
+/**
+ * Number of /<change_step> children that can be cached for each key of the wallet policy; normally,
+ * the receive and the change ones.
+ */
+#define WALLET_KEY_CACHE_CHANGE_XPUBS_PER_KEY 2
+
+/**
+ * Number of taptree and tapleaf hashes that can be cached. Each entry takes about 44 bytes of RAM.
+ */
+#ifndef WALLET_KEY_CACHE_TAPTREE_HASHES
+#define WALLET_KEY_CACHE_TAPTREE_HASHES CACHE_SIZE_FOR_TARGET(8, 16)
+#endif
+
+/**
+ * Number of scriptPubKeys of the wallet policy that can be cached. Each entry takes about 48 bytes
+ * of RAM.
+ */
+#ifndef WALLET_KEY_CACHE_SCRIPTS
+#define WALLET_KEY_CACHE_SCRIPTS CACHE_SIZE_FOR_TARGET(8, 16)
+#endif
+
+/**
+ * Cache of the public keys derived from the keys of a wallet policy during the current command.
+ * The cache only holds keys of a single wallet policy, identified by the root of the Merkle tree of
+ * its keys; using it with a different root empties the cache.
+ *
+ * A derived pubkey is identified by the index of the key in the wallet policy, and by the two
+ * unhardened derivation steps /<change_step>/<address_index> applied to its extended pubkey.
+ * The pubkeys and chain codes of the intermediate /<change_step> children are also cached, as they
+ * are shared by all the addresses of the wallet policy in the same branch, as well as the parsed
+ * key information of each key, which avoids fetching it again from the client and decoding its
+ * xpub. SIGN_PSBT also checks the BIP32 derivations of the inputs and outputs against the same
+ * entries, so that the many outputs of a self-transfer at the same address only derive it once.
+ *
+ * Finally, it caches the hashes of taptrees and tapleaves of the wallet policy for a pair
+ * (change, address_index). They are identified by the pointer to the node in the parsed policy,
+ * which is fine as a command only ever works with a single parsed wallet policy.
+ *
+ * Similarly, it caches the scriptPubKeys of the wallet policy for a pair (change, address_index),
+ * so that inputs and outputs at the same derivation only compute it once.
+ */
+
+/**
+ * Empties the cache. Must be called at the beginning of each command.
+ */
+void wallet_key_cache_reset(void);
+
+/**
+ * Looks up a derived compressed pubkey in the cache.
+ *
+ * Returns true and copies the pubkey to out if it is cached, false otherwise.
+ */
+bool wallet_key_cache_get_derived_pubkey(const uint8_t keys_root[static 32],
+                                         uint32_t key_index,
+                                         uint32_t change_step,
+                                         uint32_t address_index,
+                                         uint8_t out[static 33]);
+
+/**
+ * Adds a derived compressed pubkey to the cache, evicting the oldest entry if the cache is full.
+ */
+void wallet_key_cache_add_derived_pubkey(const uint8_t keys_root[static 32],
+                                         uint32_t key_index,
+                                         uint32_t change_step,
+                                         uint32_t address_index,
+                                         const uint8_t pubkey[static 33]);
+
+/**
+ * Looks up the /<change_step> child of the extended pubkey of a key in the cache. Only its
+ * compressed pubkey and its chain code are kept, as they are all that is needed to derive its
+ * children.
+ *
+ * Returns true and copies the pubkey and the chain code if they are cached, false otherwise.
+ */
+bool wallet_key_cache_get_change_pubkey(const uint8_t keys_root[static 32],
+                                        uint32_t key_index,
+                                        uint32_t change_step,
+                                        uint8_t pubkey[static 33],
+                                        uint8_t chain_code[static 32]);
+
+/**
+ * Adds the /<change_step> child of the extended pubkey of a key to the cache. If both the slots of
+ * the key are taken by different derivation steps, the one used for the same branch (receive or
+ * change) is replaced.
+ */
+void wallet_key_cache_add_change_pubkey(const uint8_t keys_root[static 32],
+                                        uint32_t key_index,
+                                        bool is_change,
+                                        uint32_t change_step,
+                                        const uint8_t pubkey[static 33],
+                                        const uint8_t chain_code[static 32]);
+
+/**
+ * Looks up the parsed key information of a key in the cache. As the format of the key information
+ * depends on the version of the wallet policy, it is only returned if it was parsed for the same
+ * version.
+ *
+ * Returns true and copies the key information to out if it is cached, false otherwise.
+ */
+bool wallet_key_cache_get_key_info(const uint8_t keys_root[static 32],
+                                   int wallet_version,
+                                   uint32_t key_index,
+                                   policy_map_key_info_t *out);
+
+/**
+ * Adds the parsed key information of a key to the cache, replacing the one of the same key if it
+ * was parsed for a different version of the wallet policy.
+ */
+void wallet_key_cache_add_key_info(const uint8_t keys_root[static 32],
+                                   int wallet_version,
+                                   uint32_t key_index,
+                                   const policy_map_key_info_t *key_info);
+
+/**
+ * Looks up the hash of a taptree or tapleaf of the wallet policy in the cache.
+ *
+ * Returns true and copies the hash to out if it is cached, false otherwise.
+ */
+bool wallet_key_cache_get_taptree_hash(const uint8_t keys_root[static 32],
+                                       const void *node,
+                                       bool is_change,
+                                       uint32_t address_index,
+                                       uint8_t out[static 32]);
+
+/**
+ * Adds the hash of a taptree or tapleaf of the wallet policy to the cache, evicting the oldest
+ * entry if the cache is full.
+ */
+void wallet_key_cache_add_taptree_hash(const uint8_t keys_root[static 32],
+                                       const void *node,
+                                       bool is_change,
+                                       uint32_t address_index,
+                                       const uint8_t hash[static 32]);
+
+/**
+ * Looks up the scriptPubKey of the wallet policy for the given derivation in the cache.
+ *
+ * Returns the length of the script and copies it to out if it is cached, -1 otherwise.
+ */
+int wallet_key_cache_get_script(const uint8_t keys_root[static 32],
+                                const void *policy,
+                                bool is_change,
+                                uint32_t address_index,
+                                uint8_t out[static MAX_PREVOUT_SCRIPTPUBKEY_LEN]);
+
+/**
+ * Adds the scriptPubKey of the wallet policy for the given derivation to the cache, evicting the
+ * oldest entry if the cache is full. Scripts longer than MAX_PREVOUT_SCRIPTPUBKEY_LEN are not
+ * cached.
+ */
+void wallet_key_cache_add_script(const uint8_t keys_root[static 32],
+                                 const void *policy,
+                                 bool is_change,
+                                 uint32_t address_index,
+                                 const uint8_t *script,
+                                 size_t script_len);
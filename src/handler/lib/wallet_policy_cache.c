@@ -0,0 +1,124 @@
+#include <string.h>
+
+#include "os.h"
+
+#include "cache_slots.h"
+#include "wallet_policy_cache.h"
+
+typedef struct {
+    __attribute__((aligned(4))) uint8_t policy_map_bytes[MAX_WALLET_POLICY_BYTES];
+    policy_map_wallet_header_t wallet_header;
+    uint8_t wallet_id[32];
+    uint8_t verified_hmac[32];
+    policy_map_key_info_t standard_key_info;  // only if is_standard
+    uint16_t policy_map_bytes_len;
+    bool has_verified_hmac;
+    bool is_standard;
+    bool is_used;
+} wallet_policy_cache_entry_t;
+
+static struct {
+    wallet_policy_cache_entry_t entries[WALLET_POLICY_CACHE_SIZE];
+    cache_slots_t slots;
+} G_wallet_policy_cache;
+
+static void report_bytes_in_use(void) {
+    PERF_SET_CACHE_BYTES(PERF_CACHE_WALLET_POLICY,
+                         G_wallet_policy_cache.slots.n_used * sizeof(wallet_policy_cache_entry_t),
+                         sizeof(G_wallet_policy_cache));
+}
+
+void wallet_policy_cache_reset(void) {
+    explicit_bzero(&G_wallet_policy_cache, sizeof(G_wallet_policy_cache));
+    report_bytes_in_use();
+}
+
+static wallet_policy_cache_entry_t *find_entry(const uint8_t wallet_id[static 32]) {
+    for (int i = 0; i < WALLET_POLICY_CACHE_SIZE; i++) {
+        wallet_policy_cache_entry_t *entry = &G_wallet_policy_cache.entries[i];
+        if (entry->is_used && memcmp(entry->wallet_id, wallet_id, 32) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int wallet_policy_cache_get(const uint8_t wallet_id[static 32],
+                            policy_map_wallet_header_t *wallet_header,
+                            uint8_t *policy_map_bytes,
+                            size_t policy_map_bytes_len) {
+    const wallet_policy_cache_entry_t *entry = find_entry(wallet_id);
+    bool is_hit = entry != NULL && entry->policy_map_bytes_len <= policy_map_bytes_len;
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_WALLET_POLICY, is_hit);
+    if (!is_hit) {
+        return -1;
+    }
+
+    memcpy(wallet_header, &entry->wallet_header, sizeof(policy_map_wallet_header_t));
+    memcpy(policy_map_bytes, entry->policy_map_bytes, entry->policy_map_bytes_len);
+    return entry->policy_map_bytes_len;
+}
+
+void wallet_policy_cache_add(const uint8_t wallet_id[static 32],
+                             const policy_map_wallet_header_t *wallet_header,
+                             const uint8_t *policy_map_bytes,
+                             size_t policy_map_bytes_len) {
+    if (policy_map_bytes_len > MAX_WALLET_POLICY_BYTES || find_entry(wallet_id) != NULL) {
+        return;
+    }
+
+    wallet_policy_cache_entry_t *entry =
+        &G_wallet_policy_cache.entries[cache_slots_take(&G_wallet_policy_cache.slots,
+                                                        WALLET_POLICY_CACHE_SIZE,
+                                                        PERF_CACHE_WALLET_POLICY)];
+    explicit_bzero(entry, sizeof(wallet_policy_cache_entry_t));
+    memcpy(entry->policy_map_bytes, policy_map_bytes, policy_map_bytes_len);
+    memcpy(&entry->wallet_header, wallet_header, sizeof(policy_map_wallet_header_t));
+    memcpy(entry->wallet_id, wallet_id, 32);
+    entry->policy_map_bytes_len = (uint16_t) policy_map_bytes_len;
+    entry->is_used = true;
+
+    report_bytes_in_use();
+}
+
+bool wallet_policy_cache_is_hmac_verified(const uint8_t wallet_id[static 32],
+                                          const uint8_t wallet_hmac[static 32]) {
+    const wallet_policy_cache_entry_t *entry = find_entry(wallet_id);
+
+    // constant-time comparison, like when the hmac is verified
+    bool is_verified =
+        entry != NULL && entry->has_verified_hmac &&
+        os_secure_memcmp((void *) entry->verified_hmac, (void *) wallet_hmac, 32) == 0;
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_WALLET_POLICY, is_verified);
+    return is_verified;
+}
+
+void wallet_policy_cache_set_hmac_verified(const uint8_t wallet_id[static 32],
+                                           const uint8_t wallet_hmac[static 32]) {
+    wallet_policy_cache_entry_t *entry = find_entry(wallet_id);
+    if (entry != NULL) {
+        memcpy(entry->verified_hmac, wallet_hmac, 32);
+        entry->has_verified_hmac = true;
+    }
+}
+
+bool wallet_policy_cache_get_standard_key_info(const uint8_t wallet_id[static 32],
+                                               policy_map_key_info_t *key_info) {
+    const wallet_policy_cache_entry_t *entry = find_entry(wallet_id);
+    bool is_hit = entry != NULL && entry->is_standard;
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_WALLET_POLICY, is_hit);
+    if (!is_hit) {
+        return false;
+    }
+    memcpy(key_info, &entry->standard_key_info, sizeof(policy_map_key_info_t));
+    return true;
+}
+
+void wallet_policy_cache_set_standard(const uint8_t wallet_id[static 32],
+                                      const policy_map_key_info_t *key_info) {
+    wallet_policy_cache_entry_t *entry = find_entry(wallet_id);
+    if (entry != NULL) {
+        memcpy(&entry->standard_key_info, key_info, sizeof(policy_map_key_info_t));
+        entry->is_standard = true;
+    }
+}
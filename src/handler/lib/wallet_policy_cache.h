@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../../common/wallet.h"
+
+#include "../../cache_sizes.h"
+
+/**
+ * Number of parsed wallet policies that can be cached. Each entry takes about 1.2 KB of RAM.
+ */
+#ifndef WALLET_POLICY_CACHE_SIZE
+#define WALLET_POLICY_CACHE_SIZE CACHE_SIZE_FOR_TARGET(2, 3)
+#endif
+
+/**
+ * Cache of the parsed wallet policies, identified by their wallet id. Unlike the command caches, it
+ * is kept for the whole session (see session.h), so that repeated commands for the same wallet
+ * policy skip fetching and parsing it again.
+ *
+ * This is safe because the wallet id is the hash of the serialized wallet policy, and an entry is
+ * only added after the serialized wallet policy was fetched with its hash checked by the app, and
+ * the descriptor template (that the header commits to) was fetched and parsed. Besides the parsed
+ * policy, an entry can remember the verdicts of the checks that only depend on the wallet policy:
+ * the hmac that was verified to be correct, and whether the policy is a standard one. For a
+ * standard policy, the information of its only key is kept as well, as it was verified to be the
+ * internal key at a standard derivation path.
+ *
+ * Once the cache is full, the oldest entry is replaced.
+ */
+
+/**
+ * Empties the cache. Called when the session ends (see session.h).
+ */
+void wallet_policy_cache_reset(void);
+
+/**
+ * Looks up the parsed wallet policy with the given wallet id, copying its header and its parsed
+ * descriptor template into the given buffers.
+ *
+ * Returns the memory size of the parsed descriptor template, like read_and_parse_wallet_policy, or
+ * -1 if it is not in the cache or it does not fit in policy_map_bytes.
+ */
+int wallet_policy_cache_get(const uint8_t wallet_id[static 32],
+                            policy_map_wallet_header_t *wallet_header,
+                            uint8_t *policy_map_bytes,
+                            size_t policy_map_bytes_len);
+
+/**
+ * Adds a parsed wallet policy to the cache. It does nothing if policy_map_bytes_len is larger than
+ * MAX_WALLET_POLICY_BYTES.
+ */
+void wallet_policy_cache_add(const uint8_t wallet_id[static 32],
+                             const policy_map_wallet_header_t *wallet_header,
+                             const uint8_t *policy_map_bytes,
+                             size_t policy_map_bytes_len);
+
+/**
+ * Returns true if the given hmac was already verified to be correct for the wallet policy with the
+ * given wallet id.
+ */
+bool wallet_policy_cache_is_hmac_verified(const uint8_t wallet_id[static 32],
+                                          const uint8_t wallet_hmac[static 32]);
+
+/**
+ * Records that the given hmac is correct for the wallet policy with the given wallet id. Does
+ * nothing if the wallet policy is not in the cache.
+ */
+void wallet_policy_cache_set_hmac_verified(const uint8_t wallet_id[static 32],
+                                           const uint8_t wallet_hmac[static 32]);
+
+/**
+ * Returns true if the wallet policy with the given wallet id was already verified to be standard,
+ * copying the information of its only key to key_info.
+ */
+bool wallet_policy_cache_get_standard_key_info(const uint8_t wallet_id[static 32],
+                                               policy_map_key_info_t *key_info);
+
+/**
+ * Records that the wallet policy with the given wallet id is standard, together with the parsed
+ * information of its only key. Does nothing if the wallet policy is not in the cache.
+ */
+void wallet_policy_cache_set_standard(const uint8_t wallet_id[static 32],
+                                      const policy_map_key_info_t *key_info);
@@ -0,0 +1,102 @@
+#ifdef HAVE_WALLET_REGISTRY
+
+#include <string.h>
+
+#include "os.h"
+
+#include "wallet_registry.h"
+
+typedef struct {
+    __attribute__((aligned(4))) uint8_t policy_map_bytes[MAX_WALLET_POLICY_BYTES];
+    policy_map_wallet_header_t wallet_header;
+    uint8_t wallet_id[32];
+    uint32_t master_key_fingerprint;
+    uint16_t policy_map_bytes_len;
+    uint8_t is_used;
+} wallet_registry_entry_t;
+
+typedef struct {
+    wallet_registry_entry_t entries[WALLET_REGISTRY_SIZE];
+    uint8_t next_entry;  // index of the next entry to be replaced
+} wallet_registry_storage_t;
+
+// Stored in NVM, zero-initialized when the app is installed; it must only be written with nvm_write
+const wallet_registry_storage_t N_wallet_registry_real;
+#define N_wallet_registry (*(volatile wallet_registry_storage_t *) PIC(&N_wallet_registry_real))
+
+static int find_entry(const uint8_t wallet_id[static 32], uint32_t master_key_fingerprint) {
+    for (int i = 0; i < WALLET_REGISTRY_SIZE; i++) {
+        const wallet_registry_entry_t *entry =
+            (const wallet_registry_entry_t *) &N_wallet_registry.entries[i];
+        if (entry->is_used && entry->master_key_fingerprint == master_key_fingerprint &&
+            memcmp(entry->wallet_id, wallet_id, 32) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool wallet_registry_contains(const uint8_t wallet_id[static 32], uint32_t master_key_fingerprint) {
+    return find_entry(wallet_id, master_key_fingerprint) >= 0;
+}
+
+int wallet_registry_get(const uint8_t wallet_id[static 32],
+                        uint32_t master_key_fingerprint,
+                        policy_map_wallet_header_t *wallet_header,
+                        uint8_t *policy_map_bytes,
+                        size_t policy_map_bytes_len) {
+    int index = find_entry(wallet_id, master_key_fingerprint);
+    if (index < 0) {
+        return -1;
+    }
+
+    const wallet_registry_entry_t *entry =
+        (const wallet_registry_entry_t *) &N_wallet_registry.entries[index];
+    if (entry->policy_map_bytes_len > policy_map_bytes_len) {
+        return -1;
+    }
+
+    memcpy(wallet_header, &entry->wallet_header, sizeof(policy_map_wallet_header_t));
+    memcpy(policy_map_bytes, entry->policy_map_bytes, entry->policy_map_bytes_len);
+    return entry->policy_map_bytes_len;
+}
+
+void wallet_registry_add(const uint8_t wallet_id[static 32],
+                         uint32_t master_key_fingerprint,
+                         const policy_map_wallet_header_t *wallet_header,
+                         const uint8_t *policy_map_bytes,
+                         size_t policy_map_bytes_len) {
+    if (policy_map_bytes_len > MAX_WALLET_POLICY_BYTES ||
+        wallet_registry_contains(wallet_id, master_key_fingerprint)) {
+        return;
+    }
+
+    uint8_t next_entry = N_wallet_registry.next_entry;
+    if (next_entry >= WALLET_REGISTRY_SIZE) {
+        next_entry = 0;
+    }
+
+    // the fields are written one by one (to avoid a large copy of the entry on the stack), and the
+    // entry is only marked as used at the end, so that an interrupted write never leaves a valid
+    // entry with partial content
+    volatile wallet_registry_entry_t *entry = &N_wallet_registry.entries[next_entry];
+    uint16_t len = (uint16_t) policy_map_bytes_len;
+    uint8_t is_used = 0;
+    nvm_write((void *) &entry->is_used, &is_used, sizeof(is_used));
+    nvm_write((void *) entry->policy_map_bytes, (void *) policy_map_bytes, policy_map_bytes_len);
+    nvm_write((void *) &entry->wallet_header,
+              (void *) wallet_header,
+              sizeof(policy_map_wallet_header_t));
+    nvm_write((void *) entry->wallet_id, (void *) wallet_id, 32);
+    nvm_write((void *) &entry->master_key_fingerprint,
+              &master_key_fingerprint,
+              sizeof(master_key_fingerprint));
+    nvm_write((void *) &entry->policy_map_bytes_len, &len, sizeof(len));
+    is_used = 1;
+    nvm_write((void *) &entry->is_used, &is_used, sizeof(is_used));
+
+    next_entry = (next_entry + 1) % WALLET_REGISTRY_SIZE;
+    nvm_write((void *) &N_wallet_registry.next_entry, &next_entry, sizeof(next_entry));
+}
+
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+
+#ifdef HAVE_WALLET_REGISTRY
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../../common/wallet.h"
+
+/**
+ * Number of registered wallet policies that can be stored in the non-volatile memory. Each entry
+ * takes about 1.1 KB of NVM.
+ */
+#define WALLET_REGISTRY_SIZE 4
+
+/**
+ * Registry of the wallet policies registered with REGISTER_WALLET, persisted in the non-volatile
+ * memory of the device. Each entry holds the parsed wallet policy and its header, identified by the
+ * wallet id, together with the fingerprint of the master key that registered it: a wallet policy
+ * is only considered as registered for the same seed (and passphrase).
+ *
+ * A wallet policy in the registry does not need an hmac in order to be used, and it does not need
+ * to be fetched and parsed again. Once the registry is full, the oldest entry is replaced.
+ */
+
+/**
+ * Returns true if the wallet policy with the given wallet id was registered with the master key
+ * with the given fingerprint.
+ */
+bool wallet_registry_contains(const uint8_t wallet_id[static 32], uint32_t master_key_fingerprint);
+
+/**
+ * Looks up the wallet policy with the given wallet id, registered with the master key with the
+ * given fingerprint, copying its header and its parsed descriptor template into the given buffers.
+ *
+ * Returns the memory size of the parsed descriptor template, like read_and_parse_wallet_policy, or
+ * -1 if it is not in the registry or it does not fit in policy_map_bytes.
+ */
+int wallet_registry_get(const uint8_t wallet_id[static 32],
+                        uint32_t master_key_fingerprint,
+                        policy_map_wallet_header_t *wallet_header,
+                        uint8_t *policy_map_bytes,
+                        size_t policy_map_bytes_len);
+
+/**
+ * Stores a registered wallet policy in the registry. Does nothing if it is already stored for the
+ * same master key, or if policy_map_bytes_len is larger than MAX_WALLET_POLICY_BYTES.
+ */
+void wallet_registry_add(const uint8_t wallet_id[static 32],
+                         uint32_t master_key_fingerprint,
+                         const policy_map_wallet_header_t *wallet_header,
+                         const uint8_t *policy_map_bytes,
+                         size_t policy_map_bytes_len);
+
+#endif
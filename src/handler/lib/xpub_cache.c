@@ -0,0 +1,149 @@
+#ifdef HAVE_XPUB_CACHE
+
+#include <string.h>
+
+#include "os.h"
+
+#include "../../boilerplate/perf_stats.h"
+#include "../../common/bip32.h"
+#include "../../common/write.h"
+
+#include "xpub_cache.h"
+
+// Each entry is written with a single nvm_write, that writes the bytes in order: seq is the first
+// field and seq_end the last one, so an entry whose write was interrupted has seq != seq_end, and
+// is ignored. An entry is valid if seq is not 0 (the value of the slots never written) and equal
+// to seq_end; the greater seq, the newer the entry.
+typedef struct {
+    uint32_t seq;
+    uint32_t path[XPUB_CACHE_MAX_PATH_LEN];
+    uint32_t master_key_fingerprint;
+    uint8_t parent_fingerprint[4];
+    uint8_t chain_code[32];
+    uint8_t compressed_pubkey[33];
+    uint8_t path_len;
+    uint32_t seq_end;
+} xpub_cache_entry_t;
+
+typedef struct {
+    xpub_cache_entry_t entries[XPUB_CACHE_SIZE];
+} xpub_cache_storage_t;
+
+// Stored in NVM, zero-initialized when the app is installed; it must only be written with nvm_write
+const xpub_cache_storage_t N_xpub_cache_real;
+#define N_xpub_cache (*(volatile xpub_cache_storage_t *) PIC(&N_xpub_cache_real))
+
+static bool is_valid_entry(const volatile xpub_cache_entry_t *entry) {
+    return entry->seq != 0 && entry->seq == entry->seq_end;
+}
+
+// The cache lives in NVM and is kept across sessions, therefore the order of its entries is kept
+// in the entries themselves, instead of a cache_slots_t in RAM
+static void report_bytes_in_use(void) {
+#ifdef HAVE_PERF_STATS
+    size_t bytes_in_use = 0;
+    for (int i = 0; i < XPUB_CACHE_SIZE; i++) {
+        if (is_valid_entry(&N_xpub_cache.entries[i])) {
+            bytes_in_use += sizeof(xpub_cache_entry_t);
+        }
+    }
+    PERF_SET_CACHE_BYTES(PERF_CACHE_XPUB, bytes_in_use, sizeof(xpub_cache_storage_t));
+#endif
+}
+
+bool xpub_cache_is_cacheable_path(const uint32_t bip32_path[], uint8_t bip32_path_len) {
+    if (bip32_path_len < 3 || bip32_path_len > XPUB_CACHE_MAX_PATH_LEN) {
+        return false;
+    }
+    for (int i = 0; i < bip32_path_len; i++) {
+        if ((bip32_path[i] & BIP32_FIRST_HARDENED_CHILD) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const xpub_cache_entry_t *find_entry(const uint32_t bip32_path[],
+                                            uint8_t bip32_path_len,
+                                            uint32_t master_key_fingerprint) {
+    for (int i = 0; i < XPUB_CACHE_SIZE; i++) {
+        const xpub_cache_entry_t *entry = (const xpub_cache_entry_t *) &N_xpub_cache.entries[i];
+        if (is_valid_entry(entry) && entry->master_key_fingerprint == master_key_fingerprint &&
+            entry->path_len == bip32_path_len &&
+            memcmp(entry->path, bip32_path, bip32_path_len * sizeof(uint32_t)) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool xpub_cache_get(const uint32_t bip32_path[],
+                    uint8_t bip32_path_len,
+                    uint32_t master_key_fingerprint,
+                    serialized_extended_pubkey_t *out_pubkey) {
+    if (!xpub_cache_is_cacheable_path(bip32_path, bip32_path_len)) {
+        return false;
+    }
+
+    const xpub_cache_entry_t *entry =
+        find_entry(bip32_path, bip32_path_len, master_key_fingerprint);
+    PERF_COUNT_CACHE_LOOKUP(PERF_CACHE_XPUB, entry != NULL);
+    if (entry == NULL) {
+        return false;
+    }
+
+    out_pubkey->depth = bip32_path_len;
+    memcpy(out_pubkey->parent_fingerprint, entry->parent_fingerprint, 4);
+    write_u32_be(out_pubkey->child_number, 0, bip32_path[bip32_path_len - 1]);
+    memcpy(out_pubkey->chain_code, entry->chain_code, 32);
+    memcpy(out_pubkey->compressed_pubkey, entry->compressed_pubkey, 33);
+    return true;
+}
+
+void xpub_cache_add(const uint32_t bip32_path[],
+                    uint8_t bip32_path_len,
+                    uint32_t master_key_fingerprint,
+                    const serialized_extended_pubkey_t *pubkey) {
+    if (!xpub_cache_is_cacheable_path(bip32_path, bip32_path_len) ||
+        find_entry(bip32_path, bip32_path_len, master_key_fingerprint) != NULL) {
+        return;
+    }
+
+    // a slot that is not valid (counted as seq 0), or else the oldest entry, is replaced
+    int replaced = 0;
+    uint32_t min_seq = UINT32_MAX, max_seq = 0;
+    for (int i = 0; i < XPUB_CACHE_SIZE; i++) {
+        const volatile xpub_cache_entry_t *entry = &N_xpub_cache.entries[i];
+        uint32_t seq = is_valid_entry(entry) ? entry->seq : 0;
+        if (seq < min_seq) {
+            min_seq = seq;
+            replaced = i;
+        }
+        if (seq > max_seq) {
+            max_seq = seq;
+        }
+    }
+    if (max_seq == UINT32_MAX) {
+        return;  // the flash wears out long before
+    }
+
+    if (min_seq != 0) {
+        PERF_COUNT_CACHE(PERF_CACHE_XPUB, PERF_CACHE_EVICTION);
+    }
+
+    xpub_cache_entry_t new_entry;
+    memset(&new_entry, 0, sizeof(new_entry));
+    new_entry.seq = max_seq + 1;
+    memcpy(new_entry.path, bip32_path, bip32_path_len * sizeof(uint32_t));
+    new_entry.master_key_fingerprint = master_key_fingerprint;
+    memcpy(new_entry.parent_fingerprint, pubkey->parent_fingerprint, 4);
+    memcpy(new_entry.chain_code, pubkey->chain_code, 32);
+    memcpy(new_entry.compressed_pubkey, pubkey->compressed_pubkey, 33);
+    new_entry.path_len = bip32_path_len;
+    new_entry.seq_end = new_entry.seq;
+    nvm_write((void *) &N_xpub_cache.entries[replaced], &new_entry, sizeof(new_entry));
+
+    report_bytes_in_use();
+}
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+
+#ifdef HAVE_XPUB_CACHE
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../../crypto.h"
+
+/**
+ * Number of extended pubkeys that can be stored in the non-volatile memory. Each entry takes about
+ * 100 bytes of NVM.
+ */
+#define XPUB_CACHE_SIZE 8
+
+/**
+ * Maximum number of steps of the paths that are cached: 4, for the accounts of BIP-48.
+ */
+#define XPUB_CACHE_MAX_PATH_LEN 4
+
+/**
+ * Cache of the extended pubkeys of the own accounts of the device, persisted in the non-volatile
+ * memory, so that the first commands after the app is opened do not need to derive them from the
+ * seed again. Only the account-level paths are cached (3 or 4 hardened steps, like the accounts of
+ * the standard purposes, and the keys of most registered wallet policies), as their xpubs are
+ * derived for most commands, while the deeper keys are derived from them with CKDpub. Since each
+ * new entry is a write to the flash, only the keys of the wallets that are signed for or
+ * registered are added (see get_wallet_extended_pubkey_at_path), and each entry is written at
+ * once.
+ *
+ * The extended pubkeys are public, but they depend on the seed (and passphrase): each entry is
+ * bound to the fingerprint of the master key that derived it, and it is only used for the same
+ * one. Once the cache is full, the oldest entry is replaced.
+ */
+
+/**
+ * Returns true if the extended pubkey at the given path can be stored in the cache.
+ */
+bool xpub_cache_is_cacheable_path(const uint32_t bip32_path[], uint8_t bip32_path_len);
+
+/**
+ * Looks up the extended pubkey at the given path, derived with the master key with the given
+ * fingerprint. If found, all the fields of out_pubkey are filled, except for the version.
+ *
+ * Returns true if it was found, false otherwise.
+ */
+bool xpub_cache_get(const uint32_t bip32_path[],
+                    uint8_t bip32_path_len,
+                    uint32_t master_key_fingerprint,
+                    serialized_extended_pubkey_t *out_pubkey);
+
+/**
+ * Stores the extended pubkey at the given path, derived with the master key with the given
+ * fingerprint. Does nothing if the path is not cacheable, or if it is already stored for the same
+ * master key.
+ */
+void xpub_cache_add(const uint32_t bip32_path[],
+                    uint8_t bip32_path_len,
+                    uint32_t master_key_fingerprint,
+                    const serialized_extended_pubkey_t *pubkey);
+
+#endif
@@ -35,9 +35,12 @@
 #include "../ui/display.h"
 #include "../ui/menu.h"
 
-#include "lib/get_merkle_leaf_element.h"
+#include "lib/get_merkle_leaf_range.h"
 #include "lib/get_preimage.h"
 #include "lib/policy.h"
+#include "lib/scratch.h"
+#include "lib/wallet_key_cache.h"
+#include "lib/wallet_registry.h"
 
 #include "client_commands.h"
 
@@ -51,22 +54,79 @@ static const uint8_t BIP0341_NUMS_PUBKEY[] = {0x02, 0x50, 0x92, 0x9b, 0x74, 0xc1
                                               0x8a, 0x5a, 0x0f, 0x28, 0xec, 0x96, 0xd5, 0x47, 0xbf,
                                               0xee, 0x9a, 0xce, 0x80, 0x3a, 0xc0};
 
+typedef struct {
+    char (*keys_info)[MAX_POLICY_KEY_INFO_LEN + 1];
+    bool has_error;
+} keys_info_fetch_state_t;
+
+// Working memory of handler_register_wallet, allocated in the scratch arena
+typedef struct {
+    union {
+        uint8_t bytes[MAX_WALLET_POLICY_BYTES];
+        policy_node_t parsed;
+    } policy_map;
+    uint8_t policy_map_descriptor[MAX_DESCRIPTOR_TEMPLATE_LENGTH];
+    char keys_info[MAX_N_KEYS_IN_WALLET_POLICY][MAX_POLICY_KEY_INFO_LEN + 1];
+} register_wallet_memory_t;
+
+_Static_assert(sizeof(register_wallet_memory_t) <= SCRATCH_ARENA_SIZE,
+               "The working memory of REGISTER_WALLET must fit in the scratch arena");
+
+// Callback for call_get_merkle_leaf_range; the keys information is only used once the whole range
+// is verified.
+static void store_key_info(void *state,
+                           uint32_t leaf_index,
+                           const uint8_t *element,
+                           size_t element_len) {
+    keys_info_fetch_state_t *fetch_state = (keys_info_fetch_state_t *) state;
+    // the keys information are strings; they are later handled as 0-terminated
+    if (memchr(element, 0, element_len) != NULL) {
+        fetch_state->has_error = true;
+        return;
+    }
+    memcpy(fetch_state->keys_info[leaf_index], element, element_len);
+    fetch_state->keys_info[leaf_index][element_len] = 0;
+}
+
+// Fetches the keys information of all the keys of the wallet policy with a single request, as
+// 0-terminated strings. Split from the handler only to improve stack usage.
+static int __attribute__((noinline))
+fetch_keys_info(dispatcher_context_t *dc,
+                const policy_map_wallet_header_t *wallet_header,
+                char keys_info[static MAX_N_KEYS_IN_WALLET_POLICY][MAX_POLICY_KEY_INFO_LEN + 1]) {
+    keys_info_fetch_state_t state = {.keys_info = keys_info, .has_error = false};
+    uint8_t key_info_str[MAX_POLICY_KEY_INFO_LEN];
+    if (0 > call_get_merkle_leaf_range(dc,
+                                       wallet_header->keys_info_merkle_root,
+                                       wallet_header->n_keys,
+                                       0,
+                                       wallet_header->n_keys,
+                                       key_info_str,
+                                       sizeof(key_info_str),
+                                       store_key_info,
+                                       &state) ||
+        state.has_error) {
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * Validates the input, initializes the hash context and starts accumulating the wallet header in
  * it.
  */
 void handler_register_wallet(dispatcher_context_t *dc, uint8_t protocol_version) {
-    (void) protocol_version;
-
     LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
     policy_map_wallet_header_t wallet_header;
 
     uint8_t wallet_id[32];
-    union {
-        uint8_t bytes[MAX_WALLET_POLICY_BYTES];
-        policy_node_t parsed;
-    } policy_map;
+
+    register_wallet_memory_t *mem = scratch_alloc(sizeof(register_wallet_memory_t));
+    if (mem == NULL) {
+        SEND_SW(dc, SW_BAD_STATE);
+        return;
+    }
 
     size_t n_internal_keys = 0;
 
@@ -76,13 +136,20 @@ void handler_register_wallet(dispatcher_context_t *dc, uint8_t protocol_version)
         return;
     }
 
-    uint8_t policy_map_descriptor[MAX_DESCRIPTOR_TEMPLATE_LENGTH];
-    if (0 > read_and_parse_wallet_policy(dc,
-                                         &dc->read_buffer,
-                                         &wallet_header,
-                                         policy_map_descriptor,
-                                         policy_map.bytes,
-                                         sizeof(policy_map.bytes))) {
+    // in the inline form, the descriptor template and the keys information are in the data
+    uint8_t policy_version;
+    bool is_inline = protocol_version >= PROTOCOL_VERSION_INLINE_WALLET_POLICY &&
+                     buffer_peek(&dc->read_buffer, &policy_version) &&
+                     (policy_version & WALLET_POLICY_INLINE_FLAG) != 0;
+
+    int desc_temp_len = read_and_parse_wallet_policy(dc,
+                                                     &dc->read_buffer,
+                                                     &wallet_header,
+                                                     mem->policy_map_descriptor,
+                                                     mem->policy_map.bytes,
+                                                     sizeof(mem->policy_map.bytes),
+                                                     is_inline ? mem->keys_info : NULL);
+    if (desc_temp_len < 0) {
         SEND_SW(dc, SW_INCORRECT_DATA);
         return;
     }
@@ -94,7 +161,7 @@ void handler_register_wallet(dispatcher_context_t *dc, uint8_t protocol_version)
         return;
     }
 
-    if (count_distinct_keys_info(&policy_map.parsed) != (int) wallet_header.n_keys) {
+    if (count_distinct_keys_info(&mem->policy_map.parsed) != (int) wallet_header.n_keys) {
         PRINTF("The number of keys in descriptor template doesn't match the provided keys\n");
         SEND_SW(dc, SW_INCORRECT_DATA);
         return;
@@ -111,53 +178,33 @@ void handler_register_wallet(dispatcher_context_t *dc, uint8_t protocol_version)
     }
 
     // check if policy is acceptable
-    if (!is_policy_acceptable(&policy_map.parsed)) {
+    if (!is_policy_acceptable(&mem->policy_map.parsed)) {
         PRINTF("Policy is not acceptable\n");
 
         SEND_SW(dc, SW_NOT_SUPPORTED);
         return;
     }
 
-    // make sure that the policy is sane (especially if it contains miniscript)
-    if (0 > is_policy_sane(dc,
-                           &policy_map.parsed,
-                           wallet_header.version,
-                           wallet_header.keys_info_merkle_root,
-                           wallet_header.n_keys)) {
-        PRINTF("Policy is not sane\n");
-
-        SEND_SW(dc, SW_NOT_SUPPORTED);
-        return;
-    }
-
     uint32_t master_key_fingerprint = crypto_get_master_key_fingerprint();
 
-    char keys_info[MAX_N_KEYS_IN_WALLET_POLICY][MAX_POLICY_KEY_INFO_LEN + 1];
     key_type_e keys_type[MAX_N_KEYS_IN_WALLET_POLICY];
     memset(keys_type, 0, sizeof(keys_type));
 
+    // The keys information is fetched once (unless it was inline), and shared by the checks below,
+    // the sanity checks of the policy (through the key cache) and the UI
+    if (!is_inline && 0 > fetch_keys_info(dc, &wallet_header, mem->keys_info)) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return;
+    }
+
     for (size_t cosigner_index = 0; cosigner_index < wallet_header.n_keys; cosigner_index++) {
         /**
-         * Receives and parses the next pubkey info.
-         * Asks the user to validate the pubkey info.
+         * Parses the next pubkey info.
          */
 
-        int key_info_len = call_get_merkle_leaf_element(dc,
-                                                        wallet_header.keys_info_merkle_root,
-                                                        wallet_header.n_keys,
-                                                        cosigner_index,
-                                                        (uint8_t *) keys_info[cosigner_index],
-                                                        MAX_POLICY_KEY_INFO_LEN);
-
-        if (key_info_len < 0) {
-            SEND_SW(dc, SW_INCORRECT_DATA);
-            return;
-        }
-
-        keys_info[cosigner_index][key_info_len] = 0;
-
         // Make a sub-buffer for the pubkey info
-        buffer_t key_info_buffer = buffer_create(keys_info[cosigner_index], key_info_len);
+        buffer_t key_info_buffer =
+            buffer_create(mem->keys_info[cosigner_index], strlen(mem->keys_info[cosigner_index]));
 
         policy_map_key_info_t key_info;
         if (parse_policy_map_key_info(&key_info_buffer, &key_info, wallet_header.version) == -1) {
@@ -166,6 +213,11 @@ void handler_register_wallet(dispatcher_context_t *dc, uint8_t protocol_version)
             return;
         }
 
+        wallet_key_cache_add_key_info(wallet_header.keys_info_merkle_root,
+                                      wallet_header.version,
+                                      cosigner_index,
+                                      &key_info);
+
         if (read_u32_be(key_info.ext_pubkey.version, 0) != BIP32_PUBKEY_VERSION) {
             PRINTF("Invalid pubkey version. Wrong network?\n");
             SEND_SW(dc, SW_INCORRECT_DATA);
@@ -193,10 +245,10 @@ void handler_register_wallet(dispatcher_context_t *dc, uint8_t protocol_version)
                 // we verify that we can actually generate the same pubkey
                 serialized_extended_pubkey_t pubkey_derived;
                 int serialized_pubkey_len =
-                    get_extended_pubkey_at_path(key_info.master_key_derivation,
-                                                key_info.master_key_derivation_len,
-                                                BIP32_PUBKEY_VERSION,
-                                                &pubkey_derived);
+                    get_wallet_extended_pubkey_at_path(key_info.master_key_derivation,
+                                                       key_info.master_key_derivation_len,
+                                                       BIP32_PUBKEY_VERSION,
+                                                       &pubkey_derived);
                 if (serialized_pubkey_len == -1) {
                     SEND_SW(dc, SW_BAD_STATE);
                     return;
@@ -210,6 +262,18 @@ void handler_register_wallet(dispatcher_context_t *dc, uint8_t protocol_version)
         }
     }
 
+    // make sure that the policy is sane (especially if it contains miniscript)
+    if (0 > is_policy_sane(dc,
+                           &mem->policy_map.parsed,
+                           wallet_header.version,
+                           wallet_header.keys_info_merkle_root,
+                           wallet_header.n_keys)) {
+        PRINTF("Policy is not sane\n");
+
+        SEND_SW(dc, SW_NOT_SUPPORTED);
+        return;
+    }
+
     if (n_internal_keys < 1) {
         // Unclear if there is any use case for registering policies with no internal keys.
         // We disallow that, might reconsider in future versions if needed.
@@ -225,14 +289,14 @@ void handler_register_wallet(dispatcher_context_t *dc, uint8_t protocol_version)
 
 #ifdef HAVE_BAGL
     // show wallet header
-    if (!ui_display_register_wallet(dc, &wallet_header, (char *) policy_map_descriptor)) {
+    if (!ui_display_register_wallet(dc, &wallet_header, (char *) mem->policy_map_descriptor)) {
         SEND_SW(dc, SW_DENY);
         return;
     }
     // show each cosigner
     for (size_t cosigner_index = 0; cosigner_index < wallet_header.n_keys; cosigner_index++) {
         if (!ui_display_policy_map_cosigner_pubkey(dc,
-                                                   keys_info[cosigner_index],
+                                                   mem->keys_info[cosigner_index],
                                                    cosigner_index,  // 1-indexed for the UI
                                                    wallet_header.n_keys,
                                                    keys_type[cosigner_index])) {
@@ -244,8 +308,8 @@ void handler_register_wallet(dispatcher_context_t *dc, uint8_t protocol_version)
     // show wallet policy
     if (!ui_display_register_wallet_policy(dc,
                                            &wallet_header,
-                                           (char *) policy_map_descriptor,
-                                           &keys_info,
+                                           (char *) mem->policy_map_descriptor,
+                                           &mem->keys_info,
                                            &keys_type)) {
         SEND_SW(dc, SW_DENY);
         return;
@@ -270,6 +334,15 @@ void handler_register_wallet(dispatcher_context_t *dc, uint8_t protocol_version)
 
     compute_wallet_hmac(wallet_id, response.hmac);
 
+#ifdef HAVE_WALLET_REGISTRY
+    // remember the registered wallet policy, so that it can be used without the hmac
+    wallet_registry_add(wallet_id,
+                        master_key_fingerprint,
+                        &wallet_header,
+                        mem->policy_map.bytes,
+                        desc_temp_len);
+#endif
+
     SEND_RESPONSE(dc, &response, sizeof(response), SW_OK);
 }
 
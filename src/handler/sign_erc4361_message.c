@@ -10,11 +10,10 @@
 #include "../crypto.h"
 #include "../ui/display.h"
 #include "../ui/menu.h"
-#include "lib/get_merkle_leaf_element.h"
+#include "lib/get_message_chunks.h"
 
 #include "handlers.h"
 
-#define MESSAGE_CHUNK_SIZE    64
 #define MAX_DOMAIN_LENGTH     64
 #define MAX_URI_LENGTH        64
 #define MAX_VERSION_LENGTH    5
@@ -27,50 +26,113 @@ static unsigned char const BSM_SIGN_MAGIC[] = {'\x18', 'B', 'i', 't', 'c', 'o',
                                                's',    's', 'a', 'g', 'e', ':', '\n'};
 
 typedef struct {
-    const char *name;
+    const char *name;  // prefix of the line containing the field; empty for domain and address
     size_t name_length;
     char *output;
     size_t max_length;
 } ERC4361Field;
 
-static int parse_field(const uint8_t *buffer, size_t buffer_len, char *output, size_t max_length) {
-    // Add NULL check
-    if (buffer == NULL || output == NULL) {
-        return -1;
-    }
+// Fields that are identified by their line, rather than by a prefix
+#define FIELD_DOMAIN      0
+#define FIELD_ADDRESS     1
+#define N_LINE_FIELDS     2
+#define FIRST_FIELDS_LINE 4  // lines 2 and 3 are the empty line and the statement
 
-    // Check buffer_len to prevent buffer overflow
-    if (buffer_len == 0 || max_length == 0) {
-        return -1;
-    }
+#define NO_ACTIVE_FIELD (-1)
 
-    size_t field_length = 0;
-    // Ensure we don't exceed buffer_len or max_length-1 (for null terminator)
-    const size_t max_field_length = (buffer_len < max_length - 1) ? buffer_len : max_length - 1;
+/**
+ * State of the incremental ERC-4361 parser. The message is consumed one byte at a time, so that
+ * each chunk is parsed as soon as it is received, without buffering lines.
+ */
+typedef struct {
+    ERC4361Field *fields;
+    size_t num_fields;
+    uint32_t current_line;
+    size_t column;              // position of the next byte in the current line
+    uint32_t candidates;        // bitmask of the prefixed fields still matching the current line
+    int active_field;           // index of the field being copied, or NO_ACTIVE_FIELD
+    size_t active_field_length; // number of characters copied to the active field
+    bool parsing_done;          // true once a '\0' is found; the rest of the message is ignored
+} erc4361_parser_t;
+
+static void parser_start_field(erc4361_parser_t *parser, int field_index) {
+    parser->active_field = field_index;
+    parser->active_field_length = 0;
+    parser->fields[field_index].output[0] = '\0';
+}
 
-    while (field_length < max_field_length) {
-        // Safe to dereference buffer here as we've checked both pointer and bounds
-        if (buffer[field_length] == '\n' || buffer[field_length] == '\0' ||
-            buffer[field_length] == ' ') {
-            break;
+static void parser_start_line(erc4361_parser_t *parser) {
+    parser->column = 0;
+    parser->candidates = 0;
+    parser->active_field = NO_ACTIVE_FIELD;
+
+    if (parser->current_line == 0) {
+        parser_start_field(parser, FIELD_DOMAIN);
+    } else if (parser->current_line == 1) {
+        parser_start_field(parser, FIELD_ADDRESS);
+    } else if (parser->current_line >= FIRST_FIELDS_LINE) {
+        for (size_t i = N_LINE_FIELDS; i < parser->num_fields; i++) {
+            parser->candidates |= 1U << i;
         }
-        field_length++;
     }
+}
 
-    // Safe to use memcpy as we've validated both source and destination
-    memcpy(output, buffer, field_length);
-    output[field_length] = '\0';
+static void parser_consume_byte(erc4361_parser_t *parser, uint8_t c) {
+    if (c == '\0') {
+        parser->parsing_done = true;
+        PRINTF("Parsing done\n");
+        return;
+    }
+    if (c == '\n') {
+        ++parser->current_line;
+        parser_start_line(parser);
+        return;
+    }
 
-    return (int) field_length;  // Safe cast as field_length is bounded by max_field_length
+    if (parser->active_field != NO_ACTIVE_FIELD) {
+        ERC4361Field *field = &parser->fields[parser->active_field];
+        if (c == ' ' || parser->active_field_length >= field->max_length - 1) {
+            // the value ends at the first space, or is truncated to the size of the output
+            PRINTF("%s%s\n", field->name, field->output);
+            parser->active_field = NO_ACTIVE_FIELD;
+        } else {
+            field->output[parser->active_field_length++] = (char) c;
+            field->output[parser->active_field_length] = '\0';
+        }
+    } else if (parser->candidates != 0) {
+        for (size_t i = N_LINE_FIELDS; i < parser->num_fields; i++) {
+            ERC4361Field *field = &parser->fields[i];
+            if ((parser->candidates & (1U << i)) == 0) {
+                continue;
+            }
+            if (field->name[parser->column] != (char) c) {
+                parser->candidates &= ~(1U << i);
+            } else if (parser->column + 1 == field->name_length) {
+                // the whole prefix matched; the value starts with the next byte
+                parser->candidates = 0;
+                parser_start_field(parser, (int) i);
+                break;
+            }
+        }
+    }
+    ++parser->column;
 }
 
-static bool has_newline(const char *buffer, size_t length) {
-    for (size_t i = 0; i < length; i++) {
-        if (buffer[i] == '\n') {
-            return true;
-        }
+/**
+ * Callback for call_get_message_chunks: each chunk is parsed as soon as it is received, in the same
+ * loop that adds it to the message digests. The parsed fields are only shown once
+ * call_get_message_chunks verified all the chunks.
+ */
+static void erc4361_message_callback(void *state,
+                                     size_t chunk_index,
+                                     const uint8_t *chunk,
+                                     size_t chunk_len) {
+    (void) chunk_index;
+    erc4361_parser_t *parser = (erc4361_parser_t *) state;
+
+    for (size_t i = 0; i < chunk_len && !parser->parsing_done; i++) {
+        parser_consume_byte(parser, chunk[i]);
     }
-    return false;
 }
 
 void handler_sign_erc4361_message(dispatcher_context_t *dc, uint8_t protocol_version) {
@@ -80,22 +142,24 @@ void handler_sign_erc4361_message(dispatcher_context_t *dc, uint8_t protocol_ver
         return;
     }
 
-    (void) protocol_version;
-
     uint8_t bip32_path_len;
     uint32_t bip32_path[MAX_BIP32_PATH_STEPS];
+    uint8_t chunks_per_leaf = 1;
     uint64_t message_length;
     uint8_t message_merkle_root[32];
 
     if (!buffer_read_u8(&dc->read_buffer, &bip32_path_len) ||
         !buffer_read_bip32_path(&dc->read_buffer, bip32_path, bip32_path_len) ||
+        (protocol_version >= PROTOCOL_VERSION_CHUNKS_PER_LEAF &&
+         !buffer_read_u8(&dc->read_buffer, &chunks_per_leaf)) ||
         !buffer_read_varint(&dc->read_buffer, &message_length) ||
         !buffer_read_bytes(&dc->read_buffer, message_merkle_root, 32)) {
         SAFE_SEND_SW(dc, SW_WRONG_DATA_LENGTH);
         return;
     }
 
-    if (bip32_path_len > MAX_BIP32_PATH_STEPS || message_length >= (1LL << 32)) {
+    if (bip32_path_len > MAX_BIP32_PATH_STEPS || message_length >= (1LL << 32) ||
+        chunks_per_leaf == 0 || chunks_per_leaf > MAX_CHUNKS_PER_LEAF) {
         SAFE_SEND_SW(dc, SW_INCORRECT_DATA);
         return;
     }
@@ -113,12 +177,11 @@ void handler_sign_erc4361_message(dispatcher_context_t *dc, uint8_t protocol_ver
     crypto_hash_update(&bsm_digest_context.header, BSM_SIGN_MAGIC, sizeof(BSM_SIGN_MAGIC));
     crypto_hash_update_varint(&bsm_digest_context.header, message_length);
 
-    size_t n_chunks = (message_length + MESSAGE_CHUNK_SIZE - 1) / MESSAGE_CHUNK_SIZE;
-
-    uint8_t message_chunk[MESSAGE_CHUNK_SIZE];
-    uint64_t total_bytes_read = 0;
-    uint64_t line_start = 0;
-    uint32_t current_line = 0;
+    // the leaves of the message are added to both digests
+    crypto_hash_tee_t digests;
+    crypto_hash_tee_init(&digests);
+    crypto_hash_tee_add(&digests, &msg_hash_context.header);
+    crypto_hash_tee_add(&digests, &bsm_digest_context.header);
 
     char domain[MAX_DOMAIN_LENGTH] = {0};
     char address[MAX_ADDRESS_LENGTH_STR] = {0};
@@ -128,130 +191,39 @@ void handler_sign_erc4361_message(dispatcher_context_t *dc, uint8_t protocol_ver
     char issued_at[MAX_DATETIME_LENGTH] = {0};
     char expiration_time[MAX_DATETIME_LENGTH] = {0};
 
-    char leftover[MESSAGE_CHUNK_SIZE] = {0};
-    size_t leftover_len = 0;
-    uint8_t parsing_buffer[128] = {0};
-    size_t parsing_buffer_len = 0;
-
-    bool parsing_done = false;
-
-    unsigned int chunk_index = 0;
     ERC4361Field fields[] = {
+        [FIELD_DOMAIN] = {"", 0, domain, MAX_DOMAIN_LENGTH},
+        [FIELD_ADDRESS] = {"", 0, address, MAX_ADDRESS_LENGTH_STR},
         {"URI: ", 5, uri, MAX_URI_LENGTH},
         {"Version: ", 9, version, MAX_VERSION_LENGTH},
         {"Nonce: ", 7, nonce, MAX_NONCE_LENGTH},
         {"Issued At: ", 11, issued_at, MAX_DATETIME_LENGTH},
         {"Expiration Time: ", 17, expiration_time, MAX_DATETIME_LENGTH},
     };
-    const size_t num_fields = sizeof(fields) / sizeof(fields[0]);
-
-    while ((chunk_index < n_chunks || total_bytes_read < message_length) && !parsing_done) {
-        PRINTF("Chunk index: %u\n", chunk_index);
-        int chunk_len = 0;
-        if (!has_newline(leftover, leftover_len) && chunk_index < n_chunks) {
-            chunk_len = call_get_merkle_leaf_element(dc,
-                                                     message_merkle_root,
-                                                     n_chunks,
-                                                     chunk_index,
-                                                     message_chunk,
-                                                     sizeof(message_chunk));
-
-            if (chunk_len < 0 || (chunk_len != MESSAGE_CHUNK_SIZE && chunk_index != n_chunks - 1)) {
-                SAFE_SEND_SW(dc, SW_BAD_STATE);  // should never happen
-                return;
-            }
-            crypto_hash_update(&msg_hash_context.header, message_chunk, chunk_len);
-            crypto_hash_update(&bsm_digest_context.header, message_chunk, chunk_len);
 
-            chunk_index++;  // Only increment when a new chunk is fetched
-        }
-        PRINTF("Total bytes read: %llu\n", total_bytes_read);
-
-        // Copy leftover and new chunk into parsing buffer
-        memset(parsing_buffer, 0, sizeof(parsing_buffer));
-        memcpy(parsing_buffer, leftover, leftover_len);
-        size_t bytes_to_copy = MIN((size_t) chunk_len, sizeof(parsing_buffer) - leftover_len);
-        memcpy(parsing_buffer + leftover_len, message_chunk, bytes_to_copy);
-        parsing_buffer_len = leftover_len + bytes_to_copy;
-        leftover_len = 0;
-
-        if (!has_newline((const char *) parsing_buffer, parsing_buffer_len) &&
-            chunk_index < n_chunks - 1) {
-            PRINTF("No newline found in parsing buffer\n");
-            leftover_len = parsing_buffer_len - (total_bytes_read - line_start);
-            if (leftover_len <= MESSAGE_CHUNK_SIZE) {
-                memcpy(leftover, parsing_buffer + parsing_buffer_len - leftover_len, leftover_len);
-            } else {
-                PRINTF("Error: line length exceeds 128 bytes\n");
-                SAFE_SEND_SW(dc, SW_INCORRECT_DATA);
-                return;
-            }
-            continue;
-        }
-
-        if (current_line == 0) {
-            int domain_length =
-                parse_field(parsing_buffer, parsing_buffer_len, domain, MAX_DOMAIN_LENGTH);
-            if (domain_length < 0) {
-                SAFE_SEND_SW(dc, SW_BAD_STATE);
-                return;
-            }
-            total_bytes_read += domain_length;
-            PRINTF("Domain: %s\n", domain);
-        }
-
-        if (current_line == 1) {
-            int address_length =
-                parse_field(parsing_buffer, parsing_buffer_len, address, MAX_ADDRESS_LENGTH_STR);
-            if (address_length < 0) {
-                SAFE_SEND_SW(dc, SW_BAD_STATE);
-                return;
-            }
-            total_bytes_read += address_length;
-            PRINTF("Address: %s\n", address);
-        }
-
-        // Lines 2 and 3 are empty
-        if (current_line >= 4) {
-            for (size_t i = 0; i < num_fields; i++) {
-                ERC4361Field *field = &fields[i];
-                if (parsing_buffer_len >= field->name_length &&
-                    memcmp(parsing_buffer, field->name, field->name_length) == 0) {
-                    int field_length = parse_field(parsing_buffer + field->name_length,
-                                                   parsing_buffer_len - field->name_length,
-                                                   field->output,
-                                                   field->max_length);
-                    if (field_length < 0) {
-                        SAFE_SEND_SW(dc, SW_BAD_STATE);
-                        return;
-                    }
-                    total_bytes_read += field_length + field->name_length;
-                    PRINTF("%s%s\n", field->name, field->output);
-                    break;
-                }
-            }
-        }
-
-        // Iterate on the rest of the line
-        for (size_t j = total_bytes_read - line_start; j < parsing_buffer_len; j++) {
-            total_bytes_read++;
-            PRINTF("Total bytes read: %llu\n", total_bytes_read);
-
-            if (parsing_buffer[j] == '\n') {
-                // Save leftover for next chunk
-                leftover_len = parsing_buffer_len - (total_bytes_read - line_start);
-                memcpy(leftover, parsing_buffer + parsing_buffer_len - leftover_len, leftover_len);
-                current_line++;
-                line_start = total_bytes_read;
-                break;
-            }
-
-            if (total_bytes_read >= message_length || parsing_buffer[j] == '\0') {
-                parsing_done = true;
-                PRINTF("Parsing done: %d\n", parsing_done);
-                break;
-            }
-        }
+    erc4361_parser_t parser = {.fields = fields,
+                               .num_fields = sizeof(fields) / sizeof(fields[0]),
+                               .current_line = 0,
+                               .parsing_done = false};
+    parser_start_line(&parser);
+
+    message_chunks_t message_chunks = {
+        .merkle_root = message_merkle_root,
+        .n_chunks = (message_length + MESSAGE_CHUNK_SIZE - 1) / MESSAGE_CHUNK_SIZE,
+        .chunks_per_leaf = chunks_per_leaf,
+        .message_length = message_length,
+        .digests = &digests,
+        .callback = erc4361_message_callback,
+        .callback_state = &parser};
+
+    // the whole message is fetched with a single range request
+    int ret = call_get_message_chunks(dc, &message_chunks);
+    if (ret == MESSAGE_CHUNKS_ERROR_REQUEST) {
+        SAFE_SEND_SW(dc, SW_BAD_STATE);  // should never happen
+        return;
+    } else if (ret < 0) {
+        SAFE_SEND_SW(dc, SW_INCORRECT_DATA);
+        return;
     }
 
     uint8_t message_hash[32];
@@ -289,7 +261,8 @@ void handler_sign_erc4361_message(dispatcher_context_t *dc, uint8_t protocol_ver
                                                          bsm_digest,
                                                          NULL,
                                                          sig,
-                                                         &info);
+                                                         &info,
+                                                         false);
     if (sig_len < 0) {
         // unexpected error when signing
         SAFE_SEND_SW(dc, SW_BAD_STATE);
@@ -26,7 +26,7 @@
 #include "../crypto.h"
 #include "../ui/display.h"
 #include "../ui/menu.h"
-#include "lib/get_merkle_leaf_element.h"
+#include "lib/get_message_chunks.h"
 
 #include "handlers.h"
 
@@ -37,10 +37,47 @@ static unsigned char const BSM_SIGN_MAGIC[] = {'\x18', 'B', 'i', 't', 'c', 'o',
                                                'S',    'i', 'g', 'n', 'e', 'd', ' ', 'M', 'e',
                                                's',    's', 'a', 'g', 'e', ':', '\n'};
 
+typedef struct {
+    // if not NULL, the message is also copied here, so that it can be displayed without fetching
+    // it again; it must have room for MAX_DISPLAYBLE_CHUNK_NUMBER chunks
+    uint8_t* display_buffer;
+    bool printable;
+} message_display_state_t;
+
+// Callback for call_get_message_chunks
+static void message_chunk_callback(void* state_ptr,
+                                   size_t chunk_index,
+                                   const uint8_t* chunk,
+                                   size_t chunk_len) {
+    message_display_state_t* state = (message_display_state_t*) state_ptr;
+
+    if (state->printable) {
+        for (size_t j = 0; j < chunk_len; j++) {
+            if (chunk[j] < 0x20 || chunk[j] > 0x7E) {
+                state->printable = false;
+                break;
+            }
+        }
+    }
+
+    size_t offset = chunk_index * MESSAGE_CHUNK_SIZE;
+    if (state->display_buffer != NULL &&
+        offset + chunk_len <= MAX_DISPLAYBLE_CHUNK_NUMBER * MESSAGE_CHUNK_SIZE) {
+        memcpy(state->display_buffer + offset, chunk, chunk_len);
+    }
+}
+
+// Shows the message, that was already fetched and verified; going back and forth between the
+// pages does not require any further request to the client.
 static bool display_message_content_and_confirm(dispatcher_context_t* dc,
-                                                uint8_t* message_merkle_root,
-                                                size_t n_chunks,
+                                                const uint8_t* message,
+                                                size_t message_length,
                                                 uint8_t* path_str) {
+    size_t n_chunks = (message_length + MESSAGE_CHUNK_SIZE - 1) / MESSAGE_CHUNK_SIZE;
+    if (n_chunks == 0 || n_chunks > MAX_DISPLAYBLE_CHUNK_NUMBER) {
+        return false;
+    }
+
     reset_streaming_index();
     while (get_streaming_index() <= (n_chunks - 1) / MESSAGE_CHUNK_PER_DISPLAY) {
         uint8_t message_chunk[MESSAGE_MAX_DISPLAY_SIZE];
@@ -57,28 +94,11 @@ static bool display_message_content_and_confirm(dispatcher_context_t* dc,
         total_chunk_len += offset;
 
         // each UX display will show MESSAGE_CHUNK_PER_DISPLAY chunks
-        size_t group_start_index = get_streaming_index() * MESSAGE_CHUNK_PER_DISPLAY;
-
-        for (int j = 0;
-             j < MESSAGE_CHUNK_PER_DISPLAY &&
-             (group_start_index + j) < (unsigned int) n_chunks;  // make sure not to overflow
-             j++) {
-            offset += j * MESSAGE_CHUNK_SIZE;
-
-            int chunk_len =
-                call_get_merkle_leaf_element(dc,
-                                             message_merkle_root,
-                                             n_chunks,
-                                             get_streaming_index() * MESSAGE_CHUNK_PER_DISPLAY + j,
-                                             message_chunk + offset,
-                                             MESSAGE_CHUNK_SIZE);
-
-            total_chunk_len += chunk_len;
-
-            if (chunk_len < MESSAGE_CHUNK_SIZE) {
-                break;
-            }
-        }
+        size_t group_start = get_streaming_index() * MESSAGE_CHUNK_PER_DISPLAY * MESSAGE_CHUNK_SIZE;
+        size_t group_len = MIN(MESSAGE_CHUNK_PER_DISPLAY * MESSAGE_CHUNK_SIZE,
+                               message_length - group_start);
+        memcpy(message_chunk + offset, message + group_start, group_len);
+        total_chunk_len += group_len;
 
         if ((get_streaming_index() + 1) * MESSAGE_CHUNK_PER_DISPLAY < n_chunks) {
             message_chunk[total_chunk_len] = '.';
@@ -102,23 +122,25 @@ static bool display_message_content_and_confirm(dispatcher_context_t* dc,
 }
 
 void handler_sign_message(dispatcher_context_t* dc, uint8_t protocol_version) {
-    (void) protocol_version;
-
     uint8_t bip32_path_len;
     uint32_t bip32_path[MAX_BIP32_PATH_STEPS];
+    uint8_t chunks_per_leaf = 1;
     uint64_t message_length;
     uint8_t message_merkle_root[32];
     bool printable = true;
 
     if (!buffer_read_u8(&dc->read_buffer, &bip32_path_len) ||
         !buffer_read_bip32_path(&dc->read_buffer, bip32_path, bip32_path_len) ||
+        (protocol_version >= PROTOCOL_VERSION_CHUNKS_PER_LEAF &&
+         !buffer_read_u8(&dc->read_buffer, &chunks_per_leaf)) ||
         !buffer_read_varint(&dc->read_buffer, &message_length) ||
         !buffer_read_bytes(&dc->read_buffer, message_merkle_root, 32)) {
         SEND_SW(dc, SW_WRONG_DATA_LENGTH);
         return;
     }
 
-    if (bip32_path_len > MAX_BIP32_PATH_STEPS || message_length >= (1LL << 32)) {
+    if (bip32_path_len > MAX_BIP32_PATH_STEPS || message_length >= (1LL << 32) ||
+        chunks_per_leaf == 0 || chunks_per_leaf > MAX_CHUNKS_PER_LEAF) {
         SEND_SW(dc, SW_INCORRECT_DATA);
         return;
     }
@@ -136,37 +158,41 @@ void handler_sign_message(dispatcher_context_t* dc, uint8_t protocol_version) {
     crypto_hash_update(&bsm_digest_context.header, BSM_SIGN_MAGIC, sizeof(BSM_SIGN_MAGIC));
     crypto_hash_update_varint(&bsm_digest_context.header, message_length);
 
-    size_t n_chunks = (message_length + MESSAGE_CHUNK_SIZE - 1) / MESSAGE_CHUNK_SIZE;
+    // the leaves of the message are added to both digests
+    crypto_hash_tee_t digests;
+    crypto_hash_tee_init(&digests);
+    crypto_hash_tee_add(&digests, &msg_hash_context.header);
+    crypto_hash_tee_add(&digests, &bsm_digest_context.header);
 
-    if (n_chunks > MAX_DISPLAYBLE_CHUNK_NUMBER) {
+    if (message_length > MAX_DISPLAYBLE_CHUNK_NUMBER * MESSAGE_CHUNK_SIZE) {
         printable = false;
     }
 
-    for (unsigned int i = 0; i < n_chunks; i++) {
-        uint8_t message_chunk[MESSAGE_CHUNK_SIZE];
-        int chunk_len = call_get_merkle_leaf_element(dc,
-                                                     message_merkle_root,
-                                                     n_chunks,
-                                                     i,
-                                                     message_chunk,
-                                                     sizeof(message_chunk));
-
-        if (chunk_len < 0 || (chunk_len != MESSAGE_CHUNK_SIZE && i != n_chunks - 1)) {
-            SEND_SW(dc, SW_BAD_STATE);  // should never happen
-            return;
-        }
-
-        if (printable) {
-            for (int j = 0; j < chunk_len; j++) {
-                if (message_chunk[j] < 0x20 || message_chunk[j] > 0x7E) {
-                    printable = false;
-                    break;
-                }
-            }
-        }
-        crypto_hash_update(&msg_hash_context.header, message_chunk, chunk_len);
-        crypto_hash_update(&bsm_digest_context.header, message_chunk, chunk_len);
+    // the chunks of a message short enough to be displayed are kept, so that each chunk is only
+    // fetched once
+    uint8_t message[MAX_DISPLAYBLE_CHUNK_NUMBER * MESSAGE_CHUNK_SIZE];
+
+    message_display_state_t display_state = {.display_buffer = printable ? message : NULL,
+                                             .printable = printable};
+    message_chunks_t message_chunks = {
+        .merkle_root = message_merkle_root,
+        .n_chunks = (message_length + MESSAGE_CHUNK_SIZE - 1) / MESSAGE_CHUNK_SIZE,
+        .chunks_per_leaf = chunks_per_leaf,
+        .message_length = message_length,
+        .digests = &digests,
+        .callback = message_chunk_callback,
+        .callback_state = &display_state};
+
+    // the message digests are only used after call_get_message_chunks verified all the chunks
+    int ret = call_get_message_chunks(dc, &message_chunks);
+    if (ret == MESSAGE_CHUNKS_ERROR_REQUEST) {
+        SEND_SW(dc, SW_BAD_STATE);  // should never happen
+        return;
+    } else if (ret < 0) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return;
     }
+    printable = display_state.printable;
 
     uint8_t message_hash[32];
     uint8_t bsm_digest[32];
@@ -184,8 +210,8 @@ void handler_sign_message(dispatcher_context_t* dc, uint8_t protocol_version) {
     ui_pre_processing_message();
     if (printable) {
         if (!display_message_content_and_confirm(dc,
-                                                 message_merkle_root,
-                                                 n_chunks,
+                                                 message,
+                                                 message_length,
                                                  (uint8_t*) path_str)) {
             SEND_SW(dc, SW_DENY);
             return;
@@ -205,7 +231,8 @@ void handler_sign_message(dispatcher_context_t* dc, uint8_t protocol_version) {
                                                          bsm_digest,
                                                          NULL,
                                                          sig,
-                                                         &info);
+                                                         &info,
+                                                         false);
     if (sig_len < 0) {
         // unexpected error when signing
         SEND_SW(dc, SW_BAD_STATE);
@@ -20,7 +20,10 @@
 #include "lib_standard_app/crypto_helpers.h"
 
 #include "../boilerplate/dispatcher.h"
+#include "../boilerplate/io.h"
+#include "../boilerplate/perf_stats.h"
 #include "../boilerplate/sw.h"
+#include "../boilerplate/trace.h"
 #include "../common/bitvector.h"
 #include "../common/merkle.h"
 #include "../common/psbt.h"
@@ -33,6 +36,7 @@
 #include "../commands.h"
 #include "../constants.h"
 #include "../crypto.h"
+#include "../debug-helpers/log.h"
 #include "../ui/display.h"
 #include "../ui/menu.h"
 
@@ -40,11 +44,19 @@
 
 #include "lib/policy.h"
 #include "lib/check_merkle_tree_sorted.h"
-#include "lib/get_preimage.h"
 #include "lib/get_merkleized_map.h"
 #include "lib/get_merkleized_map_value.h"
-#include "lib/get_merkle_leaf_element.h"
+#include "lib/get_preimage.h"
+#include "lib/hash_pool.h"
+#include "lib/hint_merkle_leaves.h"
+#include "lib/merkle_leaf_table.h"
 #include "lib/psbt_parse_rawtx.h"
+#include "lib/stream_preimage.h"
+#include "lib/taproot_key_cache.h"
+#include "lib/scratch.h"
+#include "lib/validated_psbt_cache.h"
+#include "lib/wallet_key_cache.h"
+#include "lib/wallet_policy_cache.h"
 
 #include "handlers.h"
 
@@ -56,35 +68,43 @@
 #include "../swap/handle_swap_sign_transaction.h"
 
 // common info that applies to either the current input or the current output
+// The fields are ordered by alignment, and the flags are bitfields, as several of these structs
+// are on the stack while signing.
 typedef struct {
     merkleized_map_commitment_t map;
 
-    bool unexpected_pubkey_error;  // Set to true if the pubkey in the keydata of
-                                   // PSBT_{IN,OUT}_BIP32_DERIVATION or
-                                   // PSBT_{IN,OUT}_TAP_BIP32_DERIVATION is not the correct length.
-
-    bool placeholder_found;  // Set to true if a matching placeholder is found in the input info
-
-    bool is_change;
-    int address_index;
+    uint32_t address_index;
 
     // For an output, its scriptPubKey
     // for an input, the prevout's scriptPubKey (either from the non-witness-utxo, or from the
     // witness-utxo)
-
-    uint8_t scriptPubKey[MAX_OUTPUT_SCRIPTPUBKEY_LEN];
     size_t scriptPubKey_len;
+    uint8_t scriptPubKey[MAX_OUTPUT_SCRIPTPUBKEY_LEN];
+
+    bool unexpected_pubkey_error : 1;  // Set to true if the pubkey in the keydata of
+                                       // PSBT_{IN,OUT}_BIP32_DERIVATION or
+                                       // PSBT_{IN,OUT}_TAP_BIP32_DERIVATION is not the correct
+                                       // length.
+
+    bool placeholder_found : 1;  // Set to true if a matching placeholder is found in the input info
+
+    bool is_change : 1;
 } in_out_info_t;
 
 typedef struct {
     in_out_info_t in_out;
-    bool has_witnessUtxo;
-    bool has_nonWitnessUtxo;
-    bool has_redeemScript;
-    bool has_sighash_type;
 
     uint64_t prevout_amount;  // the value of the prevout of the current input
 
+    uint32_t sighash_type;
+
+    uint8_t script_len;
+
+    bool has_witnessUtxo : 1;
+    bool has_nonWitnessUtxo : 1;
+    bool has_redeemScript : 1;
+    bool has_sighash_type : 1;
+
     // we no longer need the script when we compute the taptree hash right before a taproot key-path
     // spending; therefore, we reuse the same memory
     union {
@@ -92,29 +112,55 @@ typedef struct {
         uint8_t script[MAX_PREVOUT_SCRIPTPUBKEY_LEN];
         uint8_t taptree_hash[32];
     };
+} input_info_t;
 
-    size_t script_len;
+// Maximum number of internal inputs whose record is kept from preprocess_inputs for the signing
+// phase; the data of the following internal inputs is fetched again when signing them
+#define N_INPUT_RECORDS 16
 
-    uint32_t sighash_type;
-} input_info_t;
+#define INPUT_RECORD_IS_CHANGE        0x01
+#define INPUT_RECORD_HAS_SIGHASH_TYPE 0x02  // sighash_type was read from PSBT_IN_SIGHASH_TYPE
+
+// What was found about an internal input while validating it, that sign_transaction_input would
+// otherwise fetch again from its map: the prevout's scriptPubKey (from the non-witness utxo or the
+// witness utxo), the sighash type, and the derivation of the placeholder used in preprocessing.
+// The keys of the map are returned with the map itself, therefore has_* are not kept.
+typedef struct {
+    uint32_t address_index;
+    uint8_t flags;         // INPUT_RECORD_* flags
+    uint8_t sighash_type;  // all the supported sighash types fit in one byte
+    uint8_t scriptPubKey_len;
+    uint8_t scriptPubKey[MAX_PREVOUT_SCRIPTPUBKEY_LEN];
+} input_record_t;
 
 typedef struct {
     in_out_info_t in_out;
     uint64_t value;
 } output_info_t;
 
+// Maximum number of internal inputs with SIGHASH_SINGLE whose output is hashed in
+// preprocess_outputs; the outputs of the following ones are fetched again when signing them
+#define N_SINGLE_OUTPUT_HASHES 4
+
+// Only the parts of the extended pubkey of the key that derive the child keys are kept
 typedef struct {
     policy_node_key_placeholder_t placeholder;
     int cur_index;
     uint32_t fingerprint;
-    uint8_t key_derivation_length;
     uint32_t key_derivation[MAX_BIP32_PATH_STEPS];
-    serialized_extended_pubkey_t pubkey;
-    bool is_tapscript;         // true if signing with a BIP342 tapleaf script path spend
+    uint8_t key_derivation_length;
+    // root of the Merkle tree of the keys of the wallet policy, that identifies the derivations of
+    // the key in the wallet_key_cache
+    const uint8_t *keys_root;
+    bool is_tapscript : 1;  // true if signing with a BIP342 tapleaf script path spend
+    uint8_t compressed_pubkey[33];
+    uint8_t chain_code[32];
     uint8_t tapleaf_hash[32];  // only used for tapscripts
 } placeholder_info_t;
 
 // Cache for partial hashes during segwit signing (avoid quadratic hashing for segwit transactions)
+// Only the hashes needed by the segwit version of the wallet policy are computed: none for legacy
+// policies, sha_amounts and sha_scriptpubkeys only for taproot policies.
 typedef struct {
     uint8_t sha_prevouts[32];
     uint8_t sha_amounts[32];
@@ -123,11 +169,55 @@ typedef struct {
     uint8_t sha_outputs[32];
 } segwit_hashes_t;
 
+// Optional mode of SIGN_PSBT, in the byte following the wallet hmac in the request
+#define SIGN_PSBT_MODE_SIGN       0x00  // validate, confirm and sign all the internal inputs
+#define SIGN_PSBT_MODE_CHECKPOINT 0x01  // validate and confirm, then return a checkpoint
+#define SIGN_PSBT_MODE_RESUME     0x02  // sign a range of the inputs, from a checkpoint
+#define SIGN_PSBT_MODE_BATCH      0x03  // validate, confirm and sign several PSBTs
+
+// Flag that can be set in the mode byte: the ECDSA signatures are ground until R is low
+#define SIGN_PSBT_FLAG_LOW_R 0x80
+
+// How the PSBTs of a batch are shown to the user, in the byte following SIGN_PSBT_MODE_BATCH
+#define SIGN_PSBT_BATCH_REVIEW_EACH     0x00  // each PSBT is confirmed separately, as in SIGN_PSBT
+#define SIGN_PSBT_BATCH_REVIEW_COMBINED 0x01  // the outputs of all the PSBTs, then the total fees
+
+// Maximum length of the commitment of a PSBT in a batch: the 3 varints, and the 4 Merkle roots
+#define MAX_PSBT_COMMITMENT_LEN (3 * 9 + 4 * 32)
+
+// The checkpoint returned in SIGN_PSBT_MODE_CHECKPOINT: the tx-wide state that is needed to sign
+// the inputs, and an hmac binding it to the transaction and the wallet policy that were approved.
+// The client holds it, and returns it with GET_PREIMAGE when resuming.
+typedef struct {
+    segwit_hashes_t hashes;
+    uint8_t outputs_preimage_hash[32];
+    uint8_t hmac[32];
+} sign_psbt_checkpoint_t;
+
+#define PSBT_CHECKPOINT_SLIP0021_LABEL "\0LEDGER-PSBT checkpoint"
+#define PSBT_CHECKPOINT_SLIP0021_LABEL_LEN \
+    (sizeof(PSBT_CHECKPOINT_SLIP0021_LABEL) - 1)  // sizeof counts the terminating 0
+
+// Maximum length of the results sent in a single YIELD message, excluding the command code
+#define MAX_YIELD_BATCH_LEN 254
+
 // We cache the first 2 external outputs; that's needed for the swap checks
 // Moreover, this helps the code for the simplified UX for transactions that
 // have a single external output.
 #define N_CACHED_EXTERNAL_OUTPUTS 2
 
+// aggregate info on outputs
+typedef struct {
+    uint64_t total_amount;           // amount of all the outputs (external + change)
+    uint64_t change_total_amount;    // total amount of all change outputs
+    uint64_t external_total_amount;  // total amount of all external outputs
+    uint64_t fee;                    // inputs_total_amount - total_amount
+    int n_change;                    // count of outputs compatible with change outputs
+    uint8_t output_script_lengths[N_CACHED_EXTERNAL_OUTPUTS];
+    uint8_t output_scripts[N_CACHED_EXTERNAL_OUTPUTS][MAX_OUTPUT_SCRIPTPUBKEY_LEN];
+    uint64_t output_amounts[N_CACHED_EXTERNAL_OUTPUTS];
+} outputs_summary_t;
+
 typedef struct {
     uint32_t master_key_fingerprint;
     uint32_t tx_version;
@@ -145,29 +235,146 @@ typedef struct {
     unsigned int n_external_inputs;
     unsigned int n_external_outputs;
 
-    // aggregate info on outputs
-    struct {
-        uint64_t total_amount;         // amount of all the outputs (external + change)
-        uint64_t change_total_amount;  // total amount of all change outputs
-        int n_change;                  // count of outputs compatible with change outputs
-        size_t output_script_lengths[N_CACHED_EXTERNAL_OUTPUTS];
-        uint8_t output_scripts[N_CACHED_EXTERNAL_OUTPUTS][MAX_OUTPUT_SCRIPTPUBKEY_LEN];
-        uint64_t output_amounts[N_CACHED_EXTERNAL_OUTPUTS];
-    } outputs;
+    outputs_summary_t outputs;
 
     bool is_wallet_default;
 
     uint8_t protocol_version;
 
+    uint8_t mode;  // one of the SIGN_PSBT_MODE_* constants
+
+    bool grind_low_r;  // if SIGN_PSBT_FLAG_LOW_R is set, the ECDSA signatures are at most 71 bytes
+
+    // the inputs signed in this command are in [sign_begin, sign_end): all of them, unless resuming
+    // from a checkpoint; the bitvector of the internal inputs is indexed from sign_begin
+    unsigned int sign_begin;
+    unsigned int sign_end;
+
+    union {
+        // in the checkpoint modes, the hash of the part of the request that identifies the
+        // transaction and the wallet policy, to which the checkpoint is bound
+        uint8_t checkpoint_commitment[32];
+        // in SIGN_PSBT_MODE_SIGN, the key of the transaction in the validated_psbt_cache, that is
+        // computed from the same hash
+        uint8_t validated_psbt_key[32];
+    };
+
+    // if the client sent an input mask, only the inputs whose bit is set can be internal; the
+    // others are treated as external, without matching their keys. Indexed from sign_begin
+    bool has_input_mask;
+    uint8_t input_mask[BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)];
+    // when resuming, the sha256 hash of the checkpoint, whose preimage is held by the client
+    uint8_t checkpoint_hash[32];
+
+    // in SIGN_PSBT_MODE_BATCH, the PSBTs signed with the same wallet policy; the PSBT in the
+    // request must be the first one. The wallet policy and the key caches are shared by all of them
+    struct {
+        uint8_t review;          // one of the SIGN_PSBT_BATCH_REVIEW_* constants
+        unsigned int n_psbts;    // number of PSBTs in the batch
+        uint8_t psbts_root[32];  // merkle root of the vector of the commitments of the PSBTs
+        uint8_t first_psbt_hash[32];  // sha256 of the commitment of the PSBT in the request
+        unsigned int cur_index;       // index of the PSBT being validated or signed
+        int n_shown_outputs;  // in the combined review, the external outputs already shown
+    } batch;
+
     __attribute__((aligned(4))) uint8_t wallet_policy_map_bytes[MAX_WALLET_POLICY_BYTES];
     policy_node_t *wallet_policy_map;
 
+    // all the key placeholders of the wallet policy, listed once after parsing it
+    policy_key_placeholder_ref_t key_placeholders[MAX_N_KEY_PLACEHOLDERS_IN_WALLET_POLICY];
+    int n_key_placeholders;
+
+    // the keys of the wallet policy whose xpub was already derived from the seed in this command,
+    // and among them the ones that are internal; indexed by key index (only the first
+    // MAX_N_KEYS_IN_WALLET_POLICY keys, that is all of them for the registered wallet policies)
+    uint8_t verified_keys[BITVECTOR_REAL_SIZE(MAX_N_KEYS_IN_WALLET_POLICY)];
+    uint8_t internal_keys[BITVECTOR_REAL_SIZE(MAX_N_KEYS_IN_WALLET_POLICY)];
+
     tx_ux_warning_t warnings;
 
+    // computed in preprocess_inputs and preprocess_outputs
+    segwit_hashes_t hashes;
+
+    // set in preprocess_inputs if an internal input signs all the outputs; otherwise, all of them
+    // use SIGHASH_NONE or SIGHASH_SINGLE, and sha_outputs is not computed
+    bool need_sha_outputs;
+
+    // the sha256 of the outputs committed to by the first internal inputs with SIGHASH_SINGLE, that
+    // have the same index as the input; the indices are listed in preprocess_inputs, and the hashes
+    // are computed in preprocess_outputs from the outputs that it fetches anyway
+    struct {
+        unsigned int n_outputs;
+        unsigned int output_indices[N_SINGLE_OUTPUT_HASHES];
+        uint8_t hashes[N_SINGLE_OUTPUT_HASHES][32];
+    } single_outputs;
+
+    // for legacy policies from PROTOCOL_VERSION_OUTPUTS_PREIMAGE, the hash of the serialized
+    // outputs (including their count) as a preimage; computed in preprocess_outputs, so that the
+    // client can stream the outputs in the sighash of each input, without fetching them again
+    bool has_outputs_preimage_hash;
+    uint8_t outputs_preimage_hash[32];
+
+    // the part of the segwit sighash preimage that is shared by all the inputs with the same
+    // sighash type, for the last sighash type used
+    struct {
+        bool is_valid;
+        uint8_t sighash_byte;
+        cx_sha256_t context;
+    } sighash_prefix;
+
+    // signatures not yet sent to the client; from PROTOCOL_VERSION_BATCHED_YIELD, several of them
+    // are sent in the same YIELD message, and from PROTOCOL_VERSION_DEFERRED_YIELD, a full batch is
+    // sent with the next client command
+    struct {
+        uint8_t data[MAX_YIELD_BATCH_LEN];
+        size_t len;
+    } yield_batch;
+
+    // the records of the first internal inputs of the range to sign, in the order of their indices;
+    // filled by preprocess_inputs or find_internal_inputs_in_range, with the derivations of the
+    // placeholder with index placeholder_index
+    struct {
+        unsigned int n_records;
+        int placeholder_index;
+        input_record_t records[N_INPUT_RECORDS];
+    } input_records;
+
+    // the BIP342 sighash of the input being signed, for the last tapleaf that was signed for; all
+    // the internal placeholders in the same leaf (like the keys of a multi_a) sign the same
+    // sighash, so it is only computed, with the tapleaf hash, for the first of them. Reset for each
+    // input.
+    struct {
+        const policy_node_t *tapleaf_ptr;  // NULL if none was computed for the current input
+        uint32_t address_index;
+        bool is_change;
+        uint32_t sighash_type;
+        uint8_t tapleaf_hash[32];
+        uint8_t sighash[32];
+    } tapleaf_sighash;
 } sign_psbt_state_t;
 
-/* BIP0341 tags for computing the tagged hashes when computing he sighash */
-static const uint8_t BIP0341_sighash_tag[] = {'T', 'a', 'p', 'S', 'i', 'g', 'h', 'a', 's', 'h'};
+_Static_assert(sizeof(sign_psbt_state_t) <= SCRATCH_ARENA_SIZE,
+               "The state of SIGN_PSBT must fit in the scratch arena");
+
+// The state computed by preprocess_inputs and preprocess_outputs that is kept in the
+// validated_psbt_cache, so that a transaction signed again in the same session is only shown and
+// signed. The input records and the hashes of the SIGHASH_SINGLE outputs are not kept: the data
+// they save is fetched again when signing, like for a checkpoint.
+typedef struct {
+    uint64_t inputs_total_amount;
+    unsigned int n_external_inputs;
+    unsigned int n_external_outputs;
+    outputs_summary_t outputs;
+    tx_ux_warning_t warnings;
+    segwit_hashes_t hashes;
+    bool has_outputs_preimage_hash;
+    uint8_t outputs_preimage_hash[32];
+    uint8_t internal_inputs[BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)];
+    uint8_t internal_outputs[BITVECTOR_REAL_SIZE(MAX_N_OUTPUTS_CAN_SIGN)];
+} validated_psbt_t;
+
+_Static_assert(sizeof(validated_psbt_t) <= VALIDATED_PSBT_MAX_LEN,
+               "The state of a validated PSBT must fit in the validated_psbt_cache");
 
 /*
 Current assumptions during signing:
@@ -183,6 +390,73 @@ the right paths to identify internal inputs/outputs.
 */
 
 // HELPER FUNCTIONS
+// Reads the amount and the scriptPubKey of an output from its map, with a single request.
+// Returns the length of the scriptPubKey, or -1 on error, or if the amount is not 8 bytes long.
+static int read_output_amount_and_script(dispatcher_context_t *dc,
+                                         const merkleized_map_commitment_t *map,
+                                         uint8_t amount_raw[static 8],
+                                         uint8_t *script,
+                                         int script_max_len) {
+    merkleized_map_value_request_t requests[] = {
+        {.key_hash = PSBT_KEY_HASH(PSBT_OUT_AMOUNT), .out = amount_raw, .out_len = 8},
+        {.key_hash = PSBT_KEY_HASH(PSBT_OUT_SCRIPT), .out = script, .out_len = script_max_len}};
+    if (0 > call_get_merkleized_map_values(dc, map, requests, 2) || requests[0].value_len != 8) {
+        return -1;
+    }
+    return requests[1].value_len;
+}
+
+// Reads the prevout hash, the output index and the sequence of an input from its map, with a single
+// request; a missing PSBT_IN_SEQUENCE is returned as 0xFFFFFFFF.
+// If witness_utxo is not NULL, the WITNESS_UTXO is read in the same request, into a buffer of
+// 8 + 1 + MAX_PREVOUT_SCRIPTPUBKEY_LEN bytes, and must be at least 8 bytes long.
+// Returns false on error.
+static bool read_input_outpoint_and_sequence(dispatcher_context_t *dc,
+                                             const merkleized_map_commitment_t *map,
+                                             uint8_t prevout_hash[static 32],
+                                             uint8_t prevout_n_raw[static 4],
+                                             uint8_t nSequence_raw[static 4],
+                                             uint8_t *witness_utxo) {
+    merkleized_map_value_request_t requests[] = {
+        {.key_hash = PSBT_KEY_HASH(PSBT_IN_PREVIOUS_TXID), .out = prevout_hash, .out_len = 32},
+        {.key_hash = PSBT_KEY_HASH(PSBT_IN_OUTPUT_INDEX), .out = prevout_n_raw, .out_len = 4},
+        {.key_hash = PSBT_KEY_HASH(PSBT_IN_SEQUENCE), .out = nSequence_raw, .out_len = 4},
+        {.key_hash = PSBT_KEY_HASH(PSBT_IN_WITNESS_UTXO),
+         .out = witness_utxo,
+         .out_len = 8 + 1 + MAX_PREVOUT_SCRIPTPUBKEY_LEN}};
+    if (0 > call_get_merkleized_map_values(dc, map, requests, witness_utxo != NULL ? 4 : 3) ||
+        requests[0].value_len != 32 || requests[1].value_len != 4 ||
+        (witness_utxo != NULL && requests[3].value_len < 8)) {
+        return false;
+    }
+    if (requests[2].value_len != 4) {
+        // if no PSBT_IN_SEQUENCE is present, we must assume nSequence 0xFFFFFFFF
+        memset(nSequence_raw, 0xFF, 4);
+    }
+    return true;
+}
+
+// Updates the hash_context with the amount and scriptPubKey of the output with the given map
+// returns -1 on error. 0 on success.
+static int hash_output_map(dispatcher_context_t *dc,
+                           const merkleized_map_commitment_t *map,
+                           cx_hash_t *hash_context) {
+    // get output's amount and scriptPubKey
+    uint8_t amount_raw[8];
+    uint8_t out_script[MAX_OUTPUT_SCRIPTPUBKEY_LEN];
+    int out_script_len =
+        read_output_amount_and_script(dc, map, amount_raw, out_script, sizeof(out_script));
+    if (out_script_len == -1) {
+        return -1;
+    }
+
+    crypto_hash_update(hash_context, amount_raw, 8);
+
+    crypto_hash_update_varint(hash_context, out_script_len);
+    crypto_hash_update(hash_context, out_script, out_script_len);
+    return 0;
+}
+
 // Updates the hash_context with the output of given index
 // returns -1 on error. 0 on success.
 static int hash_output_n(dispatcher_context_t *dc,
@@ -201,54 +475,75 @@ static int hash_output_n(dispatcher_context_t *dc,
         return -1;
     }
 
-    // get output's amount
-    uint8_t amount_raw[8];
-    if (8 != call_get_merkleized_map_value(dc,
-                                           &ith_map,
-                                           (uint8_t[]){PSBT_OUT_AMOUNT},
-                                           1,
-                                           amount_raw,
-                                           8)) {
-        return -1;
-    }
-
-    crypto_hash_update(hash_context, amount_raw, 8);
+    return hash_output_map(dc, &ith_map, hash_context);
+}
 
-    // get output's scriptPubKey
+// Number of output maps whose commitments are fetched and verified together in hash_outputs
+#define HASH_OUTPUTS_BATCH_SIZE 4
 
-    uint8_t out_script[MAX_OUTPUT_SCRIPTPUBKEY_LEN];
-    int out_script_len = call_get_merkleized_map_value(dc,
-                                                       &ith_map,
-                                                       (uint8_t[]){PSBT_OUT_SCRIPT},
-                                                       1,
-                                                       out_script,
-                                                       sizeof(out_script));
-    if (out_script_len == -1) {
+// Updates the hash_context with the network serialization of all the outputs
+// The hash is only used once all the outputs are hashed; therefore, the commitments of the output
+// maps are fetched in batches with a single proof for each batch, instead of one proof per output.
+// returns -1 on error. 0 on success.
+static int hash_outputs(dispatcher_context_t *dc, sign_psbt_state_t *st, cx_hash_t *hash_context) {
+    // let the client prepare the output maps that we are about to request
+    if (st->n_outputs > 1 &&
+        0 > call_hint_merkle_leaves(dc, st->outputs_root, st->n_outputs, 0, st->n_outputs)) {
         return -1;
     }
 
-    crypto_hash_update_varint(hash_context, out_script_len);
-    crypto_hash_update(hash_context, out_script, out_script_len);
+    merkleized_map_commitment_t maps[HASH_OUTPUTS_BATCH_SIZE];
+    for (unsigned int begin = 0; begin < st->n_outputs; begin += HASH_OUTPUTS_BATCH_SIZE) {
+        unsigned int end = MIN(begin + HASH_OUTPUTS_BATCH_SIZE, st->n_outputs);
+        if (0 > call_get_merkleized_maps(dc, st->outputs_root, st->n_outputs, begin, end, maps)) {
+            return -1;
+        }
+        for (unsigned int i = begin; i < end; i++) {
+            if (hash_output_map(dc, &maps[i - begin], hash_context)) {
+                return -1;
+            }
+        }
+    }
     return 0;
 }
 
-// Updates the hash_context with the network serialization of all the outputs
+// Computes the sha256 of the output with the given index, that SIGHASH_SINGLE commits to; it is
+// only fetched if it was not already hashed in preprocess_outputs.
 // returns -1 on error. 0 on success.
-static int hash_outputs(dispatcher_context_t *dc, sign_psbt_state_t *st, cx_hash_t *hash_context) {
-    for (unsigned int i = 0; i < st->n_outputs; i++) {
-        if (hash_output_n(dc, st, hash_context, i)) {
-            return -1;
+static int get_single_output_hash(dispatcher_context_t *dc,
+                                  sign_psbt_state_t *st,
+                                  unsigned int index,
+                                  uint8_t out[static 32]) {
+    for (unsigned int i = 0; i < st->single_outputs.n_outputs; i++) {
+        if (st->single_outputs.output_indices[i] == index) {
+            memcpy(out, st->single_outputs.hashes[i], 32);
+            return 0;
         }
     }
+
+    cx_sha256_t sha_output_context;
+    cx_sha256_init(&sha_output_context);
+    if (hash_output_n(dc, st, &sha_output_context.header, index) == -1) {
+        return -1;
+    }
+    crypto_hash_digest(&sha_output_context.header, out, 32);
     return 0;
 }
 
+// Callback for call_stream_preimage that updates the hash context passed as state with the data
+static void cb_update_hash(buffer_t *data, void *cb_state) {
+    crypto_hash_update((cx_hash_t *) cb_state, data->ptr + data->offset, data->size - data->offset);
+}
+
 /*
  Convenience function to get the amount and scriptpubkey from the non-witness-utxo of a certain
  input in a PSBTv2.
  If expected_prevout_hash is not NULL, the function fails if the txid computed from the
  non-witness-utxo does not match the one pointed by expected_prevout_hash. Returns -1 on failure, 0
  on success.
+ The outputs with the indices in other_prevout_ns (at most PSBT_PARSE_RAWTX_MAX_OUTPUTS - 1) are
+ extracted in the same pass, so that other inputs spending them do not need to parse the
+ non-witness-utxo again.
 */
 static int __attribute__((noinline)) get_amount_scriptpubkey_from_psbt_nonwitness(
     dispatcher_context_t *dc,
@@ -256,29 +551,41 @@ static int __attribute__((noinline)) get_amount_scriptpubkey_from_psbt_nonwitnes
     uint64_t *amount,
     uint8_t scriptPubKey[static MAX_PREVOUT_SCRIPTPUBKEY_LEN],
     size_t *scriptPubKey_len,
-    const uint8_t *expected_prevout_hash) {
+    const uint8_t *expected_prevout_hash,
+    const uint32_t *other_prevout_ns,
+    int n_other_prevout_ns) {
     // If there is no witness-utxo, it must be the case that this is a legacy input.
     // In this case, we can only retrieve the prevout amount and scriptPubKey by parsing
     // the non-witness-utxo
 
     // Read the prevout index
     uint32_t prevout_n;
-    if (4 != call_get_merkleized_map_value_u32_le(dc,
-                                                  input_map,
-                                                  (uint8_t[]){PSBT_IN_OUTPUT_INDEX},
-                                                  1,
-                                                  &prevout_n)) {
+    if (4 != call_get_merkleized_map_value_u32_le_by_hash(dc,
+                                                          input_map,
+                                                          PSBT_KEY_HASH(PSBT_IN_OUTPUT_INDEX),
+                                                          &prevout_n)) {
+        return -1;
+    }
+
+    if (n_other_prevout_ns < 0 || n_other_prevout_ns >= PSBT_PARSE_RAWTX_MAX_OUTPUTS) {
         return -1;
     }
 
-    txid_parser_outputs_t parser_outputs;
+    unsigned int output_indices[PSBT_PARSE_RAWTX_MAX_OUTPUTS];
+    output_indices[0] = prevout_n;
+    for (int i = 0; i < n_other_prevout_ns; i++) {
+        output_indices[1 + i] = other_prevout_ns[i];
+    }
+
+    txid_parser_outputs_t parser_outputs[PSBT_PARSE_RAWTX_MAX_OUTPUTS];
     // request non-witness utxo, and get the prevout's value and scriptpubkey
     int res = call_psbt_parse_rawtx(dc,
                                     input_map,
                                     (uint8_t[]){PSBT_IN_NON_WITNESS_UTXO},
                                     1,
-                                    prevout_n,
-                                    &parser_outputs);
+                                    output_indices,
+                                    1 + n_other_prevout_ns,
+                                    parser_outputs);
     if (res < 0) {
         PRINTF("Parsing rawtx failed\n");
         return -1;
@@ -286,19 +593,72 @@ static int __attribute__((noinline)) get_amount_scriptpubkey_from_psbt_nonwitnes
 
     // if expected_prevout_hash is given, check that it matches the txid obtained from the parser
     if (expected_prevout_hash != NULL &&
-        memcmp(parser_outputs.txid, expected_prevout_hash, 32) != 0) {
+        memcmp(parser_outputs[0].txid, expected_prevout_hash, 32) != 0) {
         PRINTF("Prevout hash did not match non-witness-utxo transaction hash\n");
 
         return -1;
     }
 
-    *amount = parser_outputs.vout_value;
-    *scriptPubKey_len = parser_outputs.vout_scriptpubkey_len;
-    memcpy(scriptPubKey, parser_outputs.vout_scriptpubkey, parser_outputs.vout_scriptpubkey_len);
+    *amount = parser_outputs[0].vout_value;
+    *scriptPubKey_len = parser_outputs[0].vout_scriptpubkey_len;
+    memcpy(scriptPubKey,
+           parser_outputs[0].vout_scriptpubkey,
+           parser_outputs[0].vout_scriptpubkey_len);
 
     return 0;
 }
 
+/*
+ Looks at the inputs following the one with index cur_input_index in the PSBT, and collects the
+ output indices of those that spend outputs of the same transaction with id prevout_hash, as long as
+ they are consecutive (like when the inputs are sorted as in BIP-69). At most max_prevout_ns of them
+ are collected into prevout_ns.
+ Returns the number of output indices collected, or -1 on failure.
+*/
+static int __attribute__((noinline)) get_next_prevout_ns_with_same_txid(
+    dispatcher_context_t *dc,
+    sign_psbt_state_t *st,
+    unsigned int cur_input_index,
+    const uint8_t prevout_hash[static 32],
+    uint32_t *prevout_ns,
+    int max_prevout_ns) {
+    int n_prevout_ns = 0;
+
+    for (unsigned int i = cur_input_index + 1; i < st->n_inputs && n_prevout_ns < max_prevout_ns;
+         i++) {
+        merkleized_map_commitment_t ith_map;
+        if (0 > call_get_merkleized_map(dc, st->inputs_root, st->n_inputs, i, &ith_map)) {
+            return -1;
+        }
+
+        // the output index is fetched in the same request, even if it is not used on a mismatch
+        uint8_t ith_prevout_hash[32];
+        uint8_t ith_prevout_n_raw[4];
+        merkleized_map_value_request_t requests[] = {
+            {.key_hash = PSBT_KEY_HASH(PSBT_IN_PREVIOUS_TXID),
+             .out = ith_prevout_hash,
+             .out_len = sizeof(ith_prevout_hash)},
+            {.key_hash = PSBT_KEY_HASH(PSBT_IN_OUTPUT_INDEX),
+             .out = ith_prevout_n_raw,
+             .out_len = sizeof(ith_prevout_n_raw)}};
+        if (0 > call_get_merkleized_map_values(dc, &ith_map, requests, 2) ||
+            requests[0].value_len != 32) {
+            return -1;
+        }
+
+        if (memcmp(ith_prevout_hash, prevout_hash, 32) != 0) {
+            break;
+        }
+
+        if (requests[1].value_len != 4) {
+            return -1;
+        }
+        prevout_ns[n_prevout_ns] = read_u32_le(ith_prevout_n_raw, 0);
+        ++n_prevout_ns;
+    }
+    return n_prevout_ns;
+}
+
 /*
  Convenience function to get the amount and scriptpubkey from the witness-utxo of a certain input in
  a PSBTv2.
@@ -312,12 +672,11 @@ static int __attribute__((noinline)) get_amount_scriptpubkey_from_psbt_witness(
     size_t *scriptPubKey_len) {
     uint8_t raw_witnessUtxo[8 + 1 + MAX_PREVOUT_SCRIPTPUBKEY_LEN];
 
-    int wit_utxo_len = call_get_merkleized_map_value(dc,
-                                                     input_map,
-                                                     (uint8_t[]){PSBT_IN_WITNESS_UTXO},
-                                                     1,
-                                                     raw_witnessUtxo,
-                                                     sizeof(raw_witnessUtxo));
+    int wit_utxo_len = call_get_merkleized_map_value_by_hash(dc,
+                                                             input_map,
+                                                             PSBT_KEY_HASH(PSBT_IN_WITNESS_UTXO),
+                                                             raw_witnessUtxo,
+                                                             sizeof(raw_witnessUtxo));
 
     if (wit_utxo_len < 0) {
         return -1;
@@ -338,47 +697,18 @@ static int __attribute__((noinline)) get_amount_scriptpubkey_from_psbt_witness(
     return 0;
 }
 
-/*
- Convenience function to get the amount and scriptpubkey of a certain input in a PSBTv2.
- It first tries to obtain it from the witness-utxo field; in case of failure, it then obtains it
- from the non-witness-utxo.
- Returns -1 on failure, 0 on success.
-*/
-static int get_amount_scriptpubkey_from_psbt(
-    dispatcher_context_t *dc,
-    const merkleized_map_commitment_t *input_map,
-    uint64_t *amount,
-    uint8_t scriptPubKey[static MAX_PREVOUT_SCRIPTPUBKEY_LEN],
-    size_t *scriptPubKey_len) {
-    int ret = get_amount_scriptpubkey_from_psbt_witness(dc,
-                                                        input_map,
-                                                        amount,
-                                                        scriptPubKey,
-                                                        scriptPubKey_len);
-    if (ret >= 0) {
-        return ret;
-    }
-
-    return get_amount_scriptpubkey_from_psbt_nonwitness(dc,
-                                                        input_map,
-                                                        amount,
-                                                        scriptPubKey,
-                                                        scriptPubKey_len,
-                                                        NULL);
-}
-
-// Convenience function to share common logic when processing all the
-// PSBT_{IN|OUT}_{TAP}?_BIP32_DERIVATION fields.
-static int read_change_and_index_from_psbt_bip32_derivation(
-    dispatcher_context_t *dc,
-    placeholder_info_t *placeholder_info,
-    in_out_info_t *in_out,
-    int psbt_key_type,
-    buffer_t *data,
-    const merkleized_map_commitment_t *map_commitment,
-    int index) {
-    uint8_t bip32_derivation_pubkey[33];
-
+// Reads the pubkey in the key data and the fingerprint and derivation path in the value of one of
+// the PSBT_{IN|OUT}_{TAP}?_BIP32_DERIVATION fields. The value is fetched from the client, hence
+// this is the only part of the processing of a derivation that costs a round trip.
+// Returns the length of the derivation path, or -1 on error.
+static int read_psbt_bip32_derivation(dispatcher_context_t *dc,
+                                      in_out_info_t *in_out,
+                                      int psbt_key_type,
+                                      buffer_t *data,
+                                      const merkleized_map_commitment_t *map_commitment,
+                                      int index,
+                                      uint8_t bip32_derivation_pubkey[static 33],
+                                      uint32_t fpt_der[static 1 + MAX_BIP32_PATH_STEPS]) {
     bool is_tap = psbt_key_type == PSBT_IN_TAP_BIP32_DERIVATION ||
                   psbt_key_type == PSBT_OUT_TAP_BIP32_DERIVATION;
     int key_len = is_tap ? 32 : 33;
@@ -395,8 +725,6 @@ static int read_change_and_index_from_psbt_bip32_derivation(
 
     // get the corresponding value in the values Merkle tree,
     // then fetch the bip32 path from the field
-    uint32_t fpt_der[1 + MAX_BIP32_PATH_STEPS];
-
     int der_len = extract_bip32_derivation(dc,
                                            psbt_key_type,
                                            map_commitment->values_root,
@@ -412,46 +740,137 @@ static int read_change_and_index_from_psbt_bip32_derivation(
         PRINTF("BIP32_DERIVATION path too long\n");
         return -1;
     }
+    return der_len;
+}
+
+// Checks if a derivation read with read_psbt_bip32_derivation belongs to the given placeholder;
+// if so, it stores in in_out whether it is change and its address index, and returns 1.
+// The fingerprint and the path are compared first: the pubkey is only derived for the derivations
+// of this device, so the keys of the cosigners cost no cryptographic operation.
+// Returns 0 if the derivation does not match, -1 on error.
+static int match_psbt_bip32_derivation(placeholder_info_t *placeholder_info,
+                                       in_out_info_t *in_out,
+                                       int psbt_key_type,
+                                       const uint8_t bip32_derivation_pubkey[static 33],
+                                       const uint32_t fpt_der[static 1 + MAX_BIP32_PATH_STEPS],
+                                       int der_len) {
+    bool is_tap = psbt_key_type == PSBT_IN_TAP_BIP32_DERIVATION ||
+                  psbt_key_type == PSBT_OUT_TAP_BIP32_DERIVATION;
+    int key_len = is_tap ? 32 : 33;
 
     // if this derivation path matches the internal placeholder,
     // we use it to detect whether the current input is change or not,
     // and store its address index
-    if (fpt_der[0] == placeholder_info->fingerprint &&
-        der_len == placeholder_info->key_derivation_length + 2) {
-        for (int i = 0; i < placeholder_info->key_derivation_length; i++) {
-            if (placeholder_info->key_derivation[i] != fpt_der[1 + i]) {
-                return 0;
-            }
+    if (fpt_der[0] != placeholder_info->fingerprint ||
+        der_len != placeholder_info->key_derivation_length + 2) {
+        return 0;
+    }
+    for (int i = 0; i < placeholder_info->key_derivation_length; i++) {
+        if (placeholder_info->key_derivation[i] != fpt_der[1 + i]) {
+            return 0;
         }
+    }
 
-        uint32_t change = fpt_der[1 + der_len - 2];
-        uint32_t addr_index = fpt_der[1 + der_len - 1];
+    uint32_t change = fpt_der[1 + der_len - 2];
+    uint32_t addr_index = fpt_der[1 + der_len - 1];
 
-        // check that we can indeed derive the same key from the current placeholder
-        serialized_extended_pubkey_t pubkey;
-        if (0 > bip32_CKDpub(&placeholder_info->pubkey, change, &pubkey)) return -1;
-        if (0 > bip32_CKDpub(&pubkey, addr_index, &pubkey)) return -1;
+    // the 'change' derivation step must be coherent with the placeholder
+    if (change != placeholder_info->placeholder.num_first &&
+        change != placeholder_info->placeholder.num_second) {
+        return 0;
+    }
 
-        int pk_offset = is_tap ? 1 : 0;
-        if (memcmp(pubkey.compressed_pubkey + pk_offset, bip32_derivation_pubkey, key_len) != 0) {
-            return 0;
+    bool is_change = change != placeholder_info->placeholder.num_first;
+
+    // check that we can indeed derive the same key from the current placeholder; the derivations
+    // are shared with the wallet_key_cache, so that the outputs (or inputs) at the same (change,
+    // address_index) only derive it once, and the wallet script at that path reuses it
+    uint32_t key_index = placeholder_info->placeholder.key_index;
+    uint8_t compressed_pubkey[33];
+    if (!wallet_key_cache_get_derived_pubkey(placeholder_info->keys_root,
+                                             key_index,
+                                             change,
+                                             addr_index,
+                                             compressed_pubkey)) {
+        // the intermediate key is kept uncompressed, in order to avoid decompressing it
+        uint8_t pubkey[65];
+        uint8_t chain_code[32];
+        if (!wallet_key_cache_get_change_pubkey(placeholder_info->keys_root,
+                                                key_index,
+                                                change,
+                                                compressed_pubkey,
+                                                chain_code)) {
+            if (0 > crypto_get_uncompressed_pubkey(placeholder_info->compressed_pubkey, pubkey))
+                return -1;
+            if (0 > bip32_CKDpub_uncompressed(pubkey,
+                                              placeholder_info->chain_code,
+                                              change,
+                                              pubkey,
+                                              chain_code))
+                return -1;
+            crypto_get_compressed_pubkey(pubkey, compressed_pubkey);
+            wallet_key_cache_add_change_pubkey(placeholder_info->keys_root,
+                                               key_index,
+                                               is_change,
+                                               change,
+                                               compressed_pubkey,
+                                               chain_code);
+        } else if (0 > crypto_get_uncompressed_pubkey(compressed_pubkey, pubkey)) {
+            return -1;
         }
+        if (0 > bip32_CKDpub_uncompressed(pubkey, chain_code, addr_index, pubkey, chain_code))
+            return -1;
 
-        // check if the 'change' derivation step is indeed coherent with placeholder
-        if (change == placeholder_info->placeholder.num_first) {
-            in_out->is_change = false;
-            in_out->address_index = addr_index;
-        } else if (change == placeholder_info->placeholder.num_second) {
-            in_out->is_change = true;
-            in_out->address_index = addr_index;
-        } else {
-            return 0;
-        }
+        crypto_get_compressed_pubkey(pubkey, compressed_pubkey);
+        wallet_key_cache_add_derived_pubkey(placeholder_info->keys_root,
+                                            key_index,
+                                            change,
+                                            addr_index,
+                                            compressed_pubkey);
+    }
 
-        in_out->placeholder_found = true;
-        return 1;
+    int pk_offset = is_tap ? 1 : 0;
+    if (memcmp(compressed_pubkey + pk_offset, bip32_derivation_pubkey, key_len) != 0) {
+        return 0;
     }
-    return 0;
+
+    in_out->is_change = is_change;
+    in_out->address_index = addr_index;
+    in_out->placeholder_found = true;
+    return 1;
+}
+
+// Convenience function to share common logic when processing all the
+// PSBT_{IN|OUT}_{TAP}?_BIP32_DERIVATION fields.
+static int read_change_and_index_from_psbt_bip32_derivation(
+    dispatcher_context_t *dc,
+    placeholder_info_t *placeholder_info,
+    in_out_info_t *in_out,
+    int psbt_key_type,
+    buffer_t *data,
+    const merkleized_map_commitment_t *map_commitment,
+    int index) {
+    uint8_t bip32_derivation_pubkey[33];
+    uint32_t fpt_der[1 + MAX_BIP32_PATH_STEPS];
+
+    int der_len = read_psbt_bip32_derivation(dc,
+                                             in_out,
+                                             psbt_key_type,
+                                             data,
+                                             map_commitment,
+                                             index,
+                                             bip32_derivation_pubkey,
+                                             fpt_der);
+    if (der_len < 0) {
+        return -1;
+    }
+
+    return match_psbt_bip32_derivation(placeholder_info,
+                                       in_out,
+                                       psbt_key_type,
+                                       bip32_derivation_pubkey,
+                                       fpt_der,
+                                       der_len);
 }
 
 /**
@@ -487,155 +906,320 @@ static int is_in_out_internal(dispatcher_context_t *dispatcher_context,
                                          in_out_info->scriptPubKey_len);
 }
 
-static bool __attribute__((noinline)) init_global_state(dispatcher_context_t *dc,
-                                                        sign_psbt_state_t *st) {
-    LOG_PROCESSOR(__FILE__, __LINE__, __func__);
-
-    merkleized_map_commitment_t global_map;
-    if (!buffer_read_varint(&dc->read_buffer, &global_map.size)) {
-        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+// Reads the optional mode at the end of the request; for SIGN_PSBT_MODE_RESUME, it is followed by
+// the range of the inputs to sign and the hash of the checkpoint.
+// Fetches the input mask with the given hash, for a transaction with at most MAX_N_INPUTS_CAN_SIGN
+// inputs. It must have exactly one bit per input.
+static bool __attribute__((noinline)) load_input_mask(dispatcher_context_t *dc,
+                                                      sign_psbt_state_t *st,
+                                                      const uint8_t input_mask_hash[static 32]) {
+    if (st->n_inputs > MAX_N_INPUTS_CAN_SIGN) {
+        PRINTF("At most %d inputs are supported\n", MAX_N_INPUTS_CAN_SIGN);
+        SEND_SW(dc, SW_NOT_SUPPORTED);
         return false;
     }
 
-    if (!buffer_read_bytes(&dc->read_buffer, global_map.keys_root, 32) ||
-        !buffer_read_bytes(&dc->read_buffer, global_map.values_root, 32)) {
-        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+    if ((int) BITVECTOR_REAL_SIZE(st->n_inputs) != call_get_preimage(dc,
+                                                                     input_mask_hash,
+                                                                     st->input_mask,
+                                                                     sizeof(st->input_mask))) {
+        PRINTF("Failed to fetch the input mask\n");
+        SEND_SW(dc, SW_INCORRECT_DATA);
         return false;
     }
+    st->has_input_mask = true;
+    return true;
+}
 
-    // we already know n_inputs and n_outputs, so we skip reading from the global map
-
-    uint64_t n_inputs_u64;
-    if (!buffer_read_varint(&dc->read_buffer, &n_inputs_u64) ||
-        !buffer_read_bytes(&dc->read_buffer, st->inputs_root, 32)) {
-        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
-        return false;
-    }
+// Returns false if the input is marked as external in the input mask
+static bool can_input_be_internal(const sign_psbt_state_t *st, unsigned int input_index) {
+    return !st->has_input_mask || bitvector_get(st->input_mask, input_index - st->sign_begin);
+}
 
-    if (n_inputs_u64 > MAX_N_INPUTS_CAN_SIGN) {
-        PRINTF("At most %d inputs are supported\n", MAX_N_INPUTS_CAN_SIGN);
-        SEND_SW(dc, SW_NOT_SUPPORTED);
-        return false;
-    }
-    st->n_inputs = (unsigned int) n_inputs_u64;
+static bool read_sign_psbt_mode(dispatcher_context_t *dc, sign_psbt_state_t *st) {
+    st->mode = SIGN_PSBT_MODE_SIGN;
+    st->sign_begin = 0;
+    st->sign_end = st->n_inputs;
+    st->has_input_mask = false;
+    st->grind_low_r = false;
 
-    uint64_t n_outputs_u64;
-    if (!buffer_read_varint(&dc->read_buffer, &n_outputs_u64) ||
-        !buffer_read_bytes(&dc->read_buffer, st->outputs_root, 32)) {
-        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
-        return false;
+    if (!buffer_read_u8(&dc->read_buffer, &st->mode)) {
+        return true;  // no mode, sign the whole transaction
     }
-    st->n_outputs = (unsigned int) n_outputs_u64;
 
-    uint8_t wallet_hmac[32];
-    uint8_t wallet_id[32];
-    if (!buffer_read_bytes(&dc->read_buffer, wallet_id, 32) ||
-        !buffer_read_bytes(&dc->read_buffer, wallet_hmac, 32)) {
-        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
-        return false;
-    }
+    st->grind_low_r = (st->mode & SIGN_PSBT_FLAG_LOW_R) != 0;
+    st->mode &= ~SIGN_PSBT_FLAG_LOW_R;
 
-    {  // process global map
-        // Check integrity of the global map
-        if (call_check_merkle_tree_sorted(dc, global_map.keys_root, (size_t) global_map.size) < 0) {
-            SEND_SW(dc, SW_INCORRECT_DATA);
+    if (st->mode == SIGN_PSBT_MODE_SIGN) {
+        // optionally followed by the hash of an input mask
+        uint8_t input_mask_hash[32];
+        if (buffer_read_bytes(&dc->read_buffer, input_mask_hash, 32) &&
+            !load_input_mask(dc, st, input_mask_hash)) {
             return false;
         }
-
-        uint8_t raw_result[9];  // max size for a varint
-        int result_len;
-
-        // Read tx version
-        result_len = call_get_merkleized_map_value(dc,
-                                                   &global_map,
-                                                   (uint8_t[]){PSBT_GLOBAL_TX_VERSION},
-                                                   1,
-                                                   raw_result,
-                                                   sizeof(raw_result));
-        if (result_len != 4) {
+    } else if (st->mode == SIGN_PSBT_MODE_RESUME) {
+        uint32_t begin, end;
+        if (!buffer_read_u32(&dc->read_buffer, &begin, BE) ||
+            !buffer_read_u32(&dc->read_buffer, &end, BE) ||
+            !buffer_read_bytes(&dc->read_buffer, st->checkpoint_hash, 32)) {
+            SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+            return false;
+        }
+        if (begin >= end || end > st->n_inputs || end - begin > MAX_N_INPUTS_CAN_SIGN) {
+            PRINTF("Invalid range of inputs to sign\n");
             SEND_SW(dc, SW_INCORRECT_DATA);
             return false;
         }
-        st->tx_version = read_u32_le(raw_result, 0);
-
-        // Read fallback locktime.
-        // Unlike BIP-0370 recommendation, we use the fallback locktime as-is, ignoring each input's
-        // preferred height/block locktime. If that's relevant, the client must set the fallback
-        // locktime to the appropriate value before calling sign_psbt.
-        result_len = call_get_merkleized_map_value(dc,
-                                                   &global_map,
-                                                   (uint8_t[]){PSBT_GLOBAL_FALLBACK_LOCKTIME},
-                                                   1,
-                                                   raw_result,
-                                                   sizeof(raw_result));
-        if (result_len == -1) {
-            st->locktime = 0;
-        } else if (result_len != 4) {
+        st->sign_begin = begin;
+        st->sign_end = end;
+    } else if (st->mode == SIGN_PSBT_MODE_BATCH) {
+        uint64_t n_psbts;
+        if (!buffer_read_u8(&dc->read_buffer, &st->batch.review) ||
+            !buffer_read_varint(&dc->read_buffer, &n_psbts) ||
+            !buffer_read_bytes(&dc->read_buffer, st->batch.psbts_root, 32)) {
+            SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+            return false;
+        }
+        if (n_psbts == 0 || n_psbts > MAX_N_PSBTS_IN_BATCH ||
+            (st->batch.review != SIGN_PSBT_BATCH_REVIEW_EACH &&
+             st->batch.review != SIGN_PSBT_BATCH_REVIEW_COMBINED)) {
+            PRINTF("Invalid batch of PSBTs\n");
             SEND_SW(dc, SW_INCORRECT_DATA);
             return false;
-        } else {
-            st->locktime = read_u32_le(raw_result, 0);
         }
+        st->batch.n_psbts = (unsigned int) n_psbts;
+        st->batch.cur_index = 0;
+        st->batch.n_shown_outputs = 0;
+    } else if (st->mode != SIGN_PSBT_MODE_SIGN && st->mode != SIGN_PSBT_MODE_CHECKPOINT) {
+        PRINTF("Unknown SIGN_PSBT mode\n");
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return false;
+    }
+
+    if (st->mode != SIGN_PSBT_MODE_SIGN && G_swap_state.called_from_swap) {
+        PRINTF("Checkpoints and batches are not supported in swap mode\n");
+        SEND_SW(dc, SW_NOT_SUPPORTED);
+        return false;
+    }
+    return true;
+}
+
+// Computes the hash of the global map, of the input and output maps and of the wallet policy in the
+// request, and of the protocol version; a checkpoint can only be used with the same ones.
+static void compute_checkpoint_commitment(sign_psbt_state_t *st,
+                                          const merkleized_map_commitment_t *global_map,
+                                          const uint8_t wallet_id[static 32]) {
+    cx_sha256_t hash_context;
+    cx_sha256_init(&hash_context);
+
+    crypto_hash_update_u8(&hash_context.header, st->protocol_version);
+    crypto_hash_update(&hash_context.header, wallet_id, 32);
+    crypto_hash_update_varint(&hash_context.header, global_map->size);
+    crypto_hash_update(&hash_context.header, global_map->keys_root, 32);
+    crypto_hash_update(&hash_context.header, global_map->values_root, 32);
+    crypto_hash_update_varint(&hash_context.header, st->n_inputs);
+    crypto_hash_update(&hash_context.header, st->inputs_root, 32);
+    crypto_hash_update_varint(&hash_context.header, st->n_outputs);
+    crypto_hash_update(&hash_context.header, st->outputs_root, 32);
+
+    crypto_hash_digest(&hash_context.header, st->checkpoint_commitment, 32);
+}
+
+// Computes the key of the transaction in the validated_psbt_cache from the checkpoint commitment,
+// the hmac of the wallet policy and the input mask, that changes which inputs can be internal. The
+// key replaces the checkpoint commitment.
+static void compute_validated_psbt_key(sign_psbt_state_t *st,
+                                       const uint8_t wallet_hmac[static 32]) {
+    cx_sha256_t hash_context;
+    cx_sha256_init(&hash_context);
+
+    crypto_hash_update(&hash_context.header, st->checkpoint_commitment, 32);
+    crypto_hash_update(&hash_context.header, wallet_hmac, 32);
+    crypto_hash_update_u8(&hash_context.header, st->has_input_mask);
+    if (st->has_input_mask) {
+        crypto_hash_update(&hash_context.header,
+                           st->input_mask,
+                           BITVECTOR_REAL_SIZE(st->sign_end - st->sign_begin));
+    }
+
+    crypto_hash_digest(&hash_context.header, st->validated_psbt_key, 32);
+}
+
+// Reads the commitment of a PSBT: the commitment of the global map, then the number and the Merkle
+// root of the commitments of the input maps, and the same for the output maps.
+static bool read_psbt_commitment(dispatcher_context_t *dc,
+                                 buffer_t *buf,
+                                 sign_psbt_state_t *st,
+                                 merkleized_map_commitment_t *global_map) {
+    if (!buffer_read_varint(buf, &global_map->size) ||
+        !buffer_read_bytes(buf, global_map->keys_root, 32) ||
+        !buffer_read_bytes(buf, global_map->values_root, 32)) {
+        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+        return false;
+    }
+
+    // we already know n_inputs and n_outputs, so we skip reading from the global map
+
+    uint64_t n_inputs_u64;
+    if (!buffer_read_varint(buf, &n_inputs_u64) || !buffer_read_bytes(buf, st->inputs_root, 32)) {
+        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+        return false;
+    }
+
+    if (n_inputs_u64 > MAX_N_INPUTS_CAN_CHECKPOINT) {
+        PRINTF("At most %d inputs are supported\n", MAX_N_INPUTS_CAN_CHECKPOINT);
+        SEND_SW(dc, SW_NOT_SUPPORTED);
+        return false;
+    }
+    st->n_inputs = (unsigned int) n_inputs_u64;
+
+    uint64_t n_outputs_u64;
+    if (!buffer_read_varint(buf, &n_outputs_u64) || !buffer_read_bytes(buf, st->outputs_root, 32)) {
+        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+        return false;
+    }
+    st->n_outputs = (unsigned int) n_outputs_u64;
+    return true;
+}
+
+// Checks the global map of the PSBT, and reads the transaction version and the locktime.
+static bool __attribute__((noinline)) process_global_map(
+    dispatcher_context_t *dc,
+    sign_psbt_state_t *st,
+    const merkleized_map_commitment_t *global_map) {
+    // Check integrity of the global map
+    if (call_check_merkle_tree_sorted(dc, global_map->keys_root, (size_t) global_map->size) < 0) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return false;
+    }
+
+    // Read tx version and fallback locktime.
+    // Unlike BIP-0370 recommendation, we use the fallback locktime as-is, ignoring each input's
+    // preferred height/block locktime. If that's relevant, the client must set the fallback
+    // locktime to the appropriate value before calling sign_psbt.
+    uint8_t tx_version_raw[4], locktime_raw[4];
+    merkleized_map_value_request_t requests[] = {
+        {.key_hash = PSBT_KEY_HASH(PSBT_GLOBAL_TX_VERSION),
+         .out = tx_version_raw,
+         .out_len = sizeof(tx_version_raw)},
+        {.key_hash = PSBT_KEY_HASH(PSBT_GLOBAL_FALLBACK_LOCKTIME),
+         .out = locktime_raw,
+         .out_len = sizeof(locktime_raw)}};
+    if (0 > call_get_merkleized_map_values(dc, global_map, requests, 2) ||
+        requests[0].value_len != 4 ||
+        (requests[1].value_len != -1 && requests[1].value_len != 4)) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return false;
+    }
+    st->tx_version = read_u32_le(tx_version_raw, 0);
+    st->locktime = requests[1].value_len == -1 ? 0 : read_u32_le(locktime_raw, 0);
+    return true;
+}
+
+static bool __attribute__((noinline)) init_global_state(dispatcher_context_t *dc,
+                                                        sign_psbt_state_t *st) {
+    LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    merkleized_map_commitment_t global_map;
+    const uint8_t *psbt_commitment = dc->read_buffer.ptr + dc->read_buffer.offset;
+    size_t psbt_commitment_begin = dc->read_buffer.offset;
+    if (!read_psbt_commitment(dc, &dc->read_buffer, st, &global_map)) return false;
+    size_t psbt_commitment_len = dc->read_buffer.offset - psbt_commitment_begin;
+
+    uint8_t wallet_hmac[32];
+    uint8_t wallet_id[32];
+    if (!buffer_read_bytes(&dc->read_buffer, wallet_id, 32) ||
+        !buffer_read_bytes(&dc->read_buffer, wallet_hmac, 32)) {
+        SEND_SW(dc, SW_WRONG_DATA_LENGTH);
+        return false;
+    }
+
+    if (!read_sign_psbt_mode(dc, st)) return false;
+
+    if ((st->mode == SIGN_PSBT_MODE_SIGN || st->mode == SIGN_PSBT_MODE_BATCH) &&
+        st->n_inputs > MAX_N_INPUTS_CAN_SIGN) {
+        PRINTF("At most %d inputs are supported\n", MAX_N_INPUTS_CAN_SIGN);
+        SEND_SW(dc, SW_NOT_SUPPORTED);
+        return false;
+    }
+
+    if (st->mode == SIGN_PSBT_MODE_CHECKPOINT || st->mode == SIGN_PSBT_MODE_RESUME) {
+        compute_checkpoint_commitment(st, &global_map, wallet_id);
+    } else if (st->mode == SIGN_PSBT_MODE_SIGN) {
+        compute_checkpoint_commitment(st, &global_map, wallet_id);
+        compute_validated_psbt_key(st, wallet_hmac);
+    } else if (st->mode == SIGN_PSBT_MODE_BATCH) {
+        // the first PSBT of the batch is fetched again from the vector of the commitments, if it
+        // has to be processed twice; it is recognized by this hash, as the request is overwritten
+        cx_sha256_t hash_context;
+        cx_sha256_init(&hash_context);
+        crypto_hash_update(&hash_context.header, psbt_commitment, psbt_commitment_len);
+        crypto_hash_digest(&hash_context.header, st->batch.first_psbt_hash, 32);
     }
 
+    if (!process_global_map(dc, st, &global_map)) return false;
+
     uint8_t hmac_or =
         0;  // the binary OR of all the hmac bytes (so == 0 iff the hmac is identically 0)
     for (int i = 0; i < 32; i++) {
         hmac_or = hmac_or | wallet_hmac[i];
     }
 
-    if (hmac_or != 0) {
-        // Verify hmac
-        if (!check_wallet_hmac(wallet_id, wallet_hmac)) {
-            PRINTF("Incorrect hmac\n");
-            SEND_SW(dc, SW_SIGNATURE_FAIL);
-            return false;
-        }
-
-        st->is_wallet_default = false;
-    } else {
-        st->is_wallet_default = true;
-    }
+    // a wallet policy in the on-device registry does not need an hmac
+    bool is_registered = is_wallet_policy_registered(wallet_id);
+    st->is_wallet_default = hmac_or == 0 && !is_registered;
 
     {
-        // Fetch the serialized wallet policy from the client
-        uint8_t serialized_wallet_policy[MAX_WALLET_POLICY_SERIALIZED_LENGTH];
-        int serialized_wallet_policy_len = call_get_preimage(dc,
-                                                             wallet_id,
-                                                             serialized_wallet_policy,
-                                                             sizeof(serialized_wallet_policy));
-        if (serialized_wallet_policy_len < 0) {
+        // Fetch the serialized wallet policy from the client, unless it is cached; it is fetched
+        // before verifying the hmac, so that the verified hmac can be cached as well
+        int desc_temp_len = fetch_and_parse_wallet_policy(dc,
+                                                          wallet_id,
+                                                          &st->wallet_header,
+                                                          st->wallet_policy_map_bytes,
+                                                          MAX_WALLET_POLICY_BYTES);
+        if (desc_temp_len < 0) {
+            PRINTF("Failed to read or parse wallet policy");
             SEND_SW(dc, SW_INCORRECT_DATA);
             return false;
         }
 
-        buffer_t serialized_wallet_policy_buf =
-            buffer_create(serialized_wallet_policy, serialized_wallet_policy_len);
-
-        uint8_t policy_map_descriptor[MAX_DESCRIPTOR_TEMPLATE_LENGTH];
+        st->wallet_policy_map = (policy_node_t *) st->wallet_policy_map_bytes;
 
-        int desc_temp_len = read_and_parse_wallet_policy(dc,
-                                                         &serialized_wallet_policy_buf,
-                                                         &st->wallet_header,
-                                                         policy_map_descriptor,
-                                                         st->wallet_policy_map_bytes,
-                                                         MAX_WALLET_POLICY_BYTES);
-        if (desc_temp_len < 0) {
-            PRINTF("Failed to read or parse wallet policy");
+        st->n_key_placeholders = get_key_placeholders(st->wallet_policy_map,
+                                                      st->key_placeholders,
+                                                      MAX_N_KEY_PLACEHOLDERS_IN_WALLET_POLICY);
+        if (st->n_key_placeholders < 0) {
+            PRINTF("Failed to list the key placeholders of the wallet policy\n");
             SEND_SW(dc, SW_INCORRECT_DATA);
             return false;
         }
 
-        st->wallet_policy_map = (policy_node_t *) st->wallet_policy_map_bytes;
-
-        if (st->is_wallet_default) {
+        if (!st->is_wallet_default) {
+            // Verify hmac
+            if (!is_registered && !wallet_policy_cache_is_hmac_verified(wallet_id, wallet_hmac)) {
+                if (!check_wallet_hmac(wallet_id, wallet_hmac)) {
+                    PRINTF("Incorrect hmac\n");
+                    SEND_SW(dc, SW_SIGNATURE_FAIL);
+                    return false;
+                }
+                wallet_policy_cache_set_hmac_verified(wallet_id, wallet_hmac);
+            }
+        } else {
             // No hmac, verify that the policy is indeed a default one
-            if (!is_wallet_policy_standard(dc, &st->wallet_header, st->wallet_policy_map)) {
+            if (!is_wallet_policy_standard_cached(dc,
+                                                  wallet_id,
+                                                  &st->wallet_header,
+                                                  st->wallet_policy_map)) {
                 PRINTF("Non-standard policy, and no hmac provided\n");
                 SEND_SW(dc, SW_INCORRECT_DATA);
                 return false;
             }
 
+            // its only key was derived from the seed when the verdict was computed: the
+            // placeholders do not need to derive it again
+            bitvector_set(st->verified_keys, 0, true);
+            bitvector_set(st->internal_keys, 0, true);
+
             if (st->wallet_header.name_len != 0) {
                 PRINTF("Name must be zero-length for a standard wallet policy\n");
                 SEND_SW(dc, SW_INCORRECT_DATA);
@@ -647,6 +1231,15 @@ static bool __attribute__((noinline)) init_global_state(dispatcher_context_t *dc
         }
     }
 
+    // the keys are needed for the placeholders and the derivations; fetch them all at once
+    if (0 > prefetch_policy_keys_info(dc,
+                                      st->wallet_header.version,
+                                      st->wallet_header.keys_info_merkle_root,
+                                      st->wallet_header.n_keys)) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return false;
+    }
+
     st->master_key_fingerprint = crypto_get_master_key_fingerprint();
     return true;
 }
@@ -656,28 +1249,14 @@ static bool __attribute__((noinline)) fill_placeholder_info_if_internal(
     sign_psbt_state_t *st,
     placeholder_info_t *placeholder_info) {
     policy_map_key_info_t key_info;
-    {
-        uint8_t key_info_str[MAX_POLICY_KEY_INFO_LEN];
-        int key_info_len = call_get_merkle_leaf_element(dc,
-                                                        st->wallet_header.keys_info_merkle_root,
-                                                        st->wallet_header.n_keys,
-                                                        placeholder_info->placeholder.key_index,
-                                                        key_info_str,
-                                                        sizeof(key_info_str));
-
-        if (key_info_len < 0) {
-            SEND_SW(dc, SW_BAD_STATE);  // should never happen
-            return false;
-        }
-
-        // Make a sub-buffer for the pubkey info
-        buffer_t key_info_buffer = buffer_create(key_info_str, key_info_len);
-
-        if (parse_policy_map_key_info(&key_info_buffer, &key_info, st->wallet_header.version) ==
-            -1) {
-            SEND_SW(dc, SW_BAD_STATE);  // should never happen
-            return false;
-        }
+    if (0 > get_policy_key_info(dc,
+                                st->wallet_header.version,
+                                st->wallet_header.keys_info_merkle_root,
+                                st->wallet_header.n_keys,
+                                placeholder_info->placeholder.key_index,
+                                &key_info)) {
+        SEND_SW(dc, SW_BAD_STATE);  // should never happen
+        return false;
     }
 
     uint32_t fpr = read_u32_be(key_info.master_key_fingerprint, 0);
@@ -687,27 +1266,50 @@ static bool __attribute__((noinline)) fill_placeholder_info_if_internal(
 
     {
         // it could be a collision on the fingerprint; we verify that we can actually generate
-        // the same pubkey
-        if (0 > get_extended_pubkey_at_path(key_info.master_key_derivation,
-                                            key_info.master_key_derivation_len,
-                                            BIP32_PUBKEY_VERSION,
-                                            &placeholder_info->pubkey)) {
-            SEND_SW(dc, SW_BAD_STATE);
-            return false;
-        }
+        // the same pubkey. The same key can be in several placeholders, but it is only derived
+        // once per command
+        uint32_t key_index = placeholder_info->placeholder.key_index;
+        bool is_verified = key_index < MAX_N_KEYS_IN_WALLET_POLICY &&
+                           bitvector_get(st->verified_keys, key_index);
+        if (is_verified) {
+            if (!bitvector_get(st->internal_keys, key_index)) {
+                return false;
+            }
+            // equal to the derived one
+        } else {
+            serialized_extended_pubkey_t pubkey;
+            if (0 > get_wallet_extended_pubkey_at_path(key_info.master_key_derivation,
+                                                       key_info.master_key_derivation_len,
+                                                       BIP32_PUBKEY_VERSION,
+                                                       &pubkey)) {
+                SEND_SW(dc, SW_BAD_STATE);
+                return false;
+            }
 
-        if (memcmp(&key_info.ext_pubkey,
-                   &placeholder_info->pubkey,
-                   sizeof(placeholder_info->pubkey)) != 0) {
-            return false;
+            bool is_internal = memcmp(&key_info.ext_pubkey, &pubkey, sizeof(pubkey)) == 0;
+            if (key_index < MAX_N_KEYS_IN_WALLET_POLICY) {
+                bitvector_set(st->verified_keys, key_index, true);
+                bitvector_set(st->internal_keys, key_index, is_internal);
+            }
+            if (!is_internal) {
+                return false;
+            }
         }
 
+        memcpy(placeholder_info->compressed_pubkey,
+               key_info.ext_pubkey.compressed_pubkey,
+               sizeof(placeholder_info->compressed_pubkey));
+        memcpy(placeholder_info->chain_code,
+               key_info.ext_pubkey.chain_code,
+               sizeof(placeholder_info->chain_code));
+
         placeholder_info->key_derivation_length = key_info.master_key_derivation_len;
         for (int i = 0; i < key_info.master_key_derivation_len; i++) {
             placeholder_info->key_derivation[i] = key_info.master_key_derivation[i];
         }
 
         placeholder_info->fingerprint = read_u32_be(key_info.master_key_fingerprint, 0);
+        placeholder_info->keys_root = st->wallet_header.keys_info_merkle_root;
     }
 
     return true;
@@ -717,30 +1319,15 @@ static bool __attribute__((noinline)) fill_placeholder_info_if_internal(
 static bool find_first_internal_key_placeholder(dispatcher_context_t *dc,
                                                 sign_psbt_state_t *st,
                                                 placeholder_info_t *placeholder_info) {
-    placeholder_info->cur_index = 0;
-
     // find and parse our registered key info in the wallet
-    while (true) {
-        int n_key_placeholders = get_key_placeholder_by_index(st->wallet_policy_map,
-                                                              placeholder_info->cur_index,
-                                                              NULL,
-                                                              &placeholder_info->placeholder);
-        if (n_key_placeholders < 0) {
-            SEND_SW(dc, SW_BAD_STATE);  // should never happen
-            return false;
-        }
-
-        if (placeholder_info->cur_index >= n_key_placeholders) {
-            // all keys have been processed
-            break;
-        }
+    for (placeholder_info->cur_index = 0; placeholder_info->cur_index < st->n_key_placeholders;
+         ++placeholder_info->cur_index) {
+        placeholder_info->placeholder =
+            *st->key_placeholders[placeholder_info->cur_index].placeholder;
 
         if (fill_placeholder_info_if_internal(dc, st, placeholder_info)) {
             return true;
         }
-
-        // Not an internal key, move on
-        ++placeholder_info->cur_index;
     }
 
     PRINTF("No internal key found in wallet policy");
@@ -756,6 +1343,7 @@ typedef struct {
 /**
  * Callback to process all the keys of the current input map.
  * Keeps track if the current input has a witness_utxo and/or a redeemScript.
+ * The key derivations are not parsed if placeholder_info is NULL.
  */
 static void input_keys_callback(dispatcher_context_t *dc,
                                 input_keys_callback_data_t *callback_data,
@@ -776,6 +1364,7 @@ static void input_keys_callback(dispatcher_context_t *dc,
             callback_data->input->has_sighash_type = true;
         } else if ((key_type == PSBT_IN_BIP32_DERIVATION ||
                     key_type == PSBT_IN_TAP_BIP32_DERIVATION) &&
+                   callback_data->placeholder_info != NULL &&
                    !callback_data->input->in_out.placeholder_found) {
             if (0 >
                 read_change_and_index_from_psbt_bip32_derivation(dc,
@@ -791,6 +1380,21 @@ static void input_keys_callback(dispatcher_context_t *dc,
     }
 }
 
+// Keeps the record of an internal input whose derivation was matched with the placeholder of the
+// records, if there is room left. Returns the record, that the caller can complete, or NULL.
+static input_record_t *save_input_record(sign_psbt_state_t *st, const input_info_t *input) {
+    if (st->input_records.n_records >= N_INPUT_RECORDS) {
+        return NULL;
+    }
+    input_record_t *record = &st->input_records.records[st->input_records.n_records++];
+    record->address_index = input->in_out.address_index;
+    record->flags = input->in_out.is_change ? INPUT_RECORD_IS_CHANGE : 0;
+    record->sighash_type = 0;
+    record->scriptPubKey_len = input->in_out.scriptPubKey_len;
+    memcpy(record->scriptPubKey, input->in_out.scriptPubKey, input->in_out.scriptPubKey_len);
+    return record;
+}
+
 static bool __attribute__((noinline)) preprocess_inputs(
     dispatcher_context_t *dc,
     sign_psbt_state_t *st,
@@ -804,13 +1408,56 @@ static bool __attribute__((noinline)) preprocess_inputs(
 
     if (!find_first_internal_key_placeholder(dc, st, &placeholder_info)) return false;
 
+    st->input_records.n_records = 0;
+    st->input_records.placeholder_index = placeholder_info.cur_index;
+    st->need_sha_outputs = false;
+    st->single_outputs.n_outputs = 0;
+
+    // The hashes of all the prevouts, amounts, scriptPubKeys and sequences used in BIP-143 and
+    // BIP-341 are computed while walking the inputs, so that no other pass is needed when signing.
+    // Legacy inputs need none of them, and only BIP-341 uses the amounts and scriptPubKeys.
+    int policy_segwit_version = get_policy_segwit_version(st->wallet_policy_map);
+    bool need_bip143_hashes = policy_segwit_version >= 0;
+    bool need_bip341_hashes = policy_segwit_version >= 1;
+
+    // the contexts are kept out of the stack, as they live during the whole walk of the inputs
+    cx_sha256_t *sha_prevouts_context = hash_pool_acquire_sha256();
+    cx_sha256_t *sha_amounts_context = hash_pool_acquire_sha256();
+    cx_sha256_t *sha_scriptpubkeys_context = hash_pool_acquire_sha256();
+    cx_sha256_t *sha_sequences_context = hash_pool_acquire_sha256();
+    if (sha_prevouts_context == NULL || sha_amounts_context == NULL ||
+        sha_scriptpubkeys_context == NULL || sha_sequences_context == NULL) {
+        SEND_SW(dc, SW_BAD_STATE);
+        return false;
+    }
+    cx_sha256_init(sha_prevouts_context);
+    cx_sha256_init(sha_amounts_context);
+    cx_sha256_init(sha_scriptpubkeys_context);
+    cx_sha256_init(sha_sequences_context);
+
+    // let the client prepare the input maps that we are about to request
+    if (st->n_inputs > 1 &&
+        0 > call_hint_merkle_leaves(dc, st->inputs_root, st->n_inputs, 0, st->n_inputs)) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return false;
+    }
+
+    // index of the first input whose non-witness-utxo was not parsed together with previous inputs
+    unsigned int next_prevtx_lookahead_index = 0;
+
     // process each input
     for (unsigned int cur_input_index = 0; cur_input_index < st->n_inputs; cur_input_index++) {
+        TRACE(TRACE_EV_INPUT, cur_input_index);
+
         input_info_t input;
         memset(&input, 0, sizeof(input));
 
-        input_keys_callback_data_t callback_data = {.input = &input,
-                                                    .placeholder_info = &placeholder_info};
+        // the inputs that the client marked as external are still validated, but their keys are
+        // not matched against the wallet policy; hence, they are external
+        input_keys_callback_data_t callback_data = {
+            .input = &input,
+            .placeholder_info = can_input_be_internal(st, cur_input_index) ? &placeholder_info
+                                                                           : NULL};
         int res = call_get_merkleized_map_with_callback(
             dc,
             (void *) &callback_data,
@@ -831,6 +1478,16 @@ static bool __attribute__((noinline)) preprocess_inputs(
             return false;
         }
 
+        // The input map is read again by the following passes, so its values are kept in RAM if
+        // it is small enough; the non-witness utxo is left out, as it is the largest value of the
+        // map, and it is parsed while it is streamed. Its key type 0x00 sorts before all the others.
+        if (0 > call_load_merkleized_map_values(dc,
+                                                &input.in_out.map,
+                                                input.has_nonWitnessUtxo ? 1 : 0)) {
+            SEND_SW(dc, SW_INCORRECT_DATA);
+            return false;
+        }
+
         // either witness utxo or non-witness utxo (or both) must be present.
         if (!input.has_nonWitnessUtxo && !input.has_witnessUtxo) {
             PRINTF("No witness utxo nor non-witness utxo present in input.\n");
@@ -838,30 +1495,86 @@ static bool __attribute__((noinline)) preprocess_inputs(
             return false;
         }
 
-        // validate non-witness utxo (if present) and witness utxo (if present)
-
-        if (input.has_nonWitnessUtxo) {
-            uint8_t prevout_hash[32];
+        // get prevout hash, output index and sequence for this input, with a single request
+        uint8_t prevout_hash[32];
+        uint8_t prevout_n_raw[4];
+        uint8_t nSequence_raw[4];
+        merkleized_map_value_request_t requests[] = {
+            {.key_hash = PSBT_KEY_HASH(PSBT_IN_PREVIOUS_TXID),
+             .out = prevout_hash,
+             .out_len = sizeof(prevout_hash)},
+            {.key_hash = PSBT_KEY_HASH(PSBT_IN_OUTPUT_INDEX),
+             .out = prevout_n_raw,
+             .out_len = sizeof(prevout_n_raw)},
+            {.key_hash = PSBT_KEY_HASH(PSBT_IN_SEQUENCE),
+             .out = nSequence_raw,
+             .out_len = sizeof(nSequence_raw)}};
+        // the output index and the sequence are only needed for the BIP-143 hashes
+        if (0 > call_get_merkleized_map_values(dc,
+                                               &input.in_out.map,
+                                               requests,
+                                               need_bip143_hashes ? 3 : 1) ||
+            requests[0].value_len != 32) {
+            SEND_SW(dc, SW_INCORRECT_DATA);
+            return false;
+        }
 
-            // check if the prevout_hash of the transaction matches the computed one from the
-            // non-witness utxo
-            if (0 > call_get_merkleized_map_value(dc,
-                                                  &input.in_out.map,
-                                                  (uint8_t[]){PSBT_IN_PREVIOUS_TXID},
-                                                  1,
-                                                  prevout_hash,
-                                                  sizeof(prevout_hash))) {
+        if (need_bip143_hashes) {
+            if (requests[1].value_len != 4) {
                 SEND_SW(dc, SW_INCORRECT_DATA);
                 return false;
             }
 
-            // request non-witness utxo, and get the prevout's value and scriptpubkey
+            if (requests[2].value_len != 4) {
+                // if no PSBT_IN_SEQUENCE is present, we must assume nSequence 0xFFFFFFFF
+                memset(nSequence_raw, 0xFF, sizeof(nSequence_raw));
+            }
+
+            crypto_hash_update(&sha_prevouts_context->header, prevout_hash, sizeof(prevout_hash));
+            crypto_hash_update(&sha_prevouts_context->header, prevout_n_raw, sizeof(prevout_n_raw));
+            crypto_hash_update(&sha_sequences_context->header,
+                               nSequence_raw,
+                               sizeof(nSequence_raw));
+        }
+
+        // validate non-witness utxo (if present) and witness utxo (if present)
+
+        // BIP-341 signatures commit to the amounts and the scriptPubKeys of all the inputs, so for
+        // taproot policies the witness utxo is enough: the non-witness utxo is not even requested
+        bool use_nonWitnessUtxo =
+            input.has_nonWitnessUtxo && !(policy_segwit_version >= 1 && input.has_witnessUtxo);
+
+        if (use_nonWitnessUtxo) {
+            // the following inputs spending outputs of the same transaction are parsed in the same
+            // pass, unless this input is one of them
+            uint32_t other_prevout_ns[PSBT_PARSE_RAWTX_MAX_OUTPUTS - 1];
+            int n_other_prevout_ns = 0;
+            if (cur_input_index >= next_prevtx_lookahead_index) {
+                n_other_prevout_ns =
+                    get_next_prevout_ns_with_same_txid(dc,
+                                                       st,
+                                                       cur_input_index,
+                                                       prevout_hash,
+                                                       other_prevout_ns,
+                                                       PSBT_PARSE_RAWTX_MAX_OUTPUTS - 1);
+                if (n_other_prevout_ns < 0) {
+                    SEND_SW(dc, SW_INCORRECT_DATA);
+                    return false;
+                }
+                next_prevtx_lookahead_index = cur_input_index + 1 + n_other_prevout_ns;
+            }
+
+            // request non-witness utxo, and get the prevout's value and scriptpubkey; also checks
+            // that the prevout_hash of the transaction matches the computed one from the
+            // non-witness utxo
             if (0 > get_amount_scriptpubkey_from_psbt_nonwitness(dc,
                                                                  &input.in_out.map,
                                                                  &input.prevout_amount,
                                                                  input.in_out.scriptPubKey,
                                                                  &input.in_out.scriptPubKey_len,
-                                                                 prevout_hash)) {
+                                                                 prevout_hash,
+                                                                 other_prevout_ns,
+                                                                 n_other_prevout_ns)) {
                 SEND_SW(dc, SW_INCORRECT_DATA);
                 return false;
             }
@@ -883,7 +1596,7 @@ static bool __attribute__((noinline)) preprocess_inputs(
                 return false;
             };
 
-            if (input.has_nonWitnessUtxo) {
+            if (use_nonWitnessUtxo) {
                 // we already know the scriptPubKey, but we double check that it matches
                 if (input.in_out.scriptPubKey_len != wit_utxo_scriptPubkey_len ||
                     memcmp(input.in_out.scriptPubKey,
@@ -906,6 +1619,18 @@ static bool __attribute__((noinline)) preprocess_inputs(
             }
         }
 
+        if (need_bip341_hashes) {
+            uint8_t prevout_amount_le[8];
+            write_u64_le(prevout_amount_le, 0, input.prevout_amount);
+            crypto_hash_update(&sha_amounts_context->header, prevout_amount_le, 8);
+
+            crypto_hash_update_varint(&sha_scriptpubkeys_context->header,
+                                      input.in_out.scriptPubKey_len);
+            crypto_hash_update(&sha_scriptpubkeys_context->header,
+                               input.in_out.scriptPubKey,
+                               input.in_out.scriptPubKey_len);
+        }
+
         // check if the input is internal; if not, continue
 
         int is_internal = is_in_out_internal(dc, st, &input.in_out, true);
@@ -916,11 +1641,16 @@ static bool __attribute__((noinline)) preprocess_inputs(
         } else if (is_internal == 0) {
             ++st->n_external_inputs;
 
-            PRINTF("INPUT %d is external\n", cur_input_index);
+            LOG_DEBUG("INPUT %d is external\n", cur_input_index);
             continue;
         }
 
-        bitvector_set(internal_inputs, cur_input_index, 1);
+        // with a checkpoint, the internal inputs are found again in each command that signs them
+        input_record_t *record = NULL;
+        if (st->mode != SIGN_PSBT_MODE_CHECKPOINT) {
+            bitvector_set(internal_inputs, cur_input_index, 1);
+            record = save_input_record(st, &input);
+        }
 
         int segwit_version = get_policy_segwit_version(st->wallet_policy_map);
 
@@ -938,7 +1668,7 @@ static bool __attribute__((noinline)) preprocess_inputs(
         // For segwitv0 inputs, the non-witness utxo _should_ be present; we show a warning
         // to the user otherwise, but we continue nonetheless on approval
         if (segwit_version == 0 && !input.has_nonWitnessUtxo) {
-            PRINTF("Non-witness utxo missing for segwitv0 input. Will show a warning.\n");
+            LOG_DEBUG("Non-witness utxo missing for segwitv0 input. Will show a warning.\n");
             st->warnings.missing_nonwitnessutxo = true;
         }
 
@@ -953,15 +1683,16 @@ static bool __attribute__((noinline)) preprocess_inputs(
         // SIGHASH_ALL, we show a warning
 
         if (!input.has_sighash_type) {
+            // the default sighash type signs all the outputs
+            st->need_sha_outputs = true;
             continue;
         }
 
         // get the sighash_type
-        if (4 != call_get_merkleized_map_value_u32_le(dc,
-                                                      &input.in_out.map,
-                                                      (uint8_t[]){PSBT_IN_SIGHASH_TYPE},
-                                                      1,
-                                                      &input.sighash_type)) {
+        if (4 != call_get_merkleized_map_value_u32_le_by_hash(dc,
+                                                              &input.in_out.map,
+                                                              PSBT_KEY_HASH(PSBT_IN_SIGHASH_TYPE),
+                                                              &input.sighash_type)) {
             PRINTF("Malformed PSBT_IN_SIGHASH_TYPE for input %d\n", cur_input_index);
 
             SEND_SW(dc, SW_INCORRECT_DATA);
@@ -970,7 +1701,7 @@ static bool __attribute__((noinline)) preprocess_inputs(
 
         if (((segwit_version > 0) && (input.sighash_type == SIGHASH_DEFAULT)) ||
             (input.sighash_type == SIGHASH_ALL)) {
-            PRINTF("Sighash type is SIGHASH_DEFAULT or SIGHASH_ALL\n");
+            LOG_DEBUG("Sighash type is SIGHASH_DEFAULT or SIGHASH_ALL\n");
 
         } else if ((segwit_version >= 0) &&
                    ((input.sighash_type == SIGHASH_NONE) ||
@@ -992,6 +1723,20 @@ static bool __attribute__((noinline)) preprocess_inputs(
             SEND_SW(dc, SW_NOT_SUPPORTED);
             return false;
         }
+
+        if ((input.sighash_type & 3) == SIGHASH_SINGLE) {
+            if (st->single_outputs.n_outputs < N_SINGLE_OUTPUT_HASHES) {
+                st->single_outputs.output_indices[st->single_outputs.n_outputs++] =
+                    cur_input_index;
+            }
+        } else if ((input.sighash_type & 3) != SIGHASH_NONE) {
+            st->need_sha_outputs = true;
+        }
+
+        if (record != NULL) {
+            record->sighash_type = (uint8_t) input.sighash_type;
+            record->flags |= INPUT_RECORD_HAS_SIGHASH_TYPE;
+        }
     }
 
     if (st->n_external_inputs == st->n_inputs) {
@@ -1001,6 +1746,19 @@ static bool __attribute__((noinline)) preprocess_inputs(
         return false;
     }
 
+    if (need_bip143_hashes) {
+        crypto_hash_digest(&sha_prevouts_context->header, st->hashes.sha_prevouts, 32);
+        crypto_hash_digest(&sha_sequences_context->header, st->hashes.sha_sequences, 32);
+    }
+    if (need_bip341_hashes) {
+        crypto_hash_digest(&sha_amounts_context->header, st->hashes.sha_amounts, 32);
+        crypto_hash_digest(&sha_scriptpubkeys_context->header, st->hashes.sha_scriptpubkeys, 32);
+    }
+
+    hash_pool_release(sha_prevouts_context);
+    hash_pool_release(sha_amounts_context);
+    hash_pool_release(sha_scriptpubkeys_context);
+    hash_pool_release(sha_sequences_context);
     return true;
 }
 
@@ -1062,7 +1820,30 @@ static bool __attribute__((noinline)) preprocess_outputs(
     // (0-indexed here, although the UX starts with 1)
     int external_outputs_count = 0;
 
+    // sha_outputs of BIP-143 and BIP-341 (or the hash of the outputs preimage, for legacy
+    // policies) is computed while walking the outputs, so that no other pass is needed when
+    // signing; it is not needed if all the internal inputs use SIGHASH_NONE or SIGHASH_SINGLE
+    bool is_segwit = get_policy_segwit_version(st->wallet_policy_map) >= 0;
+    bool need_sha_outputs = is_segwit && st->need_sha_outputs;
+    st->has_outputs_preimage_hash =
+        !is_segwit && st->protocol_version >= PROTOCOL_VERSION_OUTPUTS_PREIMAGE;
+    cx_sha256_t sha_outputs_context;
+    cx_sha256_init(&sha_outputs_context);
+    if (st->has_outputs_preimage_hash) {
+        crypto_hash_update_u8(&sha_outputs_context.header, 0x00);
+        crypto_hash_update_varint(&sha_outputs_context.header, st->n_outputs);
+    }
+
+    // let the client prepare the output maps that we are about to request
+    if (st->n_outputs > 1 &&
+        0 > call_hint_merkle_leaves(dc, st->outputs_root, st->n_outputs, 0, st->n_outputs)) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return false;
+    }
+
     for (unsigned int cur_output_index = 0; cur_output_index < st->n_outputs; cur_output_index++) {
+        TRACE(TRACE_EV_OUTPUT, cur_output_index);
+
         output_info_t output;
         memset(&output, 0, sizeof(output));
 
@@ -1088,17 +1869,14 @@ static bool __attribute__((noinline)) preprocess_outputs(
             return false;
         }
 
-        // Read output amount
+        // Read the output's amount and scriptPubKey
         uint8_t raw_result[8];
-
-        // Read the output's amount
-        int result_len = call_get_merkleized_map_value(dc,
+        int result_len = read_output_amount_and_script(dc,
                                                        &output.in_out.map,
-                                                       (uint8_t[]){PSBT_OUT_AMOUNT},
-                                                       1,
                                                        raw_result,
-                                                       sizeof(raw_result));
-        if (result_len != 8) {
+                                                       output.in_out.scriptPubKey,
+                                                       sizeof(output.in_out.scriptPubKey));
+        if (result_len == -1) {
             SEND_SW(dc, SW_INCORRECT_DATA);
             return false;
         }
@@ -1107,20 +1885,29 @@ static bool __attribute__((noinline)) preprocess_outputs(
         output.value = value;
         st->outputs.total_amount += value;
 
-        // Read the output's scriptPubKey
-        result_len = call_get_merkleized_map_value(dc,
-                                                   &output.in_out.map,
-                                                   (uint8_t[]){PSBT_OUT_SCRIPT},
-                                                   1,
-                                                   output.in_out.scriptPubKey,
-                                                   sizeof(output.in_out.scriptPubKey));
+        output.in_out.scriptPubKey_len = result_len;
 
-        if (result_len == -1 || result_len > (int) sizeof(output.in_out.scriptPubKey)) {
-            SEND_SW(dc, SW_INCORRECT_DATA);
-            return false;
+        if (need_sha_outputs || st->has_outputs_preimage_hash) {
+            crypto_hash_update(&sha_outputs_context.header, raw_result, sizeof(raw_result));
+            crypto_hash_update_varint(&sha_outputs_context.header, output.in_out.scriptPubKey_len);
+            crypto_hash_update(&sha_outputs_context.header,
+                               output.in_out.scriptPubKey,
+                               output.in_out.scriptPubKey_len);
         }
 
-        output.in_out.scriptPubKey_len = result_len;
+        for (unsigned int i = 0; i < st->single_outputs.n_outputs; i++) {
+            if (st->single_outputs.output_indices[i] == cur_output_index) {
+                cx_sha256_t sha_output_context;
+                cx_sha256_init(&sha_output_context);
+                crypto_hash_update(&sha_output_context.header, raw_result, sizeof(raw_result));
+                crypto_hash_update_varint(&sha_output_context.header,
+                                          output.in_out.scriptPubKey_len);
+                crypto_hash_update(&sha_output_context.header,
+                                   output.in_out.scriptPubKey,
+                                   output.in_out.scriptPubKey_len);
+                crypto_hash_digest(&sha_output_context.header, st->single_outputs.hashes[i], 32);
+            }
+        }
 
         int is_internal = is_in_out_internal(dc, st, &output.in_out, false);
 
@@ -1155,6 +1942,12 @@ static bool __attribute__((noinline)) preprocess_outputs(
 
     st->n_external_outputs = external_outputs_count;
 
+    if (need_sha_outputs) {
+        crypto_hash_digest(&sha_outputs_context.header, st->hashes.sha_outputs, 32);
+    } else if (st->has_outputs_preimage_hash) {
+        crypto_hash_digest(&sha_outputs_context.header, st->outputs_preimage_hash, 32);
+    }
+
     if (st->inputs_total_amount < st->outputs.total_amount) {
         PRINTF("Negative fee is invalid\n");
         // negative fee transaction is invalid
@@ -1162,6 +1955,11 @@ static bool __attribute__((noinline)) preprocess_outputs(
         return false;
     }
 
+    // The totals are only computed here; together with the cached external outputs, they are all
+    // that the swap checks need, so that no output is fetched again while the exchange is waiting
+    st->outputs.fee = st->inputs_total_amount - st->outputs.total_amount;
+    st->outputs.external_total_amount = st->outputs.total_amount - st->outputs.change_total_amount;
+
     if (st->outputs.n_change > 10) {
         // As the information regarding change outputs is aggregated, we want to prevent the user
         // from unknowingly signing a transaction that sends the change to too many outputs
@@ -1200,8 +1998,6 @@ static bool __attribute__((noinline)) execute_swap_checks(dispatcher_context_t *
         finalize_exchange_sign_transaction(false);
     }
 
-    uint64_t fee = st->inputs_total_amount - st->outputs.total_amount;
-
     // The index of the swap destination address in the cache of external outputs.
     // NB: this is _not_ the output index in the transaction, as change outputs are skipped.
     int swap_dest_idx = -1;
@@ -1294,49 +2090,29 @@ static bool __attribute__((noinline)) execute_swap_checks(dispatcher_context_t *
                   "External output index out of range for swap\n");
 
     // Check that total amount and fees are as expected
-    if (fee != G_swap_state.fees) {
+    if (st->outputs.fee != G_swap_state.fees) {
         PRINTF("Mismatching fee for swap\n");
         SEND_SW(dc, SW_FAIL_SWAP);
         finalize_exchange_sign_transaction(false);
     }
 
-    uint64_t spent_amount = st->outputs.total_amount - st->outputs.change_total_amount;
-    if (spent_amount != G_swap_state.amount) {
+    if (st->outputs.external_total_amount != G_swap_state.amount) {
         PRINTF("Mismatching spent amount for swap\n");
         SEND_SW(dc, SW_FAIL_SWAP);
         finalize_exchange_sign_transaction(false);
     }
 
-    // Compute this output's address
-    char output_description[MAX_OUTPUT_SCRIPT_DESC_SIZE];
-
-    if (!format_script(st->outputs.output_scripts[swap_dest_idx],
-                       st->outputs.output_script_lengths[swap_dest_idx],
-                       output_description)) {
-        PRINTF("Invalid or unsupported script for external output\n");
-        SEND_SW(dc, SW_FAIL_SWAP);
-        finalize_exchange_sign_transaction(false);
-    }
-
-    char output_description_len = strlen(output_description);
-
-    // Check that the external output's address matches the request from app-exchange
-    int swap_addr_len = strlen(G_swap_state.destination_address);
-    if (swap_addr_len != output_description_len ||
-        0 !=
-            strncmp(G_swap_state.destination_address, output_description, output_description_len)) {
-        // address did not match
+    // Check that the external output's script matches the address requested by app-exchange,
+    // that was decoded when the swap parameters were copied
+    const uint8_t *dest_script = st->outputs.output_scripts[swap_dest_idx];
+    size_t dest_script_len = st->outputs.output_script_lengths[swap_dest_idx];
+    if (dest_script_len != G_swap_state.destination_script_len ||
+        memcmp(dest_script, G_swap_state.destination_script, dest_script_len) != 0) {
         PRINTF("Mismatching address for swap\n");
-        PRINTF("Expected: ");
-        for (int i = 0; i < swap_addr_len; i++) {
-            PRINTF("%c", G_swap_state.destination_address[i]);
-        }
-        PRINTF("\n");
-        PRINTF("Found: ");
-        for (int i = 0; i < output_description_len; i++) {
-            PRINTF("%c", output_description[i]);
-        }
-        PRINTF("\n");
+        PRINTF("Expected script: %.*H\n",
+               G_swap_state.destination_script_len,
+               G_swap_state.destination_script);
+        PRINTF("Found script: %.*H\n", (int) dest_script_len, dest_script);
         SEND_SW(dc, SW_FAIL_SWAP);
         finalize_exchange_sign_transaction(false);
     }
@@ -1363,10 +2139,19 @@ static bool __attribute__((noinline)) display_output(
         return false;
     }
 
+    // in the combined review of a batch, the outputs are numbered across all the PSBTs, whose
+    // total number is not known until the last one
+    int index = external_outputs_count;
+    int total_count = st->n_external_outputs;
+    if (st->mode == SIGN_PSBT_MODE_BATCH && st->batch.review == SIGN_PSBT_BATCH_REVIEW_COMBINED) {
+        index += st->batch.n_shown_outputs;
+        total_count = 0;
+    }
+
     // Show address to the user
     if (!ui_validate_output(dc,
-                            external_outputs_count,
-                            st->n_external_outputs,
+                            index,
+                            total_count,
                             output_description,
                             COIN_COINID_SHORT,
                             out_amount)) {
@@ -1399,35 +2184,18 @@ static bool get_output_script_and_amount(
         return false;
     }
 
-    // Read output amount
+    // Read the output's amount and scriptPubKey
     uint8_t raw_result[8];
-
-    // Read the output's amount
-    int result_len = call_get_merkleized_map_value(dc,
+    int result_len = read_output_amount_and_script(dc,
                                                    &map,
-                                                   (uint8_t[]){PSBT_OUT_AMOUNT},
-                                                   1,
                                                    raw_result,
-                                                   sizeof(raw_result));
-    if (result_len != 8) {
-        SEND_SW(dc, SW_INCORRECT_DATA);
-        return false;
-    }
-    uint64_t value = read_u64_le(raw_result, 0);
-    *out_amount = value;
-
-    // Read the output's scriptPubKey
-    result_len = call_get_merkleized_map_value(dc,
-                                               &map,
-                                               (uint8_t[]){PSBT_OUT_SCRIPT},
-                                               1,
-                                               out_scriptPubKey,
-                                               MAX_OUTPUT_SCRIPTPUBKEY_LEN);
-
-    if (result_len == -1 || result_len > MAX_OUTPUT_SCRIPTPUBKEY_LEN) {
+                                                   out_scriptPubKey,
+                                                   MAX_OUTPUT_SCRIPTPUBKEY_LEN);
+    if (result_len == -1) {
         SEND_SW(dc, SW_INCORRECT_DATA);
         return false;
     }
+    *out_amount = read_u64_le(raw_result, 0);
 
     *out_scriptPubKey_len = result_len;
 
@@ -1448,24 +2216,26 @@ static bool __attribute__((noinline)) display_external_outputs(
     // (0-indexed here, although the UX starts with 1)
     int external_outputs_count = 0;
 
+    // Each output is only fetched and formatted right before its page is shown, once the user
+    // moved past the previous one; therefore, the time before the first page does not depend on
+    // the number of outputs.
     for (unsigned int cur_output_index = 0; cur_output_index < st->n_outputs; cur_output_index++) {
         if (!bitvector_get(internal_outputs, cur_output_index)) {
             // external output, user needs to validate
-            uint8_t out_scriptPubKey[MAX_OUTPUT_SCRIPTPUBKEY_LEN];
+            uint8_t fetched_scriptPubKey[MAX_OUTPUT_SCRIPTPUBKEY_LEN];
+            const uint8_t *out_scriptPubKey = fetched_scriptPubKey;
             size_t out_scriptPubKey_len;
             uint64_t out_amount;
 
             if (external_outputs_count < N_CACHED_EXTERNAL_OUTPUTS) {
-                // we have the output cached, no need to fetch it again
+                // we have the output cached, no need to fetch or copy it again
+                out_scriptPubKey = st->outputs.output_scripts[external_outputs_count];
                 out_scriptPubKey_len = st->outputs.output_script_lengths[external_outputs_count];
-                memcpy(out_scriptPubKey,
-                       st->outputs.output_scripts[external_outputs_count],
-                       out_scriptPubKey_len);
                 out_amount = st->outputs.output_amounts[external_outputs_count];
             } else if (!get_output_script_and_amount(dc,
                                                      st,
                                                      cur_output_index,
-                                                     out_scriptPubKey,
+                                                     fetched_scriptPubKey,
                                                      &out_scriptPubKey_len,
                                                      &out_amount)) {
                 SEND_SW(dc, SW_INCORRECT_DATA);
@@ -1520,7 +2290,7 @@ static bool __attribute__((noinline)) display_transaction(
     const uint8_t internal_outputs[static BITVECTOR_REAL_SIZE(MAX_N_OUTPUTS_CAN_SIGN)]) {
     LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
-    uint64_t fee = st->inputs_total_amount - st->outputs.total_amount;
+    uint64_t fee = st->outputs.fee;
 
     /** INPUT VERIFICATION ALERTS
      *
@@ -1644,14 +2414,18 @@ static bool __attribute__((noinline)) compute_sighash_legacy(dispatcher_context_
                                                              uint8_t sighash[static 32]) {
     LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
-    cx_sha256_t sighash_context;
-    cx_sha256_init(&sighash_context);
+    cx_sha256_t *sighash_context = hash_pool_acquire_sha256();
+    if (sighash_context == NULL) {
+        SEND_SW(dc, SW_BAD_STATE);
+        return false;
+    }
+    cx_sha256_init(sighash_context);
 
     uint8_t tmp[4];
     write_u32_le(tmp, 0, st->tx_version);
-    crypto_hash_update(&sighash_context.header, tmp, 4);
+    crypto_hash_update(&sighash_context->header, tmp, 4);
 
-    crypto_hash_update_varint(&sighash_context.header, st->n_inputs);
+    crypto_hash_update_varint(&sighash_context->header, st->n_inputs);
 
     for (unsigned int i = 0; i < st->n_inputs; i++) {
         // get this input's map
@@ -1669,41 +2443,31 @@ static bool __attribute__((noinline)) compute_sighash_legacy(dispatcher_context_
             memcpy(&ith_map, &input->in_out.map, sizeof(input->in_out.map));
         }
 
-        // get prevout hash and output index for the i-th input
+        // get prevout hash, output index and sequence for the i-th input
         uint8_t ith_prevout_hash[32];
-        if (32 != call_get_merkleized_map_value(dc,
-                                                &ith_map,
-                                                (uint8_t[]){PSBT_IN_PREVIOUS_TXID},
-                                                1,
-                                                ith_prevout_hash,
-                                                32)) {
-            SEND_SW(dc, SW_INCORRECT_DATA);
-            return false;
-        }
-
-        crypto_hash_update(&sighash_context.header, ith_prevout_hash, 32);
-
         uint8_t ith_prevout_n_raw[4];
-        if (4 != call_get_merkleized_map_value(dc,
-                                               &ith_map,
-                                               (uint8_t[]){PSBT_IN_OUTPUT_INDEX},
-                                               1,
-                                               ith_prevout_n_raw,
-                                               4)) {
+        uint8_t ith_nSequence_raw[4];
+        if (!read_input_outpoint_and_sequence(dc,
+                                              &ith_map,
+                                              ith_prevout_hash,
+                                              ith_prevout_n_raw,
+                                              ith_nSequence_raw,
+                                              NULL)) {
             SEND_SW(dc, SW_INCORRECT_DATA);
             return false;
         }
 
-        crypto_hash_update(&sighash_context.header, ith_prevout_n_raw, 4);
+        crypto_hash_update(&sighash_context->header, ith_prevout_hash, 32);
+        crypto_hash_update(&sighash_context->header, ith_prevout_n_raw, 4);
 
         if (i != cur_input_index) {
             // empty scriptcode
-            crypto_hash_update_u8(&sighash_context.header, 0x00);
+            crypto_hash_update_u8(&sighash_context->header, 0x00);
         } else {
             if (!input->has_redeemScript) {
                 // P2PKH, the script_code is the prevout's scriptPubKey
-                crypto_hash_update_varint(&sighash_context.header, input->in_out.scriptPubKey_len);
-                crypto_hash_update(&sighash_context.header,
+                crypto_hash_update_varint(&sighash_context->header, input->in_out.scriptPubKey_len);
+                crypto_hash_update(&sighash_context->header,
                                    input->in_out.scriptPubKey,
                                    input->in_out.scriptPubKey_len);
             } else {
@@ -1716,7 +2480,7 @@ static bool __attribute__((noinline)) compute_sighash_legacy(dispatcher_context_
                                                  (uint8_t[]){PSBT_IN_REDEEM_SCRIPT},
                                                  1,
                                                  NULL,
-                                                 &sighash_context.header);
+                                                 &sighash_context->header);
 
                 if (redeemScript_len < 0) {
                     PRINTF("Error fetching redeemScript\n");
@@ -1726,131 +2490,220 @@ static bool __attribute__((noinline)) compute_sighash_legacy(dispatcher_context_
             }
         }
 
-        uint8_t ith_nSequence_raw[4];
-        if (4 != call_get_merkleized_map_value(dc,
-                                               &ith_map,
-                                               (uint8_t[]){PSBT_IN_SEQUENCE},
-                                               1,
-                                               ith_nSequence_raw,
-                                               4)) {
-            // if no PSBT_IN_SEQUENCE is present, we must assume nSequence 0xFFFFFFFF
-            memset(ith_nSequence_raw, 0xFF, 4);
-        }
-
-        crypto_hash_update(&sighash_context.header, ith_nSequence_raw, 4);
+        crypto_hash_update(&sighash_context->header, ith_nSequence_raw, 4);
     }
 
     // outputs
-    crypto_hash_update_varint(&sighash_context.header, st->n_outputs);
-    if (hash_outputs(dc, st, &sighash_context.header) == -1) {
-        SEND_SW(dc, SW_INCORRECT_DATA);
-        return false;
+    if (st->has_outputs_preimage_hash) {
+        // the client streams the serialized outputs, that were already validated in
+        // preprocess_outputs; the preimage is checked against their hash
+        if (0 > call_stream_preimage(dc,
+                                     st->outputs_preimage_hash,
+                                     NULL,
+                                     cb_update_hash,
+                                     &sighash_context->header)) {
+            SEND_SW(dc, SW_INCORRECT_DATA);
+            return false;
+        }
+    } else {
+        crypto_hash_update_varint(&sighash_context->header, st->n_outputs);
+        if (hash_outputs(dc, st, &sighash_context->header) == -1) {
+            SEND_SW(dc, SW_INCORRECT_DATA);
+            return false;
+        }
     }
 
     // nLocktime
     write_u32_le(tmp, 0, st->locktime);
-    crypto_hash_update(&sighash_context.header, tmp, 4);
+    crypto_hash_update(&sighash_context->header, tmp, 4);
 
     // hash type
     write_u32_le(tmp, 0, input->sighash_type);
-    crypto_hash_update(&sighash_context.header, tmp, 4);
+    crypto_hash_update(&sighash_context->header, tmp, 4);
 
     // compute sighash
-    crypto_hash_digest(&sighash_context.header, sighash, 32);
+    crypto_hash_digest(&sighash_context->header, sighash, 32);
     cx_hash_sha256(sighash, 32, sighash, 32);
 
+    hash_pool_release(sighash_context);
     return true;
 }
 
-static bool __attribute__((noinline)) compute_sighash_segwitv0(dispatcher_context_t *dc,
-                                                               sign_psbt_state_t *st,
-                                                               segwit_hashes_t *hashes,
-                                                               input_info_t *input,
-                                                               unsigned int cur_input_index,
-                                                               uint8_t sighash[static 32]) {
-    LOG_PROCESSOR(__FILE__, __LINE__, __func__);
-
-    cx_sha256_t sighash_context;
-    cx_sha256_init(&sighash_context);
+// Computes the part of the BIP-0143 sighash preimage that does not depend on the input
+static void compute_sighash_segwitv0_prefix(sign_psbt_state_t *st,
+                                            segwit_hashes_t *hashes,
+                                            uint8_t sighash_byte,
+                                            cx_sha256_t *sighash_context) {
+    cx_sha256_init(sighash_context);
 
-    uint8_t tmp[8];
-    uint8_t sighash_byte = (uint8_t) (input->sighash_type & 0xFF);
+    uint8_t tmp[4];
 
     // nVersion
     write_u32_le(tmp, 0, st->tx_version);
-    crypto_hash_update(&sighash_context.header, tmp, 4);
+    crypto_hash_update(&sighash_context->header, tmp, 4);
 
-    {
-        uint8_t dbl_hash[32];
+    uint8_t dbl_hash[32];
 
-        memset(dbl_hash, 0, 32);
-        // add to hash: hashPrevouts = sha256(sha_prevouts)
-        if (!(sighash_byte & SIGHASH_ANYONECANPAY)) {
-            cx_hash_sha256(hashes->sha_prevouts, 32, dbl_hash, 32);
-        }
+    memset(dbl_hash, 0, 32);
+    // add to hash: hashPrevouts = sha256(sha_prevouts)
+    if (!(sighash_byte & SIGHASH_ANYONECANPAY)) {
+        cx_hash_sha256(hashes->sha_prevouts, 32, dbl_hash, 32);
+    }
 
-        crypto_hash_update(&sighash_context.header, dbl_hash, 32);
+    crypto_hash_update(&sighash_context->header, dbl_hash, 32);
 
-        memset(dbl_hash, 0, 32);
-        // add to hash: hashSequence sha256(sha_sequences)
-        if (!(sighash_byte & SIGHASH_ANYONECANPAY) && (sighash_byte & 0x1f) != SIGHASH_SINGLE &&
-            (sighash_byte & 0x1f) != SIGHASH_NONE) {
-            cx_hash_sha256(hashes->sha_sequences, 32, dbl_hash, 32);
-        }
-        crypto_hash_update(&sighash_context.header, dbl_hash, 32);
+    memset(dbl_hash, 0, 32);
+    // add to hash: hashSequence sha256(sha_sequences)
+    if (!(sighash_byte & SIGHASH_ANYONECANPAY) && (sighash_byte & 0x1f) != SIGHASH_SINGLE &&
+        (sighash_byte & 0x1f) != SIGHASH_NONE) {
+        cx_hash_sha256(hashes->sha_sequences, 32, dbl_hash, 32);
     }
+    crypto_hash_update(&sighash_context->header, dbl_hash, 32);
+}
 
-    {
-        // outpoint (32-byte prevout hash, 4-byte index)
+// Computes the part of the BIP-0341 sighash preimage that does not depend on the input, that is,
+// everything before spend_type
+static void compute_sighash_segwitv1_prefix(sign_psbt_state_t *st,
+                                            segwit_hashes_t *hashes,
+                                            uint8_t sighash_byte,
+                                            cx_sha256_t *sighash_context) {
+    crypto_tr_tapsighash_init(sighash_context);
+    // the first 0x00 byte is not part of SigMsg
+    crypto_hash_update_u8(&sighash_context->header, 0x00);
 
-        // get prevout hash and output index for the current input
-        uint8_t prevout_hash[32];
-        if (32 != call_get_merkleized_map_value(dc,
-                                                &input->in_out.map,
-                                                (uint8_t[]){PSBT_IN_PREVIOUS_TXID},
-                                                1,
-                                                prevout_hash,
-                                                32)) {
-            SEND_SW(dc, SW_INCORRECT_DATA);
-            return false;
-        }
+    uint8_t tmp[4];
 
-        crypto_hash_update(&sighash_context.header, prevout_hash, 32);
+    // hash type
+    crypto_hash_update_u8(&sighash_context->header, sighash_byte);
 
-        uint8_t prevout_n_raw[4];
-        if (4 != call_get_merkleized_map_value(dc,
-                                               &input->in_out.map,
-                                               (uint8_t[]){PSBT_IN_OUTPUT_INDEX},
-                                               1,
-                                               prevout_n_raw,
-                                               4)) {
-            SEND_SW(dc, SW_INCORRECT_DATA);
-            return false;
+    // nVersion
+    write_u32_le(tmp, 0, st->tx_version);
+    crypto_hash_update(&sighash_context->header, tmp, 4);
+
+    // nLocktime
+    write_u32_le(tmp, 0, st->locktime);
+    crypto_hash_update(&sighash_context->header, tmp, 4);
+
+    if ((sighash_byte & 0x80) != SIGHASH_ANYONECANPAY) {
+        crypto_hash_update(&sighash_context->header, hashes->sha_prevouts, 32);
+        crypto_hash_update(&sighash_context->header, hashes->sha_amounts, 32);
+        crypto_hash_update(&sighash_context->header, hashes->sha_scriptpubkeys, 32);
+        crypto_hash_update(&sighash_context->header, hashes->sha_sequences, 32);
+    }
+
+    if ((sighash_byte & 3) != SIGHASH_NONE && (sighash_byte & 3) != SIGHASH_SINGLE) {
+        crypto_hash_update(&sighash_context->header, hashes->sha_outputs, 32);
+    }
+}
+
+// Computes the part of the sighash preimage that is shared by all the inputs with the same sighash
+// type, in st->sighash_prefix. It is only computed again if the sighash type changes, as the segwit
+// version is the same for all the inputs of the wallet policy.
+static void update_sighash_prefix(sign_psbt_state_t *st,
+                                  segwit_hashes_t *hashes,
+                                  int segwit_version,
+                                  uint8_t sighash_byte) {
+    if (!st->sighash_prefix.is_valid || st->sighash_prefix.sighash_byte != sighash_byte) {
+        if (segwit_version == 0) {
+            compute_sighash_segwitv0_prefix(st, hashes, sighash_byte, &st->sighash_prefix.context);
+        } else {
+            compute_sighash_segwitv1_prefix(st, hashes, sighash_byte, &st->sighash_prefix.context);
         }
+        st->sighash_prefix.sighash_byte = sighash_byte;
+        st->sighash_prefix.is_valid = true;
+    }
+}
+
+// Initializes sighash_context with the sighash prefix for the given sighash type.
+static void __attribute__((noinline)) init_sighash_from_prefix(sign_psbt_state_t *st,
+                                                               segwit_hashes_t *hashes,
+                                                               int segwit_version,
+                                                               uint8_t sighash_byte,
+                                                               cx_sha256_t *sighash_context) {
+    update_sighash_prefix(st, hashes, segwit_version, sighash_byte);
+    memcpy(sighash_context, &st->sighash_prefix.context, sizeof(cx_sha256_t));
+}
+
+static bool __attribute__((noinline)) compute_sighash_segwitv0(dispatcher_context_t *dc,
+                                                               sign_psbt_state_t *st,
+                                                               segwit_hashes_t *hashes,
+                                                               input_info_t *input,
+                                                               unsigned int cur_input_index,
+                                                               uint8_t sighash[static 32]) {
+    LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    uint8_t tmp[8];
+    uint8_t sighash_byte = (uint8_t) (input->sighash_type & 0xFF);
 
-        crypto_hash_update(&sighash_context.header, prevout_n_raw, 4);
+    // nVersion, hashPrevouts and hashSequence
+    cx_sha256_t *sighash_context = hash_pool_acquire_sha256();
+    if (sighash_context == NULL) {
+        SEND_SW(dc, SW_BAD_STATE);
+        return false;
+    }
+    init_sighash_from_prefix(st, hashes, 0, sighash_byte, sighash_context);
+
+    // get prevout hash, output index, sequence and witness utxo for the current input
+    uint8_t prevout_hash[32];
+    uint8_t prevout_n_raw[4];
+    uint8_t nSequence_raw[4];
+    uint8_t witness_utxo[8 + 1 + MAX_PREVOUT_SCRIPTPUBKEY_LEN];
+    if (!read_input_outpoint_and_sequence(dc,
+                                          &input->in_out.map,
+                                          prevout_hash,
+                                          prevout_n_raw,
+                                          nSequence_raw,
+                                          witness_utxo)) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return false;
     }
 
+    // outpoint (32-byte prevout hash, 4-byte index)
+    crypto_hash_update(&sighash_context->header, prevout_hash, 32);
+    crypto_hash_update(&sighash_context->header, prevout_n_raw, 4);
+
     // scriptCode
     if (is_p2wpkh(input->script, input->script_len)) {
         // P2WPKH(script[2:22])
-        crypto_hash_update_u32(&sighash_context.header, 0x1976a914);
-        crypto_hash_update(&sighash_context.header, input->script + 2, 20);
-        crypto_hash_update_u16(&sighash_context.header, 0x88ac);
+        crypto_hash_update_u32(&sighash_context->header, 0x1976a914);
+        crypto_hash_update(&sighash_context->header, input->script + 2, 20);
+        crypto_hash_update_u16(&sighash_context->header, 0x88ac);
     } else if (is_p2wsh(input->script, input->script_len)) {
         // P2WSH
 
-        // update sighash_context.header with the length-prefixed witnessScript,
+        // update the sighash_context with the length-prefixed witnessScript,
         // and also compute sha256(witnessScript)
-        cx_sha256_t witnessScript_hash_context;
-        cx_sha256_init(&witnessScript_hash_context);
-
-        int witnessScript_len = update_hashes_with_map_value(dc,
+        cx_sha256_t *witnessScript_hash_context = hash_pool_acquire_sha256();
+        if (witnessScript_hash_context == NULL) {
+            SEND_SW(dc, SW_BAD_STATE);
+            return false;
+        }
+        cx_sha256_init(witnessScript_hash_context);
+
+        int witnessScript_len;
+        if (st->wallet_policy_map->type == TOKEN_WSH || st->wallet_policy_map->type == TOKEN_SH) {
+            // the input is internal, so its witnessScript is the one of the wallet policy at its
+            // derivation: it is computed directly into the hashes, rather than streamed from the
+            // PSBT in as many round trips as it takes
+            witnessScript_len = get_wallet_witness_script_hashes(
+                dc,
+                st->wallet_policy_map,
+                &(wallet_derivation_info_t){
+                    .wallet_version = st->wallet_header.version,
+                    .keys_merkle_root = st->wallet_header.keys_info_merkle_root,
+                    .n_keys = st->wallet_header.n_keys,
+                    .change = input->in_out.is_change,
+                    .address_index = input->in_out.address_index},
+                &witnessScript_hash_context->header,
+                &sighash_context->header);
+        } else {
+            witnessScript_len = update_hashes_with_map_value(dc,
                                                              &input->in_out.map,
                                                              (uint8_t[]){PSBT_IN_WITNESS_SCRIPT},
                                                              1,
-                                                             &witnessScript_hash_context.header,
-                                                             &sighash_context.header);
+                                                             &witnessScript_hash_context->header,
+                                                             &sighash_context->header);
+        }
 
         if (witnessScript_len < 0) {
             PRINTF("Error fetching witnessScript\n");
@@ -1859,7 +2712,8 @@ static bool __attribute__((noinline)) compute_sighash_segwitv0(dispatcher_contex
         }
 
         uint8_t witnessScript_hash[32];
-        crypto_hash_digest(&witnessScript_hash_context.header, witnessScript_hash, 32);
+        crypto_hash_digest(&witnessScript_hash_context->header, witnessScript_hash, 32);
+        hash_pool_release(witnessScript_hash_context);
 
         // check that script == P2WSH(witnessScript)
         if (input->script_len != 2 + 32 || input->script[0] != 0x00 || input->script[1] != 0x20 ||
@@ -1875,40 +2729,13 @@ static bool __attribute__((noinline)) compute_sighash_segwitv0(dispatcher_contex
         return false;
     }
 
-    {
-        // input value, taken from the WITNESS_UTXO field
-        uint8_t witness_utxo[8 + 1 + MAX_PREVOUT_SCRIPTPUBKEY_LEN];
-
-        int witness_utxo_len = call_get_merkleized_map_value(dc,
-                                                             &input->in_out.map,
-                                                             (uint8_t[]){PSBT_IN_WITNESS_UTXO},
-                                                             1,
-                                                             witness_utxo,
-                                                             sizeof(witness_utxo));
-        if (witness_utxo_len < 8) {
-            SEND_SW(dc, SW_INCORRECT_DATA);
-            return false;
-        }
-
-        crypto_hash_update(&sighash_context.header,
-                           witness_utxo,
-                           8);  // only the first 8 bytes (amount)
-    }
+    // input value, taken from the WITNESS_UTXO field
+    crypto_hash_update(&sighash_context->header,
+                       witness_utxo,
+                       8);  // only the first 8 bytes (amount)
 
     // nSequence
-    {
-        uint8_t nSequence_raw[4];
-        if (4 != call_get_merkleized_map_value(dc,
-                                               &input->in_out.map,
-                                               (uint8_t[]){PSBT_IN_SEQUENCE},
-                                               1,
-                                               nSequence_raw,
-                                               4)) {
-            // if no PSBT_IN_SEQUENCE is present, we must assume nSequence 0xFFFFFFFF
-            memset(nSequence_raw, 0xFF, 4);
-        }
-        crypto_hash_update(&sighash_context.header, nSequence_raw, 4);
-    }
+    crypto_hash_update(&sighash_context->header, nSequence_raw, 4);
 
     {
         // compute hashOutputs = sha256(sha_outputs)
@@ -1920,30 +2747,28 @@ static bool __attribute__((noinline)) compute_sighash_segwitv0(dispatcher_contex
             cx_hash_sha256(hashes->sha_outputs, 32, hashOutputs, 32);
 
         } else if ((sighash_byte & 0x1f) == SIGHASH_SINGLE && cur_input_index < st->n_outputs) {
-            cx_sha256_t sha_output_context;
-            cx_sha256_init(&sha_output_context);
-            if (hash_output_n(dc, st, &sha_output_context.header, cur_input_index) == -1) {
+            if (get_single_output_hash(dc, st, cur_input_index, hashOutputs) == -1) {
                 SEND_SW(dc, SW_INCORRECT_DATA);
                 return false;
             }
-            crypto_hash_digest(&sha_output_context.header, hashOutputs, 32);
             cx_hash_sha256(hashOutputs, 32, hashOutputs, 32);
         }
-        crypto_hash_update(&sighash_context.header, hashOutputs, 32);
+        crypto_hash_update(&sighash_context->header, hashOutputs, 32);
     }
 
     // nLocktime
     write_u32_le(tmp, 0, st->locktime);
-    crypto_hash_update(&sighash_context.header, tmp, 4);
+    crypto_hash_update(&sighash_context->header, tmp, 4);
 
     // sighash type
     write_u32_le(tmp, 0, input->sighash_type);
-    crypto_hash_update(&sighash_context.header, tmp, 4);
+    crypto_hash_update(&sighash_context->header, tmp, 4);
 
     // compute sighash
-    crypto_hash_digest(&sighash_context.header, sighash, 32);
+    crypto_hash_digest(&sighash_context->header, sighash, 32);
     cx_hash_sha256(sighash, 32, sighash, 32);
 
+    hash_pool_release(sighash_context);
     return true;
 }
 
@@ -1956,130 +2781,119 @@ static bool __attribute__((noinline)) compute_sighash_segwitv1(dispatcher_contex
                                                                uint8_t sighash[static 32]) {
     LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
-    cx_sha256_t sighash_context;
-    crypto_tr_tagged_hash_init(&sighash_context, BIP0341_sighash_tag, sizeof(BIP0341_sighash_tag));
-    // the first 0x00 byte is not part of SigMsg
-    crypto_hash_update_u8(&sighash_context.header, 0x00);
-
     uint8_t tmp[MAX(32, 8 + 1 + MAX_PREVOUT_SCRIPTPUBKEY_LEN)];
 
-    // hash type
+    // epoch, hash type, nVersion, nLocktime and the sha_* fields
     uint8_t sighash_byte = (uint8_t) (input->sighash_type & 0xFF);
-    crypto_hash_update_u8(&sighash_context.header, sighash_byte);
-
-    // nVersion
-    write_u32_le(tmp, 0, st->tx_version);
-    crypto_hash_update(&sighash_context.header, tmp, 4);
-
-    // nLocktime
-    write_u32_le(tmp, 0, st->locktime);
-    crypto_hash_update(&sighash_context.header, tmp, 4);
-
-    if ((sighash_byte & 0x80) != SIGHASH_ANYONECANPAY) {
-        crypto_hash_update(&sighash_context.header, hashes->sha_prevouts, 32);
-        crypto_hash_update(&sighash_context.header, hashes->sha_amounts, 32);
-        crypto_hash_update(&sighash_context.header, hashes->sha_scriptpubkeys, 32);
-        crypto_hash_update(&sighash_context.header, hashes->sha_sequences, 32);
-    }
-
-    if ((sighash_byte & 3) != SIGHASH_NONE && (sighash_byte & 3) != SIGHASH_SINGLE) {
-        crypto_hash_update(&sighash_context.header, hashes->sha_outputs, 32);
+    cx_sha256_t *sighash_context = hash_pool_acquire_sha256();
+    if (sighash_context == NULL) {
+        SEND_SW(dc, SW_BAD_STATE);
+        return false;
     }
+    init_sighash_from_prefix(st, hashes, 1, sighash_byte, sighash_context);
 
     // ext_flag
     uint8_t ext_flag = placeholder_info->is_tapscript ? 1 : 0;
     // annex is not supported
     const uint8_t annex_present = 0;
     uint8_t spend_type = ext_flag * 2 + annex_present;
-    crypto_hash_update_u8(&sighash_context.header, spend_type);
+    crypto_hash_update_u8(&sighash_context->header, spend_type);
 
     if ((sighash_byte & 0x80) == SIGHASH_ANYONECANPAY) {
-        // outpoint (hash)
-        if (32 != call_get_merkleized_map_value(dc,
-                                                &input->in_out.map,
-                                                (uint8_t[]){PSBT_IN_PREVIOUS_TXID},
-                                                1,
-                                                tmp,
-                                                32)) {
+        // the witness utxo is read in tmp
+        uint8_t prevout_hash[32];
+        uint8_t prevout_n_raw[4];
+        uint8_t nSequence_raw[4];
+        if (!read_input_outpoint_and_sequence(dc,
+                                              &input->in_out.map,
+                                              prevout_hash,
+                                              prevout_n_raw,
+                                              nSequence_raw,
+                                              tmp)) {
             SEND_SW(dc, SW_INCORRECT_DATA);
             return false;
         }
-        crypto_hash_update(&sighash_context.header, tmp, 32);
 
-        // outpoint (output index)
-        if (4 != call_get_merkleized_map_value(dc,
-                                               &input->in_out.map,
-                                               (uint8_t[]){PSBT_IN_OUTPUT_INDEX},
-                                               1,
-                                               tmp,
-                                               4)) {
-            SEND_SW(dc, SW_INCORRECT_DATA);
-            return false;
-        }
-        crypto_hash_update(&sighash_context.header, tmp, 4);
+        // outpoint (hash)
+        crypto_hash_update(&sighash_context->header, prevout_hash, 32);
 
-        if (8 > call_get_merkleized_map_value(dc,
-                                              &input->in_out.map,
-                                              (uint8_t[]){PSBT_IN_WITNESS_UTXO},
-                                              1,
-                                              tmp,
-                                              8 + 1 + MAX_PREVOUT_SCRIPTPUBKEY_LEN)) {
-            SEND_SW(dc, SW_INCORRECT_DATA);
-            return false;
-        }
+        // outpoint (output index)
+        crypto_hash_update(&sighash_context->header, prevout_n_raw, 4);
 
         // amount
-        crypto_hash_update(&sighash_context.header, tmp, 8);
+        crypto_hash_update(&sighash_context->header, tmp, 8);
 
         // scriptPubKey
-        crypto_hash_update_varint(&sighash_context.header, input->in_out.scriptPubKey_len);
+        crypto_hash_update_varint(&sighash_context->header, input->in_out.scriptPubKey_len);
 
-        crypto_hash_update(&sighash_context.header,
+        crypto_hash_update(&sighash_context->header,
                            input->in_out.scriptPubKey,
                            input->in_out.scriptPubKey_len);
 
         // nSequence
-        if (4 != call_get_merkleized_map_value(dc,
-                                               &input->in_out.map,
-                                               (uint8_t[]){PSBT_IN_SEQUENCE},
-                                               1,
-                                               tmp,
-                                               4)) {
-            // if no PSBT_IN_SEQUENCE is present, we must assume nSequence 0xFFFFFFFF
-            memset(tmp, 0xFF, 4);
-        }
-        crypto_hash_update(&sighash_context.header, tmp, 4);
+        crypto_hash_update(&sighash_context->header, nSequence_raw, 4);
     } else {
         // input_index
         write_u32_le(tmp, 0, cur_input_index);
-        crypto_hash_update(&sighash_context.header, tmp, 4);
+        crypto_hash_update(&sighash_context->header, tmp, 4);
     }
 
     // no annex
 
     if ((sighash_byte & 3) == SIGHASH_SINGLE) {
-        // compute sha_output
-        cx_sha256_t sha_output_context;
-        cx_sha256_init(&sha_output_context);
-
-        if (hash_output_n(dc, st, &sha_output_context.header, cur_input_index) == -1) {
+        // sha_single_output
+        if (get_single_output_hash(dc, st, cur_input_index, tmp) == -1) {
             SEND_SW(dc, SW_INCORRECT_DATA);
             return false;
         }
-        crypto_hash_digest(&sha_output_context.header, tmp, 32);
-
-        crypto_hash_update(&sighash_context.header, tmp, 32);
+        crypto_hash_update(&sighash_context->header, tmp, 32);
     }
 
     if (placeholder_info->is_tapscript) {
         // If spending a tapscript, append the Common Signature Message Extension per BIP-0342
-        crypto_hash_update(&sighash_context.header, placeholder_info->tapleaf_hash, 32);
-        crypto_hash_update_u8(&sighash_context.header, 0x00);         // key_version
-        crypto_hash_update_u32(&sighash_context.header, 0xffffffff);  // no OP_CODESEPARATOR
+        crypto_hash_update(&sighash_context->header, placeholder_info->tapleaf_hash, 32);
+        crypto_hash_update_u8(&sighash_context->header, 0x00);         // key_version
+        crypto_hash_update_u32(&sighash_context->header, 0xffffffff);  // no OP_CODESEPARATOR
+    }
+
+    crypto_hash_digest(&sighash_context->header, sighash, 32);
+
+    hash_pool_release(sighash_context);
+    return true;
+}
+
+// Sends all the pending signatures to the client in a single YIELD message. Unless is_final, from
+// PROTOCOL_VERSION_DEFERRED_YIELD the message is deferred to the next client command, that signing
+// the next inputs will send anyway; the final flush also sends the deferred one, if any.
+static bool __attribute__((noinline)) flush_yield_batch(dispatcher_context_t *dc,
+                                                        sign_psbt_state_t *st,
+                                                        bool is_final) {
+    LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    if (st->yield_batch.len == 0) {
+        if (is_final && dc->flush_deferred_yield(dc) < 0) {
+            SEND_SW(dc, SW_BAD_STATE);
+            return false;
+        }
+        return true;
+    }
+
+    if (!is_final && dc->defer_yield(st->yield_batch.data, st->yield_batch.len)) {
+        st->yield_batch.len = 0;
+        return true;
     }
 
-    crypto_hash_digest(&sighash_context.header, sighash, 32);
+    uint8_t cmd = CCMD_YIELD;
+    dc->add_to_response(&cmd, 1);
+    dc->add_to_response(st->yield_batch.data, st->yield_batch.len);
+    dc->finalize_response(SW_INTERRUPTED_EXECUTION);
+
+    st->yield_batch.len = 0;
 
+    if (dc->process_interruption(dc) < 0) {
+        SEND_SW(dc, SW_BAD_STATE);
+        return false;
+    }
     return true;
 }
 
@@ -2093,34 +2907,56 @@ static bool __attribute__((noinline)) yield_signature(dispatcher_context_t *dc,
                                                       size_t sig_len) {
     LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
-    // yield signature
-    uint8_t cmd = CCMD_YIELD;
-    dc->add_to_response(&cmd, 1);
-
-    uint8_t buf[9];
-    int input_index_varint_len = varint_write(buf, 0, cur_input_index);
-    dc->add_to_response(&buf, input_index_varint_len);
+    // from PROTOCOL_VERSION_BATCHED_YIELD, each result is prefixed by its length, and it is only
+    // sent when there is no more space in the batch, or at the end of signing
+    bool is_batched = st->protocol_version >= PROTOCOL_VERSION_BATCHED_YIELD;
 
     // for tapscript signatures, we concatenate the (x-only) pubkey with the tapleaf hash
     uint8_t augm_pubkey_len = pubkey_len + (tapleaf_hash != NULL ? 32 : 0);
 
+    // in a batch, each result starts with the index of its PSBT
+    bool is_batch = st->mode == SIGN_PSBT_MODE_BATCH;
+
     // the pubkey is not output in version 0 of the protocol
+    size_t result_len = (is_batch ? varint_size(st->batch.cur_index) : 0) +
+                        varint_size(cur_input_index) +
+                        (st->protocol_version >= 1 ? 1 + augm_pubkey_len : 0) + sig_len;
+
+    // the result is always shorter than 0xFD bytes, so its length takes a single byte
+    size_t total_len = (is_batched ? 1 : 0) + result_len;
+
+    if (st->yield_batch.len + total_len > MAX_YIELD_BATCH_LEN) {
+        if (!flush_yield_batch(dc, st, false)) return false;
+    }
+
+    uint8_t *out = st->yield_batch.data + st->yield_batch.len;
+    size_t offset = 0;
+
+    if (is_batched) {
+        out[offset++] = (uint8_t) result_len;
+    }
+    if (is_batch) {
+        offset += varint_write(out, offset, st->batch.cur_index);
+    }
+    offset += varint_write(out, offset, cur_input_index);
+
     if (st->protocol_version >= 1) {
-        dc->add_to_response(&augm_pubkey_len, 1);
-        dc->add_to_response(pubkey, pubkey_len);
+        out[offset++] = augm_pubkey_len;
+        memcpy(out + offset, pubkey, pubkey_len);
+        offset += pubkey_len;
 
         if (tapleaf_hash != NULL) {
-            dc->add_to_response(tapleaf_hash, 32);
+            memcpy(out + offset, tapleaf_hash, 32);
+            offset += 32;
         }
     }
 
-    dc->add_to_response(sig, sig_len);
+    memcpy(out + offset, sig, sig_len);
 
-    dc->finalize_response(SW_INTERRUPTED_EXECUTION);
+    st->yield_batch.len += total_len;
 
-    if (dc->process_interruption(dc) < 0) {
-        SEND_SW(dc, SW_BAD_STATE);
-        return false;
+    if (!is_batched) {
+        return flush_yield_batch(dc, st, false);
     }
     return true;
 }
@@ -2154,7 +2990,8 @@ static bool __attribute__((noinline)) sign_sighash_ecdsa_and_yield(
                                                          sighash,
                                                          pubkey,
                                                          sig,
-                                                         NULL);
+                                                         NULL,
+                                                         st->grind_low_r);
     if (sig_len < 0) {
         // unexpected error when signing
         SEND_SW(dc, SW_BAD_STATE);
@@ -2170,6 +3007,60 @@ static bool __attribute__((noinline)) sign_sighash_ecdsa_and_yield(
     return true;
 }
 
+// Initializes private_key with the secret key at the given path, tweaked as described in
+// taproot_key_cache_get, and computes the corresponding x-only pubkey. Inputs spending from the
+// same address (with the same taptree) sign with the same key, therefore it is looked up in, and
+// added to, the taproot_key_cache. It is the caller's responsibility to wipe private_key.
+// Returns false on error.
+static bool __attribute__((noinline)) get_taproot_signing_key(const uint32_t sign_path[],
+                                                              uint8_t sign_path_len,
+                                                              bool is_tweaked,
+                                                              const uint8_t *tweak,
+                                                              uint8_t tweak_len,
+                                                              cx_ecfp_private_key_t *private_key,
+                                                              uint8_t xonly_pubkey[static 32]) {
+    uint8_t cached_seckey[32];
+    if (taproot_key_cache_get(sign_path,
+                              sign_path_len,
+                              is_tweaked,
+                              tweak,
+                              tweak_len,
+                              cached_seckey,
+                              xonly_pubkey)) {
+        unsigned int init_err =
+            cx_ecfp_init_private_key_no_throw(CX_CURVE_256K1, cached_seckey, 32, private_key);
+        explicit_bzero(cached_seckey, sizeof(cached_seckey));
+        return init_err == CX_OK;
+    }
+
+    uint8_t *seckey = private_key->d;  // convenience alias (entirely within the private_key struct)
+
+    if (crypto_derive_private_key(sign_path, sign_path_len, private_key) < 0) {
+        return false;
+    }
+
+    if (is_tweaked && 0 > crypto_tr_tweak_seckey(seckey, tweak, tweak_len, seckey)) {
+        return false;
+    }
+
+    // generate corresponding public key
+    cx_ecfp_public_key_t pubkey_tweaked;
+    if (cx_ecfp_generate_pair_no_throw(CX_CURVE_256K1, &pubkey_tweaked, private_key, 1) != CX_OK) {
+        return false;
+    }
+    // x-only pubkey, hence take only the x-coordinate
+    memcpy(xonly_pubkey, pubkey_tweaked.W + 1, 32);
+
+    taproot_key_cache_add(sign_path,
+                          sign_path_len,
+                          is_tweaked,
+                          tweak,
+                          tweak_len,
+                          seckey,
+                          xonly_pubkey);
+    return true;
+}
+
 static bool __attribute__((noinline)) sign_sighash_schnorr_and_yield(
     dispatcher_context_t *dc,
     sign_psbt_state_t *st,
@@ -2187,7 +3078,7 @@ static bool __attribute__((noinline)) sign_sighash_schnorr_and_yield(
     uint8_t sig[64 + 1];  // extra byte for the appended sighash-type, possibly
     size_t sig_len = 0;
 
-    cx_ecfp_public_key_t pubkey_tweaked;  // Pubkey corresponding to the key used for signing
+    uint8_t xonly_pubkey[32];  // Pubkey corresponding to the key used for signing
 
     uint8_t *tapleaf_hash = NULL;
 
@@ -2199,9 +3090,6 @@ static bool __attribute__((noinline)) sign_sighash_schnorr_and_yield(
 
     do {  // block executed once, only to allow safely breaking out on error
 
-        uint8_t *seckey =
-            private_key.d;  // convenience alias (entirely within the private_key struct)
-
         uint32_t sign_path[MAX_BIP32_PATH_STEPS];
 
         for (int i = 0; i < placeholder_info->key_derivation_length; i++) {
@@ -2214,41 +3102,34 @@ static bool __attribute__((noinline)) sign_sighash_schnorr_and_yield(
 
         int sign_path_len = placeholder_info->key_derivation_length + 2;
 
-        if (bip32_derive_init_privkey_256(CX_CURVE_256K1,
-                                          sign_path,
-                                          sign_path_len,
-                                          &private_key,
-                                          NULL) != CX_OK) {
-            error = true;
-            break;
-        }
-
         policy_node_tr_t *policy = (policy_node_tr_t *) st->wallet_policy_map;
 
-        if (!placeholder_info->is_tapscript) {
-            if (isnull_policy_node_tree(&policy->tree)) {
-                // tweak as specified in BIP-86 and BIP-386
-                crypto_tr_tweak_seckey(seckey, (uint8_t[]){}, 0, seckey);
-            } else {
-                // tweak with the taptree hash, per BIP-341
-                // The taptree hash is computed in sign_transaction_input in order to
-                // reduce stack usage.
-                crypto_tr_tweak_seckey(seckey, input->taptree_hash, 32, seckey);
-            }
+        bool is_tweaked = !placeholder_info->is_tapscript;
+        // The taptree hash is computed in sign_transaction_input in order to reduce stack usage.
+        const uint8_t *tweak = input->taptree_hash;
+        uint8_t tweak_len = 0;
+        if (is_tweaked) {
+            // tweak as specified in BIP-86 and BIP-386 if there is no taptree, otherwise tweak
+            // with the taptree hash, per BIP-341
+            tweak_len = isnull_policy_node_tree(&policy->tree) ? 0 : 32;
         } else {
             // tapscript, we need to yield the tapleaf hash together with the pubkey
             tapleaf_hash = placeholder_info->tapleaf_hash;
         }
 
-        // generate corresponding public key
-        unsigned int err =
-            cx_ecfp_generate_pair_no_throw(CX_CURVE_256K1, &pubkey_tweaked, &private_key, 1);
-        if (err != CX_OK) {
+        if (!get_taproot_signing_key(sign_path,
+                                     sign_path_len,
+                                     is_tweaked,
+                                     tweak,
+                                     tweak_len,
+                                     &private_key,
+                                     xonly_pubkey)) {
             error = true;
             break;
         }
 
-        err = cx_ecschnorr_sign_no_throw(&private_key,
+        PERF_COUNT_CRYPTO(PERF_CRYPTO_SIGNATURE, 1);
+        unsigned int err = cx_ecschnorr_sign_no_throw(&private_key,
                                          CX_ECSCHNORR_BIP0340 | CX_RND_TRNG,
                                          CX_SHA256,
                                          sighash,
@@ -2281,164 +3162,64 @@ static bool __attribute__((noinline)) sign_sighash_schnorr_and_yield(
         sig[sig_len++] = sighash_byte;
     }
 
-    if (!yield_signature(dc,
-                         st,
-                         cur_input_index,
-                         pubkey_tweaked.W + 1,  // x-only pubkey, hence take only the x-coordinate
-                         32,
-                         tapleaf_hash,
-                         sig,
-                         sig_len))
+    if (!yield_signature(dc, st, cur_input_index, xonly_pubkey, 32, tapleaf_hash, sig, sig_len))
         return false;
 
     return true;
 }
 
-static bool __attribute__((noinline)) compute_segwit_hashes(dispatcher_context_t *dc,
-                                                            sign_psbt_state_t *st,
-                                                            segwit_hashes_t *hashes) {
-    {
-        // compute sha_prevouts and sha_sequences
-        cx_sha256_t sha_prevouts_context, sha_sequences_context;
-
-        // compute hashPrevouts and hashSequence
-        cx_sha256_init(&sha_prevouts_context);
-        cx_sha256_init(&sha_sequences_context);
-
-        for (unsigned int i = 0; i < st->n_inputs; i++) {
-            // get this input's map
-            merkleized_map_commitment_t ith_map;
-
-            int res = call_get_merkleized_map(dc, st->inputs_root, st->n_inputs, i, &ith_map);
-            if (res < 0) {
-                SEND_SW(dc, SW_INCORRECT_DATA);
-                return false;
-            }
-
-            // get prevout hash and output index for the i-th input
-            uint8_t ith_prevout_hash[32];
-            if (32 != call_get_merkleized_map_value(dc,
-                                                    &ith_map,
-                                                    (uint8_t[]){PSBT_IN_PREVIOUS_TXID},
-                                                    1,
-                                                    ith_prevout_hash,
-                                                    32)) {
-                SEND_SW(dc, SW_INCORRECT_DATA);
-                return false;
-            }
-
-            crypto_hash_update(&sha_prevouts_context.header, ith_prevout_hash, 32);
-
-            uint8_t ith_prevout_n_raw[4];
-            if (4 != call_get_merkleized_map_value(dc,
-                                                   &ith_map,
-                                                   (uint8_t[]){PSBT_IN_OUTPUT_INDEX},
-                                                   1,
-                                                   ith_prevout_n_raw,
-                                                   4)) {
-                SEND_SW(dc, SW_INCORRECT_DATA);
-                return false;
-            }
-
-            crypto_hash_update(&sha_prevouts_context.header, ith_prevout_n_raw, 4);
-
-            uint8_t ith_nSequence_raw[4];
-            if (4 != call_get_merkleized_map_value(dc,
-                                                   &ith_map,
-                                                   (uint8_t[]){PSBT_IN_SEQUENCE},
-                                                   1,
-                                                   ith_nSequence_raw,
-                                                   4)) {
-                // if no PSBT_IN_SEQUENCE is present, we must assume nSequence 0xFFFFFFFF
-                memset(ith_nSequence_raw, 0xFF, 4);
-            }
-
-            crypto_hash_update(&sha_sequences_context.header, ith_nSequence_raw, 4);
-        }
-
-        crypto_hash_digest(&sha_prevouts_context.header, hashes->sha_prevouts, 32);
-        crypto_hash_digest(&sha_sequences_context.header, hashes->sha_sequences, 32);
-    }
-
-    {
-        // compute sha_outputs
-        cx_sha256_t sha_outputs_context;
-        cx_sha256_init(&sha_outputs_context);
-
-        if (hash_outputs(dc, st, &sha_outputs_context.header) == -1) {
-            SEND_SW(dc, SW_INCORRECT_DATA);
-            return false;
-        }
-
-        crypto_hash_digest(&sha_outputs_context.header, hashes->sha_outputs, 32);
-    }
-
-    {
-        // compute sha_amounts and sha_scriptpubkeys
-        // TODO: could be skipped if there are no segwitv1 inputs to sign
-
-        cx_sha256_t sha_amounts_context, sha_scriptpubkeys_context;
-
-        cx_sha256_init(&sha_amounts_context);
-        cx_sha256_init(&sha_scriptpubkeys_context);
-
-        for (unsigned int i = 0; i < st->n_inputs; i++) {
-            // get this input's map
-            merkleized_map_commitment_t ith_map;
-
-            int res = call_get_merkleized_map(dc, st->inputs_root, st->n_inputs, i, &ith_map);
-            if (res < 0) {
-                SEND_SW(dc, SW_INCORRECT_DATA);
-                return false;
-            }
-
-            uint64_t in_amount;
-            uint8_t in_scriptPubKey[MAX_PREVOUT_SCRIPTPUBKEY_LEN];
-            size_t in_scriptPubKey_len;
-
-            if (0 > get_amount_scriptpubkey_from_psbt(dc,
-                                                      &ith_map,
-                                                      &in_amount,
-                                                      in_scriptPubKey,
-                                                      &in_scriptPubKey_len)) {
-                SEND_SW(dc, SW_INCORRECT_DATA);
-                return false;
-            }
-
-            uint8_t in_amount_le[8];
-            write_u64_le(in_amount_le, 0, in_amount);
-            crypto_hash_update(&sha_amounts_context.header, in_amount_le, 8);
-
-            crypto_hash_update_varint(&sha_scriptpubkeys_context.header, in_scriptPubKey_len);
-            crypto_hash_update(&sha_scriptpubkeys_context.header,
-                               in_scriptPubKey,
-                               in_scriptPubKey_len);
-        }
-
-        crypto_hash_digest(&sha_amounts_context.header, hashes->sha_amounts, 32);
-        crypto_hash_digest(&sha_scriptpubkeys_context.header, hashes->sha_scriptpubkeys, 32);
-    }
-
-    return true;
+// Returns true if the sighash of the input for the given tapleaf was already computed, for another
+// placeholder of the same leaf
+static bool has_tapleaf_sighash(const sign_psbt_state_t *st,
+                                const policy_node_t *tapleaf_ptr,
+                                const input_info_t *input) {
+    return tapleaf_ptr != NULL && tapleaf_ptr == st->tapleaf_sighash.tapleaf_ptr &&
+           input->in_out.is_change == st->tapleaf_sighash.is_change &&
+           input->in_out.address_index == st->tapleaf_sighash.address_index;
 }
 
+// Signs the input for the given placeholder. If record is not NULL, the scriptPubKey and the
+// sighash type that it contains are not fetched again.
 static bool __attribute__((noinline)) sign_transaction_input(dispatcher_context_t *dc,
                                                              sign_psbt_state_t *st,
                                                              segwit_hashes_t *hashes,
                                                              placeholder_info_t *placeholder_info,
                                                              input_info_t *input,
+                                                             const input_record_t *record,
                                                              unsigned int cur_input_index) {
     LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
+    TRACE(TRACE_EV_SIGN_INPUT, cur_input_index);
+
+    // another key of the same tapleaf was already signed for: the sighash is the same, and none of
+    // the data of the input needs to be fetched again
+    const policy_node_t *tapleaf_ptr =
+        st->key_placeholders[placeholder_info->cur_index].tapleaf_ptr;
+    if (has_tapleaf_sighash(st, tapleaf_ptr, input)) {
+        input->sighash_type = st->tapleaf_sighash.sighash_type;
+        return sign_sighash_schnorr_and_yield(dc,
+                                              st,
+                                              placeholder_info,
+                                              input,
+                                              cur_input_index,
+                                              st->tapleaf_sighash.sighash);
+    }
+
+    if (record != NULL) {
+        input->in_out.scriptPubKey_len = record->scriptPubKey_len;
+        memcpy(input->in_out.scriptPubKey, record->scriptPubKey, record->scriptPubKey_len);
+    }
+
     // if the psbt does not specify the sighash flag for this input, the default
     // changes depending on the type of spend; therefore, we set it later.
-    if (input->has_sighash_type) {
+    if (record != NULL && (record->flags & INPUT_RECORD_HAS_SIGHASH_TYPE) != 0) {
+        input->sighash_type = record->sighash_type;
+    } else if (input->has_sighash_type) {
         // Get sighash type
-        if (4 != call_get_merkleized_map_value_u32_le(dc,
-                                                      &input->in_out.map,
-                                                      (uint8_t[]){PSBT_IN_SIGHASH_TYPE},
-                                                      1,
-                                                      &input->sighash_type)) {
+        if (4 != call_get_merkleized_map_value_u32_le_by_hash(dc,
+                                                              &input->in_out.map,
+                                                              PSBT_KEY_HASH(PSBT_IN_SIGHASH_TYPE),
+                                                              &input->sighash_type)) {
             PRINTF("Malformed PSBT_IN_SIGHASH_TYPE for input %d\n", cur_input_index);
 
             SEND_SW(dc, SW_INCORRECT_DATA);
@@ -2453,12 +3234,15 @@ static bool __attribute__((noinline)) sign_transaction_input(dispatcher_context_
         // sign_non_witness(non_witness_utxo.vout[psbt.tx.input_[i].prevout.n].scriptPubKey, i)
 
         uint64_t tmp;  // unused
-        if (0 > get_amount_scriptpubkey_from_psbt_nonwitness(dc,
+        if (record == NULL &&
+            0 > get_amount_scriptpubkey_from_psbt_nonwitness(dc,
                                                              &input->in_out.map,
                                                              &tmp,
                                                              input->in_out.scriptPubKey,
                                                              &input->in_out.scriptPubKey_len,
-                                                             NULL)) {
+                                                             NULL,
+                                                             NULL,
+                                                             0)) {
             SEND_SW(dc, SW_INCORRECT_DATA);
             return false;
         }
@@ -2480,8 +3264,9 @@ static bool __attribute__((noinline)) sign_transaction_input(dispatcher_context_
             return false;
     } else {
         {
-            uint64_t amount;
-            if (0 > get_amount_scriptpubkey_from_psbt_witness(dc,
+            uint64_t amount;  // unused
+            if (record == NULL &&
+                0 > get_amount_scriptpubkey_from_psbt_witness(dc,
                                                               &input->in_out.map,
                                                               &amount,
                                                               input->in_out.scriptPubKey,
@@ -2497,12 +3282,11 @@ static bool __attribute__((noinline)) sign_transaction_input(dispatcher_context_
                 uint8_t redeemScript[MAX_PREVOUT_SCRIPTPUBKEY_LEN];
 
                 int redeemScript_length =
-                    call_get_merkleized_map_value(dc,
-                                                  &input->in_out.map,
-                                                  (uint8_t[]){PSBT_IN_REDEEM_SCRIPT},
-                                                  1,
-                                                  redeemScript,
-                                                  sizeof(redeemScript));
+                    call_get_merkleized_map_value_by_hash(dc,
+                                                          &input->in_out.map,
+                                                          PSBT_KEY_HASH(PSBT_IN_REDEEM_SCRIPT),
+                                                          redeemScript,
+                                                          sizeof(redeemScript));
                 if (redeemScript_length < 0) {
                     PRINTF("Error fetching redeem script\n");
                     SEND_SW(dc, SW_INCORRECT_DATA);
@@ -2563,6 +3347,15 @@ static bool __attribute__((noinline)) sign_transaction_input(dispatcher_context_
                                           sighash))
                 return false;
 
+            if (placeholder_info->is_tapscript) {
+                st->tapleaf_sighash.tapleaf_ptr = tapleaf_ptr;
+                st->tapleaf_sighash.is_change = input->in_out.is_change;
+                st->tapleaf_sighash.address_index = input->in_out.address_index;
+                st->tapleaf_sighash.sighash_type = input->sighash_type;
+                memcpy(st->tapleaf_sighash.tapleaf_hash, placeholder_info->tapleaf_hash, 32);
+                memcpy(st->tapleaf_sighash.sighash, sighash, 32);
+            }
+
             policy_node_tr_t *policy = (policy_node_tr_t *) st->wallet_policy_map;
             if (!placeholder_info->is_tapscript && !isnull_policy_node_tree(&policy->tree)) {
                 // keypath spend, we compute the taptree hash so that we find it ready
@@ -2605,155 +3398,705 @@ static bool __attribute__((noinline)) fill_taproot_placeholder_info(
     const input_info_t *input,
     const policy_node_t *tapleaf_ptr,
     placeholder_info_t *placeholder_info) {
-    cx_sha256_t hash_context;
-    crypto_tr_tapleaf_hash_init(&hash_context);
-
-    // we compute the tapscript once just to compute its length
-    // this avoids having to store it
-    int tapscript_len = get_wallet_internal_script_hash(
-        dc,
-        tapleaf_ptr,
-        &(wallet_derivation_info_t){.wallet_version = st->wallet_header.version,
-                                    .keys_merkle_root = st->wallet_header.keys_info_merkle_root,
-                                    .n_keys = st->wallet_header.n_keys,
-                                    .change = input->in_out.is_change,
-                                    .address_index = input->in_out.address_index},
-        WRAPPED_SCRIPT_TYPE_TAPSCRIPT,
-        NULL);
-    if (tapscript_len < 0) {
-        PRINTF("Failed to compute tapleaf script\n");
+    if (0 > get_tapleaf_hash(
+                dc,
+                &(wallet_derivation_info_t){
+                    .wallet_version = st->wallet_header.version,
+                    .keys_merkle_root = st->wallet_header.keys_info_merkle_root,
+                    .n_keys = st->wallet_header.n_keys,
+                    .change = input->in_out.is_change,
+                    .address_index = input->in_out.address_index},
+                tapleaf_ptr,
+                placeholder_info->tapleaf_hash)) {
+        PRINTF("Failed to compute tapleaf hash\n");
         return false;
     }
 
-    crypto_hash_update_u8(&hash_context.header, 0xC0);
-    crypto_hash_update_varint(&hash_context.header, tapscript_len);
-
-    // we compute it again to get add the actual script code to the hash computation
-    if (0 >
-        get_wallet_internal_script_hash(
-            dc,
-            tapleaf_ptr,
-            &(wallet_derivation_info_t){.wallet_version = st->wallet_header.version,
-                                        .keys_merkle_root = st->wallet_header.keys_info_merkle_root,
-                                        .n_keys = st->wallet_header.n_keys,
-                                        .change = input->in_out.is_change,
-                                        .address_index = input->in_out.address_index},
-            WRAPPED_SCRIPT_TYPE_TAPSCRIPT,
-            &hash_context.header)) {
-        return false;  // should never happen!
-    }
-    crypto_hash_digest(&hash_context.header, placeholder_info->tapleaf_hash, 32);
-
     return true;
 }
 
-static bool __attribute__((noinline)) sign_transaction(
-    dispatcher_context_t *dc,
-    sign_psbt_state_t *st,
-    const uint8_t internal_inputs[static BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)]) {
-    LOG_PROCESSOR(__FILE__, __LINE__, __func__);
-
-    int placeholder_index = 0;
-
-    segwit_hashes_t hashes;
-
-    // compute all the tx-wide hashes
-    // while this is redundant for legacy transactions, we do it here in order to
-    // avoid doing it in places that have more stack limitations
-    if (!compute_segwit_hashes(dc, st, &hashes)) {
-        // we do not send a status word, since compute_segwit_hashes already does it on failure
-        return false;
-    }
+// Maximum number of internal placeholders that are signed for in the same pass over the inputs.
+// Each input map is fetched once per pass; each placeholder takes about 180 bytes of stack.
+#define N_PLACEHOLDERS_PER_SIGNING_PASS 4
 
-    // Iterate over all the placeholders that correspond to keys owned by us
-    while (true) {
-        placeholder_info_t placeholder_info;
-        memset(&placeholder_info, 0, sizeof(placeholder_info));
-
-        const policy_node_t *tapleaf_ptr = NULL;
-        int n_key_placeholders = get_key_placeholder_by_index(st->wallet_policy_map,
-                                                              placeholder_index,
-                                                              &tapleaf_ptr,
-                                                              &placeholder_info.placeholder);
+// Change and address index of an input, as detected from its BIP32 derivations for a placeholder
+typedef struct {
+    uint32_t address_index;
+    bool placeholder_found : 1;
+    bool is_change : 1;
+} input_derivation_t;
 
-        if (n_key_placeholders < 0) {
-            SEND_SW(dc, SW_BAD_STATE);  // should never happen
-            return false;
-        }
+typedef struct {
+    placeholder_info_t *placeholder_infos;
+    input_derivation_t *derivations;
+    int n_placeholders;
+    input_info_t *input;
+} signing_input_keys_callback_data_t;
 
-        if (placeholder_index >= n_key_placeholders) {
-            // all placeholders were processed
-            break;
+/**
+ * Like input_keys_callback, but detects the change and address index of the input for each of the
+ * placeholders of the current signing pass.
+ */
+static void signing_input_keys_callback(dispatcher_context_t *dc,
+                                        signing_input_keys_callback_data_t *callback_data,
+                                        const merkleized_map_commitment_t *map_commitment,
+                                        int i,
+                                        buffer_t *data) {
+    size_t data_len = data->size - data->offset;
+    if (data_len >= 1) {
+        uint8_t key_type;
+        buffer_read_u8(data, &key_type);
+        input_info_t *input = callback_data->input;
+        if (key_type == PSBT_IN_WITNESS_UTXO) {
+            input->has_witnessUtxo = true;
+        } else if (key_type == PSBT_IN_NON_WITNESS_UTXO) {
+            input->has_nonWitnessUtxo = true;
+        } else if (key_type == PSBT_IN_REDEEM_SCRIPT) {
+            input->has_redeemScript = true;
+        } else if (key_type == PSBT_IN_SIGHASH_TYPE) {
+            input->has_sighash_type = true;
+        } else if (key_type == PSBT_IN_BIP32_DERIVATION ||
+                   key_type == PSBT_IN_TAP_BIP32_DERIVATION) {
+            bool any_missing = false;
+            for (int j = 0; j < callback_data->n_placeholders; j++) {
+                any_missing = any_missing || !callback_data->derivations[j].placeholder_found;
+            }
+            if (!any_missing) {
+                return;
+            }
+
+            // the value is fetched once, and matched against each placeholder
+            uint8_t bip32_derivation_pubkey[33];
+            uint32_t fpt_der[1 + MAX_BIP32_PATH_STEPS];
+            int der_len = read_psbt_bip32_derivation(dc,
+                                                     &input->in_out,
+                                                     key_type,
+                                                     data,
+                                                     map_commitment,
+                                                     i,
+                                                     bip32_derivation_pubkey,
+                                                     fpt_der);
+            if (der_len < 0) {
+                input->in_out.unexpected_pubkey_error = true;
+                return;
+            }
+
+            for (int j = 0; j < callback_data->n_placeholders; j++) {
+                input_derivation_t *derivation = &callback_data->derivations[j];
+                if (derivation->placeholder_found) {
+                    continue;
+                }
+
+                input->in_out.placeholder_found = false;
+                int ret = match_psbt_bip32_derivation(&callback_data->placeholder_infos[j],
+                                                      &input->in_out,
+                                                      key_type,
+                                                      bip32_derivation_pubkey,
+                                                      fpt_der,
+                                                      der_len);
+                if (ret < 0) {
+                    input->in_out.unexpected_pubkey_error = true;
+                } else if (ret > 0) {
+                    derivation->placeholder_found = true;
+                    derivation->is_change = input->in_out.is_change;
+                    derivation->address_index = input->in_out.address_index;
+                }
+            }
         }
+    }
+}
 
-        if (tapleaf_ptr != NULL) {
-            // get_key_placeholder_by_index returns the pointer to the tapleaf only if the key being
-            // spent is indeed in a tapleaf
-            placeholder_info.is_tapscript = true;
-        }
-
-        if (fill_placeholder_info_if_internal(dc, st, &placeholder_info) == true) {
-            for (unsigned int i = 0; i < st->n_inputs; i++)
-                if (bitvector_get(internal_inputs, i)) {
-                    input_info_t input;
-                    memset(&input, 0, sizeof(input));
-
-                    input_keys_callback_data_t callback_data = {
-                        .input = &input,
-                        .placeholder_info = &placeholder_info};
-                    int res = call_get_merkleized_map_with_callback(
-                        dc,
-                        (void *) &callback_data,
-                        st->inputs_root,
-                        st->n_inputs,
-                        i,
-                        (merkle_tree_elements_callback_t) input_keys_callback,
-                        &input.in_out.map);
-                    if (res < 0) {
-                        SEND_SW(dc, SW_INCORRECT_DATA);
-                        return false;
-                    }
-
-                    if (tapleaf_ptr != NULL && !fill_taproot_placeholder_info(dc,
-                                                                              st,
-                                                                              &input,
-                                                                              tapleaf_ptr,
-                                                                              &placeholder_info))
-                        return false;
-
-                    if (!sign_transaction_input(dc, st, &hashes, &placeholder_info, &input, i)) {
-                        // we do not send a status word, since sign_transaction_input
-                        // already does it on failure
-                        return false;
-                    }
+// Signs all the internal inputs for the given internal placeholders, fetching each input map once
+static bool __attribute__((noinline)) sign_transaction_pass(
+    dispatcher_context_t *dc,
+    sign_psbt_state_t *st,
+    const uint8_t internal_inputs[static BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)],
+    placeholder_info_t *placeholder_infos,
+    int n_placeholders) {
+    LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    // only the internal inputs are visited, skipping 32 external inputs at a time; they are visited
+    // in the same order as when their records were saved
+    unsigned int n_range_inputs = st->sign_end - st->sign_begin;
+    unsigned int n_visited = 0;
+    for (unsigned int k = bitvector_find_next_set(internal_inputs, n_range_inputs, 0);
+         k < n_range_inputs;
+         k = bitvector_find_next_set(internal_inputs, n_range_inputs, k + 1)) {
+        unsigned int i = st->sign_begin + k;
+
+        input_info_t input;
+        memset(&input, 0, sizeof(input));
+
+        st->tapleaf_sighash.tapleaf_ptr = NULL;
+
+        input_derivation_t derivations[N_PLACEHOLDERS_PER_SIGNING_PASS];
+        memset(derivations, 0, sizeof(derivations));
+
+        // the derivation of the placeholder of the record is already known, therefore it is
+        // neither fetched nor derived again
+        const input_record_t *record = NULL;
+        if (n_visited < st->input_records.n_records) {
+            record = &st->input_records.records[n_visited];
+            for (int j = 0; j < n_placeholders; j++) {
+                if (placeholder_infos[j].cur_index == st->input_records.placeholder_index) {
+                    derivations[j].placeholder_found = true;
+                    derivations[j].is_change = (record->flags & INPUT_RECORD_IS_CHANGE) != 0;
+                    derivations[j].address_index = record->address_index;
                 }
+            }
+        }
+        ++n_visited;
+
+        signing_input_keys_callback_data_t callback_data = {.placeholder_infos = placeholder_infos,
+                                                            .derivations = derivations,
+                                                            .n_placeholders = n_placeholders,
+                                                            .input = &input};
+        int res = call_get_merkleized_map_with_callback(
+            dc,
+            (void *) &callback_data,
+            st->inputs_root,
+            st->n_inputs,
+            i,
+            (merkle_tree_elements_callback_t) signing_input_keys_callback,
+            &input.in_out.map);
+        if (res < 0) {
+            SEND_SW(dc, SW_INCORRECT_DATA);
+            return false;
         }
 
-        ++placeholder_index;
+        for (int j = 0; j < n_placeholders; j++) {
+            placeholder_info_t *placeholder_info = &placeholder_infos[j];
+
+            input.in_out.placeholder_found = derivations[j].placeholder_found;
+            input.in_out.is_change = derivations[j].is_change;
+            input.in_out.address_index = derivations[j].address_index;
+
+            // the keys in the same tapleaf share its hash, computed for the first one of them
+            const policy_node_t *tapleaf_ptr =
+                st->key_placeholders[placeholder_info->cur_index].tapleaf_ptr;
+            if (has_tapleaf_sighash(st, tapleaf_ptr, &input)) {
+                memcpy(placeholder_info->tapleaf_hash, st->tapleaf_sighash.tapleaf_hash, 32);
+            } else if (tapleaf_ptr != NULL &&
+                       !fill_taproot_placeholder_info(dc,
+                                                      st,
+                                                      &input,
+                                                      tapleaf_ptr,
+                                                      placeholder_info)) {
+                return false;
+            }
+
+            if (!sign_transaction_input(dc, st, &st->hashes, placeholder_info, &input, record, i)) {
+                // we do not send a status word, since sign_transaction_input
+                // already does it on failure
+                return false;
+            }
+        }
     }
 
     return true;
 }
 
-void handler_sign_psbt(dispatcher_context_t *dc, uint8_t protocol_version) {
+static bool __attribute__((noinline)) sign_transaction(
+    dispatcher_context_t *dc,
+    sign_psbt_state_t *st,
+    const uint8_t internal_inputs[static BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)]) {
     LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
-    sign_psbt_state_t st;
-    memset(&st, 0, sizeof(st));
+    // Iterate over all the placeholders that correspond to keys owned by us, signing for up to
+    // N_PLACEHOLDERS_PER_SIGNING_PASS of them in each pass over the inputs
+    int placeholder_index = 0;
+    while (placeholder_index < st->n_key_placeholders) {
+        placeholder_info_t placeholder_infos[N_PLACEHOLDERS_PER_SIGNING_PASS];
+        int n_placeholders = 0;
 
-    st.protocol_version = protocol_version;
+        while (placeholder_index < st->n_key_placeholders &&
+               n_placeholders < N_PLACEHOLDERS_PER_SIGNING_PASS) {
+            placeholder_info_t *placeholder_info = &placeholder_infos[n_placeholders];
+            memset(placeholder_info, 0, sizeof(placeholder_info_t));
 
-    // read APDU inputs, intialize global state and read global PSBT map
-    if (!init_global_state(dc, &st)) return;
+            placeholder_info->cur_index = placeholder_index;
+            placeholder_info->placeholder = *st->key_placeholders[placeholder_index].placeholder;
 
-    // bitmap to keep track of which inputs are internal
-    uint8_t internal_inputs[BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)];
-    memset(internal_inputs, 0, sizeof(internal_inputs));
+            // the pointer to the tapleaf is only set if the key being spent is indeed in a tapleaf
+            if (st->key_placeholders[placeholder_index].tapleaf_ptr != NULL) {
+                placeholder_info->is_tapscript = true;
+            }
 
-    // bitmap to keep track of which inputs are internal
+            if (fill_placeholder_info_if_internal(dc, st, placeholder_info) == true) {
+                ++n_placeholders;
+            }
+            ++placeholder_index;
+        }
+
+        if (n_placeholders > 0 &&
+            !sign_transaction_pass(dc, st, internal_inputs, placeholder_infos, n_placeholders)) {
+            return false;
+        }
+    }
+
+    // send the signatures that are still pending
+    return flush_yield_batch(dc, st, true);
+}
+
+// Computes the hmac of a checkpoint, over its content and the commitment to the transaction and the
+// wallet policy of the request. Returns false on error.
+static bool compute_checkpoint_hmac(const sign_psbt_state_t *st,
+                                    const sign_psbt_checkpoint_t *checkpoint,
+                                    uint8_t out[static 32]) {
+    uint8_t key[32];
+    if (!crypto_derive_symmetric_key(PSBT_CHECKPOINT_SLIP0021_LABEL,
+                                     PSBT_CHECKPOINT_SLIP0021_LABEL_LEN,
+                                     key)) {
+        return false;
+    }
+
+    uint8_t data[32 + sizeof(checkpoint->hashes) + sizeof(checkpoint->outputs_preimage_hash)];
+    memcpy(data, st->checkpoint_commitment, 32);
+    memcpy(data + 32, &checkpoint->hashes, sizeof(checkpoint->hashes));
+    memcpy(data + 32 + sizeof(checkpoint->hashes),
+           checkpoint->outputs_preimage_hash,
+           sizeof(checkpoint->outputs_preimage_hash));
+
+    cx_hmac_sha256(key, sizeof(key), data, sizeof(data), out, 32);
+
+    explicit_bzero(key, sizeof(key));
+    return true;
+}
+
+// Sends the checkpoint of the transaction that was just validated and approved, as the response.
+static void __attribute__((noinline)) send_checkpoint(dispatcher_context_t *dc,
+                                                      const sign_psbt_state_t *st) {
+    sign_psbt_checkpoint_t checkpoint;
+    memcpy(&checkpoint.hashes, &st->hashes, sizeof(checkpoint.hashes));
+    memcpy(checkpoint.outputs_preimage_hash,
+           st->outputs_preimage_hash,
+           sizeof(checkpoint.outputs_preimage_hash));
+
+    if (!compute_checkpoint_hmac(st, &checkpoint, checkpoint.hmac)) {
+        SEND_SW(dc, SW_BAD_STATE);
+        return;
+    }
+
+    SEND_RESPONSE(dc, &checkpoint, sizeof(checkpoint), SW_OK);
+}
+
+// Fetches the checkpoint from the client, verifies its hmac, and restores the tx-wide state that
+// preprocess_inputs and preprocess_outputs computed when it was produced. The input mask that can
+// follow it is not authenticated: it can only make the device sign fewer inputs.
+static bool __attribute__((noinline)) load_checkpoint(dispatcher_context_t *dc,
+                                                      sign_psbt_state_t *st) {
+    // the checkpoint can be followed by an input mask, with one bit per input in the range
+    struct {
+        sign_psbt_checkpoint_t checkpoint;
+        uint8_t input_mask[BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)];
+    } preimage;
+    sign_psbt_checkpoint_t *checkpoint = &preimage.checkpoint;
+
+    int preimage_len =
+        call_get_preimage(dc, st->checkpoint_hash, (uint8_t *) &preimage, sizeof(preimage));
+    size_t input_mask_len = BITVECTOR_REAL_SIZE(st->sign_end - st->sign_begin);
+    if (preimage_len == (int) (sizeof(*checkpoint) + input_mask_len)) {
+        memcpy(st->input_mask, preimage.input_mask, input_mask_len);
+        st->has_input_mask = true;
+    } else if (preimage_len != (int) sizeof(*checkpoint)) {
+        PRINTF("Failed to fetch the checkpoint\n");
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return false;
+    }
+
+    uint8_t expected_hmac[32];
+    if (!compute_checkpoint_hmac(st, checkpoint, expected_hmac)) {
+        SEND_SW(dc, SW_BAD_STATE);
+        return false;
+    }
+
+    // constant-time comparison, like for the wallet hmac
+    bool is_hmac_valid = os_secure_memcmp(expected_hmac, checkpoint->hmac, 32) == 0;
+    explicit_bzero(expected_hmac, sizeof(expected_hmac));
+    if (!is_hmac_valid) {
+        PRINTF("Incorrect checkpoint hmac\n");
+        SEND_SW(dc, SW_SIGNATURE_FAIL);
+        return false;
+    }
+
+    memcpy(&st->hashes, &checkpoint->hashes, sizeof(st->hashes));
+    memcpy(st->outputs_preimage_hash,
+           checkpoint->outputs_preimage_hash,
+           sizeof(st->outputs_preimage_hash));
+    // as in preprocess_outputs; the protocol version is committed in the checkpoint
+    st->has_outputs_preimage_hash = get_policy_segwit_version(st->wallet_policy_map) < 0 &&
+                                    st->protocol_version >= PROTOCOL_VERSION_OUTPUTS_PREIMAGE;
+    return true;
+}
+
+// When resuming from a checkpoint, finds which of the inputs to sign are internal. All the inputs
+// were validated when the checkpoint was produced, and their maps are committed in it; therefore,
+// only what tells if an input is internal is fetched again, and checked like in preprocess_inputs.
+static bool __attribute__((noinline)) find_internal_inputs_in_range(
+    dispatcher_context_t *dc,
+    sign_psbt_state_t *st,
+    uint8_t internal_inputs[static BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)]) {
+    LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    memset(internal_inputs, 0, BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN));
+
+    placeholder_info_t placeholder_info;
+    memset(&placeholder_info, 0, sizeof(placeholder_info));
+
+    if (!find_first_internal_key_placeholder(dc, st, &placeholder_info)) return false;
+
+    st->input_records.n_records = 0;
+    st->input_records.placeholder_index = placeholder_info.cur_index;
+    // the outputs are not walked when resuming: SIGHASH_SINGLE fetches them when signing
+    st->single_outputs.n_outputs = 0;
+
+    if (st->sign_end - st->sign_begin > 1 &&
+        0 > call_hint_merkle_leaves(dc,
+                                    st->inputs_root,
+                                    st->n_inputs,
+                                    st->sign_begin,
+                                    st->sign_end)) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return false;
+    }
+
+    for (unsigned int cur_input_index = st->sign_begin; cur_input_index < st->sign_end;
+         cur_input_index++) {
+        TRACE(TRACE_EV_INPUT, cur_input_index);
+
+        if (!can_input_be_internal(st, cur_input_index)) {
+            continue;  // marked as external by the client, nothing to fetch
+        }
+
+        input_info_t input;
+        memset(&input, 0, sizeof(input));
+
+        input_keys_callback_data_t callback_data = {.input = &input,
+                                                    .placeholder_info = &placeholder_info};
+        int res = call_get_merkleized_map_with_callback(
+            dc,
+            (void *) &callback_data,
+            st->inputs_root,
+            st->n_inputs,
+            cur_input_index,
+            (merkle_tree_elements_callback_t) input_keys_callback,
+            &input.in_out.map);
+        if (res < 0 || input.in_out.unexpected_pubkey_error) {
+            PRINTF("Failed to process input map\n");
+            SEND_SW(dc, SW_INCORRECT_DATA);
+            return false;
+        }
+
+        if (!input.in_out.placeholder_found) {
+            continue;  // external
+        }
+
+        // If both are present, the witness utxo and the non-witness utxo were already checked to
+        // have the same scriptPubKey
+        if (input.has_witnessUtxo) {
+            if (0 > get_amount_scriptpubkey_from_psbt_witness(dc,
+                                                              &input.in_out.map,
+                                                              &input.prevout_amount,
+                                                              input.in_out.scriptPubKey,
+                                                              &input.in_out.scriptPubKey_len)) {
+                SEND_SW(dc, SW_INCORRECT_DATA);
+                return false;
+            }
+        } else {
+            uint8_t prevout_hash[32];
+            if (32 != call_get_merkleized_map_value_by_hash(dc,
+                                                            &input.in_out.map,
+                                                            PSBT_KEY_HASH(PSBT_IN_PREVIOUS_TXID),
+                                                            prevout_hash,
+                                                            sizeof(prevout_hash)) ||
+                0 > get_amount_scriptpubkey_from_psbt_nonwitness(dc,
+                                                                 &input.in_out.map,
+                                                                 &input.prevout_amount,
+                                                                 input.in_out.scriptPubKey,
+                                                                 &input.in_out.scriptPubKey_len,
+                                                                 prevout_hash,
+                                                                 NULL,
+                                                                 0)) {
+                SEND_SW(dc, SW_INCORRECT_DATA);
+                return false;
+            }
+        }
+
+        int is_internal = is_in_out_internal(dc, st, &input.in_out, true);
+        if (is_internal < 0) {
+            PRINTF("Error checking if input %d is internal\n", cur_input_index);
+            SEND_SW(dc, SW_INCORRECT_DATA);
+            return false;
+        } else if (is_internal == 1) {
+            bitvector_set(internal_inputs, cur_input_index - st->sign_begin, 1);
+            // the sighash type is not read here: it is fetched when signing, if present
+            save_input_record(st, &input);
+        }
+    }
+
+    return true;
+}
+
+// Adds the state computed by preprocess_inputs and preprocess_outputs to the validated_psbt_cache.
+static void __attribute__((noinline)) save_validated_psbt(
+    const sign_psbt_state_t *st,
+    const uint8_t internal_inputs[static BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)],
+    const uint8_t internal_outputs[static BITVECTOR_REAL_SIZE(MAX_N_OUTPUTS_CAN_SIGN)]) {
+    validated_psbt_t validated;
+    memset(&validated, 0, sizeof(validated));
+
+    validated.inputs_total_amount = st->inputs_total_amount;
+    validated.n_external_inputs = st->n_external_inputs;
+    validated.n_external_outputs = st->n_external_outputs;
+    memcpy(&validated.outputs, &st->outputs, sizeof(validated.outputs));
+    validated.warnings = st->warnings;
+    memcpy(&validated.hashes, &st->hashes, sizeof(validated.hashes));
+    validated.has_outputs_preimage_hash = st->has_outputs_preimage_hash;
+    memcpy(validated.outputs_preimage_hash,
+           st->outputs_preimage_hash,
+           sizeof(validated.outputs_preimage_hash));
+    memcpy(validated.internal_inputs, internal_inputs, sizeof(validated.internal_inputs));
+    memcpy(validated.internal_outputs, internal_outputs, sizeof(validated.internal_outputs));
+
+    validated_psbt_cache_add(st->validated_psbt_key, &validated, sizeof(validated));
+}
+
+// Restores the state of a transaction that was already validated in this session, if it is in the
+// validated_psbt_cache. Returns false if it is not.
+static bool __attribute__((noinline)) load_validated_psbt(
+    sign_psbt_state_t *st,
+    uint8_t internal_inputs[static BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)],
+    uint8_t internal_outputs[static BITVECTOR_REAL_SIZE(MAX_N_OUTPUTS_CAN_SIGN)]) {
+    validated_psbt_t validated;
+    if (!validated_psbt_cache_get(st->validated_psbt_key, &validated, sizeof(validated))) {
+        return false;
+    }
+
+    st->inputs_total_amount = validated.inputs_total_amount;
+    st->n_external_inputs = validated.n_external_inputs;
+    st->n_external_outputs = validated.n_external_outputs;
+    memcpy(&st->outputs, &validated.outputs, sizeof(st->outputs));
+    st->warnings = validated.warnings;
+    memcpy(&st->hashes, &validated.hashes, sizeof(st->hashes));
+    st->has_outputs_preimage_hash = validated.has_outputs_preimage_hash;
+    memcpy(st->outputs_preimage_hash,
+           validated.outputs_preimage_hash,
+           sizeof(st->outputs_preimage_hash));
+    memcpy(internal_inputs, validated.internal_inputs, sizeof(validated.internal_inputs));
+    memcpy(internal_outputs, validated.internal_outputs, sizeof(validated.internal_outputs));
+
+    // as when resuming from a checkpoint, the inputs are fetched again when signing them
+    st->input_records.n_records = 0;
+    st->single_outputs.n_outputs = 0;
+    return true;
+}
+
+/**
+ * Precomputation while the user reviews the transaction.
+ *
+ * During the review, the app waits for the user for seconds, only handling the UI events. Part of
+ * the work that signing needs only depends on the seed and on the data that was already validated;
+ * it is done meanwhile on the tick events (see io_set_idle_task), a bounded step at a time, so that
+ * the UI stays responsive:
+ * - the prefix of the segwit sighash, for the sighash type of the first internal input;
+ * - the verification of the keys of the wallet policy that are not yet known to be internal or
+ *   external, which derives their xpub;
+ * - for taproot policies, the signing keys of the first internal inputs, that are added to the
+ *   taproot_key_cache.
+ * Nothing is requested from the client: the key information and the taptree hashes that are not
+ * in the wallet_key_cache are skipped, and computed when signing, as usual.
+ */
+#define REVIEW_PRECOMPUTE_SIGHASH_PREFIX 0
+#define REVIEW_PRECOMPUTE_KEYS           1
+#define REVIEW_PRECOMPUTE_SIGNING_KEYS   2
+#define REVIEW_PRECOMPUTE_DONE           3
+
+static struct {
+    sign_psbt_state_t *st;  // NULL if no review is in progress
+    uint8_t step;           // one of the REVIEW_PRECOMPUTE_* constants
+    unsigned int next;      // the next key index or input record of the current step
+} G_review_precompute;
+
+// Initializes the sighash prefix for the sighash type of the first internal input, if known.
+static void precompute_sighash_prefix(sign_psbt_state_t *st) {
+    int segwit_version = get_policy_segwit_version(st->wallet_policy_map);
+    if (segwit_version < 0 || st->input_records.n_records == 0) {
+        return;
+    }
+
+    const input_record_t *record = &st->input_records.records[0];
+    uint8_t sighash_byte;
+    if ((record->flags & INPUT_RECORD_HAS_SIGHASH_TYPE) != 0) {
+        sighash_byte = record->sighash_type;
+    } else {
+        sighash_byte = segwit_version == 0 ? SIGHASH_ALL : SIGHASH_DEFAULT;
+    }
+    update_sighash_prefix(st, &st->hashes, segwit_version, sighash_byte);
+}
+
+// Verifies if the key with the given index is internal, like fill_placeholder_info_if_internal,
+// if its key information is cached. Returns true if a key was derived.
+static bool precompute_key(sign_psbt_state_t *st, unsigned int key_index) {
+    if (bitvector_get(st->verified_keys, key_index)) {
+        return false;
+    }
+
+    policy_map_key_info_t key_info;
+    if (!wallet_key_cache_get_key_info(st->wallet_header.keys_info_merkle_root,
+                                       st->wallet_header.version,
+                                       key_index,
+                                       &key_info) ||
+        read_u32_be(key_info.master_key_fingerprint, 0) != st->master_key_fingerprint) {
+        return false;
+    }
+
+    serialized_extended_pubkey_t pubkey;
+    if (0 > get_wallet_extended_pubkey_at_path(key_info.master_key_derivation,
+                                               key_info.master_key_derivation_len,
+                                               BIP32_PUBKEY_VERSION,
+                                               &pubkey)) {
+        return true;  // tried again when signing
+    }
+
+    bitvector_set(st->verified_keys, key_index, true);
+    bitvector_set(st->internal_keys,
+                  key_index,
+                  memcmp(&key_info.ext_pubkey, &pubkey, sizeof(pubkey)) == 0);
+    return true;
+}
+
+// Adds the taproot signing key of the given input record to the taproot_key_cache, if its key
+// information and its taptree hash (if any) are cached. Returns true if a key was derived.
+static bool precompute_signing_key(sign_psbt_state_t *st, const input_record_t *record) {
+    const policy_key_placeholder_ref_t *ref =
+        &st->key_placeholders[st->input_records.placeholder_index];
+    const uint8_t *keys_root = st->wallet_header.keys_info_merkle_root;
+
+    policy_map_key_info_t key_info;
+    if (!wallet_key_cache_get_key_info(keys_root,
+                                       st->wallet_header.version,
+                                       ref->placeholder->key_index,
+                                       &key_info) ||
+        key_info.master_key_derivation_len + 2 > MAX_BIP32_PATH_STEPS) {
+        return false;
+    }
+
+    bool is_change = (record->flags & INPUT_RECORD_IS_CHANGE) != 0;
+
+    // same key and tweak as in sign_sighash_schnorr_and_yield
+    uint32_t sign_path[MAX_BIP32_PATH_STEPS];
+    memcpy(sign_path,
+           key_info.master_key_derivation,
+           key_info.master_key_derivation_len * sizeof(uint32_t));
+    sign_path[key_info.master_key_derivation_len] =
+        is_change ? ref->placeholder->num_second : ref->placeholder->num_first;
+    sign_path[key_info.master_key_derivation_len + 1] = record->address_index;
+
+    bool is_tweaked = ref->tapleaf_ptr == NULL;
+    uint8_t tweak[32];
+    uint8_t tweak_len = 0;
+    policy_node_tr_t *policy = (policy_node_tr_t *) st->wallet_policy_map;
+    if (is_tweaked && !isnull_policy_node_tree(&policy->tree)) {
+        if (!wallet_key_cache_get_taptree_hash(keys_root,
+                                               r_policy_node_tree(&policy->tree),
+                                               is_change,
+                                               record->address_index,
+                                               tweak)) {
+            return false;
+        }
+        tweak_len = 32;
+    }
+
+    cx_ecfp_private_key_t private_key = {0};
+    uint8_t xonly_pubkey[32];
+    (void) get_taproot_signing_key(sign_path,
+                                   key_info.master_key_derivation_len + 2,
+                                   is_tweaked,
+                                   tweak,
+                                   tweak_len,
+                                   &private_key,
+                                   xonly_pubkey);
+    explicit_bzero(&private_key, sizeof(private_key));
+    return true;
+}
+
+// The idle task of the review: runs the steps of the precomputation until one derives a key or
+// hashes, and runs again at the next tick if there is more to do.
+static void review_precompute_step(void) {
+    sign_psbt_state_t *st = G_review_precompute.st;
+    if (st == NULL) {
+        return;
+    }
+
+    unsigned int n_keys = MIN(st->wallet_header.n_keys, MAX_N_KEYS_IN_WALLET_POLICY);
+    unsigned int n_signing_keys =
+        st->wallet_policy_map->type == TOKEN_TR
+            ? MIN(st->input_records.n_records, TAPROOT_KEY_CACHE_SIZE)
+            : 0;
+
+    bool did_work = false;
+    while (!did_work && G_review_precompute.step != REVIEW_PRECOMPUTE_DONE) {
+        unsigned int next = G_review_precompute.next++;
+        if (G_review_precompute.step == REVIEW_PRECOMPUTE_SIGHASH_PREFIX && next == 0) {
+            precompute_sighash_prefix(st);
+            did_work = true;
+        } else if (G_review_precompute.step == REVIEW_PRECOMPUTE_KEYS && next < n_keys) {
+            did_work = precompute_key(st, next);
+        } else if (G_review_precompute.step == REVIEW_PRECOMPUTE_SIGNING_KEYS &&
+                   next < n_signing_keys) {
+            did_work = precompute_signing_key(st, &st->input_records.records[next]);
+        } else {
+            ++G_review_precompute.step;
+            G_review_precompute.next = 0;
+        }
+    }
+
+    if (G_review_precompute.step != REVIEW_PRECOMPUTE_DONE) {
+        io_set_idle_task(review_precompute_step);
+    }
+}
+
+// Shows the transaction to the user, precomputing part of the signing meanwhile, unless the
+// transaction is only signed by the next commands, from a checkpoint.
+static bool __attribute__((noinline)) review_transaction(
+    dispatcher_context_t *dc,
+    sign_psbt_state_t *st,
+    const uint8_t internal_outputs[static BITVECTOR_REAL_SIZE(MAX_N_OUTPUTS_CAN_SIGN)]) {
+    if (st->mode == SIGN_PSBT_MODE_CHECKPOINT) {
+        return display_transaction(dc, st, internal_outputs);
+    }
+
+    G_review_precompute.st = st;
+    G_review_precompute.step = REVIEW_PRECOMPUTE_SIGHASH_PREFIX;
+    G_review_precompute.next = 0;
+    io_set_idle_task(review_precompute_step);
+
+    bool is_approved = display_transaction(dc, st, internal_outputs);
+
+    io_set_idle_task(NULL);
+    G_review_precompute.st = NULL;
+    return is_approved;
+}
+
+// Validates the inputs and the outputs of the transaction, and obtains the approval of the user (or
+// performs the swap checks). In SIGN_PSBT_MODE_SIGN, the validation is skipped for a transaction
+// that was already validated in this session.
+static bool __attribute__((noinline)) validate_and_confirm_transaction(
+    dispatcher_context_t *dc,
+    sign_psbt_state_t *st,
+    uint8_t internal_inputs[static BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)]) {
+    // bitmap to keep track of which outputs are internal
     uint8_t internal_outputs[BITVECTOR_REAL_SIZE(MAX_N_OUTPUTS_CAN_SIGN)];
     memset(internal_outputs, 0, sizeof(internal_outputs));
 
+    // in swap mode, the checks of the exchange app must always see the fetched outputs
+    bool use_validated_psbt_cache =
+        st->mode == SIGN_PSBT_MODE_SIGN && !G_swap_state.called_from_swap;
+    if (use_validated_psbt_cache && load_validated_psbt(st, internal_inputs, internal_outputs)) {
+        PERF_START_PHASE(PERF_PHASE_CONFIRM);
+        return review_transaction(dc, st, internal_outputs);
+    }
+
     /** Inputs verification flow
      *
      *  Go though all the inputs:
@@ -2762,14 +4105,22 @@ void handler_sign_psbt(dispatcher_context_t *dc, uint8_t protocol_version) {
      *  - detect internal inputs that should be signed, and if there are external inputs or unusual
      * sighashes
      */
-    if (!preprocess_inputs(dc, &st, internal_inputs)) return;
+    PERF_START_PHASE(PERF_PHASE_INPUTS);
+    if (!preprocess_inputs(dc, st, internal_inputs)) return false;
 
     /** OUTPUTS VERIFICATION FLOW
      *
      *  For each output, check if it's a change address.
      *  Check if it's an acceptable output.
      */
-    if (!preprocess_outputs(dc, &st, internal_outputs)) return;
+    PERF_START_PHASE(PERF_PHASE_OUTPUTS);
+    if (!preprocess_outputs(dc, st, internal_outputs)) return false;
+
+    if (use_validated_psbt_cache) {
+        save_validated_psbt(st, internal_inputs, internal_outputs);
+    }
+
+    PERF_START_PHASE(PERF_PHASE_CONFIRM);
 
     if (G_swap_state.called_from_swap) {
         /** SWAP CHECKS
@@ -2778,13 +4129,246 @@ void handler_sign_psbt(dispatcher_context_t *dc, uint8_t protocol_version) {
          */
 
         // During swaps, the user approval was already obtained in the exchange app
-        if (!execute_swap_checks(dc, &st)) return;
+        if (!execute_swap_checks(dc, st)) return false;
     } else {
         /** TRANSACTION CONFIRMATION
          *
          *  Display each non-change output, and transaction fees, and acquire user confirmation,
          */
-        if (!display_transaction(dc, &st, internal_outputs)) return;
+        if (!review_transaction(dc, st, internal_outputs)) return false;
+    }
+
+    return true;
+}
+
+// Clears the part of the state that depends on the transaction, before loading the next PSBT of a
+// batch; the wallet policy and its keys are kept.
+static void reset_transaction_state(sign_psbt_state_t *st) {
+    st->inputs_total_amount = 0;
+    st->n_external_inputs = 0;
+    st->n_external_outputs = 0;
+    memset(&st->outputs, 0, sizeof(st->outputs));
+    memset(&st->warnings, 0, sizeof(st->warnings));
+    memset(&st->hashes, 0, sizeof(st->hashes));
+    st->input_records.n_records = 0;
+    st->single_outputs.n_outputs = 0;
+    st->has_outputs_preimage_hash = false;
+    st->sighash_prefix.is_valid = false;
+}
+
+// Fetches the commitment of the PSBT with the given index in the batch, and reads its global map.
+// The first PSBT of the batch must be the one in the request.
+static bool __attribute__((noinline)) load_batch_psbt(dispatcher_context_t *dc,
+                                                      sign_psbt_state_t *st,
+                                                      unsigned int index) {
+    uint8_t psbt_commitment[MAX_PSBT_COMMITMENT_LEN];
+    int psbt_commitment_len = call_get_merkle_leaf_element(dc,
+                                                           st->batch.psbts_root,
+                                                           st->batch.n_psbts,
+                                                           index,
+                                                           psbt_commitment,
+                                                           sizeof(psbt_commitment));
+    if (psbt_commitment_len < 0) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return false;
+    }
+
+    if (index == 0) {
+        uint8_t psbt_commitment_hash[32];
+        cx_sha256_t hash_context;
+        cx_sha256_init(&hash_context);
+        crypto_hash_update(&hash_context.header, psbt_commitment, psbt_commitment_len);
+        crypto_hash_digest(&hash_context.header, psbt_commitment_hash, 32);
+        if (memcmp(psbt_commitment_hash, st->batch.first_psbt_hash, 32) != 0) {
+            PRINTF("The first PSBT of the batch is not the one in the request\n");
+            SEND_SW(dc, SW_INCORRECT_DATA);
+            return false;
+        }
+    }
+
+    reset_transaction_state(st);
+    st->batch.cur_index = index;
+
+    merkleized_map_commitment_t global_map;
+    buffer_t buf = buffer_create(psbt_commitment, psbt_commitment_len);
+    if (!read_psbt_commitment(dc, &buf, st, &global_map)) return false;
+    if (buf.offset != buf.size) {
+        SEND_SW(dc, SW_INCORRECT_DATA);
+        return false;
+    }
+
+    if (st->n_inputs > MAX_N_INPUTS_CAN_SIGN) {
+        PRINTF("At most %d inputs are supported\n", MAX_N_INPUTS_CAN_SIGN);
+        SEND_SW(dc, SW_NOT_SUPPORTED);
+        return false;
+    }
+    st->sign_end = st->n_inputs;
+
+    return process_global_map(dc, st, &global_map);
+}
+
+// Validates all the PSBTs of a batch, showing the external outputs of each of them, and asks the
+// user to confirm the total fees of the batch. The first PSBT is already loaded.
+// The warnings are only known once all the PSBTs are validated, therefore they are shown after the
+// outputs, right before the final confirmation.
+static bool __attribute__((noinline)) validate_and_confirm_batch(dispatcher_context_t *dc,
+                                                                 sign_psbt_state_t *st) {
+    LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    uint8_t internal_inputs[BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)];
+    uint8_t internal_outputs[BITVECTOR_REAL_SIZE(MAX_N_OUTPUTS_CAN_SIGN)];
+
+#ifdef HAVE_NBGL
+    if (!ui_transaction_prompt(dc)) {
+        SEND_SW(dc, SW_DENY);
+        return false;
+    }
+#endif
+    if (!st->is_wallet_default && !ui_authorize_wallet_spend(dc, st->wallet_header.name)) {
+        SEND_SW(dc, SW_DENY);
+        return false;
+    }
+
+    uint64_t inputs_total_amount = 0;
+    uint64_t fee = 0;
+    unsigned int n_external_inputs = 0;
+    tx_ux_warning_t warnings = {0};
+
+    for (unsigned int i = 0; i < st->batch.n_psbts; i++) {
+        if (i > 0 && !load_batch_psbt(dc, st, i)) return false;
+
+        memset(internal_inputs, 0, sizeof(internal_inputs));
+        memset(internal_outputs, 0, sizeof(internal_outputs));
+
+        PERF_START_PHASE(PERF_PHASE_INPUTS);
+        if (!preprocess_inputs(dc, st, internal_inputs)) return false;
+        PERF_START_PHASE(PERF_PHASE_OUTPUTS);
+        if (!preprocess_outputs(dc, st, internal_outputs)) return false;
+        PERF_START_PHASE(PERF_PHASE_CONFIRM);
+        if (!display_external_outputs(dc, st, internal_outputs)) return false;
+
+        st->batch.n_shown_outputs += st->n_external_outputs;
+        inputs_total_amount += st->inputs_total_amount;
+        fee += st->outputs.fee;
+        n_external_inputs += st->n_external_inputs;
+        warnings.missing_nonwitnessutxo |= st->warnings.missing_nonwitnessutxo;
+        warnings.non_default_sighash |= st->warnings.non_default_sighash;
+    }
+
+    st->n_external_inputs = n_external_inputs;
+    st->warnings = warnings;
+    if (!display_warnings(dc, st)) {
+        return false;
+    }
+
+    // same threshold as in display_transaction, for the whole batch
+    if (10 * fee >= inputs_total_amount && inputs_total_amount > 100000 && !ui_warn_high_fee(dc)) {
+        SEND_SW(dc, SW_DENY);
+        return false;
+    }
+
+    if (!ui_validate_transaction(dc, COIN_COINID_SHORT, fee, st->batch.n_shown_outputs == 0)) {
+        SEND_SW(dc, SW_DENY);
+        return false;
+    }
+    return true;
+}
+
+// Validates, confirms and signs all the PSBTs of a batch, with the wallet policy already loaded
+// for the first one. The signatures of each PSBT are yielded once it is confirmed (or, for the
+// combined review, once the whole batch is).
+static bool __attribute__((noinline)) sign_psbt_batch(dispatcher_context_t *dc,
+                                                      sign_psbt_state_t *st) {
+    LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    bool is_combined = st->batch.review == SIGN_PSBT_BATCH_REVIEW_COMBINED;
+
+    if (is_combined && !validate_and_confirm_batch(dc, st)) return false;
+
+    uint8_t internal_inputs[BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)];
+    uint8_t internal_outputs[BITVECTOR_REAL_SIZE(MAX_N_OUTPUTS_CAN_SIGN)];
+
+    for (unsigned int i = 0; i < st->batch.n_psbts; i++) {
+        // after the combined review, the PSBTs are loaded again from the first one
+        if ((i > 0 || is_combined) && !load_batch_psbt(dc, st, i)) return false;
+
+        memset(internal_inputs, 0, sizeof(internal_inputs));
+        memset(internal_outputs, 0, sizeof(internal_outputs));
+
+        if (is_combined) {
+            // already approved; the PSBT is bound by its commitment, so the same results are
+            // obtained as during the review
+            PERF_START_PHASE(PERF_PHASE_INPUTS);
+            if (!preprocess_inputs(dc, st, internal_inputs)) return false;
+            PERF_START_PHASE(PERF_PHASE_OUTPUTS);
+            if (!preprocess_outputs(dc, st, internal_outputs)) return false;
+        } else if (!validate_and_confirm_transaction(dc, st, internal_inputs)) {
+            return false;
+        }
+
+        io_show_processing_screen();
+
+        PERF_START_PHASE(PERF_PHASE_SIGN);
+        if (!sign_transaction(dc, st, internal_inputs)) {
+            ui_post_processing_confirm_transaction(dc, false);
+            return false;
+        }
+    }
+
+    ui_post_processing_confirm_transaction(dc, true);
+    return true;
+}
+
+void handler_sign_psbt(dispatcher_context_t *dc, uint8_t protocol_version) {
+    LOG_PROCESSOR(__FILE__, __LINE__, __func__);
+
+    // the state is too large for the stack
+    sign_psbt_state_t *st = scratch_alloc(sizeof(sign_psbt_state_t));
+    if (st == NULL) {
+        SEND_SW(dc, SW_BAD_STATE);
+        return;
+    }
+
+    st->protocol_version = protocol_version;
+
+    // the keys and values of the PSBT maps are accessed many times
+    if (protocol_version >= PROTOCOL_VERSION_MERKLE_LEAF_HASHES) {
+        merkle_leaf_table_enable_downloads();
+    }
+
+    // read APDU inputs, intialize global state and read global PSBT map
+    PERF_START_PHASE(PERF_PHASE_INIT);
+    if (!init_global_state(dc, st)) return;
+
+    if (st->mode == SIGN_PSBT_MODE_BATCH) {
+        if (sign_psbt_batch(dc, st)) {
+            SEND_SW(dc, SW_OK);
+        }
+        return;
+    }
+
+    // bitmap to keep track of which inputs are internal
+    uint8_t internal_inputs[BITVECTOR_REAL_SIZE(MAX_N_INPUTS_CAN_SIGN)];
+    memset(internal_inputs, 0, sizeof(internal_inputs));
+
+    if (st->mode == SIGN_PSBT_MODE_RESUME) {
+        /** RESUMING FROM A CHECKPOINT
+         *
+         *  The transaction was validated and approved when the checkpoint was produced; only the
+         *  internal inputs in the range to sign are looked up again.
+         */
+        PERF_START_PHASE(PERF_PHASE_INPUTS);
+        if (!load_checkpoint(dc, st)) return;
+        if (!find_internal_inputs_in_range(dc, st, internal_inputs)) return;
+    } else if (!validate_and_confirm_transaction(dc, st, internal_inputs)) {
+        return;
+    }
+
+    if (st->mode == SIGN_PSBT_MODE_CHECKPOINT) {
+        // the inputs are signed by the following commands, resuming from the checkpoint
+        ui_post_processing_confirm_transaction(dc, true);
+        send_checkpoint(dc, st);
+        return;
     }
 
     // Signing always takes some time, so we rather not wait before showing the spinner
@@ -2795,7 +4379,8 @@ void handler_sign_psbt(dispatcher_context_t *dc, uint8_t protocol_version) {
      * For each internal placeholder, and for each internal input, sign using the
      * appropriate algorithm.
      */
-    int sign_result = sign_transaction(dc, &st, internal_inputs);
+    PERF_START_PHASE(PERF_PHASE_SIGN);
+    int sign_result = sign_transaction(dc, st, internal_inputs);
 
     if (!G_swap_state.called_from_swap) {
         ui_post_processing_confirm_transaction(dc, sign_result);
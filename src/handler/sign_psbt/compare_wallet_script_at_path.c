@@ -5,6 +5,7 @@
 
 #include "../lib/get_merkleized_map_value.h"
 #include "../lib/policy.h"
+#include "../lib/wallet_key_cache.h"
 
 #include "../../common/read.h"
 
@@ -19,20 +20,31 @@ int compare_wallet_script_at_path(dispatcher_context_t *dispatcher_context,
                                   size_t expected_script_len) {
     LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
-    // derive wallet's scriptPubKey, check if it matches the expected one
+    // derive wallet's scriptPubKey, check if it matches the expected one; inputs and outputs often
+    // share the same derivation, so the script is only derived once per command
     uint8_t wallet_script[MAX_PREVOUT_SCRIPTPUBKEY_LEN];
     int wallet_script_len =
-        get_wallet_script(dispatcher_context,
-                          policy,
-                          &(wallet_derivation_info_t){.wallet_version = wallet_version,
-                                                      .keys_merkle_root = keys_merkle_root,
-                                                      .n_keys = n_keys,
-                                                      .change = change,
-                                                      .address_index = address_index},
-                          wallet_script);
+        wallet_key_cache_get_script(keys_merkle_root, policy, change, address_index, wallet_script);
     if (wallet_script_len < 0) {
-        PRINTF("Failed to get wallet script\n");
-        return -1;  // shouldn't happen
+        wallet_script_len =
+            get_wallet_script(dispatcher_context,
+                              policy,
+                              &(wallet_derivation_info_t){.wallet_version = wallet_version,
+                                                          .keys_merkle_root = keys_merkle_root,
+                                                          .n_keys = n_keys,
+                                                          .change = change,
+                                                          .address_index = address_index},
+                              wallet_script);
+        if (wallet_script_len < 0) {
+            PRINTF("Failed to get wallet script\n");
+            return -1;  // shouldn't happen
+        }
+        wallet_key_cache_add_script(keys_merkle_root,
+                                    policy,
+                                    change,
+                                    address_index,
+                                    wallet_script,
+                                    wallet_script_len);
     }
 
     if (wallet_script_len == (int) expected_script_len &&
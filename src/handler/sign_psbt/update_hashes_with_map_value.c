@@ -5,7 +5,7 @@
 #include "../../crypto.h"
 
 typedef struct {
-    cx_hash_t *hash_unprefixed;
+    crypto_hash_tee_t hashes;  // all the hashes that are updated with the preimage bytes
     cx_hash_t *hash_prefixed;
 } callback_state_t;
 
@@ -20,15 +20,7 @@ static void cb_process_len(size_t len, void *cb_state) {
 static void cb_process_data(buffer_t *data, void *cb_state) {
     callback_state_t *state = (callback_state_t *) cb_state;
 
-    size_t data_len = data->size - data->offset;
-    uint8_t *data_start_ptr = data->ptr + data->offset;
-
-    if (state->hash_prefixed != NULL) {
-        crypto_hash_update(state->hash_prefixed, data_start_ptr, data_len);
-    }
-    if (state->hash_unprefixed != NULL) {
-        crypto_hash_update(state->hash_unprefixed, data_start_ptr, data_len);
-    }
+    crypto_hash_tee_update_buffer(data, &state->hashes);
 }
 
 int update_hashes_with_map_value(dispatcher_context_t *dispatcher_context,
@@ -39,8 +31,14 @@ int update_hashes_with_map_value(dispatcher_context_t *dispatcher_context,
                                  cx_hash_t *hash_prefixed) {
     LOG_PROCESSOR(__FILE__, __LINE__, __func__);
 
-    callback_state_t cb_state = {.hash_unprefixed = hash_unprefixed,
-                                 .hash_prefixed = hash_prefixed};
+    callback_state_t cb_state = {.hash_prefixed = hash_prefixed};
+    crypto_hash_tee_init(&cb_state.hashes);
+    if (hash_prefixed != NULL) {
+        crypto_hash_tee_add(&cb_state.hashes, hash_prefixed);
+    }
+    if (hash_unprefixed != NULL) {
+        crypto_hash_tee_add(&cb_state.hashes, hash_unprefixed);
+    }
 
     return call_stream_merkleized_map_value(dispatcher_context,
                                             map,
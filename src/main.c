@@ -32,9 +32,13 @@
 #include "boilerplate/dispatcher.h"
 
 #include "debug-helpers/debug.h"
+#include "debug-helpers/log.h"
 
 #include "handler/handlers.h"
+#include "handler/lib/policy.h"
+#include "handler/lib/session.h"
 #include "commands.h"
+#include "crypto.h"
 
 #include "common/wallet.h"
 
@@ -86,6 +90,11 @@ const command_descriptor_t COMMAND_DESCRIPTORS[] = {
         .ins = GET_MASTER_FINGERPRINT,
         .handler = (command_handler_t)handler_get_master_fingerprint
     },
+    {
+        .cla = CLA_APP,
+        .ins = GET_APP_CAPABILITIES,
+        .handler = (command_handler_t)handler_get_app_capabilities
+    },
     {
         .cla = CLA_APP,
         .ins = SIGN_MESSAGE,
@@ -101,6 +110,13 @@ const command_descriptor_t COMMAND_DESCRIPTORS[] = {
         .ins = SIGN_ERC4361_MESSAGE,
         .handler = (command_handler_t)handler_sign_erc4361_message
     },
+#ifdef HAVE_PERF_STATS
+    {
+        .cla = CLA_APP,
+        .ins = BENCHMARK_CRYPTO,
+        .handler = (command_handler_t)handler_benchmark_crypto
+    },
+#endif
 };
 // clang-format on
 
@@ -114,9 +130,12 @@ void app_main() {
         // Reset length of APDU response
         G_output_len = 0;
 
-        // Receive command bytes in G_io_apdu_buffer
+        // Receive command bytes in G_io_apdu_buffer; meanwhile, the session caches are filled on
+        // the next tick, if they are empty (after the app is opened, or after a session ended)
 
+        io_set_idle_task(session_warm_up);
         input_len = io_exchange(CHANNEL_APDU | IO_ASYNCH_REPLY, 0);
+        io_set_idle_task(NULL);
 
         if (input_len < 0) {
             PRINTF("=> io_exchange error\n");
@@ -132,16 +151,14 @@ void app_main() {
             return;
         }
 
-        PRINTF("=> CLA=%02X | INS=%02X | P1=%02X | P2=%02X | Lc=%02X | CData=",
-               cmd.cla,
-               cmd.ins,
-               cmd.p1,
-               cmd.p2,
-               cmd.lc);
-        for (int i = 0; i < cmd.lc; i++) {
-            PRINTF("%02X", cmd.data[i]);
-        }
-        PRINTF("\n");
+        LOG_DEBUG("=> CLA=%02X | INS=%02X | P1=%02X | P2=%02X | Lc=%02X | CData=%.*H\n",
+                  cmd.cla,
+                  cmd.ins,
+                  cmd.p1,
+                  cmd.p2,
+                  cmd.lc,
+                  cmd.lc,
+                  cmd.data);
 
         if (G_swap_state.called_from_swap) {
             if (cmd.cla != CLA_APP) {
@@ -158,12 +175,16 @@ void app_main() {
             }
         }
 
+        session_begin_command();
+
         // Dispatch structured APDU command to handler
         apdu_dispatcher(COMMAND_DESCRIPTORS,
                         sizeof(COMMAND_DESCRIPTORS) / sizeof(COMMAND_DESCRIPTORS[0]),
                         ui_menu_main,
                         &cmd);
 
+        session_end_command(apdu_dispatcher_get_last_sw());
+
         if (G_swap_state.called_from_swap && G_swap_state.should_exit) {
             // Acre app will keep listening as long as it does not receive a valid TX
             finalize_exchange_sign_transaction(true);
@@ -175,6 +196,8 @@ void app_main() {
  * Exit the application and go back to the dashboard.
  */
 void app_exit() {
+    session_reset();
+
     BEGIN_TRY_L(exit) {
         TRY_L(exit) {
             os_sched_exit(-1);
@@ -244,7 +267,8 @@ void coin_main() {
                 app_main();
             }
             CATCH(EXCEPTION_IO_RESET) {
-                // reset IO and UX
+                // reset IO and UX, and end the session
+                session_reset();
                 CLOSE_TRY;
                 continue;
             }
@@ -260,6 +284,9 @@ void coin_main() {
     app_exit();
 }
 
+// CHECK_ADDRESS and GET_PRINTABLE_AMOUNT are answered without initializing the IO, the UX or the
+// session: only SIGN_TRANSACTION runs the app. Each call of the Exchange app starts the library
+// with its RAM initialized again, therefore no cache can be kept from one call to the next.
 static void swap_library_main_helper(libargs_t *args) {
     PRINTF("Inside a library \n");
     switch (args->command) {
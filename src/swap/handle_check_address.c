@@ -88,13 +88,41 @@ bool get_address_from_compressed_public_key(unsigned char format,
     return true;
 }
 
+// Like get_address_from_compressed_public_key, from the uncompressed public key returned by the
+// derivation: for taproot, the key is tweaked without lifting its x coordinate again.
+static bool get_address_from_uncompressed_public_key(unsigned char format,
+                                                     const uint8_t pub_key[static 65],
+                                                     char* address,
+                                                     unsigned char max_address_length) {
+    if (format == P2_TAPROOT) {
+        uint8_t tweaked_key[32];
+        uint8_t parity;
+        if (crypto_tr_tweak_uncompressed_pubkey(pub_key, NULL, 0, &parity, tweaked_key) < 0) {
+            return false;
+        }
+        return segwit_addr_encode(address, COIN_NATIVE_SEGWIT_PREFIX, 1, tweaked_key, 32) == 1;
+    }
+
+    unsigned char compressed_pub_key[33];
+    if (crypto_get_compressed_pubkey(pub_key, compressed_pub_key) < 0) {
+        return false;
+    }
+    return get_address_from_compressed_public_key(format,
+                                                  compressed_pub_key,
+                                                  COIN_P2PKH_VERSION,
+                                                  COIN_P2SH_VERSION,
+                                                  COIN_NATIVE_SEGWIT_PREFIX,
+                                                  address,
+                                                  max_address_length);
+}
+
 int os_strcmp(const char* s1, const char* s2) {
     size_t size = strlen(s1) + 1;
     return memcmp(s1, s2, size);
 }
 
 int handle_check_address(check_address_parameters_t* params) {
-    unsigned char compressed_public_key[33];
+    uint8_t public_key[65];
     PRINTF("Params on the address %d\n", (unsigned int) params);
     PRINTF("Address to check %s\n", params->address_to_check);
     PRINTF("Inside handle_check_address\n");
@@ -110,20 +138,14 @@ int handle_check_address(check_address_parameters_t* params) {
         return false;
     }
 
-    if (!crypto_get_compressed_pubkey_at_path(path.path,
-                                              path.length,
-                                              compressed_public_key,
-                                              NULL)) {
+    if (!crypto_get_uncompressed_pubkey_at_path(path.path, path.length, public_key, NULL)) {
         return 0;
     }
     char address[MAX_ADDRESS_LENGTH_STR + 1];
-    if (!get_address_from_compressed_public_key(params->address_parameters[0],
-                                                compressed_public_key,
-                                                COIN_P2PKH_VERSION,
-                                                COIN_P2SH_VERSION,
-                                                COIN_NATIVE_SEGWIT_PREFIX,
-                                                address,
-                                                sizeof(address))) {
+    if (!get_address_from_uncompressed_public_key(params->address_parameters[0],
+                                                  public_key,
+                                                  address,
+                                                  sizeof(address))) {
         PRINTF("Can't create address from given public key\n");
         return 0;
     }
@@ -58,9 +58,6 @@ bool copy_transaction_parameters(create_transaction_parameters_t* sign_transacti
 
     G_swap_state.amount = read_u64_be(amount, 0);
     G_swap_state.fees = read_u64_be(fees, 0);
-    memcpy(G_swap_state.destination_address,
-           destination_address,
-           sizeof(G_swap_state.destination_address));
 
     // if destination_address_extra_id is given, we use the first byte to determine if we use the
     // normal swap protocol, or the one for cross-chain swaps
@@ -85,6 +82,15 @@ bool copy_transaction_parameters(create_transaction_parameters_t* sign_transacti
         G_swap_state.mode = SWAP_MODE_ERROR;
     }
 
+    int destination_script_len =
+        get_address_script(destination_address, G_swap_state.destination_script);
+    if (destination_script_len < 0) {
+        // as above, the error is returned once an attempt is made to sign
+        G_swap_state.mode = SWAP_MODE_ERROR;
+    } else {
+        G_swap_state.destination_script_len = (uint8_t) destination_script_len;
+    }
+
     return true;
 }
 
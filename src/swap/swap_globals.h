@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#include "../common/script.h"
+
 enum {
     SWAP_MODE_STANDARD = 0,
     SWAP_MODE_CROSSCHAIN = 1,
@@ -11,7 +13,10 @@ enum {
 typedef struct swap_globals_s {
     uint64_t amount;
     uint64_t fees;
-    char destination_address[65];
+    // the scriptPubKey of the destination address, decoded once when the swap parameters are
+    // copied, so that the output of the transaction is compared without encoding its address
+    uint8_t destination_script[MAX_ADDRESS_SCRIPT_LEN];
+    uint8_t destination_script_len;
     /*Is swap mode*/
     unsigned char called_from_swap;
     unsigned char should_exit;
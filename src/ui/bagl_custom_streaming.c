@@ -114,6 +114,9 @@ static void ux_layout_paging_prev(ux_layout_paging_redisplay_t redisplay) {
     }
 }
 
+// Moving past the first or the last page of the current text ends the flow with the streaming index
+// updated, and the caller shows the text of the previous or next step. For sign_message, the whole
+// message is already in RAM at this point, so that no request to the client is needed on any press.
 STATIC_IF_NOT_INDEXED unsigned int ux_layout_paging_button_callback_common_streaming(
     unsigned int button_mask,
     unsigned int button_mask_counter,
@@ -22,6 +22,9 @@ BITCOIN_APP_BINARY: the full path and file name of the app's binary to use. Defa
 
 BITCOIN_APP_LIB_BINARY: the full path and file name of binary to use as Bitcoin library in speculos.
                         If omitted no library is used in speculos.
+
+SPECULOS_EXTRA_ARGS: additional command line arguments of speculos, separated by spaces; for example "-d" to wait
+                     for a debugger or the profiler of dev-tools/profile_speculos.py.
 """
 
 
@@ -132,6 +135,7 @@ def comm(settings, root_directory, hid, headless, model, app_version: str) -> Un
             ['--model', model, '--seed', f'{settings["mnemonic"]}']
             + ["--display", "qt" if not headless else "headless"]
             + lib_params
+            + os.getenv("SPECULOS_EXTRA_ARGS", "").split()
         )
         client.start()
 
@@ -23,6 +23,17 @@ def withdrawal_instruction_approve(model: Firmware, save_screenshot=True) -> Ins
         instructions.confirm_withdrawal()
     return instructions
 
+def withdrawals_instruction_approve(model: Firmware, count: int, save_screenshot=True) -> Instructions:
+    instructions = Instructions(model)
+
+    # each withdrawal is reviewed separately
+    for _ in range(count):
+        if model.name.startswith("nano"):
+            instructions.new_request("Approve", save_screenshot=save_screenshot)
+        else:
+            instructions.confirm_withdrawal(save_screenshot=save_screenshot)
+    return instructions
+
 def withdrawal_instruction_reject(model: Firmware) -> Instructions:
     instructions = Instructions(model)
 
@@ -0,0 +1,17 @@
+from ragger_bitcoin import RaggerClient
+
+from ledger_bitcoin.capabilities import AppLimit
+
+
+def test_get_app_capabilities(client: RaggerClient):
+    capabilities = client.get_app_capabilities()
+
+    assert capabilities.max_protocol_version == 10
+    # all the client commands from GET_PREIMAGE (0x40) to GET_MERKLE_LEAF_HASHES (0x48), except
+    # MULTI_REQUEST (0x47), that the app does not send
+    for code in range(0x40, 0x49):
+        assert capabilities.supports_client_command(code) == (code != 0x47)
+    assert not capabilities.supports_client_command(0x49)
+
+    assert capabilities.limit(AppLimit.MAX_CONTINUE_LENGTH) >= 255
+    assert capabilities.limit(AppLimit.MAX_N_INPUTS_CAN_SIGN) == 512
@@ -326,6 +326,50 @@ def test_get_wallet_address_large_addr_index(client: RaggerClient):
         client.get_wallet_address(wallet, wallet_hmac, 0, 2**31, False)
 
 
+def test_get_wallet_addresses_batch(client: RaggerClient):
+    # batch mode should return the same addresses as one command per address index
+    wallet = WalletPolicy(
+        name="",
+        descriptor_template="wpkh(@0/**)",
+        keys_info=[
+            f"[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P",
+        ],
+    )
+
+    # enough addresses to need more than one YIELD message
+    res = client.get_wallet_addresses(wallet, None, 1, 10, 10)
+    assert len(res) == 10
+    assert res[5] == "tb1qlrvzyx8jcjfj2xuy69du9trtxnsvjuped7e289"
+    for i in range(10):
+        assert res[i] == client.get_wallet_address(wallet, None, 1, 10 + i, False)
+
+    # for a default wallet, all the address indexes must be in the recommended range
+    client.get_wallet_addresses(wallet, None, 0, 50000, 1)
+    with pytest.raises(ExceptionRAPDU):
+        client.get_wallet_addresses(wallet, None, 0, 49999, 2)
+
+    wallet = MultisigWallet(
+        name="Cold storage",
+        address_type=AddressType.WIT,
+        threshold=2,
+        keys_info=[
+            "[76223a6e/48'/1'/0'/2']tpubDE7NQymr4AFtewpAsWtnreyq9ghkzQBXpCZjWLFVRAvnbf7vya2eMTvT2fPapNqL8SuVvLQdbUbMfWLVDCZKnsEBqp6UK93QEzL8Ck23AwF",
+            "[f5acc2fd/48'/1'/0'/2']tpubDFAqEGNyad35aBCKUAXbQGDjdVhNueno5ZZVEn3sQbW5ci457gLR7HyTmHBg93oourBssgUxuWz1jX5uhc1qaqFo9VsybY1J5FuedLfm4dK",
+        ],
+    )
+    wallet_hmac = bytes.fromhex(
+        "d7c7a60b4ab4a14c1bf8901ba627d72140b2fb907f2b4e35d2e693bce9fbb371"
+    )
+
+    res = client.get_wallet_addresses(wallet, wallet_hmac, 0, 0, 4)
+    assert res[0] == "tb1qmyauyzn08cduzdqweexgna2spwd0rndj55fsrkefry2cpuyt4cpsn2pg28"
+
+    # the range must not include hardened indexes
+    client.get_wallet_addresses(wallet, wallet_hmac, 0, 2**31 - 2, 2)
+    with pytest.raises(ExceptionRAPDU):
+        client.get_wallet_addresses(wallet, wallet_hmac, 0, 2**31 - 2, 3)
+
+
 def test_get_wallet_address_miniscript_all_fragments(client: Client, speculos_globals: SpeculosGlobals, rpc):
     # Create some miniscripts to exercise all possible fragments at least once,
     # by comparing with the addresses generated by bitcoin-core.
@@ -1,7 +1,8 @@
 import pytest
 
-from ledger_bitcoin.command_builder import BitcoinCommandBuilder, BitcoinInsType, CURRENT_PROTOCOL_VERSION
-from ledger_bitcoin.exception.errors import WrongP1P2Error
+from ledger_bitcoin.command_builder import BitcoinCommandBuilder, BitcoinInsType, FrameworkInsType, \
+    CURRENT_PROTOCOL_VERSION
+from ledger_bitcoin.exception.errors import BadStateError, WrongP1P2Error
 from ledger_bitcoin.exception.device_exception import DeviceException
 
 from ragger.error import ExceptionRAPDU
@@ -36,3 +37,17 @@ def test_p2_too_high(client: RaggerClient):
         )
     assert DeviceException.exc.get(e.value.status) == WrongP1P2Error
     assert len(e.value.data) == 0
+
+
+def test_unexpected_get_response(client: RaggerClient):
+    # Tests that GET_RESPONSE fails with 0xb007 (BAD_STATE) if no response is chained
+    with pytest.raises(ExceptionRAPDU) as e:
+        client.transport_client.exchange(
+            cla=BitcoinCommandBuilder.CLA_FRAMEWORK,
+            ins=FrameworkInsType.GET_RESPONSE,
+            p1=0,
+            p2=CURRENT_PROTOCOL_VERSION,
+            data=b''
+        )
+    assert DeviceException.exc.get(e.value.status) == BadStateError
+    assert len(e.value.data) == 0
@@ -1,6 +1,7 @@
 import pytest
 
-from ledger_bitcoin.exception.errors import DenyError
+from ledger_bitcoin.command_builder import BitcoinCommandBuilder, MAX_CHUNKS_PER_LEAF
+from ledger_bitcoin.exception.errors import DenyError, IncorrectDataError
 from ledger_bitcoin.exception.device_exception import DeviceException
 from ragger.navigator import Navigator
 from ragger.firmware import Firmware
@@ -110,3 +111,15 @@ def test_sign_message_hash_reject(navigator: Navigator, firmware: Firmware, clie
 
     assert DeviceException.exc.get(e.value.status) == DenyError
     assert len(e.value.data) == 0
+
+
+def test_sign_message_chunks_per_leaf_too_high(client: RaggerClient):
+    # Each leaf of the Merkle tree of the message holds at most MAX_CHUNKS_PER_LEAF chunks
+    with pytest.raises(ExceptionRAPDU) as e:
+        client.transport_client.exchange(
+            **BitcoinCommandBuilder().sign_message(b"Hello world!", "m/44'/1'/0'/0/0",
+                                                   chunks_per_leaf=MAX_CHUNKS_PER_LEAF + 1)
+        )
+
+    assert DeviceException.exc.get(e.value.status) == IncorrectDataError
+    assert len(e.value.data) == 0
@@ -4,9 +4,10 @@ import pytest
 from pathlib import Path
 
 from ledger_bitcoin import WalletPolicy, MultisigWallet, AddressType, PartialSignature
-from ledger_bitcoin.exception.errors import IncorrectDataError, NotSupportedError
+from ledger_bitcoin.exception.errors import IncorrectDataError, NotSupportedError, SignatureFailError
 from ledger_bitcoin.exception.device_exception import DeviceException
 
+from ledger_bitcoin.command_builder import MAX_APDU_DATA_LENGTH
 from ledger_bitcoin.psbt import PSBT
 from ledger_bitcoin.wallet import AddressType
 from ragger.navigator import Navigator
@@ -164,6 +165,40 @@ def test_sign_psbt_singlesig_wpkh_1to2(navigator: Navigator, firmware: Firmware,
     )]
 
 
+def test_sign_psbt_singlesig_wpkh_1to2_protocol_version_1(navigator: Navigator, firmware: Firmware, client:
+                                                          RaggerClient, test_name: str):
+    # Same as test_sign_psbt_singlesig_wpkh_1to2, for a client of version 1 of the protocol: the app must only
+    # send the client commands of that version (the interpreter fails on the others)
+    client.builder.protocol_version = 1
+    client.max_continue_length = MAX_APDU_DATA_LENGTH
+    client.chunks_per_leaf = 1
+
+    psbt = open_psbt_from_file(f"{tests_root}/psbt/singlesig/wpkh-1to2.psbt")
+
+    wallet = WalletPolicy(
+        "",
+        "wpkh(@0/**)",
+        [
+            "[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"
+        ],
+    )
+
+    # the screens are the same as for the current version of the protocol
+    result = client.sign_psbt(psbt, wallet, None, navigator,
+                              instructions=sign_psbt_instruction_approve(firmware),
+                              testname="test_sign_psbt_singlesig_wpkh_1to2")
+
+    assert result == [(
+        0,
+        PartialSignature(
+            pubkey=bytes.fromhex("03ee2c3d98eb1f93c0a1aa8e5a4009b70eb7b44ead15f1666f136b012ad58d3068"),
+            signature=bytes.fromhex(
+                "3045022100ab44f34dd7e87c9054591297a101e8500a0641d1d591878d0d23cf8096fa79e802205d12d1062d925e27b57bdcf994ecf332ad0a8e67b8fe407bab2101255da632aa01"
+            )
+        )
+    )]
+
+
 def test_sign_psbt_singlesig_wpkh_2to2(navigator: Navigator, firmware: Firmware, client:
                                        RaggerClient, test_name: str):
     # PSBT for a segwit 2-input 2-output spend (1 change address)
@@ -549,6 +584,145 @@ def test_sign_psbt_singlesig_wpkh_4to3(navigator: Navigator, firmware: Firmware,
     assert len(result) == n_ins
 
 
+def test_sign_psbt_selected_inputs(navigator: Navigator, firmware: Firmware, client:
+                                   RaggerClient, test_name: str):
+    # only the inputs selected by the client are signed; the others are shown as external
+
+    wallet = WalletPolicy(
+        "",
+        "wpkh(@0/**)",
+        [
+            "[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"
+        ],
+    )
+
+    n_ins = 4
+    n_outs = 3
+
+    in_amounts = [10000 + 10000 * i for i in range(n_ins)]
+    total_in = sum(in_amounts)
+    out_amounts = [total_in // n_outs - i for i in range(n_outs)]
+
+    psbt = txmaker.createPsbt(wallet, in_amounts, out_amounts, [i == 1 for i in range(n_outs)])
+
+    result = client.sign_psbt(psbt, wallet, None, navigator,
+                              instructions=sign_psbt_instruction_approve_external_inputs(firmware, output_count=2),
+                              testname=test_name, inputs_to_sign=[1, 3])
+
+    assert sorted(i for i, _ in result) == [1, 3]
+
+
+def test_sign_psbt_checkpoint_resume(navigator: Navigator, firmware: Firmware, client:
+                                     RaggerClient, test_name: str):
+    # signs the inputs of a PSBT in multiple commands, after validating it once
+
+    wallet = WalletPolicy(
+        "",
+        "wpkh(@0/**)",
+        [
+            "[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"
+        ],
+    )
+
+    n_ins = 6
+    n_outs = 2
+
+    in_amounts = [10000 + 10000 * i for i in range(n_ins)]
+    total_in = sum(in_amounts)
+    out_amounts = [total_in // n_outs - i for i in range(n_outs)]
+
+    psbt = txmaker.createPsbt(wallet, in_amounts, out_amounts, [i == 0 for i in range(n_outs)])
+
+    checkpoint = client.sign_psbt_checkpoint(psbt, wallet, None, navigator,
+                                             instructions=sign_psbt_instruction_approve(
+                                                 firmware, save_screenshot=False),
+                                             testname=test_name)
+    assert len(checkpoint) == 224
+
+    result = client.sign_psbt_resume(psbt, wallet, None, checkpoint, 0, 4)
+    assert sorted(i for i, _ in result) == [0, 1, 2, 3]
+    result += client.sign_psbt_resume(psbt, wallet, None, checkpoint, 4, 6)
+
+    expected = client.sign_psbt(psbt, wallet, None, navigator,
+                                instructions=sign_psbt_instruction_approve(firmware, save_screenshot=False),
+                                testname=test_name)
+    assert sorted(result) == sorted(expected)
+
+    # a tampered checkpoint is rejected
+    tampered = checkpoint[:-1] + bytes([checkpoint[-1] ^ 1])
+    with pytest.raises(ExceptionRAPDU) as e:
+        client.sign_psbt_resume(psbt, wallet, None, tampered, 0, 1)
+    assert DeviceException.exc.get(e.value.status) == SignatureFailError
+
+    # and so is a range past the last input
+    with pytest.raises(ExceptionRAPDU) as e:
+        client.sign_psbt_resume(psbt, wallet, None, checkpoint, 6, 7)
+    assert DeviceException.exc.get(e.value.status) == IncorrectDataError
+
+
+def test_sign_psbt_low_r(navigator: Navigator, firmware: Firmware, client: RaggerClient, test_name: str):
+    # with low_r, all the ECDSA signatures are ground to a low R, therefore at most 71 bytes long;
+    # without grinding, some of the 8 signatures would be 72 bytes long with probability 1 - 2^-8
+
+    wallet = WalletPolicy(
+        "",
+        "wpkh(@0/**)",
+        [
+            "[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"
+        ],
+    )
+
+    n_ins = 8
+    n_outs = 2
+
+    in_amounts = [10000 + 10000 * i for i in range(n_ins)]
+    total_in = sum(in_amounts)
+    out_amounts = [total_in // n_outs - i for i in range(n_outs)]
+
+    psbt = txmaker.createPsbt(wallet, in_amounts, out_amounts, [i == 0 for i in range(n_outs)])
+
+    result = client.sign_psbt(psbt, wallet, None, navigator,
+                              instructions=sign_psbt_instruction_approve(firmware),
+                              testname=test_name, low_r=True)
+
+    assert sorted(i for i, _ in result) == list(range(n_ins))
+    for _, sig in result:
+        assert len(sig.signature) <= 71
+
+
+def test_sign_psbt_batch(navigator: Navigator, firmware: Firmware, client: RaggerClient, test_name: str):
+    # signs two PSBTs for the same wallet policy in a single command, confirming each of them
+
+    wallet = WalletPolicy(
+        "",
+        "wpkh(@0/**)",
+        [
+            "[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"
+        ],
+    )
+
+    psbts = []
+    for n_ins in [2, 3]:
+        in_amounts = [10000 + 10000 * i for i in range(n_ins)]
+        out_amounts = [sum(in_amounts) // 2 - i for i in range(2)]
+        psbts.append(txmaker.createPsbt(wallet, in_amounts, out_amounts, [i == 0 for i in range(2)]))
+
+    instructions = sign_psbt_instruction_approve(firmware, save_screenshot=False)
+    second_review = sign_psbt_instruction_approve(firmware, save_screenshot=False)
+    for key in instructions.data:
+        instructions.data[key] += second_review.data[key]
+
+    results = client.sign_psbt_batch(psbts, wallet, None, navigator=navigator,
+                                     instructions=instructions, testname=test_name)
+    assert len(results) == 2
+
+    for psbt, result in zip(psbts, results):
+        expected = client.sign_psbt(psbt, wallet, None, navigator,
+                                    instructions=sign_psbt_instruction_approve(firmware, save_screenshot=False),
+                                    testname=test_name)
+        assert sorted(result) == sorted(expected)
+
+
 def test_sign_psbt_singlesig_large_amount(navigator: Navigator, firmware: Firmware, client:
                                           RaggerClient, test_name: str):
     # Test with a transaction with an extremely large amount
@@ -860,6 +1034,38 @@ def test_sign_psbt_singlesig_pkh_1to1_other_encodings(navigator: Navigator, firm
         )]
 
 
+def test_sign_psbt_taproot_ignores_non_witness_utxo(navigator: Navigator, firmware: Firmware, client:
+                                                   RaggerClient, test_name: str):
+    # For taproot policies only the witness utxo is used, as the signatures commit to all the
+    # amounts and scriptPubKeys; a non-witness utxo is not even requested. Here it is not the
+    # transaction spent by the input, which would be rejected if it was checked.
+
+    psbt = open_psbt_from_file(f"{tests_root}/psbt/singlesig/tr-1to2-sighash-all.psbt")
+    psbt.inputs[0].non_witness_utxo = psbt.tx
+
+    wallet = WalletPolicy(
+        "",
+        "tr(@0/**)",
+        [
+            "[f5acc2fd/86'/1'/0']tpubDDKYE6BREvDsSWMazgHoyQWiJwYaDDYPbCFjYxN3HFXJP5fokeiK4hwK5tTLBNEDBwrDXn8cQ4v9b2xdW62Xr5yxoQdMu1v6c7UDXYVH27U"
+        ],
+    )
+
+    result = client.sign_psbt(psbt, wallet, None, navigator,
+                              instructions=sign_psbt_instruction_approve(firmware),
+                              testname=test_name)
+    assert len(result) == 1
+
+    # same sighash as in test_sign_psbt_taproot_1to2_sighash_all
+    sighash0 = bytes.fromhex("7A999E5AD6F53EA6448E7026061D3B4523F957999C430A5A492DFACE74AE31B6")
+    pubkey0_psbt = psbt.inputs[0].witness_utxo.scriptPubKey[2:]
+
+    idx0, partial_sig0 = result[0]
+    assert idx0 == 0
+    assert partial_sig0.pubkey == pubkey0_psbt
+    assert bip0340.schnorr_verify(sighash0, pubkey0_psbt, partial_sig0.signature[:-1])
+
+
 def test_sign_psbt_tr_script_pk_sighash_all(navigator: Navigator, firmware: Firmware, client:
                                             RaggerClient, test_name: str):
     # Transaction signed with SIGHASH_ALL, therefore producing a 65-byte signature
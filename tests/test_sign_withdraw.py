@@ -7,7 +7,7 @@ from ragger.firmware import Firmware
 from ragger.error import ExceptionRAPDU
 from ragger_bitcoin import RaggerClient
 from ledger_bitcoin.withdraw import AcreWithdrawalData
-from .instructions import withdrawal_instruction_approve, withdrawal_instruction_reject
+from .instructions import withdrawal_instruction_approve, withdrawal_instruction_reject, withdrawals_instruction_approve
 
 #
 def test_sign_withdraw(navigator: Navigator, firmware: Firmware, client: RaggerClient, test_name: str):
@@ -72,3 +72,23 @@ def test_sign_withdraw_reject(navigator: Navigator, firmware: Firmware, client:
 
         assert DeviceException.exc.get(e.value.status) == DenyError
         assert len(e.value.data) == 0
+
+def test_sign_withdrawals_batch(navigator: Navigator, firmware: Firmware, client: RaggerClient, test_name: str):
+    data = AcreWithdrawalData(
+        to= "0xc14972DC5a4443E4f5e89E3655BE48Ee95A795aB",
+        value= "0x0",
+        data= "0xcae9ca510000000000000000000000007e184179b1F95A9ca398E6a16127f06b81Cb37a3000000000000000000000000000000000000000000000000002386F26FC10000000000000000000000000000000000000000000000000000000000000000006000000000000000000000000000000000000000000000000000000000000001000000000000000000000000006083Bde64CCBF08470a1a0dAa9a0281B4951be7C4fa8f3322330a4be2d34fdd2a573eaa5f94c7fe5000000000000000000000000d2f85a52fee8ee905e504f75dcf34156b2503004de1079ddaeceaf643b38a034000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000005835b17e900000000000000000000000000000000000000000000000000000000000000c0000000000000000000000000000000000000000000000000000000000000001a1976a914c8e9edf5e915c0482b1b236fc917011a4b943e6e88ac000000000000",
+        operation= "0",
+        safeTxGas= "0x0",
+        baseGas= "0x0",
+        gasPrice= "0x0",
+        gasToken= "0x0000000000000000000000000000000000000000",
+        refundReceiver= "0x0000000000000000000000000000000000000000",
+        nonce= "0x8",
+    )
+    path = "m/44'/0'/0'/0/0"
+    # the batch returns the same signatures as signing each withdrawal separately
+    result = client.sign_withdrawals([data, data], path, navigator,
+                                     instructions=withdrawals_instruction_approve(firmware, 2, save_screenshot=False),
+                                     testname=test_name)
+    assert result == ["Hy2UpLBXRUkHBRfXIEYFB8PEteLtjxrqJ7kJ3Qe+i67wP0bzDkFl5Z4bYBFfT/3+xwgPrw3T0rkq6dv53Cff+p0="] * 2
@@ -1,6 +1,7 @@
 
 from pathlib import Path
 from test_utils.fixtures import *
+import pytest
 import random
 import sys
 import os
@@ -16,3 +17,65 @@ from ledger_bitcoin import Chain  # noqa: E402
 TESTS_ROOT_DIR = Path(__file__).parent
 
 random.seed(0)  # make sure tests are repeatable
+
+from test_utils.fixtures import pytest_addoption as test_utils_addoption  # noqa: E402
+
+from .perf_stats import CACHE_REPORT_PATH, CacheReport  # noqa: E402
+from .round_trips import BASELINE_PATH, RoundTripBaseline  # noqa: E402
+from .scaling import REPORT_PATH, ScalingReport  # noqa: E402
+from .worst_case import REPORT_PATH as WORST_CASE_REPORT_PATH, WorstCaseReport  # noqa: E402
+
+
+def pytest_addoption(parser):
+    test_utils_addoption(parser)
+    parser.addoption("--update-round-trip-baseline", action="store_true",
+                     help="Write the measured round trips to the committed baseline, instead of checking them")
+    parser.addoption("--scaling-report", action="store", default=str(REPORT_PATH),
+                     help="Path of the scaling report, without extension; a .csv and a .json file are written")
+    parser.addoption("--worst-case-report", action="store", default=str(WORST_CASE_REPORT_PATH),
+                     help="Path of the JSON report of the worst-case corpus")
+    parser.addoption("--cache-report", action="store", default=str(CACHE_REPORT_PATH),
+                     help="Path of the JSON report of the counters of the caches")
+
+
+@pytest.fixture(scope="session")
+def round_trip_baseline(pytestconfig) -> RoundTripBaseline:
+    baseline = RoundTripBaseline(BASELINE_PATH, pytestconfig.getoption("update_round_trip_baseline"))
+    yield baseline
+    baseline.save()
+
+
+@pytest.fixture(scope="session")
+def scaling_report(pytestconfig) -> ScalingReport:
+    report = ScalingReport()
+    yield report
+    report.save(Path(pytestconfig.getoption("scaling_report")))
+
+
+@pytest.fixture(scope="session")
+def worst_case_report(pytestconfig) -> WorstCaseReport:
+    report = WorstCaseReport()
+    yield report
+    report.save(Path(pytestconfig.getoption("worst_case_report")))
+
+
+# the report is kept after the session fixtures are torn down, for pytest_terminal_summary
+cache_report_key = pytest.StashKey[CacheReport]()
+
+
+@pytest.fixture(scope="session")
+def cache_report(pytestconfig) -> CacheReport:
+    report = CacheReport()
+    pytestconfig.stash[cache_report_key] = report
+    yield report
+    report.save(Path(pytestconfig.getoption("cache_report")))
+
+
+def pytest_terminal_summary(terminalreporter, exitstatus, config):
+    report = config.stash.get(cache_report_key, None)
+    if report is None or len(report.scenarios) == 0:
+        return
+
+    terminalreporter.section("cache hit rates")
+    for line in report.format_hit_rates():
+        terminalreporter.write_line(line)
@@ -0,0 +1,293 @@
+import json
+from dataclasses import dataclass, field
+from pathlib import Path
+from typing import Dict, List, Tuple
+
+from ledger_bitcoin import Client
+from ledger_bitcoin.common import SW_OK, SW_RESPONSE_HAS_MORE
+
+CLA_FRAMEWORK = 0xF8
+INS_GET_PERF_STATS = 0x02
+INS_GET_TRACE = 0x03
+
+PERF_STATS_P1_CRYPTO = 0x01
+PERF_STATS_P1_LATENCY = 0x02
+PERF_STATS_P1_CACHES = 0x03
+
+PHASE_NAMES = ["other", "init", "inputs", "outputs", "confirm", "sign"]
+
+# cryptographic operations counted by the app, in the order of perf_crypto_op_t in src/boilerplate/perf_stats.h
+CRYPTO_OP_NAMES = ["hash_blocks", "hmac_sha256", "hmac_sha512", "scalar_mult", "point_add", "mod_sqrt", "ripemd160",
+                   "os_derivation", "signature"]
+
+# caches instrumented by the app, in the order of perf_cache_t in src/boilerplate/perf_stats.h
+CACHE_NAMES = ["merkle_node", "merkle_leaf_table", "merkleized_map", "map_contents", "wallet_key", "rawtx",
+               "taproot_key", "wallet_policy", "validated_psbt", "xpub", "private_node"]
+
+CACHE_REPORT_PATH = Path(__file__).parent / "cache_report.json"
+
+# ids of the events of the binary trace, as in src/boilerplate/trace.h
+TRACE_EVENT_NAMES = {1: "phase", 2: "interruption", 3: "input", 4: "output", 5: "sign_input", 6: "error"}
+
+
+@dataclass
+class CcmdStats:
+    n_interruptions: int
+    n_apdus: int
+    bytes_out: int
+    bytes_in: int
+
+
+@dataclass
+class PhaseStats:
+    ticks: int
+    n_interruptions: int
+
+
+@dataclass
+class PerfStats:
+    """Counters of the last command executed by the app, as returned by INS_GET_PERF_STATS."""
+
+    cla: int
+    ins: int
+    n_interruptions: int
+    bytes_out: int
+    bytes_in: int
+    ccmds: Dict[int, CcmdStats] = field(default_factory=dict)
+    phases: List[PhaseStats] = field(default_factory=list)
+    stack_used: int = 0
+    stack_free: int = 0
+    # peak stack usage of each command (CLA, INS) since the app was started
+    max_stack_used: Dict[Tuple[int, int], int] = field(default_factory=dict)
+
+    def to_dict(self) -> dict:
+        return {
+            "n_interruptions": self.n_interruptions,
+            "bytes_out": self.bytes_out,
+            "bytes_in": self.bytes_in,
+            "ccmds": {f"0x{code:02x}": vars(stats) for code, stats in self.ccmds.items()},
+            "phases": {
+                (PHASE_NAMES[i] if i < len(PHASE_NAMES) else str(i)): vars(stats)
+                for i, stats in enumerate(self.phases)
+            },
+            "stack_used": self.stack_used,
+            "stack_free": self.stack_free,
+        }
+
+
+def get_perf_stats(client: Client) -> PerfStats:
+    """Reads the counters of the last command; the app must be built with AUTOAPPROVE_FOR_PERF_TESTS=1."""
+
+    data = client.transport_client.apdu_exchange(CLA_FRAMEWORK, INS_GET_PERF_STATS)
+
+    def u32(pos: int) -> int:
+        return int.from_bytes(data[pos:pos + 4], byteorder="big")
+
+    stats = PerfStats(cla=data[0], ins=data[1], n_interruptions=u32(2), bytes_out=u32(6), bytes_in=u32(10))
+
+    pos = 14
+    n_codes = data[pos]
+    pos += 1
+    for _ in range(n_codes):
+        stats.ccmds[data[pos]] = CcmdStats(u32(pos + 1), u32(pos + 5), u32(pos + 9), u32(pos + 13))
+        pos += 17
+
+    n_phases = data[pos]
+    pos += 1
+    for _ in range(n_phases):
+        stats.phases.append(PhaseStats(u32(pos), u32(pos + 4)))
+        pos += 8
+
+    stats.stack_used = u32(pos)
+    stats.stack_free = u32(pos + 4)
+    pos += 8
+
+    n_ins = data[pos]
+    pos += 1
+    for _ in range(n_ins):
+        stats.max_stack_used[(data[pos], data[pos + 1])] = u32(pos + 2)
+        pos += 6
+
+    return stats
+
+
+@dataclass
+class TraceEvent:
+    event: str
+    tick: int
+    arg: int
+
+
+@dataclass
+class Trace:
+    """Most recent events of the last command, as returned by INS_GET_TRACE."""
+
+    n_dropped: int  # older events that were overwritten in the ring buffer
+    events: List[TraceEvent]
+
+
+def get_trace(client: Client) -> Trace:
+    """Reads the binary trace of the last command; the app must be built with AUTOAPPROVE_FOR_PERF_TESTS=1."""
+
+    data = client.transport_client.apdu_exchange(CLA_FRAMEWORK, INS_GET_TRACE)
+
+    trace = Trace(n_dropped=int.from_bytes(data[0:4], byteorder="big"), events=[])
+    pos = 5
+    for _ in range(data[4]):
+        event_id = data[pos]
+        trace.events.append(TraceEvent(
+            event=TRACE_EVENT_NAMES.get(event_id, str(event_id)),
+            tick=int.from_bytes(data[pos + 1:pos + 3], byteorder="big"),
+            arg=int.from_bytes(data[pos + 3:pos + 7], byteorder="big"),
+        ))
+        pos += 7
+
+    return trace
+
+
+def get_crypto_stats(client: Client) -> Dict[str, int]:
+    """Reads the counts of the cryptographic operations of the last command; the app must be built with
+    AUTOAPPROVE_FOR_PERF_TESTS=1."""
+
+    data = client.transport_client.apdu_exchange(CLA_FRAMEWORK, INS_GET_PERF_STATS, p1=PERF_STATS_P1_CRYPTO)
+
+    return {
+        (CRYPTO_OP_NAMES[i] if i < len(CRYPTO_OP_NAMES) else str(i)):
+            int.from_bytes(data[1 + 4 * i:5 + 4 * i], byteorder="big")
+        for i in range(data[0])
+    }
+
+
+@dataclass
+class LatencyHistograms:
+    """Latency histograms kept by the app since it was started, as returned by INS_GET_PERF_STATS with
+    P1 = PERF_STATS_P1_LATENCY. Each histogram is a list of counts: the first bucket counts the durations of 0 ticks,
+    bucket i > 0 the durations from 2^(i-1) to 2^i - 1 ticks, and the last bucket all the longer ones."""
+
+    # duration of the commands, for each (CLA, INS)
+    commands: Dict[Tuple[int, int], List[int]] = field(default_factory=dict)
+    # for each client command code, the service time of the app after its answer (0: before the first interruption)
+    service: Dict[int, List[int]] = field(default_factory=dict)
+    # for each client command code, the time waiting for the answer of the client
+    wait: Dict[int, List[int]] = field(default_factory=dict)
+
+    def __sub__(self, other: "LatencyHistograms") -> "LatencyHistograms":
+        """The counts accumulated since `other` was read."""
+
+        def diff(current: dict, previous: dict) -> dict:
+            return {
+                key: [n - p for n, p in zip(counts, previous.get(key, [0] * len(counts)))]
+                for key, counts in current.items()
+            }
+
+        return LatencyHistograms(diff(self.commands, other.commands), diff(self.service, other.service),
+                                 diff(self.wait, other.wait))
+
+    def to_dict(self) -> dict:
+        return {
+            "commands": {f"{cla:02x}{ins:02x}": counts for (cla, ins), counts in self.commands.items()},
+            "service": {f"0x{code:02x}": counts for code, counts in self.service.items()},
+            "wait": {f"0x{code:02x}": counts for code, counts in self.wait.items()},
+        }
+
+
+def get_latency_histograms(client: Client) -> LatencyHistograms:
+    """Reads the latency histograms of the app; the app must be built with AUTOAPPROVE_FOR_PERF_TESTS=1. The response
+    is longer than an APDU, so it is read in chunks with GET_RESPONSE."""
+
+    sw, data = client._apdu_exchange(client.builder.serialize(CLA_FRAMEWORK, INS_GET_PERF_STATS,
+                                                              p1=PERF_STATS_P1_LATENCY))
+    while sw & 0xFF00 == SW_RESPONSE_HAS_MORE:
+        sw, next_chunk = client._apdu_exchange(client.builder.get_response())
+        data += next_chunk
+    if sw != SW_OK:
+        raise RuntimeError(f"Unexpected status word 0x{sw:04x} reading the latency histograms")
+
+    n_buckets = data[0]
+
+    def histogram(pos: int) -> List[int]:
+        return [int.from_bytes(data[pos + 2 * i:pos + 2 * i + 2], byteorder="big") for i in range(n_buckets)]
+
+    histograms = LatencyHistograms()
+    pos = 2
+    for _ in range(data[1]):
+        histograms.commands[(data[pos], data[pos + 1])] = histogram(pos + 2)
+        pos += 2 + 2 * n_buckets
+
+    n_codes = data[pos]
+    pos += 1
+    for _ in range(n_codes):
+        histograms.service[data[pos]] = histogram(pos + 1)
+        histograms.wait[data[pos]] = histogram(pos + 1 + 2 * n_buckets)
+        pos += 1 + 4 * n_buckets
+
+    return histograms
+
+
+@dataclass
+class CacheStats:
+    """Counters of a cache, as returned by INS_GET_PERF_STATS with P1 = PERF_STATS_P1_CACHES: the hits, misses and
+    evictions during the last command, and the bytes of the cache in use at its end, out of its budget."""
+
+    hits: int
+    misses: int
+    evictions: int
+    bytes_in_use: int
+    budget: int
+
+    @property
+    def hit_rate(self) -> float:
+        n_lookups = self.hits + self.misses
+        return self.hits / n_lookups if n_lookups > 0 else 0.0
+
+    def to_dict(self) -> dict:
+        return {**vars(self), "hit_rate": round(self.hit_rate, 3)}
+
+
+def get_cache_stats(client: Client) -> Dict[str, CacheStats]:
+    """Reads the counters of the caches for the last command; the app must be built with
+    AUTOAPPROVE_FOR_PERF_TESTS=1."""
+
+    data = client.transport_client.apdu_exchange(CLA_FRAMEWORK, INS_GET_PERF_STATS, p1=PERF_STATS_P1_CACHES)
+
+    def u32(pos: int) -> int:
+        return int.from_bytes(data[pos:pos + 4], byteorder="big")
+
+    return {
+        (CACHE_NAMES[i] if i < len(CACHE_NAMES) else str(i)):
+            CacheStats(*(u32(1 + 20 * i + 4 * j) for j in range(5)))
+        for i in range(data[0])
+    }
+
+
+@dataclass
+class CacheReport:
+    """Collects the counters of the caches of each scenario, and writes them at the end of the session to
+    `cache_report.json`; the hit rates are also printed in the summary of the session."""
+
+    scenarios: Dict[str, Dict[str, CacheStats]] = field(default_factory=dict)
+
+    def add(self, scenario: str, stats: Dict[str, CacheStats]) -> None:
+        self.scenarios[scenario] = stats
+
+    def format_hit_rates(self) -> List[str]:
+        """One line per scenario, with the hit rate of each cache that was looked up."""
+
+        lines = []
+        for scenario, stats in self.scenarios.items():
+            rates = [
+                f"{name} {100 * s.hit_rate:.0f}% ({s.hits}/{s.hits + s.misses}"
+                + (f", {s.evictions} evicted)" if s.evictions > 0 else ")")
+                for name, s in stats.items() if s.hits + s.misses > 0
+            ]
+            lines.append(f"{scenario}: " + (", ".join(rates) if len(rates) > 0 else "no lookups"))
+        return lines
+
+    def save(self, path: Path = CACHE_REPORT_PATH) -> None:
+        if len(self.scenarios) == 0:
+            return
+
+        path.write_text(json.dumps({
+            scenario: {name: s.to_dict() for name, s in stats.items()}
+            for scenario, stats in self.scenarios.items()
+        }, indent=2) + "\n")
@@ -0,0 +1,86 @@
+import json
+from contextlib import contextmanager
+from dataclasses import dataclass
+from pathlib import Path
+from typing import Dict, Iterator
+
+from ledger_bitcoin import Client
+from ledger_bitcoin.client_base import ApduException
+
+BASELINE_PATH = Path(__file__).parent / "round_trips_baseline.json"
+
+APDU_HEADER_LEN = 5  # CLA, INS, P1, P2, Lc
+SW_LEN = 2
+
+
+@dataclass
+class RoundTrips:
+    """Number of APDUs exchanged with the device, and bytes sent in each direction."""
+
+    apdus: int = 0
+    bytes_to_device: int = 0
+    bytes_from_device: int = 0
+
+    def to_dict(self) -> Dict[str, int]:
+        return vars(self).copy()
+
+
+@contextmanager
+def count_round_trips(client: Client) -> Iterator[RoundTrips]:
+    """Counts all the APDUs exchanged by `client` in the body of the context, including the CONTINUE
+    APDUs answering the client commands. Unlike timings, the counts are deterministic."""
+
+    counts = RoundTrips()
+    transport_client = client.transport_client
+    apdu_exchange = transport_client.apdu_exchange
+
+    def counting_apdu_exchange(cla: int, ins: int, data: bytes = b"", p1: int = 0, p2: int = 0) -> bytes:
+        counts.apdus += 1
+        counts.bytes_to_device += APDU_HEADER_LEN + len(data)
+        try:
+            response = apdu_exchange(cla, ins, data, p1, p2)
+        except ApduException as e:
+            # interruptions are returned with a status word other than 0x9000
+            counts.bytes_from_device += len(e.data) + SW_LEN
+            raise
+        counts.bytes_from_device += len(response) + SW_LEN
+        return response
+
+    transport_client.apdu_exchange = counting_apdu_exchange
+    try:
+        yield counts
+    finally:
+        transport_client.apdu_exchange = apdu_exchange
+
+
+class RoundTripBaseline:
+    """The committed round-trip counts of each benchmark. A benchmark fails if its counts are above the
+    baseline; benchmarks missing from the baseline only report their counts. With `update` set, the
+    measured counts are collected and written back to the baseline file at the end of the session."""
+
+    def __init__(self, path: Path, update: bool):
+        self.path = path
+        self.update = update
+        self.baseline: Dict[str, Dict[str, int]] = json.loads(path.read_text()) if path.is_file() else {}
+        self.measured: Dict[str, Dict[str, int]] = {}
+
+    def check(self, name: str, counts: RoundTrips) -> None:
+        self.measured[name] = counts.to_dict()
+
+        if self.update or name not in self.baseline:
+            return
+
+        expected = self.baseline[name]
+        regressions = [
+            f"{key}: {value} > {expected[key]}"
+            for key, value in counts.to_dict().items()
+            if key in expected and value > expected[key]
+        ]
+        assert not regressions, f"Round trips regressed for {name}: " + ", ".join(regressions)
+
+    def save(self) -> None:
+        if not self.update or len(self.measured) == 0:
+            return
+
+        self.baseline.update(self.measured)
+        self.path.write_text(json.dumps(self.baseline, indent=2, sort_keys=True) + "\n")
@@ -0,0 +1,239 @@
+import csv
+import json
+import math
+from dataclasses import dataclass, field
+from hashlib import sha256
+from pathlib import Path
+from typing import Dict, List, Optional
+
+from embit.bip32 import HDKey
+from embit.networks import NETWORKS
+
+from ledger_bitcoin import WalletPolicy
+
+from .round_trips import RoundTrips
+
+REPORT_PATH = Path(__file__).parent / "scaling_report"
+
+# sighash types of the inputs; SIGHASH_SINGLE is left out, as the matrix has more inputs than outputs
+SIGHASH_TYPES = {
+    "default": None,
+    "all": 0x01,
+    "none": 0x02,
+    "all_acp": 0x81,
+}
+
+# an exponent above this threshold between two consecutive cells of a series is reported as superlinear
+SUPERLINEAR_THRESHOLD = 1.25
+
+INTERNAL_KEYS = {
+    "pkh": "[f5acc2fd/44'/1'/0']tpubDCwYjpDhUdPGP5rS3wgNg13mTrrjBuG8V9VpWbyptX6TRPbNoZVXsoVUSkCjmQ8jJycjuDKBb9eataSymXakTTaGifxR6kmVsfFehH1ZgJT",
+    "wpkh": "[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P",
+    "tr": "[f5acc2fd/86'/1'/0']tpubDDKYE6BREvDsSWMazgHoyQWiJwYaDDYPbCFjYxN3HFXJP5fokeiK4hwK5tTLBNEDBwrDXn8cQ4v9b2xdW62Xr5yxoQdMu1v6c7UDXYVH27U",
+    "wsh": "[f5acc2fd/48'/1'/0'/2']tpubDFAqEGNyad35aBCKUAXbQGDjdVhNueno5ZZVEn3sQbW5ci457gLR7HyTmHBg93oourBssgUxuWz1jX5uhc1qaqFo9VsybY1J5FuedLfm4dK",
+}
+
+
+def external_key(index: int) -> str:
+    """A testnet xpub that does not belong to the device, deterministically generated from its index."""
+
+    seed = sha256(f"scaling external key {index}".encode()).digest()
+    return HDKey.from_seed(seed, version=NETWORKS["test"]["xprv"]).to_public().to_base58()
+
+
+def make_policy(family: str, size: int) -> WalletPolicy:
+    """Returns the wallet policy of the family with the given size, where only the key @0 is internal:
+    - "pkh", "wpkh", "tr": single-signature policies, the size is ignored;
+    - "sortedmulti": wsh(sortedmulti(k, ...)) with `size` keys, and k equal to half of them;
+    - "taptree": tr(@0/**, TREE) where TREE is a chain of `size` leaves pk(@i/**), that has depth `size`;
+    - "multi_a": tr(@0/<0;1>/*, multi_a(k, ...)) with `size` keys, the internal key being also the first key of the
+      multi_a with other derivations;
+    - "thresh": the miniscript wsh(thresh(k, pk(@0/**), s:pk(@1/**), ...)) with `size` keys.
+    """
+
+    if family in ["pkh", "wpkh", "tr"]:
+        return WalletPolicy("", f"{family}(@0/**)", [INTERNAL_KEYS[family]])
+
+    if family == "sortedmulti":
+        keys = ",".join(f"@{i}/**" for i in range(size))
+        return WalletPolicy(
+            "Cold storage",
+            f"wsh(sortedmulti({(size + 1) // 2},{keys}))",
+            [INTERNAL_KEYS["wsh"]] + [external_key(i) for i in range(1, size)],
+        )
+
+    if family == "taptree":
+        tree = f"pk(@{size}/**)"
+        for i in range(size - 1, 0, -1):
+            tree = f"{{pk(@{i}/**),{tree}}}"
+        return WalletPolicy(
+            "Cold storage",
+            f"tr(@0/**,{tree})",
+            [INTERNAL_KEYS["tr"]] + [external_key(i) for i in range(1, size + 1)],
+        )
+
+    if family == "multi_a":
+        keys = ",".join(["@0/<2;3>/*"] + [f"@{i}/**" for i in range(1, size)])
+        return WalletPolicy(
+            "Cold storage",
+            f"tr(@0/<0;1>/*,multi_a({(size + 1) // 2},{keys}))",
+            [INTERNAL_KEYS["tr"]] + [external_key(i) for i in range(1, size)],
+        )
+
+    if family == "thresh":
+        subs = ",".join(["pk(@0/**)"] + [f"s:pk(@{i}/**)" for i in range(1, size)])
+        return WalletPolicy(
+            "Cold storage",
+            f"wsh(thresh({(size + 1) // 2},{subs}))",
+            [INTERNAL_KEYS["wsh"]] + [external_key(i) for i in range(1, size)],
+        )
+
+    raise ValueError(f"Unknown policy family: {family}")
+
+
+@dataclass(frozen=True)
+class ScalingCell:
+    """A cell of the matrix: a policy of a family and size, signed with a number of inputs and outputs,
+    all the inputs having the same sighash type."""
+
+    family: str
+    size: int
+    n_inputs: int
+    n_outputs: int
+    sighash: str
+    slow: bool = False
+
+    @property
+    def name(self) -> str:
+        return f"{self.family}{self.size}_{self.n_inputs}in_{self.n_outputs}out_{self.sighash}"
+
+
+def generate_matrix() -> List[ScalingCell]:
+    """Returns the cells of the scaling matrix.
+
+    The full cartesian product would take days on a device, therefore each series varies a single parameter
+    from a small base cell: the number of inputs, the number of outputs, the size of the policy, and the sighash
+    type. The cells that take more than a few minutes on speculos are marked as slow.
+    """
+
+    cells: List[ScalingCell] = []
+
+    def add(cell: ScalingCell) -> None:
+        if cell not in cells:
+            cells.append(cell)
+
+    families = [("pkh", 1), ("wpkh", 1), ("tr", 1), ("sortedmulti", 3), ("taptree", 3)]
+
+    for family, size in families:
+        default_sighash = "default" if family in ["tr", "taptree"] else "all"
+
+        for n_inputs in [1, 3, 10, 30, 100, 250, 500]:
+            add(ScalingCell(family, size, n_inputs, 2, default_sighash, slow=n_inputs > 30))
+
+        for n_outputs in [2, 10, 30, 100, 250]:
+            add(ScalingCell(family, size, 1, n_outputs, default_sighash, slow=n_outputs > 30))
+
+        for sighash in SIGHASH_TYPES:
+            if sighash == "default" and family not in ["tr", "taptree"]:
+                continue  # SIGHASH_DEFAULT only exists for taproot
+            for n_inputs in [10, 100]:
+                add(ScalingCell(family, size, n_inputs, 2, sighash, slow=n_inputs > 30))
+
+    # n-of-n up to the maximum number of keys of a wallet policy
+    for size in [2, 3, 5, 7, 10]:
+        add(ScalingCell("sortedmulti", size, 10, 2, "all"))
+
+    for size in range(1, 10):
+        add(ScalingCell("taptree", size, 10, 2, "default"))
+
+    return cells
+
+
+@dataclass
+class ScalingMeasurement:
+    cell: ScalingCell
+    seconds: float
+    round_trips: RoundTrips
+    device_ticks: Optional[int] = None  # the total of the phases counted by the app, if available
+
+    def to_dict(self) -> dict:
+        return {
+            "name": self.cell.name,
+            "family": self.cell.family,
+            "size": self.cell.size,
+            "n_inputs": self.cell.n_inputs,
+            "n_outputs": self.cell.n_outputs,
+            "sighash": self.cell.sighash,
+            "seconds": round(self.seconds, 3),
+            **self.round_trips.to_dict(),
+            "device_ticks": self.device_ticks,
+        }
+
+
+# the parameters that a series can vary, and the fields of the measurements whose growth is reported
+SERIES_PARAMETERS = ["n_inputs", "n_outputs", "size"]
+GROWTH_METRICS = ["seconds", "device_ticks", "apdus", "bytes_to_device", "bytes_from_device"]
+
+
+@dataclass
+class ScalingReport:
+    """Collects the measurements of the cells of the matrix, and writes them at the end of the session as
+    `scaling_report.csv` (one row per cell) and `scaling_report.json` (the cells and the series)."""
+
+    measurements: List[ScalingMeasurement] = field(default_factory=list)
+
+    def add(self, measurement: ScalingMeasurement) -> None:
+        self.measurements.append(measurement)
+
+    def series(self) -> List[dict]:
+        """Groups the measured cells that only differ by one parameter, and computes the growth exponent of
+        each metric between consecutive cells: log(m2 / m1) / log(x2 / x1), that is 1 for a linear growth
+        and 2 for a quadratic one. Exponents above SUPERLINEAR_THRESHOLD are listed as superlinear."""
+
+        rows = [m.to_dict() for m in self.measurements]
+        result = []
+        for parameter in SERIES_PARAMETERS:
+            groups: Dict[tuple, List[dict]] = {}
+            for row in rows:
+                key = tuple((k, row[k]) for k in ["family", "sighash"] + SERIES_PARAMETERS if k != parameter)
+                groups.setdefault(key, []).append(row)
+
+            for key, group in groups.items():
+                if len(group) < 2:
+                    continue
+                group.sort(key=lambda row: row[parameter])
+
+                steps = []
+                for prev, cur in zip(group, group[1:]):
+                    step = {"from": prev[parameter], "to": cur[parameter]}
+                    for metric in GROWTH_METRICS:
+                        if prev[metric] and cur[metric] and cur[parameter] > prev[parameter]:
+                            step[metric] = round(
+                                math.log(cur[metric] / prev[metric]) / math.log(cur[parameter] / prev[parameter]), 2)
+                    steps.append(step)
+
+                result.append({
+                    "parameter": parameter,
+                    "fixed": dict(key),
+                    "values": [row[parameter] for row in group],
+                    "steps": steps,
+                    "superlinear": [
+                        f"{metric} {step['from']}->{step['to']}: {step[metric]}"
+                        for step in steps
+                        for metric in GROWTH_METRICS
+                        if step.get(metric, 0) > SUPERLINEAR_THRESHOLD
+                    ],
+                })
+        return result
+
+    def save(self, path: Path = REPORT_PATH) -> None:
+        if len(self.measurements) == 0:
+            return
+
+        rows = [m.to_dict() for m in self.measurements]
+        with open(path.with_suffix(".csv"), "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=list(rows[0].keys()))
+            writer.writeheader()
+            writer.writerows(rows)
+
+        path.with_suffix(".json").write_text(json.dumps({"cells": rows, "series": self.series()}, indent=2) + "\n")
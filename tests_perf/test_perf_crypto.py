@@ -0,0 +1,60 @@
+import time
+from typing import Tuple
+
+import pytest
+
+from ledger_bitcoin import Client
+
+CLA_APP = 0xE1
+INS_BENCHMARK_CRYPTO = 0xF0
+
+# primitive code and number of iterations, sized so that each command takes a few seconds on a Nano X;
+# the codes are the values of benchmark_primitive_e in src/handler/benchmark_crypto.h
+PRIMITIVES = {
+    "sha256": (0, 1000),
+    "ripemd160": (1, 1000),
+    "hash160": (2, 1000),
+    "hmac_sha512": (3, 500),
+    "keccak256": (4, 1000),
+    "scalar_mult": (5, 20),
+    "decompress_pubkey": (6, 100),
+    "ckdpub": (7, 20),
+    "ckdpub_uncompressed": (8, 20),
+    "derive_private_key": (9, 10),
+    "ecdsa_sign": (10, 20),
+    "schnorr_sign": (11, 20),
+    "tr_tweak_pubkey": (12, 20),
+}
+
+
+def run_benchmark_crypto(client: Client, primitive: int, n_iterations: int) -> Tuple[float, int]:
+    """Returns the time taken by the command on the client, and the ticks measured by the device."""
+
+    data = primitive.to_bytes(1, byteorder="big") + n_iterations.to_bytes(4, byteorder="big")
+
+    start = time.perf_counter()
+    response = client.transport_client.apdu_exchange(CLA_APP, INS_BENCHMARK_CRYPTO, data, 0, 0)
+    elapsed = time.perf_counter() - start
+
+    assert response[0] == primitive
+    assert int.from_bytes(response[1:5], byteorder="big") == n_iterations
+    return elapsed, int.from_bytes(response[5:7], byteorder="big")
+
+
+@pytest.mark.parametrize("name", PRIMITIVES.keys())
+def test_perf_crypto(client: Client, name: str, benchmark):
+    primitive, n_iterations = PRIMITIVES[name]
+
+    # the time of the command without iterations is the overhead of the transport and of the setup
+    overhead, _ = run_benchmark_crypto(client, primitive, 0)
+
+    result = {}
+
+    def run():
+        result["elapsed"], result["ticks"] = run_benchmark_crypto(client, primitive, n_iterations)
+
+    benchmark.pedantic(run, rounds=1)
+
+    benchmark.extra_info["n_iterations"] = n_iterations
+    benchmark.extra_info["ticks"] = result["ticks"]
+    benchmark.extra_info["us_per_op"] = max(0.0, result["elapsed"] - overhead) * 1e6 / n_iterations
@@ -0,0 +1,91 @@
+import copy
+
+import pytest
+
+from ledger_bitcoin import Client
+
+from .round_trips import RoundTripBaseline, count_round_trips
+from .test_round_trips import ERC4361_MESSAGE, WITHDRAWAL_DATA
+
+# Latency of the commands that are not SIGN_PSBT: each benchmark also records the round trips of the command in
+# its extra_info, and checks them against the baseline in round_trips_baseline.json like test_round_trips.py.
+
+BIP32_PATH = "m/44'/1'/0'/0/0"
+
+# an ERC-4361 message where every field displayed by the device has its maximum length, with a statement and
+# resources that are only hashed
+ERC4361_MESSAGE_MAX = "\n".join([
+    ("stake." + "a" * 49 + ".acre.fi")[:63] + " wants you to sign in with your Bitcoin account:",
+    "2N1LKgFZMgJWuHuzmRWX6uYMKyAQn6KHKw7",
+    "",
+    "I accept the Terms of Service of Acre: " + "https://stake.test.acre.fi/terms " * 8,
+    "",
+    "URI: " + ("https://stake.test.acre.fi/" + "a" * 63)[:63],
+    "Version: 1",
+    "Chain ID: 1",
+    "Nonce: " + "WrHviCXAslNNeNtcD" * 2 + "W" * 31,
+    "Issued At: 2024-10-01T11:00:23.816123456789+00:00",
+    "Expiration Time: 2024-10-08T11:00:23.816123456789+00:00",
+    "Request ID: " + "0" * 64,
+    "Resources:",
+    *[f"- https://stake.test.acre.fi/resources/{i:04d}" for i in range(16)],
+])
+
+WITHDRAWAL_CHUNK_SIZE = 64
+
+
+@pytest.mark.parametrize("message_len", [64, 256, 1024, 4096, 16384, 65536])
+def test_perf_sign_message(client: Client, message_len: int, round_trip_baseline: RoundTripBaseline, benchmark):
+    message = b"a" * message_len
+    counts = None
+
+    def sign():
+        nonlocal counts
+        with count_round_trips(client) as counts:
+            client.sign_message(message, BIP32_PATH)
+
+    benchmark.pedantic(sign, rounds=1)
+
+    benchmark.extra_info["round_trips"] = counts.to_dict()
+    round_trip_baseline.check(f"perf_sign_message_{message_len}", counts)
+
+
+@pytest.mark.parametrize("message_name,message", [("typical", ERC4361_MESSAGE), ("max", ERC4361_MESSAGE_MAX)])
+def test_perf_sign_erc4361_message(client: Client, message_name: str, message: str,
+                                   round_trip_baseline: RoundTripBaseline, benchmark):
+    counts = None
+
+    def sign():
+        nonlocal counts
+        with count_round_trips(client) as counts:
+            client.sign_erc4361_message(message, BIP32_PATH)
+
+    benchmark.pedantic(sign, rounds=1)
+
+    benchmark.extra_info["message_len"] = len(message)
+    benchmark.extra_info["round_trips"] = counts.to_dict()
+    round_trip_baseline.check(f"perf_sign_erc4361_message_{message_name}", counts)
+
+
+@pytest.mark.parametrize("extra_chunks", [0, 4, 16, 64])
+@pytest.mark.parametrize("n_withdrawals", [1, 4])
+def test_perf_sign_withdraw(client: Client, extra_chunks: int, n_withdrawals: int,
+                            round_trip_baseline: RoundTripBaseline, benchmark):
+    # zero bytes appended to the calldata only add chunks to the data that is hashed by the device
+    data = copy.copy(WITHDRAWAL_DATA)
+    data.data += "00" * WITHDRAWAL_CHUNK_SIZE * extra_chunks
+    counts = None
+
+    def sign():
+        nonlocal counts
+        with count_round_trips(client) as counts:
+            # the redeemer output script of WITHDRAWAL_DATA is for the key at this path
+            result = client.sign_withdrawals([data] * n_withdrawals, "m/44'/0'/0'/0/0")
+
+        assert len(result) == n_withdrawals
+
+    benchmark.pedantic(sign, rounds=1)
+
+    benchmark.extra_info["n_chunks"] = len(data.to_bytes().to_chunks())
+    benchmark.extra_info["round_trips"] = counts.to_dict()
+    round_trip_baseline.check(f"perf_sign_withdraw_{n_withdrawals}_{extra_chunks}", counts)
@@ -0,0 +1,120 @@
+from typing import List
+
+import pytest
+
+from ledger_bitcoin import WalletPolicy, Client
+from ledger_bitcoin.client_command import ClientCommandCode
+from ledger_bitcoin.psbt import PSBT
+from ledger_bitcoin.tx import COutPoint, CScriptWitness, CTransaction, CTxIn, CTxInWitness, CTxOut, CTxWitness, \
+    uint256_from_str
+
+from test_utils import SpeculosGlobals, txmaker
+
+from .perf_stats import get_perf_stats
+from .round_trips import count_round_trips
+
+# Measures the cost of streaming the PSBT_IN_NON_WITNESS_UTXO of legacy and segwit v0 inputs, that the device
+# parses in full in order to verify the txid of the prevout: the parent transactions are padded to a target size
+# either with outputs or with a witness, and several inputs of the PSBT can spend outputs of the same parent.
+
+POLICIES = {
+    "pkh": WalletPolicy(
+        "",
+        "pkh(@0/**)",
+        ["[f5acc2fd/44'/1'/0']tpubDCwYjpDhUdPGP5rS3wgNg13mTrrjBuG8V9VpWbyptX6TRPbNoZVXsoVUSkCjmQ8jJycjuDKBb9eataSymXakTTaGifxR6kmVsfFehH1ZgJT"],
+    ),
+    "wpkh": WalletPolicy(
+        "",
+        "wpkh(@0/**)",
+        ["[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"],
+    ),
+}
+
+PADDING_OUTPUT_LEN = 8 + 1 + 34  # amount, script length, P2TR script
+
+
+def make_parent(outputs: List[CTxOut], target_size: int, padding: str) -> CTransaction:
+    """Returns a transaction with the given outputs first, padded to about `target_size` bytes (including the
+    witness) with additional P2TR outputs if `padding` is "outputs", or with a single witness element if it is
+    "witness"."""
+
+    tx = CTransaction()
+    tx.nVersion = 2
+    tx.nLockTime = 0
+    tx.vin = [CTxIn(COutPoint(uint256_from_str(txmaker.random_txid()), 0), b"", 0)]
+    tx.vout = list(outputs)
+    tx.wit = CTxWitness()
+
+    missing = target_size - len(tx.serialize_with_witness())
+    if padding == "outputs":
+        # the random scripts are not valid points, it does not matter for a prevout
+        tx.vout += [CTxOut(1000, b"\x51\x20" + txmaker.random_bytes(32))
+                    for _ in range(max(0, missing) // PADDING_OUTPUT_LEN)]
+    elif padding == "witness":
+        # marker, flag, number of elements and the length of the element take up to 6 bytes
+        in_wit = CTxInWitness()
+        in_wit.scriptWitness = CScriptWitness()
+        in_wit.scriptWitness.stack = [txmaker.random_bytes(max(1, missing - 6))]
+        tx.wit.vtxinwit = [in_wit]
+    else:
+        raise ValueError(f"Unknown padding: {padding}")
+
+    tx.rehash()
+    return tx
+
+
+def make_psbt(wallet_policy: WalletPolicy, n_inputs: int, n_inputs_per_parent: int, parent_size: int,
+              padding: str) -> PSBT:
+    """Returns a PSBT with `n_inputs` inputs, where each group of `n_inputs_per_parent` consecutive inputs spends
+    the outputs of the same parent transaction of about `parent_size` bytes."""
+
+    in_amounts = [100_000 + 10000 * i for i in range(n_inputs)]
+    psbt = txmaker.createPsbt(wallet_policy, in_amounts, [sum(in_amounts) // 2, sum(in_amounts) // 2 - 1000],
+                              [False, True])
+
+    for first in range(0, n_inputs, n_inputs_per_parent):
+        indices = range(first, min(first + n_inputs_per_parent, n_inputs))
+
+        # the outputs spent by the inputs are moved to the new parent, with their scripts and amounts
+        spent = [psbt.inputs[i].non_witness_utxo.vout[psbt.tx.vin[i].prevout.n] for i in indices]
+        parent = make_parent(spent, parent_size, padding)
+
+        for n, i in enumerate(indices):
+            psbt.tx.vin[i].prevout = COutPoint(parent.sha256, n)
+            psbt.inputs[i].non_witness_utxo = parent
+
+    return psbt
+
+
+@pytest.mark.parametrize("policy_name", ["pkh", "wpkh"])
+@pytest.mark.parametrize("padding", ["outputs", "witness"])
+@pytest.mark.parametrize("parent_size", [200, 1000, 10_000, 50_000, 100_000])
+@pytest.mark.parametrize("n_inputs,n_inputs_per_parent", [(1, 1), (3, 1), (3, 3)])
+def test_perf_sign_psbt_non_witness_utxo(client: Client, policy_name: str, padding: str, parent_size: int,
+                                         n_inputs: int, n_inputs_per_parent: int, speculos_globals: SpeculosGlobals,
+                                         enable_slow_tests: bool, benchmark):
+    if parent_size > 10_000 and not enable_slow_tests:
+        pytest.skip("requires --enableslowtests")
+
+    wallet_policy = POLICIES[policy_name]
+    psbt = make_psbt(wallet_policy, n_inputs, n_inputs_per_parent, parent_size, padding)
+
+    counts = None
+
+    def sign_tx():
+        nonlocal counts
+        with count_round_trips(client) as counts:
+            result = client.sign_psbt(psbt, wallet_policy, None)
+
+        assert len(result) == n_inputs
+
+    benchmark.pedantic(sign_tx, rounds=1)
+
+    perf_stats = get_perf_stats(client)
+    get_more_elements = perf_stats.ccmds.get(ClientCommandCode.GET_MORE_ELEMENTS)
+
+    benchmark.extra_info["parent_sizes"] = sorted(
+        {len(psbt_in.non_witness_utxo.serialize_with_witness()) for psbt_in in psbt.inputs})
+    benchmark.extra_info["round_trips"] = counts.to_dict()
+    benchmark.extra_info["get_more_elements"] = vars(get_more_elements) if get_more_elements is not None else None
+    benchmark.extra_info["perf_stats"] = perf_stats.to_dict()
@@ -2,6 +2,7 @@
 from pathlib import Path
 from hashlib import sha256
 import hmac
+import time
 
 import pytest
 
@@ -10,6 +11,11 @@ from ledger_bitcoin.psbt import PSBT
 
 from test_utils import SpeculosGlobals, txmaker
 
+from .perf_stats import CacheReport, get_cache_stats, get_crypto_stats, get_latency_histograms, get_perf_stats, \
+    get_trace
+from .round_trips import count_round_trips
+from .scaling import SIGHASH_TYPES, ScalingCell, ScalingMeasurement, ScalingReport, generate_matrix, make_policy
+
 tests_root: Path = Path(__file__).parent
 
 
@@ -35,15 +41,13 @@ def make_psbt(wallet_policy: WalletPolicy, n_inputs: int, n_outputs: int) -> PSB
     return psbt
 
 
-def run_test(client: Client, wallet_policy: WalletPolicy, n_inputs: int, speculos_globals: SpeculosGlobals, benchmark):
-
-    wallet_hmac = None
-    if wallet_policy.name != "":
-        wallet_hmac = hmac.new(
-            speculos_globals.wallet_registration_key, wallet_policy.id, sha256).digest()
+def get_wallet_hmac(wallet_policy: WalletPolicy, speculos_globals: SpeculosGlobals):
+    if wallet_policy.name == "":
+        return None
+    return hmac.new(speculos_globals.wallet_registration_key, wallet_policy.id, sha256).digest()
 
-    psbt = make_psbt(wallet_policy, n_inputs, 2)
 
+def count_internal_placeholders(wallet_policy: WalletPolicy, speculos_globals: SpeculosGlobals) -> int:
     # the following code might count repetitions incorrectly for more than 10 keys
     assert len(wallet_policy.keys_info) <= 10
 
@@ -55,17 +59,42 @@ def run_test(client: Client, wallet_policy: WalletPolicy, n_inputs: int, speculo
                 f"@{key_index}")
 
     assert n_internal_placeholders >= 1
+    return n_internal_placeholders
+
+
+def run_test(client: Client, wallet_policy: WalletPolicy, n_inputs: int, speculos_globals: SpeculosGlobals,
+             cache_report: CacheReport, benchmark):
+
+    wallet_hmac = get_wallet_hmac(wallet_policy, speculos_globals)
+
+    psbt = make_psbt(wallet_policy, n_inputs, 2)
+
+    n_internal_placeholders = count_internal_placeholders(wallet_policy, speculos_globals)
 
     def sign_tx():
         result = client.sign_psbt(psbt, wallet_policy, wallet_hmac)
 
         assert len(result) == n_inputs * n_internal_placeholders
 
+    # the histograms are kept since the app was started
+    latency_before = get_latency_histograms(client)
     benchmark.pedantic(sign_tx, rounds=1)
+    latency = get_latency_histograms(client) - latency_before
+
+    # the counters of the device tell apart the time spent in the protocol from the computations
+    benchmark.extra_info["perf_stats"] = get_perf_stats(client).to_dict()
+    benchmark.extra_info["crypto_ops"] = get_crypto_stats(client)
+    benchmark.extra_info["trace"] = [vars(event) for event in get_trace(client).events]
+    benchmark.extra_info["latency"] = latency.to_dict()
+
+    cache_stats = get_cache_stats(client)
+    benchmark.extra_info["caches"] = {name: stats.to_dict() for name, stats in cache_stats.items()}
+    cache_report.add(benchmark.name, cache_stats)
 
 
 @pytest.mark.parametrize("n_inputs", [1, 3, 10])
-def test_perf_sign_psbt_singlesig_pkh(client: Client, n_inputs: int, speculos_globals: SpeculosGlobals, benchmark):
+def test_perf_sign_psbt_singlesig_pkh(client: Client, n_inputs: int, speculos_globals: SpeculosGlobals,
+                                      cache_report: CacheReport, benchmark):
     # PSBT for a legacy 2-output spend (1 change address)
 
     wallet_policy = WalletPolicy(
@@ -76,11 +105,12 @@ def test_perf_sign_psbt_singlesig_pkh(client: Client, n_inputs: int, speculos_gl
         ],
     )
 
-    run_test(client, wallet_policy, n_inputs, speculos_globals, benchmark)
+    run_test(client, wallet_policy, n_inputs, speculos_globals, cache_report, benchmark)
 
 
 @pytest.mark.parametrize("n_inputs", [1, 3, 10])
-def test_perf_sign_psbt_singlesig_wpkh(client: Client, n_inputs: int, speculos_globals: SpeculosGlobals, benchmark):
+def test_perf_sign_psbt_singlesig_wpkh(client: Client, n_inputs: int, speculos_globals: SpeculosGlobals,
+                                       cache_report: CacheReport, benchmark):
     # PSBT for a segwit 2-output spend (1 change address)
 
     wallet_policy = WalletPolicy(
@@ -91,11 +121,12 @@ def test_perf_sign_psbt_singlesig_wpkh(client: Client, n_inputs: int, speculos_g
         ],
     )
 
-    run_test(client, wallet_policy, n_inputs, speculos_globals, benchmark)
+    run_test(client, wallet_policy, n_inputs, speculos_globals, cache_report, benchmark)
 
 
 @pytest.mark.parametrize("n_inputs", [1, 3, 10])
-def test_perf_sign_psbt_singlesig_tr(client: Client, n_inputs: int, speculos_globals: SpeculosGlobals, benchmark):
+def test_perf_sign_psbt_singlesig_tr(client: Client, n_inputs: int, speculos_globals: SpeculosGlobals,
+                                     cache_report: CacheReport, benchmark):
     # PSBT for a taproot 2-output spend (1 change address)
 
     wallet_policy = WalletPolicy(
@@ -106,11 +137,12 @@ def test_perf_sign_psbt_singlesig_tr(client: Client, n_inputs: int, speculos_glo
         ],
     )
 
-    run_test(client, wallet_policy, n_inputs, speculos_globals, benchmark)
+    run_test(client, wallet_policy, n_inputs, speculos_globals, cache_report, benchmark)
 
 
 @pytest.mark.parametrize("n_inputs", [1, 3, 10])
-def test_perf_sign_psbt_multisig2of3_wsh(client: Client, n_inputs: int, speculos_globals: SpeculosGlobals, benchmark):
+def test_perf_sign_psbt_multisig2of3_wsh(client: Client, n_inputs: int, speculos_globals: SpeculosGlobals,
+                                         cache_report: CacheReport, benchmark):
     wallet_policy = WalletPolicy(
         name="Cold storage",
         descriptor_template="wsh(sortedmulti(2,@0/**,@1/**,@2/**))",
@@ -121,11 +153,12 @@ def test_perf_sign_psbt_multisig2of3_wsh(client: Client, n_inputs: int, speculos
         ],
     )
 
-    run_test(client, wallet_policy, n_inputs, speculos_globals, benchmark)
+    run_test(client, wallet_policy, n_inputs, speculos_globals, cache_report, benchmark)
 
 
 @pytest.mark.parametrize("n_inputs", [1, 3, 10])
-def test_perf_sign_psbt_multisig3of5_wsh(client: Client, n_inputs: int, speculos_globals: SpeculosGlobals, benchmark):
+def test_perf_sign_psbt_multisig3of5_wsh(client: Client, n_inputs: int, speculos_globals: SpeculosGlobals,
+                                         cache_report: CacheReport, benchmark):
     wallet_policy = WalletPolicy(
         name="Cold storage",
         descriptor_template="wsh(sortedmulti(3,@0/**,@1/**,@2/**,@3/**,@4/**))",
@@ -138,11 +171,12 @@ def test_perf_sign_psbt_multisig3of5_wsh(client: Client, n_inputs: int, speculos
         ],
     )
 
-    run_test(client, wallet_policy, n_inputs, speculos_globals, benchmark)
+    run_test(client, wallet_policy, n_inputs, speculos_globals, cache_report, benchmark)
 
 
 @pytest.mark.parametrize("n_inputs", [1, 3, 10])
-def test_perf_sign_psbt_tapminiscript_2paths(client: Client, n_inputs: int, speculos_globals: SpeculosGlobals, benchmark):
+def test_perf_sign_psbt_tapminiscript_2paths(client: Client, n_inputs: int, speculos_globals: SpeculosGlobals,
+                                             cache_report: CacheReport, benchmark):
     # A taproot miniscript policy where the two placeholders (in different spending paths) are internal
     # The app signs for both spending paths.
     wallet_policy = WalletPolicy(
@@ -156,4 +190,64 @@ def test_perf_sign_psbt_tapminiscript_2paths(client: Client, n_inputs: int, spec
         ],
     )
 
-    run_test(client, wallet_policy, n_inputs, speculos_globals, benchmark)
+    run_test(client, wallet_policy, n_inputs, speculos_globals, cache_report, benchmark)
+
+
+# The scaling matrix: each cell signs a PSBT of a policy of a given size, with a given number of inputs and outputs
+# and a sighash type. The measurements are written to the scaling report (see README.md) at the end of the session.
+
+def make_scaling_psbt(wallet_policy: WalletPolicy, n_inputs: int, n_outputs: int) -> PSBT:
+    # large enough amounts for hundreds of outputs, with a fee of 1000 sats
+    in_amounts = [1_000_000 + 10000 * i for i in range(n_inputs)]
+    out_amount = (sum(in_amounts) - 1000) // n_outputs
+
+    return txmaker.createPsbt(
+        wallet_policy,
+        in_amounts,
+        [out_amount] * n_outputs,
+        [i == 1 for i in range(n_outputs)]
+    )
+
+
+@pytest.mark.parametrize("cell", generate_matrix(), ids=lambda cell: cell.name)
+def test_perf_sign_psbt_scaling(client: Client, cell: ScalingCell, speculos_globals: SpeculosGlobals,
+                                enable_slow_tests: bool, scaling_report: ScalingReport, cache_report: CacheReport,
+                                benchmark):
+    if cell.slow and not enable_slow_tests:
+        pytest.skip("requires --enableslowtests")
+
+    wallet_policy = make_policy(cell.family, cell.size)
+    wallet_hmac = get_wallet_hmac(wallet_policy, speculos_globals)
+
+    psbt = make_scaling_psbt(wallet_policy, cell.n_inputs, cell.n_outputs)
+    for psbt_in in psbt.inputs:
+        psbt_in.sighash = SIGHASH_TYPES[cell.sighash]
+
+    n_internal_placeholders = count_internal_placeholders(wallet_policy, speculos_globals)
+
+    measured = {}
+
+    def sign_tx():
+        with count_round_trips(client) as counts:
+            start = time.perf_counter()
+            result = client.sign_psbt(psbt, wallet_policy, wallet_hmac)
+            measured["seconds"] = time.perf_counter() - start
+
+        assert len(result) == cell.n_inputs * n_internal_placeholders
+        measured["round_trips"] = counts
+
+    benchmark.pedantic(sign_tx, rounds=1)
+
+    perf_stats = get_perf_stats(client)
+    device_ticks = sum(phase.ticks for phase in perf_stats.phases) if len(perf_stats.phases) > 0 else None
+
+    scaling_report.add(ScalingMeasurement(cell, measured["seconds"], measured["round_trips"], device_ticks))
+
+    benchmark.extra_info["cell"] = cell.name
+    benchmark.extra_info["round_trips"] = measured["round_trips"].to_dict()
+    benchmark.extra_info["perf_stats"] = perf_stats.to_dict()
+    benchmark.extra_info["crypto_ops"] = get_crypto_stats(client)
+
+    cache_stats = get_cache_stats(client)
+    benchmark.extra_info["caches"] = {name: stats.to_dict() for name, stats in cache_stats.items()}
+    cache_report.add(cell.name, cache_stats)
@@ -0,0 +1,77 @@
+from typing import List, Tuple
+
+import pytest
+
+from ledger_bitcoin import Client
+
+from .perf_stats import CacheReport, get_cache_stats, get_crypto_stats, get_perf_stats
+from .round_trips import RoundTripBaseline, count_round_trips
+from .scaling import make_policy
+
+# Registration and address derivation for wallet policies of growing size: registration fetches and compares all
+# the keys of the policy, and the address derives and sorts or combines all of them. Each benchmark records the
+# round trips, the counters of the device and the cryptographic operations in its extra_info, and checks the round
+# trips against the baseline in round_trips_baseline.json like test_round_trips.py.
+
+MAX_N_KEYS_IN_WALLET_POLICY = 10
+MAX_TAPTREE_POLICY_DEPTH = 9
+
+
+def policy_shapes() -> List[Tuple[str, int]]:
+    """Returns the family and size of each measured policy: the multisig and miniscript families for every number
+    of keys allowed in a wallet policy, and the taproot trees for every depth."""
+
+    shapes = [(family, n_keys)
+              for family in ["sortedmulti", "multi_a", "thresh"]
+              for n_keys in range(1, MAX_N_KEYS_IN_WALLET_POLICY + 1)]
+    shapes += [("taptree", depth) for depth in range(1, MAX_TAPTREE_POLICY_DEPTH + 1)]
+    return shapes
+
+
+def record_stats(client: Client, benchmark, counts, cache_report: CacheReport) -> None:
+    benchmark.extra_info["round_trips"] = counts.to_dict()
+    benchmark.extra_info["perf_stats"] = get_perf_stats(client).to_dict()
+    benchmark.extra_info["crypto_ops"] = get_crypto_stats(client)
+
+    cache_stats = get_cache_stats(client)
+    benchmark.extra_info["caches"] = {name: stats.to_dict() for name, stats in cache_stats.items()}
+    cache_report.add(benchmark.name, cache_stats)
+
+
+@pytest.mark.parametrize("family,size", policy_shapes())
+def test_perf_register_wallet(client: Client, family: str, size: int, round_trip_baseline: RoundTripBaseline,
+                              cache_report: CacheReport, benchmark):
+    wallet_policy = make_policy(family, size)
+    counts = None
+
+    def register():
+        nonlocal counts
+        with count_round_trips(client) as counts:
+            wallet_id, _ = client.register_wallet(wallet_policy)
+
+        assert wallet_id == wallet_policy.id
+
+    benchmark.pedantic(register, rounds=1)
+
+    benchmark.extra_info["n_keys"] = wallet_policy.n_keys
+    record_stats(client, benchmark, counts, cache_report)
+    round_trip_baseline.check(f"perf_register_wallet_{family}{size}", counts)
+
+
+@pytest.mark.parametrize("family,size", policy_shapes())
+def test_perf_get_wallet_address(client: Client, family: str, size: int, round_trip_baseline: RoundTripBaseline,
+                                 cache_report: CacheReport, benchmark):
+    wallet_policy = make_policy(family, size)
+    _, wallet_hmac = client.register_wallet(wallet_policy)
+    counts = None
+
+    def get_address():
+        nonlocal counts
+        with count_round_trips(client) as counts:
+            client.get_wallet_address(wallet_policy, wallet_hmac, 0, 0, False)
+
+    benchmark.pedantic(get_address, rounds=1)
+
+    benchmark.extra_info["n_keys"] = wallet_policy.n_keys
+    record_stats(client, benchmark, counts, cache_report)
+    round_trip_baseline.check(f"perf_get_wallet_address_{family}{size}", counts)
@@ -0,0 +1,93 @@
+import time
+from typing import Callable
+
+import pytest
+
+from ledger_bitcoin import Client, WalletPolicy
+from ledger_bitcoin.psbt import PSBT
+
+from test_utils import SpeculosGlobals
+
+from .round_trips import count_round_trips
+from .scaling import make_policy
+from .test_perf_non_witness_utxo import POLICIES as NON_WITNESS_UTXO_POLICIES, make_psbt as make_non_witness_utxo_psbt
+from .test_perf_sign_psbt import count_internal_placeholders, get_wallet_hmac, make_scaling_psbt
+from .worst_case import CORPUS, WorstCase, WorstCaseMeasurement, WorstCaseReport, adversarial_host
+
+# Runs the worst-case corpus defined in worst_case.py: each case prepares its inputs, and returns the command to
+# measure. The time of the slowest case of each command is written to the worst-case report (see README.md).
+
+LAST_UNHARDENED_INDEX = 2**31 - 1
+
+# the largest wallet policies allowed by the app
+POLICIES = {
+    "taptree9": make_policy("taptree", 9),
+    "sortedmulti10": make_policy("sortedmulti", 10),
+}
+
+
+def sign_psbt_command(client: Client, speculos_globals: SpeculosGlobals, wallet_policy: WalletPolicy,
+                      psbt: PSBT) -> Callable[[], None]:
+    wallet_hmac = get_wallet_hmac(wallet_policy, speculos_globals)
+    n_signatures = len(psbt.inputs) * count_internal_placeholders(wallet_policy, speculos_globals)
+
+    def command():
+        assert len(client.sign_psbt(psbt, wallet_policy, wallet_hmac)) == n_signatures
+
+    return command
+
+
+def make_command(case: WorstCase, client: Client, speculos_globals: SpeculosGlobals) -> Callable[[], None]:
+    name = case.name.replace("_adversarial", "")
+    pkh = NON_WITNESS_UTXO_POLICIES["pkh"]
+
+    if name == "get_extended_pubkey_max_path":
+        return lambda: client.get_extended_pubkey("m/44'/1'/0'/1'/2'/3'/4/5", True)
+    if name.startswith("register_wallet_"):
+        wallet_policy = POLICIES[name[len("register_wallet_"):]]
+        return lambda: client.register_wallet(wallet_policy)
+    if name.startswith("get_wallet_address_"):
+        wallet_policy = POLICIES[name[len("get_wallet_address_"):]]
+        wallet_hmac = get_wallet_hmac(wallet_policy, speculos_globals)
+        return lambda: client.get_wallet_address(wallet_policy, wallet_hmac, 1, LAST_UNHARDENED_INDEX, False)
+    if name == "sign_message_64k":
+        return lambda: client.sign_message(b"a" * 65536, "m/44'/1'/0'/0/0")
+    if name in ["sign_psbt_taptree9_10in", "sign_psbt_sortedmulti10_10in"]:
+        wallet_policy = POLICIES[name.split("_")[2]]
+        return sign_psbt_command(client, speculos_globals, wallet_policy, make_scaling_psbt(wallet_policy, 10, 2))
+    if name == "sign_psbt_wpkh_512in":
+        wallet_policy = make_policy("wpkh", 1)
+        return sign_psbt_command(client, speculos_globals, wallet_policy, make_scaling_psbt(wallet_policy, 512, 2))
+    if name in ["sign_psbt_pkh_parent_10k", "sign_psbt_pkh_parent_100k"]:
+        parent_size = 10_000 if name.endswith("10k") else 100_000
+        return sign_psbt_command(client, speculos_globals, pkh,
+                                 make_non_witness_utxo_psbt(pkh, 1, 1, parent_size, "outputs"))
+    if name == "sign_psbt_pkh_512in_shared_parent_100k":
+        return sign_psbt_command(client, speculos_globals, pkh,
+                                 make_non_witness_utxo_psbt(pkh, 512, 512, 100_000, "outputs"))
+
+    raise ValueError(f"Unknown case: {case.name}")
+
+
+@pytest.mark.parametrize("case", CORPUS, ids=lambda case: case.name)
+def test_perf_worst_case(client: Client, case: WorstCase, speculos_globals: SpeculosGlobals,
+                         enable_slow_tests: bool, worst_case_report: WorstCaseReport, benchmark):
+    if case.slow and not enable_slow_tests:
+        pytest.skip("requires --enableslowtests")
+
+    command = make_command(case, client, speculos_globals)
+    measured = {}
+
+    def run():
+        with adversarial_host(case.adversarial), count_round_trips(client) as counts:
+            start = time.perf_counter()
+            command()
+            measured["seconds"] = time.perf_counter() - start
+        measured["round_trips"] = counts
+
+    benchmark.pedantic(run, rounds=1)
+
+    worst_case_report.add(WorstCaseMeasurement(case, measured["seconds"], measured["round_trips"]))
+
+    benchmark.extra_info["command"] = case.command
+    benchmark.extra_info["round_trips"] = measured["round_trips"].to_dict()
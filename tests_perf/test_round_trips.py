@@ -0,0 +1,139 @@
+from hashlib import sha256
+import hmac
+
+import pytest
+
+from ledger_bitcoin import WalletPolicy, Client
+from ledger_bitcoin.withdraw import AcreWithdrawalData
+
+from test_utils import SpeculosGlobals
+
+from .round_trips import RoundTripBaseline, count_round_trips
+from .test_perf_sign_psbt import make_psbt
+
+# Counts the APDUs and bytes exchanged by each command, and compares them with the committed
+# baseline in round_trips_baseline.json. Run with --update-round-trip-baseline to update it after an
+# intended change of the protocol.
+
+POLICIES = {
+    "pkh": WalletPolicy(
+        "",
+        "pkh(@0/**)",
+        ["[f5acc2fd/44'/1'/0']tpubDCwYjpDhUdPGP5rS3wgNg13mTrrjBuG8V9VpWbyptX6TRPbNoZVXsoVUSkCjmQ8jJycjuDKBb9eataSymXakTTaGifxR6kmVsfFehH1ZgJT"],
+    ),
+    "wpkh": WalletPolicy(
+        "",
+        "wpkh(@0/**)",
+        ["[f5acc2fd/84'/1'/0']tpubDCtKfsNyRhULjZ9XMS4VKKtVcPdVDi8MKUbcSD9MJDyjRu1A2ND5MiipozyyspBT9bg8upEp7a8EAgFxNxXn1d7QkdbL52Ty5jiSLcxPt1P"],
+    ),
+    "tr": WalletPolicy(
+        "",
+        "tr(@0/**)",
+        ["[f5acc2fd/86'/1'/0']tpubDDKYE6BREvDsSWMazgHoyQWiJwYaDDYPbCFjYxN3HFXJP5fokeiK4hwK5tTLBNEDBwrDXn8cQ4v9b2xdW62Xr5yxoQdMu1v6c7UDXYVH27U"],
+    ),
+    "multisig": WalletPolicy(
+        "Cold storage",
+        "wsh(sortedmulti(2,@0/**,@1/**,@2/**))",
+        [
+            "[f5acc2fd/48'/1'/0'/2']tpubDFAqEGNyad35aBCKUAXbQGDjdVhNueno5ZZVEn3sQbW5ci457gLR7HyTmHBg93oourBssgUxuWz1jX5uhc1qaqFo9VsybY1J5FuedLfm4dK",
+            "tpubDE7NQymr4AFtewpAsWtnreyq9ghkzQBXpCZjWLFVRAvnbf7vya2eMTvT2fPapNqL8SuVvLQdbUbMfWLVDCZKnsEBqp6UK93QEzL8Ck23AwF",
+            "tpubDF4kujkh5dAhC1pFgBToZybXdvJFXXGX4BWdDxWqP7EUpG8gxkfMQeDjGPDnTr9e4NrkFmDM1ocav3Jz6x79CRZbxGr9dzFokJLuvDDnyRh",
+        ],
+    ),
+    "miniscript": WalletPolicy(
+        "Cold storage",
+        "wsh(or_d(multi(4,@0/<0;1>/*,@1/<0;1>/*,@2/<0;1>/*,@3/<0;1>/*),and_v(v:thresh(3,pkh(@0/<2;3>/*),a:pkh(@1/<2;3>/*),a:pkh(@2/<2;3>/*),a:pkh(@3/<2;3>/*)),older(65535))))",
+        [
+            "[f5acc2fd/48'/1'/0'/2']tpubDFAqEGNyad35aBCKUAXbQGDjdVhNueno5ZZVEn3sQbW5ci457gLR7HyTmHBg93oourBssgUxuWz1jX5uhc1qaqFo9VsybY1J5FuedLfm4dK",
+            "tpubDE7NQymr4AFtewpAsWtnreyq9ghkzQBXpCZjWLFVRAvnbf7vya2eMTvT2fPapNqL8SuVvLQdbUbMfWLVDCZKnsEBqp6UK93QEzL8Ck23AwF",
+            "tpubDF4kujkh5dAhC1pFgBToZybXdvJFXXGX4BWdDxWqP7EUpG8gxkfMQeDjGPDnTr9e4NrkFmDM1ocav3Jz6x79CRZbxGr9dzFokJLuvDDnyRh",
+            "tpubDD3ULTdBbyuMMMs8BCsJKgZgEnZjjbsbtV6ig3xtkQnaSc1gu9kNhmDDEW49HoLzDNA4y2TMqRzj4BugrrtcpXkjoHSoMVhJwfZLUFmv6yn",
+        ],
+    ),
+}
+
+WITHDRAWAL_DATA = AcreWithdrawalData(
+    to="0xc14972DC5a4443E4f5e89E3655BE48Ee95A795aB",
+    value="0x0",
+    data="0xcae9ca510000000000000000000000007e184179b1F95A9ca398E6a16127f06b81Cb37a3000000000000000000000000000000000000000000000000002386F26FC10000000000000000000000000000000000000000000000000000000000000000006000000000000000000000000000000000000000000000000000000000000001000000000000000000000000006083Bde64CCBF08470a1a0dAa9a0281B4951be7C4fa8f3322330a4be2d34fdd2a573eaa5f94c7fe5000000000000000000000000d2f85a52fee8ee905e504f75dcf34156b2503004de1079ddaeceaf643b38a034000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000005835b17e900000000000000000000000000000000000000000000000000000000000000c0000000000000000000000000000000000000000000000000000000000000001a1976a914c8e9edf5e915c0482b1b236fc917011a4b943e6e88ac000000000000",
+    operation="0",
+    safeTxGas="0x0",
+    baseGas="0x0",
+    gasPrice="0x0",
+    gasToken="0x0000000000000000000000000000000000000000",
+    refundReceiver="0x0000000000000000000000000000000000000000",
+    nonce="0x8",
+)
+
+ERC4361_MESSAGE = "stake.test.acre.fi wants you to sign in with your Bitcoin account:\n2N1LKgFZMgJWuHuzmRWX6uYMKyAQn6KHKw7\n\n\nURI: https://stake.test.acre.fi\nVersion: 1\nNonce: WrHviCXAslNNeNtcD\nIssued At: 2024-10-01T11:00:23.816Z\nExpiration Time: 2024-10-08T11:00:23.816Z"
+
+
+def get_wallet_hmac(wallet_policy: WalletPolicy, speculos_globals: SpeculosGlobals):
+    if wallet_policy.name == "":
+        return None
+    return hmac.new(speculos_globals.wallet_registration_key, wallet_policy.id, sha256).digest()
+
+
+@pytest.mark.parametrize("policy_name", list(POLICIES.keys()))
+@pytest.mark.parametrize("n_inputs", [1, 10, 200])
+def test_round_trips_sign_psbt(client: Client, policy_name: str, n_inputs: int, speculos_globals: SpeculosGlobals,
+                               round_trip_baseline: RoundTripBaseline, enable_slow_tests: bool):
+    if n_inputs > 10 and not enable_slow_tests:
+        pytest.skip("requires --enableslowtests")
+
+    wallet_policy = POLICIES[policy_name]
+    psbt = make_psbt(wallet_policy, n_inputs, 2)
+
+    with count_round_trips(client) as counts:
+        result = client.sign_psbt(psbt, wallet_policy, get_wallet_hmac(wallet_policy, speculos_globals))
+
+    assert len(result) >= n_inputs
+
+    round_trip_baseline.check(f"sign_psbt_{policy_name}_{n_inputs}", counts)
+
+
+@pytest.mark.parametrize("message_len", [32, 1024, 65536])
+def test_round_trips_sign_message(client: Client, message_len: int, round_trip_baseline: RoundTripBaseline):
+    message = b"a" * message_len
+
+    with count_round_trips(client) as counts:
+        client.sign_message(message, "m/44'/1'/0'/0/0")
+
+    round_trip_baseline.check(f"sign_message_{message_len}", counts)
+
+
+def test_round_trips_sign_erc4361_message(client: Client, round_trip_baseline: RoundTripBaseline):
+    with count_round_trips(client) as counts:
+        client.sign_erc4361_message(ERC4361_MESSAGE, "m/44'/1'/0'/0/0")
+
+    round_trip_baseline.check("sign_erc4361_message", counts)
+
+
+@pytest.mark.parametrize("n_withdrawals", [1, 4])
+def test_round_trips_sign_withdraw(client: Client, n_withdrawals: int, round_trip_baseline: RoundTripBaseline):
+    with count_round_trips(client) as counts:
+        # the redeemer output script of WITHDRAWAL_DATA is for the key at this path
+        result = client.sign_withdrawals([WITHDRAWAL_DATA] * n_withdrawals, "m/44'/0'/0'/0/0")
+
+    assert len(result) == n_withdrawals
+
+    round_trip_baseline.check(f"sign_withdraw_{n_withdrawals}", counts)
+
+
+@pytest.mark.parametrize("policy_name", ["multisig", "miniscript"])
+def test_round_trips_register_wallet(client: Client, policy_name: str, round_trip_baseline: RoundTripBaseline):
+    with count_round_trips(client) as counts:
+        client.register_wallet(POLICIES[policy_name])
+
+    round_trip_baseline.check(f"register_wallet_{policy_name}", counts)
+
+
+@pytest.mark.parametrize("policy_name", list(POLICIES.keys()))
+def test_round_trips_get_wallet_address(client: Client, policy_name: str, speculos_globals: SpeculosGlobals,
+                                        round_trip_baseline: RoundTripBaseline):
+    wallet_policy = POLICIES[policy_name]
+
+    with count_round_trips(client) as counts:
+        client.get_wallet_address(wallet_policy, get_wallet_hmac(wallet_policy, speculos_globals), 0, 10, False)
+
+    round_trip_baseline.check(f"get_wallet_address_{policy_name}", counts)
@@ -0,0 +1,158 @@
+import json
+from contextlib import contextmanager
+from dataclasses import dataclass, field
+from pathlib import Path
+from typing import Dict, Iterator, List
+
+import ledger_bitcoin.client
+import ledger_bitcoin.prepared_psbt
+from ledger_bitcoin.client_command import ByteRun, ClientCommandCode, ClientCommandInterpreter, \
+    GetMoreElementsCommand, GetPreimageCommand
+from ledger_bitcoin.common import write_varint
+
+from .round_trips import RoundTrips
+
+REPORT_PATH = Path(__file__).parent / "worst_case_report.json"
+
+
+@dataclass(frozen=True)
+class WorstCase:
+    """An input of the corpus: the largest or most expensive input that the device accepts for a command.
+    With `adversarial`, the host answers the client commands with the smallest responses allowed by the
+    protocol, as a malicious or buggy host could."""
+
+    name: str
+    command: str
+    description: str
+    adversarial: bool = False
+    slow: bool = False
+
+
+# The limits are the ones of the app: MAX_TAPTREE_POLICY_DEPTH is 9, MAX_N_KEYS_IN_WALLET_POLICY is 10 (smaller
+# than the 16 keys of a multisig in script), MAX_BIP32_PATH_STEPS is 8 and MAX_N_INPUTS_CAN_SIGN is 512.
+# MAX_MERKLE_TREE_DEPTH (32) is not reachable: the deepest trees are the 1024 chunks of a 64 kB message, with depth
+# 10, and the maps of the 512 inputs of a PSBT, with depth 9.
+CORPUS: List[WorstCase] = [
+    WorstCase("get_extended_pubkey_max_path", "GET_EXTENDED_PUBKEY",
+              "an unusual path with MAX_BIP32_PATH_STEPS steps"),
+    WorstCase("register_wallet_taptree9", "REGISTER_WALLET",
+              "tr(@0/**,TREE) where TREE has MAX_TAPTREE_POLICY_DEPTH leaves in a chain"),
+    WorstCase("register_wallet_sortedmulti10", "REGISTER_WALLET",
+              "wsh(sortedmulti(5,...)) with MAX_N_KEYS_IN_WALLET_POLICY keys"),
+    WorstCase("register_wallet_sortedmulti10_adversarial", "REGISTER_WALLET",
+              "wsh(sortedmulti(5,...)) with MAX_N_KEYS_IN_WALLET_POLICY keys", adversarial=True),
+    WorstCase("get_wallet_address_taptree9", "GET_WALLET_ADDRESS",
+              "the largest taproot tree, at the last unhardened index"),
+    WorstCase("get_wallet_address_sortedmulti10", "GET_WALLET_ADDRESS",
+              "the largest sortedmulti, at the last unhardened index"),
+    WorstCase("sign_message_64k", "SIGN_MESSAGE", "a 64 kB message, that is a Merkle tree of depth 10"),
+    WorstCase("sign_message_64k_adversarial", "SIGN_MESSAGE",
+              "a 64 kB message, with one chunk per GET_MORE_ELEMENTS", adversarial=True),
+    WorstCase("sign_psbt_taptree9_10in", "SIGN_PSBT", "10 inputs of the largest taproot tree"),
+    WorstCase("sign_psbt_sortedmulti10_10in", "SIGN_PSBT", "10 inputs of the largest sortedmulti"),
+    WorstCase("sign_psbt_pkh_parent_10k_adversarial", "SIGN_PSBT",
+              "an input with a 10 kB non-witness UTXO, streamed one byte per GET_MORE_ELEMENTS", adversarial=True),
+    WorstCase("sign_psbt_pkh_parent_100k_adversarial", "SIGN_PSBT",
+              "an input with a 100 kB non-witness UTXO, streamed one byte per GET_MORE_ELEMENTS",
+              adversarial=True, slow=True),
+    WorstCase("sign_psbt_wpkh_512in", "SIGN_PSBT", "MAX_N_INPUTS_CAN_SIGN inputs", slow=True),
+    WorstCase("sign_psbt_pkh_512in_shared_parent_100k", "SIGN_PSBT",
+              "MAX_N_INPUTS_CAN_SIGN inputs spending the outputs of the same 100 kB parent", slow=True),
+]
+
+
+class MinimalGetPreimageCommand(GetPreimageCommand):
+    """Returns the first byte of the preimage, and queues the rest for GET_MORE_ELEMENTS."""
+
+    def execute(self, request: bytes) -> bytes:
+        req_hash = request[2:]
+        if len(request) != 34 or request[1] != 0 or req_hash not in self.known_preimages:
+            return super().execute(request)
+
+        known_preimage = self.known_preimages[req_hash]
+        if len(known_preimage) > 1:
+            self.queue.append(ByteRun(known_preimage[1:]))
+        return write_varint(len(known_preimage)) + bytes([min(1, len(known_preimage))]) + known_preimage[:1]
+
+
+class MinimalGetMoreElementsCommand(GetMoreElementsCommand):
+    """Returns a single element, or a single byte of a preimage, per response."""
+
+    def execute(self, request: bytes) -> bytes:
+        if len(self.queue) > 0:
+            self.max_response_len = 2 + (1 if isinstance(self.queue[0], ByteRun) else len(self.queue[0]))
+        return super().execute(request)
+
+
+class AdversarialClientCommandInterpreter(ClientCommandInterpreter):
+    """A client command interpreter that answers correctly, but in as many round trips as possible."""
+
+    def __init__(self, max_response_len: int = 255):
+        super().__init__(max_response_len)
+
+        queue = self.commands[ClientCommandCode.GET_MORE_ELEMENTS].queue
+        for cmd in [MinimalGetPreimageCommand(self.known_preimages, queue), MinimalGetMoreElementsCommand(queue)]:
+            self.commands[cmd.code] = cmd
+            self.handlers[cmd.code] = cmd.execute
+
+
+@contextmanager
+def adversarial_host(enabled: bool = True) -> Iterator[None]:
+    """Makes all the clients use AdversarialClientCommandInterpreter in the body of the context."""
+
+    if not enabled:
+        yield
+        return
+
+    modules = [ledger_bitcoin.client, ledger_bitcoin.prepared_psbt]
+    for module in modules:
+        module.ClientCommandInterpreter = AdversarialClientCommandInterpreter
+    try:
+        yield
+    finally:
+        for module in modules:
+            module.ClientCommandInterpreter = ClientCommandInterpreter
+
+
+@dataclass
+class WorstCaseMeasurement:
+    case: WorstCase
+    seconds: float
+    round_trips: RoundTrips
+
+    def to_dict(self) -> dict:
+        return {
+            "name": self.case.name,
+            "command": self.case.command,
+            "description": self.case.description,
+            "adversarial": self.case.adversarial,
+            "seconds": round(self.seconds, 3),
+            **self.round_trips.to_dict(),
+        }
+
+
+@dataclass
+class WorstCaseReport:
+    """Collects the measurements of the corpus, and writes them at the end of the session to
+    `worst_case_report.json`, with the slowest case of each command."""
+
+    measurements: List[WorstCaseMeasurement] = field(default_factory=list)
+
+    def add(self, measurement: WorstCaseMeasurement) -> None:
+        self.measurements.append(measurement)
+
+    def worst_per_command(self) -> Dict[str, dict]:
+        worst: Dict[str, WorstCaseMeasurement] = {}
+        for m in self.measurements:
+            if m.case.command not in worst or m.seconds > worst[m.case.command].seconds:
+                worst[m.case.command] = m
+        return {command: m.to_dict() for command, m in sorted(worst.items())}
+
+    def save(self, path: Path = REPORT_PATH) -> None:
+        if len(self.measurements) == 0:
+            return
+
+        path.write_text(json.dumps({
+            "worst_per_command": self.worst_per_command(),
+            "cases": [m.to_dict() for m in self.measurements],
+        }, indent=2) + "\n")
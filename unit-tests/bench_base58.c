@@ -0,0 +1,52 @@
+// Microbenchmark of the base58 decoding and encoding of base58.c, on an xpub, that is the most
+// common use of base58 in the app. It is not a test: run it manually as ./bench_base58, before and
+// after a change to base58.c.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "common/base58.h"
+
+#include "bench.h"
+
+static const char G_xpub[] =
+    "tpubDCwYjpDhUdPGP5rS3wgNg13mTrrjBuG8V9VpWbyptX6TRPbNoZVXsoVUSkCjmQ8jJycjuDKBb9eataSymXakTT"
+    "aGifxR6kmVsfFehH1ZgJT";
+
+static uint8_t G_decoded[82];
+
+static uint64_t run_base58_decode(void) {
+    uint8_t out[100];
+    return (uint64_t) base58_decode(G_xpub, sizeof(G_xpub) - 1, out, sizeof(out)) + out[81];
+}
+
+static uint64_t run_base58_encode(void) {
+    char out[120];
+    return (uint64_t) base58_encode(G_decoded, sizeof(G_decoded), out, sizeof(out)) + out[0];
+}
+
+int main() {
+    const struct {
+        const char *name;
+        uint64_t (*fn)(void);
+    } functions[] = {
+        {"base58_decode (xpub)", run_base58_decode},
+        {"base58_encode (xpub)", run_base58_encode},
+    };
+
+    if (base58_decode(G_xpub, sizeof(G_xpub) - 1, G_decoded, sizeof(G_decoded)) !=
+        (int) sizeof(G_decoded)) {
+        printf("Invalid xpub\n");
+        return 1;
+    }
+
+    printf("%-24s %14s\n", "function", "ns/call");
+
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        double ns = bench(functions[i].fn, 1);
+        printf("%-24s %14.2f\n", functions[i].name, ns);
+    }
+    return 0;
+}
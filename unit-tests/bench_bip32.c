@@ -0,0 +1,84 @@
+// Microbenchmark of the serialization and formatting of BIP32 paths of bip32.c, on the paths of the
+// standard wallets. It is not a test: run it manually as ./bench_bip32, before and after a change
+// to bip32.c.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "common/bip32.h"
+#include "common/write.h"
+
+#include "bench.h"
+
+#define N_PATHS 256
+
+#define H BIP32_FIRST_HARDENED_CHILD
+
+typedef struct {
+    uint32_t steps[MAX_BIP32_PATH_STEPS];
+    size_t len;
+} path_t;
+
+static path_t G_paths[N_PATHS];
+static uint8_t G_serialized_paths[N_PATHS][4 * MAX_BIP32_PATH_STEPS];
+
+static uint64_t run_bip32_path_read(void) {
+    uint64_t checksum = 0;
+    uint32_t out[MAX_BIP32_PATH_STEPS];
+    for (int i = 0; i < N_PATHS; i++) {
+        bip32_path_read(G_serialized_paths[i], 4 * G_paths[i].len, out, G_paths[i].len);
+        checksum += out[G_paths[i].len - 1];
+    }
+    return checksum;
+}
+
+static uint64_t run_bip32_path_format(void) {
+    uint64_t checksum = 0;
+    char out[MAX_SERIALIZED_BIP32_PATH_LENGTH + 1];
+    for (int i = 0; i < N_PATHS; i++) {
+        bip32_path_format(G_paths[i].steps, G_paths[i].len, out, sizeof(out));
+        checksum += strlen(out);
+    }
+    return checksum;
+}
+
+int main() {
+    const struct {
+        const char *name;
+        uint64_t (*fn)(void);
+    } functions[] = {
+        {"bip32_path_read", run_bip32_path_read},
+        {"bip32_path_format", run_bip32_path_format},
+    };
+
+    // the keys of the accounts (3 or 4 steps) and their addresses (5 or 6 steps)
+    const uint32_t purposes[] = {44, 49, 84, 86, 48};
+    for (int i = 0; i < N_PATHS; i++) {
+        uint32_t purpose = purposes[i % 5];
+        path_t *path = &G_paths[i];
+        path->len = 0;
+        path->steps[path->len++] = purpose | H;
+        path->steps[path->len++] = (uint32_t) (i % 2) | H;
+        path->steps[path->len++] = (uint32_t) (i % 7) | H;
+        if (purpose == 48) {
+            path->steps[path->len++] = 2 | H;
+        }
+        if (i % 3 != 0) {
+            path->steps[path->len++] = (uint32_t) (i % 2);
+            path->steps[path->len++] = (uint32_t) (i * 397);
+        }
+        for (size_t j = 0; j < path->len; j++) {
+            write_u32_be(G_serialized_paths[i], 4 * j, path->steps[j]);
+        }
+    }
+
+    printf("%-24s %14s\n", "function", "ns/call");
+
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        double ns = bench(functions[i].fn, N_PATHS);
+        printf("%-24s %14.2f\n", functions[i].name, ns);
+    }
+    return 0;
+}
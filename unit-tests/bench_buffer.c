@@ -0,0 +1,109 @@
+// Microbenchmark of the readers of buffer_t, on data with the layout of the transaction inputs.
+// It is not a test: run it manually as ./bench_buffer, before and after a change to buffer.c or to
+// the readers in buffer.h and parser.h.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "common/buffer.h"
+#include "common/parser.h"
+#include "common/read.h"
+
+#include "bench.h"
+
+// minimum duration of the measurement of each reader
+#define MIN_BENCH_NS 200000000ULL
+
+// each record has a 32-byte hash, a 4-byte index, an 8-byte amount and a 4-byte sequence
+#define RECORD_LEN  48
+#define N_RECORDS   256
+#define STREAM_SIZE (RECORD_LEN * N_RECORDS)
+
+static uint8_t G_stream[STREAM_SIZE];
+
+static uint64_t read_with_buffer_read(void) {
+    buffer_t buf = buffer_create(G_stream, sizeof(G_stream));
+    uint64_t checksum = 0;
+    uint8_t hash[32];
+    uint32_t index, sequence;
+    uint64_t amount;
+    while (buffer_read_bytes(&buf, hash, 32) && buffer_read_u32(&buf, &index, LE) &&
+           buffer_read_u64(&buf, &amount, LE) && buffer_read_u32(&buf, &sequence, LE)) {
+        checksum += hash[0] + index + amount + sequence;
+    }
+    return checksum;
+}
+
+static uint64_t read_with_buffer_reserve_read(void) {
+    buffer_t buf = buffer_create(G_stream, sizeof(G_stream));
+    uint64_t checksum = 0;
+    const uint8_t *record;
+    while ((record = buffer_reserve_read(&buf, RECORD_LEN)) != NULL) {
+        checksum += record[0] + read_u32_le(record, 32) + read_u64_le(record, 36) +
+                    read_u32_le(record, 44);
+    }
+    return checksum;
+}
+
+static uint64_t read_with_dbuffer_read(void) {
+    buffer_t store = buffer_create(NULL, 0);
+    buffer_t stream = buffer_create(G_stream, sizeof(G_stream));
+    buffer_t *buffers[2] = {&store, &stream};
+    uint64_t checksum = 0;
+    uint8_t hash[32], amount[8];
+    uint32_t index, sequence;
+    while (dbuffer_read_bytes(buffers, hash, 32) && dbuffer_read_u32(buffers, &index, LE) &&
+           dbuffer_read_bytes(buffers, amount, 8) && dbuffer_read_u32(buffers, &sequence, LE)) {
+        checksum += hash[0] + index + read_u64_le(amount, 0) + sequence;
+    }
+    return checksum;
+}
+
+// same fields as read_with_dbuffer_read, one by one, as the steps of psbt_parse_rawtx read them
+static uint64_t read_with_dbuffer_reserve_read(void) {
+    buffer_t store = buffer_create(NULL, 0);
+    buffer_t stream = buffer_create(G_stream, sizeof(G_stream));
+    buffer_t *buffers[2] = {&store, &stream};
+    uint64_t checksum = 0;
+    const uint8_t *hash, *index, *amount, *sequence;
+    while ((hash = dbuffer_reserve_read(buffers, 32)) != NULL &&
+           (index = dbuffer_reserve_read(buffers, 4)) != NULL &&
+           (amount = dbuffer_reserve_read(buffers, 8)) != NULL &&
+           (sequence = dbuffer_reserve_read(buffers, 4)) != NULL) {
+        checksum += hash[0] + read_u32_le(index, 0) + read_u64_le(amount, 0) +
+                    read_u32_le(sequence, 0);
+    }
+    return checksum;
+}
+
+int main() {
+    const struct {
+        const char *name;
+        uint64_t (*fn)(void);
+    } readers[] = {
+        {"buffer_read_*", read_with_buffer_read},
+        {"buffer_reserve_read", read_with_buffer_reserve_read},
+        {"dbuffer_read_*", read_with_dbuffer_read},
+        {"dbuffer_reserve_read", read_with_dbuffer_reserve_read},
+    };
+
+    for (size_t i = 0; i < sizeof(G_stream); i++) {
+        G_stream[i] = (uint8_t) (i * 131 + 7);
+    }
+
+    printf("%-24s %14s\n", "reader", "ns/record");
+
+    int ret = 0;
+    uint64_t expected_checksum = read_with_buffer_read();
+    for (size_t i = 0; i < sizeof(readers) / sizeof(readers[0]); i++) {
+        if (readers[i].fn() != expected_checksum) {
+            printf("%-24s FAILED: wrong checksum\n", readers[i].name);
+            ret = 1;
+            continue;
+        }
+        printf("%-24s %14.2f\n", readers[i].name, bench(readers[i].fn, N_RECORDS));
+    }
+    return ret;
+}
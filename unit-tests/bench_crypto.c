@@ -0,0 +1,168 @@
+// Microbenchmark of the derivations and of the taproot functions of crypto.c, built on the host
+// against the software primitives of libs/cx_mocks.c. It is not a test: run it manually as
+// ./bench_crypto, before and after a change to crypto.c.
+//
+// The timings are the ones of OpenSSL on the host, not of the secure element: compare the rows to
+// each other (with and without the midstate of the tagged hashes, or the cache of private nodes),
+// rather than to the timings on the device.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "crypto.h"
+#include "common/bip32.h"
+
+#include "bench.h"
+
+#define N_KEYS 16
+
+#define H BIP32_FIRST_HARDENED_CHILD
+
+#define TPUB_VERSION 0x043587CF
+
+static const uint8_t BIP0341_tapbranch_tag[] = {'T', 'a', 'p', 'B', 'r', 'a', 'n', 'c', 'h'};
+
+static const uint32_t G_account_path[] = {86 ^ H, 1 ^ H, 0 ^ H};
+
+static serialized_extended_pubkey_t G_account;
+static uint8_t G_xonly_pubkeys[N_KEYS][32];
+static uint8_t G_hashes[N_KEYS + 1][32];
+
+// The keys of the addresses of the receive chain, from the extended pubkey of the account, as in
+// the derivation of the keys of a wallet policy: two steps per key
+static uint64_t run_bip32_CKDpub(void) {
+    uint64_t checksum = 0;
+    serialized_extended_pubkey_t change, address;
+    for (uint32_t i = 0; i < N_KEYS; i++) {
+        bip32_CKDpub(&G_account, 0, &change);
+        bip32_CKDpub(&change, i, &address);
+        checksum += address.compressed_pubkey[1];
+    }
+    return checksum;
+}
+
+static uint64_t run_crypto_tr_tweak_pubkey(void) {
+    uint64_t checksum = 0;
+    uint8_t y_parity, out[32];
+    for (int i = 0; i < N_KEYS; i++) {
+        crypto_tr_tweak_pubkey(G_xonly_pubkeys[i], G_hashes[i], 32, &y_parity, out);
+        checksum += out[0] + y_parity;
+    }
+    return checksum;
+}
+
+// The TapBranch hashes of a taptree, initialized from the midstate of the tag
+static uint64_t run_tapbranch_midstate(void) {
+    uint64_t checksum = 0;
+    uint8_t out[32];
+    for (int i = 0; i < N_KEYS; i++) {
+        crypto_tr_combine_taptree_hashes(G_hashes[i], G_hashes[i + 1], out);
+        checksum += out[0];
+    }
+    return checksum;
+}
+
+// The same hashes as run_tapbranch_midstate, hashing the tag each time
+static uint64_t run_tapbranch_no_midstate(void) {
+    uint64_t checksum = 0;
+    uint8_t out[32];
+    cx_sha256_t hash_context;
+    for (int i = 0; i < N_KEYS; i++) {
+        bool left_first = memcmp(G_hashes[i], G_hashes[i + 1], 32) < 0;
+        crypto_tr_tagged_hash_init(&hash_context,
+                                   BIP0341_tapbranch_tag,
+                                   sizeof(BIP0341_tapbranch_tag));
+        crypto_hash_update(&hash_context.header, G_hashes[left_first ? i : i + 1], 32);
+        crypto_hash_update(&hash_context.header, G_hashes[left_first ? i + 1 : i], 32);
+        crypto_hash_digest(&hash_context.header, out, 32);
+        checksum += out[0];
+    }
+    return checksum;
+}
+
+// The pubkeys of the addresses of the account, derived from the seed
+static uint64_t run_get_extended_pubkey(void) {
+    uint64_t checksum = 0;
+    uint32_t path[5] = {86 ^ H, 1 ^ H, 0 ^ H, 0, 0};
+    serialized_extended_pubkey_t pubkey;
+    for (uint32_t i = 0; i < N_KEYS; i++) {
+        path[4] = i;
+        get_extended_pubkey_at_path(path, 5, TPUB_VERSION, &pubkey);
+        checksum += pubkey.compressed_pubkey[1];
+    }
+    return checksum;
+}
+
+// The private keys of the addresses of the account, as to sign; with the cache, the private node
+// of the account is derived once
+static uint64_t derive_private_keys(bool reset_cache) {
+    uint64_t checksum = 0;
+    uint32_t path[5] = {86 ^ H, 1 ^ H, 0 ^ H, 0, 0};
+    cx_ecfp_private_key_t private_key;
+    for (uint32_t i = 0; i < N_KEYS; i++) {
+        if (reset_cache) {
+            crypto_session_cache_reset();
+        }
+        path[4] = i;
+        crypto_derive_private_key(path, 5, &private_key);
+        checksum += private_key.d[0];
+    }
+    explicit_bzero(&private_key, sizeof(private_key));
+    return checksum;
+}
+
+static uint64_t run_derive_private_key_cached(void) {
+    return derive_private_keys(false);
+}
+
+static uint64_t run_derive_private_key_uncached(void) {
+    return derive_private_keys(true);
+}
+
+int main() {
+    const struct {
+        const char *name;
+        uint64_t (*fn)(void);
+    } functions[] = {
+        {"bip32_CKDpub (2 steps)", run_bip32_CKDpub},
+        {"crypto_tr_tweak_pubkey", run_crypto_tr_tweak_pubkey},
+        {"TapBranch (midstate)", run_tapbranch_midstate},
+        {"TapBranch (no midstate)", run_tapbranch_no_midstate},
+        {"xpub at path", run_get_extended_pubkey},
+        {"private key (cached)", run_derive_private_key_cached},
+        {"private key (uncached)", run_derive_private_key_uncached},
+    };
+
+    if (get_extended_pubkey_at_path(G_account_path, 3, TPUB_VERSION, &G_account) < 0) {
+        printf("FAILED: could not derive the account\n");
+        return 1;
+    }
+
+    // the x-only keys of the addresses, and the hashes of the leaves of a taptree
+    serialized_extended_pubkey_t change, address;
+    bip32_CKDpub(&G_account, 0, &change);
+    for (uint32_t i = 0; i < N_KEYS; i++) {
+        bip32_CKDpub(&change, i, &address);
+        memcpy(G_xonly_pubkeys[i], address.compressed_pubkey + 1, 32);
+    }
+    for (int i = 0; i <= N_KEYS; i++) {
+        cx_hash_sha256((uint8_t *) &i, sizeof(i), G_hashes[i], 32);
+    }
+
+    if (run_tapbranch_midstate() != run_tapbranch_no_midstate() ||
+        run_derive_private_key_cached() != run_derive_private_key_uncached() ||
+        run_bip32_CKDpub() != run_get_extended_pubkey()) {
+        printf("FAILED: the results differ\n");
+        return 1;
+    }
+
+    printf("%-24s %14s\n", "function", "ns/op");
+
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        double ns = bench(functions[i].fn, N_KEYS);
+        printf("%-24s %14.2f\n", functions[i].name, ns);
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+// Microbenchmark of the formatting functions of format.c, on amounts and hashes as they are shown
+// on the review screens. It is not a test: run it manually as ./bench_format, before and after a
+// change to format.c.
+//
+// The previous implementation of format_u64, digit by digit with 64-bit divisions, is measured for
+// comparison. On the host, the compiler replaces the 64-bit divisions by 10 by multiplications; on
+// Cortex-M, each of them is a call to a library routine instead. The divisor is therefore read from
+// a volatile variable, so that the divisions are actually executed, as on the device.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "common/format.h"
+
+#include "bench.h"
+
+#define N_VALUES 256
+
+static uint64_t G_amounts[N_VALUES];
+static uint8_t G_hashes[N_VALUES][32];
+
+static volatile uint64_t G_ten = 10;
+
+static bool format_u64_with_divisions(char *out, size_t outLen, uint64_t in) {
+    const uint64_t ten = G_ten;
+    uint8_t i = 0;
+
+    if (outLen == 0) {
+        return false;
+    }
+    outLen--;
+
+    while (in > 9) {
+        out[i] = in % ten + '0';
+        in /= ten;
+        i++;
+        if ((size_t) i + 1 > outLen) {
+            return false;
+        }
+    }
+    out[i] = in + '0';
+    out[i + 1] = '\0';
+
+    for (uint8_t j = 0; j < i; j++, i--) {
+        char tmp = out[j];
+        out[j] = out[i];
+        out[i] = tmp;
+    }
+    return true;
+}
+
+static uint64_t run_format_u64_with_divisions(void) {
+    uint64_t checksum = 0;
+    char out[21];
+    for (int i = 0; i < N_VALUES; i++) {
+        format_u64_with_divisions(out, sizeof(out), G_amounts[i]);
+        checksum += (uint8_t) out[0] + strlen(out);
+    }
+    return checksum;
+}
+
+static uint64_t run_format_u64(void) {
+    uint64_t checksum = 0;
+    char out[21];
+    for (int i = 0; i < N_VALUES; i++) {
+        format_u64(out, sizeof(out), G_amounts[i]);
+        checksum += (uint8_t) out[0] + strlen(out);
+    }
+    return checksum;
+}
+
+static uint64_t run_format_fpu64(void) {
+    uint64_t checksum = 0;
+    char out[22];
+    for (int i = 0; i < N_VALUES; i++) {
+        format_fpu64(out, sizeof(out), G_amounts[i], 8);
+        checksum += (uint8_t) out[0] + strlen(out);
+    }
+    return checksum;
+}
+
+static uint64_t run_format_hex(void) {
+    uint64_t checksum = 0;
+    char out[65];
+    for (int i = 0; i < N_VALUES; i++) {
+        format_hex(G_hashes[i], 32, out, sizeof(out));
+        checksum += (uint8_t) out[0] + (uint8_t) out[63];
+    }
+    return checksum;
+}
+
+int main() {
+    const struct {
+        const char *name;
+        uint64_t (*fn)(void);
+    } functions[] = {
+        {"format_u64 (divisions)", run_format_u64_with_divisions},
+        {"format_u64", run_format_u64},
+        {"format_fpu64", run_format_fpu64},
+        {"format_hex (32 bytes)", run_format_hex},
+    };
+
+    // amounts in satoshis of all the magnitudes, from 1 sat to about 184 billion BTC
+    uint64_t x = 0x243F6A8885A308D3ULL;
+    for (int i = 0; i < N_VALUES; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        G_amounts[i] = x >> (i % 64);
+        for (int j = 0; j < 32; j++) {
+            G_hashes[i][j] = (uint8_t) (x >> (j % 8 * 8));
+        }
+    }
+
+    printf("%-24s %14s\n", "function", "ns/call");
+
+    if (run_format_u64() != run_format_u64_with_divisions()) {
+        printf("FAILED: format_u64 differs from the implementation with divisions\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        double ns = bench(functions[i].fn, N_VALUES);
+        printf("%-24s %14.2f\n", functions[i].name, ns);
+    }
+    return 0;
+}
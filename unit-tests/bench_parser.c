@@ -0,0 +1,216 @@
+// Microbenchmark of the varints of varint.c and of the step machine of parser.c, on a stream with
+// the layout of the transaction inputs, received in chunks like the data of the APDUs. It is not a
+// test: run it manually as ./bench_parser, before and after a change to varint.c or parser.c.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "common/buffer.h"
+#include "common/parser.h"
+#include "common/read.h"
+#include "common/varint.h"
+#include "common/write.h"
+
+#include "bench.h"
+
+#define N_VALUES 256
+
+// each record has a 32-byte hash, a 4-byte index, a varint with the length of the script, the
+// script and a 4-byte sequence
+#define N_RECORDS      256
+#define MAX_RECORD_LEN (32 + 4 + 1 + 34 + 4)
+#define CHUNK_LEN      64
+
+static uint64_t G_values[N_VALUES];
+static uint8_t G_varints[N_VALUES * 9];
+static size_t G_varints_len;
+
+static uint8_t G_stream[N_RECORDS * MAX_RECORD_LEN];
+static size_t G_stream_len;
+
+static uint64_t run_varint_write(void) {
+    uint8_t out[N_VALUES * 9];
+    size_t offset = 0;
+    for (int i = 0; i < N_VALUES; i++) {
+        offset += varint_write(out, offset, G_values[i]);
+    }
+    return offset + out[offset / 2];
+}
+
+static uint64_t run_varint_read(void) {
+    uint64_t checksum = 0;
+    size_t offset = 0;
+    for (int i = 0; i < N_VALUES; i++) {
+        uint64_t value;
+        offset += varint_read(G_varints + offset, G_varints_len - offset, &value);
+        checksum += value;
+    }
+    return checksum;
+}
+
+static uint64_t run_dbuffer_read_varint(void) {
+    // the varints are split across the two buffers, as at the boundary of two chunks
+    size_t half = G_varints_len / 2;
+    buffer_t first = buffer_create(G_varints, half);
+    buffer_t second = buffer_create(G_varints + half, G_varints_len - half);
+    buffer_t *buffers[2] = {&first, &second};
+    uint64_t checksum = 0;
+    for (int i = 0; i < N_VALUES; i++) {
+        uint64_t value;
+        dbuffer_read_varint(buffers, &value);
+        checksum += value;
+    }
+    return checksum;
+}
+
+typedef struct {
+    uint64_t checksum;
+    uint64_t script_len;
+} record_parser_state_t;
+
+static int parse_hash(record_parser_state_t *state, buffer_t *buffers[2]) {
+    uint8_t hash[32];
+    if (!dbuffer_read_bytes(buffers, hash, 32)) {
+        return 0;
+    }
+    state->checksum += hash[0];
+    return 1;
+}
+
+static int parse_index(record_parser_state_t *state, buffer_t *buffers[2]) {
+    uint32_t index;
+    if (!dbuffer_read_u32(buffers, &index, LE)) {
+        return 0;
+    }
+    state->checksum += index;
+    return 1;
+}
+
+static int parse_script_len(record_parser_state_t *state, buffer_t *buffers[2]) {
+    if (!dbuffer_read_varint(buffers, &state->script_len)) {
+        return 0;
+    }
+    return state->script_len <= 34 ? 1 : -1;
+}
+
+static int parse_script(record_parser_state_t *state, buffer_t *buffers[2]) {
+    uint8_t script[34];
+    if (!dbuffer_read_bytes(buffers, script, state->script_len)) {
+        return 0;
+    }
+    state->checksum += state->script_len > 0 ? script[state->script_len - 1] : 0;
+    return 1;
+}
+
+static int parse_sequence(record_parser_state_t *state, buffer_t *buffers[2]) {
+    uint32_t sequence;
+    if (!dbuffer_read_u32(buffers, &sequence, LE)) {
+        return 0;
+    }
+    state->checksum += sequence;
+    return 1;
+}
+
+static const parsing_step_t record_parsing_steps[] = {
+    (parsing_step_t) parse_hash,
+    (parsing_step_t) parse_index,
+    (parsing_step_t) parse_script_len,
+    (parsing_step_t) parse_script,
+    (parsing_step_t) parse_sequence,
+};
+
+static const size_t n_record_parsing_steps =
+    sizeof(record_parsing_steps) / sizeof(record_parsing_steps[0]);
+
+// Parses all the records of the stream with parser_run, receiving CHUNK_LEN bytes at a time, and
+// keeping the bytes of an incomplete step for the next chunk as psbt_parse_rawtx does
+static uint64_t run_parser_run(void) {
+    record_parser_state_t state = {0};
+    parser_context_t parser_context;
+    parser_init_context(&parser_context, &state);
+
+    uint8_t store_data[MAX_RECORD_LEN];
+    buffer_t store = buffer_create(store_data, 0);
+
+    for (size_t offset = 0; offset < G_stream_len; offset += CHUNK_LEN) {
+        size_t chunk_len = G_stream_len - offset < CHUNK_LEN ? G_stream_len - offset : CHUNK_LEN;
+        buffer_t chunk = buffer_create(G_stream + offset, chunk_len);
+        buffer_t *buffers[2] = {&store, &chunk};
+
+        int result;
+        while ((result = parser_run(record_parsing_steps,
+                                    n_record_parsing_steps,
+                                    &parser_context,
+                                    buffers,
+                                    NULL)) == 1) {
+            parser_context.cur_step = 0;  // next record
+        }
+        if (result < 0 || !parser_consolidate_buffers(buffers, sizeof(store_data))) {
+            return 0;
+        }
+    }
+    return state.checksum;
+}
+
+int main() {
+    const struct {
+        const char *name;
+        uint64_t (*fn)(void);
+        size_t n_per_call;
+    } functions[] = {
+        {"varint_write", run_varint_write, N_VALUES},
+        {"varint_read", run_varint_read, N_VALUES},
+        {"dbuffer_read_varint", run_dbuffer_read_varint, N_VALUES},
+        {"parser_run (record)", run_parser_run, N_RECORDS},
+    };
+
+    // mostly 1-byte varints, as the counts and the lengths of scripts, and some of each other size
+    uint64_t x = 0x243F6A8885A308D3ULL;
+    for (int i = 0; i < N_VALUES; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        const uint64_t masks[] = {0x7F, 0x7F, 0x7F, 0x7F, 0xFFFF, 0xFFFFFFFF, ~0ULL, 0x7F};
+        G_values[i] = x & masks[i % 8];
+    }
+    G_varints_len = 0;
+    for (int i = 0; i < N_VALUES; i++) {
+        G_varints_len += varint_write(G_varints, G_varints_len, G_values[i]);
+    }
+
+    // scripts of 22 and 34 bytes, like P2WPKH and P2TR outputs
+    uint64_t expected_checksum = 0;
+    G_stream_len = 0;
+    for (int i = 0; i < N_RECORDS; i++) {
+        uint8_t *record = G_stream + G_stream_len;
+        size_t script_len = i % 2 == 0 ? 22 : 34;
+        memset(record, i, 32);
+        write_u32_le(record, 32, (uint32_t) i);
+        record[36] = (uint8_t) script_len;
+        memset(record + 37, i + 1, script_len);
+        write_u32_le(record, 37 + script_len, 0xFFFFFFFD);
+        G_stream_len += 37 + script_len + 4;
+
+        expected_checksum += (uint64_t) (uint8_t) i + (uint32_t) i + (uint8_t) (i + 1) + 0xFFFFFFFD;
+    }
+
+    uint64_t sum_values = 0;
+    for (int i = 0; i < N_VALUES; i++) {
+        sum_values += G_values[i];
+    }
+    if (run_varint_read() != sum_values || run_dbuffer_read_varint() != sum_values ||
+        run_parser_run() != expected_checksum) {
+        printf("FAILED: wrong checksum\n");
+        return 1;
+    }
+
+    printf("%-24s %14s\n", "function", "ns/op");
+
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        double ns = bench(functions[i].fn, functions[i].n_per_call);
+        printf("%-24s %14.2f\n", functions[i].name, ns);
+    }
+    return 0;
+}
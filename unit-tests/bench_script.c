@@ -0,0 +1,138 @@
+// Microbenchmark of the classification and formatting of output scripts of script.c, on a mix of
+// scripts like the outputs of the transactions. It is not a test: run it manually as
+// ./bench_script, before and after a change to script.c.
+//
+// format_script is not measured, as the addresses require crypto.c, that is only built with
+// OpenSSL; format_opscript_script is the part of it that does not.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "common/script.h"
+
+#include "bench.h"
+
+#define N_SCRIPTS 256
+
+typedef struct {
+    uint8_t data[40];
+    size_t len;
+} script_t;
+
+static script_t G_scripts[N_SCRIPTS];
+static script_t G_opreturn_scripts[N_SCRIPTS];
+
+static void make_script(script_t *script, int type, uint8_t seed) {
+    uint8_t *s = script->data;
+    switch (type) {
+        case SCRIPT_TYPE_P2PKH:
+            s[0] = OP_DUP;
+            s[1] = OP_HASH160;
+            s[2] = 20;
+            memset(s + 3, seed, 20);
+            s[23] = OP_EQUALVERIFY;
+            s[24] = OP_CHECKSIG;
+            script->len = 25;
+            break;
+        case SCRIPT_TYPE_P2SH:
+            s[0] = OP_HASH160;
+            s[1] = 20;
+            memset(s + 2, seed, 20);
+            s[22] = OP_EQUAL;
+            script->len = 23;
+            break;
+        case SCRIPT_TYPE_P2WPKH:
+            s[0] = OP_0;
+            s[1] = 20;
+            memset(s + 2, seed, 20);
+            script->len = 22;
+            break;
+        case SCRIPT_TYPE_P2WSH:
+            s[0] = OP_0;
+            s[1] = 32;
+            memset(s + 2, seed, 32);
+            script->len = 34;
+            break;
+        default:
+            s[0] = OP_1;
+            s[1] = 32;
+            memset(s + 2, seed, 32);
+            script->len = 34;
+            break;
+    }
+}
+
+static uint64_t run_get_script_type(void) {
+    uint64_t checksum = 0;
+    for (int i = 0; i < N_SCRIPTS; i++) {
+        checksum += (uint64_t) get_script_type(G_scripts[i].data, G_scripts[i].len);
+    }
+    return checksum;
+}
+
+static uint64_t run_get_script_info(void) {
+    uint64_t checksum = 0;
+    script_info_t info;
+    for (int i = 0; i < N_SCRIPTS; i++) {
+        checksum += (uint64_t) get_script_info(G_scripts[i].data, G_scripts[i].len, &info);
+    }
+    return checksum;
+}
+
+static uint64_t run_format_opscript_script(void) {
+    uint64_t checksum = 0;
+    char out[MAX_OPRETURN_OUTPUT_DESC_SIZE];
+    for (int i = 0; i < N_SCRIPTS; i++) {
+        checksum += (uint64_t) format_opscript_script(G_opreturn_scripts[i].data,
+                                                      G_opreturn_scripts[i].len,
+                                                      out);
+    }
+    return checksum;
+}
+
+int main() {
+    const struct {
+        const char *name;
+        uint64_t (*fn)(void);
+    } functions[] = {
+        {"get_script_type", run_get_script_type},
+        {"get_script_info", run_get_script_info},
+        {"format_opscript_script", run_format_opscript_script},
+    };
+
+    // mostly segwit outputs, as in the transactions signed by the app
+    const int types[] = {SCRIPT_TYPE_P2WPKH,
+                         SCRIPT_TYPE_P2TR,
+                         SCRIPT_TYPE_P2WPKH,
+                         SCRIPT_TYPE_P2WSH,
+                         SCRIPT_TYPE_P2TR,
+                         SCRIPT_TYPE_P2SH,
+                         SCRIPT_TYPE_P2PKH,
+                         SCRIPT_TYPE_P2WPKH};
+    for (int i = 0; i < N_SCRIPTS; i++) {
+        make_script(&G_scripts[i], types[i % 8], (uint8_t) i);
+
+        // OP_RETURN followed by a push of 0 to 32 bytes, like the commitments of the protocols
+        script_t *opreturn = &G_opreturn_scripts[i];
+        size_t data_len = (size_t) (i % 33);
+        opreturn->data[0] = OP_RETURN;
+        opreturn->data[1] = (uint8_t) data_len;
+        memset(opreturn->data + 2, i, data_len);
+        opreturn->len = 2 + data_len;
+    }
+
+    if (run_get_script_type() != run_get_script_info()) {
+        printf("FAILED: get_script_info differs from get_script_type\n");
+        return 1;
+    }
+
+    printf("%-24s %14s\n", "function", "ns/call");
+
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        double ns = bench(functions[i].fn, N_SCRIPTS);
+        printf("%-24s %14.2f\n", functions[i].name, ns);
+    }
+    return 0;
+}
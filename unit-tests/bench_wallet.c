@@ -0,0 +1,234 @@
+// Microbenchmark of the parsing and of the miniscript analysis of descriptor templates.
+// It is not a test: run it manually as ./bench_wallet, before and after a change to wallet.c.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+// missing definitions to make it compile without the SDK
+unsigned int pic(unsigned int linked_address) {
+    return linked_address;
+}
+
+#define PRINTF(...) printf
+#define PIC(x)      (x)
+
+#include "common/wallet.h"
+
+#include "bench.h"
+
+// same as in test_wallet.c, as size_t is 8 bytes on the host
+#define MAX_WALLET_POLICY_MEMORY_SIZE 2048
+
+// minimum duration of the measurement of each descriptor
+#define MIN_BENCH_NS 200000000ULL
+
+typedef struct {
+    const char *name;
+    char descriptor_template[MAX_DESCRIPTOR_TEMPLATE_LENGTH_V2 + 1];
+} bench_case_t;
+
+static uint8_t G_out[MAX_WALLET_POLICY_MEMORY_SIZE] __attribute__((aligned(8)));
+
+static int parse(const char *descriptor_template) {
+    buffer_t buf = buffer_create((void *) descriptor_template, strlen(descriptor_template));
+    return parse_descriptor_template(&buf, G_out, sizeof(G_out), WALLET_POLICY_VERSION_V2);
+}
+
+// Runs the miniscript analysis on each miniscript of the parsed policy in G_out; returns the
+// number of analysed miniscripts, or -1 on error
+static int analyse_tree(const policy_node_tree_t *tree) {
+    if (tree->is_leaf) {
+        const policy_node_t *script = r_policy_node(&tree->script);
+        if (!script->flags.is_miniscript) {
+            return 0;
+        }
+        policy_node_ext_info_t ext_info;
+        return compute_miniscript_policy_ext_info(script, &ext_info, MINISCRIPT_CONTEXT_TAPSCRIPT) <
+                       0
+                   ? -1
+                   : 1;
+    }
+    int left = analyse_tree(r_policy_node_tree(&tree->left_tree));
+    int right = analyse_tree(r_policy_node_tree(&tree->right_tree));
+    return left < 0 || right < 0 ? -1 : left + right;
+}
+
+static int analyse(void) {
+    const policy_node_t *policy = (const policy_node_t *) G_out;
+    if (policy->type == TOKEN_SH) {
+        policy = r_policy_node(&((const policy_node_with_script_t *) policy)->script);
+    }
+
+    if (policy->type == TOKEN_WSH) {
+        const policy_node_t *script =
+            r_policy_node(&((const policy_node_with_script_t *) policy)->script);
+        if (!script->flags.is_miniscript) {
+            return 0;
+        }
+        policy_node_ext_info_t ext_info;
+        return compute_miniscript_policy_ext_info(script, &ext_info, MINISCRIPT_CONTEXT_P2WSH) < 0
+                   ? -1
+                   : 1;
+    } else if (policy->type == TOKEN_TR) {
+        const policy_node_tr_t *tr = (const policy_node_tr_t *) policy;
+        if (isnull_policy_node_tree(&tr->tree)) {
+            return 0;
+        }
+        return analyse_tree(r_policy_node_tree(&tr->tree));
+    }
+    return 0;
+}
+
+// the descriptor template measured by run_parse
+static const char *G_descriptor_template;
+
+static uint64_t run_parse(void) {
+    return (uint64_t) parse(G_descriptor_template);
+}
+
+// G_out must contain a parsed policy
+static uint64_t run_analyse(void) {
+    return (uint64_t) analyse();
+}
+
+// Appends to out a complete tree of pk leaves with the given depth, using next_key for the keys
+static void append_taptree(char *out, size_t out_len, int depth, int *next_key) {
+    if (depth == 0) {
+        snprintf(out + strlen(out), out_len - strlen(out), "pk(@%d/**)", (*next_key)++ % 10);
+        return;
+    }
+    strncat(out, "{", out_len - strlen(out) - 1);
+    append_taptree(out, out_len, depth - 1, next_key);
+    strncat(out, ",", out_len - strlen(out) - 1);
+    append_taptree(out, out_len, depth - 1, next_key);
+    strncat(out, "}", out_len - strlen(out) - 1);
+}
+
+int main() {
+    bench_case_t cases[] = {
+        {"wpkh", "wpkh(@0/**)"},
+        {"tr keypath", "tr(@0/**)"},
+        {"sortedmulti 15-of-15", ""},
+        {"multi_a 10-of-10 in taptree", ""},
+        {"taptree depth 4 (16 leaves)", ""},
+        {"taptree left-deep depth 8", ""},
+        {"miniscript decaying 3-of-3",
+         "wsh(thresh(3,pk(@0/**),s:pk(@1/**),s:pk(@2/**),sln:older(12960)))"},
+        {"miniscript largest", ""},
+        {"miniscript nested thresh x8", ""},
+    };
+
+    // the parser does not require the placeholders to refer to distinct keys, so 10 keys with two
+    // different derivations give the 15 placeholders
+    char *d = cases[2].descriptor_template;
+    strcpy(d, "wsh(sortedmulti(15");
+    for (int i = 0; i < 15; i++) {
+        sprintf(d + strlen(d), ",@%d/<%d;%d>/*", i % 10, 2 * (i / 10), 2 * (i / 10) + 1);
+    }
+    strcat(d, "))");
+
+    d = cases[3].descriptor_template;
+    strcpy(d, "tr(@0/**,multi_a(10");
+    for (int i = 0; i < 10; i++) {
+        sprintf(d + strlen(d), ",@%d/<2;3>/*", i);
+    }
+    strcat(d, "))");
+
+    int next_key = 1;
+    d = cases[4].descriptor_template;
+    strcpy(d, "tr(@0/**,");
+    append_taptree(d, sizeof(cases[4].descriptor_template), 4, &next_key);
+    strcat(d, ")");
+
+    d = cases[5].descriptor_template;
+    strcpy(d, "tr(@0/**,");
+    for (int i = 0; i < 8; i++) {
+        sprintf(d + strlen(d), "{pk(@%d/**),", i % 10);
+    }
+    strcat(d, "pk(@9/**)");
+    for (int i = 0; i < 8; i++) {
+        strcat(d, "}");
+    }
+    strcat(d, ")");
+
+    // a chain of and_v fragments, as long as the limit on the length of descriptor templates allows
+    d = cases[7].descriptor_template;
+    const char *tail = "older(52560)";
+    const char *fragments[] = {"v:pk(@%d/**)", "v:pkh(@%d/**)", "v:sha256(%064d)"};
+    size_t n_fragments = 0;
+    d[0] = '\0';
+    while (true) {
+        char fragment[128];
+        sprintf(fragment, fragments[n_fragments % 3], (int) (n_fragments % 10));
+        // "wsh(" + n * "and_v(" + n * (fragment + ",") + tail + n * ")" + ")"
+        size_t len = 4 + strlen(d) + strlen("and_v(") + strlen(fragment) + 1 + strlen(tail) +
+                     n_fragments + 1 + 1;
+        if (len > MAX_DESCRIPTOR_TEMPLATE_LENGTH_V2) {
+            break;
+        }
+        strcat(d, "and_v(");
+        strcat(d, fragment);
+        strcat(d, ",");
+        ++n_fragments;
+    }
+    char body[MAX_DESCRIPTOR_TEMPLATE_LENGTH_V2 + 1];
+    strcpy(body, d);
+    strcpy(d, "wsh(");
+    strcat(d, body);
+    strcat(d, tail);
+    for (size_t i = 0; i < n_fragments; i++) {
+        strcat(d, ")");
+    }
+    strcat(d, ")");
+
+    // thresh fragments nested in the last child of each other
+    d = cases[8].descriptor_template;
+    strcpy(d, "wsh(");
+    for (int i = 0; i < 8; i++) {
+        sprintf(d + strlen(d), "thresh(1,pk(@%d/**),a:", i);
+    }
+    strcat(d, "pk(@8/**)");
+    for (int i = 0; i < 8; i++) {
+        strcat(d, ")");
+    }
+    strcat(d, ")");
+
+    printf("%-30s %6s %10s %12s %14s\n",
+           "descriptor",
+           "length",
+           "bytes",
+           "parse ns/op",
+           "analysis ns/op");
+
+    int ret = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const char *descriptor_template = cases[i].descriptor_template;
+
+        int n_bytes = parse(descriptor_template);
+        int n_miniscripts = n_bytes < 0 ? -1 : analyse();
+        if (n_bytes < 0 || n_miniscripts < 0) {
+            printf("%-30s FAILED: %s\n", cases[i].name, descriptor_template);
+            ret = 1;
+            continue;
+        }
+
+        G_descriptor_template = descriptor_template;
+        double parse_ns = bench(run_parse, 1);
+
+        char analysis[32] = "-";
+        if (n_miniscripts > 0) {
+            // G_out still contains the parsed policy
+            snprintf(analysis, sizeof(analysis), "%.0f", bench(run_analyse, 1));
+        }
+
+        printf("%-30s %6zu %10d %12.0f %14s\n",
+               cases[i].name,
+               strlen(descriptor_template),
+               n_bytes,
+               parse_ns,
+               analysis);
+    }
+    return ret;
+}
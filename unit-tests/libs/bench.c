@@ -0,0 +1,33 @@
+#include <time.h>
+
+#include "bench.h"
+
+static volatile uint64_t G_checksum;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+double bench(uint64_t (*fn)(void), size_t n_per_call) {
+    uint64_t checksum = 0;
+    uint64_t n_calls = 0;
+    uint64_t start = now_ns();
+    uint64_t elapsed;
+    // the calls are made in batches of growing size, so that reading the clock is negligible for
+    // the fast functions, while the slow ones are not repeated much longer than MIN_BENCH_NS
+    uint64_t batch = 1;
+    do {
+        for (uint64_t i = 0; i < batch; i++) {
+            checksum += fn();
+        }
+        n_calls += batch;
+        if (batch < 100) {
+            batch *= 2;
+        }
+        elapsed = now_ns() - start;
+    } while (elapsed < MIN_BENCH_NS);
+    G_checksum += checksum;
+    return (double) elapsed / (double) (n_calls * n_per_call);
+}
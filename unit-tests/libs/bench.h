@@ -0,0 +1,17 @@
+#pragma once
+
+// Timing harness of the microbenchmarks (bench_*.c). They are not tests: run them manually, or
+// with the `bench` target, before and after a change.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// minimum duration of the measurement of each function
+#define MIN_BENCH_NS 200000000ULL
+
+/**
+ * Returns the average duration in ns of each of the n_per_call items (keys, records, values...)
+ * processed by each call of fn, called repeatedly for at least MIN_BENCH_NS. fn returns a checksum
+ * of its results, that is accumulated so that the calls can not be optimized away.
+ */
+double bench(uint64_t (*fn)(void), size_t n_per_call);
@@ -1,6 +1,6 @@
-// We're currently unable to compile the app's crypto.c in unit tests.
+// crypto.c can only be compiled in unit tests if OpenSSL is available (see libs/cx_mocks.c).
 // This library mocks the functions currently used in other modules that are part of
-// the unit tests.
+// the unit tests, so that their tests do not require it.
 
 #include <stdint.h>
 
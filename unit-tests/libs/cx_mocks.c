@@ -0,0 +1,943 @@
+// Software implementation of the cryptographic primitives of the SDK and of the derivations of the
+// OS used by crypto.c, so that it can be built and tested on the host. The big numbers, the
+// points of secp256k1, the HMACs and RIPEMD-160 use OpenSSL's libcrypto; SHA-256 is implemented
+// here, as the app copies and resumes the contexts of the tagged hashes, and counts their blocks.
+//
+// The seed of the device is the one of the default mnemonic of speculos, so that the keys are the
+// same as in the functional tests.
+//
+// This is not constant time, and is not meant to be: it is only used in unit tests and benchmarks.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/obj_mac.h>
+
+#include "os.h"
+#include "cx.h"
+#include "lib_standard_app/crypto_helpers.h"
+
+#define SPECULOS_MNEMONIC                                                                         \
+    "glory promote mansion idle axis finger extra february uncover one trip resource lawn turtle " \
+    "enact monster seven myth punch hobby comfort wild raise skin"
+
+static const uint8_t secp256k1_n[] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe,
+    0xba, 0xae, 0xdc, 0xe6, 0xaf, 0x48, 0xa0, 0x3b, 0xbf, 0xd2, 0x5e, 0x8c, 0xd0, 0x36, 0x41, 0x41};
+
+/* ----------------------------------------------------------------------- */
+/* -                               SHA-256                               - */
+/* ----------------------------------------------------------------------- */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static const uint32_t sha256_iv[8] = {0x6a09e667,
+                                      0xbb67ae85,
+                                      0x3c6ef372,
+                                      0xa54ff53a,
+                                      0x510e527f,
+                                      0x9b05688c,
+                                      0x1f83d9ab,
+                                      0x5be0cd19};
+
+static uint32_t load_u32_be(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | (uint32_t) p[3];
+}
+
+static void store_u32_be(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) (v >> 24);
+    p[1] = (uint8_t) (v >> 16);
+    p[2] = (uint8_t) (v >> 8);
+    p[3] = (uint8_t) v;
+}
+
+#define ROTR(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+// Compresses one block into the state, that is kept in acc as 8 big-endian words
+static void sha256_compress(cx_sha256_t *hash, const uint8_t block[static 64]) {
+    uint32_t w[64], s[8];
+    for (int i = 0; i < 16; i++) {
+        w[i] = load_u32_be(block + 4 * i);
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    for (int i = 0; i < 8; i++) {
+        s[i] = load_u32_be(hash->acc + 4 * i);
+    }
+    uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) +
+                      sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    s[0] += a;
+    s[1] += b;
+    s[2] += c;
+    s[3] += d;
+    s[4] += e;
+    s[5] += f;
+    s[6] += g;
+    s[7] += h;
+    for (int i = 0; i < 8; i++) {
+        store_u32_be(hash->acc + 4 * i, s[i]);
+    }
+    hash->header.counter++;
+}
+
+int cx_sha256_init(cx_sha256_t *hash) {
+    memset(hash, 0, sizeof(cx_sha256_t));
+    hash->header.algo = CX_SHA256;
+    for (int i = 0; i < 8; i++) {
+        store_u32_be(hash->acc + 4 * i, sha256_iv[i]);
+    }
+    return CX_SHA256;
+}
+
+// SHA-512 contexts are also updated with cx_hash_no_throw
+static cx_err_t sha512_hash(cx_sha512_t *ctx,
+                            uint32_t mode,
+                            const uint8_t *in,
+                            size_t len,
+                            uint8_t *out,
+                            size_t out_len);
+
+cx_err_t cx_hash_no_throw(cx_hash_t *hash,
+                          uint32_t mode,
+                          const uint8_t *in,
+                          size_t len,
+                          uint8_t *out,
+                          size_t out_len) {
+    if (hash->algo == CX_SHA512) {
+        return sha512_hash((cx_sha512_t *) hash, mode, in, len, out, out_len);
+    }
+    if (hash->algo != CX_SHA256) {
+        return CX_INVALID_PARAMETER;
+    }
+    cx_sha256_t *ctx = (cx_sha256_t *) hash;
+
+    while (len > 0) {
+        size_t n = 64 - ctx->blen < len ? 64 - ctx->blen : len;
+        memcpy(ctx->block + ctx->blen, in, n);
+        ctx->blen += n;
+        in += n;
+        len -= n;
+        if (ctx->blen == 64) {
+            sha256_compress(ctx, ctx->block);
+            ctx->blen = 0;
+        }
+    }
+
+    if (mode & CX_LAST) {
+        if (out_len < CX_SHA256_SIZE) {
+            return CX_INVALID_PARAMETER;
+        }
+        uint64_t bit_len = ((uint64_t) ctx->header.counter * 64 + ctx->blen) * 8;
+        ctx->block[ctx->blen++] = 0x80;
+        if (ctx->blen > 56) {
+            memset(ctx->block + ctx->blen, 0, 64 - ctx->blen);
+            sha256_compress(ctx, ctx->block);
+            ctx->blen = 0;
+        }
+        memset(ctx->block + ctx->blen, 0, 56 - ctx->blen);
+        store_u32_be(ctx->block + 56, (uint32_t) (bit_len >> 32));
+        store_u32_be(ctx->block + 60, (uint32_t) bit_len);
+        sha256_compress(ctx, ctx->block);
+        memcpy(out, ctx->acc, CX_SHA256_SIZE);
+    }
+    return CX_OK;
+}
+
+int cx_hash_sha256(const uint8_t *in, unsigned int len, uint8_t *out, unsigned int out_len) {
+    cx_sha256_t ctx;
+    cx_sha256_init(&ctx);
+    if (cx_hash_no_throw(&ctx.header, CX_LAST, in, len, out, out_len) != CX_OK) {
+        return 0;
+    }
+    return CX_SHA256_SIZE;
+}
+
+/* ----------------------------------------------------------------------- */
+/* -                               SHA-512                               - */
+/* ----------------------------------------------------------------------- */
+
+static const uint64_t sha512_k[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static const uint64_t sha512_iv[8] = {
+    0x6a09e667f3bcc908ULL,
+    0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL,
+    0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL,
+    0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL,
+    0x5be0cd19137e2179ULL
+};
+
+static uint64_t load_u64_be(const uint8_t *p) {
+    return (uint64_t) load_u32_be(p) << 32 | load_u32_be(p + 4);
+}
+
+static void store_u64_be(uint8_t *p, uint64_t v) {
+    store_u32_be(p, (uint32_t) (v >> 32));
+    store_u32_be(p + 4, (uint32_t) v);
+}
+
+#define ROTR64(x, n) ((x) >> (n) | (x) << (64 - (n)))
+
+// Compresses one block into the state, that is kept in acc as 8 big-endian words
+static void sha512_compress(cx_sha512_t *hash, const uint8_t block[static 128]) {
+    uint64_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = load_u64_be(block + 8 * i);
+    }
+    for (int i = 16; i < 80; i++) {
+        uint64_t s0 = ROTR64(w[i - 15], 1) ^ ROTR64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+        uint64_t s1 = ROTR64(w[i - 2], 19) ^ ROTR64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint64_t s[8];
+    for (int i = 0; i < 8; i++) {
+        s[i] = load_u64_be(hash->acc + 8 * i);
+    }
+    uint64_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 80; i++) {
+        uint64_t S1 = ROTR64(e, 14) ^ ROTR64(e, 18) ^ ROTR64(e, 41);
+        uint64_t ch = (e & f) ^ (~e & g);
+        uint64_t t1 = h + S1 + ch + sha512_k[i] + w[i];
+        uint64_t S0 = ROTR64(a, 28) ^ ROTR64(a, 34) ^ ROTR64(a, 39);
+        uint64_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint64_t t2 = S0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    s[0] += a;
+    s[1] += b;
+    s[2] += c;
+    s[3] += d;
+    s[4] += e;
+    s[5] += f;
+    s[6] += g;
+    s[7] += h;
+    for (int i = 0; i < 8; i++) {
+        store_u64_be(hash->acc + 8 * i, s[i]);
+    }
+    hash->header.counter++;
+}
+
+cx_err_t cx_sha512_init_no_throw(cx_sha512_t *hash) {
+    memset(hash, 0, sizeof(cx_sha512_t));
+    hash->header.algo = CX_SHA512;
+    for (int i = 0; i < 8; i++) {
+        store_u64_be(hash->acc + 8 * i, sha512_iv[i]);
+    }
+    return CX_OK;
+}
+
+static cx_err_t sha512_hash(cx_sha512_t *ctx,
+                            uint32_t mode,
+                            const uint8_t *in,
+                            size_t len,
+                            uint8_t *out,
+                            size_t out_len) {
+    while (len > 0) {
+        size_t n = 128 - ctx->blen < len ? 128 - ctx->blen : len;
+        memcpy(ctx->block + ctx->blen, in, n);
+        ctx->blen += n;
+        in += n;
+        len -= n;
+        if (ctx->blen == 128) {
+            sha512_compress(ctx, ctx->block);
+            ctx->blen = 0;
+        }
+    }
+
+    if (mode & CX_LAST) {
+        if (out_len < CX_SHA512_SIZE) {
+            return CX_INVALID_PARAMETER;
+        }
+        uint64_t bit_len = ((uint64_t) ctx->header.counter * 128 + ctx->blen) * 8;
+        ctx->block[ctx->blen++] = 0x80;
+        if (ctx->blen > 112) {
+            memset(ctx->block + ctx->blen, 0, 128 - ctx->blen);
+            sha512_compress(ctx, ctx->block);
+            ctx->blen = 0;
+        }
+        // the length is encoded on 128 bits, but never exceeds 64 bits here
+        memset(ctx->block + ctx->blen, 0, 120 - ctx->blen);
+        store_u64_be(ctx->block + 120, bit_len);
+        sha512_compress(ctx, ctx->block);
+        memcpy(out, ctx->acc, CX_SHA512_SIZE);
+    }
+    return CX_OK;
+}
+
+/* ----------------------------------------------------------------------- */
+/* -                        RIPEMD-160 and HMACs                         - */
+/* ----------------------------------------------------------------------- */
+
+cx_err_t cx_ripemd160_hash(const uint8_t *in, size_t in_len, uint8_t *out) {
+    return EVP_Digest(in, in_len, out, NULL, EVP_ripemd160(), NULL) == 1 ? CX_OK
+                                                                         : CX_INTERNAL_ERROR;
+}
+
+static size_t hmac(const EVP_MD *md,
+                   const uint8_t *key,
+                   size_t key_len,
+                   const uint8_t *in,
+                   size_t len,
+                   uint8_t *mac,
+                   size_t mac_len) {
+    uint8_t result[EVP_MAX_MD_SIZE];
+    unsigned int result_len;
+    if (HMAC(md, key, (int) key_len, in, len, result, &result_len) == NULL) {
+        return 0;
+    }
+    if (mac_len > result_len) {
+        mac_len = result_len;
+    }
+    memcpy(mac, result, mac_len);
+    return mac_len;
+}
+
+size_t cx_hmac_sha256(const uint8_t *key,
+                      size_t key_len,
+                      const uint8_t *in,
+                      size_t len,
+                      uint8_t *mac,
+                      size_t mac_len) {
+    return hmac(EVP_sha256(), key, key_len, in, len, mac, mac_len);
+}
+
+size_t cx_hmac_sha512(const uint8_t *key,
+                      size_t key_len,
+                      const uint8_t *in,
+                      size_t len,
+                      uint8_t *mac,
+                      size_t mac_len) {
+    return hmac(EVP_sha512(), key, key_len, in, len, mac, mac_len);
+}
+
+/* ----------------------------------------------------------------------- */
+/* -                             Big numbers                             - */
+/* ----------------------------------------------------------------------- */
+
+cx_err_t cx_math_cmp_no_throw(const uint8_t *a, const uint8_t *b, size_t len, int *diff) {
+    int c = memcmp(a, b, len);
+    *diff = c < 0 ? -1 : (c > 0 ? 1 : 0);
+    return CX_OK;
+}
+
+cx_err_t cx_math_is_zero_no_throw(const uint8_t *a, size_t len, bool *result) {
+    *result = true;
+    for (size_t i = 0; i < len; i++) {
+        if (a[i] != 0) {
+            *result = false;
+        }
+    }
+    return CX_OK;
+}
+
+cx_err_t cx_math_sub_no_throw(uint8_t *r, const uint8_t *a, const uint8_t *b, size_t len) {
+    int borrow = 0;
+    for (size_t i = len; i-- > 0;) {
+        int d = (int) a[i] - (int) b[i] - borrow;
+        borrow = d < 0;
+        r[i] = (uint8_t) (d + (borrow ? 256 : 0));
+    }
+    return CX_OK;
+}
+
+// The modular operations below convert the operands to BIGNUMs, and the result back to len bytes
+typedef enum { OP_ADDM, OP_MULTM, OP_POWM, OP_INVM } bn_op_t;
+
+static cx_err_t bn_modular_op(bn_op_t op,
+                              uint8_t *r,
+                              const uint8_t *a,
+                              const uint8_t *b,
+                              size_t len_b,
+                              const uint8_t *m,
+                              size_t len) {
+    BN_CTX *ctx = BN_CTX_new();
+    if (ctx == NULL) {
+        return CX_INTERNAL_ERROR;
+    }
+    BN_CTX_start(ctx);
+    BIGNUM *bn_a = BN_CTX_get(ctx);
+    BIGNUM *bn_b = BN_CTX_get(ctx);
+    BIGNUM *bn_m = BN_CTX_get(ctx);
+    BIGNUM *bn_r = BN_CTX_get(ctx);
+
+    bool ok = bn_r != NULL && BN_bin2bn(a, (int) len, bn_a) != NULL &&
+              BN_bin2bn(m, (int) len, bn_m) != NULL &&
+              (b == NULL || BN_bin2bn(b, (int) len_b, bn_b) != NULL);
+    if (ok) {
+        switch (op) {
+            case OP_ADDM:
+                ok = BN_mod_add(bn_r, bn_a, bn_b, bn_m, ctx);
+                break;
+            case OP_MULTM:
+                ok = BN_mod_mul(bn_r, bn_a, bn_b, bn_m, ctx);
+                break;
+            case OP_POWM:
+                ok = BN_mod_exp(bn_r, bn_a, bn_b, bn_m, ctx);
+                break;
+            case OP_INVM:
+                ok = BN_mod_inverse(bn_r, bn_a, bn_m, ctx) != NULL;
+                break;
+        }
+    }
+    ok = ok && BN_bn2binpad(bn_r, r, (int) len) == (int) len;
+
+    BN_CTX_end(ctx);
+    BN_CTX_free(ctx);
+    return ok ? CX_OK : CX_INTERNAL_ERROR;
+}
+
+cx_err_t cx_math_addm_no_throw(uint8_t *r,
+                               const uint8_t *a,
+                               const uint8_t *b,
+                               const uint8_t *m,
+                               size_t len) {
+    return bn_modular_op(OP_ADDM, r, a, b, len, m, len);
+}
+
+cx_err_t cx_math_multm_no_throw(uint8_t *r,
+                                const uint8_t *a,
+                                const uint8_t *b,
+                                const uint8_t *m,
+                                size_t len) {
+    return bn_modular_op(OP_MULTM, r, a, b, len, m, len);
+}
+
+cx_err_t cx_math_powm_no_throw(uint8_t *r,
+                               const uint8_t *a,
+                               const uint8_t *e,
+                               size_t len_e,
+                               const uint8_t *m,
+                               size_t len) {
+    return bn_modular_op(OP_POWM, r, a, e, len_e, m, len);
+}
+
+cx_err_t cx_math_invprimem_no_throw(uint8_t *r, const uint8_t *a, const uint8_t *m, size_t len) {
+    return bn_modular_op(OP_INVM, r, a, NULL, 0, m, len);
+}
+
+cx_err_t cx_math_modm_no_throw(uint8_t *v, size_t len_v, const uint8_t *m, size_t len_m) {
+    BN_CTX *ctx = BN_CTX_new();
+    if (ctx == NULL) {
+        return CX_INTERNAL_ERROR;
+    }
+    BN_CTX_start(ctx);
+    BIGNUM *bn_v = BN_CTX_get(ctx);
+    BIGNUM *bn_m = BN_CTX_get(ctx);
+    BIGNUM *bn_r = BN_CTX_get(ctx);
+
+    bool ok = bn_r != NULL && BN_bin2bn(v, (int) len_v, bn_v) != NULL &&
+              BN_bin2bn(m, (int) len_m, bn_m) != NULL && BN_mod(bn_r, bn_v, bn_m, ctx) &&
+              BN_bn2binpad(bn_r, v, (int) len_v) == (int) len_v;
+
+    BN_CTX_end(ctx);
+    BN_CTX_free(ctx);
+    return ok ? CX_OK : CX_INTERNAL_ERROR;
+}
+
+/* ----------------------------------------------------------------------- */
+/* -                         Points of secp256k1                         - */
+/* ----------------------------------------------------------------------- */
+
+static const EC_GROUP *secp256k1_group(void) {
+    static EC_GROUP *group = NULL;
+    if (group == NULL) {
+        group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+    }
+    return group;
+}
+
+// Decodes the 65-byte uncompressed point, that must be on the curve
+static bool point_read(const uint8_t *in, EC_POINT *P, BN_CTX *ctx) {
+    return in[0] == 0x04 && EC_POINT_oct2point(secp256k1_group(), P, in, 65, ctx) == 1;
+}
+
+// Encodes the point as 65 bytes, failing for the point at infinity
+static cx_err_t point_write(const EC_POINT *P, uint8_t *out, BN_CTX *ctx) {
+    if (EC_POINT_is_at_infinity(secp256k1_group(), P)) {
+        return CX_EC_INFINITE_POINT;
+    }
+    size_t n = EC_POINT_point2oct(secp256k1_group(),
+                                  P,
+                                  POINT_CONVERSION_UNCOMPRESSED,
+                                  out,
+                                  65,
+                                  ctx);
+    return n == 65 ? CX_OK : CX_INTERNAL_ERROR;
+}
+
+cx_err_t cx_ecfp_add_point_no_throw(cx_curve_t curve,
+                                    uint8_t *R,
+                                    const uint8_t *P,
+                                    const uint8_t *Q) {
+    if (curve != CX_CURVE_SECP256K1) {
+        return CX_INVALID_PARAMETER;
+    }
+    BN_CTX *ctx = BN_CTX_new();
+    EC_POINT *p = EC_POINT_new(secp256k1_group());
+    EC_POINT *q = EC_POINT_new(secp256k1_group());
+
+    cx_err_t err = CX_INVALID_PARAMETER;
+    if (ctx != NULL && p != NULL && q != NULL && point_read(P, p, ctx) && point_read(Q, q, ctx)) {
+        err = EC_POINT_add(secp256k1_group(), p, p, q, ctx) == 1 ? point_write(p, R, ctx)
+                                                                 : CX_INTERNAL_ERROR;
+    }
+
+    EC_POINT_free(q);
+    EC_POINT_free(p);
+    BN_CTX_free(ctx);
+    return err;
+}
+
+cx_err_t cx_ecfp_scalar_mult_no_throw(cx_curve_t curve,
+                                      uint8_t *P,
+                                      const uint8_t *k,
+                                      size_t k_len) {
+    if (curve != CX_CURVE_SECP256K1) {
+        return CX_INVALID_PARAMETER;
+    }
+    BN_CTX *ctx = BN_CTX_new();
+    EC_POINT *p = EC_POINT_new(secp256k1_group());
+    BIGNUM *bn_k = BN_bin2bn(k, (int) k_len, NULL);
+
+    cx_err_t err = CX_INVALID_PARAMETER;
+    if (ctx != NULL && p != NULL && bn_k != NULL && point_read(P, p, ctx)) {
+        err = EC_POINT_mul(secp256k1_group(), p, NULL, p, bn_k, ctx) == 1 ? point_write(p, P, ctx)
+                                                                          : CX_INTERNAL_ERROR;
+    }
+
+    BN_clear_free(bn_k);
+    EC_POINT_free(p);
+    BN_CTX_free(ctx);
+    return err;
+}
+
+// Computes the uncompressed public key k*G
+static cx_err_t secp256k1_pubkey(const uint8_t k[static 32], uint8_t out[static 65]) {
+    BN_CTX *ctx = BN_CTX_new();
+    EC_POINT *p = EC_POINT_new(secp256k1_group());
+    BIGNUM *bn_k = BN_bin2bn(k, 32, NULL);
+
+    cx_err_t err = CX_INTERNAL_ERROR;
+    if (ctx != NULL && p != NULL && bn_k != NULL &&
+        EC_POINT_mul(secp256k1_group(), p, bn_k, NULL, NULL, ctx) == 1) {
+        err = point_write(p, out, ctx);
+    }
+
+    BN_clear_free(bn_k);
+    EC_POINT_free(p);
+    BN_CTX_free(ctx);
+    return err;
+}
+
+cx_err_t cx_ecfp_init_private_key_no_throw(cx_curve_t curve,
+                                           const uint8_t *rawkey,
+                                           size_t key_len,
+                                           cx_ecfp_private_key_t *pvkey) {
+    if (curve != CX_CURVE_SECP256K1 || key_len != 32) {
+        return CX_INVALID_PARAMETER;
+    }
+    pvkey->curve = curve;
+    pvkey->d_len = 32;
+    memcpy(pvkey->d, rawkey, 32);
+    return CX_OK;
+}
+
+cx_err_t cx_ecfp_generate_pair_no_throw(cx_curve_t curve,
+                                        cx_ecfp_public_key_t *pubkey,
+                                        cx_ecfp_private_key_t *privkey,
+                                        bool keepprivate) {
+    // the random generation of a new private key is not needed by the app
+    if (curve != CX_CURVE_SECP256K1 || !keepprivate) {
+        return CX_INVALID_PARAMETER;
+    }
+    pubkey->curve = curve;
+    pubkey->W_len = 65;
+    return secp256k1_pubkey(privkey->d, pubkey->W);
+}
+
+/* ----------------------------------------------------------------------- */
+/* -                                ECDSA                                - */
+/* ----------------------------------------------------------------------- */
+
+// Writes the integer of len bytes as a DER INTEGER, and returns the length of the encoding
+static size_t der_write_integer(uint8_t *out, const uint8_t *v, size_t len) {
+    while (len > 1 && v[0] == 0) {
+        v++;
+        len--;
+    }
+    size_t pad = (v[0] & 0x80) ? 1 : 0;
+    out[0] = 0x02;
+    out[1] = (uint8_t) (len + pad);
+    out[2] = 0x00;
+    memcpy(out + 2 + pad, v, len);
+    return 2 + pad + len;
+}
+
+size_t cx_ecfp_encode_sig_der(uint8_t *sig,
+                              size_t sig_len,
+                              const uint8_t *r,
+                              size_t r_len,
+                              const uint8_t *s,
+                              size_t s_len) {
+    if (r_len > 32 || s_len > 32 || sig_len < 2 + 2 * (2 + 1 + 32)) {
+        return 0;
+    }
+    size_t len = 2;
+    len += der_write_integer(sig + len, r, r_len);
+    len += der_write_integer(sig + len, s, s_len);
+    sig[0] = 0x30;
+    sig[1] = (uint8_t) (len - 2);
+    return len;
+}
+
+// The deterministic nonce of RFC6979 with HMAC-SHA256, for a 32-byte hash
+static void rfc6979_nonce(const uint8_t x[static 32],
+                          const uint8_t hash[static 32],
+                          uint8_t k[static 32]) {
+    uint8_t K[32], V[32];
+    uint8_t data[32 + 1 + 32 + 32];  // V || 0x00 or 0x01 || x || bits2octets(hash)
+
+    memset(K, 0x00, sizeof(K));
+    memset(V, 0x01, sizeof(V));
+    memcpy(data + 33, x, 32);
+    memcpy(data + 65, hash, 32);
+    cx_math_modm_no_throw(data + 65, 32, secp256k1_n, 32);
+
+    for (uint8_t sep = 0x00; sep <= 0x01; sep++) {
+        memcpy(data, V, 32);
+        data[32] = sep;
+        cx_hmac_sha256(K, 32, data, sizeof(data), K, 32);
+        cx_hmac_sha256(K, 32, V, 32, V, 32);
+    }
+    while (true) {
+        cx_hmac_sha256(K, 32, V, 32, V, 32);
+        bool is_zero;
+        cx_math_is_zero_no_throw(V, 32, &is_zero);
+        if (!is_zero && memcmp(V, secp256k1_n, 32) < 0) {
+            memcpy(k, V, 32);
+            break;
+        }
+        memcpy(data, V, 32);
+        data[32] = 0x00;
+        cx_hmac_sha256(K, 32, data, 33, K, 32);
+        cx_hmac_sha256(K, 32, V, 32, V, 32);
+    }
+
+    explicit_bzero(K, sizeof(K));
+    explicit_bzero(V, sizeof(V));
+    explicit_bzero(data, sizeof(data));
+}
+
+cx_err_t cx_ecdsa_sign_no_throw(const cx_ecfp_private_key_t *pvkey,
+                                uint32_t mode,
+                                cx_md_t hashID,
+                                const uint8_t *hash,
+                                size_t hash_len,
+                                uint8_t *sig,
+                                size_t *sig_len,
+                                uint32_t *info) {
+    (void) hashID;
+
+    if (pvkey->curve != CX_CURVE_SECP256K1 || pvkey->d_len != 32 ||
+        (mode & CX_RND_RFC6979) != CX_RND_RFC6979 || hash_len != 32) {
+        return CX_INVALID_PARAMETER;
+    }
+
+    // (n - 1) / 2
+    static const uint8_t n_half[] = {
+        0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0x5d, 0x57, 0x6e, 0x73, 0x57, 0xa4, 0x50, 0x1d, 0xdf, 0xe9, 0x2f, 0x46, 0x68, 0x1b,
+        0x20, 0xa0};
+
+    uint8_t k[32], R[65], r[32], s[32], z[32];
+    rfc6979_nonce(pvkey->d, hash, k);
+
+    cx_err_t err = secp256k1_pubkey(k, R);
+    if (err != CX_OK) {
+        return err;
+    }
+    *info = (R[64] & 1) ? CX_ECCINFO_PARITY_ODD : 0;
+
+    memcpy(r, R + 1, 32);
+    if (memcmp(r, secp256k1_n, 32) >= 0) {
+        *info |= CX_ECCINFO_xGTn;
+        cx_math_modm_no_throw(r, 32, secp256k1_n, 32);
+    }
+
+    // s = k^-1 * (z + r * d) mod n
+    memcpy(z, hash, 32);
+    if (cx_math_modm_no_throw(z, 32, secp256k1_n, 32) != CX_OK ||
+        cx_math_multm_no_throw(s, r, pvkey->d, secp256k1_n, 32) != CX_OK ||
+        cx_math_addm_no_throw(s, s, z, secp256k1_n, 32) != CX_OK ||
+        cx_math_invprimem_no_throw(k, k, secp256k1_n, 32) != CX_OK ||
+        cx_math_multm_no_throw(s, s, k, secp256k1_n, 32) != CX_OK) {
+        explicit_bzero(k, sizeof(k));
+        return CX_INTERNAL_ERROR;
+    }
+    explicit_bzero(k, sizeof(k));
+
+    if (memcmp(s, n_half, 32) > 0) {
+        cx_math_sub_no_throw(s, secp256k1_n, s, 32);
+        *info ^= CX_ECCINFO_PARITY_ODD;
+    }
+
+    *sig_len = cx_ecfp_encode_sig_der(sig, *sig_len, r, 32, s, 32);
+    return *sig_len > 0 ? CX_OK : CX_INVALID_PARAMETER;
+}
+
+// Reads a DER INTEGER that must be positive and at most 32 bytes long, as a 32-byte big-endian
+// number; returns the length of the encoding, or 0 if it is invalid
+static size_t der_read_integer(const uint8_t *in, size_t in_len, uint8_t out[static 32]) {
+    if (in_len < 3 || in[0] != 0x02 || in[1] == 0 || in[1] > 33 || in_len < 2 + (size_t) in[1] ||
+        (in[2] & 0x80) != 0) {
+        return 0;
+    }
+    const uint8_t *v = in + 2;
+    size_t len = in[1];
+    if (len > 1 && v[0] == 0) {
+        v++;
+        len--;
+    }
+    if (len > 32) {
+        return 0;
+    }
+    memset(out, 0, 32);
+    memcpy(out + 32 - len, v, len);
+    return 2 + (size_t) in[1];
+}
+
+bool cx_ecdsa_verify_no_throw(const cx_ecfp_public_key_t *pukey,
+                              const uint8_t *hash,
+                              size_t hash_len,
+                              const uint8_t *sig,
+                              size_t sig_len) {
+    uint8_t r[32], s[32];
+    if (pukey->curve != CX_CURVE_SECP256K1 || pukey->W_len != 65 || hash_len != 32 ||
+        sig_len < 2 || sig[0] != 0x30 || sig[1] != sig_len - 2) {
+        return false;
+    }
+    size_t r_len = der_read_integer(sig + 2, sig_len - 2, r);
+    if (r_len == 0 || der_read_integer(sig + 2 + r_len, sig_len - 2 - r_len, s) !=
+                          sig_len - 2 - r_len) {
+        return false;
+    }
+
+    BN_CTX *ctx = BN_CTX_new();
+    EC_POINT *q = EC_POINT_new(secp256k1_group());
+    BIGNUM *bn_r = BN_bin2bn(r, 32, NULL);
+    BIGNUM *bn_s = BN_bin2bn(s, 32, NULL);
+    BIGNUM *bn_z = BN_bin2bn(hash, 32, NULL);
+    BIGNUM *bn_x = BN_new();
+    const BIGNUM *n = EC_GROUP_get0_order(secp256k1_group());
+
+    // R = (z / s) * G + (r / s) * Q, and the signature is valid if x(R) = r mod n
+    bool valid = false;
+    if (ctx != NULL && q != NULL && bn_r != NULL && bn_s != NULL && bn_z != NULL &&
+        bn_x != NULL && point_read(pukey->W, q, ctx) && !BN_is_zero(bn_r) && !BN_is_zero(bn_s) &&
+        BN_cmp(bn_r, n) < 0 && BN_cmp(bn_s, n) < 0 &&
+        BN_mod_inverse(bn_s, bn_s, n, ctx) != NULL &&
+        BN_mod_mul(bn_z, bn_z, bn_s, n, ctx) == 1 && BN_mod_mul(bn_s, bn_r, bn_s, n, ctx) == 1 &&
+        EC_POINT_mul(secp256k1_group(), q, bn_z, q, bn_s, ctx) == 1 &&
+        !EC_POINT_is_at_infinity(secp256k1_group(), q) &&
+        EC_POINT_get_affine_coordinates(secp256k1_group(), q, bn_x, NULL, ctx) == 1 &&
+        BN_nnmod(bn_x, bn_x, n, ctx) == 1) {
+        valid = BN_cmp(bn_x, bn_r) == 0;
+    }
+
+    BN_free(bn_x);
+    BN_free(bn_z);
+    BN_free(bn_s);
+    BN_free(bn_r);
+    EC_POINT_free(q);
+    BN_CTX_free(ctx);
+    return valid;
+}
+
+/* ----------------------------------------------------------------------- */
+/* -                        Derivations of the OS                        - */
+/* ----------------------------------------------------------------------- */
+
+static const uint8_t *device_seed(void) {
+    static uint8_t seed[64];
+    static bool is_initialized = false;
+    if (!is_initialized) {
+        const char *salt = "mnemonic";
+        PKCS5_PBKDF2_HMAC(SPECULOS_MNEMONIC,
+                          (int) strlen(SPECULOS_MNEMONIC),
+                          (const uint8_t *) salt,
+                          (int) strlen(salt),
+                          2048,
+                          EVP_sha512(),
+                          sizeof(seed),
+                          seed);
+        is_initialized = true;
+    }
+    return seed;
+}
+
+// Derives the private key k and the chain code c at the path from the seed, as in BIP32
+static cx_err_t bip32_derive_node(const uint32_t *path,
+                                  size_t path_len,
+                                  uint8_t k[static 32],
+                                  uint8_t c[static 32]) {
+    uint8_t I[64];
+    const char *key = "Bitcoin seed";
+    cx_hmac_sha512((const uint8_t *) key, strlen(key), device_seed(), 64, I, 64);
+
+    cx_err_t err = CX_OK;
+    for (size_t i = 0; i <= path_len && err == CX_OK; i++) {
+        if (i > 0) {
+            uint8_t data[33 + 4];
+            if (path[i - 1] & 0x80000000) {
+                data[0] = 0x00;
+                memcpy(data + 1, k, 32);
+            } else {
+                uint8_t P[65];
+                if ((err = secp256k1_pubkey(k, P)) != CX_OK) {
+                    break;
+                }
+                data[0] = 0x02 | (P[64] & 1);
+                memcpy(data + 1, P + 1, 32);
+            }
+            store_u32_be(data + 33, path[i - 1]);
+            cx_hmac_sha512(c, 32, data, sizeof(data), I, 64);
+            explicit_bzero(data, sizeof(data));
+
+            if (memcmp(I, secp256k1_n, 32) >= 0) {
+                err = CX_INTERNAL_ERROR;
+                break;
+            }
+            err = cx_math_addm_no_throw(I, I, k, secp256k1_n, 32);
+        }
+        memcpy(k, I, 32);
+        memcpy(c, I + 32, 32);
+    }
+
+    explicit_bzero(I, sizeof(I));
+    return err;
+}
+
+cx_err_t bip32_derive_init_privkey_256(cx_curve_t curve,
+                                       const uint32_t *path,
+                                       size_t path_len,
+                                       cx_ecfp_256_private_key_t *privkey,
+                                       uint8_t *chain_code) {
+    uint8_t k[32], c[32];
+    cx_err_t err = curve == CX_CURVE_SECP256K1 ? bip32_derive_node(path, path_len, k, c)
+                                               : CX_INVALID_PARAMETER;
+    if (err == CX_OK) {
+        err = cx_ecfp_init_private_key_no_throw(curve, k, 32, privkey);
+    }
+    if (err == CX_OK && chain_code != NULL) {
+        memcpy(chain_code, c, 32);
+    }
+    explicit_bzero(k, sizeof(k));
+    return err;
+}
+
+cx_err_t bip32_derive_get_pubkey_256(cx_curve_t curve,
+                                     const uint32_t *path,
+                                     size_t path_len,
+                                     uint8_t raw_pubkey[static 65],
+                                     uint8_t *chain_code,
+                                     cx_md_t hashID) {
+    (void) hashID;
+
+    uint8_t k[32], c[32];
+    cx_err_t err = curve == CX_CURVE_SECP256K1 ? bip32_derive_node(path, path_len, k, c)
+                                               : CX_INVALID_PARAMETER;
+    if (err == CX_OK) {
+        err = secp256k1_pubkey(k, raw_pubkey);
+    }
+    if (err == CX_OK && chain_code != NULL) {
+        memcpy(chain_code, c, 32);
+    }
+    explicit_bzero(k, sizeof(k));
+    return err;
+}
+
+cx_err_t os_derive_bip32_with_seed_no_throw(unsigned int derivation_mode,
+                                            cx_curve_t curve,
+                                            const unsigned int *path,
+                                            unsigned int path_len,
+                                            unsigned char *raw_privkey,
+                                            unsigned char *chain_code,
+                                            unsigned char *seed,
+                                            unsigned int seed_len) {
+    (void) curve;
+    (void) chain_code;
+
+    // only the SLIP-0021 derivation of a single label from the device's seed is needed by the app
+    if (derivation_mode != HDW_SLIP21 || seed != NULL || seed_len != 0) {
+        return CX_INVALID_PARAMETER;
+    }
+
+    uint8_t node[64];
+    const char *key = "Symmetric key seed";
+    cx_hmac_sha512((const uint8_t *) key, strlen(key), device_seed(), 64, node, 64);
+    // the label is already prefixed with the 0x00 byte of SLIP-0021
+    cx_hmac_sha512(node, 32, (const uint8_t *) path, path_len, node, 64);
+    memcpy(raw_privkey, node + 32, 32);
+
+    explicit_bzero(node, sizeof(node));
+    return CX_OK;
+}
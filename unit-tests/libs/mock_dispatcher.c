@@ -0,0 +1,753 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mock_dispatcher.h"
+
+#include "boilerplate/sw.h"
+#include "constants.h"
+#include "common/merkle.h"
+#include "common/varint.h"
+#include "handler/client_commands.h"
+
+#include "sha-256.h"
+
+// Same limit as the Python client for the responses to client commands
+#define MAX_CLIENT_RESPONSE_LEN 255
+
+// The app's responses fit in an APDU
+#define MAX_APP_RESPONSE_LEN 255
+
+typedef struct {
+    uint8_t hash[32];
+    uint8_t *data;
+    size_t len;
+} known_preimage_t;
+
+typedef struct {
+    uint8_t root[32];
+    uint8_t (*leaf_hashes)[32];
+    size_t size;
+} known_tree_t;
+
+static struct {
+    known_preimage_t *preimages;
+    size_t n_preimages;
+
+    known_tree_t *trees;
+    size_t n_trees;
+
+    // elements for CCMD_GET_MORE_ELEMENTS, all of the same length
+    uint8_t *queue;
+    size_t queue_len;  // in bytes
+    size_t queue_pos;
+    size_t queue_element_len;
+
+    uint8_t app_response[MAX_APP_RESPONSE_LEN];
+    size_t app_response_len;
+    uint16_t sw;
+
+    uint8_t final_response[MAX_APP_RESPONSE_LEN];
+    size_t final_response_len;
+    uint16_t final_sw;
+
+    uint8_t client_response[MAX_CLIENT_RESPONSE_LEN];
+
+    // length of the data of the YIELD message deferred to the next client command, or 0
+    size_t deferred_yield_len;
+
+    mock_dispatcher_stats_t stats;
+} G_mock;
+
+/* Merkle trees, computed with the uncounted SHA-256 implementation */
+
+static void combine_hashes(const uint8_t left[static 32],
+                           const uint8_t right[static 32],
+                           uint8_t out[static 32]) {
+    uint8_t preimage[1 + 32 + 32];
+    preimage[0] = 0x01;
+    memcpy(preimage + 1, left, 32);
+    memcpy(preimage + 1 + 32, right, 32);
+    calc_sha_256(out, preimage, sizeof(preimage));
+}
+
+// Number of leaves of the left subtree of a tree with size > 1 leaves
+static size_t left_subtree_size(size_t size) {
+    return (size_t) 1 << (ceil_lg(size) - 1);
+}
+
+static void subtree_root(uint8_t (*leaf_hashes)[32], size_t size, uint8_t out[static 32]) {
+    if (size == 1) {
+        memcpy(out, leaf_hashes[0], 32);
+        return;
+    }
+    size_t mask = left_subtree_size(size);
+    uint8_t left[32], right[32];
+    subtree_root(leaf_hashes, mask, left);
+    subtree_root(leaf_hashes + mask, size - mask, right);
+    combine_hashes(left, right, out);
+}
+
+// Appends the proof of the leaf to out, starting from the sibling of the leaf
+static void prove_leaf(uint8_t (*leaf_hashes)[32],
+                       size_t size,
+                       size_t index,
+                       uint8_t (*out)[32],
+                       size_t *n_out) {
+    if (size == 1) {
+        return;
+    }
+    size_t mask = left_subtree_size(size);
+    if (index < mask) {
+        prove_leaf(leaf_hashes, mask, index, out, n_out);
+        subtree_root(leaf_hashes + mask, size - mask, out[(*n_out)++]);
+    } else {
+        prove_leaf(leaf_hashes + mask, size - mask, index - mask, out, n_out);
+        subtree_root(leaf_hashes, mask, out[(*n_out)++]);
+    }
+}
+
+/* Known preimages and trees */
+
+static const known_preimage_t *find_preimage(const uint8_t hash[static 32]) {
+    for (size_t i = 0; i < G_mock.n_preimages; i++) {
+        if (memcmp(G_mock.preimages[i].hash, hash, 32) == 0) {
+            return &G_mock.preimages[i];
+        }
+    }
+    return NULL;
+}
+
+static const known_tree_t *find_tree(const uint8_t root[static 32]) {
+    for (size_t i = 0; i < G_mock.n_trees; i++) {
+        if (memcmp(G_mock.trees[i].root, root, 32) == 0) {
+            return &G_mock.trees[i];
+        }
+    }
+    return NULL;
+}
+
+// Returns the element of a leaf, that is its preimage without the 0x00 prefix
+static const uint8_t *get_leaf_element(const known_tree_t *tree, size_t index, size_t *len) {
+    const known_preimage_t *preimage = find_preimage(tree->leaf_hashes[index]);
+    if (preimage == NULL || preimage->len == 0) {
+        return NULL;
+    }
+    *len = preimage->len - 1;
+    return preimage->data + 1;
+}
+
+void mock_dispatcher_add_preimage(const uint8_t *preimage, size_t len, uint8_t *hash_out) {
+    uint8_t hash[32];
+    calc_sha_256(hash, preimage, len);
+    if (hash_out != NULL) {
+        memcpy(hash_out, hash, 32);
+    }
+    if (find_preimage(hash) != NULL) {
+        return;
+    }
+
+    G_mock.preimages =
+        realloc(G_mock.preimages, (G_mock.n_preimages + 1) * sizeof(known_preimage_t));
+    known_preimage_t *p = &G_mock.preimages[G_mock.n_preimages++];
+    memcpy(p->hash, hash, 32);
+    p->data = malloc(len > 0 ? len : 1);
+    memcpy(p->data, preimage, len);
+    p->len = len;
+}
+
+void mock_dispatcher_add_merkle_tree(const uint8_t *const elements[],
+                                     const size_t element_lens[],
+                                     size_t n_elements,
+                                     uint8_t root_out[static 32]) {
+    G_mock.trees = realloc(G_mock.trees, (G_mock.n_trees + 1) * sizeof(known_tree_t));
+    known_tree_t *tree = &G_mock.trees[G_mock.n_trees++];
+    tree->size = n_elements;
+    tree->leaf_hashes = malloc((n_elements > 0 ? n_elements : 1) * 32);
+
+    for (size_t i = 0; i < n_elements; i++) {
+        uint8_t *preimage = malloc(element_lens[i] + 1);
+        preimage[0] = 0x00;
+        memcpy(preimage + 1, elements[i], element_lens[i]);
+        mock_dispatcher_add_preimage(preimage, element_lens[i] + 1, tree->leaf_hashes[i]);
+        free(preimage);
+    }
+
+    if (n_elements > 0) {
+        subtree_root(tree->leaf_hashes, n_elements, tree->root);
+    } else {
+        memset(tree->root, 0, 32);
+    }
+    memcpy(root_out, tree->root, 32);
+}
+
+/* Client */
+
+static void queue_reset(size_t element_len) {
+    G_mock.queue_len = 0;
+    G_mock.queue_pos = 0;
+    G_mock.queue_element_len = element_len;
+}
+
+static void queue_push(const uint8_t *data, size_t len) {
+    G_mock.queue = realloc(G_mock.queue, G_mock.queue_len + len);
+    memcpy(G_mock.queue + G_mock.queue_len, data, len);
+    G_mock.queue_len += len;
+}
+
+static bool queue_is_empty(void) {
+    return G_mock.queue_pos == G_mock.queue_len;
+}
+
+// Writes <total_len : varint> <partial_len : 1> <data : partial_len>, and queues the remaining
+// bytes of the data as 1-byte elements
+static int respond_with_stream(const uint8_t *data, size_t len, uint8_t *out) {
+    int pos = varint_write(out, 0, len);
+    size_t payload_len = MAX_CLIENT_RESPONSE_LEN - pos - 1;
+    if (payload_len > len) {
+        payload_len = len;
+    }
+    out[pos++] = (uint8_t) payload_len;
+    memcpy(out + pos, data, payload_len);
+    pos += payload_len;
+
+    queue_reset(1);
+    queue_push(data + payload_len, len - payload_len);
+    return pos;
+}
+
+static int execute_get_preimage(buffer_t *req, uint8_t *out) {
+    uint8_t zero;
+    uint8_t hash[32];
+    if (!buffer_read_u8(req, &zero) || zero != 0 || !buffer_read_bytes(req, hash, 32)) {
+        return -1;
+    }
+    const known_preimage_t *preimage = find_preimage(hash);
+    if (preimage == NULL) {
+        return -1;
+    }
+    return respond_with_stream(preimage->data, preimage->len, out);
+}
+
+static int execute_get_merkle_leaf_proof(buffer_t *req, uint8_t *out) {
+    uint8_t root[32];
+    uint64_t tree_size, leaf_index;
+    if (!buffer_read_bytes(req, root, 32) || !buffer_read_varint(req, &tree_size) ||
+        !buffer_read_varint(req, &leaf_index)) {
+        return -1;
+    }
+    const known_tree_t *tree = find_tree(root);
+    if (tree == NULL || tree->size != tree_size || leaf_index >= tree_size || !queue_is_empty()) {
+        return -1;
+    }
+
+    uint8_t proof[MAX_MERKLE_TREE_DEPTH][32];
+    size_t proof_size = 0;
+    prove_leaf(tree->leaf_hashes, tree->size, leaf_index, proof, &proof_size);
+
+    size_t n_response_elements = (MAX_CLIENT_RESPONSE_LEN - 32 - 1 - 1) / 32;
+    if (n_response_elements > proof_size) {
+        n_response_elements = proof_size;
+    }
+
+    int pos = 0;
+    memcpy(out, tree->leaf_hashes[leaf_index], 32);
+    pos += 32;
+    out[pos++] = (uint8_t) proof_size;
+    out[pos++] = (uint8_t) n_response_elements;
+    memcpy(out + pos, proof, 32 * n_response_elements);
+    pos += 32 * n_response_elements;
+
+    queue_reset(32);
+    queue_push(proof[n_response_elements], 32 * (proof_size - n_response_elements));
+    return pos;
+}
+
+static int execute_get_merkle_leaf_index(buffer_t *req, uint8_t *out) {
+    uint8_t root[32], leaf_hash[32];
+    if (!buffer_read_bytes(req, root, 32) || !buffer_read_bytes(req, leaf_hash, 32)) {
+        return -1;
+    }
+    const known_tree_t *tree = find_tree(root);
+    if (tree == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < tree->size; i++) {
+        if (memcmp(tree->leaf_hashes[i], leaf_hash, 32) == 0) {
+            out[0] = 1;
+            return 1 + varint_write(out, 1, i);
+        }
+    }
+    out[0] = 0;
+    return 1 + varint_write(out, 1, 0);
+}
+
+static int execute_get_merkle_leaf_element(buffer_t *req, uint8_t *out) {
+    uint8_t root[32];
+    uint64_t tree_size, leaf_index;
+    if (!buffer_read_bytes(req, root, 32) || !buffer_read_varint(req, &tree_size) ||
+        !buffer_read_varint(req, &leaf_index)) {
+        return -1;
+    }
+    const known_tree_t *tree = find_tree(root);
+    if (tree == NULL || tree->size != tree_size || leaf_index >= tree_size) {
+        return -1;
+    }
+
+    size_t element_len;
+    const uint8_t *element = get_leaf_element(tree, leaf_index, &element_len);
+    if (element == NULL) {
+        return -1;
+    }
+
+    uint8_t proof[MAX_MERKLE_TREE_DEPTH][32];
+    size_t proof_size = 0;
+    prove_leaf(tree->leaf_hashes, tree->size, leaf_index, proof, &proof_size);
+
+    uint8_t element_len_varint[9];
+    int element_len_varint_len = varint_write(element_len_varint, 0, element_len);
+    size_t response_len = 1 + 1 + 32 * proof_size + element_len_varint_len + element_len;
+    if (response_len > MAX_CLIENT_RESPONSE_LEN) {
+        // does not fit in a single response
+        out[0] = 0;
+        return 1;
+    }
+
+    int pos = 0;
+    out[pos++] = 1;
+    out[pos++] = (uint8_t) proof_size;
+    memcpy(out + pos, proof, 32 * proof_size);
+    pos += 32 * proof_size;
+    memcpy(out + pos, element_len_varint, element_len_varint_len);
+    pos += element_len_varint_len;
+    memcpy(out + pos, element, element_len);
+    pos += element_len;
+    return pos;
+}
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+} byte_vector_t;
+
+static void byte_vector_push(byte_vector_t *v, const uint8_t *data, size_t len) {
+    v->data = realloc(v->data, v->len + len);
+    memcpy(v->data + v->len, data, len);
+    v->len += len;
+}
+
+// Serializes the answer for the range [begin, end) of a subtree, in the same depth-first order in
+// which merkle_compute_range_root consumes it
+static bool prove_subtree_range(const known_tree_t *tree,
+                                size_t offset,
+                                size_t size,
+                                size_t begin,
+                                size_t end,
+                                byte_vector_t *answer) {
+    if (begin >= end) {
+        uint8_t root[32];
+        subtree_root(tree->leaf_hashes + offset, size, root);
+        byte_vector_push(answer, root, 32);
+        return true;
+    }
+
+    if (size == 1) {
+        size_t element_len;
+        const uint8_t *element = get_leaf_element(tree, offset, &element_len);
+        if (element == NULL) {
+            return false;
+        }
+        uint8_t element_len_varint[9];
+        int element_len_varint_len = varint_write(element_len_varint, 0, element_len);
+        byte_vector_push(answer, element_len_varint, element_len_varint_len);
+        byte_vector_push(answer, element, element_len);
+        return true;
+    }
+
+    size_t mask = left_subtree_size(size);
+    return prove_subtree_range(tree, offset, mask, begin, end < mask ? end : mask, answer) &&
+           prove_subtree_range(tree,
+                               offset + mask,
+                               size - mask,
+                               begin > mask ? begin - mask : 0,
+                               end > mask ? end - mask : 0,
+                               answer);
+}
+
+static int execute_get_merkle_leaf_range(buffer_t *req, uint8_t *out) {
+    uint8_t root[32];
+    uint64_t tree_size, begin, n_leaves;
+    if (!buffer_read_bytes(req, root, 32) || !buffer_read_varint(req, &tree_size) ||
+        !buffer_read_varint(req, &begin) || !buffer_read_varint(req, &n_leaves)) {
+        return -1;
+    }
+    const known_tree_t *tree = find_tree(root);
+    if (tree == NULL || tree->size != tree_size || n_leaves == 0 ||
+        begin + n_leaves > tree_size || !queue_is_empty()) {
+        return -1;
+    }
+
+    byte_vector_t answer = {0};
+    if (!prove_subtree_range(tree, 0, tree->size, begin, begin + n_leaves, &answer)) {
+        free(answer.data);
+        return -1;
+    }
+    int pos = respond_with_stream(answer.data, answer.len, out);
+    free(answer.data);
+    return pos;
+}
+
+static int execute_get_merkle_leaf_hashes(buffer_t *req, uint8_t *out) {
+    uint8_t root[32];
+    uint64_t tree_size;
+    if (!buffer_read_bytes(req, root, 32) || !buffer_read_varint(req, &tree_size)) {
+        return -1;
+    }
+    const known_tree_t *tree = find_tree(root);
+    if (tree == NULL || tree->size != tree_size || !queue_is_empty()) {
+        return -1;
+    }
+    return respond_with_stream(tree->leaf_hashes[0], 32 * tree->size, out);
+}
+
+// Serializes the proof of the leaves of a subtree with the given (sorted) indices, in the same
+// depth-first order in which merkle_compute_leaves_root consumes it; the elements of the leaves are
+// only included if with_elements is true
+static bool prove_subtree_leaves(const known_tree_t *tree,
+                                 size_t offset,
+                                 size_t size,
+                                 const size_t *indices,
+                                 size_t n_indices,
+                                 bool with_elements,
+                                 byte_vector_t *answer) {
+    if (n_indices == 0) {
+        uint8_t root[32];
+        subtree_root(tree->leaf_hashes + offset, size, root);
+        byte_vector_push(answer, root, 32);
+        return true;
+    }
+
+    if (size == 1) {
+        if (!with_elements) {
+            return true;
+        }
+        size_t element_len;
+        const uint8_t *element = get_leaf_element(tree, offset, &element_len);
+        if (element == NULL) {
+            return false;
+        }
+        uint8_t element_len_varint[9];
+        int element_len_varint_len = varint_write(element_len_varint, 0, element_len);
+        byte_vector_push(answer, element_len_varint, element_len_varint_len);
+        byte_vector_push(answer, element, element_len);
+        return true;
+    }
+
+    size_t mask = left_subtree_size(size);
+    size_t n_left = 0;
+    while (n_left < n_indices && indices[n_left] < offset + mask) {
+        ++n_left;
+    }
+    return prove_subtree_leaves(tree, offset, mask, indices, n_left, with_elements, answer) &&
+           prove_subtree_leaves(tree,
+                                offset + mask,
+                                size - mask,
+                                indices + n_left,
+                                n_indices - n_left,
+                                with_elements,
+                                answer);
+}
+
+static int execute_get_merkleized_map_values(buffer_t *req, uint8_t *out) {
+    uint8_t keys_root[32], values_root[32];
+    uint64_t size;
+    uint8_t n_keys;
+    if (!buffer_read_bytes(req, keys_root, 32) || !buffer_read_bytes(req, values_root, 32) ||
+        !buffer_read_varint(req, &size) || !buffer_read_u8(req, &n_keys)) {
+        return -1;
+    }
+    const known_tree_t *keys_tree = find_tree(keys_root);
+    const known_tree_t *values_tree = find_tree(values_root);
+    if (keys_tree == NULL || values_tree == NULL || keys_tree->size != size ||
+        values_tree->size != size || !queue_is_empty()) {
+        return -1;
+    }
+
+    byte_vector_t answer = {0};
+    size_t indices[256];
+    size_t n_found = 0;
+    for (size_t i = 0; i < n_keys; i++) {
+        uint8_t key_hash[32];
+        if (!buffer_read_bytes(req, key_hash, 32)) {
+            free(answer.data);
+            return -1;
+        }
+
+        uint8_t found_index[1 + 9] = {0};
+        int found_index_len = 1 + varint_write(found_index, 1, 0);
+        for (size_t j = 0; j < keys_tree->size; j++) {
+            if (memcmp(keys_tree->leaf_hashes[j], key_hash, 32) == 0) {
+                found_index[0] = 1;
+                found_index_len = 1 + varint_write(found_index, 1, j);
+
+                size_t k = n_found++;
+                for (; k > 0 && indices[k - 1] > j; k--) {
+                    indices[k] = indices[k - 1];
+                }
+                indices[k] = j;
+                break;
+            }
+        }
+        byte_vector_push(&answer, found_index, found_index_len);
+    }
+
+    if (n_found > 0 &&
+        (!prove_subtree_leaves(keys_tree, 0, size, indices, n_found, false, &answer) ||
+         !prove_subtree_leaves(values_tree, 0, size, indices, n_found, true, &answer))) {
+        free(answer.data);
+        return -1;
+    }
+    int pos = respond_with_stream(answer.data, answer.len, out);
+    free(answer.data);
+    return pos;
+}
+
+static int execute_get_more_elements(uint8_t *out) {
+    if (queue_is_empty()) {
+        return -1;
+    }
+
+    size_t element_len = G_mock.queue_element_len;
+    size_t pos = 0;
+    while (!queue_is_empty() && pos + 2 + element_len <= MAX_CLIENT_RESPONSE_LEN) {
+        size_t n_elements = 0;
+        size_t group_start = pos;
+        pos += 2;
+        while (!queue_is_empty() && n_elements < 255 &&
+               pos + element_len <= MAX_CLIENT_RESPONSE_LEN) {
+            memcpy(out + pos, G_mock.queue + G_mock.queue_pos, element_len);
+            G_mock.queue_pos += element_len;
+            pos += element_len;
+            ++n_elements;
+        }
+        out[group_start] = (uint8_t) n_elements;
+        out[group_start + 1] = (uint8_t) element_len;
+
+        if (element_len != 1) {
+            break;
+        }
+    }
+    return (int) pos;
+}
+
+static int execute_client_command(const uint8_t *request, size_t request_len, uint8_t *out) {
+    if (request_len == 0) {
+        return -1;
+    }
+
+    buffer_t req = buffer_create((uint8_t *) request + 1, request_len - 1);
+    int ret;
+    switch (request[0]) {
+        case CCMD_YIELD:
+            return 0;
+        case CCMD_GET_PREIMAGE:
+            ret = execute_get_preimage(&req, out);
+            break;
+        case CCMD_GET_MERKLE_LEAF_PROOF:
+            ret = execute_get_merkle_leaf_proof(&req, out);
+            break;
+        case CCMD_GET_MERKLE_LEAF_INDEX:
+            ret = execute_get_merkle_leaf_index(&req, out);
+            break;
+        case CCMD_GET_MERKLE_LEAF_ELEMENT:
+            ret = execute_get_merkle_leaf_element(&req, out);
+            break;
+        case CCMD_GET_MERKLE_LEAF_RANGE:
+            ret = execute_get_merkle_leaf_range(&req, out);
+            break;
+        case CCMD_GET_MERKLEIZED_MAP_VALUES:
+            ret = execute_get_merkleized_map_values(&req, out);
+            break;
+        case CCMD_GET_MERKLE_LEAF_HASHES:
+            ret = execute_get_merkle_leaf_hashes(&req, out);
+            break;
+        case CCMD_HINT_MERKLE_LEAVES:
+            // only a hint, that this client does not need
+            return 0;
+        case CCMD_GET_MORE_ELEMENTS:
+            return request_len == 1 ? execute_get_more_elements(out) : -1;
+        default:
+            printf("Unknown client command: 0x%02x\n", request[0]);
+            return -1;
+    }
+
+    if (ret >= 0 && buffer_can_read(&req, 1)) {
+        return -1;  // the request is longer than expected
+    }
+    return ret;
+}
+
+// The first protocol version whose clients support the client command, as the clients of older
+// versions fail on the commands they do not know
+static uint8_t min_protocol_version(uint8_t ccmd) {
+    switch (ccmd) {
+        case CCMD_GET_MERKLE_LEAF_ELEMENT:
+            return PROTOCOL_VERSION_MERKLE_LEAF_ELEMENT;
+        case CCMD_GET_MERKLE_LEAF_RANGE:
+            return PROTOCOL_VERSION_MERKLE_LEAF_RANGE;
+        case CCMD_HINT_MERKLE_LEAVES:
+            return PROTOCOL_VERSION_HINT_MERKLE_LEAVES;
+        case CCMD_GET_MERKLEIZED_MAP_VALUES:
+            return PROTOCOL_VERSION_MERKLEIZED_MAP_VALUES;
+        case CCMD_GET_MERKLE_LEAF_HASHES:
+            return PROTOCOL_VERSION_MERKLE_LEAF_HASHES;
+        default:
+            return 0;
+    }
+}
+
+/* Dispatcher context */
+
+static void set_ui_dirty(void) {
+}
+
+static void add_to_response(const void *rdata, size_t rdata_len) {
+    if (G_mock.app_response_len + rdata_len > sizeof(G_mock.app_response)) {
+        printf("Response too long\n");
+        abort();
+    }
+    memcpy(G_mock.app_response + G_mock.app_response_len, rdata, rdata_len);
+    G_mock.app_response_len += rdata_len;
+}
+
+static buffer_t get_response_writer(void) {
+    return buffer_create(G_mock.app_response + G_mock.app_response_len,
+                         sizeof(G_mock.app_response) - G_mock.app_response_len);
+}
+
+static void commit_response(const buffer_t *writer) {
+    G_mock.app_response_len += writer->offset;
+}
+
+static void finalize_response(uint16_t sw) {
+    G_mock.sw = sw;
+}
+
+static void send_response(void) {
+    memcpy(G_mock.final_response, G_mock.app_response, G_mock.app_response_len);
+    G_mock.final_response_len = G_mock.app_response_len;
+    G_mock.final_sw = G_mock.sw;
+    G_mock.app_response_len = 0;
+}
+
+static int process_interruption(dispatcher_context_t *dc) {
+    if (G_mock.sw != SW_INTERRUPTED_EXECUTION) {
+        printf("Interruption without SW_INTERRUPTED_EXECUTION\n");
+        return -1;
+    }
+
+    ++G_mock.stats.n_interruptions;
+    if (G_mock.app_response_len > 0) {
+        ++G_mock.stats.n_interruptions_by_ccmd[G_mock.app_response[0]];
+    }
+    G_mock.stats.bytes_to_client += G_mock.app_response_len;
+
+    // the deferred YIELD message is prefixed to this client command, and ignored like a YIELD
+    if (G_mock.deferred_yield_len > 0) {
+        ++G_mock.stats.n_deferred_yields;
+        G_mock.stats.bytes_to_client += 2 + G_mock.deferred_yield_len;
+        G_mock.deferred_yield_len = 0;
+    }
+
+    if (G_mock.app_response_len > 0 &&
+        dc->protocol_version < min_protocol_version(G_mock.app_response[0])) {
+        printf("Client command 0x%02x not supported with protocol version %d\n",
+               G_mock.app_response[0],
+               dc->protocol_version);
+        G_mock.app_response_len = 0;
+        G_mock.sw = 0;
+        return -1;
+    }
+
+    int len = execute_client_command(G_mock.app_response,
+                                     G_mock.app_response_len,
+                                     G_mock.client_response);
+    G_mock.app_response_len = 0;
+    G_mock.sw = 0;
+    if (len < 0) {
+        return -1;
+    }
+
+    G_mock.stats.bytes_from_client += len;
+    dc->read_buffer = buffer_create(G_mock.client_response, len);
+    return 0;
+}
+
+static bool defer_yield(const void *data, size_t data_len) {
+    (void) data;
+    if (G_mock.deferred_yield_len != 0 || data_len == 0 || data_len > MAX_DEFERRED_YIELD_LENGTH) {
+        return false;
+    }
+    G_mock.deferred_yield_len = data_len;
+    return true;
+}
+
+static int flush_deferred_yield(dispatcher_context_t *dc) {
+    if (G_mock.deferred_yield_len == 0) {
+        return 0;
+    }
+    uint8_t cmd = CCMD_YIELD;
+    add_to_response(&cmd, 1);
+    G_mock.stats.bytes_to_client += G_mock.deferred_yield_len;
+    G_mock.deferred_yield_len = 0;
+    finalize_response(SW_INTERRUPTED_EXECUTION);
+    return process_interruption(dc);
+}
+
+void mock_dispatcher_init(dispatcher_context_t *dc) {
+    mock_dispatcher_free();
+
+    dc->read_buffer = buffer_create(NULL, 0);
+    dc->protocol_version = CURRENT_PROTOCOL_VERSION;
+    dc->set_ui_dirty = set_ui_dirty;
+    dc->add_to_response = add_to_response;
+    dc->get_response_writer = get_response_writer;
+    dc->commit_response = commit_response;
+    dc->finalize_response = finalize_response;
+    dc->send_response = send_response;
+    dc->process_interruption = process_interruption;
+    dc->defer_yield = defer_yield;
+    dc->flush_deferred_yield = flush_deferred_yield;
+}
+
+void mock_dispatcher_free(void) {
+    for (size_t i = 0; i < G_mock.n_preimages; i++) {
+        free(G_mock.preimages[i].data);
+    }
+    free(G_mock.preimages);
+    for (size_t i = 0; i < G_mock.n_trees; i++) {
+        free(G_mock.trees[i].leaf_hashes);
+    }
+    free(G_mock.trees);
+    free(G_mock.queue);
+    memset(&G_mock, 0, sizeof(G_mock));
+}
+
+uint16_t mock_dispatcher_get_sw(void) {
+    return G_mock.final_sw;
+}
+
+const uint8_t *mock_dispatcher_get_response(size_t *len) {
+    *len = G_mock.final_response_len;
+    return G_mock.final_response;
+}
+
+const mock_dispatcher_stats_t *mock_dispatcher_get_stats(void) {
+    return &G_mock.stats;
+}
+
+void mock_dispatcher_reset_stats(void) {
+    memset(&G_mock.stats, 0, sizeof(G_mock.stats));
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// Host implementation of the dispatcher context, where the interruptions are answered in-process by
+// a client that knows a set of preimages and Merkle trees, like the ClientCommandInterpreter of the
+// Python client. It allows running the modules that use client commands without Speculos, and
+// counting the interruptions and the bytes exchanged.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "boilerplate/dispatcher.h"
+
+typedef struct {
+    size_t n_interruptions;
+    size_t n_interruptions_by_ccmd[256];
+    size_t bytes_to_client;    // data bytes sent by the app, excluding the status words
+    size_t bytes_from_client;  // data bytes of the responses of the client
+    size_t n_deferred_yields;  // YIELD messages prefixed to another client command
+} mock_dispatcher_stats_t;
+
+/**
+ * Initializes the dispatcher context, and forgets all the known preimages and Merkle trees. The
+ * protocol version is CURRENT_PROTOCOL_VERSION; the client fails on the client commands that the
+ * clients of dc->protocol_version do not support, if it is changed.
+ */
+void mock_dispatcher_init(dispatcher_context_t *dc);
+
+/**
+ * Frees the memory of the known preimages and Merkle trees.
+ */
+void mock_dispatcher_free(void);
+
+/**
+ * Makes the SHA-256 preimage known to the client; the hash is returned in hash_out, if not NULL.
+ */
+void mock_dispatcher_add_preimage(const uint8_t *preimage, size_t len, uint8_t *hash_out);
+
+/**
+ * Makes the Merkle tree of the given elements known to the client, and returns its root in
+ * root_out. The preimages of the leaves are also added.
+ */
+void mock_dispatcher_add_merkle_tree(const uint8_t *const elements[],
+                                     const size_t element_lens[],
+                                     size_t n_elements,
+                                     uint8_t root_out[static 32]);
+
+/**
+ * Returns the status word of the last response that was not an interruption, or 0 if none.
+ */
+uint16_t mock_dispatcher_get_sw(void);
+
+/**
+ * Returns the data of the last response that was not an interruption.
+ */
+const uint8_t *mock_dispatcher_get_response(size_t *len);
+
+const mock_dispatcher_stats_t *mock_dispatcher_get_stats(void);
+
+void mock_dispatcher_reset_stats(void);
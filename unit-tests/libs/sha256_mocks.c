@@ -0,0 +1,176 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "sha256_mocks.h"
+
+static size_t G_n_compressions;
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static const uint32_t H0[8] = {0x6a09e667,
+                               0xbb67ae85,
+                               0x3c6ef372,
+                               0xa54ff53a,
+                               0x510e527f,
+                               0x9b05688c,
+                               0x1f83d9ab,
+                               0x5be0cd19};
+
+static uint32_t rotr(uint32_t x, unsigned int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+// The accumulator is kept as 8 native 32-bit words in the acc field of the context
+static void compress(cx_sha256_t *ctx, const uint8_t block[static 64]) {
+    uint32_t h[8];
+    memcpy(h, ctx->acc, sizeof(h));
+
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t) block[4 * i] << 24 | (uint32_t) block[4 * i + 1] << 16 |
+               (uint32_t) block[4 * i + 2] << 8 | (uint32_t) block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] +
+                      w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        hh = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += hh;
+    memcpy(ctx->acc, h, sizeof(h));
+
+    ++ctx->header.counter;
+    ++G_n_compressions;
+}
+
+static void sha256_update(cx_sha256_t *ctx, const uint8_t *in, size_t len) {
+    while (len > 0) {
+        size_t n = sizeof(ctx->block) - ctx->blen;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(ctx->block + ctx->blen, in, n);
+        ctx->blen += n;
+        in += n;
+        len -= n;
+
+        if (ctx->blen == sizeof(ctx->block)) {
+            compress(ctx, ctx->block);
+            ctx->blen = 0;
+        }
+    }
+}
+
+static void sha256_final(cx_sha256_t *ctx, uint8_t out[static 32]) {
+    uint64_t bit_len = ((uint64_t) ctx->header.counter * 64 + ctx->blen) * 8;
+
+    uint8_t padding[64 + 8] = {0x80};
+    size_t padding_len = (ctx->blen < 56 ? 56 : 120) - ctx->blen;
+    for (int i = 0; i < 8; i++) {
+        padding[padding_len + i] = (uint8_t) (bit_len >> (56 - 8 * i));
+    }
+    sha256_update(ctx, padding, padding_len + 8);
+
+    uint32_t h[8];
+    memcpy(h, ctx->acc, sizeof(h));
+    for (int i = 0; i < 8; i++) {
+        out[4 * i] = (uint8_t) (h[i] >> 24);
+        out[4 * i + 1] = (uint8_t) (h[i] >> 16);
+        out[4 * i + 2] = (uint8_t) (h[i] >> 8);
+        out[4 * i + 3] = (uint8_t) h[i];
+    }
+}
+
+int cx_sha256_init(cx_sha256_t *hash) {
+    memset(hash, 0, sizeof(*hash));
+    hash->header.algo = CX_SHA256;
+    memcpy(hash->acc, H0, sizeof(H0));
+    return CX_SHA256;
+}
+
+cx_err_t cx_hash_no_throw(cx_hash_t *hash,
+                          uint32_t mode,
+                          const uint8_t *in,
+                          size_t len,
+                          uint8_t *out,
+                          size_t out_len) {
+    if (hash->algo != CX_SHA256) {
+        return 1;
+    }
+
+    cx_sha256_t *ctx = (cx_sha256_t *) hash;
+    sha256_update(ctx, in, len);
+
+    if (mode & CX_LAST) {
+        if (out_len < CX_SHA256_SIZE) {
+            return 1;
+        }
+        // the output can overlap with the context
+        uint8_t digest[CX_SHA256_SIZE];
+        sha256_final(ctx, digest);
+        memcpy(out, digest, sizeof(digest));
+    }
+    return CX_OK;
+}
+
+int cx_hash_sha256(const unsigned char *in,
+                   unsigned int len,
+                   unsigned char *out,
+                   unsigned int out_len) {
+    cx_sha256_t ctx;
+    cx_sha256_init(&ctx);
+    if (cx_hash_no_throw(&ctx.header, CX_LAST, in, len, out, out_len) != CX_OK) {
+        return 0;
+    }
+    return CX_SHA256_SIZE;
+}
+
+cx_err_t cx_sha256_hash_iovec(const cx_iovec_t *iovec,
+                              size_t iovcnt,
+                              uint8_t digest[static CX_SHA256_SIZE]) {
+    cx_sha256_t ctx;
+    cx_sha256_init(&ctx);
+    for (size_t i = 0; i < iovcnt; i++) {
+        sha256_update(&ctx, iovec[i].iov_base, iovec[i].iov_len);
+    }
+    sha256_final(&ctx, digest);
+    return CX_OK;
+}
+
+size_t sha256_mocks_get_n_compressions(void) {
+    return G_n_compressions;
+}
+
+void sha256_mocks_reset_stats(void) {
+    G_n_compressions = 0;
+}
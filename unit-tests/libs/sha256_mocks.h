@@ -0,0 +1,15 @@
+#pragma once
+
+// Host implementation of the SDK's SHA-256 functions used by the Merkle tree modules of the app.
+// Each compression of a 64-byte block is counted, so that tests can check the hashing cost of a
+// command.
+
+#include <stddef.h>
+
+#include "os.h"
+#include "cx.h"
+
+// Number of SHA-256 compressions since the last call to sha256_mocks_reset_stats
+size_t sha256_mocks_get_n_compressions(void);
+
+void sha256_mocks_reset_stats(void);
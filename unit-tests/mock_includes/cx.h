@@ -51,7 +51,7 @@
 
 #include "lcx_sha256.h"
 // #include "lcx_sha3.h"
-// #include "lcx_sha512.h"
+#include "lcx_sha512.h"
 
 // #include "lcx_blake2.h"
 
@@ -61,7 +61,7 @@
 /*                                 HASH MAC                                */
 /* ======================================================================= */
 
-// #include "lcx_hmac.h"
+#include "lcx_hmac.h"
 
 /* ======================================================================= */
 /*                                  PKDF2                                  */
@@ -93,7 +93,7 @@
 
 #include "lcx_ecfp.h"
 
-// #include "lcx_ecdsa.h"
+#include "lcx_ecdsa.h"
 // #include "lcx_ecschnorr.h"
 // #include "lcx_eddsa.h"
 
@@ -113,7 +113,7 @@
 /*                                    MATH                                 */
 /* ======================================================================= */
 
-// #include "lcx_math.h"
+#include "lcx_math.h"
 
 /* ======================================================================= */
 /*                                    DEBUG                                */
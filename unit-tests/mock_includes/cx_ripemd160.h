@@ -0,0 +1,3 @@
+#pragma once
+
+// Included by the app; the declarations that it uses are in cx.h.
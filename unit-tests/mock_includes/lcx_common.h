@@ -98,6 +98,18 @@ typedef uint64_t uint64bits_t;
  */
 #define CX_SIG_MODE (1 << 1)
 
+/** Error code of the *_no_throw functions. */
+typedef uint32_t cx_err_t;
+
+/** Success. */
+#define CX_OK 0x00000000
+/** Internal error. */
+#define CX_INTERNAL_ERROR 0xFFFFFF85
+/** Invalid parameter. */
+#define CX_INVALID_PARAMETER 0xFFFFFF84
+/** The result is the point at infinity. */
+#define CX_EC_INFINITE_POINT 0xFFFFFF41
+
 /*
  * Bit 2:1
  */
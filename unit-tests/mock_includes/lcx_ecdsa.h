@@ -0,0 +1,32 @@
+#ifndef LCX_ECDSA_H
+#define LCX_ECDSA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lcx_ecfp.h"
+#include "lcx_hash.h"
+
+/**
+ * Signs a hash with ECDSA. Only the deterministic nonces of RFC6979
+ * (CX_RND_RFC6979) are supported; the signature is DER-encoded, with a low S.
+ *
+ * @param [out] info CX_ECCINFO_PARITY_ODD if the y-coordinate of R is odd, and
+ *                   CX_ECCINFO_xGTn if its x-coordinate is not smaller than n.
+ */
+cx_err_t cx_ecdsa_sign_no_throw(const cx_ecfp_private_key_t *pvkey,
+                                uint32_t mode, cx_md_t hashID,
+                                const uint8_t *hash, size_t hash_len,
+                                uint8_t *sig, size_t *sig_len, uint32_t *info);
+
+/**
+ * Verifies the DER-encoded ECDSA signature of a hash with the public key.
+ *
+ * @return true if the signature is valid, false otherwise.
+ */
+bool cx_ecdsa_verify_no_throw(const cx_ecfp_public_key_t *pukey,
+                              const uint8_t *hash, size_t hash_len,
+                              const uint8_t *sig, size_t sig_len);
+
+#endif
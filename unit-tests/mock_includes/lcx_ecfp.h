@@ -19,6 +19,10 @@
 #ifndef LCX_ECFP_H
 #define LCX_ECFP_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 /**
  *
  */
@@ -592,4 +596,31 @@ CXCALL int cx_ecfp_generate_pair2(
         PLENGTH(scc__cx_scc_struct_size_ecfp_privkey_from_curve__curve),
     int keepprivate, cx_md_t hashID);
 
+/* The functions of the current SDK, used by the app; they return an error code instead of throwing
+ * an exception. Points are uncompressed. */
+
+cx_err_t cx_ecfp_add_point_no_throw(cx_curve_t curve, uint8_t *R,
+                                    const uint8_t *P, const uint8_t *Q);
+
+cx_err_t cx_ecfp_scalar_mult_no_throw(cx_curve_t curve, uint8_t *P,
+                                      const uint8_t *k, size_t k_len);
+
+cx_err_t cx_ecfp_init_private_key_no_throw(cx_curve_t curve,
+                                           const uint8_t *rawkey,
+                                           size_t key_len,
+                                           cx_ecfp_private_key_t *pvkey);
+
+cx_err_t cx_ecfp_generate_pair_no_throw(cx_curve_t curve,
+                                        cx_ecfp_public_key_t *pubkey,
+                                        cx_ecfp_private_key_t *privkey,
+                                        bool keepprivate);
+
+/**
+ * Encodes the signature (r, s) in DER; the values are big-endian, without
+ * leading zeros required. Returns the length of the signature, or 0 if it does
+ * not fit in sig_len bytes.
+ */
+size_t cx_ecfp_encode_sig_der(uint8_t *sig, size_t sig_len, const uint8_t *r,
+                              size_t r_len, const uint8_t *s, size_t s_len);
+
 #endif
@@ -20,6 +20,8 @@
 #define LCX_HASH_H
 
 #include "os.h"
+#include "lcx_common.h"
+#include <stddef.h>
 #include <stdint.h>
 
 /** Message Digest algorithm identifiers. */
@@ -70,6 +72,20 @@ struct cx_hash_header_s {
 /** Convenience type. See #cx_hash_header_s. */
 typedef struct cx_hash_header_s cx_hash_t;
 
+/**
+ * Input data of a hash computation split in several buffers.
+ */
+typedef struct {
+  const uint8_t *iov_base;
+  size_t iov_len;
+} cx_iovec_t;
+
+/**
+ * Same as cx_hash, returning an error code instead of throwing.
+ */
+cx_err_t cx_hash_no_throw(cx_hash_t *hash, uint32_t mode, const uint8_t *in,
+                          size_t len, uint8_t *out, size_t out_len);
+
 /**
  * Add more data to hash.
  *
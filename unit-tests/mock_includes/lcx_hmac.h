@@ -0,0 +1,23 @@
+#ifndef LCX_HMAC_H
+#define LCX_HMAC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * One shot HMAC-SHA256.
+ *
+ * @return the length of the MAC written to mac.
+ */
+size_t cx_hmac_sha256(const uint8_t *key, size_t key_len, const uint8_t *in,
+                      size_t len, uint8_t *mac, size_t mac_len);
+
+/**
+ * One shot HMAC-SHA512.
+ *
+ * @return the length of the MAC written to mac.
+ */
+size_t cx_hmac_sha512(const uint8_t *key, size_t key_len, const uint8_t *in,
+                      size_t len, uint8_t *mac, size_t mac_len);
+
+#endif
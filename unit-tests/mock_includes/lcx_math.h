@@ -0,0 +1,38 @@
+#ifndef LCX_MATH_H
+#define LCX_MATH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Arithmetic on big-endian unsigned integers of len bytes. The modular
+ * operations expect operands smaller than the modulus m. */
+
+cx_err_t cx_math_cmp_no_throw(const uint8_t *a, const uint8_t *b, size_t len,
+                              int *diff);
+
+cx_err_t cx_math_is_zero_no_throw(const uint8_t *a, size_t len, bool *result);
+
+/* r = a - b, modulo 2^(8 * len) */
+cx_err_t cx_math_sub_no_throw(uint8_t *r, const uint8_t *a, const uint8_t *b,
+                              size_t len);
+
+cx_err_t cx_math_addm_no_throw(uint8_t *r, const uint8_t *a, const uint8_t *b,
+                               const uint8_t *m, size_t len);
+
+cx_err_t cx_math_multm_no_throw(uint8_t *r, const uint8_t *a, const uint8_t *b,
+                                const uint8_t *m, size_t len);
+
+/* v = v mod m */
+cx_err_t cx_math_modm_no_throw(uint8_t *v, size_t len_v, const uint8_t *m,
+                               size_t len_m);
+
+/* r = a^e mod m */
+cx_err_t cx_math_powm_no_throw(uint8_t *r, const uint8_t *a, const uint8_t *e,
+                               size_t len_e, const uint8_t *m, size_t len);
+
+/* r = a^-1 mod m, for a prime m */
+cx_err_t cx_math_invprimem_no_throw(uint8_t *r, const uint8_t *a,
+                                    const uint8_t *m, size_t len);
+
+#endif
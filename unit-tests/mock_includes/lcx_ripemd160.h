@@ -56,4 +56,15 @@ typedef struct cx_ripemd160_s cx_ripemd160_t;
 CXCALL int
 cx_ripemd160_init(cx_ripemd160_t *hash PLENGTH(sizeof(cx_ripemd160_t)));
 
+/**
+ * One shot RIPEMD-160 digest.
+ *
+ * @param [in] in     the data to hash.
+ * @param [in] in_len the length of the data.
+ * @param [out] out   the 20-byte digest.
+ *
+ * @return CX_OK on success.
+ */
+cx_err_t cx_ripemd160_hash(const uint8_t *in, size_t in_len, uint8_t *out);
+
 #endif
@@ -77,4 +77,10 @@ CXCALL int cx_hash_sha256(const unsigned char WIDE *in PLENGTH(len),
                           unsigned int len, unsigned char *out PLENGTH(out_len),
                           unsigned int out_len);
 
+/**
+ * One shot SHA-256 digest of the concatenation of the iovcnt buffers in iovec
+ */
+cx_err_t cx_sha256_hash_iovec(const cx_iovec_t *iovec, size_t iovcnt,
+                              uint8_t digest[static CX_SHA256_SIZE]);
+
 #endif
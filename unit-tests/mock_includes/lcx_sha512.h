@@ -0,0 +1,30 @@
+#ifndef LCX_SHA512_H
+#define LCX_SHA512_H
+
+#include "lcx_hash.h"
+
+/** SHA512 message digest size */
+#define CX_SHA512_SIZE 64
+
+/**
+ * SHA-512 context.
+ */
+struct cx_sha512_s {
+  /** @copydoc cx_ripemd160_s::header */
+  struct cx_hash_header_s header;
+  /** @internal @copydoc cx_ripemd160_s::blen */
+  size_t blen;
+  /** @internal @copydoc cx_ripemd160_s::block */
+  uint8_t block[128];
+  /** @copydoc cx_ripemd160_s::acc */
+  uint8_t acc[8 * 8];
+};
+/** Convenience type. See #cx_sha512_s. */
+typedef struct cx_sha512_s cx_sha512_t;
+
+/**
+ * Initializes a SHA-512 context.
+ */
+cx_err_t cx_sha512_init_no_throw(cx_sha512_t *hash);
+
+#endif
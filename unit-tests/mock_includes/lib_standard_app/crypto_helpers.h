@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cx.h"
+
+/**
+ * Derives the private key and the chain code at the given BIP32 path from the
+ * seed of the device.
+ */
+cx_err_t bip32_derive_init_privkey_256(cx_curve_t curve,
+                                       const uint32_t *path,
+                                       size_t path_len,
+                                       cx_ecfp_256_private_key_t *privkey,
+                                       uint8_t *chain_code);
+
+/**
+ * Derives the uncompressed public key and the chain code at the given BIP32
+ * path from the seed of the device.
+ */
+cx_err_t bip32_derive_get_pubkey_256(cx_curve_t curve,
+                                     const uint32_t *path,
+                                     size_t path_len,
+                                     uint8_t raw_pubkey[static 65],
+                                     uint8_t *chain_code,
+                                     cx_md_t hashID);
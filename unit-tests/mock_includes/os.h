@@ -1193,6 +1193,18 @@ SYSCALL void os_perso_derive_node_with_seed_key(
                                      privateKey, chain, seed_key,              \
                                      seed_key_length)
 
+// Like os_perso_derive_node_with_seed_key, returning an error code instead of
+// throwing; for HDW_SLIP21, path is the label and raw_privkey gets the 32-byte
+// key of the node.
+cx_err_t os_derive_bip32_with_seed_no_throw(unsigned int derivation_mode,
+                                            cx_curve_t curve,
+                                            const unsigned int *path,
+                                            unsigned int path_len,
+                                            unsigned char *raw_privkey,
+                                            unsigned char *chain_code,
+                                            unsigned char *seed,
+                                            unsigned int seed_len);
+
 /**
  * Generate a seed based cookie
  * seed => derivation (path 0xda7aba5e/0xc1a551c5) => priv key =SECP256K1=>
@@ -1376,6 +1388,10 @@ void screen_printc(unsigned char const c);
 // redefined if string.h not included
 int snprintf(char *str, size_t str_size, const char *format, ...);
 
+// on the host, PRINTF can be printf and the assertions are the ones of assert.h
+#include <stdio.h>
+#include "ledger_assert.h"
+
 #ifndef PRINTF
 #define PRINTF(...)
 #endif
@@ -27,8 +27,69 @@ static void test_base58(void **state) {
     assert_string_equal((char *) out2, expected_out2);
 }
 
+static void test_base58_leading_zeros(void **state) {
+    (void) state;
+
+    const uint8_t in[] = {0x00, 0x00, 0x00, 0x01, 0x02, 0x03};
+    const char expected_out[] = "111Ldp";
+    char out[100] = {0};
+    int out_len = base58_encode(in, sizeof(in), out, sizeof(out));
+    assert_int_equal(out_len, strlen(expected_out));
+    assert_string_equal(out, expected_out);
+
+    uint8_t decoded[100] = {0};
+    int decoded_len = base58_decode(out, out_len, decoded, sizeof(decoded));
+    assert_int_equal(decoded_len, sizeof(in));
+    assert_memory_equal(decoded, in, sizeof(in));
+
+    // only zeros
+    const uint8_t zeros[] = {0x00, 0x00};
+    assert_int_equal(base58_encode(zeros, sizeof(zeros), out, sizeof(out)), 2);
+    assert_memory_equal(out, "11", 2);
+    assert_int_equal(base58_decode("11", 2, decoded, sizeof(decoded)), 2);
+    assert_memory_equal(decoded, zeros, sizeof(zeros));
+}
+
+static void test_base58_xpub(void **state) {
+    (void) state;
+
+    const char xpub[] =
+        "tpubDCwYjpDhUdPGP5rS3wgNg13mTrrjBuG8V9VpWbyptX6TRPbNoZVXsoVUSkCjmQ8jJycjuDKBb9eataSymXakTT"
+        "aGifxR6kmVsfFehH1ZgJT";
+    uint8_t decoded[100] = {0};
+    int decoded_len = base58_decode(xpub, sizeof(xpub) - 1, decoded, sizeof(decoded));
+    assert_int_equal(decoded_len, 82);  // 78 bytes of serialized xpub, and 4 bytes of checksum
+    assert_memory_equal(decoded, "\x04\x35\x87\xcf", 4);  // testnet xpub version
+
+    char encoded[120] = {0};
+    int encoded_len = base58_encode(decoded, decoded_len, encoded, sizeof(encoded));
+    assert_int_equal(encoded_len, sizeof(xpub) - 1);
+    assert_memory_equal(encoded, xpub, sizeof(xpub) - 1);
+}
+
+static void test_base58_errors(void **state) {
+    (void) state;
+
+    uint8_t out[100];
+    char out_str[100];
+
+    // invalid characters
+    assert_int_equal(base58_decode("1O", 2, out, sizeof(out)), -1);
+    assert_int_equal(base58_decode("2\xff", 2, out, sizeof(out)), -1);
+    // input too short
+    assert_int_equal(base58_decode("2", 1, out, sizeof(out)), -1);
+    // output buffer too short
+    const char in[] = "USm3fpXnKG5EUBx2ndxBDMPVciP5hGey2Jh4NDv6gmeo1LkMeiKrLJUUBk6Z";
+    assert_int_equal(base58_decode(in, sizeof(in) - 1, out, 43), -1);
+    const uint8_t in2[] = "The quick brown fox jumps over the lazy dog.";
+    assert_int_equal(base58_encode(in2, sizeof(in2) - 1, out_str, 59), -1);
+}
+
 int main() {
-    const struct CMUnitTest tests[] = {cmocka_unit_test(test_base58)};
+    const struct CMUnitTest tests[] = {cmocka_unit_test(test_base58),
+                                       cmocka_unit_test(test_base58_leading_zeros),
+                                       cmocka_unit_test(test_base58_xpub),
+                                       cmocka_unit_test(test_base58_errors)};
 
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
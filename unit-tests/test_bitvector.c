@@ -95,10 +95,84 @@ static void test_bitvector_set(void **state) {
     }
 }
 
+static void test_bitvector_count(void **state) {
+    (void) state;
+
+    uint8_t vec[BITVECTOR_REAL_SIZE(100)];
+    memset(vec, 0xFF, sizeof(vec));
+
+    // the bits after the end of the vector are not counted
+    for (unsigned int n = 0; n <= 100; n++) {
+        assert_int_equal(bitvector_count(vec, n), n);
+    }
+
+    memset(vec, 0, sizeof(vec));
+    bitvector_set(vec, 0, 1);
+    bitvector_set(vec, 31, 1);
+    bitvector_set(vec, 32, 1);
+    bitvector_set(vec, 99, 1);
+    assert_int_equal(bitvector_count(vec, 100), 4);
+    assert_int_equal(bitvector_count(vec, 99), 3);
+    assert_int_equal(bitvector_count(vec, 32), 2);
+}
+
+static void test_bitvector_find_next_set(void **state) {
+    (void) state;
+
+    uint8_t vec[BITVECTOR_REAL_SIZE(131)];
+    memset(vec, 0, sizeof(vec));
+
+    assert_int_equal(bitvector_find_next_set(vec, 131, 0), 131);
+
+    const unsigned int positions[] = {0, 7, 8, 31, 32, 33, 63, 64, 100, 130};
+    for (size_t i = 0; i < sizeof(positions) / sizeof(positions[0]); i++) {
+        bitvector_set(vec, positions[i], 1);
+    }
+
+    // iterating over the bits set returns exactly the positions, in order
+    size_t n_found = 0;
+    for (unsigned int i = bitvector_find_next_set(vec, 131, 0); i < 131;
+         i = bitvector_find_next_set(vec, 131, i + 1)) {
+        assert_true(n_found < sizeof(positions) / sizeof(positions[0]));
+        assert_int_equal(i, positions[n_found]);
+        ++n_found;
+    }
+    assert_int_equal(n_found, sizeof(positions) / sizeof(positions[0]));
+
+    // the bits after the end of the vector are ignored
+    assert_int_equal(bitvector_find_next_set(vec, 130, 101), 130);
+    assert_int_equal(bitvector_find_next_set(vec, 131, 131), 131);
+}
+
+static void test_bitvector_set_range(void **state) {
+    (void) state;
+
+    uint8_t vec[BITVECTOR_REAL_SIZE(70)];
+
+    for (unsigned int begin = 0; begin <= 70; begin++) {
+        for (unsigned int end = begin; end <= 70; end++) {
+            memset(vec, 0, sizeof(vec));
+            bitvector_set_range(vec, begin, end, 1);
+            for (unsigned int i = 0; i < 70; i++) {
+                assert_int_equal(bitvector_get(vec, i), begin <= i && i < end);
+            }
+
+            memset(vec, 0xFF, sizeof(vec));
+            bitvector_set_range(vec, begin, end, 0);
+            for (unsigned int i = 0; i < 70; i++) {
+                assert_int_equal(bitvector_get(vec, i), i < begin || end <= i);
+            }
+        }
+    }
+}
+
 int main() {
     const struct CMUnitTest tests[] = {cmocka_unit_test(test_bitvector_size),
                                        cmocka_unit_test(test_bitvector_get),
-                                       cmocka_unit_test(test_bitvector_set)};
+                                       cmocka_unit_test(test_bitvector_set),
+                                       cmocka_unit_test(test_bitvector_count),
+                                       cmocka_unit_test(test_bitvector_find_next_set),
+                                       cmocka_unit_test(test_bitvector_set_range)};
 
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
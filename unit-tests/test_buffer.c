@@ -348,6 +348,31 @@ static void test_buffer_write(void **state) {
     buffer_seek_end(&buf, 8);
     assert_true(buffer_write_u64(&buf, 0x4242424242424242ULL, BE));          // enough space this time 
 
+    // reset data
+    memcpy(data, template, sizeof(template));
+    buffer_seek_set(&buf, 0);
+
+
+    // TEST buffer_write_varint
+    buffer_seek_set(&buf, 3);
+    assert_true(buffer_write_varint(&buf, 0xfc));
+    assert_int_equal(data[3], 0xfc);
+    assert_int_equal(data[4], 0x04);
+    assert_int_equal(buf.offset, 4);
+    assert_true(buffer_write_varint(&buf, 0x3344));
+    assert_int_equal(data[4], 0xfd);
+    assert_int_equal(data[5], 0x44);
+    assert_int_equal(data[6], 0x33);
+    assert_int_equal(data[7], 0x07);
+    assert_int_equal(buf.offset, 7);
+
+    buffer_seek_end(&buf, 4);
+    assert_false(buffer_write_varint(&buf, 0x42424242));                  // not enough space
+    assert_int_equal(buf.offset, sizeof(data) - 4);                      // offset unchanged on failure
+    assert_int_equal(data[sizeof(data) - 4], template[sizeof(data) - 4]); // shouldn't change data if not enough space
+    buffer_seek_end(&buf, 5);
+    assert_true(buffer_write_varint(&buf, 0x42424242));                   // enough space this time 
+    assert_int_equal(data[sizeof(data) - 5], 0xfe);
 }
 
 static void test_buffer_create(void **state) {
@@ -481,6 +506,29 @@ static void test_buffer_snapshot_restore(void **state) {
     assert_int_equal(buf.size, buf_correct.size);
 }
 
+static void test_buffer_reserve_read(void **state) {
+    (void) state;
+
+    uint8_t data[6] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06};
+    buffer_t buf = buffer_create(data, sizeof(data));
+
+    const uint8_t *ptr = buffer_reserve_read(&buf, 4);
+    assert_ptr_equal(ptr, data);
+    assert_int_equal(buf.offset, 4);
+
+    // not enough bytes left: the buffer is not advanced
+    assert_ptr_equal(buffer_reserve_read(&buf, 3), NULL);
+    assert_int_equal(buf.offset, 4);
+
+    assert_ptr_equal(buffer_reserve_read(&buf, 0), data + 4);
+    assert_ptr_equal(buffer_reserve_read(&buf, 2), data + 4);
+    assert_int_equal(buf.offset, 6);
+
+    assert_ptr_equal(buffer_reserve_read(&buf, 0), data + 6);
+    assert_ptr_equal(buffer_reserve_read(&buf, 1), NULL);
+    assert_ptr_equal(buffer_reserve_read(&buf, SIZE_MAX), NULL);
+    assert_int_equal(buf.offset, 6);
+}
 
 int main() {
     const struct CMUnitTest tests[] = {cmocka_unit_test(test_buffer_can_read),
@@ -493,7 +541,8 @@ int main() {
                                        cmocka_unit_test(test_buffer_create),
                                        cmocka_unit_test(test_buffer_alloc),
                                        cmocka_unit_test(test_buffer_is_cur_aligned),
-                                       cmocka_unit_test(test_buffer_snapshot_restore)};
+                                       cmocka_unit_test(test_buffer_snapshot_restore),
+                                       cmocka_unit_test(test_buffer_reserve_read)};
 
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -0,0 +1,949 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <cmocka.h>
+
+#include "boilerplate/sw.h"
+#include "common/merkle.h"
+#include "handler/client_commands.h"
+#include "handler/lib/cache_slots.h"
+#include "handler/lib/check_merkle_tree_sorted.h"
+#include "handler/lib/get_merkle_leaf_element.h"
+#include "handler/lib/get_merkle_leaf_hash.h"
+#include "handler/lib/get_merkle_leaf_index.h"
+#include "handler/lib/get_merkle_leaf_range.h"
+#include "handler/lib/get_merkleized_map.h"
+#include "handler/lib/get_merkleized_map_value.h"
+#include "handler/lib/get_message_chunks.h"
+#include "handler/lib/get_preimage.h"
+#include "handler/lib/map_contents_cache.h"
+#include "handler/lib/merkle_leaf_table.h"
+#include "handler/lib/merkle_node_cache.h"
+#include "handler/lib/merkleized_map_cache.h"
+
+#include "mock_dispatcher.h"
+#include "sha256_mocks.h"
+
+// The tests check the exact number of interruptions and SHA-256 compressions of each operation, so
+// that any change in the cost of the protocol is noticed; update the expected values if intended.
+
+#define MAX_ELEMENTS 128
+#define MAX_ELEMENT_LEN 1024
+
+static dispatcher_context_t G_dc;
+
+static uint8_t G_elements[MAX_ELEMENTS][MAX_ELEMENT_LEN];
+static const uint8_t *G_element_ptrs[MAX_ELEMENTS];
+static size_t G_element_lens[MAX_ELEMENTS];
+
+static int setup(void **state) {
+    (void) state;
+
+    mock_dispatcher_init(&G_dc);
+    merkle_node_cache_reset();
+    merkle_leaf_table_reset();
+    merkleized_map_cache_reset();
+    map_contents_cache_reset();
+    return 0;
+}
+
+static int teardown(void **state) {
+    (void) state;
+
+    mock_dispatcher_free();
+    return 0;
+}
+
+static void reset_stats(void) {
+    mock_dispatcher_reset_stats();
+    sha256_mocks_reset_stats();
+}
+
+static void print_stats(const char *name) {
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    printf("%s: %zu interruptions, %zu bytes to client, %zu bytes from client, %zu compressions\n",
+           name,
+           stats->n_interruptions,
+           stats->bytes_to_client,
+           stats->bytes_from_client,
+           sha256_mocks_get_n_compressions());
+}
+
+// Adds a tree with n_elements elements of length element_len, with distinct contents
+static void add_tree(size_t n_elements, size_t element_len, uint8_t root[static 32]) {
+    for (size_t i = 0; i < n_elements; i++) {
+        for (size_t j = 0; j < element_len; j++) {
+            G_elements[i][j] = (uint8_t) (i * 31 + j * 7 + 1);
+        }
+        G_element_ptrs[i] = G_elements[i];
+        G_element_lens[i] = element_len;
+    }
+    mock_dispatcher_add_merkle_tree(G_element_ptrs, G_element_lens, n_elements, root);
+}
+
+static void test_get_merkle_leaf_element(void **state) {
+    (void) state;
+
+    uint8_t root[32];
+    add_tree(10, 33, root);
+
+    reset_stats();
+    uint8_t out[MAX_ELEMENT_LEN];
+    assert_int_equal(call_get_merkle_leaf_element(&G_dc, root, 10, 5, out, sizeof(out)), 33);
+    assert_memory_equal(out, G_elements[5], 33);
+    print_stats("get_merkle_leaf_element");
+
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions, 1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_ELEMENT], 1);
+    // leaf hash, and 4 combinations of 2 compressions each
+    assert_int_equal(sha256_mocks_get_n_compressions(), 1 + 4 * 2);
+
+    // the sibling shares the verified ancestors, so only the leaf and its parent are hashed
+    reset_stats();
+    assert_int_equal(call_get_merkle_leaf_element(&G_dc, root, 10, 4, out, sizeof(out)), 33);
+    assert_memory_equal(out, G_elements[4], 33);
+    assert_int_equal(mock_dispatcher_get_stats()->n_interruptions, 1);
+    assert_int_equal(sha256_mocks_get_n_compressions(), 1 + 2);
+}
+
+static void test_get_merkle_leaf_element_long(void **state) {
+    (void) state;
+
+    uint8_t root[32];
+    add_tree(8, 600, root);
+
+    // the element does not fit in a single response: GET_MERKLE_LEAF_ELEMENT, then
+    // GET_MERKLE_LEAF_PROOF, GET_PREIMAGE and 2 GET_MORE_ELEMENTS for the rest of the preimage
+    reset_stats();
+    uint8_t out[MAX_ELEMENT_LEN];
+    assert_int_equal(call_get_merkle_leaf_element(&G_dc, root, 8, 3, out, sizeof(out)), 600);
+    assert_memory_equal(out, G_elements[3], 600);
+    print_stats("get_merkle_leaf_element (600 bytes)");
+
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions, 5);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_ELEMENT], 1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_PROOF], 1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_PREIMAGE], 1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MORE_ELEMENTS], 2);
+}
+
+static void test_get_merkle_leaf_single_leaf(void **state) {
+    (void) state;
+
+    uint8_t root[32];
+    add_tree(1, 40, root);
+
+    // the root is the leaf hash: a single GET_PREIMAGE, and no proof
+    reset_stats();
+    uint8_t out[MAX_ELEMENT_LEN];
+    assert_int_equal(call_get_merkle_leaf_element(&G_dc, root, 1, 0, out, sizeof(out)), 40);
+    assert_memory_equal(out, G_elements[0], 40);
+    print_stats("get_merkle_leaf_element (single leaf)");
+
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions, 1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_PREIMAGE], 1);
+
+    // neither the leaf hash nor its index need any request
+    reset_stats();
+    uint8_t leaf_hash[32];
+    assert_int_equal(call_get_merkle_leaf_hash(&G_dc, root, 1, 0, leaf_hash), 0);
+    assert_memory_equal(leaf_hash, root, 32);
+    assert_int_equal(call_get_merkle_leaf_index(&G_dc, 1, root, leaf_hash), 0);
+    leaf_hash[0] ^= 1;
+    assert_true(call_get_merkle_leaf_index(&G_dc, 1, root, leaf_hash) < 0);
+    assert_int_equal(mock_dispatcher_get_stats()->n_interruptions, 0);
+
+    assert_true(call_get_merkle_leaf_element(&G_dc, root, 1, 1, out, sizeof(out)) < 0);
+}
+
+static void test_merkle_leaf_table(void **state) {
+    (void) state;
+
+    uint8_t root[32];
+    add_tree(6, 20, root);
+    merkle_leaf_table_enable_downloads();
+
+    // the first access only asks for a proof
+    reset_stats();
+    uint8_t leaf_hash[32];
+    assert_int_equal(call_get_merkle_leaf_hash(&G_dc, root, 6, 2, leaf_hash), 0);
+    assert_int_equal(mock_dispatcher_get_stats()->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_PROOF],
+                     1);
+
+    // the second one downloads all the leaf hashes, and recomputes the root with 5 combinations
+    uint8_t expected_hash[32];
+    merkle_compute_element_hash(G_elements[4], 20, expected_hash);
+    reset_stats();
+    assert_int_equal(call_get_merkle_leaf_hash(&G_dc, root, 6, 4, leaf_hash), 0);
+    assert_memory_equal(leaf_hash, expected_hash, 32);
+    print_stats("merkle_leaf_table download");
+
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions, 1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_HASHES], 1);
+    assert_int_equal(sha256_mocks_get_n_compressions(), 5 * 2);
+
+    // the following accesses to the hashes and to the indices are answered without the client
+    reset_stats();
+    merkle_compute_element_hash(G_elements[5], 20, expected_hash);
+    assert_int_equal(call_get_merkle_leaf_hash(&G_dc, root, 6, 5, leaf_hash), 0);
+    assert_memory_equal(leaf_hash, expected_hash, 32);
+    assert_int_equal(call_get_merkle_leaf_index(&G_dc, 6, root, expected_hash), 5);
+    expected_hash[0] ^= 1;
+    assert_true(call_get_merkle_leaf_index(&G_dc, 6, root, expected_hash) < 0);
+    assert_true(call_get_merkle_leaf_hash(&G_dc, root, 6, 6, leaf_hash) < 0);
+    assert_int_equal(stats->n_interruptions, 0);
+
+    // an element only needs its preimage
+    uint8_t out[MAX_ELEMENT_LEN];
+    assert_int_equal(call_get_merkle_leaf_element(&G_dc, root, 6, 1, out, sizeof(out)), 20);
+    assert_memory_equal(out, G_elements[1], 20);
+    assert_int_equal(stats->n_interruptions, 1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_PREIMAGE], 1);
+}
+
+static void test_get_merkle_leaf_index(void **state) {
+    (void) state;
+
+    uint8_t root[32];
+    add_tree(20, 8, root);
+
+    uint8_t leaf_preimage[1 + 8] = {0x00};
+    memcpy(leaf_preimage + 1, G_elements[13], 8);
+    uint8_t leaf_hash[32];
+    mock_dispatcher_add_preimage(leaf_preimage, sizeof(leaf_preimage), leaf_hash);
+
+    reset_stats();
+    assert_int_equal(call_get_merkle_leaf_index(&G_dc, 20, root, leaf_hash), 13);
+    print_stats("get_merkle_leaf_index");
+
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions, 2);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_INDEX], 1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_PROOF], 1);
+}
+
+typedef struct {
+    uint32_t next_leaf_index;
+    bool ok;
+} range_state_t;
+
+static void range_callback(void *state_ptr,
+                           uint32_t leaf_index,
+                           const uint8_t *element,
+                           size_t element_len) {
+    range_state_t *state = (range_state_t *) state_ptr;
+    state->ok = state->ok && leaf_index == state->next_leaf_index &&
+                element_len == G_element_lens[leaf_index] &&
+                memcmp(element, G_elements[leaf_index], element_len) == 0;
+    ++state->next_leaf_index;
+}
+
+static void test_get_merkle_leaf_range(void **state) {
+    (void) state;
+
+    uint8_t root[32];
+    add_tree(100, 33, root);
+
+    reset_stats();
+    uint8_t element[MAX_ELEMENT_LEN];
+    range_state_t range_state = {.next_leaf_index = 0, .ok = true};
+    assert_int_equal(call_get_merkle_leaf_range(&G_dc,
+                                                root,
+                                                100,
+                                                0,
+                                                100,
+                                                element,
+                                                sizeof(element),
+                                                range_callback,
+                                                &range_state),
+                     0);
+    assert_true(range_state.ok);
+    assert_int_equal(range_state.next_leaf_index, 100);
+    print_stats("get_merkle_leaf_range (100 leaves)");
+
+    // 3400 bytes: 251 in the first response, then 253 for each GET_MORE_ELEMENTS
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions, 14);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_RANGE], 1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MORE_ELEMENTS], 13);
+    // 100 leaf hashes, and 99 combinations
+    assert_int_equal(sha256_mocks_get_n_compressions(), 100 + 99 * 2);
+
+    // a partial range also receives the roots of the disjoint subtrees
+    reset_stats();
+    range_state = (range_state_t){.next_leaf_index = 37, .ok = true};
+    assert_int_equal(call_get_merkle_leaf_range(&G_dc,
+                                                root,
+                                                100,
+                                                37,
+                                                42,
+                                                element,
+                                                sizeof(element),
+                                                range_callback,
+                                                &range_state),
+                     0);
+    assert_true(range_state.ok);
+    assert_int_equal(range_state.next_leaf_index, 42);
+    print_stats("get_merkle_leaf_range (5 leaves)");
+    assert_int_equal(mock_dispatcher_get_stats()->n_interruptions, 2);
+}
+
+// crypto.c is not linked in these tests
+int crypto_hash_tee_update(const crypto_hash_tee_t *tee, const void *in, size_t in_len) {
+    for (size_t i = 0; i < tee->n_sinks; i++) {
+        if (crypto_hash_update(tee->sinks[i], in, in_len) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    uint8_t message[MAX_ELEMENTS * MESSAGE_CHUNK_SIZE];
+    size_t next_chunk_index;
+    size_t length;
+    bool ok;
+} message_chunks_state_t;
+
+static void message_chunk_callback(void *state_ptr,
+                                   size_t chunk_index,
+                                   const uint8_t *chunk,
+                                   size_t chunk_len) {
+    message_chunks_state_t *state = (message_chunks_state_t *) state_ptr;
+    state->ok = state->ok && chunk_index == state->next_chunk_index++;
+    memcpy(state->message + state->length, chunk, chunk_len);
+    state->length += chunk_len;
+}
+
+static void test_get_message_chunks(void **state) {
+    (void) state;
+
+    // a message of 500 bytes, in leaves of 3 chunks: 192, 192 and 116 bytes
+    static const size_t leaf_lens[] = {192, 192, 116};
+    uint8_t message[500];
+    for (size_t i = 0; i < sizeof(message); i++) {
+        message[i] = (uint8_t) (i * 13 + 5);
+    }
+    for (size_t i = 0; i < 3; i++) {
+        memcpy(G_elements[i], message + i * 192, leaf_lens[i]);
+        G_element_ptrs[i] = G_elements[i];
+        G_element_lens[i] = leaf_lens[i];
+    }
+    uint8_t root[32];
+    mock_dispatcher_add_merkle_tree(G_element_ptrs, G_element_lens, 3, root);
+
+    cx_sha256_t hash_context;
+    cx_sha256_init(&hash_context);
+    crypto_hash_tee_t digests;
+    crypto_hash_tee_init(&digests);
+    digests.sinks[digests.n_sinks++] = &hash_context.header;
+
+    message_chunks_state_t chunks_state = {.next_chunk_index = 0, .length = 0, .ok = true};
+    message_chunks_t message_chunks = {.merkle_root = root,
+                                       .n_chunks = 8,
+                                       .chunks_per_leaf = 3,
+                                       .message_length = sizeof(message),
+                                       .digests = &digests,
+                                       .callback = message_chunk_callback,
+                                       .callback_state = &chunks_state};
+    reset_stats();
+    assert_int_equal(call_get_message_chunks(&G_dc, &message_chunks), 0);
+    assert_true(chunks_state.ok);
+    assert_int_equal(chunks_state.next_chunk_index, 8);
+    assert_int_equal(chunks_state.length, sizeof(message));
+    assert_memory_equal(chunks_state.message, message, sizeof(message));
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_RANGE], 1);
+
+    uint8_t digest[32];
+    uint8_t expected_digest[32];
+    crypto_hash_digest(&hash_context.header, digest, 32);
+    cx_hash_sha256(message, sizeof(message), expected_digest, 32);
+    assert_memory_equal(digest, expected_digest, 32);
+
+    // the same leaves do not match a message of a different length...
+    message_chunks.message_length = 499;
+    assert_int_equal(call_get_message_chunks(&G_dc, &message_chunks),
+                     MESSAGE_CHUNKS_ERROR_CHUNKING);
+
+    // ...nor a different number of chunks per leaf
+    message_chunks.message_length = sizeof(message);
+    message_chunks.chunks_per_leaf = 2;
+    message_chunks.merkle_root = root;
+    assert_true(call_get_message_chunks(&G_dc, &message_chunks) < 0);
+
+    // without the length, the last chunk of each leaf can be shorter
+    message_chunks.chunks_per_leaf = 3;
+    message_chunks.message_length = 0;
+    message_chunks.digests = NULL;
+    message_chunks.callback = NULL;
+    assert_int_equal(call_get_message_chunks(&G_dc, &message_chunks), 0);
+}
+
+typedef struct {
+    int n_calls;
+    bool ok;
+} sorted_elements_state_t;
+
+// checks that the elements of the tree added by test_check_merkle_tree_sorted are passed in order
+static void sorted_elements_callback(dispatcher_context_t *dc,
+                                     void *state_ptr,
+                                     const merkleized_map_commitment_t *map_commitment,
+                                     int i,
+                                     buffer_t *data) {
+    (void) dc;
+    (void) map_commitment;
+    sorted_elements_state_t *state = (sorted_elements_state_t *) state_ptr;
+
+    if (i != state->n_calls || data->size != G_element_lens[i] ||
+        memcmp(data->ptr, G_elements[i], G_element_lens[i]) != 0) {
+        state->ok = false;
+    }
+    ++state->n_calls;
+}
+
+static void test_check_merkle_tree_sorted(void **state) {
+    (void) state;
+
+    // 8 sorted keys of 34 bytes, like BIP32 derivations; only the first 7 fit in the buffer
+    for (size_t i = 0; i < 8; i++) {
+        G_elements[i][0] = (uint8_t) i;
+        memset(G_elements[i] + 1, 0xAB, 33);
+        G_element_ptrs[i] = G_elements[i];
+        G_element_lens[i] = 34;
+    }
+    uint8_t root[32];
+    mock_dispatcher_add_merkle_tree(G_element_ptrs, G_element_lens, 8, root);
+
+    reset_stats();
+    assert_int_equal(call_check_merkle_tree_sorted(&G_dc, root, 8), 0);
+    print_stats("check_merkle_tree_sorted (8 keys)");
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_RANGE], 1);
+    assert_int_equal(stats->n_interruptions,
+                     1 + stats->n_interruptions_by_ccmd[CCMD_GET_MORE_ELEMENTS]);
+
+    // with a callback, the element that did not fit in the buffer is requested again
+    reset_stats();
+    sorted_elements_state_t callback_state = {.n_calls = 0, .ok = true};
+    assert_int_equal(call_check_merkle_tree_sorted_with_callback(&G_dc,
+                                                                 &callback_state,
+                                                                 root,
+                                                                 8,
+                                                                 sorted_elements_callback,
+                                                                 NULL),
+                     0);
+    print_stats("check_merkle_tree_sorted with callback (8 keys)");
+    assert_true(callback_state.ok);
+    assert_int_equal(callback_state.n_calls, 8);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_RANGE], 1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_ELEMENT], 1);
+
+    // unsorted keys are rejected, and the callback is not called
+    G_element_ptrs[3] = G_elements[4];
+    G_element_ptrs[4] = G_elements[3];
+    mock_dispatcher_add_merkle_tree(G_element_ptrs, G_element_lens, 8, root);
+    callback_state = (sorted_elements_state_t){.n_calls = 0, .ok = true};
+    assert_true(call_check_merkle_tree_sorted_with_callback(&G_dc,
+                                                            &callback_state,
+                                                            root,
+                                                            8,
+                                                            sorted_elements_callback,
+                                                            NULL) < 0);
+    assert_int_equal(callback_state.n_calls, 0);
+}
+
+static void test_get_preimage(void **state) {
+    (void) state;
+
+    uint8_t preimage[1000];
+    for (size_t i = 0; i < sizeof(preimage); i++) {
+        preimage[i] = (uint8_t) (i * 13);
+    }
+    uint8_t hash[32];
+    mock_dispatcher_add_preimage(preimage, sizeof(preimage), hash);
+
+    reset_stats();
+    uint8_t out[sizeof(preimage)];
+    assert_int_equal(call_get_preimage(&G_dc, hash, out, sizeof(out)), sizeof(preimage));
+    assert_memory_equal(out, preimage, sizeof(preimage));
+    print_stats("get_preimage (1000 bytes)");
+
+    // 251 bytes in the first response, then 253 for each GET_MORE_ELEMENTS
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions, 4);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_PREIMAGE], 1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MORE_ELEMENTS], 3);
+}
+
+static void test_unknown_root(void **state) {
+    (void) state;
+
+    uint8_t root[32];
+    add_tree(10, 33, root);
+
+    uint8_t unknown_root[32];
+    memcpy(unknown_root, root, 32);
+    unknown_root[0] ^= 1;
+
+    uint8_t out[MAX_ELEMENT_LEN];
+    assert_true(call_get_merkle_leaf_element(&G_dc, unknown_root, 10, 5, out, sizeof(out)) < 0);
+}
+
+static void test_get_merkleized_map_values(void **state) {
+    (void) state;
+
+    // a map with 8 one-byte keys, and values of different lengths
+    uint8_t keys[8][1];
+    const uint8_t *key_ptrs[8];
+    size_t key_lens[8];
+    for (int i = 0; i < 8; i++) {
+        keys[i][0] = (uint8_t) (2 * i);
+        key_ptrs[i] = keys[i];
+        key_lens[i] = 1;
+    }
+    for (size_t i = 0; i < 8; i++) {
+        for (size_t j = 0; j < 4 + 10 * i; j++) {
+            G_elements[i][j] = (uint8_t) (i * 31 + j * 7 + 1);
+        }
+        G_element_ptrs[i] = G_elements[i];
+        G_element_lens[i] = 4 + 10 * i;
+    }
+
+    merkleized_map_commitment_t map = {.size = 8};
+    mock_dispatcher_add_merkle_tree(key_ptrs, key_lens, 8, map.keys_root);
+    mock_dispatcher_add_merkle_tree(G_element_ptrs, G_element_lens, 8, map.values_root);
+
+    // the keys 0x0C, 0x02 and 0x04 are in the map, 0x05 is not
+    uint8_t outs[4][MAX_ELEMENT_LEN];
+    const uint8_t requested_keys[4] = {0x0C, 0x05, 0x02, 0x04};
+    const int expected_indices[4] = {6, -1, 1, 2};
+    merkleized_map_value_request_t requests[4];
+    for (int i = 0; i < 4; i++) {
+        requests[i] = (merkleized_map_value_request_t){.key = &requested_keys[i],
+                                                       .key_len = 1,
+                                                       .out = outs[i],
+                                                       .out_len = MAX_ELEMENT_LEN};
+    }
+
+    reset_stats();
+    assert_int_equal(call_get_merkleized_map_values(&G_dc, &map, requests, 4), 0);
+    print_stats("get_merkleized_map_values (4 keys)");
+
+    for (int i = 0; i < 4; i++) {
+        int index = expected_indices[i];
+        if (index < 0) {
+            assert_int_equal(requests[i].value_len, -1);
+        } else {
+            assert_int_equal(requests[i].value_len, G_element_lens[index]);
+            assert_memory_equal(outs[i], G_elements[index], G_element_lens[index]);
+        }
+    }
+
+    // a single request, completed with GET_MORE_ELEMENTS
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLEIZED_MAP_VALUES], 1);
+    assert_int_equal(stats->n_interruptions,
+                     1 + stats->n_interruptions_by_ccmd[CCMD_GET_MORE_ELEMENTS]);
+    // the 4 key hashes, the 3 value hashes (the value of 0x0C takes 2 compressions), and 2
+    // compressions for each of the 6 internal nodes on the paths of the leaves, in both trees
+    assert_int_equal(sha256_mocks_get_n_compressions(), 4 + (2 + 1 + 1) + 2 * (6 + 6));
+
+    // a value longer than its buffer is an error
+    requests[0].out_len = G_element_lens[6] - 1;
+    assert_true(call_get_merkleized_map_values(&G_dc, &map, requests, 4) < 0);
+
+    // more keys than fit in a request are split in several requests
+    merkleized_map_value_request_t all_requests[8];
+    uint8_t all_outs[8][MAX_ELEMENT_LEN];
+    for (int i = 0; i < 8; i++) {
+        all_requests[i] = (merkleized_map_value_request_t){.key = keys[7 - i],
+                                                           .key_len = 1,
+                                                           .out = all_outs[i],
+                                                           .out_len = MAX_ELEMENT_LEN};
+    }
+    reset_stats();
+    assert_int_equal(call_get_merkleized_map_values(&G_dc, &map, all_requests, 8), 0);
+    for (int i = 0; i < 8; i++) {
+        assert_int_equal(all_requests[i].value_len, G_element_lens[7 - i]);
+        assert_memory_equal(all_outs[i], G_elements[7 - i], G_element_lens[7 - i]);
+    }
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLEIZED_MAP_VALUES], 2);
+}
+
+// A client of version 1 of the protocol only knows GET_PREIMAGE, GET_MERKLE_LEAF_PROOF and
+// GET_MERKLE_LEAF_INDEX (the mock dispatcher fails on the others): the leaves, the ranges and the
+// values of a map are then requested one by one
+static void test_protocol_version_1(void **state) {
+    (void) state;
+
+    G_dc.protocol_version = 1;
+
+    uint8_t root[32];
+    add_tree(10, 33, root);
+
+    reset_stats();
+    uint8_t out[MAX_ELEMENT_LEN];
+    assert_int_equal(call_get_merkle_leaf_element(&G_dc, root, 10, 5, out, sizeof(out)), 33);
+    assert_memory_equal(out, G_elements[5], 33);
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions, 2);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_PROOF], 1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_PREIMAGE], 1);
+
+    reset_stats();
+    range_state_t range_state = {.next_leaf_index = 2, .ok = true};
+    assert_int_equal(call_get_merkle_leaf_range(&G_dc,
+                                                root,
+                                                10,
+                                                2,
+                                                6,
+                                                out,
+                                                sizeof(out),
+                                                range_callback,
+                                                &range_state),
+                     0);
+    assert_true(range_state.ok);
+    assert_int_equal(range_state.next_leaf_index, 6);
+    // the leaves 2 and 3 share their verified parent with the leaf 5, but they are all requested
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_RANGE], 0);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_PROOF], 4);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_PREIMAGE], 4);
+
+    // a map with the keys 0x00, 0x02, ..., 0x0E
+    uint8_t keys[8][1];
+    const uint8_t *key_ptrs[8];
+    size_t key_lens[8];
+    for (int i = 0; i < 8; i++) {
+        keys[i][0] = (uint8_t) (2 * i);
+        key_ptrs[i] = keys[i];
+        key_lens[i] = 1;
+    }
+    merkleized_map_commitment_t map = {.size = 8};
+    mock_dispatcher_add_merkle_tree(key_ptrs, key_lens, 8, map.keys_root);
+    mock_dispatcher_add_merkle_tree(G_element_ptrs, G_element_lens, 8, map.values_root);
+
+    uint8_t outs[2][MAX_ELEMENT_LEN];
+    const uint8_t requested_keys[2] = {0x0C, 0x05};
+    merkleized_map_value_request_t requests[2];
+    for (int i = 0; i < 2; i++) {
+        requests[i] = (merkleized_map_value_request_t){.key = &requested_keys[i],
+                                                       .key_len = 1,
+                                                       .out = outs[i],
+                                                       .out_len = MAX_ELEMENT_LEN};
+    }
+    reset_stats();
+    assert_int_equal(call_get_merkleized_map_values(&G_dc, &map, requests, 2), 0);
+    assert_int_equal(requests[0].value_len, 33);
+    assert_memory_equal(outs[0], G_elements[6], 33);
+    assert_int_equal(requests[1].value_len, -1);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLEIZED_MAP_VALUES], 0);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_INDEX], 2);
+}
+
+static uint8_t G_values[6][600];
+
+// Adds a map with the keys in G_elements and the values in G_values, and the tree of its commitment
+static void add_map(size_t n_keys,
+                    const size_t *value_lens,
+                    merkleized_map_commitment_t *map,
+                    uint8_t root[static 32]) {
+    const uint8_t *value_ptrs[6];
+    for (size_t i = 0; i < n_keys; i++) {
+        value_ptrs[i] = G_values[i];
+    }
+    map->size = n_keys;
+    mock_dispatcher_add_merkle_tree(G_element_ptrs, G_element_lens, n_keys, map->keys_root);
+    mock_dispatcher_add_merkle_tree(value_ptrs, value_lens, n_keys, map->values_root);
+
+    static uint8_t commitment[9 + 2 * 32];
+    buffer_t buf = buffer_create(commitment, sizeof(commitment));
+    buffer_write_varint(&buf, map->size);
+    buffer_write_bytes(&buf, map->keys_root, 32);
+    buffer_write_bytes(&buf, map->values_root, 32);
+    const uint8_t *commitment_ptr = commitment;
+    size_t commitment_len = buf.offset;
+    mock_dispatcher_add_merkle_tree(&commitment_ptr, &commitment_len, 1, root);
+}
+
+static void test_load_merkleized_map_values(void **state) {
+    (void) state;
+
+    // a map like a PSBT input: the key 0x00 with a large value, then 5 keys of 34 bytes
+    size_t value_lens[6] = {600};
+    G_elements[0][0] = 0x00;
+    G_element_lens[0] = 1;
+    G_element_ptrs[0] = G_elements[0];
+    for (size_t i = 1; i < 6; i++) {
+        G_elements[i][0] = (uint8_t) i;
+        memset(G_elements[i] + 1, 0xAB, 33);
+        G_element_ptrs[i] = G_elements[i];
+        G_element_lens[i] = 34;
+        value_lens[i] = 4 + 10 * i;
+    }
+    for (size_t i = 0; i < 6; i++) {
+        for (size_t j = 0; j < value_lens[i]; j++) {
+            G_values[i][j] = (uint8_t) (i * 31 + j * 7 + 1);
+        }
+    }
+    merkleized_map_commitment_t expected_map;
+    uint8_t root[32];
+    add_map(6, value_lens, &expected_map, root);
+
+    merkleized_map_commitment_t map;
+    sorted_elements_state_t cb_state = {.n_calls = 0, .ok = true};
+    reset_stats();
+    assert_int_equal(call_get_merkleized_map_with_callback(&G_dc,
+                                                           &cb_state,
+                                                           root,
+                                                           1,
+                                                           0,
+                                                           sorted_elements_callback,
+                                                           &map),
+                     0);
+    assert_int_equal(call_load_merkleized_map_values(&G_dc, &map, 1), 0);
+    print_stats("load_merkleized_map_values (6 keys)");
+    assert_true(cb_state.ok);
+    assert_int_equal(cb_state.n_calls, 6);
+    assert_memory_equal(&map, &expected_map, sizeof(map));
+    assert_true(map_contents_cache_has(&map));
+
+    // a range for the keys, and one for the values after the first
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_RANGE], 2);
+
+    // the cached values, and the keys that are not in the map, take no round trip
+    uint8_t outs[6][MAX_ELEMENT_LEN];
+    merkleized_map_value_request_t requests[6];
+    for (int i = 0; i < 5; i++) {
+        requests[i] = (merkleized_map_value_request_t){.key = G_elements[5 - i],
+                                                       .key_len = 34,
+                                                       .out = outs[i],
+                                                       .out_len = MAX_ELEMENT_LEN};
+    }
+    const uint8_t missing_key[1] = {0x07};
+    requests[5] = (merkleized_map_value_request_t){.key = missing_key,
+                                                   .key_len = 1,
+                                                   .out = outs[5],
+                                                   .out_len = MAX_ELEMENT_LEN};
+    reset_stats();
+    assert_int_equal(call_get_merkleized_map_values(&G_dc, &map, requests, 6), 0);
+    assert_int_equal(stats->n_interruptions, 0);
+    for (int i = 0; i < 5; i++) {
+        assert_int_equal(requests[i].value_len, value_lens[5 - i]);
+        assert_memory_equal(outs[i], G_values[5 - i], value_lens[5 - i]);
+    }
+    assert_int_equal(requests[5].value_len, -1);
+
+    // the value before first_value is still fetched from the client
+    const uint8_t first_key[1] = {0x00};
+    assert_int_equal(
+        call_get_merkleized_map_value(&G_dc, &map, first_key, 1, outs[0], MAX_ELEMENT_LEN),
+        value_lens[0]);
+    assert_memory_equal(outs[0], G_values[0], value_lens[0]);
+
+    // reopening the map passes the keys to the callback without fetching them
+    cb_state = (sorted_elements_state_t){.n_calls = 0, .ok = true};
+    reset_stats();
+    assert_int_equal(call_get_merkleized_map_with_callback(&G_dc,
+                                                           &cb_state,
+                                                           root,
+                                                           1,
+                                                           0,
+                                                           sorted_elements_callback,
+                                                           &map),
+                     0);
+    assert_true(cb_state.ok);
+    assert_int_equal(cb_state.n_calls, 6);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_RANGE], 0);
+
+    // a map whose values do not fit in the cache is verified, but not cached
+    for (size_t i = 0; i < 6; i++) {
+        value_lens[i] = 300;
+    }
+    add_map(6, value_lens, &expected_map, root);
+    cb_state = (sorted_elements_state_t){.n_calls = 0, .ok = true};
+    assert_int_equal(call_get_merkleized_map_with_callback(&G_dc,
+                                                           &cb_state,
+                                                           root,
+                                                           1,
+                                                           0,
+                                                           sorted_elements_callback,
+                                                           &map),
+                     0);
+    assert_int_equal(call_load_merkleized_map_values(&G_dc, &map, 0), 0);
+    assert_false(map_contents_cache_has(&map));
+
+    // the values of a map that do not match its commitment are rejected
+    map.values_root[0] ^= 1;
+    map_contents_cache_begin_keys(6);
+    for (int i = 0; i < 6; i++) {
+        uint8_t key_hash[32];
+        merkle_compute_element_hash(G_elements[i], G_element_lens[i], key_hash);
+        map_contents_cache_record_key(i, key_hash, G_elements[i], G_element_lens[i]);
+    }
+    map_contents_cache_end_keys(&map);
+    assert_true(call_load_merkleized_map_values(&G_dc, &map, 1) < 0);
+    assert_false(map_contents_cache_has(&map));
+}
+
+static void test_get_merkleized_maps(void **state) {
+    (void) state;
+
+    // 6 maps, each with i + 1 sorted one-byte keys; their commitments are the leaves of a tree
+    uint8_t keys[6][6][1];
+    const uint8_t *key_ptrs[6];
+    size_t key_lens[6];
+    merkleized_map_commitment_t maps[6];
+    for (int i = 0; i < 6; i++) {
+        for (int j = 0; j <= i; j++) {
+            keys[i][j][0] = (uint8_t) (16 * i + j);
+            key_ptrs[j] = keys[i][j];
+            key_lens[j] = 1;
+        }
+        maps[i].size = i + 1;
+        mock_dispatcher_add_merkle_tree(key_ptrs, key_lens, i + 1, maps[i].keys_root);
+        // the values are not requested
+        memset(maps[i].values_root, i, 32);
+
+        buffer_t buf = buffer_create(G_elements[i], MAX_ELEMENT_LEN);
+        buffer_write_varint(&buf, maps[i].size);
+        buffer_write_bytes(&buf, maps[i].keys_root, 32);
+        buffer_write_bytes(&buf, maps[i].values_root, 32);
+        G_element_ptrs[i] = G_elements[i];
+        G_element_lens[i] = buf.offset;
+    }
+    uint8_t root[32];
+    mock_dispatcher_add_merkle_tree(G_element_ptrs, G_element_lens, 6, root);
+
+    merkleized_map_commitment_t out[4];
+    reset_stats();
+    assert_int_equal(call_get_merkleized_maps(&G_dc, root, 6, 1, 5, out), 0);
+    print_stats("get_merkleized_maps (4 maps)");
+    for (int i = 0; i < 4; i++) {
+        assert_int_equal(out[i].size, maps[i + 1].size);
+        assert_memory_equal(out[i].keys_root, maps[i + 1].keys_root, 32);
+        assert_memory_equal(out[i].values_root, maps[i + 1].values_root, 32);
+    }
+
+    // a single proof for the 4 commitments, and the keys of each map checked with a range
+    const mock_dispatcher_stats_t *stats = mock_dispatcher_get_stats();
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_RANGE], 1 + 4);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_ELEMENT], 0);
+
+    // the keys of the maps are not checked again
+    reset_stats();
+    assert_int_equal(call_get_merkleized_maps(&G_dc, root, 6, 1, 5, out), 0);
+    assert_int_equal(stats->n_interruptions_by_ccmd[CCMD_GET_MERKLE_LEAF_RANGE], 1);
+
+    uint8_t unknown_root[32];
+    memcpy(unknown_root, root, 32);
+    unknown_root[0] ^= 1;
+    assert_true(call_get_merkleized_maps(&G_dc, unknown_root, 6, 1, 5, out) < 0);
+    assert_true(call_get_merkleized_maps(&G_dc, root, 6, 5, 7, out) < 0);
+}
+
+static void test_merkle_leaf_path(void **state) {
+    (void) state;
+
+    for (size_t size = 1; size <= 300; size++) {
+        for (size_t index = 0; index < size; index++) {
+            merkle_leaf_path_t path;
+            assert_int_equal(merkle_get_leaf_path(size, index, &path), 0);
+            assert_int_equal(path.depth, merkle_get_leaf_depth(size, index));
+
+            // walking up from the leaf, as the verification of a proof does; a step goes right if
+            // and only if the subtree it reaches does not start with the same leaf as its parent
+            size_t start = index;
+            for (int i = path.depth - 1; i >= 0; i--) {
+                size_t parent_start = merkle_get_subtree_start(size, index, i);
+                assert_int_equal(merkle_path_direction(&path, i), start != parent_start);
+                assert_int_equal(merkle_get_ith_direction(size, index, i), start != parent_start);
+                start = merkle_path_parent_start(&path, i, start);
+                assert_int_equal(start, parent_start);
+            }
+            assert_int_equal(start, 0);
+        }
+        merkle_leaf_path_t path;
+        assert_int_equal(merkle_get_leaf_path(size, size, &path), -1);
+    }
+
+    // the last leaf of the left subtree of the largest tree supported, at the maximum depth
+    merkle_leaf_path_t path;
+    assert_int_equal(merkle_get_leaf_path(0xFFFFFFFF, 0x7FFFFFFF, &path), 0);
+    assert_int_equal(path.depth, MAX_MERKLE_TREE_DEPTH);
+    assert_int_equal(path.directions, 0xFFFFFFFE);
+}
+
+// With the same root, leaf 2 of a tree of 4 leaves and the parent of leaves 2-3 of a tree of 6 have
+// the same depth and start: a node verified for one size must not be a hit for the other one
+static void test_merkle_node_cache_tree_size(void **state) {
+    (void) state;
+
+    uint8_t root[32], leaf_hash[32], node_hash[32];
+    memset(root, 0x11, sizeof(root));
+    memset(leaf_hash, 0x22, sizeof(leaf_hash));
+    memset(node_hash, 0x33, sizeof(node_hash));
+
+    merkle_node_cache_add_pending(root, 4, 2, 2, leaf_hash);
+    merkle_node_cache_commit_pending();
+    assert_int_equal(merkle_node_cache_check(root, 4, 2, 2, leaf_hash), 1);
+    assert_int_equal(merkle_node_cache_check(root, 4, 2, 2, node_hash), -1);
+
+    // neither accepted nor rejected with the other size: the node must be verified up to the root
+    assert_int_equal(merkle_node_cache_check(root, 6, 2, 2, leaf_hash), 0);
+    assert_int_equal(merkle_node_cache_check(root, 6, 2, 2, node_hash), 0);
+
+    merkle_node_cache_add_pending(root, 6, 2, 2, node_hash);
+    merkle_node_cache_commit_pending();
+    assert_int_equal(merkle_node_cache_check(root, 6, 2, 2, node_hash), 1);
+    assert_int_equal(merkle_node_cache_check(root, 6, 2, 2, leaf_hash), -1);
+    assert_int_equal(merkle_node_cache_check(root, 4, 2, 2, leaf_hash), 1);
+}
+
+static void test_cache_slots(void **state) {
+    (void) state;
+
+    // the entries are filled in order, then the oldest one is replaced
+    cache_slots_t slots = {0};
+    for (uint8_t i = 0; i < 3; i++) {
+        assert_int_equal(cache_slots_take(&slots, 3, PERF_CACHE_MERKLE_NODE), i);
+        assert_int_equal(slots.n_used, i + 1);
+    }
+    for (uint8_t i = 0; i < 7; i++) {
+        assert_int_equal(cache_slots_take(&slots, 3, PERF_CACHE_MERKLE_NODE), i % 3);
+        assert_int_equal(slots.n_used, 3);
+    }
+}
+
+int main() {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_get_merkle_leaf_element, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_get_merkle_leaf_element_long, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_get_merkle_leaf_single_leaf, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_merkle_leaf_table, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_get_merkle_leaf_index, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_get_merkle_leaf_range, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_get_message_chunks, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_check_merkle_tree_sorted, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_get_preimage, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_unknown_root, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_get_merkleized_map_values, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_protocol_version_1, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_get_merkleized_maps, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_load_merkleized_map_values, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_merkle_node_cache_tree_size, setup, teardown),
+        cmocka_unit_test(test_merkle_leaf_path),
+        cmocka_unit_test(test_cache_slots)};
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -7,17 +7,11 @@
 #include <cmocka.h>
 
 #include "../src/crypto.h"
+#include "common/base58.h"
+#include "common/bip32.h"
+#include "lib_standard_app/crypto_helpers.h"
 
 // clang-format off
-// HACK: define empty functions for the expected imports in cx.h and os.h.
-int cx_ecfp_generate_pair ( cx_curve_t curve, cx_ecfp_public_key_t * pubkey, cx_ecfp_private_key_t * privkey, int keepprivate ){return 0;}
-int cx_hash_sha256 ( const unsigned char * in, unsigned int len, unsigned char * out, unsigned int out_len ){return 0;}
-int cx_hash ( cx_hash_t * hash, int mode, const unsigned char * in, unsigned int len, unsigned char * out, unsigned int out_len ){return 0;}
-int cx_ecfp_init_private_key ( cx_curve_t curve, const unsigned char * rawkey, unsigned int key_len, cx_ecfp_private_key_t * pvkey ){return 0;}
-int cx_ripemd160_init ( cx_ripemd160_t * hash ){return 0;}
-void os_memmove(void * dst, const void * src, unsigned int length){}
-void os_perso_derive_node_bip32 ( cx_curve_t curve, const unsigned int * path, unsigned int pathLength, unsigned char * privateKey, unsigned char * chain ){}
-
 const uint8_t uncompressed_key_02[] = {
     0x04,
     0xee,0x86,0x08,0x20,0x7e,0x21,0x02,0x84,0x26,0xf6,0x9e,0x76,0x44,0x7d,0x7e,0x3d,
@@ -104,11 +98,331 @@ static void test_get_compressed_pubkey_invalid(void **state) {
     assert_int_equal(ret, -1);
 }
 
+#define H BIP32_FIRST_HARDENED_CHILD
+
+// The keys are the ones of the seed of speculos, as in the functional tests
+
+static void test_get_master_key_fingerprint(void **state) {
+    (void) state;
+
+    assert_int_equal(crypto_get_master_key_fingerprint(), 0xf5acc2fd);
+}
+
+static void test_get_extended_pubkey_at_path(void **state) {
+    (void) state;
+
+    const uint32_t path[] = {44 ^ H, 1 ^ H, 0 ^ H};
+    serialized_extended_pubkey_check_t pubkey_check;
+    char out[MAX_SERIALIZED_PUBKEY_LENGTH + 1];
+
+    assert_int_equal(
+        get_extended_pubkey_at_path(path, 3, 0x043587CF, &pubkey_check.serialized_extended_pubkey),
+        0);
+
+    crypto_get_checksum((uint8_t *) &pubkey_check.serialized_extended_pubkey,
+                        sizeof(pubkey_check.serialized_extended_pubkey),
+                        pubkey_check.checksum);
+    int len = base58_encode((uint8_t *) &pubkey_check, sizeof(pubkey_check), out, sizeof(out));
+    assert_int_equal(len, 111);
+    out[len] = '\0';
+
+    assert_string_equal(out,
+                        "tpubDCwYjpDhUdPGP5rS3wgNg13mTrrjBuG8V9VpWbyptX6TRPbNoZVXsoVUSkCjmQ8jJ"
+                        "ycjuDKBb9eataSymXakTTaGifxR6kmVsfFehH1ZgJT");
+}
+
+// The unhardened derivation from the extended pubkey gives the same key as the derivation from the
+// seed
+static void test_CKDpub_matches_derivation_from_seed(void **state) {
+    (void) state;
+
+    const uint32_t path[] = {84 ^ H, 1 ^ H, 0 ^ H, 1, 42};
+    serialized_extended_pubkey_t account, change, address, expected;
+
+    assert_int_equal(get_extended_pubkey_at_path(path, 3, 0x043587CF, &account), 0);
+    assert_int_equal(bip32_CKDpub(&account, path[3], &change), 0);
+    assert_int_equal(bip32_CKDpub(&change, path[4], &address), 0);
+
+    assert_int_equal(get_extended_pubkey_at_path(path, 5, 0x043587CF, &expected), 0);
+
+    assert_memory_equal(&address, &expected, sizeof(expected));
+}
+
+// The private keys derived from the cached node of the account are the ones derived from the seed,
+// for paths under the same account, under other accounts, and with a hardened prefix shallower
+// than an account (that is never cached)
+static void test_derive_private_key_matches_derivation_from_seed(void **state) {
+    (void) state;
+
+    const struct {
+        uint32_t path[MAX_BIP32_PATH_STEPS];
+        uint8_t path_len;
+    } paths[] = {
+        {{84 ^ H, 1 ^ H, 0 ^ H, 0, 3}, 5},
+        {{84 ^ H, 1 ^ H, 0 ^ H, 1, 7}, 5},
+        {{84 ^ H, 1 ^ H, 0 ^ H}, 3},
+        {{84 ^ H, 1 ^ H, 1 ^ H, 0, 3}, 5},
+        {{84 ^ H, 1 ^ H, 0 ^ H, 0, 3}, 5},
+        {{48 ^ H, 1 ^ H, 0 ^ H, 2 ^ H, 0, 1}, 6},
+        {{84 ^ H, 1 ^ H, 0, 5}, 4},
+        {{84 ^ H}, 1},
+        {{0, 1}, 2},
+        {{0}, 0},
+        {{84 ^ H, 1 ^ H, 0 ^ H, 0, 3}, 5},
+    };
+
+    crypto_session_cache_reset();
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        cx_ecfp_private_key_t private_key, expected;
+        assert_int_equal(crypto_derive_private_key(paths[i].path, paths[i].path_len, &private_key),
+                         0);
+        assert_int_equal(bip32_derive_init_privkey_256(CX_CURVE_256K1,
+                                                       paths[i].path,
+                                                       paths[i].path_len,
+                                                       &expected,
+                                                       NULL),
+                         CX_OK);
+        assert_memory_equal(private_key.d, expected.d, 32);
+    }
+}
+
+// The keyed HMAC states of bip32_CKDpub are cached per parent chain code: alternating between more
+// parents than the cache holds must still give the keys derived from the seed
+static void test_CKDpub_with_many_parents(void **state) {
+    (void) state;
+
+    enum { N_PARENTS = 2 * CKDPUB_HMAC_CACHE_SIZE + 1 };
+    serialized_extended_pubkey_t parents[N_PARENTS];
+    for (int i = 0; i < N_PARENTS; i++) {
+        const uint32_t path[] = {84 ^ H, 1 ^ H, i ^ H};
+        assert_int_equal(get_extended_pubkey_at_path(path, 3, 0x043587CF, &parents[i]), 0);
+    }
+
+    for (uint32_t index = 0; index < 3; index++) {
+        for (int i = 0; i < N_PARENTS; i++) {
+            const uint32_t path[] = {84 ^ H, 1 ^ H, i ^ H, index};
+            serialized_extended_pubkey_t child, expected;
+            assert_int_equal(bip32_CKDpub(&parents[i], index, &child), 0);
+            assert_int_equal(get_extended_pubkey_at_path(path, 4, 0x043587CF, &expected), 0);
+            assert_memory_equal(&child, &expected, sizeof(expected));
+        }
+    }
+}
+
+// Signatures of the hash made of 32 times the same byte with the key at m/84'/1'/0'/0/0, computed
+// independently as Bitcoin Core does (RFC6979 with the little-endian attempt counter as extra data
+// after the first attempt, low S), with the number of signatures with a high R before the low one
+// clang-format off
+static const struct {
+    uint8_t hash_byte;
+    uint32_t counter;
+    uint8_t sig_len;
+    uint8_t sig[MAX_DER_SIG_LEN];
+} low_r_vectors[] = {
+    {0, 0, 70, {
+        0x30,0x44,0x02,0x20,0x7e,0xcd,0xa8,0xc9,0x0e,0x15,0xb8,0x04,0xd7,0x6e,0xd8,0x96,
+        0x55,0x04,0x4d,0xdf,0xe4,0x22,0x57,0x18,0x2e,0x54,0x29,0xcc,0x0a,0x36,0xf2,0x21,
+        0x6b,0x49,0x42,0x53,0x02,0x20,0x20,0xa4,0xce,0xbc,0xb3,0x63,0x2d,0x2f,0x4c,0xc4,
+        0xdb,0x51,0xfe,0x26,0x6d,0x50,0xb1,0x02,0xa8,0x82,0xa6,0x0c,0x62,0x65,0x5c,0x15,
+        0xc1,0x0a,0xbe,0xd3,0xc4,0x20,
+    }},
+    {5, 1, 70, {
+        0x30,0x44,0x02,0x20,0x46,0x3a,0x79,0xd2,0xc4,0x7d,0x78,0x0a,0x9d,0x68,0x81,0xe3,
+        0x2a,0xf5,0xdd,0xe3,0x6c,0xdb,0x64,0x6e,0x66,0x9c,0xbe,0xd0,0x32,0x74,0x73,0x63,
+        0xa0,0x4f,0x09,0x42,0x02,0x20,0x48,0xee,0x15,0xa0,0x9a,0xbf,0x5b,0xea,0xb8,0x71,
+        0x62,0x33,0xb0,0xb7,0xe4,0xe1,0xc8,0x56,0x70,0x30,0x53,0x83,0xd9,0xa0,0xac,0x36,
+        0x41,0x1f,0x6b,0x52,0x99,0x7b,
+    }},
+    {18, 3, 70, {
+        0x30,0x44,0x02,0x20,0x05,0x82,0x81,0xd9,0xfe,0x84,0x01,0x68,0xcb,0xdc,0x72,0xb2,
+        0xc4,0x01,0xd8,0xdc,0x88,0x12,0xc5,0x1f,0x55,0x39,0xc0,0xb2,0x08,0x47,0xdc,0x07,
+        0x46,0x81,0xda,0xcc,0x02,0x20,0x3b,0x50,0x24,0x98,0x13,0x8a,0x45,0x0c,0xab,0xa6,
+        0x87,0xca,0xb7,0x51,0x92,0x54,0xba,0x6e,0xb6,0x34,0x12,0x2c,0x13,0x18,0xd4,0x97,
+        0x5d,0x3f,0x61,0x4c,0x32,0x1e,
+    }},
+    {10, 4, 69, {
+        0x30,0x43,0x02,0x20,0x13,0x35,0x6d,0x0b,0x81,0x5d,0x78,0x40,0xb0,0x6e,0x24,0xff,
+        0x2e,0x04,0x6c,0x2d,0xe8,0xaa,0xb4,0xf0,0x07,0x27,0xb9,0x6a,0xb5,0x3b,0xbf,0x7c,
+        0x27,0x24,0x3a,0xdc,0x02,0x1f,0x1a,0x05,0x11,0x28,0xec,0xad,0x6e,0x57,0xd6,0x32,
+        0x30,0x20,0x44,0xfc,0x1e,0x68,0xda,0x0e,0x6e,0x9a,0x49,0x72,0x7e,0x0f,0xf5,0x98,
+        0x9f,0x43,0xcc,0x06,0x97,
+    }},
+};
+
+// Signature of the hash of 32 bytes 10 with the same key without grinding, that has a high R
+static const uint8_t high_r_sig[] = {
+    0x30,0x45,0x02,0x21,0x00,0xd4,0xc9,0x14,0x7d,0x60,0xca,0xd2,0x49,0x47,0x85,0xca,
+    0xab,0xf6,0xf4,0x34,0xa2,0x4e,0xbd,0x01,0xdd,0x4d,0x63,0x1e,0xdd,0xa2,0xb1,0xe5,
+    0xe2,0xe6,0x11,0x1b,0x94,0x02,0x20,0x6a,0x89,0x89,0xcb,0xc5,0x16,0x95,0x44,0xae,
+    0xb5,0x28,0x2a,0xe1,0xd8,0x5b,0x51,0x60,0x5b,0xa7,0xc9,0x38,0xf1,0x06,0xd8,0x0f,
+    0x87,0x2b,0x31,0x7f,0x91,0x9c,0x52,
+};
+
+// The compressed pubkey at m/84'/1'/0'/0/0
+static const uint8_t low_r_pubkey[] = {
+    0x02,0x7c,0xb7,0x5d,0x34,0xb0,0x05,0xc4,0xeb,0x9f,0x62,0xbb,0xf2,0xc4,0x57,0xd7,
+    0x63,0x8e,0x81,0x3e,0x75,0x7e,0xfc,0xec,0x8f,0xa6,0x86,0x77,0xd9,0x50,0xb6,0x36,
+    0x62,
+};
+
+// (n - 1)/2 for secp256k1, the largest s of a signature with low S
+static const uint8_t secp256k1_n_half[] = {
+    0x7f,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+    0x5d,0x57,0x6e,0x73,0x57,0xa4,0x50,0x1d,0xdf,0xe9,0x2f,0x46,0x68,0x1b,0x20,0xa0,
+};
+// clang-format on
+
+// Whether the integer of len bytes of a DER encoding is at most (n - 1)/2, that is, a low S
+static bool der_int_is_low(const uint8_t *value, size_t len) {
+    uint8_t padded[32] = {0};
+    if (len > 33 || (len == 33 && value[0] != 0x00)) {
+        return false;
+    }
+    if (len == 33) {
+        value++;
+        len--;
+    }
+    memcpy(padded + 32 - len, value, len);
+    return memcmp(padded, secp256k1_n_half, 32) <= 0;
+}
+
+// With grind_low_r, the signatures are the ones of Bitcoin Core, including when several attempts
+// have a high R, and have both a low R and a low S
+static void test_ecdsa_sign_low_r(void **state) {
+    (void) state;
+
+    const uint32_t path[] = {84 ^ H, 1 ^ H, 0 ^ H, 0, 0};
+    uint8_t hash[32], sig[MAX_DER_SIG_LEN], pubkey[33];
+
+    for (size_t i = 0; i < sizeof(low_r_vectors) / sizeof(low_r_vectors[0]); i++) {
+        memset(hash, low_r_vectors[i].hash_byte, sizeof(hash));
+        int sig_len =
+            crypto_ecdsa_sign_sha256_hash_with_key(path, 5, hash, pubkey, sig, NULL, true);
+        assert_int_equal(sig_len, low_r_vectors[i].sig_len);
+        assert_memory_equal(sig, low_r_vectors[i].sig, sig_len);
+        assert_memory_equal(pubkey, low_r_pubkey, sizeof(pubkey));
+
+        // 0x30 <len> 0x02 <len_r> <r> 0x02 <len_s> <s>
+        uint8_t len_r = sig[3], len_s = sig[5 + len_r];
+        assert_true(len_r <= 32);  // low R: r < 2^255, without the 0x00 padding of DER
+        assert_true(der_int_is_low(sig + 6 + len_r, len_s));
+    }
+
+    // without grinding, the first attempt of the last vector has a high R
+    memset(hash, 10, sizeof(hash));
+    int sig_len = crypto_ecdsa_sign_sha256_hash_with_key(path, 5, hash, NULL, sig, NULL, false);
+    assert_int_equal(sig_len, sizeof(high_r_sig));
+    assert_memory_equal(sig, high_r_sig, sizeof(high_r_sig));
+}
+
+static void test_tr_tweak_pubkey(void **state) {
+    (void) state;
+
+    // from the first scriptPubKey of the wallet test vectors of BIP-0341, without scripts
+    // clang-format off
+    const uint8_t internal_pubkey[] = {
+        0xd6,0x88,0x9c,0xb0,0x81,0x03,0x6e,0x0f,0xae,0xfa,0x3a,0x35,0x15,0x7a,0xd7,0x10,
+        0x86,0xb1,0x23,0xb2,0xb1,0x44,0xb6,0x49,0x79,0x8b,0x49,0x4c,0x30,0x0a,0x96,0x1d
+    };
+    const uint8_t tweaked_pubkey[] = {
+        0x53,0xa1,0xf6,0xe4,0x54,0xdf,0x1a,0xa2,0x77,0x6a,0x28,0x14,0xa7,0x21,0x37,0x2d,
+        0x62,0x58,0x05,0x0d,0xe3,0x30,0xb3,0xc6,0xd1,0x0e,0xe8,0xf4,0xe0,0xdd,0xa3,0x43
+    };
+    // clang-format on
+
+    uint8_t y_parity;
+    uint8_t out[32];
+    assert_int_equal(crypto_tr_tweak_pubkey(internal_pubkey, NULL, 0, &y_parity, out), 0);
+    assert_memory_equal(out, tweaked_pubkey, 32);
+}
+
+// The tagged hashes initialized from the cached midstate are the same as the ones that hash the tag
+static void test_tagged_hash_midstate(void **state) {
+    (void) state;
+
+    const uint8_t tag[] = {'T', 'a', 'p', 'L', 'e', 'a', 'f'};
+    const uint8_t data[] = {0xc0, 0x01, 0x51};
+
+    uint8_t expected[32], out[32];
+    cx_sha256_t hash_context;
+
+    crypto_tr_tagged_hash_init(&hash_context, tag, sizeof(tag));
+    assert_int_equal(crypto_hash_update(&hash_context.header, data, sizeof(data)), CX_OK);
+    assert_int_equal(crypto_hash_digest(&hash_context.header, expected, 32), CX_OK);
+
+    for (int i = 0; i < 2; i++) {
+        crypto_tr_tapleaf_hash_init(&hash_context);
+        assert_int_equal(hash_context.header.counter, 1);  // the prefix is a single block
+        assert_int_equal(crypto_hash_update(&hash_context.header, data, sizeof(data)), CX_OK);
+        assert_int_equal(crypto_hash_digest(&hash_context.header, out, 32), CX_OK);
+        assert_memory_equal(out, expected, 32);
+    }
+}
+
+// Each context of a tee has the digest of all the data added with the tee, after its own prefix
+static void test_hash_tee(void **state) {
+    (void) state;
+
+    const uint8_t prefix[] = {0x18, 0x42};
+    const uint8_t data[] = {0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x0a};
+
+    uint8_t expected[2][32], out[32];
+    cx_sha256_t contexts[2];
+
+    cx_sha256_init(&contexts[0]);
+    cx_sha256_init(&contexts[1]);
+    crypto_hash_update(&contexts[1].header, prefix, sizeof(prefix));
+    for (int i = 0; i < 2; i++) {
+        crypto_hash_update(&contexts[i].header, data, sizeof(data));
+        crypto_hash_digest(&contexts[i].header, expected[i], 32);
+    }
+
+    cx_sha256_init(&contexts[0]);
+    cx_sha256_init(&contexts[1]);
+    crypto_hash_update(&contexts[1].header, prefix, sizeof(prefix));
+
+    crypto_hash_tee_t tee;
+    crypto_hash_tee_init(&tee);
+    assert_true(crypto_hash_tee_add(&tee, &contexts[0].header));
+    assert_true(crypto_hash_tee_add(&tee, &contexts[1].header));
+
+    // the same data, split between a direct update and the buffer of a stream
+    assert_int_equal(crypto_hash_tee_update(&tee, data, 2), CX_OK);
+    uint8_t stream_data[sizeof(data)];
+    memcpy(stream_data, data, sizeof(data));
+    buffer_t buffer = buffer_create(stream_data, sizeof(stream_data));
+    buffer.offset = 2;
+    crypto_hash_tee_update_buffer(&buffer, &tee);
+    assert_int_equal(buffer.offset, 2);
+
+    for (int i = 0; i < 2; i++) {
+        crypto_hash_digest(&contexts[i].header, out, 32);
+        assert_memory_equal(out, expected[i], 32);
+    }
+
+    // no more than CRYPTO_HASH_TEE_MAX_SINKS contexts
+    for (int i = 2; i < CRYPTO_HASH_TEE_MAX_SINKS; i++) {
+        assert_true(crypto_hash_tee_add(&tee, &contexts[0].header));
+    }
+    assert_false(crypto_hash_tee_add(&tee, &contexts[0].header));
+    assert_int_equal(tee.n_sinks, CRYPTO_HASH_TEE_MAX_SINKS);
+}
+
 int main() {
     const struct CMUnitTest tests[] = {cmocka_unit_test(test_get_compressed_pubkey_02),
                                        cmocka_unit_test(test_get_compressed_pubkey_03),
                                        cmocka_unit_test(test_get_compressed_pubkey_in_place),
-                                       cmocka_unit_test(test_get_compressed_pubkey_invalid)};
+                                       cmocka_unit_test(test_get_compressed_pubkey_invalid),
+                                       cmocka_unit_test(test_get_master_key_fingerprint),
+                                       cmocka_unit_test(test_get_extended_pubkey_at_path),
+                                       cmocka_unit_test(test_CKDpub_matches_derivation_from_seed),
+                                       cmocka_unit_test(
+                                           test_derive_private_key_matches_derivation_from_seed),
+                                       cmocka_unit_test(test_CKDpub_with_many_parents),
+                                       cmocka_unit_test(test_ecdsa_sign_low_r),
+                                       cmocka_unit_test(test_tr_tweak_pubkey),
+                                       cmocka_unit_test(test_tagged_hash_midstate),
+                                       cmocka_unit_test(test_hash_tee)};
 
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
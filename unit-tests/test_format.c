@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
 
 #include <cmocka.h>
 
@@ -50,6 +52,49 @@ static void test_format_u64(void **state) {
     assert_false(format_u64(temp, sizeof(temp) - 5, value));
 }
 
+// values around each power of 10, where the number of digits changes, and pseudo-random values
+static uint64_t test_value(int i) {
+    static uint64_t rnd = 0x243F6A8885A308D3ULL;
+    if (i < 3 * 20) {
+        uint64_t p = 1;
+        for (int k = 0; k < i / 3; k++) {
+            p *= 10;
+        }
+        return p + (uint64_t) (i % 3) - 1;  // 10^k - 1, 10^k, 10^k + 1
+    }
+    rnd ^= rnd << 13;
+    rnd ^= rnd >> 7;
+    rnd ^= rnd << 17;
+    return rnd >> (i % 64);
+}
+
+static void test_format_u64_i64_all_lengths(void **state) {
+    (void) state;
+
+    for (int i = 0; i < 100000; i++) {
+        uint64_t value = test_value(i);
+
+        char expected[22], temp[22];
+        int len = snprintf(expected, sizeof(expected), "%" PRIu64, value);
+        assert_true(format_u64(temp, sizeof(temp), value));
+        assert_string_equal(temp, expected);
+
+        // the buffer must have room for the terminating null character
+        assert_true(format_u64(temp, len + 1, value));
+        assert_false(format_u64(temp, len, value));
+
+        len = snprintf(expected, sizeof(expected), "%" PRId64, (int64_t) value);
+        assert_true(format_i64(temp, sizeof(temp), (int64_t) value));
+        assert_string_equal(temp, expected);
+        assert_true(format_i64(temp, len + 1, (int64_t) value));
+        assert_false(format_i64(temp, len, (int64_t) value));
+
+        len = snprintf(expected, sizeof(expected), "%" PRId64, -(int64_t) (value >> 1));
+        assert_true(format_i64(temp, sizeof(temp), -(int64_t) (value >> 1)));
+        assert_string_equal(temp, expected);
+    }
+}
+
 static void test_format_fpu64(void **state) {
     (void) state;
 
@@ -93,11 +138,29 @@ static void test_format_hex(void **state) {
                      format_hex(address, sizeof(address), output, sizeof(output)));
     assert_string_equal(output, "de0b295669a9fd93d5f28d9ec85e40f4cb697bae");
     assert_int_equal(-1, format_hex(address, sizeof(address), output, sizeof(address)));
+
+    uint8_t bytes[256];
+    char bytes_hex[2 * sizeof(bytes) + 1];
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = (uint8_t) i;
+    }
+    assert_int_equal(sizeof(bytes_hex),
+                     format_hex(bytes, sizeof(bytes), bytes_hex, sizeof(bytes_hex)));
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        char expected[3];
+        snprintf(expected, sizeof(expected), "%02x", (unsigned int) i);
+        assert_memory_equal(&bytes_hex[2 * i], expected, 2);
+    }
+    assert_int_equal(bytes_hex[2 * sizeof(bytes)], '\0');
+
+    assert_int_equal(1, format_hex(bytes, 0, bytes_hex, 1));
+    assert_string_equal(bytes_hex, "");
 }
 
 int main() {
     const struct CMUnitTest tests[] = {cmocka_unit_test(test_format_i64),
                                        cmocka_unit_test(test_format_u64),
+                                       cmocka_unit_test(test_format_u64_i64_all_lengths),
                                        cmocka_unit_test(test_format_fpu64),
                                        cmocka_unit_test(test_format_hex)};
 
@@ -307,6 +307,34 @@ static void test_parser_error(void **state) {
     assert_int_equal(parser_state.a, 0xa0a1a2a3);  // a should have been parsed correctly
 }
 
+static void test_dbuffer_reserve_read(void **state) {
+    (void) state;
+
+    uint8_t store[3] = {0x01, 0x02, 0x03};
+    uint8_t stream[4] = {0x04, 0x05, 0x06, 0x07};
+
+    buffer_t store_buf = buffer_create(store, sizeof(store));
+    buffer_t stream_buf = buffer_create(stream, sizeof(stream));
+    buffer_t *buffers[2] = {&store_buf, &stream_buf};
+
+    // bytes in the first buffer
+    assert_ptr_equal(dbuffer_reserve_read(buffers, 2), store);
+
+    // bytes split across the two buffers: nothing is read
+    assert_ptr_equal(dbuffer_reserve_read(buffers, 2), NULL);
+    assert_int_equal(store_buf.offset, 2);
+    assert_int_equal(stream_buf.offset, 0);
+
+    uint8_t out[2];
+    assert_true(dbuffer_read_bytes(buffers, out, 2));
+    assert_int_equal(out[0], 0x03);
+    assert_int_equal(out[1], 0x04);
+
+    // bytes in the second buffer, once the first one is exhausted
+    assert_ptr_equal(dbuffer_reserve_read(buffers, 3), stream + 1);
+    assert_ptr_equal(dbuffer_reserve_read(buffers, 1), NULL);
+}
+
 int main() {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_parser_init_context),
@@ -316,6 +344,7 @@ int main() {
         cmocka_unit_test(test_parser_stream_ends),
         cmocka_unit_test(test_parser_continue_partial),
         cmocka_unit_test(test_parser_error),
+        cmocka_unit_test(test_dbuffer_reserve_read),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
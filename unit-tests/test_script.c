@@ -74,6 +74,61 @@ static void test_get_script_type_valid(void **state) {
     assert_int_equal(get_script_type(unknown2, sizeof(unknown2)), SCRIPT_TYPE_UNKNOWN_SEGWIT);
 }
 
+static void test_get_script_info(void **state) {
+    (void) state;
+
+    // all the bytes that are not checked by the templates are 0x42
+    uint8_t script[84];
+    script_info_t info;
+
+    const struct {
+        uint8_t prefix[3];
+        size_t prefix_len;
+        size_t script_len;
+        int type;
+        uint8_t payload_offset;
+        uint8_t payload_len;
+    } cases[] = {
+        {{OP_DUP, OP_HASH160, 0x14}, 3, 25, SCRIPT_TYPE_P2PKH, 3, 20},
+        {{OP_HASH160, 0x14}, 2, 23, SCRIPT_TYPE_P2SH, 2, 20},
+        {{OP_0, 0x14}, 2, 22, SCRIPT_TYPE_P2WPKH, 2, 20},
+        {{OP_0, 0x20}, 2, 34, SCRIPT_TYPE_P2WSH, 2, 32},
+        {{OP_1, 0x20}, 2, 34, SCRIPT_TYPE_P2TR, 2, 32},
+        {{OP_1, 0x14}, 2, 22, SCRIPT_TYPE_UNKNOWN_SEGWIT, 2, 20},
+        {{OP_16, 40}, 2, 42, SCRIPT_TYPE_UNKNOWN_SEGWIT, 2, 40},
+        {{OP_RETURN}, 1, 1, SCRIPT_TYPE_OPRETURN, 1, 0},
+        {{OP_RETURN}, 1, 83, SCRIPT_TYPE_OPRETURN, 1, 82},
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        memset(script, 0x42, sizeof(script));
+        memcpy(script, cases[i].prefix, cases[i].prefix_len);
+        if (cases[i].type == SCRIPT_TYPE_P2PKH) {
+            script[23] = OP_EQUALVERIFY;
+            script[24] = OP_CHECKSIG;
+        } else if (cases[i].type == SCRIPT_TYPE_P2SH) {
+            script[22] = OP_EQUAL;
+        }
+
+        memset(&info, 0, sizeof(info));
+        assert_int_equal(get_script_info(script, cases[i].script_len, &info), cases[i].type);
+        assert_int_equal(info.type, cases[i].type);
+        assert_int_equal(info.payload_offset, cases[i].payload_offset);
+        assert_int_equal(info.payload_len, cases[i].payload_len);
+
+        // get_script_type agrees, except for OP_RETURN that has no address
+        int expected_type = cases[i].type == SCRIPT_TYPE_OPRETURN ? -1 : cases[i].type;
+        assert_int_equal(get_script_type(script, cases[i].script_len), expected_type);
+    }
+
+    // OP_RETURN scripts longer than 83 bytes, and unknown scripts
+    script[0] = OP_RETURN;
+    assert_int_equal(get_script_info(script, 84, &info), -1);
+    script[0] = OP_NOP;
+    assert_int_equal(get_script_info(script, 22, &info), -1);
+    assert_int_equal(get_script_info(script, 0, &info), -1);
+}
+
 static void test_get_script_type_invalid(void **state) {
     (void) state;
 
@@ -320,6 +375,7 @@ int main() {
         cmocka_unit_test(test_get_push_script_size),
         cmocka_unit_test(test_get_script_type_valid),
         cmocka_unit_test(test_get_script_type_invalid),
+        cmocka_unit_test(test_get_script_info),
         cmocka_unit_test(test_format_opscript_script_valid),
         cmocka_unit_test(test_format_opscript_script_invalid),
     };
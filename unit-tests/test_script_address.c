@@ -0,0 +1,115 @@
+// Tests of the conversions between scripts and addresses of script.c, that need crypto.c for the
+// checksums of the base58check addresses; the addresses are the ones of testnet.
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "common/script.h"
+
+// clang-format off
+static const uint8_t p2pkh_script[] = {
+    0x76, 0xa9, 0x14,
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+    0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14,
+    0x88, 0xac
+};
+static const uint8_t p2sh_script[] = {
+    0xa9, 0x14,
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+    0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14,
+    0x87
+};
+static const uint8_t p2wpkh_script[] = {
+    0x00, 0x14,
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+    0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14
+};
+static const uint8_t p2wsh_script[] = {
+    0x00, 0x20,
+    0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+    0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x40
+};
+static const uint8_t p2tr_script[] = {
+    0x51, 0x20,
+    0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+    0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x40
+};
+// clang-format on
+
+// Checks that get_script_address gives the expected address for the script, and that
+// get_address_script gives the script back
+static void assert_round_trip(const uint8_t *script, size_t script_len, const char *address) {
+    char out_address[MAX_ADDRESS_LENGTH_STR + 1];
+    int address_len = get_script_address(script, script_len, out_address, sizeof(out_address));
+    assert_int_equal(address_len, strlen(address));
+    assert_string_equal(out_address, address);
+
+    uint8_t out_script[MAX_ADDRESS_SCRIPT_LEN];
+    assert_int_equal(get_address_script(address, out_script), script_len);
+    assert_memory_equal(out_script, script, script_len);
+}
+
+static void test_address_script_round_trip(void **state) {
+    (void) state;
+
+    assert_round_trip(p2pkh_script, sizeof(p2pkh_script), "mfcHP2WMCVLsVZA8yrovmhMgxNFW9r98xw");
+    assert_round_trip(p2sh_script, sizeof(p2sh_script), "2MsLZ5FqqYpjM1Q1W4X81zMVZTF9gdbhVwd");
+    assert_round_trip(p2wpkh_script,
+                      sizeof(p2wpkh_script),
+                      "tb1qqypqxpq9qcrsszg2pvxq6rs0zqg3yyc5r7fxez");
+    assert_round_trip(p2wsh_script,
+                      sizeof(p2wsh_script),
+                      "tb1qyy3zxfp9ycnjs2f29vkz6t30xqcnyve5x5mrwwpe8ganc0f78aqq3wux0s");
+    assert_round_trip(p2tr_script,
+                      sizeof(p2tr_script),
+                      "tb1pyy3zxfp9ycnjs2f29vkz6t30xqcnyve5x5mrwwpe8ganc0f78aqqmeu0hv");
+}
+
+static void test_address_script_bip173_vector(void **state) {
+    (void) state;
+
+    // P2WPKH test vector of BIP-173
+    const uint8_t expected[] = {0x00, 0x14, 0x75, 0x1e, 0x76, 0xe8, 0x19, 0x91, 0x96, 0xd4, 0x54,
+                                0x94, 0x1c, 0x45, 0xd1, 0xb3, 0xa3, 0x23, 0xf1, 0x43, 0x3b, 0xd6};
+    uint8_t out[MAX_ADDRESS_SCRIPT_LEN];
+    assert_int_equal(get_address_script("tb1qw508d6qejxtdg4y5r3zarvary0c5xw7kxpjzsx", out),
+                     sizeof(expected));
+    assert_memory_equal(out, expected, sizeof(expected));
+}
+
+static void test_address_script_invalid(void **state) {
+    (void) state;
+
+    uint8_t out[MAX_ADDRESS_SCRIPT_LEN];
+
+    // the P2WPKH address of the round trip, with the prefix of mainnet
+    assert_int_equal(get_address_script("bc1qqypqxpq9qcrsszg2pvxq6rs0zqg3yyc5fcj4z3", out), -1);
+    // the same witness program of version 0, with the checksum of bech32m
+    assert_int_equal(get_address_script("tb1qqypqxpq9qcrsszg2pvxq6rs0zqg3yyc5kze2uq", out), -1);
+    // ... and with the last character of the bech32 checksum changed
+    assert_int_equal(get_address_script("tb1qqypqxpq9qcrsszg2pvxq6rs0zqg3yyc5r7fxeq", out), -1);
+
+    // the P2PKH address of the round trip, with one bit of the checksum changed
+    assert_int_equal(get_address_script("mfcHP2WMCVLsVZA8yrovmhMgxNFW9r98xx", out), -1);
+    // the same hash, with the version of the P2PKH addresses of mainnet
+    assert_int_equal(get_address_script("16L5yRNPTuciSgXGHqYwn9N6NeoKqopAu", out), -1);
+    // the same hash followed by a zero byte, with a valid checksum
+    assert_int_equal(get_address_script("4Q9QjJDeY9i6hs2wLDxr8LH8KMNo1ZrGErVD", out), -1);
+
+    // neither base58 nor bech32
+    assert_int_equal(get_address_script("", out), -1);
+    assert_int_equal(get_address_script("not an address", out), -1);
+}
+
+int main() {
+    const struct CMUnitTest tests[] = {cmocka_unit_test(test_address_script_round_trip),
+                                       cmocka_unit_test(test_address_script_bip173_vector),
+                                       cmocka_unit_test(test_address_script_invalid)};
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
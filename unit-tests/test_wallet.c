@@ -18,6 +18,8 @@ unsigned int pic(unsigned int linked_address) {
 
 #include "common/wallet.h"
 
+#include "sha-256.h"
+
 static int parse_policy(const char *descriptor_template, uint8_t *out, size_t out_size) {
     buffer_t descriptor_template_buf =
         buffer_create((void *) descriptor_template, strlen(descriptor_template));
@@ -321,6 +323,60 @@ static void test_get_policy_segwit_version(void **state) {
     assert(get_policy_segwit_version(policy) == 1);
 }
 
+static void test_get_default_descriptor_template(void **state) {
+    (void) state;
+
+    const char *default_templates[] = {"pkh(@0/**)",
+                                       "sh(wpkh(@0/**))",
+                                       "wpkh(@0/**)",
+                                       "tr(@0/**)"};
+
+    for (size_t i = 0; i < sizeof(default_templates) / sizeof(default_templates[0]); i++) {
+        const char *descriptor_template = default_templates[i];
+        size_t len = strlen(descriptor_template);
+        uint8_t sha256[32];
+        calc_sha_256(sha256, descriptor_template, len);
+
+        // the precompiled descriptor template is the same as the output of the parser
+        uint8_t parsed[MAX_WALLET_POLICY_MEMORY_SIZE] __attribute__((aligned(4))) = {0};
+        uint8_t precompiled[MAX_WALLET_POLICY_MEMORY_SIZE] __attribute__((aligned(4))) = {0};
+        uint8_t template_out[MAX_DESCRIPTOR_TEMPLATE_LENGTH] = {0};
+        int parsed_len = parse_policy(descriptor_template, parsed, sizeof(parsed));
+        int precompiled_len = get_default_descriptor_template(sha256,
+                                                              len,
+                                                              template_out,
+                                                              sizeof(template_out),
+                                                              precompiled,
+                                                              sizeof(precompiled));
+        assert_true(parsed_len > 0);
+        assert_int_equal(precompiled_len, parsed_len);
+        assert_memory_equal(precompiled, parsed, parsed_len);
+        assert_memory_equal(template_out, descriptor_template, len);
+
+        // the length must match as well
+        assert_int_equal(get_default_descriptor_template(sha256,
+                                                         len + 1,
+                                                         template_out,
+                                                         sizeof(template_out),
+                                                         precompiled,
+                                                         sizeof(precompiled)),
+                         -1);
+    }
+
+    // not a default wallet policy
+    uint8_t sha256[32];
+    calc_sha_256(sha256, "wsh(pk(@0/**))", strlen("wsh(pk(@0/**))"));
+    uint8_t out[MAX_WALLET_POLICY_MEMORY_SIZE] __attribute__((aligned(4)));
+    uint8_t template_out[MAX_DESCRIPTOR_TEMPLATE_LENGTH];
+    assert_int_equal(get_default_descriptor_template(sha256,
+                                                     strlen("wsh(pk(@0/**))"),
+                                                     template_out,
+                                                     sizeof(template_out),
+                                                     out,
+                                                     sizeof(out)),
+                     -1);
+}
+
 static void test_failures(void **state) {
     (void) state;
 
@@ -631,6 +687,7 @@ int main() {
         cmocka_unit_test(test_parse_policy_tr),
         cmocka_unit_test(test_parse_policy_tr_multisig),
         cmocka_unit_test(test_get_policy_segwit_version),
+        cmocka_unit_test(test_get_default_descriptor_template),
         cmocka_unit_test(test_failures),
         cmocka_unit_test(test_miniscript_types),
     };